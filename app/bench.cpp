@@ -0,0 +1,94 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "bench.hpp"
+
+#include <iostream>
+
+#include <entwine/builder/codec-bench.hpp>
+#include <entwine/builder/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Bench::addArgs()
+{
+    m_ap.setUsage("entwine bench <path> (<options>)");
+
+    addOutput("Path containing a completed EPT dataset", true);
+    addConfig();
+    addTmp();
+
+    m_ap.add(
+            "--nodes",
+            "Number of nodes to sample, 32 by default\n"
+            "Example: --nodes 64",
+            [this](json j) { m_json["nodes"] = extract(j); });
+
+    m_ap.add(
+            "--types",
+            "Data types to measure, all of them by default\n"
+            "Example: --types laszip zstandard",
+            [this](json j)
+            {
+                if (j.is_array())
+                {
+                    for (const json& entry : j)
+                    {
+                        m_json["types"].push_back(entry);
+                    }
+                }
+                else m_json["types"].push_back(j);
+            });
+
+    m_ap.add(
+            "--storageCost",
+            "Storage cost per GB-month, for estimates, 0.023 by default",
+            [this](json j)
+            {
+                m_json["storageCost"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--egressCost",
+            "Transfer cost per GB, for estimates, 0.09 by default",
+            [this](json j)
+            {
+                m_json["egressCost"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--json",
+            "Also write the results as JSON to this path",
+            [this](json j) { m_json["json"] = j; });
+
+    addArbiter();
+}
+
+void Bench::run()
+{
+    const Config config(m_json);
+    std::cout << "Sampling " << config.output() << "..." << std::endl;
+
+    CodecBench bench(config);
+    const json results(bench.go());
+    CodecBench::print(results);
+
+    if (m_json.count("json"))
+    {
+        arbiter::Arbiter a(m_json.value("arbiter", json()).dump());
+        a.put(m_json.at("json").get<std::string>(), results.dump(2));
+    }
+}
+
+} // namespace app
+} // namespace entwine
@@ -16,6 +16,7 @@
 #include <string>
 
 #include <entwine/builder/builder.hpp>
+#include <entwine/builder/estimator.hpp>
 #include <entwine/builder/thread-pools.hpp>
 #include <entwine/io/io.hpp>
 #include <entwine/types/bounds.hpp>
@@ -51,6 +52,18 @@ void Build::addArgs()
     addTmp();
     addReprojection();
 
+    m_ap.add(
+            "--nativeReprojection",
+            "If set, entwine reprojects coordinates itself in batches rather "
+            "than adding a PDAL reprojection filter to each pipeline.  Only "
+            "applies to pipelines consisting of a single reader.\n"
+            "Example: -r EPSG:26915 EPSG:3857 --nativeReprojection",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["reprojection"]["native"] = true;
+            });
+
     m_ap.add(
             "--threads",
             "-t",
@@ -71,10 +84,18 @@ void Build::addArgs()
     m_ap.add(
             "--dataType",
             "Data type for serialized point cloud data.  Valid values are "
-            "\"laszip\" or \"binary\".  Default: \"laszip\".\n"
+            "\"laszip\", \"binary\", \"zstandard\", \"columnar\", or, if "
+            "built with Zstd, \"zstandard-dictionary\".  "
+            "Default: \"laszip\".\n"
             "Example: --dataType binary",
             [this](json j) { m_json["dataType"] = j; });
 
+    m_ap.add(
+            "--dataPrefixes",
+            "Number of hashed subdirectories over which node data is spread.\n"
+            "Example: --dataPrefixes 256",
+            [this](json j) { m_json["dataPrefixes"] = extract(j); });
+
     m_ap.add(
             "--span",
             "Number of voxels in each spatial dimension for data nodes.  "
@@ -93,6 +114,27 @@ void Build::addArgs()
                 m_json["allowOriginId"] = false;
             });
 
+    m_ap.add(
+            "--keepDims",
+            "Dimensions of the input to store, along with XYZ, omitting all "
+            "others.  May not be combined with --dropDims.\n"
+            "Example: --keepDims Intensity Classification",
+            [this](json j)
+            {
+                if (!j.is_array()) j = json::array({ j });
+                m_json["keepDims"] = j;
+            });
+
+    m_ap.add(
+            "--dropDims",
+            "Dimensions of the input not to store.\n"
+            "Example: --dropDims ScanAngleRank UserData",
+            [this](json j)
+            {
+                if (!j.is_array()) j = json::array({ j });
+                m_json["dropDims"] = j;
+            });
+
     m_ap.add(
             "--bounds",
             "-b",
@@ -135,14 +177,54 @@ void Build::addArgs()
             "Example: --run 20",
             [this](json j) { m_json["run"] = extract(j); });
 
+    m_ap.add(
+            "--sparseAppend",
+            "When adding to an existing index, leave its existing nodes "
+            "untouched and insert new points into new nodes beneath them.",
+            [this](json j) { checkEmpty(j); m_json["sparseAppend"] = true; });
+
+    m_ap.add(
+            "--previewDepth",
+            "Build only the top depths of the tree, discarding points which "
+            "would descend to this depth or beyond.  Continuing a preview "
+            "with a different depth, or 0 for none, indexes every file "
+            "again.\n"
+            "Example: --previewDepth 8",
+            [this](json j) { m_json["previewDepth"] = extract(j); });
+
+    m_ap.add(
+            "--leafDepth",
+            "Depth at which nodes become leaves, which keep every point "
+            "reaching them rather than splitting.\n"
+            "Example: --leafDepth 16",
+            [this](json j) { m_json["leafDepth"] = extract(j); });
+
+    m_ap.add(
+            "--leafPoints",
+            "Maximum number of points a leaf keeps beyond one per voxel, past "
+            "which points are thinned away.  0 (the default) keeps them all.",
+            [this](json j) { m_json["leafPoints"] = extract(j); });
+
+    m_ap.add(
+            "--fileOrder",
+            "Order of file insertion: \"input\" (list order, the default), "
+            "\"spatial\" (along a space-filling curve of file bounds), "
+            "\"largest\" (by descending point count), or "
+            "\"spatial-largest\" (spatially within classes of similar "
+            "point counts, largest first).\n"
+            "Example: --fileOrder spatial",
+            [this](json j) { m_json["fileOrder"] = extract(j); });
+
     m_ap.add(
             "--subset",
             "-s",
-            "A partial task specification for this build.\n"
-            "Example: --subset 1 4",
+            "A partial task specification for this build.  Append "
+            "\"balanced\" to partition by point count for any number of "
+            "subsets.\n"
+            "Example: --subset 1 4, --subset 3 7 balanced",
             [this](json j)
             {
-                if (!j.is_array() || j.size() != 2)
+                if (!j.is_array() || j.size() < 2 || j.size() > 3)
                 {
                     throw std::runtime_error("Invalid subset specification");
                 }
@@ -150,8 +232,24 @@ void Build::addArgs()
                 const uint64_t of(std::stoul(j.at(1).get<std::string>()));
                 m_json["subset"]["id"] = id;
                 m_json["subset"]["of"] = of;
+
+                if (j.size() == 3)
+                {
+                    if (j.at(2).get<std::string>() != "balanced")
+                    {
+                        throw std::runtime_error(
+                                "Invalid subset specification");
+                    }
+                    m_json["subset"]["balanced"] = true;
+                }
             });
 
+    m_ap.add(
+            "--mergeData",
+            "For a subset, a path to which shared-depth nodes are written, "
+            "uncompressed, for the merge rather than to the output.",
+            [this](json j) { m_json["mergeData"] = j.get<std::string>(); });
+
     m_ap.add(
             "--overflowDepth",
             "Depth at which nodes may overflow.",
@@ -175,23 +273,179 @@ void Build::addArgs()
             "output.",
             [this](json j) { m_json["cacheSize"] = extract(j); });
 
+    m_ap.add(
+            "--maxMemory",
+            "Memory budget in bytes for node point data.  If set, unused "
+            "nodes are serialized when over budget rather than by count.",
+            [this](json j) { m_json["maxMemory"] = extract(j); });
+
+    m_ap.add(
+            "--pinDepth",
+            "Depth above which nodes are kept in memory until the end of the "
+            "build.",
+            [this](json j) { m_json["pinDepth"] = extract(j); });
+
+    m_ap.add(
+            "--memoryLimits",
+            "Soft limits in bytes on the memory of each part of the build, "
+            "past which threads release unused nodes sooner.\n"
+            "Example: --memoryLimits '{ \"overflows\": 2147483648 }'",
+            [this](json j)
+            {
+                m_json["memoryLimits"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--estimate",
+            "Rather than building, estimate the memory, tmp disk, node "
+            "counts, and duration of this build by inserting a sample of its "
+            "input files into a throwaway dataset.",
+            [this](json j) { checkEmpty(j); m_json["estimate"] = true; });
+
+    m_ap.add(
+            "--sampleFiles",
+            "Number of input files sampled by --estimate, 4 by default.",
+            [this](json j) { m_json["sampleFiles"] = extract(j); });
+
+    m_ap.add(
+            "--autoTune",
+            "Choose the span, overflow depth, memory budget, cache size, and "
+            "sleep count from the scanned input and this machine, for any of "
+            "them not set explicitly.",
+            [this](json j) { checkEmpty(j); m_json["autoTune"] = true; });
+
+    m_ap.add(
+            "--spill",
+            "Write evicted nodes uncompressed to the temporary directory, "
+            "deferring the final write to the output until the build ends.",
+            [this](json j) { checkEmpty(j); m_json["spill"] = true; });
+
+    m_ap.add(
+            "--hugePages",
+            "Back point memory with huge pages: \"transparent\" or "
+            "\"explicit\" (from the reserved huge page pool).  "
+            "Example: --hugePages transparent",
+            [this](json j) { m_json["hugePages"] = j.get<std::string>(); });
+
+    m_ap.add(
+            "--tmpBytes",
+            "Limit on the total size of files in the temporary directory.  "
+            "Downloads wait for room, and spills which don't fit are "
+            "written to the output.",
+            [this](json j) { m_json["tmpBytes"] = extract(j); });
+
+    m_ap.add(
+            "--bulk",
+            "Keep every node in memory for the whole build and serialize them "
+            "all at the end, for datasets which fit in memory.",
+            [this](json j) { checkEmpty(j); m_json["bulk"] = true; });
+
+    m_ap.add(
+            "--engine",
+            "Build engine: \"insert\" (default) inserts points as they are "
+            "read, \"sort\" sorts all points on local disk first.",
+            [this](json j) { m_json["engine"] = j; });
+
+    m_ap.add(
+            "--selection",
+            "Which point is kept by an occupied voxel: \"center\" (default) "
+            "keeps the nearest to its center, \"first\" the first to arrive, "
+            "and \"random\" a pseudorandom one.",
+            [this](json j) { m_json["selection"] = j; });
+
+    m_ap.add(
+            "--dedup",
+            "Drop points which exactly duplicate the occupant of their voxel: "
+            "\"xyz\" by position, or \"xyzt\" by position and GpsTime.",
+            [this](json j) { m_json["dedup"] = j.get<std::string>(); });
+
+    m_ap.add(
+            "--packNodes",
+            "Once the build completes, pack the nodes of each hierarchy file "
+            "into a single blob, read with range requests.  Requires a "
+            "dataType other than \"laszip\".",
+            [this](json j) { checkEmpty(j); m_json["packNodes"] = true; });
+
+    m_ap.add(
+            "--las14",
+            "Write laszip nodes as LAS 1.4 with point formats 6 through 8, "
+            "whose layered compression lets readers decompress only the "
+            "dimensions they need.",
+            [this](json j) { checkEmpty(j); m_json["las14"] = true; });
+
+    m_ap.add(
+            "--statistics",
+            "Record the count, extents, mean, and variance of every dimension, "
+            "and the counts of each value of 8-bit dimensions, in ept.json.",
+            [this](json j) { checkEmpty(j); m_json["statistics"] = true; });
+
+    m_ap.add(
+            "--stream",
+            "Read remote uncompressed LAS inputs in ranged windows rather "
+            "than downloading them whole.",
+            [this](json j) { checkEmpty(j); m_json["streamInput"] = true; });
+
     m_ap.add(
             "--hierarchyStep",
             "Hierarchy step size - recommended to be set for testing only as "
             "entwine will determine it heuristically.",
             [this](json j) { m_json["hierarchyStep"] = extract(j); });
 
+    m_ap.add(
+            "--hierarchyPageNodes",
+            "Split the hierarchy into files of about this many nodes each, "
+            "chosen per subtree, rather than at a fixed depth step.",
+            [this](json j) { m_json["hierarchyPageNodes"] = extract(j); });
+
     m_ap.add(
             "--sleepCount",
             "Count (per-thread) after which idle nodes are serialized.",
             [this](json j) { m_json["sleepCount"] = extract(j); });
 
+    m_ap.add(
+            "--numa",
+            "If set, pin build threads evenly across the NUMA nodes of the "
+            "machine, so each thread's memory stays local to its node.",
+            [this](json j) { checkEmpty(j); m_json["numa"] = true; });
+
+    m_ap.add(
+            "--packed",
+            "If set, points are held in memory with XYZ in their scaled "
+            "integer form rather than as doubles.  Requires a scale, and may "
+            "not be used with the laszip dataType or cesium output.",
+            [this](json j) { checkEmpty(j); m_json["packed"] = true; });
+
+    m_ap.add(
+            "--partitionDepth",
+            "Depth above which each thread selects points privately, merging "
+            "its selections into the shared nodes periodically.",
+            [this](json j) { m_json["partitionDepth"] = extract(j); });
+
+    m_ap.add(
+            "--checkpoint",
+            "Interval in seconds at which progress is saved so an interrupted "
+            "build may be continued.  0 to save only at the end (default).",
+            [this](json j) { m_json["checkpoint"] = extract(j); });
+
     m_ap.add(
             "--progress",
             "Interval in seconds at which to log build stats.  0 for no "
             "logging (default: 10).",
             [this](json j) { m_json["progressInterval"] = extract(j); });
 
+    m_ap.add(
+            "--metrics",
+            "Path to which build metrics are written at each progress "
+            "interval, as lines of JSON, or in the Prometheus text format if "
+            "the path ends with \".prom\".",
+            [this](json j) { m_json["metrics"] = j; });
+
+    m_ap.add(
+            "--trace",
+            "Path to which the most recent chunk lifecycle events are written "
+            "at the end of the build, in the Chrome trace event format.",
+            [this](json j) { m_json["trace"] = j; });
+
     addArbiter();
 }
 
@@ -200,6 +454,14 @@ void Build::run()
     m_json["verbose"] = true;
 
     Config config(m_json);
+
+    if (m_json.value("estimate", false))
+    {
+        std::cout << "Estimating..." << std::endl;
+        Estimator::print(Estimator(config).go());
+        return;
+    }
+
     auto builder(makeUnique<Builder>(config));
 
     log(*builder);
@@ -319,8 +581,8 @@ void Build::log(const Builder& b) const
 
     std::cout <<
         "\tThreads: [" <<
-            b.threadPools().workPool().numThreads() << ", " <<
-            b.threadPools().clipPool().numThreads() << "]" <<
+            b.threadPools().workPool().active() << ", " <<
+            b.threadPools().clipPool().active() << "]" <<
         std::endl;
 
     std::cout <<
@@ -380,6 +642,21 @@ void Build::log(const Builder& b) const
         "\tMinimum node size: " << commify(metadata.minNodeSize()) << "\n" <<
         "\tCache size: " << commify(metadata.cacheSize()) << "\n";
 
+    if (const uint64_t m = metadata.maxMemory())
+    {
+        std::cout << "\tMemory budget: " << commify(m) << " bytes\n";
+    }
+
+    if (const uint64_t d = metadata.pinDepth())
+    {
+        std::cout << "\tPin depth: " << d << "\n";
+    }
+
+    if (const uint64_t n = metadata.hierarchyPageNodes())
+    {
+        std::cout << "\tHierarchy page nodes: " << commify(n) << "\n";
+    }
+
     if (const Subset* s = metadata.subset())
     {
         std::cout << "\tSubset: " << s->id() << " of " << s->of() << "\n";
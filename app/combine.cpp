@@ -0,0 +1,50 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "combine.hpp"
+
+#include <iostream>
+
+#include <entwine/builder/combiner.hpp>
+#include <entwine/builder/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Combine::addArgs()
+{
+    m_ap.setUsage("entwine combine <path> <path>... -o <output> (<options>)");
+
+    addInput(
+            "Paths of at least two completed EPT datasets with matching "
+            "bounds, span, and schema.\n"
+            "Example: --input ~/data/2018 ~/data/2019",
+            true);
+    addOutput("Path for the combined dataset");
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+    addArbiter();
+}
+
+void Combine::run()
+{
+    m_json["verbose"] = true;
+    Config config(m_json);
+    Combiner combiner(config);
+    std::cout << "Combining into " << config.output() << "..." << std::endl;
+    combiner.go();
+    std::cout << "Combination complete." << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,45 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "compact.hpp"
+
+#include <iostream>
+
+#include <entwine/builder/compactor.hpp>
+#include <entwine/builder/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Compact::addArgs()
+{
+    m_ap.setUsage("entwine compact <path> (<options>)");
+
+    addOutput("Path containing a completed EPT dataset", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+    addArbiter();
+}
+
+void Compact::run()
+{
+    m_json["verbose"] = true;
+    Config config(m_json);
+    Compactor compactor(config);
+    std::cout << "Compacting " << config.output() << "..." << std::endl;
+    compactor.go();
+    std::cout << "Compaction complete." << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,29 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include "entwine.hpp"
+
+namespace entwine
+{
+namespace app
+{
+
+class Compact : public App
+{
+private:
+    virtual void addArgs() override;
+    virtual void run() override;
+};
+
+} // namespace app
+} // namespace entwine
+
@@ -44,6 +44,17 @@ void Convert::addArgs()
                 m_json["geometricErrorDivisor"] = extract(j);
             });
 
+    m_ap.add(
+            "--densityError",
+            "Scale the geometric error of each tile by the point spacing of "
+            "its node, from its point count, so that densely populated tiles "
+            "defer the loading of their children.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["densityError"] = true;
+            });
+
     m_ap.add(
             "--colorType",
             "The coloring for the output tileset.  May be omitted to choose "
@@ -65,6 +76,51 @@ void Convert::addArgs()
                 checkEmpty(j);
                 m_json["truncate"] = true;
             });
+
+    m_ap.add(
+            "--quantize",
+            "Write positions as 16-bit integers within each tile's bounds, "
+            "and normals as oct-encoded 16-bit values, rather than as 32-bit "
+            "floats.  This makes tiles roughly half of their original size.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["quantize"] = true;
+            });
+
+    m_ap.add(
+            "--tileFormat",
+            "The format of each tile.  Valid values:\n"
+            "'pnts': 3D Tiles 1.0 point cloud tiles (default)\n"
+            "'glb': binary glTF tiles for 3D Tiles 1.1, compressed with "
+            "EXT_meshopt_compression unless --noMeshopt is set",
+            [this](json j) { m_json["tileFormat"] = j; });
+
+    m_ap.add(
+            "--noMeshopt",
+            "With --tileFormat glb, write uncompressed glTF buffers.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["meshopt"] = false;
+            });
+
+    m_ap.add(
+            "--implicit",
+            "Write a 3D Tiles 1.1 tileset with implicit octree tiling, whose "
+            "tile availability is written to binary subtree files, rather "
+            "than an explicit tree of tileset JSON.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["implicit"] = true;
+            });
+
+    m_ap.add(
+            "--subtreeLevels",
+            "With --implicit, the number of levels described by each subtree "
+            "file.  Default: 5.",
+            [this](json j) { m_json["subtreeLevels"] = extract(j); });
 }
 
 void Convert::run()
@@ -76,6 +132,14 @@ void Convert::run()
     std::cout << "\tOutput: " << tileset.out().prefixedRoot() << "\n";
     std::cout << "\tColor:  " << tileset.colorString() << std::endl;
     std::cout << "\tTruncate: " << (tileset.truncate() ? "yes" : "no") << "\n";
+    std::cout << "\tQuantize: " <<
+        (tileset.settings().quantize() ? "yes" : "no") << "\n";
+    std::cout << "\tTile format: " <<
+        (tileset.settings().glb() ?
+            (tileset.settings().meshopt() ? "glb (meshopt)" : "glb") :
+            "pnts") << "\n";
+    std::cout << "\tImplicit: " <<
+        (tileset.settings().implicit() ? "yes" : "no") << "\n";
     std::cout << "\tThreads: " << tileset.threadPool().numThreads() << "\n";
     std::cout << "\tRoot geometric error: " <<
         tileset.rootGeometricError() << "\n";
@@ -0,0 +1,103 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "coordinate.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/coordinator.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Coordinate::addArgs()
+{
+    m_ap.setUsage("entwine coordinate (<options>)");
+
+    addInput(
+            "File paths or directory entries, as for `entwine build`.\n"
+            "Example: -i pointclouds/, -i autzen/scan.json");
+
+    addOutput(
+            "Output directory, which must be reachable by every worker.\n"
+            "Example: --output s3://bucket/autzen");
+
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+    addArbiter();
+
+    m_ap.add(
+            "--subsets",
+            "The number of subsets into which to split the build.  Append "
+            "\"balanced\" to partition by point count.\n"
+            "Example: --subsets 16, --subsets 12 balanced",
+            [this](json j)
+            {
+                if (j.is_string()) j = json::array({ j });
+                if (!j.is_array() || j.empty() || j.size() > 2)
+                {
+                    throw std::runtime_error("Invalid subset specification");
+                }
+
+                m_json["subset"]["of"] = std::stoul(j.at(0).get<std::string>());
+
+                if (j.size() == 2)
+                {
+                    if (j.at(1).get<std::string>() != "balanced")
+                    {
+                        throw std::runtime_error(
+                                "Invalid subset specification");
+                    }
+                    m_json["subset"]["balanced"] = true;
+                }
+            });
+
+    m_ap.add(
+            "--worker",
+            "-w",
+            "A command which builds one subset, in which {id}, {of}, and "
+            "{config} are replaced with the subset ID, the subset count, and "
+            "the path of that subset's configuration.  May be given once per "
+            "worker.  Without workers, subsets are built in this process.\n"
+            "Example: -w \"ssh node1 entwine build -c {config}\"",
+            [this](json j) { m_json["workers"].push_back(j); });
+
+    m_ap.add(
+            "--retries",
+            "Number of times to retry an incomplete subset.  Default: 2.\n"
+            "Example: --retries 4",
+            [this](json j) { m_json["retries"] = extract(j); });
+
+    m_ap.add(
+            "--force",
+            "-f",
+            "Force build overwrite - do not continue subsets that may exist "
+            "at this output location.",
+            [this](json j) { checkEmpty(j); m_json["force"] = true; });
+}
+
+void Coordinate::run()
+{
+    m_json["verbose"] = true;
+    Config config(m_json);
+    Coordinator coordinator(config);
+    std::cout << "Coordinating " << config.output() << "..." << std::endl;
+    coordinator.go();
+    std::cout << "Coordinated build complete." << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
+
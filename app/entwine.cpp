@@ -8,11 +8,18 @@
 *
 ******************************************************************************/
 
+#include "bench.hpp"
 #include "build.hpp"
+#include "combine.hpp"
+#include "compact.hpp"
 #include "entwine.hpp"
 #include "convert.hpp"
+#include "coordinate.hpp"
 #include "merge.hpp"
+#include "profile.hpp"
 #include "scan.hpp"
+#include "serve.hpp"
+#include "transcode.hpp"
 
 #include <csignal>
 #include <cstdio>
@@ -43,8 +50,23 @@ namespace
             t(3) + "Aggregate information about an unindexed dataset\n" +
             t(2) + "merge\n" +
             t(3) + "Merge colocated entwine subsets\n" +
+            t(2) + "coordinate\n" +
+            t(3) + "Build and merge subsets across a set of workers\n" +
+            t(2) + "combine\n" +
+            t(3) + "Combine independent EPT datasets whose trees line up\n" +
+            t(2) + "compact\n" +
+            t(3) + "Rebalance the node sizes of an EPT dataset\n" +
             t(2) + "convert\n" +
-            t(3) + "Convert an entwine dataset to a different format\n";
+            t(3) + "Convert an entwine dataset to a different format\n" +
+            t(2) + "serve\n" +
+            t(3) + "Serve queries against EPT datasets over HTTP\n" +
+            t(2) + "bench\n" +
+            t(3) + "Measure each data type on nodes of an EPT dataset\n" +
+            t(2) + "profile\n" +
+            t(3) + "Report the node and hierarchy layout of an EPT dataset\n" +
+            t(2) + "transcode\n" +
+            t(3) + "Change the data type, scale, or dimensions of an EPT "
+                "dataset\n";
     }
 
     std::mutex mutex;
@@ -233,6 +255,17 @@ void App::addArbiter()
                 m_json["arbiter"]["s3"]["allowInstanceProfile"] = true;
             });
 
+    m_ap.add(
+            "--httpConnections",
+            "Maximum number of concurrent HTTP connections\n"
+            "Example: --httpConnections 64",
+            [this](json j) { m_json["http"]["connections"] = extract(j); });
+
+    m_ap.add(
+            "--http2",
+            "Negotiate HTTP/2 with remote servers where supported",
+            [this](json j) { checkEmpty(j); m_json["http"]["http2"] = true; });
+
     m_ap.add(
             "--verbose",
             "-v",
@@ -316,10 +349,38 @@ int main(int argc, char** argv)
         {
             entwine::app::Merge().go(args);
         }
+        else if (app == "coordinate")
+        {
+            entwine::app::Coordinate().go(args);
+        }
+        else if (app == "compact")
+        {
+            entwine::app::Compact().go(args);
+        }
         else if (app == "convert")
         {
             entwine::app::Convert().go(args);
         }
+        else if (app == "serve")
+        {
+            entwine::app::Serve().go(args);
+        }
+        else if (app == "bench")
+        {
+            entwine::app::Bench().go(args);
+        }
+        else if (app == "combine")
+        {
+            entwine::app::Combine().go(args);
+        }
+        else if (app == "profile")
+        {
+            entwine::app::Profile().go(args);
+        }
+        else if (app == "transcode")
+        {
+            entwine::app::Transcode().go(args);
+        }
         else
         {
             if (app != "help" && app != "-h" && app != "--help")
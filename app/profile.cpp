@@ -0,0 +1,69 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "profile.hpp"
+
+#include <iostream>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/profiler.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Profile::addArgs()
+{
+    m_ap.setUsage("entwine profile <path> (<options>)");
+
+    addOutput("Path containing a completed EPT dataset", true);
+    addConfig();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--nodes",
+            "Number of data objects whose stored size is sampled, 1024 by "
+            "default, or 0 for all of them\n"
+            "Example: --nodes 4096",
+            [this](json j) { m_json["nodes"] = extract(j); });
+
+    m_ap.add(
+            "--top",
+            "Number of the largest nodes to list, 10 by default\n"
+            "Example: --top 20",
+            [this](json j) { m_json["top"] = extract(j); });
+
+    m_ap.add(
+            "--json",
+            "Also write the results as JSON to this path",
+            [this](json j) { m_json["json"] = j; });
+
+    addArbiter();
+}
+
+void Profile::run()
+{
+    const Config config(m_json);
+    std::cout << "Profiling " << config.output() << "..." << std::endl;
+
+    Profiler profiler(config);
+    const json results(profiler.go());
+    Profiler::print(results);
+
+    if (m_json.count("json"))
+    {
+        arbiter::Arbiter a(m_json.value("arbiter", json()).dump());
+        a.put(m_json.at("json").get<std::string>(), results.dump(2));
+    }
+}
+
+} // namespace app
+} // namespace entwine
@@ -46,6 +46,19 @@ void Scan::addArgs()
     addNoTrustHeaders();
     addAbsolute();
     addArbiter();
+
+    m_ap.add(
+            "--binary",
+            "Also write a binary table of the scanned files, which a build "
+            "from this scan loads much faster than the JSON file list.",
+            [this](json j) { checkEmpty(j); m_json["binaryScan"] = true; });
+
+    m_ap.add(
+            "--force",
+            "-f",
+            "Ignore the results of a previous scan at this output, rather "
+            "than reusing them for unchanged files.",
+            [this](json j) { checkEmpty(j); m_json["force"] = true; });
 }
 
 void Scan::run()
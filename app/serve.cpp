@@ -0,0 +1,193 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "serve.hpp"
+
+#include <iostream>
+
+#include <entwine/reader/server.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Serve::addArgs()
+{
+    m_ap.setUsage("entwine serve <name>=<path> (<name>=<path>...) (<options>)");
+
+    m_ap.addDefault(
+            "--dataset",
+            "-d",
+            "A dataset to serve, as its name and EPT path.  May be repeated.\n"
+            "Example: --dataset autzen=s3://entwine.io/autzen",
+            [this](json j)
+            {
+                const json list(j.is_array() ? j : json::array({ j }));
+                for (const json& entry : list)
+                {
+                    const std::string s(entry.get<std::string>());
+                    const auto pos(s.find('='));
+                    if (pos == std::string::npos || !pos)
+                    {
+                        throw std::runtime_error("Invalid dataset: " + s);
+                    }
+                    m_json["datasets"][s.substr(0, pos)] = s.substr(pos + 1);
+                }
+            });
+
+    addConfig();
+    addTmp();
+
+    m_ap.add(
+            "--port",
+            "TCP port on which to listen.  Default: 8080.\n"
+            "Example: --port 9000",
+            [this](json j) { m_json["port"] = extract(j); });
+
+    m_ap.add(
+            "--threads",
+            "-t",
+            "Number of requests to serve concurrently.  Default: 8.\n"
+            "Example: --threads 32",
+            [this](json j) { m_json["threads"] = extract(j); });
+
+    m_ap.add(
+            "--cacheSize",
+            "Megabytes of decoded chunks to cache, shared by all datasets.  "
+            "Default: 1024.\n"
+            "Example: --cacheSize 4096",
+            [this](json j)
+            {
+                m_json["cacheSize"] = extract(j) * 1024 * 1024;
+            });
+
+    m_ap.add(
+            "--compressedCacheSize",
+            "Megabytes of stored chunk data to cache, so that chunks evicted "
+            "from the decoded cache may be decoded without being refetched.  "
+            "Default: 0.\n"
+            "Example: --compressedCacheSize 2048",
+            [this](json j)
+            {
+                m_json["compressedCacheSize"] = extract(j) * 1024 * 1024;
+            });
+
+    m_ap.add(
+            "--diskCache",
+            "Local directory in which to cache fetched and decoded chunks, "
+            "which persists across restarts and may be shared by several "
+            "servers on a host.\n"
+            "Example: --diskCache /mnt/nvme/entwine",
+            [this](json j) { m_json["diskCache"] = j; });
+
+    m_ap.add(
+            "--diskCacheSize",
+            "Megabytes of chunks to keep in the --diskCache directory.  "
+            "Default: 16384.\n"
+            "Example: --diskCacheSize 500000",
+            [this](json j)
+            {
+                m_json["diskCacheSize"] = extract(j) * 1024 * 1024;
+            });
+
+    m_ap.add(
+            "--prefetchChildren",
+            "After each chunk is requested, speculatively load this many of "
+            "its most populous children, for clients navigating down the "
+            "tree.  Default: 0.\n"
+            "Example: --prefetchChildren 4",
+            [this](json j) { m_json["prefetchChildren"] = extract(j); });
+
+    m_ap.add(
+            "--prefetchSize",
+            "Megabytes of prefetched chunks which have not yet been "
+            "requested, beyond which nothing more is prefetched.  "
+            "Default: 64.\n"
+            "Example: --prefetchSize 256",
+            [this](json j)
+            {
+                m_json["prefetchSize"] = extract(j) * 1024 * 1024;
+            });
+
+    m_ap.add(
+            "--hedgePercentile",
+            "Percentile of recent fetch latencies after which a remote chunk "
+            "fetch is duplicated, taking whichever returns first.  "
+            "Default: 0, for no hedging.\n"
+            "Example: --hedgePercentile 95",
+            [this](json j)
+            {
+                m_json["hedgePercentile"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--hedgeBudget",
+            "Most duplicate fetches, as a fraction of all fetches.  "
+            "Default: 0.05.\n"
+            "Example: --hedgeBudget 0.1",
+            [this](json j)
+            {
+                m_json["hedgeBudget"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--timeout",
+            "Default number of seconds after which a query stops and returns "
+            "partial results, if the query doesn't set its own.  Default: 0, "
+            "for no timeout.\n"
+            "Example: --timeout 30",
+            [this](json j)
+            {
+                m_json["timeout"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--ioTimeout",
+            "Number of seconds within which a request must arrive, which also "
+            "bounds each receive and send.  Default: 30, or 0 for none.\n"
+            "Example: --ioTimeout 10",
+            [this](json j)
+            {
+                m_json["ioTimeout"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--resultCacheSize",
+            "Megabytes of complete read results to cache, so that repeated "
+            "identical reads are answered without being run.  Default: 0.\n"
+            "Example: --resultCacheSize 512",
+            [this](json j)
+            {
+                m_json["resultCacheSize"] = extract(j) * 1024 * 1024;
+            });
+
+    m_ap.add(
+            "--preload",
+            "Load each dataset's hierarchy in the background after startup, "
+            "so that queries needn't wait for its pages to be fetched.",
+            [this](json j) { checkEmpty(j); m_json["preload"] = true; });
+
+    addArbiter();
+}
+
+void Serve::run()
+{
+    Server server(m_json);
+
+    std::cout << "Serving " << m_json.at("datasets").size() <<
+        " dataset(s) on port " << m_json.value("port", 8080) << std::endl;
+
+    server.serve();
+}
+
+} // namespace app
+} // namespace entwine
+
@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "transcode.hpp"
+
+#include <iostream>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/transcoder.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Transcode::addArgs()
+{
+    m_ap.setUsage("entwine transcode <path> -o <output> (<options>)");
+
+    m_ap.addDefault(
+            "--input",
+            "-i",
+            "Path containing a completed EPT dataset",
+            [this](json j) { m_json["input"] = j; });
+
+    addOutput("Path for the transcoded dataset");
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--dataType",
+            "Data type for the transcoded point data.  Valid values are "
+            "\"laszip\", \"binary\", \"zstandard\", \"columnar\", or, if "
+            "built with Zstd, \"zstandard-dictionary\".  "
+            "Default: the existing data type.\n"
+            "Example: --dataType zstandard",
+            [this](json j) { m_json["dataType"] = j; });
+
+    m_ap.add(
+            "--scale",
+            "The new scale factor for spatial coordinates.\n"
+            "Example: --scale 0.1, --scale \"[0.1, 0.1, 0.025]\"",
+            [this](json j)
+            {
+                m_json["scale"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--compressionLevel",
+            "Compression level for the zstandard and columnar data types.\n"
+            "Example: --compressionLevel 9",
+            [this](json j) { m_json["compressionLevel"] = extract(j); });
+
+    m_ap.add(
+            "--keepDims",
+            "Dimensions to keep, along with XYZ, omitting all others.  May "
+            "not be combined with --dropDims.\n"
+            "Example: --keepDims Intensity Classification",
+            [this](json j)
+            {
+                if (!j.is_array()) j = json::array({ j });
+                m_json["keepDims"] = j;
+            });
+
+    m_ap.add(
+            "--dropDims",
+            "Dimensions to omit.\n"
+            "Example: --dropDims ScanAngleRank UserData",
+            [this](json j)
+            {
+                if (!j.is_array()) j = json::array({ j });
+                m_json["dropDims"] = j;
+            });
+
+    addArbiter();
+}
+
+void Transcode::run()
+{
+    m_json["verbose"] = true;
+    Config config(m_json);
+    Transcoder transcoder(config);
+    std::cout << "Transcoding to " << config.output() << "..." << std::endl;
+    transcoder.go();
+    std::cout << "Transcoding complete." << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,115 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+// Builds a synthetic point cloud and reports the throughput of the build as a
+// single line of JSON.  Options, each given as "--key value":
+//
+//      points          Number of points to generate (default 1000000)
+//      distribution    "uniform", "clustered", or "strips" (default uniform)
+//      seed            Random seed for the generator (default 1)
+//      dir             Directory for fixtures and output (default tmp)
+//      span, threads, cacheSize, dataType
+//                      Passed through to the build configuration
+//
+// Generated inputs are kept in the fixture directory and reused across runs
+// with the same distribution, point count, and seed.
+
+#include <iostream>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/block-pool.hpp>
+
+#include "common.hpp"
+#include "synthetic.hpp"
+
+using namespace entwine;
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const json args(bench::parseArgs(argc, argv));
+
+        const uint64_t points(args.value("points", 1000000));
+        const bench::Distribution distribution(
+                bench::toDistribution(
+                    args.value("distribution", std::string("uniform"))));
+        const uint64_t seed(args.value("seed", 1));
+        const std::string dir(
+                args.value(
+                    "dir",
+                    arbiter::join(arbiter::getTempPath(), "entwine-bench")) +
+                "/");
+
+        arbiter::mkdirp(dir);
+
+        const TimePoint start(now());
+        const std::string input(
+                bench::fixture(dir, distribution, points, seed));
+        const double generateSeconds(bench::secondsSince(start));
+
+        json config {
+            { "input", input },
+            { "output", dir + "build-" + bench::toString(distribution) },
+            { "tmp", dir + "tmp" },
+            { "force", true },
+            { "verbose", false },
+            { "progressInterval", 0 }
+        };
+
+        for (const std::string key : { "span", "threads", "cacheSize",
+                "dataType" })
+        {
+            if (args.count(key)) config[key] = args.at(key);
+        }
+
+        // Discard any counts from before this build.
+        ChunkCache::latchInfo();
+
+        const TimePoint buildStart(now());
+        {
+            Builder builder((Config(config)));
+            builder.go();
+        }
+        const double buildSeconds(bench::secondsSince(buildStart));
+
+        const ChunkCache::Info info(ChunkCache::peekInfo());
+
+        const json report {
+            { "benchmark", "build" },
+            { "points", points },
+            { "distribution", bench::toString(distribution) },
+            { "seed", seed },
+            { "config", config },
+            { "seconds", {
+                { "generate", generateSeconds },
+                { "build", buildSeconds }
+            } },
+            { "pointsPerSecond", buildSeconds ? points / buildSeconds : 0 },
+            { "peakRssBytes", bench::peakRss() },
+            { "chunks", {
+                { "written", info.written },
+                { "read", info.read }
+            } },
+            { "blockPoolBytes", BlockPool::get().stats().pooled }
+        };
+
+        std::cout << report.dump() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
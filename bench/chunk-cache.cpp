@@ -0,0 +1,241 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+// Drives the chunk cache directly from many threads with synthetic points,
+// bypassing input reading and with a null data type, so that serialization
+// costs only the builder's own work.  The throughput of insertion, contention
+// on the spin locks, and chunk reawakenings are reported as a single line of
+// JSON.  Options, each given as "--key value":
+//
+//      points          Number of points to insert (default 4000000)
+//      distribution    "uniform", "clustered" for hot spots, or "strips" for
+//                      scan lines (default uniform)
+//      seed            Random seed for the generators (default 1)
+//      threads         Number of inserting threads (default 8)
+//      clipThreads     Number of serialization threads (default 4)
+//      batch           Points inserted per batch by each thread (default 4096)
+//      dir             Output directory (default <system tmp>/entwine-bench)
+//      span, cacheSize, maxMemory, partitionDepth, hugePages
+//                      Passed through to the build configuration
+//
+// Whether the build has cache-aligned voxel tubes (WITH_ALIGNED_TUBES) is
+// included in the report, so runs with and without it may be compared.
+//
+// Each thread generates its own stream, with its own seed, so threads insert
+// concurrently into overlapping regions as they would for adjacent files.
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/clipper.hpp>
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/voxel.hpp>
+#include <entwine/util/huge-pages.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/spin-lock.hpp>
+
+#include "common.hpp"
+#include "synthetic.hpp"
+
+using namespace entwine;
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const json args(bench::parseArgs(argc, argv));
+
+        const uint64_t points(args.value("points", 4000000));
+        const bench::Distribution distribution(
+                bench::toDistribution(
+                    args.value("distribution", std::string("uniform"))));
+        const uint64_t seed(args.value("seed", 1));
+        const uint64_t threads(std::max<uint64_t>(args.value("threads", 8), 1));
+        const uint64_t clipThreads(
+                std::max<uint64_t>(args.value("clipThreads", 4), 1));
+        const uint64_t batch(std::max<uint64_t>(args.value("batch", 4096), 1));
+        const std::string dir(
+                args.value(
+                    "dir",
+                    arbiter::join(arbiter::getTempPath(), "entwine-bench")) +
+                "/chunk-cache/");
+
+        arbiter::mkdirp(dir + "out");
+        arbiter::mkdirp(dir + "tmp");
+
+        json config {
+            { "bounds", bench::fixtureBounds() },
+            { "schema", bench::Generator::schema() },
+            { "dataType", "null" },
+            { "output", dir + "out" },
+            { "tmp", dir + "tmp" }
+        };
+
+        for (const std::string key : { "span", "cacheSize", "maxMemory",
+                "partitionDepth", "hugePages" })
+        {
+            if (args.count(key)) config[key] = args.at(key);
+        }
+
+        // Set before any point memory is allocated.
+        hugePages::setMode(Config(config).hugePages());
+
+        const Metadata metadata((Config(config)));
+        Hierarchy hierarchy;
+        Pool clipPool(clipThreads);
+
+        arbiter::Arbiter a;
+        const arbiter::Endpoint out(a.getEndpoint(dir + "out"));
+        const arbiter::Endpoint tmp(a.getEndpoint(dir + "tmp"));
+
+        // Discard any counts from before this run.
+        ChunkCache::latchInfo();
+
+#ifndef SPINLOCK_AS_MUTEX
+        const uint64_t contendedBefore(SpinLock::contended());
+        const uint64_t parkedBefore(SpinLock::parked());
+        const uint64_t waitBefore(SpinLock::waitNanos());
+#endif
+
+        std::mutex mutex;
+        std::string error;
+        double insertSeconds(0);
+        const TimePoint start(now());
+
+        {
+            ChunkCache cache(
+                    metadata,
+                    hierarchy,
+                    clipPool,
+                    out,
+                    tmp,
+                    out,
+                    metadata.cacheSize(),
+                    metadata.maxMemory());
+
+            std::vector<std::thread> workers;
+            for (uint64_t t(0); t < threads; ++t)
+            {
+                const uint64_t share(
+                        points / threads + (t < points % threads ? 1 : 0));
+
+                workers.emplace_back([&, t, share]()
+                {
+                    try
+                    {
+                        bench::Generator generator(
+                                distribution,
+                                seed + t,
+                                bench::fixtureBounds());
+
+                        const Schema& schema(metadata.schema());
+                        VectorPointTable table(schema, batch);
+                        Clipper clipper(cache);
+                        const ChunkKey root(metadata);
+                        Key key(metadata);
+                        Voxel voxel;
+                        Insertions insertions;
+
+                        for (uint64_t done(0); done < share; )
+                        {
+                            const uint64_t np(std::min(batch, share - done));
+                            generator.fill(table, np);
+
+                            insertions.clear();
+                            for (uint64_t i(0); i < np; ++i)
+                            {
+                                char* pos(table.getPoint(i));
+                                const Point p(table.xyz(pos));
+                                voxel.initShallow(p, pos);
+                                key.init(p);
+                                insertions.emplace_back(voxel, key);
+                            }
+
+                            clipper.advance(np, heuristics::sleepCount);
+                            cache.insert(insertions, root, clipper);
+                            done += np;
+                        }
+                    }
+                    catch (std::exception& e)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (error.empty()) error = e.what();
+                    }
+                });
+            }
+
+            for (std::thread& worker : workers) worker.join();
+            insertSeconds = bench::secondsSince(start);
+
+            // Everything still in the cache is serialized as it's destroyed.
+            cache.flushShallow();
+        }
+
+        const double totalSeconds(bench::secondsSince(start));
+
+        if (!error.empty()) throw std::runtime_error(error);
+
+        const ChunkCache::Info info(ChunkCache::peekInfo());
+
+        json report {
+            { "benchmark", "chunk-cache" },
+            { "points", points },
+            { "distribution", bench::toString(distribution) },
+            { "seed", seed },
+            { "threads", threads },
+            { "clipThreads", clipThreads },
+            { "batch", batch },
+            { "config", config },
+            { "seconds", {
+                { "insert", insertSeconds },
+                { "total", totalSeconds }
+            } },
+            { "insertsPerSecond", insertSeconds ? points / insertSeconds : 0 },
+            { "peakRssBytes", bench::peakRss() },
+            { "hugePages", hugePages::toString(hugePages::mode()) },
+#ifdef ENTWINE_ALIGN_TUBES
+            { "alignedTubes", true },
+#else
+            { "alignedTubes", false },
+#endif
+            { "chunks", {
+                { "written", info.written },
+                { "reawakened", info.read }
+            } }
+        };
+
+#ifndef SPINLOCK_AS_MUTEX
+        report["locks"] = {
+            { "contended", SpinLock::contended() - contendedBefore },
+            { "parked", SpinLock::parked() - parkedBefore },
+            { "waitSeconds", (SpinLock::waitNanos() - waitBefore) / 1e9 }
+        };
+#endif
+
+        std::cout << report.dump() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
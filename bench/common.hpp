@@ -0,0 +1,76 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <entwine/util/json.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+namespace bench
+{
+
+// Parse arguments of the form "--key value" into an object.  Values which
+// parse as JSON, like numbers and booleans, are stored as such - anything
+// else is stored as a string.
+inline json parseArgs(int argc, char** argv)
+{
+    json args(json::object());
+
+    for (int i(1); i < argc; ++i)
+    {
+        const std::string key(argv[i]);
+        if (key.size() < 3 || key.substr(0, 2) != "--" || i + 1 >= argc)
+        {
+            throw std::runtime_error("Invalid argument: " + key);
+        }
+
+        const std::string value(argv[++i]);
+        try { args[key.substr(2)] = json::parse(value); }
+        catch (...) { args[key.substr(2)] = value; }
+    }
+
+    return args;
+}
+
+// The peak resident set size of this process so far, in bytes, or zero if
+// unavailable.
+inline uint64_t peakRss()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Seconds elapsed since the given time point.
+inline double secondsSince(const TimePoint& start)
+{
+    return std::chrono::duration<double>(now() - start).count();
+}
+
+} // namespace bench
+} // namespace entwine
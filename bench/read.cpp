@@ -0,0 +1,342 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+// Builds a synthetic point cloud once, and then reports the latencies of
+// queries against it with a cold and a warm cache, for boxes at several
+// depths, with attribute filters, and from concurrent readers.  Each scenario
+// is written as a line of JSON.  Options, each given as "--key value":
+//
+//      points          Number of points to generate (default 1000000)
+//      distribution    "uniform", "clustered", or "strips" (default clustered)
+//      seed            Random seed for the generator and queries (default 1)
+//      dir             Directory for fixtures and output (default tmp)
+//      queries         Number of queries per scenario (default 64)
+//      threads         Number of concurrent readers (default 8)
+//      depths          Box sizes, as the depths of the octree at which a box
+//                      would be a single node (default [0, 2, 4, 6])
+//      dataType        Passed through to the build configuration
+//
+// The built output is reused across runs with the same options.
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/reader/filter.hpp>
+#include <entwine/reader/reader.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+
+#include "common.hpp"
+#include "synthetic.hpp"
+
+using namespace entwine;
+
+namespace
+{
+    json percentiles(std::vector<double> seconds)
+    {
+        if (seconds.empty()) return json::object();
+        std::sort(seconds.begin(), seconds.end());
+
+        auto at([&seconds](double p)
+        {
+            const std::size_t i(p * (seconds.size() - 1) + 0.5);
+            return seconds[i] * 1000.0;
+        });
+
+        double total(0);
+        for (const double s : seconds) total += s;
+
+        return json {
+            { "count", seconds.size() },
+            { "meanMs", total / seconds.size() * 1000.0 },
+            { "p50Ms", at(0.5) },
+            { "p90Ms", at(0.9) },
+            { "p99Ms", at(0.99) },
+            { "maxMs", seconds.back() * 1000.0 }
+        };
+    }
+
+    // Random boxes of the size of an octree node at the given depth, anywhere
+    // within the generated bounds.
+    std::vector<Bounds> boxes(
+            const uint64_t depth,
+            const uint64_t n,
+            std::mt19937_64& engine)
+    {
+        const Bounds full(bench::fixtureBounds());
+        const double factor(1.0 / (1ULL << depth));
+        const Point size(
+                full.width() * factor,
+                full.depth() * factor,
+                full.height() * factor);
+
+        std::vector<Bounds> result;
+        for (uint64_t i(0); i < n; ++i)
+        {
+            Point min;
+            for (std::size_t d(0); d < 3; ++d)
+            {
+                min[d] = std::uniform_real_distribution<double>(
+                        full.min()[d],
+                        full.max()[d] - size[d])(engine);
+            }
+            result.emplace_back(min, min + size);
+        }
+        return result;
+    }
+
+    double timeQuery(const Reader& reader, const json& q)
+    {
+        const TimePoint start(now());
+        auto query(reader.read(q));
+        query->run();
+        return bench::secondsSince(start);
+    }
+
+    json box(const Bounds& b, const json& filter = json())
+    {
+        json q { { "bounds", b } };
+        if (!filter.is_null()) q["filter"] = filter;
+        return q;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const json args(bench::parseArgs(argc, argv));
+
+        const uint64_t points(args.value("points", 1000000));
+        const bench::Distribution distribution(
+                bench::toDistribution(
+                    args.value("distribution", std::string("clustered"))));
+        const uint64_t seed(args.value("seed", 1));
+        const uint64_t queries(args.value("queries", 64));
+        const uint64_t threads(args.value("threads", 8));
+        const std::vector<uint64_t> depths(
+                args.value("depths", std::vector<uint64_t> { 0, 2, 4, 6 }));
+        const std::string dataType(
+                args.value("dataType", std::string("laszip")));
+        const std::string dir(
+                args.value(
+                    "dir",
+                    arbiter::join(arbiter::getTempPath(), "entwine-bench")) +
+                "/");
+
+        arbiter::mkdirp(dir);
+
+        const std::string input(
+                bench::fixture(dir, distribution, points, seed));
+        const std::string output(
+                dir + "read-" + bench::toString(distribution) + "-" +
+                std::to_string(points) + "-" + std::to_string(seed) + "-" +
+                dataType);
+
+        if (!std::ifstream(output + "/ept.json").good())
+        {
+            json config {
+                { "input", input },
+                { "output", output },
+                { "tmp", dir + "tmp" },
+                { "force", true },
+                { "verbose", false },
+                { "progressInterval", 0 },
+                { "dataType", dataType }
+            };
+            Builder builder((Config(config)));
+            builder.go();
+        }
+
+        std::mt19937_64 engine(seed);
+
+        auto report([&](const std::string& scenario, json stats)
+        {
+            stats["benchmark"] = "read";
+            stats["scenario"] = scenario;
+            stats["points"] = points;
+            stats["distribution"] = bench::toString(distribution);
+            stats["dataType"] = dataType;
+            std::cout << stats.dump() << std::endl;
+        });
+
+        // Cold cache: every query has a new reader, so every chunk is
+        // fetched and decoded.  Opening the reader itself isn't counted.
+        // Warm cache: the same queries are repeated against one reader which
+        // has already run them.
+        for (const uint64_t depth : depths)
+        {
+            const std::vector<Bounds> list(boxes(depth, queries, engine));
+
+            std::vector<double> cold;
+            for (const Bounds& b : list)
+            {
+                Reader reader(output);
+                cold.push_back(timeQuery(reader, box(b)));
+            }
+
+            Reader reader(output);
+            for (const Bounds& b : list) timeQuery(reader, box(b));
+
+            std::vector<double> warm;
+            for (const Bounds& b : list)
+            {
+                warm.push_back(timeQuery(reader, box(b)));
+            }
+
+            const Cache::Stats stats(reader.cache().stats());
+            json j {
+                { "depth", depth },
+                { "cold", percentiles(cold) },
+                { "warm", percentiles(warm) },
+                { "cache", {
+                    { "hits", stats.hits },
+                    { "misses", stats.misses },
+                    { "bytes", stats.bytes }
+                } }
+            };
+            report("box", j);
+        }
+
+        // Attribute filters within boxes, run against a warm cache so the
+        // filter cost isn't dwarfed by fetching.
+        {
+            const json filters {
+                { { "Classification", 2 } },
+                { { "Intensity", { { "$gt", 3000 } } } },
+                { { "Classification", { { "$in", { 2, 6 } } } },
+                    { "Intensity", { { "$lt", 1024 } } } }
+            };
+
+            Reader reader(output);
+            const std::vector<Bounds> list(boxes(2, queries, engine));
+
+            for (const json& filter : filters)
+            {
+                for (const Bounds& b : list) timeQuery(reader, box(b));
+
+                std::vector<double> filtered;
+                uint64_t selected(0);
+                for (const Bounds& b : list)
+                {
+                    const TimePoint start(now());
+                    auto query(reader.read(box(b, filter)));
+                    query->run();
+                    filtered.push_back(bench::secondsSince(start));
+                    selected += query->points();
+                }
+
+                json j(percentiles(filtered));
+                j["filter"] = filter;
+                j["selected"] = selected;
+                report("filter", j);
+            }
+        }
+
+        // Filter evaluation alone, over a table of generated points.
+        {
+            const Reader reader(output);
+            const Metadata& metadata(reader.metadata());
+            const uint64_t np(65536);
+
+            VectorPointTable table(metadata.schema(), np);
+            bench::Generator generator(
+                    distribution,
+                    seed,
+                    bench::fixtureBounds());
+            generator.fill(table, np);
+            table.clear(np);
+
+            const Filter filter(
+                    metadata,
+                    QueryParams(json {
+                        { "filter", { { "Classification", 2 } } } }));
+
+            FilterProgram::Mask mask;
+            std::vector<double> seconds;
+            for (uint64_t i(0); i < queries; ++i)
+            {
+                const TimePoint start(now());
+                filter.select(table, mask);
+                seconds.push_back(bench::secondsSince(start));
+            }
+
+            json j(percentiles(seconds));
+            j["tablePoints"] = np;
+            report("filterProgram", j);
+        }
+
+        // Concurrent readers sharing one reader and its cache, each running
+        // its own sequence of boxes of mixed sizes.
+        {
+            const Reader reader(output);
+            std::vector<std::vector<Bounds>> lists;
+            for (uint64_t t(0); t < threads; ++t)
+            {
+                std::vector<Bounds> list;
+                for (uint64_t i(0); i < queries; ++i)
+                {
+                    const uint64_t depth(depths[i % depths.size()]);
+                    list.push_back(boxes(depth, 1, engine).front());
+                }
+                lists.push_back(list);
+            }
+
+            std::vector<std::vector<double>> results(threads);
+            std::vector<std::exception_ptr> errors(threads);
+            std::vector<std::thread> workers;
+
+            const TimePoint start(now());
+            for (uint64_t t(0); t < threads; ++t)
+            {
+                workers.emplace_back([&, t]()
+                {
+                    try
+                    {
+                        for (const Bounds& b : lists[t])
+                        {
+                            results[t].push_back(timeQuery(reader, box(b)));
+                        }
+                    }
+                    catch (...)
+                    {
+                        errors[t] = std::current_exception();
+                    }
+                });
+            }
+            for (std::thread& w : workers) w.join();
+            for (const auto& e : errors) if (e) std::rethrow_exception(e);
+            const double total(bench::secondsSince(start));
+
+            std::vector<double> all;
+            for (const auto& r : results)
+            {
+                all.insert(all.end(), r.begin(), r.end());
+            }
+
+            json j(percentiles(all));
+            j["threads"] = threads;
+            j["queriesPerSecond"] = total ? all.size() / total : 0;
+            report("concurrent", j);
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
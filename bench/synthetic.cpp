@@ -0,0 +1,344 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "synthetic.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace entwine
+{
+namespace bench
+{
+
+namespace
+{
+    const uint64_t numCenters(32);
+    const uint64_t numStrips(8);
+    const uint64_t pulsesPerLine(256);
+    const uint64_t linesPerStrip(4096);
+
+    // Each LAS coordinate is stored at centimeter precision.
+    const double lasScale(0.01);
+    const uint16_t lasHeaderSize(227);
+    const uint16_t lasPointSize(28);
+
+    template<typename T>
+    void put(std::vector<char>& data, std::size_t pos, const T v)
+    {
+        std::memcpy(data.data() + pos, &v, sizeof(T));
+    }
+
+    double clamp(double v, double lo, double hi)
+    {
+        return std::max(lo, std::min(v, hi));
+    }
+
+    Point clamp(const Point& p, const Bounds& b)
+    {
+        return Point(
+                clamp(p.x, b.min().x, b.max().x),
+                clamp(p.y, b.min().y, b.max().y),
+                clamp(p.z, b.min().z, b.max().z));
+    }
+}
+
+Distribution toDistribution(const std::string& s)
+{
+    if (s == "uniform") return Distribution::Uniform;
+    if (s == "clustered") return Distribution::Clustered;
+    if (s == "strips") return Distribution::Strips;
+    throw std::runtime_error("Invalid distribution: " + s);
+}
+
+std::string toString(const Distribution d)
+{
+    switch (d)
+    {
+        case Distribution::Uniform:     return "uniform";
+        case Distribution::Clustered:   return "clustered";
+        case Distribution::Strips:      return "strips";
+        default:                        return "unknown";
+    }
+}
+
+Generator::Generator(
+        const Distribution d,
+        const uint64_t seed,
+        const Bounds& bounds)
+    : m_distribution(d)
+    , m_bounds(bounds)
+    , m_engine(seed)
+{
+    for (uint64_t i(0); i < numCenters; ++i) m_centers.push_back(uniform());
+}
+
+Schema Generator::schema()
+{
+    return Schema(DimList {
+        DimId::X,
+        DimId::Y,
+        DimId::Z,
+        DimId::Intensity,
+        DimId::Classification,
+        DimId::PointSourceId,
+        DimId::GpsTime
+    });
+}
+
+void Generator::fill(VectorPointTable& table, const uint64_t np)
+{
+    if (np > table.capacity())
+    {
+        throw std::runtime_error("Table too small for synthetic points");
+    }
+
+    pdal::PointRef pr(table, 0);
+    for (uint64_t i(0); i < np; ++i)
+    {
+        const Point p(next());
+
+        pr.setPointId(i);
+        pr.setField(DimId::X, p.x);
+        pr.setField(DimId::Y, p.y);
+        pr.setField(DimId::Z, p.z);
+        pr.setField(DimId::Intensity, m_intensity);
+        pr.setField(DimId::Classification, m_classification);
+        pr.setField(DimId::PointSourceId, m_pointSourceId);
+        pr.setField(DimId::GpsTime, m_gpsTime);
+    }
+}
+
+Point Generator::next()
+{
+    std::uniform_int_distribution<uint16_t> intensity(0, 4095);
+    m_intensity = intensity(m_engine);
+    m_gpsTime += 0.00001;
+
+    Point p;
+    switch (m_distribution)
+    {
+        case Distribution::Uniform:     p = uniform();      break;
+        case Distribution::Clustered:   p = clustered();    break;
+        case Distribution::Strips:      p = strip();        break;
+        default: throw std::runtime_error("Invalid distribution");
+    }
+
+    ++m_index;
+    return clamp(p, m_bounds);
+}
+
+Point Generator::uniform()
+{
+    const Point& mn(m_bounds.min());
+    const Point& mx(m_bounds.max());
+
+    m_classification = 1;
+    return Point(
+            std::uniform_real_distribution<double>(mn.x, mx.x)(m_engine),
+            std::uniform_real_distribution<double>(mn.y, mx.y)(m_engine),
+            std::uniform_real_distribution<double>(mn.z, mx.z)(m_engine));
+}
+
+Point Generator::clustered()
+{
+    // A fifth of the points are sparse ground, and the rest are dense
+    // clusters about our centers.
+    if (std::uniform_int_distribution<int>(0, 4)(m_engine) == 0)
+    {
+        Point p(uniform());
+        p.z = m_bounds.min().z;
+        m_classification = 2;
+        return p;
+    }
+
+    const Point& c(
+            m_centers[std::uniform_int_distribution<uint64_t>(
+                0, m_centers.size() - 1)(m_engine)]);
+    std::normal_distribution<double> offset(0, m_bounds.width() / 64.0);
+
+    m_classification = 6;
+    return Point(
+            c.x + offset(m_engine),
+            c.y + offset(m_engine),
+            c.z + offset(m_engine));
+}
+
+Point Generator::strip()
+{
+    const uint64_t pulse(m_index % pulsesPerLine);
+    const uint64_t line((m_index / pulsesPerLine) % linesPerStrip);
+    const uint64_t strip((m_index / pulsesPerLine / linesPerStrip) % numStrips);
+
+    // Flight lines alternate direction, and the scanner sweeps back and forth
+    // across each line, with neighboring strips overlapping slightly.
+    double along(static_cast<double>(line) / linesPerStrip);
+    if (strip % 2) along = 1.0 - along;
+
+    const double phase(static_cast<double>(pulse) / pulsesPerLine);
+    const double sweep(line % 2 ? 1.0 - phase : phase);
+    const double across((strip + sweep * 1.1 - 0.05) / numStrips);
+
+    std::normal_distribution<double> jitter(0, m_bounds.width() / 100000.0);
+
+    const Point& mn(m_bounds.min());
+    const double x(mn.x + along * m_bounds.width() + jitter(m_engine));
+    const double y(mn.y + across * m_bounds.depth() + jitter(m_engine));
+
+    // Rolling terrain, with some returns from vegetation above it.
+    const double w(m_bounds.width());
+    double z(
+            mn.z + m_bounds.height() *
+            (0.3 + 0.1 * std::sin(x / w * 12.0) + 0.1 * std::cos(y / w * 7.0)));
+    m_classification = 2;
+
+    if (std::uniform_int_distribution<int>(0, 9)(m_engine) == 0)
+    {
+        z += std::uniform_real_distribution<double>(
+                0, m_bounds.height() * 0.2)(m_engine);
+        m_classification = 5;
+    }
+
+    m_pointSourceId = strip + 1;
+    return Point(x, y, z);
+}
+
+void writeLas(
+        const std::string& path,
+        Generator& generator,
+        const uint64_t np,
+        const uint64_t batchSize)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.good()) throw std::runtime_error("Could not open " + path);
+
+    const Point offset(generator.bounds().mid().round());
+    Bounds bounds(Bounds::expander());
+
+    // Write a placeholder header, to be rewritten with the final bounds.
+    std::vector<char> header(lasHeaderSize, 0);
+    file.write(header.data(), header.size());
+
+    VectorPointTable table(Generator::schema(), batchSize);
+    std::vector<char> records(batchSize * lasPointSize, 0);
+
+    const uint8_t returns(0x09); // Return 1 of 1.
+
+    uint64_t written(0);
+    while (written < np)
+    {
+        const uint64_t n(std::min(batchSize, np - written));
+        generator.fill(table, n);
+
+        pdal::PointRef pr(table, 0);
+        for (uint64_t i(0); i < n; ++i)
+        {
+            pr.setPointId(i);
+            const Point p(
+                    pr.getFieldAs<double>(DimId::X),
+                    pr.getFieldAs<double>(DimId::Y),
+                    pr.getFieldAs<double>(DimId::Z));
+            bounds.grow(p);
+
+            const std::size_t pos(i * lasPointSize);
+            for (std::size_t d(0); d < 3; ++d)
+            {
+                const double v(std::round((p[d] - offset[d]) / lasScale));
+                put(records, pos + d * 4, static_cast<int32_t>(v));
+            }
+
+            put(records, pos + 12, pr.getFieldAs<uint16_t>(DimId::Intensity));
+            put(records, pos + 14, returns);
+            put(records, pos + 15,
+                    pr.getFieldAs<uint8_t>(DimId::Classification));
+            put(records, pos + 16, int8_t(0));   // Scan angle.
+            put(records, pos + 17, uint8_t(0));  // User data.
+            put(records, pos + 18,
+                    pr.getFieldAs<uint16_t>(DimId::PointSourceId));
+            put(records, pos + 20, pr.getFieldAs<double>(DimId::GpsTime));
+        }
+
+        file.write(records.data(), n * lasPointSize);
+        written += n;
+    }
+
+    if (np > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Too many points for LAS 1.2");
+    }
+
+    const std::string magic("LASF");
+    std::copy(magic.begin(), magic.end(), header.begin());
+    header[24] = 1;                                 // Version 1.2.
+    header[25] = 2;
+
+    const std::string software("Entwine benchmark");
+    std::copy(software.begin(), software.end(), header.begin() + 58);
+
+    put(header, 94, lasHeaderSize);
+    put(header, 96, static_cast<uint32_t>(lasHeaderSize));
+    put(header, 100, uint32_t(0));                  // No VLRs.
+    put(header, 104, uint8_t(1));                   // Point format 1.
+    put(header, 105, lasPointSize);
+    put(header, 107, static_cast<uint32_t>(np));
+    put(header, 111, static_cast<uint32_t>(np));    // All first returns.
+
+    for (std::size_t d(0); d < 3; ++d)
+    {
+        put(header, 131 + d * 8, lasScale);
+        put(header, 155 + d * 8, offset[d]);
+        put(header, 179 + d * 16, bounds.max()[d]);
+        put(header, 187 + d * 16, bounds.min()[d]);
+    }
+
+    file.seekp(0);
+    file.write(header.data(), header.size());
+
+    if (!file.good()) throw std::runtime_error("Could not write " + path);
+}
+
+Bounds fixtureBounds()
+{
+    return Bounds(500000, 4000000, 0, 502000, 4002000, 200);
+}
+
+std::string fixture(
+        const std::string& dir,
+        const Distribution d,
+        const uint64_t np,
+        const uint64_t seed)
+{
+    const std::string path(
+            dir + toString(d) + "-" + std::to_string(np) + "-" +
+            std::to_string(seed) + ".las");
+
+    if (std::ifstream(path).good()) return path;
+
+    // Write to a temporary name first so an interrupted run doesn't leave a
+    // truncated fixture behind.
+    const std::string partial(path + ".partial");
+    Generator generator(d, seed, fixtureBounds());
+    writeLas(partial, generator, np);
+
+    if (std::rename(partial.c_str(), path.c_str()))
+    {
+        throw std::runtime_error("Could not create " + path);
+    }
+
+    return path;
+}
+
+} // namespace bench
+} // namespace entwine
@@ -0,0 +1,99 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/point.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+namespace bench
+{
+
+enum class Distribution
+{
+    // Uniformly random within the bounds.
+    Uniform,
+
+    // Gaussian clusters around a fixed set of random centers, as for dense
+    // features like buildings and vegetation surrounded by sparse ground.
+    Clustered,
+
+    // Parallel flight lines with a zig-zag scan pattern across each one, over
+    // gently rolling terrain, with increasing GpsTime - like aerial LiDAR.
+    Strips
+};
+
+Distribution toDistribution(const std::string& s);
+std::string toString(Distribution d);
+
+// Produces a deterministic stream of synthetic points for a given seed.
+class Generator
+{
+public:
+    Generator(Distribution d, uint64_t seed, const Bounds& bounds);
+
+    static Schema schema();
+
+    const Bounds& bounds() const { return m_bounds; }
+
+    // Overwrite the first np points of the table, which must have at least
+    // that capacity, with the next np points of the stream.
+    void fill(VectorPointTable& table, uint64_t np);
+
+private:
+    Point next();
+    Point uniform();
+    Point clustered();
+    Point strip();
+
+    const Distribution m_distribution;
+    const Bounds m_bounds;
+    std::mt19937_64 m_engine;
+
+    std::vector<Point> m_centers;
+    uint64_t m_index = 0;
+
+    // The state of the current point for attributes which depend on it.
+    uint16_t m_intensity = 0;
+    uint8_t m_classification = 0;
+    uint16_t m_pointSourceId = 0;
+    double m_gpsTime = 0;
+};
+
+// Write np points of the generator's stream, in batches of the given size, to
+// a LAS 1.2 file with point format 1.
+void writeLas(
+        const std::string& path,
+        Generator& generator,
+        uint64_t np,
+        uint64_t batchSize = 65536);
+
+// The bounds within which synthetic fixtures are generated.
+Bounds fixtureBounds();
+
+// The path to a LAS fixture in the given directory holding np points of this
+// distribution and seed, which is generated only if it doesn't already exist.
+std::string fixture(
+        const std::string& dir,
+        Distribution d,
+        uint64_t np,
+        uint64_t seed);
+
+} // namespace bench
+} // namespace entwine
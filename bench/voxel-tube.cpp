@@ -0,0 +1,153 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+// Compares the open-addressed VoxelTube against the std::map tube which it
+// replaced, by running an identical sequence of Z lookups, most of which
+// insert, through a grid of each.  The time of each layout and their ratio
+// are reported as a single line of JSON.  Options, each given as
+// "--key value":
+//
+//      tubes           Number of tubes, as in a chunk's grid (default 65536)
+//      lookups         Lookups per tube (default 32)
+//      zRange          Span of the Z positions looked up in each tube, so
+//                      that lookups beyond it find existing voxels
+//                      (default 64)
+//      rounds          Passes over the grid, each with fresh tubes
+//                      (default 5)
+//      seed            Random seed (default 1)
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/types/voxel.hpp>
+
+#include "common.hpp"
+
+using namespace entwine;
+
+namespace
+{
+    using MapTube = std::map<uint32_t, Voxel>;
+
+    // Run every lookup through a fresh grid of tubes, returning the seconds
+    // taken and a count of the voxels found empty so that none of the work
+    // may be skipped.
+    template <typename Tube>
+    double run(
+            const std::vector<uint32_t>& zs,
+            const uint64_t tubes,
+            const uint64_t lookups,
+            uint64_t& empty)
+    {
+        const TimePoint start(now());
+
+        std::vector<Tube> grid(tubes);
+        for (uint64_t t(0); t < tubes; ++t)
+        {
+            Tube& tube(grid[t]);
+            const uint32_t* z(zs.data() + t * lookups);
+            for (uint64_t i(0); i < lookups; ++i)
+            {
+                if (!tube[z[i]].data()) ++empty;
+            }
+        }
+
+        return bench::secondsSince(start);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const json args(bench::parseArgs(argc, argv));
+
+        const uint64_t tubes(args.value("tubes", 65536));
+        const uint64_t lookups(args.value("lookups", 32));
+        const uint64_t zRange(std::max<uint64_t>(args.value("zRange", 64), 1));
+        const uint64_t rounds(std::max<uint64_t>(args.value("rounds", 5), 1));
+        const uint64_t seed(args.value("seed", 1));
+
+        // Within a chunk, the Z positions of a tube are contiguous from an
+        // offset which depends on its depth.
+        std::mt19937_64 gen(seed);
+        std::uniform_int_distribution<uint32_t> offset(0, 1u << 20);
+        std::uniform_int_distribution<uint32_t> within(
+                0,
+                static_cast<uint32_t>(zRange - 1));
+
+        std::vector<uint32_t> zs(tubes * lookups);
+        for (uint64_t t(0); t < tubes; ++t)
+        {
+            const uint32_t base(offset(gen));
+            for (uint64_t i(0); i < lookups; ++i)
+            {
+                zs[t * lookups + i] = base + within(gen);
+            }
+        }
+
+        double flat(0);
+        double mapped(0);
+        uint64_t flatEmpty(0);
+        uint64_t mappedEmpty(0);
+
+        // Alternate the layouts, so neither benefits from running warm.
+        for (uint64_t r(0); r < rounds; ++r)
+        {
+            flat += run<VoxelTube>(zs, tubes, lookups, flatEmpty);
+            mapped += run<MapTube>(zs, tubes, lookups, mappedEmpty);
+        }
+
+        if (flatEmpty != mappedEmpty)
+        {
+            throw std::runtime_error("Tube layouts disagree");
+        }
+
+        const uint64_t total(tubes * lookups * rounds);
+        const json report {
+            { "benchmark", "voxel-tube" },
+            { "tubes", tubes },
+            { "lookups", lookups },
+            { "zRange", zRange },
+            { "rounds", rounds },
+            { "seed", seed },
+            { "seconds", {
+                { "flat", flat },
+                { "map", mapped }
+            } },
+            { "lookupsPerSecond", {
+                { "flat", flat ? total / flat : 0 },
+                { "map", mapped ? total / mapped : 0 }
+            } },
+            { "speedup", flat ? mapped / flat : 0 },
+#ifdef ENTWINE_ALIGN_TUBES
+            { "alignedTubes", true },
+#else
+            { "alignedTubes", false },
+#endif
+            { "peakRssBytes", bench::peakRss() }
+        };
+
+        std::cout << report.dump() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
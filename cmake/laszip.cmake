@@ -0,0 +1,12 @@
+find_path(LASZIP_API_INCLUDE_DIR laszip_api.h
+    HINTS ${LASZIP_DIRECTORIES}
+    PATH_SUFFIXES laszip)
+find_library(LASZIP_LIBRARIES NAMES laszip laszip3)
+
+if (LASZIP_API_INCLUDE_DIR AND LASZIP_LIBRARIES)
+    set(LASZIP_DEFS ENTWINE_HAVE_LASZIP)
+    list(APPEND LASZIP_DIRECTORIES ${LASZIP_API_INCLUDE_DIR})
+else()
+    message("LASzip not found - laszip chunks are read through PDAL")
+    unset(LASZIP_LIBRARIES)
+endif()
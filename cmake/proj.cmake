@@ -0,0 +1,19 @@
+find_package(PROJ CONFIG QUIET)
+if (PROJ_FOUND)
+    set(PROJ_LIBRARIES PROJ::proj)
+    get_target_property(PROJ_INCLUDE_DIR PROJ::proj
+        INTERFACE_INCLUDE_DIRECTORIES)
+else()
+    find_path(PROJ_INCLUDE_DIR proj.h)
+    find_library(PROJ_LIBRARIES NAMES proj proj_9 proj_8 proj_7 proj_6)
+    if (PROJ_INCLUDE_DIR AND PROJ_LIBRARIES)
+        set(PROJ_FOUND TRUE)
+    endif()
+endif()
+
+if (PROJ_FOUND)
+    set(PROJ_DEFS ENTWINE_HAVE_PROJ)
+else()
+    message("PROJ not found - native reprojection is disabled")
+    unset(PROJ_LIBRARIES)
+endif()
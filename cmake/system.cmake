@@ -18,6 +18,9 @@ function(compiler_options target)
         PRIVATE
             ${CURL_DEFS}
             ${OPENSSL_DEFS}
+            ${PROJ_DEFS}
+            ${LASZIP_DEFS}
+            ${ZSTD_DEFS}
 			${BACKTRACE_DEFS}
     )
     target_include_directories(${target}
@@ -25,9 +28,11 @@ function(compiler_options target)
 			${ROOT_DIR}
             ${PROJECT_BINARY_DIR}/include
             ${PDAL_INCLUDE_DIRS}
+            ${PROJ_INCLUDE_DIR}
             ${CURL_INCLUDE_DIR}
             ${OPENSSL_INCLUDE_DIR}
             ${LASZIP_DIRECTORIES}
+            ${ZSTD_INCLUDE_DIRS}
 			${JSONCPP_INCLUDE_DIR}
     )
 endfunction()
@@ -0,0 +1,8 @@
+find_package(Zstd)
+if (ZSTD_FOUND)
+    set(ZSTD_DEFS ENTWINE_HAVE_ZSTD)
+else()
+    message("Zstd not found - zstandard-dictionary data is disabled")
+    unset(ZSTD_LIBRARIES)
+    unset(ZSTD_INCLUDE_DIRS)
+endif()
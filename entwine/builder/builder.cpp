@@ -11,28 +11,44 @@
 #include <entwine/builder/builder.hpp>
 
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
 #include <limits>
 #include <numeric>
 #include <random>
 #include <thread>
 
 #include <entwine/builder/clipper.hpp>
+#include <entwine/builder/external-sort.hpp>
 #include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/packer.hpp>
 #include <entwine/builder/registry.hpp>
 #include <entwine/builder/sequence.hpp>
 #include <entwine/builder/thread-pools.hpp>
+#include <entwine/formats/cesium/tileset.hpp>
+#include <entwine/io/uploader.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/block-pool.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/file-info.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-packer.hpp>
 #include <entwine/types/reprojection.hpp>
 #include <entwine/types/scale-offset.hpp>
 #include <entwine/types/schema.hpp>
+#include <entwine/types/srs-transform.hpp>
 #include <entwine/types/subset.hpp>
 #include <entwine/types/vector-point-table.hpp>
 #include <entwine/util/executor.hpp>
 #include <entwine/util/json.hpp>
+#include <entwine/util/las-stream.hpp>
+#include <entwine/util/memory.hpp>
+#include <entwine/util/metrics.hpp>
 #include <entwine/util/pool.hpp>
+#include <entwine/util/tmp-space.hpp>
+#include <entwine/util/trace.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -43,25 +59,221 @@ namespace
     const std::size_t inputRetryLimit(16);
     std::size_t reawakened(0);
 
-    std::size_t workThreads(const Metadata& m, const Config& c)
+    // The positions of a batch of input points, by column, retained per
+    // thread so they aren't reallocated for every batch.
+    struct Columns
     {
-        // Limit worker threads to the number of files.
-        const std::size_t baseWorkThreads(c.workThreads());
-        return std::min(baseWorkThreads, m.files().size());
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            data.clear();
+        }
+
+        void push(const Point& p, char* pos)
+        {
+            x.push_back(p.x);
+            y.push_back(p.y);
+            z.push_back(p.z);
+            data.push_back(pos);
+        }
+
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> z;
+        std::vector<char*> data;
+        std::vector<uint8_t> inside;
+
+        // Root cell positions, valid where exact is set.
+        std::vector<uint64_t> px;
+        std::vector<uint64_t> py;
+        std::vector<uint64_t> pz;
+        std::vector<uint8_t> exact;
+    };
+
+    Columns& columns()
+    {
+        static thread_local Columns c;
+        return c;
     }
 
-    std::size_t clipThreads(const Metadata& m, const Config& c)
+    // XYZ are taken from the position, since they may be stored scaled.
+    void addDimStats(
+            DimStatsList& stats,
+            const DimList& dims,
+            const pdal::PointRef& pr,
+            const Point& p)
     {
-        const std::size_t baseWorkThreads(c.workThreads());
-        const std::size_t baseClipThreads(c.clipThreads());
+        for (std::size_t d(0); d < dims.size(); ++d)
+        {
+            const DimId id(dims[d].id());
+            if (id == DimId::X) stats[d].add(p.x);
+            else if (id == DimId::Y) stats[d].add(p.y);
+            else if (id == DimId::Z) stats[d].add(p.z);
+            else stats[d].add(pr.getFieldAs<double>(id));
+        }
+    }
 
-        // Actual work threads is <= base work threads.
-        const std::size_t actualWorkThreads(workThreads(m, c));
-        const std::size_t stolenWorkThreads(
-                baseWorkThreads - actualWorkThreads);
+    json poolMetrics(const Pool& pool)
+    {
+        return json {
+            { "threads", pool.numThreads() },
+            { "active", pool.active() },
+            { "idle", pool.idle() },
+            { "queued", pool.queued() }
+        };
+    }
 
-        return baseClipThreads + stolenWorkThreads;
+    // Append a line of JSON, or if the path ends in ".prom", replace the file
+    // with the Prometheus text format for collection by an exporter.
+    void writeMetrics(const std::string& path, const json& j)
+    {
+        const std::string prom(".prom");
+        if (path.size() > prom.size() &&
+                path.substr(path.size() - prom.size()) == prom)
+        {
+            // Written in full before being renamed into place, so a scrape
+            // never sees a partial file.
+            const std::string partial(path + ".partial");
+            {
+                std::ofstream file(partial, std::ios::out | std::ios::trunc);
+                file << toPrometheus(j);
+            }
+            std::rename(partial.c_str(), path.c_str());
+        }
+        else
+        {
+            std::ofstream file(path, std::ios::out | std::ios::app);
+            file << j.dump() << std::endl;
+        }
     }
+
+    // Tracks the bytes of downloaded input files awaiting insertion, so
+    // downloads don't run arbitrarily far ahead of the work threads.
+    class PrefetchBudget
+    {
+    public:
+        explicit PrefetchBudget(uint64_t max) : m_max(max) { }
+
+        // Block until we're under budget.  At least one file is always
+        // allowed in flight.
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return !m_bytes || m_bytes < m_max; });
+        }
+
+        void add(uint64_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bytes += bytes;
+        }
+
+        void release(uint64_t bytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_bytes -= bytes;
+            }
+            m_cv.notify_all();
+        }
+
+    private:
+        const uint64_t m_max;
+        uint64_t m_bytes = 0;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+    };
+
+    // The points of a single file, split into batches which may be inserted
+    // concurrently by any work thread.  The reading thread offers each batch
+    // to the pool and afterward finishes whatever hasn't been claimed, so it
+    // never waits on a batch that hasn't started.
+    //
+    // Each batch is charged to the memory of point tables from its push
+    // until its inserter calls done.
+    class SplitInsertion
+    {
+    public:
+        ~SplitInsertion()
+        {
+            for (const auto& data : m_batches) uncharge(data.size());
+        }
+
+        void push(std::vector<char>&& data)
+        {
+            Memory::get().add(Memory::Subsystem::Tables, data.size());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_batches.push_back(std::move(data));
+        }
+
+        bool pop(std::vector<char>& data)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_batches.empty()) return false;
+
+            data = std::move(m_batches.front());
+            m_batches.pop_front();
+            ++m_running;
+            return true;
+        }
+
+        void done(uint64_t bytes)
+        {
+            uncharge(bytes);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_running;
+            }
+            m_cv.notify_all();
+        }
+
+        void add(const PointStats& stats)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.push_back(stats);
+        }
+
+        void fail(std::string error)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_error.empty()) m_error = error;
+        }
+
+        // Stats of completed batches since the last call.  These are only
+        // taken by the reading thread, so per-file stats aren't updated
+        // concurrently.
+        std::vector<PointStats> takeStats()
+        {
+            std::vector<PointStats> stats;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::swap(stats, m_stats);
+            return stats;
+        }
+
+        // Wait for all claimed batches to complete, returning the first
+        // error, if any.
+        std::string wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return !m_running; });
+            return m_error;
+        }
+
+    private:
+        static void uncharge(uint64_t bytes)
+        {
+            Memory::get().sub(Memory::Subsystem::Tables, bytes);
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<std::vector<char>> m_batches;
+        std::size_t m_running = 0;
+        std::vector<PointStats> m_stats;
+        std::string m_error;
+    };
 }
 
 Builder::Builder(const Config& config, std::shared_ptr<arbiter::Arbiter> a)
@@ -72,30 +284,94 @@ Builder::Builder(const Config& config, std::shared_ptr<arbiter::Arbiter> a)
                 m_arbiter->getEndpoint(m_config.output())))
     , m_tmp(makeUnique<arbiter::Endpoint>(
                 m_arbiter->getEndpoint(m_config.tmp())))
-    , m_isContinuation(m_config.isContinuation())
+    , m_isContinuation(
+            !m_config.force() &&
+            m_out->tryGetSize("ept" + m_config.postfix() + ".json"))
     , m_sleepCount(m_config.sleepCount())
+    , m_nativeReprojection(m_config.nativeReprojection())
+    , m_pipeline(m_config.pipeline("", m_nativeReprojection))
     , m_metadata(m_isContinuation ?
             makeUnique<Metadata>(*m_out, m_config) :
             makeUnique<Metadata>(m_config))
     , m_threadPools(
             makeUnique<ThreadPools>(
-                workThreads(*m_metadata, m_config),
-                clipThreads(*m_metadata, m_config)))
+                m_config.workThreads(),
+                m_config.clipThreads()))
+    , m_merge(m_metadata->mergeData().empty() ?
+            std::unique_ptr<arbiter::Endpoint>() :
+            makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_metadata->mergeData())))
     , m_registry(makeUnique<Registry>(
                 *m_metadata,
                 *m_out,
                 *m_tmp,
                 *m_threadPools,
-                m_isContinuation))
-    , m_sequence(makeUnique<Sequence>(*m_metadata, m_mutex))
+                m_isContinuation && !m_metadata->rebuildingPreview(),
+                m_merge.get()))
+    , m_sequence(
+            makeUnique<Sequence>(*m_metadata, m_mutex, m_config.fileOrder()))
     , m_verbose(m_config.verbose())
     , m_start(now())
 {
+    hugePages::setMode(m_config.hugePages());
+    BlockPool::get().setMaxPooled(m_config.blockPoolSize());
+    Memory::get().setLimits(m_config.memoryLimits());
+    Uploader::get().configure(m_config.uploadThreads(), m_config.uploadBytes());
+    TmpSpace::get().configure(m_config.tmpBytes());
+    if (!m_config.trace().empty()) Trace::get().enable(heuristics::traceEvents);
+    if (m_metadata->bulk()) checkBulk();
     prepareEndpoints();
+
+    // Packing removes local copies of the individual nodes, which we would
+    // need to add to them.
+    if (
+            m_isContinuation &&
+            m_out->getSubEndpoint("ept-hierarchy").tryGetSize(
+                Dxyz().toString() + m_metadata->postfix() + ".pack.json"))
+    {
+        throw std::runtime_error("Packed datasets may not be continued");
+    }
+
+    if (m_config.numa())
+    {
+        const std::size_t nodes(m_threadPools->pinToNodes());
+        if (verbose())
+        {
+            if (nodes > 1)
+            {
+                std::cout << "Threads pinned across " << nodes <<
+                    " NUMA nodes" << std::endl;
+            }
+            else std::cout << "Single NUMA node - threads unpinned" << std::endl;
+        }
+    }
+
+    const std::string engine(m_config.engine());
+    if (engine == "sort")
+    {
+        if (m_metadata->subset())
+        {
+            throw std::runtime_error("The sort engine may not use a subset");
+        }
+
+        m_sorter = makeUnique<ExternalSort>(
+                *m_metadata,
+                *m_tmp,
+                m_config.sortRunBytes());
+    }
+    else if (engine != "insert")
+    {
+        throw std::runtime_error("Invalid engine: " + engine);
+    }
 }
 
 Builder::~Builder()
-{ }
+{
+    // Errors are surfaced by save, so any remaining here have already been
+    // reported.
+    try { Uploader::get().await(); }
+    catch (...) { }
+}
 
 void Builder::go(std::size_t max)
 {
@@ -106,6 +382,22 @@ void Builder::go(std::size_t max)
 
     const std::size_t alreadyInserted(files.pointStats().inserts());
 
+    // The file list is fixed for the duration, so it is measured only once.
+    // The others which are measured rather than tracked are refreshed every
+    // second.
+    Memory& memory(Memory::get());
+    memory.set(Memory::Subsystem::Files, files.bytes());
+    const auto measure([this, &memory]()
+    {
+        memory.set(
+                Memory::Subsystem::Blocks,
+                BlockPool::get().stats().resident);
+        memory.set(
+                Memory::Subsystem::Hierarchy,
+                m_registry->hierarchy().bytes());
+    });
+    measure();
+
     Pool p(2);
     p.add([this, max, &done]()
     {
@@ -113,15 +405,63 @@ void Builder::go(std::size_t max)
         done = true;
     });
 
-    p.add([this, &done, &files, alreadyInserted]()
+    const std::string metricsPath(m_config.metrics());
+    const double totalPoints(files.totalPoints());
+
+    const auto metrics([&](const int64_t s, const ChunkCache::Info& info)
     {
-        if (!m_interval) return;
+        const BlockPool::Stats mem(BlockPool::get().stats());
+        const uint64_t inserts(files.pointStats().inserts());
+
+        json j(Metrics::get().toJson());
+        j["elapsed"] = s;
+        j["inserts"] = inserts - alreadyInserted;
+        j["progress"] = totalPoints ? inserts / totalPoints : 0;
+        j["chunks"] = {
+            { "written", info.written },
+            { "read", info.read },
+            { "alive", info.alive }
+        };
+
+        // Keyed rather than listed, so each has its own Prometheus name.
+        json& depths(j["chunks"]["depths"] = json::object());
+        for (std::size_t d(0); d < info.depths.size(); ++d)
+        {
+            const ChunkCache::DepthInfo& depth(info.depths[d]);
+            depths[std::to_string(d)] = {
+                { "alive", depth.alive },
+                { "cached", depth.cached },
+                { "cachedBytes", depth.cachedBytes },
+                { "read", depth.read }
+            };
+        }
+
+        json& serializeMs(j["chunks"]["serializeMs"] = json::object());
+        for (std::size_t i(0); i < info.serializeMs.size(); ++i)
+        {
+            const bool last(i + 1 == info.serializeMs.size());
+            serializeMs[last ? "inf" : std::to_string(1ULL << i)] =
+                info.serializeMs[i];
+        }
+        j["memory"] = {
+            { "resident", mem.resident },
+            { "pooled", mem.pooled },
+            { "subsystems", memory.toJson() }
+        };
+        j["pools"] = {
+            { "work", poolMetrics(m_threadPools->workPool()) },
+            { "clip", poolMetrics(m_threadPools->clipPool()) }
+        };
+        return j;
+    });
 
+    p.add([this, &done, &files, alreadyInserted, &metrics, &metricsPath,
+            totalPoints, &memory, &measure]()
+    {
         using ms = std::chrono::milliseconds;
         uint64_t lastInserts(0);
         int64_t lastProgress(0);
 
-        const double totalPoints(files.totalPoints());
         const double megsPerHour(3600.0 / 1000000.0);
 
         while (!done)
@@ -130,7 +470,10 @@ void Builder::go(std::size_t max)
             std::this_thread::sleep_for(ms(1000 - t % 1000));
             const auto s(since<std::chrono::seconds>(m_start));
 
-            if (s != lastProgress && s % m_interval == 0)
+            m_threadPools->rebalance(ChunkCache::peekInfo().alive);
+            measure();
+
+            if (m_interval && s != lastProgress && s % m_interval == 0)
             {
                 lastProgress = s;
 
@@ -144,6 +487,13 @@ void Builder::go(std::size_t max)
                 const ChunkCache::Info info(ChunkCache::latchInfo());
                 reawakened += info.read;
 
+                const BlockPool::Stats mem(BlockPool::get().stats());
+
+                if (!metricsPath.empty())
+                {
+                    writeMetrics(metricsPath, metrics(s, info));
+                }
+
                 if (verbose())
                 {
                     const uint64_t totalPace(
@@ -163,8 +513,26 @@ void Builder::go(std::size_t max)
                         commify(totalPace) <<
                         "(" << commify(lastIntervalPace) << ")M/h - " <<
                         info.written << "W - " << info.read << "R - " <<
-                        info.alive << "A" <<
+                        info.alive << "A - " <<
+                        commify(mem.resident / 1024 / 1024) << "MB(" <<
+                        commify(mem.pooled / 1024 / 1024) << "MB pooled) - " <<
+                        m_threadPools->workPool().active() << "/" <<
+                        m_threadPools->clipPool().active() << "T" <<
                         std::endl;
+
+                    std::cout << "\tMemory -";
+                    for (std::size_t i(0); i < Memory::numSubsystems; ++i)
+                    {
+                        const auto sub(static_cast<Memory::Subsystem>(i));
+                        std::cout << " " << Memory::toString(sub) << ": " <<
+                            commify(memory.bytes(sub) / 1024 / 1024) << "MB";
+                        if (const uint64_t limit = memory.limit(sub))
+                        {
+                            std::cout << "/" <<
+                                commify(limit / 1024 / 1024) << "MB";
+                        }
+                    }
+                    std::cout << std::endl;
                 }
 
                 lastInserts = inserts;
@@ -173,6 +541,26 @@ void Builder::go(std::size_t max)
     });
 
     p.join();
+
+    if (!metricsPath.empty())
+    {
+        // A final line covering everything since the last interval, which
+        // includes saving.
+        json j(metrics(since<std::chrono::seconds>(m_start),
+                    ChunkCache::latchInfo()));
+        j["done"] = true;
+        writeMetrics(metricsPath, j);
+    }
+
+    if (!m_config.trace().empty())
+    {
+        const uint64_t events(Trace::get().dump(m_config.trace()));
+        if (verbose())
+        {
+            std::cout << "Wrote " << commify(events) << " trace events to " <<
+                m_config.trace() << std::endl;
+        }
+    }
 }
 
 void Builder::doRun(const std::size_t max)
@@ -182,8 +570,26 @@ void Builder::doRun(const std::size_t max)
         throw std::runtime_error("Cannot add to read-only builder");
     }
 
+    // Downloads run ahead of insertion on their own threads, so work threads
+    // only parse and insert.  Lookahead is bounded by the download pool's
+    // queue and by the bytes of localized files not yet inserted.
+    PrefetchBudget budget(m_config.prefetchBytes());
+    Pool downloads(m_config.prefetchThreads(), m_config.prefetchThreads());
+
+    // Bulk builds hold every node until the end, and the sort engine inserts
+    // nothing until all files are read, so neither has progress to persist.
+    const int64_t interval(
+            m_sorter || m_metadata->bulk() ? 0 : m_config.checkpoint());
+    auto lastCheckpoint(now());
+
     while (auto o = m_sequence->next(max))
     {
+        if (interval && since<std::chrono::seconds>(lastCheckpoint) >= interval)
+        {
+            checkpoint(downloads);
+            lastCheckpoint = now();
+        }
+
         const Origin origin(*o);
         FileInfo& info(m_metadata->mutableFiles().get(origin));
         const auto path(info.path());
@@ -193,42 +599,116 @@ void Builder::doRun(const std::size_t max)
             std::cout << "Adding " << origin << " - " << path << std::endl;
         }
 
-        m_threadPools->workPool().add([this, origin, &info, path]()
+        downloads.add([this, origin, &info, path, &budget]()
         {
-            FileInfo::Status status(FileInfo::Status::Inserted);
-            std::string message;
+            budget.wait();
+
+            std::shared_ptr<arbiter::LocalHandle> handle;
+            std::shared_ptr<TmpSpace::Lease> lease;
+            std::shared_ptr<LasStream> stream;
+            std::string error;
+            uint64_t bytes(0);
 
             try
             {
-                insertPath(origin, info);
+                Metrics::Timer timer(Metrics::Phase::Download);
+                stream = openStream(path);
+
+                if (stream) bytes = stream->bytes();
+                else if (m_arbiter->isRemote(path))
+                {
+                    // The copy we download must fit in tmp, if its size is
+                    // known up front.
+                    const auto size(m_arbiter->tryGetSize(path));
+                    lease = std::make_shared<TmpSpace::Lease>(
+                            size ? *size : 0);
+
+                    handle = localize(path);
+
+                    if (size) bytes = *size;
+                    else if (auto local = m_arbiter->tryGetSize(
+                                handle->localPath()))
+                    {
+                        bytes = *local;
+                    }
+                }
+                else handle = localize(path);
             }
-            catch (const std::exception& e)
+            catch (const std::exception& e) { error = e.what(); }
+            catch (...) { error = "Unknown error"; }
+
+            // Begin fetching the nodes this file is likely to reawaken while
+            // it waits for a work thread.
+            if (!m_sorter && error.empty())
             {
-                if (verbose())
+                if (const Bounds* bounds = info.bounds())
                 {
-                    std::cout << "During " << path << ": " << e.what() <<
-                        std::endl;
+                    m_registry->cache().prefetch(*bounds);
                 }
-
-                status = FileInfo::Status::Error;
-                message = e.what();
             }
-            catch (...)
+
+            budget.add(bytes);
+
+            m_threadPools->workPool().add(
+                    [this, origin, &info, path, handle, lease, stream, error,
+                        bytes, &budget]()
+                    mutable
             {
-                if (verbose())
+                FileInfo::Status status(FileInfo::Status::Inserted);
+                std::string message;
+
+                try
                 {
-                    std::cout << "Unknown error during " << path << std::endl;
+                    if (stream) insertStream(origin, info, *stream);
+                    else if (handle)
+                    {
+                        insertPath(origin, info, handle->localPath());
+                    }
+                    else throw std::runtime_error(error);
+                }
+                catch (const std::exception& e)
+                {
+                    if (verbose())
+                    {
+                        std::cout << "During " << path << ": " << e.what() <<
+                            std::endl;
+                    }
+
+                    status = FileInfo::Status::Error;
+                    message = e.what();
+                }
+                catch (...)
+                {
+                    if (verbose())
+                    {
+                        std::cout << "Unknown error during " << path <<
+                            std::endl;
+                    }
+
+                    status = FileInfo::Status::Error;
+                    message = "Unknown error";
                 }
 
-                status = FileInfo::Status::Error;
-                message = "Unknown error";
-            }
+                // Remove any downloaded copy before releasing its budget.
+                handle.reset();
+                lease.reset();
+                stream.reset();
+                budget.release(bytes);
 
-            m_metadata->mutableFiles().set(origin, status, message);
-            if (verbose()) std::cout << "\tDone " << origin << std::endl;
+                m_metadata->mutableFiles().set(origin, status, message);
+                if (verbose()) std::cout << "\tDone " << origin << std::endl;
+            });
         });
     }
 
+    downloads.join();
+
+    if (m_sorter)
+    {
+        m_threadPools->cycle();
+        insertSorted();
+    }
+
     if (verbose())
     {
         std::cout << "\tPushes complete - joining..." << std::endl;
@@ -237,9 +717,29 @@ void Builder::doRun(const std::size_t max)
     save();
 }
 
-void Builder::insertPath(const Origin originId, FileInfo& info)
+std::shared_ptr<LasStream> Builder::openStream(const std::string path)
+{
+    if (!m_config.streamInput()) return std::shared_ptr<LasStream>();
+
+    // Anything that can't be streamed, including a failure here, falls back
+    // to localization, which has its own retries and error reporting.
+    try
+    {
+        return std::shared_ptr<LasStream>(
+                LasStream::create(
+                    *m_arbiter,
+                    path,
+                    *m_tmp,
+                    heuristics::streamWindowBytes));
+    }
+    catch (...)
+    {
+        return std::shared_ptr<LasStream>();
+    }
+}
+
+std::shared_ptr<arbiter::LocalHandle> Builder::localize(const std::string path)
 {
-    const std::string rawPath(info.path());
     std::size_t tries(0);
     std::unique_ptr<arbiter::LocalHandle> localHandle;
 
@@ -249,14 +749,14 @@ void Builder::insertPath(const Origin originId, FileInfo& info)
 
         try
         {
-            localHandle = m_arbiter->getLocalHandle(rawPath, *m_tmp);
+            localHandle = m_arbiter->getLocalHandle(path, *m_tmp);
         }
         catch (const std::exception& e)
         {
             if (verbose())
             {
                 std::cout <<
-                    "Failed GET " << tries << " of " << rawPath << ": " <<
+                    "Failed GET " << tries << " of " << path << ": " <<
                     e.what() << std::endl;
             }
         }
@@ -265,43 +765,122 @@ void Builder::insertPath(const Origin originId, FileInfo& info)
             if (verbose())
             {
                 std::cout <<
-                    "Failed GET " << tries << " of " << rawPath << ": " <<
+                    "Failed GET " << tries << " of " << path << ": " <<
                     "unknown error" << std::endl;
             }
         }
     }
     while (!localHandle && ++tries < inputRetryLimit);
 
-    if (!localHandle) throw std::runtime_error("No local handle: " + rawPath);
+    if (!localHandle) throw std::runtime_error("No local handle: " + path);
 
-    const std::string& localPath(localHandle->localPath());
+    return std::shared_ptr<arbiter::LocalHandle>(std::move(localHandle));
+}
+
+void Builder::insertPath(
+        const Origin originId,
+        FileInfo& info,
+        const std::string localPath)
+{
+    const std::string pipeline(m_pipeline.instantiate(localPath));
+    insert(originId, info, [&pipeline](VectorPointTable& table)
+    {
+        return Executor::get().run(table, pipeline);
+    });
+}
+
+void Builder::insertStream(
+        const Origin originId,
+        FileInfo& info,
+        LasStream& stream)
+{
+    // Each window runs through its own pipeline, feeding the same table, so
+    // point IDs continue across windows.
+    insert(originId, info, [this, &stream](VectorPointTable& table)
+    {
+        while (true)
+        {
+            {
+                Metrics::Timer timer(Metrics::Phase::Download);
+                if (!stream.next()) break;
+            }
+
+            const std::string pipeline(
+                    m_pipeline.instantiate(stream.localPath()));
+            if (!Executor::get().run(table, pipeline)) return false;
+        }
+        return true;
+    });
+}
+
+void Builder::insert(
+        const Origin originId,
+        FileInfo& info,
+        const std::function<bool(VectorPointTable&)>& execute)
+{
+    const std::string rawPath(info.path());
+    const uint64_t pointSize(m_metadata->schema().pointSize());
 
-    uint64_t inserted(0);
     uint64_t pointId(0);
+    const bool contained(this->contained(info));
 
-    ChunkKey ck(*m_metadata);
-    Clipper clipper(m_registry->cache());
+    std::unique_ptr<Clipper> held(m_registry->takeClipper());
+    Clipper& clipper(*held);
+    auto split(std::make_shared<SplitInsertion>());
+    Pool& pool(m_threadPools->workPool());
 
-    VectorPointTable table(m_metadata->schema());
-    table.setProcess([&]()
+    const auto addStats([this, originId](SplitInsertion& split)
     {
-        inserted += table.numPoints();
-
-        if (inserted > m_sleepCount)
+        if (originId == invalidOrigin) return;
+        for (const PointStats& stats : split.takeStats())
         {
-            inserted = 0;
-            clipper.clip();
+            m_metadata->mutableFiles().add(originId, stats);
         }
+    });
 
-        std::unique_ptr<ScaleOffset> so(m_metadata->outSchema().scaleOffset());
+    // Run a batch split off from this file, on whichever thread claims it.
+    const auto run([this, originId, pointSize, contained](
+                SplitInsertion& split)
+    {
+        std::vector<char> data;
+        while (split.pop(data))
+        {
+            const uint64_t bytes(data.size());
+            try
+            {
+                Clipper clipper(m_registry->cache());
+                VectorPointTable table(m_metadata->schema(), std::move(data));
+                table.setProcess([&]()
+                {
+                    split.add(
+                            insertBatch(table, originId, clipper, contained));
+                });
+                table.clear(table.capacity());
+            }
+            catch (const std::exception& e) { split.fail(e.what()); }
+            catch (...) { split.fail("Unknown error"); }
+
+            split.done(bytes);
+        }
+    });
 
-        Voxel voxel;
+    const auto process([&](VectorPointTable& table)
+    {
+        if (m_sorter)
+        {
+            sortBatch(table, originId, pointId, contained);
+            return;
+        }
 
-        PointStats pointStats;
-        const Bounds& boundsConforming(m_metadata->boundsConforming());
-        const Bounds* boundsSubset(m_metadata->boundsSubset());
+        if (!m_metadata->bulk())
+        {
+            clipper.advance(table.numPoints(), m_sleepCount);
+        }
 
-        Key key(*m_metadata);
+        // Point IDs are assigned here, in file order, so they are the same
+        // regardless of which thread ends up inserting each point.
+        std::vector<char> data;
+        data.reserve(table.numPoints() * pointSize);
 
         for (auto it(table.begin()); it != table.end(); ++it)
         {
@@ -310,36 +889,337 @@ void Builder::insertPath(const Origin originId, FileInfo& info)
             pr.setField(DimId::PointId, pointId);
             ++pointId;
 
-            voxel.initShallow(it.pointRef(), it.data());
-            if (so) voxel.clip(*so);
-            const Point& point(voxel.point());
+            data.insert(data.end(), it.data(), it.data() + pointSize);
+        }
+
+        // If a worker is free, offer it this batch.  Otherwise insert it
+        // here - we never block waiting for room in the pool.
+        split->push(std::move(data));
+        if (!pool.tryAdd([split, run]() { run(*split); })) run(*split);
+
+        addStats(*split);
+    });
+
+    const Schema& absolute(m_metadata->absoluteSchema());
+    const std::size_t capacity(
+            VectorPointTable::capacityFor(
+                absolute,
+                m_config.pointTableBytes()));
+
+    // If packing, each batch is converted from the absolute layout in which
+    // PDAL reads it to our in-memory layout, and processed from there.
+    std::unique_ptr<PointPacker> packer;
+    if (m_metadata->packed())
+    {
+        packer = makeUnique<PointPacker>(absolute, m_metadata->schema());
+    }
+
+    const Memory::Charge charge(
+            Memory::Subsystem::Tables,
+            capacity * (absolute.pointSize() +
+                (packer ? m_metadata->schema().pointSize() : 0)));
+
+    VectorPointTable packed(m_metadata->schema(), packer ? capacity : 0);
+    packed.setProcess([&]() { process(packed); });
+
+    VectorPointTable table(absolute, capacity);
+    table.setProcess([&]()
+    {
+        if (m_nativeReprojection) reproject(table);
+        if (!packer) return process(table);
+
+        uint64_t np(0);
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            packer->pack(it.data(), packed.getPoint(np++));
+        }
+        packed.clear(np);
+    });
+
+    bool ran(false);
+    {
+        // Time spent inserting is charged to its own phases, so what remains
+        // here is PDAL's reading of the input.
+        Metrics::Timer timer(Metrics::Phase::Read);
+        ran = execute(table);
+    }
+
+    // Finish any batches nobody has claimed, then wait for those that are
+    // in progress elsewhere.  Every claimed batch is already running, so this
+    // can't wait on a task stuck behind us in the queue.
+    run(*split);
+    const std::string error(split->wait());
+    addStats(*split);
+
+    if (!error.empty()) throw std::runtime_error(error);
+    if (!ran) throw std::runtime_error("Failed to execute: " + rawPath);
+
+    m_registry->giveClipper(std::move(held));
+}
+
+void Builder::reproject(VectorPointTable& table) const
+{
+    // The reader has set the table's SRS by now, from the file or from our
+    // input SRS if there was none or it was hammered.
+    const std::string in(table.anySpatialReference().getWKT());
+    if (in.empty()) throw std::runtime_error("No SRS found to reproject from");
+
+    if (!table.directXyz())
+    {
+        throw std::runtime_error("Native reprojection requires double XYZ");
+    }
+
+    SrsTransform::get(in, m_metadata->reprojection()->out()).apply(table);
+}
+
+bool Builder::contained(const FileInfo& info) const
+{
+    // The epsilon bounds allow for some imprecision in the scanned bounds and
+    // for the rounding of points to our scale, but not for the curvature of a
+    // reprojection of them.
+    const Bounds* b(info.boundsEpsilon());
+    if (!b || m_metadata->reprojection()) return false;
+
+    // Points are contained up to, but not including, the maximal edges.
+    const Bounds& conforming(m_metadata->boundsConforming());
+    if (!conforming.contains(*b) || !conforming.contains(b->max()))
+    {
+        return false;
+    }
+
+    const Subset* subset(m_metadata->subset());
+    return !subset || subset->contains(*b);
+}
+
+void Builder::sortBatch(
+        VectorPointTable& table,
+        const Origin originId,
+        uint64_t& pointId,
+        const bool contained)
+{
+    std::unique_ptr<ScaleOffset> so(m_metadata->outSchema().scaleOffset());
+    const Bounds& boundsConforming(m_metadata->boundsConforming());
+    const bool direct(table.directXyz());
+
+    // Out of bounds points are still sorted, but are dropped when they're
+    // inserted, so count them here where their origin is known.
+    Voxel voxel;
+    PointStats stats;
 
-            ck.reset();
+    for (auto it(table.begin()); it != table.end(); ++it)
+    {
+        auto& pr(it.pointRef());
+        pr.setField(DimId::OriginId, originId);
+        pr.setField(DimId::PointId, pointId);
+        ++pointId;
+
+        if (direct) voxel.initShallow(table.xyz(it.data()), it.data());
+        else voxel.initShallow(pr, it.data());
+        if (so) voxel.clip(*so);
 
-            if (boundsConforming.contains(point))
+        if (contained || boundsConforming.contains(voxel.point()))
+        {
+            stats.addInsert();
+        }
+        else stats.addOutOfBounds();
+    }
+
+    m_sorter->add(table);
+    if (originId != invalidOrigin)
+    {
+        m_metadata->mutableFiles().add(originId, stats);
+    }
+}
+
+void Builder::insertSorted()
+{
+    m_sorter->finish();
+
+    if (verbose())
+    {
+        std::cout << "Sorted " << commify(m_sorter->points()) << " points " <<
+            "in " << m_sorter->runs() << " runs - inserting..." << std::endl;
+    }
+
+    // Each task claims batches from the merged stream in turn, so consecutive
+    // batches cover nearby nodes.  A task keeps its clipper across batches so
+    // nodes it's done with are released at the usual cadence.
+    std::mutex mutex;
+    std::string error;
+    Pool& pool(m_threadPools->workPool());
+
+    for (std::size_t i(0); i < pool.numThreads(); ++i)
+    {
+        pool.add([this, &mutex, &error]()
+        {
+            Clipper clipper(m_registry->cache());
+            VectorPointTable table(
+                    m_metadata->schema(),
+                    VectorPointTable::capacityFor(
+                        m_metadata->schema(),
+                        m_config.pointTableBytes()));
+            table.setProcess([&]()
             {
-                if (!boundsSubset || boundsSubset->contains(point))
+                insertBatch(table, invalidOrigin, clipper);
+            });
+
+            try
+            {
+                while (true)
                 {
-                    key.init(point);
-                    m_registry->addPoint(voxel, key, ck, clipper);
-                    pointStats.addInsert();
+                    uint64_t np(0);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error.empty()) return;
+                        Metrics::Timer timer(Metrics::Phase::Read);
+                        np = m_sorter->read(table);
+                    }
+                    if (!np) return;
+
+                    table.clear(np);
+
+                    if (!m_metadata->bulk()) clipper.advance(np, m_sleepCount);
                 }
             }
-            else if (m_metadata->primary()) pointStats.addOutOfBounds();
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error.empty()) error = e.what();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error.empty()) error = "Unknown error during insertion";
+            }
+        });
+    }
+
+    m_threadPools->cycle();
+
+    if (!error.empty()) throw std::runtime_error(error);
+}
+
+PointStats Builder::insertBatch(
+        VectorPointTable& table,
+        const Origin originId,
+        Clipper& clipper,
+        const bool contained)
+{
+    const ChunkKey ck(*m_metadata);
+    std::unique_ptr<ScaleOffset> so(m_metadata->outSchema().scaleOffset());
+
+    Voxel voxel;
+
+    PointStats pointStats;
+    const Bounds& boundsConforming(m_metadata->boundsConforming());
+    const Subset* subset(m_metadata->subset());
+
+    Key key(*m_metadata);
+
+    Insertions batch;
+    batch.reserve(table.numPoints());
+
+    const bool direct(table.directXyz());
+
+    // Statistics of the inserted points are accumulated over the batch, and
+    // added to the shared totals once.
+    SharedDimStats* sharedStats(m_metadata->mutableDimStats());
+    DimStatsList dimStats(sharedStats ? sharedStats->make() : DimStatsList());
+    const DimList& dims(m_metadata->schema().dims());
+    pdal::PointRef pr(table, 0);
+
+    {
+        Metrics::Timer timer(Metrics::Phase::Key);
+
+        // Gather the positions into columns, so that clipping to the output
+        // scale and the bounds test run over the whole table at once.
+        Columns& c(columns());
+        c.clear();
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            if (direct) voxel.initShallow(table.xyz(it.data()), it.data());
+            else voxel.initShallow(it.pointRef(), it.data());
+            c.push(voxel.point(), it.data());
         }
 
-        if (originId != invalidOrigin)
+        const std::size_t n(c.data.size());
+        if (so)
         {
-            m_metadata->mutableFiles().add(originId, pointStats);
+            so->clip(c.x.data(), n, 0);
+            so->clip(c.y.data(), n, 1);
+            so->clip(c.z.data(), n, 2);
+        }
+        if (contained) c.inside.assign(n, 1);
+        else
+        {
+            c.inside.resize(n);
+            boundsConforming.contains(
+                    c.x.data(),
+                    c.y.data(),
+                    c.z.data(),
+                    n,
+                    c.inside.data());
         }
-    });
 
-    const json pipeline(m_config.pipeline(localPath));
+        // Likewise key each point at the root in a single pass per axis,
+        // leaving only those near a cell boundary to be keyed one at a time.
+        const Bounds& cube(m_metadata->boundsCubic());
+        const uint64_t depth(m_metadata->startDepth());
+        c.px.resize(n);
+        c.py.resize(n);
+        c.pz.resize(n);
+        c.exact.assign(n, 1);
+
+        const auto quantize([&](
+                    const std::vector<double>& v,
+                    double lo,
+                    double hi,
+                    std::vector<uint64_t>& out)
+        {
+            Key::quantize(
+                    v.data(),
+                    n,
+                    lo,
+                    hi,
+                    depth,
+                    out.data(),
+                    c.exact.data());
+        });
 
-    if (!Executor::get().run(table, pipeline))
-    {
-        throw std::runtime_error("Failed to execute: " + rawPath);
+        quantize(c.x, cube.min().x, cube.max().x, c.px);
+        quantize(c.y, cube.min().y, cube.max().y, c.py);
+        quantize(c.z, cube.min().z, cube.max().z, c.pz);
+
+        for (std::size_t i(0); i < n; ++i)
+        {
+            if (c.inside[i])
+            {
+                const Point point(c.x[i], c.y[i], c.z[i]);
+                if (contained || !subset || subset->contains(point, key))
+                {
+                    voxel.initShallow(point, c.data[i]);
+                    if (c.exact[i]) key.set(Xyz(c.px[i], c.py[i], c.pz[i]), 0);
+                    else key.init(point);
+                    batch.emplace_back(voxel, key);
+                    pointStats.addInsert();
+
+                    if (sharedStats)
+                    {
+                        pr.setPointId(i);
+                        addDimStats(dimStats, dims, pr, point);
+                    }
+                }
+            }
+            else if (m_metadata->primary()) pointStats.addOutOfBounds();
+        }
     }
+
+    if (sharedStats) sharedStats->add(dimStats);
+
+    Metrics::Timer timer(Metrics::Phase::Insert);
+    m_registry->addPoints(batch, ck, clipper);
+
+    return pointStats;
 }
 
 void Builder::save()
@@ -360,17 +1240,84 @@ void Builder::save(const arbiter::Endpoint& ep)
 
     if (verbose()) std::cout << "Reawakened: " << reawakened << std::endl;
 
+#ifndef SPINLOCK_AS_MUTEX
+    if (verbose())
+    {
+        std::cout << "Lock contention: " << commify(SpinLock::contended()) <<
+            " contended, " << commify(SpinLock::parked()) << " parked" <<
+            std::endl;
+    }
+#endif
+
     if (verbose()) std::cout << "Saving registry..." << std::endl;
     m_registry->save(m_config.hierarchyStep(), verbose());
+    m_metadata->addDuplicates(m_registry->takeDuplicates());
+    m_metadata->addThinned(m_registry->takeThinned());
+
+    // Make sure all data has landed before the metadata which references it.
+    Uploader::get().await();
+
+    if (m_metadata->packNodes() && !m_metadata->subset())
+    {
+        if (verbose()) std::cout << "Packing nodes..." << std::endl;
+        Packer(*m_metadata, *m_out, m_threadPools->workPool(), verbose()).go();
+    }
 
     if (verbose()) std::cout << "Saving metadata..." << std::endl;
-    m_metadata->save(*m_out, m_config);
+    m_metadata->save(*m_out, m_config, &m_threadPools->workPool());
+
+    if (m_metadata->cesium())
+    {
+        // The tiles themselves were written as each node was saved, so only
+        // the tileset definitions, from the hierarchy, remain.
+        if (verbose()) std::cout << "Saving tileset..." << std::endl;
+
+        json c(m_metadata->cesiumConfig());
+        c["input"] = m_out->prefixedRoot();
+        c["output"] = m_out->getSubEndpoint("cesium").prefixedRoot();
+        if (m_tmp) c["tmp"] = m_tmp->prefixedRoot();
+        c["arbiter"] = json::parse(m_config.arbiter());
+        cesium::Tileset(c).buildTileset();
+    }
+
+    Uploader::get().await();
 }
 
-void Builder::merge(Builder& other, Clipper& clipper)
+void Builder::checkpoint(Pool& downloads)
 {
-    m_registry->merge(*other.m_registry, clipper);
-    m_metadata->merge(*other.m_metadata);
+    // Let every dispatched file finish so the saved file statuses agree with
+    // the data beneath them.
+    downloads.await();
+    m_threadPools->workPool().await();
+
+    if (verbose()) std::cout << "Checkpointing..." << std::endl;
+    m_registry->checkpoint(m_config.hierarchyStep());
+    m_metadata->addDuplicates(m_registry->takeDuplicates());
+    m_metadata->addThinned(m_registry->takeThinned());
+
+    // Every node and hierarchy page is written before ept.json, so a reader
+    // may open the output as soon as this returns.  It remains marked partial
+    // until the final save.
+    Uploader::get().await();
+    m_metadata->save(*m_out, m_config, &m_threadPools->workPool(), true);
+
+    if (verbose()) std::cout << "\tCheckpoint complete" << std::endl;
+}
+
+void Builder::merge(const uint64_t id)
+{
+    const std::string postfix("-" + std::to_string(id));
+    m_registry->merge(postfix);
+    m_metadata->merge(*m_out, postfix);
+}
+
+void Builder::combine(
+        const Metadata& other,
+        const arbiter::Endpoint& ep,
+        const Origin origin)
+{
+    m_registry->combine(other, ep, origin);
+    m_metadata->combine(other, origin);
 }
 
 void Builder::prepareEndpoints()
@@ -400,6 +1347,15 @@ void Builder::prepareEndpoints()
                 throw std::runtime_error("Couldn't create data directory");
             }
 
+            for (const std::string& dir : m_metadata->dataDirs())
+            {
+                if (!arbiter::mkdirp(rootDir + "ept-data/" + dir))
+                {
+                    throw std::runtime_error(
+                            "Couldn't create data directory " + dir);
+                }
+            }
+
             if (!arbiter::mkdirp(rootDir + "ept-hierarchy"))
             {
                 throw std::runtime_error("Couldn't create hierarchy directory");
@@ -409,10 +1365,59 @@ void Builder::prepareEndpoints()
             {
                 throw std::runtime_error("Couldn't create sources directory");
             }
+
+            if (m_metadata->nodeStats().size() &&
+                    !arbiter::mkdirp(rootDir + "ept-node-stats"))
+            {
+                throw std::runtime_error("Couldn't create stats directory");
+            }
+
+            if (m_metadata->cesium() && !arbiter::mkdirp(rootDir + "cesium"))
+            {
+                throw std::runtime_error("Couldn't create cesium directory");
+            }
+        }
+    }
+
+    if (m_merge && m_merge->isLocal())
+    {
+        std::vector<std::string> dirs(m_metadata->dataDirs());
+        dirs.push_back("");
+
+        for (const std::string& dir : dirs)
+        {
+            if (!arbiter::mkdirp(m_merge->root() + dir))
+            {
+                throw std::runtime_error(
+                        "Couldn't create merge directory " + dir);
+            }
         }
     }
 }
 
+void Builder::checkBulk() const
+{
+    // Every point will be resident at once, so know up front whether that
+    // fits rather than finding out partway through.
+    const uint64_t needed(
+            m_metadata->files().totalPoints() *
+            m_metadata->schema().pointSize());
+
+    if (m_metadata->maxMemory() && needed > m_metadata->maxMemory())
+    {
+        throw std::runtime_error(
+                "Bulk build requires about " +
+                commify(needed / 1024 / 1024) + " MB of point data, " +
+                "over the maxMemory budget");
+    }
+
+    if (verbose())
+    {
+        std::cout << "Bulk build - about " << commify(needed / 1024 / 1024) <<
+            " MB of point data will be resident" << std::endl;
+    }
+}
+
 void Builder::makeWhole() { m_metadata->makeWhole(); }
 
 const Metadata& Builder::metadata() const           { return *m_metadata; }
@@ -13,6 +13,7 @@
 #include <chrono>
 #include <cstddef>
 #include <fstream>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -34,6 +35,7 @@ namespace arbiter
 {
     class Arbiter;
     class Endpoint;
+    class LocalHandle;
 }
 
 namespace entwine
@@ -42,7 +44,9 @@ namespace entwine
 class Bounds;
 class Clipper;
 class Executor;
+class ExternalSort;
 class FileInfo;
+class LasStream;
 class Metadata;
 class Pool;
 class Registry;
@@ -52,9 +56,11 @@ class Sequence;
 class Structure;
 class Subset;
 class ThreadPools;
+class VectorPointTable;
 
 class Builder
 {
+    friend class Combiner;
     friend class Merger;
     friend class Sequence;
 
@@ -67,8 +73,17 @@ public:
     // Perform indexing.  A _maxFileInsertions_ of zero inserts all files.
     void go(std::size_t maxFileInsertions = 0);
 
-    // Aggregate spatially segmented build.
-    void merge(Builder& other, Clipper& clipper);
+    // Aggregate spatially segmented build, merging the subset of our dataset
+    // with this id into our own.  Only its file list, metadata, hierarchy,
+    // and shared-depth nodes are read.
+    void merge(uint64_t id);
+
+    // Combine an independent dataset, already validated as lining up with
+    // ours, whose file list follows our own from _origin_.
+    void combine(
+            const Metadata& other,
+            const arbiter::Endpoint& ep,
+            Origin origin);
 
     // Various getters.
     const Metadata& metadata() const;
@@ -107,16 +122,67 @@ private:
     void save(std::string to);
     void save(const arbiter::Endpoint& to);
 
-    // Insert points from a file.  Sets any previously unset FileInfo fields
-    // based on file contents.
-    void insertPath(Origin origin, FileInfo& info);
+    // Wait for dispatched files to finish, then persist the tree and file
+    // statuses so an interrupted build may be continued from this point.
+    void checkpoint(Pool& downloads);
+
+    // Insert points from a localized file.  Sets any previously unset
+    // FileInfo fields based on file contents.
+    void insertPath(Origin origin, FileInfo& info, std::string localPath);
+
+    // Insert points from each window of a streamed remote file in turn.
+    void insertStream(Origin origin, FileInfo& info, LasStream& stream);
+
+    // Insert the points produced by this execution, which runs PDAL
+    // pipelines into the given table.
+    void insert(
+            Origin origin,
+            FileInfo& info,
+            const std::function<bool(VectorPointTable&)>& execute);
+
+    // Transform a batch of points from the SRS of its file to our output SRS,
+    // in place of a PDAL reprojection filter.
+    void reproject(VectorPointTable& table) const;
+
+    // True if the scanned bounds of this file lie strictly within both our
+    // conforming bounds and our subset, so that none of its points need to
+    // be tested against either.
+    bool contained(const FileInfo& info) const;
+
+    // Insert a batch of points from a single origin, returning its stats.  If
+    // _contained_, every point is known to be within our bounds.
+    PointStats insertBatch(
+            VectorPointTable& table,
+            Origin origin,
+            Clipper& clipper,
+            bool contained = false);
+
+    // With the sort engine, assign the IDs of this batch and count its
+    // points toward the stats of their file, and then hand it to the sorter
+    // rather than inserting it.
+    void sortBatch(
+            VectorPointTable& table,
+            Origin origin,
+            uint64_t& pointId,
+            bool contained);
+
+    // With the sort engine, insert the points gathered from every file, in
+    // Morton order, once all files have been read.
+    void insertSorted();
 
     // Validate sources.
     void prepareEndpoints();
 
-    // Ensure that the file at this path is accessible locally for execution.
-    // Return the local path.
-    std::string localize(std::string path, Origin origin);
+    // Verify that a bulk build's points can all be held at once.
+    void checkBulk() const;
+
+    // Ensure that the file at this path is accessible locally for execution,
+    // retrying failed downloads.
+    std::shared_ptr<arbiter::LocalHandle> localize(std::string path);
+
+    // Open this path for streamed insertion, or return null if streaming is
+    // disabled or unsupported for this file.
+    std::shared_ptr<LasStream> openStream(std::string path);
 
     //
 
@@ -129,13 +195,19 @@ private:
 
     const bool m_isContinuation = false;
     const std::size_t m_sleepCount;
+    const bool m_nativeReprojection;
+    const PipelineTemplate m_pipeline;
     std::unique_ptr<Metadata> m_metadata;
     std::unique_ptr<ThreadPools> m_threadPools;
 
+    // Where a subset writes its shared-depth nodes for merging, if set.
+    std::unique_ptr<arbiter::Endpoint> m_merge;
+
     mutable std::mutex m_mutex;
 
     std::unique_ptr<Registry> m_registry;
     std::unique_ptr<Sequence> m_sequence;
+    std::unique_ptr<ExternalSort> m_sorter;
 
     bool m_verbose;
 
@@ -10,53 +10,247 @@
 
 #include <entwine/builder/chunk-cache.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string>
+
 #include <entwine/builder/clipper.hpp>
 #include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/shallow-buffer.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/types/block-pool.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/memory.hpp>
+#include <entwine/util/time.hpp>
+#include <entwine/util/trace.hpp>
 
 namespace entwine
 {
 
 namespace
 {
-    SpinLock infoSpin;
-    ChunkCache::Info info;
+    // Statistics shared by every ChunkCache.  These are counted with relaxed
+    // atomics, since they order nothing, so that insertion threads never
+    // contend for them.
+    using Counter = std::atomic<uint64_t>;
+
+    struct DepthCounters
+    {
+        Counter alive;
+        Counter cached;
+        Counter cachedBytes;
+        Counter read;
+    };
+
+    const std::size_t serializeBuckets(20);
+
+    struct Counters
+    {
+        Counter written;
+        Counter read;
+        Counter alive;
+        std::array<DepthCounters, maxDepth> depths;
+        std::array<Counter, serializeBuckets> serializeMs;
+    };
+
+    // Zero-initialized, having static storage.
+    Counters counters;
+
+    void add(Counter& c, const uint64_t n = 1)
+    {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void sub(Counter& c, const uint64_t n = 1)
+    {
+        c.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    uint64_t load(const Counter& c)
+    {
+        return c.load(std::memory_order_relaxed);
+    }
+
+    uint64_t take(Counter& c)
+    {
+        return c.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Latching resets the counts of events since the previous latch.
+    ChunkCache::Info collect(const bool latch)
+    {
+        const auto events([latch](Counter& c)
+        {
+            return latch ? take(c) : load(c);
+        });
+
+        ChunkCache::Info info;
+        info.written = events(counters.written);
+        info.read = events(counters.read);
+        info.alive = load(counters.alive);
+
+        for (DepthCounters& c : counters.depths)
+        {
+            ChunkCache::DepthInfo depth;
+            depth.alive = load(c.alive);
+            depth.cached = load(c.cached);
+            depth.cachedBytes = load(c.cachedBytes);
+            depth.read = events(c.read);
+            info.depths.push_back(depth);
+        }
+
+        while (
+                info.depths.size() &&
+                !info.depths.back().alive &&
+                !info.depths.back().read)
+        {
+            info.depths.pop_back();
+        }
+
+        for (Counter& c : counters.serializeMs)
+        {
+            info.serializeMs.push_back(events(c));
+        }
+
+        return info;
+    }
+
+    void uncache(const Dxyz& dxyz, const uint64_t bytes)
+    {
+        sub(counters.depths[dxyz.depth()].cached);
+        sub(counters.depths[dxyz.depth()].cachedBytes, bytes);
+    }
+
+    std::size_t serializeBucket(const uint64_t ms)
+    {
+        std::size_t bucket(0);
+        while (bucket + 1 < serializeBuckets && ms >= (1ULL << bucket))
+        {
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    void trace(const char* name, const Dxyz& dxyz)
+    {
+        const Xyz& p(dxyz.position());
+        Trace::get().instant(name, dxyz.depth(), p.x, p.y, p.z);
+    }
+
+    class TraceSpan : public Trace::Span
+    {
+    public:
+        TraceSpan(const char* name, const Dxyz& dxyz)
+            : Trace::Span(
+                    name,
+                    dxyz.depth(),
+                    dxyz.position().x,
+                    dxyz.position().y,
+                    dxyz.position().z)
+        { }
+    };
 }
 
 ChunkCache::Info ChunkCache::latchInfo()
 {
-    SpinGuard lock(infoSpin);
-    Info latched = info;
-    info.written = 0;
-    info.read = 0;
-    return latched;
+    return collect(true);
+}
+
+ChunkCache::Info ChunkCache::peekInfo()
+{
+    return collect(false);
 }
 
 ChunkCache::ChunkCache(
+        const Metadata& metadata,
         Hierarchy& hierarchy,
         Pool& ioPool,
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
-        const uint64_t cacheSize)
-    : m_hierarchy(hierarchy)
+        const arbiter::Endpoint& tiles,
+        const uint64_t cacheSize,
+        const uint64_t maxMemory,
+        const std::unordered_set<PackedDxyz>* frozen,
+        const arbiter::Endpoint* merge)
+    : m_metadata(metadata)
+    , m_hierarchy(hierarchy)
     , m_pool(ioPool)
     , m_out(out)
     , m_tmp(tmp)
+    , m_tiles(tiles)
+    , m_merge(merge)
     , m_cacheSize(cacheSize)
-{ }
+    , m_maxMemory(maxMemory)
+    , m_bulk(metadata.bulk())
+    , m_partitionDepth(metadata.partitionDepth())
+    , m_previewDepth(
+            metadata.previewDepth() ? metadata.previewDepth() : maxDepth)
+    , m_pinDepth(metadata.pinDepth())
+    , m_frozen(frozen)
+    , m_spill(metadata.spill() && tmp.isLocal())
+{
+    if (const uint64_t threads = metadata.fetchThreads())
+    {
+        m_fetchPool = makeUnique<Pool>(threads, heuristics::fetchedChunks);
+    }
+
+    if (const uint64_t threads = metadata.reawakenThreads())
+    {
+        m_reawakenPool = makeUnique<Pool>(
+                threads,
+                heuristics::queuedReawakenings);
+    }
+}
 
 ChunkCache::~ChunkCache()
 {
+    if (m_reawakenPool) m_reawakenPool->join();
+    if (m_fetchPool) m_fetchPool->join();
+    m_finishing = true;
+
+    // Unpin our pinned chunks, so they are purged along with the rest.
+    for (const auto& p : m_pinned)
+    {
+        OwnedShard& shard(owned(p.first));
+        SpinGuard ownedLock(shard.spin);
+        shard.chunks[p.first] = Owned(p.second, m_clips);
+        ++m_ownedCount;
+        add(counters.depths[p.first.depth()].cached);
+        add(counters.depths[p.first.depth()].cachedBytes, p.second);
+    }
+    m_pinned.clear();
+
+    // Insertion has finished, so serialization may use every thread.
+    m_pool.setActive(m_pool.numThreads());
     maybePurge(0);
+    m_pool.await();
+
+    // Anything left in the spill tier was never reawakened, so it still needs
+    // its one and only write to the output.
+    std::vector<Task> tasks;
+    tasks.reserve(m_spilled.size());
+    for (const PackedDxyz& packed : m_spilled)
+    {
+        const ChunkKey ck(m_metadata, packed.unpack());
+        tasks.emplace_back([this, ck]()
+        {
+            NodeStats stats;
+            Chunk::saveSpilled(ck, out(ck), m_tmp, m_tiles, stats);
+            m_hierarchy.setStats(ck.get(), stats);
+        });
+    }
+    m_spilled.clear();
+    m_pool.addBatch(std::move(tasks));
+
     m_pool.join();
 
-    assert(
-            std::all_of(
-                m_slices.begin(),
-                m_slices.end(),
-                [](const std::map<Xyz, ReffedChunk>& slice)
-                {
-                    return slice.empty();
-                }));
+#ifndef NDEBUG
+    for (const auto& depth : m_slices)
+    {
+        for (const Slice& slice : depth) assert(slice.chunks.empty());
+    }
+#endif
 }
 
 void ChunkCache::insert(
@@ -67,6 +261,17 @@ void ChunkCache::insert(
 {
     assert(ck.depth() < maxDepth);
 
+    // Past the depth limit of a preview, points are discarded.
+    if (ck.depth() >= m_previewDepth) return;
+
+    if (frozen(ck))
+    {
+        key.step(voxel.point());
+        const Dir dir(getDirection(ck.bounds().mid(), voxel.point()));
+        insert(voxel, key, ck.getStep(dir), clipper);
+        return;
+    }
+
     // Get from single-threaded cache if we can.
     Chunk* chunk = clipper.get(ck);
 
@@ -82,15 +287,182 @@ void ChunkCache::insert(
     insert(voxel, key, chunk->childAt(dir), clipper);
 }
 
+void ChunkCache::insert(
+        Insertions& batch,
+        const ChunkKey& ck,
+        Clipper& clipper)
+{
+    if (batch.empty()) return;
+
+    assert(ck.depth() < maxDepth);
+
+    if (ck.depth() >= m_previewDepth)
+    {
+        Insertions().swap(batch);
+        return;
+    }
+
+    if (ck.depth() < m_partitionDepth || frozen(ck))
+    {
+        insertShallow(batch, ck, clipper);
+        return;
+    }
+
+    Chunk* chunk = clipper.get(ck);
+    if (!chunk) chunk = &addRef(ck, clipper);
+
+    const Point& mid(ck.bounds().mid());
+    std::array<Insertions, 8> children;
+
+    for (Insertion& insertion : batch)
+    {
+        Voxel& voxel(insertion.voxel);
+        Key& key(insertion.key);
+
+        if (chunk->insert(*this, clipper, voxel, key)) continue;
+
+        key.step(voxel.point());
+        const Dir dir(getDirection(mid, voxel.point()));
+        children[toIntegral(dir)].push_back(insertion);
+    }
+
+    // Release our batch before descending so we aren't holding every level's
+    // partitions at once.
+    Insertions().swap(batch);
+
+    for (uint64_t i(0); i < children.size(); ++i)
+    {
+        insert(children[i], chunk->childAt(toDir(i)), clipper);
+    }
+}
+
+void ChunkCache::merge(
+        VectorPointTable& table,
+        const ChunkKey& ck,
+        Clipper& clipper)
+{
+    Insertions conflicts;
+
+    if (ck.depth() < m_previewDepth && !frozen(ck))
+    {
+        Chunk* chunk = clipper.get(ck);
+        if (!chunk) chunk = &addRef(ck, clipper);
+        chunk->merge(table, conflicts);
+    }
+    else
+    {
+        // Nothing is retained here, so every point takes the usual path.
+        Voxel voxel;
+        Key key(m_metadata);
+        const bool direct(table.directXyz());
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            if (direct) voxel.initShallow(table.xyz(it.data()), it.data());
+            else voxel.initShallow(it.pointRef(), it.data());
+            key.init(voxel.point(), ck.depth());
+            conflicts.emplace_back(voxel, key);
+        }
+    }
+
+    insert(conflicts, ck, clipper);
+}
+
+void ChunkCache::insertShallow(
+        Insertions& batch,
+        const ChunkKey& ck,
+        Clipper& clipper)
+{
+    // Above the partition depth, points are selected within this thread's
+    // own buffer, so the shared chunks here see only the periodic merges.
+    // Frozen chunks retain nothing, so every point descends.
+    const bool buffered(ck.depth() < m_partitionDepth);
+    ShallowBuffer* shallow(buffered ? &clipper.shallow() : nullptr);
+
+    const Point& mid(ck.bounds().mid());
+    std::array<Insertions, 8> children;
+
+    for (Insertion& insertion : batch)
+    {
+        Voxel& voxel(insertion.voxel);
+        Key& key(insertion.key);
+
+        if (shallow && shallow->insert(voxel, key)) continue;
+
+        key.step(voxel.point());
+        const Dir dir(getDirection(mid, voxel.point()));
+        children[toIntegral(dir)].push_back(insertion);
+    }
+
+    Insertions().swap(batch);
+
+    for (uint64_t i(0); i < children.size(); ++i)
+    {
+        insert(children[i], ck.getStep(toDir(i)), clipper);
+    }
+
+    if (shallow && shallow->full()) shallow->flush(*this, clipper);
+}
+
+std::unique_ptr<ShallowBuffer> ChunkCache::acquireShallow()
+{
+    {
+        SpinGuard lock(m_shallowSpin);
+        if (!m_shallow.empty())
+        {
+            std::unique_ptr<ShallowBuffer> buffer(std::move(m_shallow.back()));
+            m_shallow.pop_back();
+            return buffer;
+        }
+    }
+
+    return makeUnique<ShallowBuffer>(m_metadata);
+}
+
+void ChunkCache::releaseShallow(std::unique_ptr<ShallowBuffer> buffer)
+{
+    SpinGuard lock(m_shallowSpin);
+    m_shallow.push_back(std::move(buffer));
+}
+
+void ChunkCache::flushShallow()
+{
+    if (m_reawakenPool)
+    {
+        m_reawakenPool->join();
+        const auto& errors(m_reawakenPool->errors());
+        if (!errors.empty())
+        {
+            throw std::runtime_error("Failed to reawaken: " + errors.front());
+        }
+        m_reawakenPool->go();
+    }
+
+    std::vector<std::unique_ptr<ShallowBuffer>> buffers;
+    {
+        SpinGuard lock(m_shallowSpin);
+        buffers.swap(m_shallow);
+    }
+
+    if (buffers.empty()) return;
+
+    Clipper clipper(*this);
+    for (auto& buffer : buffers) buffer->flush(*this, clipper);
+
+    SpinGuard lock(m_shallowSpin);
+    for (auto& buffer : buffers) m_shallow.push_back(std::move(buffer));
+}
+
 Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
 {
     // This is the first access of this chunk for a particular thread.
-    UniqueSpin sliceLock(m_spins[ck.depth()]);
+    trace("addRef", ck.dxyz());
+    Slice& slice(this->slice(ck.dxyz()));
+    UniqueSpin sliceLock(slice.spin);
 
-    auto& slice(m_slices[ck.depth()]);
-    auto it(slice.find(ck.position()));
+    auto& chunks(slice.chunks);
+    auto it(chunks.find(ck.position()));
 
-    if (it != slice.end())
+    if (it != chunks.end())
     {
         // We've found a reffed chunk here.  The chunk itself may not exist,
         // since the serialization and deletion steps occur asynchronously.
@@ -100,6 +472,16 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
 
         sliceLock.unlock();
 
+        // If this chunk is being serialized, wait for that to finish, after
+        // which our reference means it will have been handed back to us.
+        while (ref.serializing())
+        {
+            const std::shared_future<void> serialized(ref.serialized());
+            chunkLock.unlock();
+            serialized.wait();
+            chunkLock.lock();
+        }
+
         if (!ref.exists())
         {
             assert(ref.count() == 1);
@@ -112,10 +494,9 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
             ref.assign(ck, m_hierarchy);
             assert(ref.exists());
 
-            {
-                SpinGuard lock(infoSpin);
-                ++info.read;
-            }
+            add(counters.read);
+            add(counters.depths[ck.depth()].read);
+            reawakened(ck.dxyz());
 
             const uint64_t np = m_hierarchy.get(ck.dxyz());
             assert(np);
@@ -123,7 +504,7 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
             // Need to insert this ref prior to loading the chunk or we'll end
             // up deadlocked.
             clipper.set(ck, &ref.chunk());
-            ref.chunk().load(*this, clipper, m_out, m_tmp, np);
+            reawaken(ref, ck, clipper, np);
         }
         else clipper.set(ck, &ref.chunk());
 
@@ -131,29 +512,31 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
 
         // If we've reclaimed this chunk while it sits in our ownership list,
         // remove it from that list - it is now communally owned.
-        SpinGuard ownedLock(m_ownedSpin);
-        auto it(m_owned.find(ck.dxyz()));
-        if (it != m_owned.end())
+        OwnedShard& shard(owned(ck.dxyz()));
+        SpinGuard ownedLock(shard.spin);
+        auto it(shard.chunks.find(ck.dxyz()));
+        if (it != shard.chunks.end())
         {
             chunkLock.lock();
             assert(ref.count() > 1);
             ref.del();
-            m_owned.erase(it);
+            uncache(ck.dxyz(), it->second.bytes);
+            shard.chunks.erase(it);
+            --m_ownedCount;
         }
 
         return ref.chunk();
     }
 
     // Couldn't find this chunk, create it.
-    auto insertion = slice.emplace(
+    auto insertion = chunks.emplace(
             std::piecewise_construct,
             std::forward_as_tuple(ck.position()),
             std::forward_as_tuple(ck, m_hierarchy));
 
-    {
-        SpinGuard lock(infoSpin);
-        ++info.alive;
-    }
+    add(counters.alive);
+    add(counters.depths[ck.depth()].alive);
+    trace("create", ck.dxyz());
 
     it = insertion.first;
     assert(insertion.second);
@@ -181,69 +564,119 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
     // check this.
     if (const uint64_t np = m_hierarchy.get(ck.dxyz()))
     {
-        {
-            SpinGuard lock(infoSpin);
-            ++info.read;
-        }
-
-        ref.chunk().load(*this, clipper, m_out, m_tmp, np);
+        add(counters.read);
+        add(counters.depths[ck.depth()].read);
+        reawakened(ck.dxyz());
+        reawaken(ref, ck, clipper, np);
     }
 
     return ref.chunk();
 }
 
-void ChunkCache::clip(uint64_t depth, const std::map<Xyz, Chunk*>& stale)
+void ChunkCache::reawaken(
+        ReffedChunk& ref,
+        const ChunkKey& ck,
+        Clipper& clipper,
+        const uint64_t np)
 {
-    if (stale.empty()) return;
+    if (m_reawakenPool)
+    {
+        // Points inserted while we load are merged with those reloaded, just
+        // as they are for a concurrent insertion into a synchronous load.
+        Chunk* chunk(&ref.chunk());
+        ref.add();
+        const bool queued(m_reawakenPool->tryAdd([this, ck, chunk, np]()
+        {
+            Clipper loader(*this);
+            loader.set(ck, chunk);
 
-    auto& slice(m_slices[depth]);
-    UniqueSpin sliceLock(m_spins[depth]);
+            TraceSpan span("reawaken", ck.dxyz());
+            load(*chunk, loader, np);
+        }));
 
-    for (const auto& p : stale)
-    {
-        const auto& key(p.first);
-        assert(slice.count(key));
+        if (queued) return;
+        ref.del();
+    }
 
-        ReffedChunk& ref(slice.at(key));
-        UniqueSpin chunkLock(ref.spin());
+    TraceSpan span("reawaken", ck.dxyz());
+    load(ref.chunk(), clipper, np);
+}
 
-        assert(ref.count());
-        if (!ref.del())
-        {
-            // Defer erasing here, instead adding taking ownership.
-            ref.add();
+void ChunkCache::clip(
+        const uint64_t depth,
+        const Xyz& key,
+        Chunk* const chunk)
+{
+    const uint64_t bytes(chunk->bytes());
+    Slice& slice(this->slice(depth, key));
+    UniqueSpin sliceLock(slice.spin);
+    assert(slice.chunks.count(key));
 
-            chunkLock.unlock();
-            sliceLock.unlock();
+    ReffedChunk& ref(slice.chunks.at(key));
+    UniqueSpin chunkLock(ref.spin());
 
-            {
-                SpinGuard ownedLock(m_ownedSpin);
-                const Dxyz dxyz(depth, key);
-                assert(!m_owned.count(dxyz));
-                m_owned.insert(dxyz);
-            }
+    const Dxyz dxyz(depth, key);
+    trace("clip", dxyz);
+
+    assert(ref.count());
+    if (!ref.del())
+    {
+        // Defer erasing here, instead adding taking ownership.
+        ref.add();
 
-            sliceLock.lock();
+        chunkLock.unlock();
+        sliceLock.unlock();
+
+        // Our reference to a pinned chunk is never released, so we only get
+        // here once for each.
+        if (depth < m_pinDepth)
+        {
+            trace("pin", dxyz);
+            SpinGuard pinnedLock(m_pinnedSpin);
+            m_pinned[dxyz] = bytes;
+            return;
         }
+
+        trace("own", dxyz);
+        OwnedShard& shard(owned(dxyz));
+        SpinGuard ownedLock(shard.spin);
+        assert(!shard.chunks.count(dxyz));
+        shard.chunks[dxyz] = Owned(bytes, m_clips);
+        ++m_ownedCount;
+        add(counters.depths[depth].cached);
+        add(counters.depths[depth].cachedBytes, bytes);
     }
 }
 
 void ChunkCache::maybePurge(const uint64_t maxCacheSize)
 {
-    uint64_t disowned(0);
-    UniqueSpin ownedLock(m_ownedSpin);
-    while (m_owned.size() > maxCacheSize)
+    ++m_clips;
+    if (!overBudget(maxCacheSize)) return;
+
+    std::lock_guard<std::mutex> purgeLock(m_purgeMutex);
+
+    for (const auto& ranked : evictionOrder())
     {
-        ++disowned;
+        if (!overBudget(maxCacheSize)) break;
+
+        const Dxyz& dxyz(ranked.second);
+
+        // This chunk may have been reclaimed since we ranked it.
+        OwnedShard& shard(owned(dxyz));
+        UniqueSpin ownedLock(shard.spin);
+        auto it(shard.chunks.find(dxyz));
+        if (it == shard.chunks.end()) continue;
+        const uint64_t bytes(it->second.bytes);
 
-        const Dxyz dxyz(*m_owned.rbegin());
-        auto& slice(m_slices[dxyz.depth()]);
-        UniqueSpin sliceLock(m_spins[dxyz.depth()]);
+        Slice& slice(this->slice(dxyz));
+        UniqueSpin sliceLock(slice.spin);
 
-        ReffedChunk& ref(slice.at(dxyz.position()));
+        ReffedChunk& ref(slice.chunks.at(dxyz.position()));
         UniqueSpin chunkLock(ref.spin());
 
-        m_owned.erase(std::prev(m_owned.end()));
+        uncache(dxyz, bytes);
+        shard.chunks.erase(it);
+        --m_ownedCount;
 
         // If we're destructing and thus purging everything, we should be the
         // only ref-holder.
@@ -251,6 +684,9 @@ void ChunkCache::maybePurge(const uint64_t maxCacheSize)
 
         if (!ref.del())
         {
+            trace("purge", dxyz);
+            m_evicting += bytes;
+
             // Once we've unreffed this chunk, all bets are off as to its
             // validity.  It may be recaptured before deletion by an insertion
             // thread, or may be deleted instantly.
@@ -258,22 +694,264 @@ void ChunkCache::maybePurge(const uint64_t maxCacheSize)
             sliceLock.unlock();
             ownedLock.unlock();
 
-            // Don't hold any locks while we do this, since it may block.  We
-            // only want to block the calling thread in this case, not the
-            // whole system.
-            m_pool.add([this, dxyz]() { maybeSerialize(dxyz); });
+            Eviction eviction;
+            eviction.retention = ranked.first;
+            eviction.dxyz = dxyz;
+            eviction.bytes = bytes;
+            evict(eviction);
+        }
+    }
+}
+
+void ChunkCache::evict(const Eviction& eviction)
+{
+    {
+        // Only at our limit does the calling thread wait - otherwise the
+        // eviction is queued without blocking.
+        std::unique_lock<std::mutex> lock(m_evictionsMutex);
+        m_evictionsCv.wait(lock, [this]()
+        {
+            return m_evictions.size() < heuristics::evictionBacklog;
+        });
+
+        Eviction queued(eviction);
+        queued.order = m_evictionOrder++;
+        m_evictions.push(queued);
+        ++m_evictionCount;
+    }
 
-            ownedLock.lock();
+    // If the pool's queue is full, its queued tasks will take this eviction
+    // when they run.
+    m_pool.tryAdd([this]() { serializeEvictions(); });
+}
+
+void ChunkCache::serializeEvictions()
+{
+    while (true)
+    {
+        Eviction eviction;
+        {
+            std::lock_guard<std::mutex> lock(m_evictionsMutex);
+            if (m_evictions.empty()) return;
+
+            eviction = m_evictions.top();
+            m_evictions.pop();
+            --m_evictionCount;
         }
+        m_evictionsCv.notify_all();
+
+        maybeSerialize(eviction.dxyz);
+        m_evicting -= eviction.bytes;
+    }
+}
+
+double ChunkCache::pressure() const
+{
+    // A subsystem over its soft limit hastens clipping regardless of our own
+    // budget.
+    const double limited(Memory::get().pressure());
+
+    if (m_maxMemory)
+    {
+        const uint64_t resident(BlockPool::get().stats().resident);
+        const uint64_t evicting(m_evicting);
+        if (resident <= evicting) return limited;
+        return std::max(limited, double(resident - evicting) / m_maxMemory);
     }
+
+    if (!m_cacheSize) return limited;
+
+    return std::max(limited, double(m_ownedCount) / m_cacheSize);
+}
+
+bool ChunkCache::overBudget(const uint64_t maxCacheSize) const
+{
+    const uint64_t count(m_ownedCount);
+    if (!count) return false;
+
+    // Without a memory budget, or when purging everything, we simply retain
+    // a fixed number of unused chunks.
+    if (!m_maxMemory || !maxCacheSize) return count > maxCacheSize;
+
+    const uint64_t resident(BlockPool::get().stats().resident);
+    const uint64_t evicting(m_evicting);
+    return resident > evicting && resident - evicting > m_maxMemory;
+}
+
+std::vector<std::pair<int64_t, Dxyz>> ChunkCache::evictionOrder()
+{
+    // Each shard is locked only while it is copied, so the ranking itself
+    // blocks no one.
+    std::vector<std::pair<Dxyz, Owned>> candidates;
+    candidates.reserve(m_ownedCount);
+    for (OwnedShard& shard : m_owned)
+    {
+        SpinGuard ownedLock(shard.spin);
+        candidates.insert(
+                candidates.end(),
+                shard.chunks.begin(),
+                shard.chunks.end());
+    }
+
+    // Rank unused chunks in the order we'd prefer to serialize them.  Deep
+    // chunks are cheap to lose since they are small and rarely revisited,
+    // chunks which have sat unused for many clips are likely done, and chunks
+    // which have been reawakened before are likely to be needed again.
+    std::vector<std::pair<int64_t, Dxyz>> ranked;
+    ranked.reserve(candidates.size());
+    const uint64_t clips(m_clips);
+
+    SpinGuard lock(m_reawakenedSpin);
+    for (const auto& p : candidates)
+    {
+        const Dxyz& dxyz(p.first);
+        const Owned& owned(p.second);
+
+        const auto it(m_reawakened.find(PackedDxyz(dxyz)));
+        const int64_t reads(it != m_reawakened.end() ? it->second : 0);
+        const int64_t idle(clips - owned.since);
+
+        const int64_t retention(
+                reads * heuristics::reawakenWeight -
+                static_cast<int64_t>(dxyz.depth()) -
+                idle);
+
+        ranked.emplace_back(retention, dxyz);
+    }
+
+    std::sort(
+            ranked.begin(),
+            ranked.end(),
+            [](const std::pair<int64_t, Dxyz>& a,
+                const std::pair<int64_t, Dxyz>& b)
+            {
+                return a.first < b.first ||
+                    (a.first == b.first && b.second < a.second);
+            });
+
+    return ranked;
+}
+
+void ChunkCache::load(Chunk& chunk, Clipper& clipper, const uint64_t np)
+{
+    const PackedDxyz packed(chunk.chunkKey().dxyz());
+
+    bool spilled(false);
+    {
+        SpinGuard lock(m_spilledSpin);
+        spilled = m_spilled.erase(packed);
+    }
+
+    if (spilled) chunk.unspill(*this, clipper, m_tmp, np);
+    else if (auto stored = fetched(chunk.chunkKey().dxyz()))
+    {
+        chunk.load(*this, clipper, *stored, np);
+    }
+    else chunk.load(*this, clipper, out(chunk.chunkKey()), m_tmp, np);
+}
+
+void ChunkCache::prefetch(const Bounds& bounds)
+{
+    if (!m_fetchPool) return;
+
+    // Breadth-first, so the shallow chunks most likely to be revisited are
+    // fetched first.  Nodes without points have no descendants.
+    std::deque<ChunkKey> keys{ ChunkKey(m_metadata) };
+    while (!keys.empty())
+    {
+        const ChunkKey ck(keys.front());
+        keys.pop_front();
+
+        if (ck.depth() >= maxDepth) continue;
+        if (!ck.bounds().overlaps(bounds)) continue;
+        if (!m_hierarchy.get(ck.dxyz())) continue;
+
+        if (!frozen(ck) && !resident(ck) && !fetch(ck)) return;
+
+        for (uint64_t i(0); i < dirEnd(); ++i)
+        {
+            keys.push_back(ck.getStep(toDir(i)));
+        }
+    }
+}
+
+bool ChunkCache::resident(const ChunkKey& ck)
+{
+    {
+        SpinGuard lock(m_spilledSpin);
+        if (m_spilled.count(PackedDxyz(ck.dxyz()))) return true;
+    }
+
+    Slice& slice(this->slice(ck.dxyz()));
+    SpinGuard lock(slice.spin);
+    return slice.chunks.count(ck.position());
+}
+
+bool ChunkCache::fetch(const ChunkKey& ck)
+{
+    const PackedDxyz packed(ck.dxyz());
+
+    SpinGuard lock(m_fetchedSpin);
+    if (m_fetched.count(packed)) return true;
+
+    // Make room by dropping the oldest fetches, which may never be used.
+    if (m_fetched.size() >= heuristics::fetchedChunks)
+    {
+        while (!m_fetchOrder.empty())
+        {
+            const PackedDxyz oldest(m_fetchOrder.front());
+            m_fetchOrder.pop_front();
+            if (m_fetched.erase(oldest)) break;
+        }
+    }
+
+    using Stored = std::shared_ptr<std::vector<char>>;
+    const std::string filename(Chunk::dataName(ck));
+    const DataIo& io(m_metadata.dataIo(ck.depth()));
+    const arbiter::Endpoint& ep(out(ck));
+    std::packaged_task<Stored()> task([&io, &ep, filename]()
+    {
+        return Stored(io.fetch(ep, filename));
+    });
+    auto fetched(task.get_future().share());
+
+    if (!m_fetchPool->tryAdd(std::move(task))) return false;
+
+    m_fetched[packed] = fetched;
+    m_fetchOrder.push_back(packed);
+    return true;
+}
+
+std::shared_ptr<std::vector<char>> ChunkCache::fetched(const Dxyz& dxyz)
+{
+    Fetched fetched;
+    {
+        SpinGuard lock(m_fetchedSpin);
+        auto it(m_fetched.find(PackedDxyz(dxyz)));
+        if (it == m_fetched.end()) return nullptr;
+        fetched = it->second;
+        m_fetched.erase(it);
+    }
+
+    try { return fetched.get(); }
+    catch (...) { return nullptr; }
+}
+
+void ChunkCache::reawakened(const Dxyz& dxyz)
+{
+    SpinGuard lock(m_reawakenedSpin);
+    ++m_reawakened[PackedDxyz(dxyz)];
 }
 
 void ChunkCache::maybeSerialize(const Dxyz& dxyz)
 {
+    TraceSpan span("maybeSerialize", dxyz);
+
     // Acquire both locks in order and see what we need to do.
-    UniqueSpin sliceLock(m_spins[dxyz.depth()]);
-    auto& slice(m_slices[dxyz.depth()]);
-    auto it(slice.find(dxyz.position()));
+    Slice& slice(this->slice(dxyz));
+    UniqueSpin sliceLock(slice.spin);
+    auto& chunks(slice.chunks);
+    auto it(chunks.find(dxyz.position()));
 
     // This case represents a chunk that has been queued for serialization,
     // then reclaimed, and then queued for serialization again.  If the first
@@ -283,7 +961,7 @@ void ChunkCache::maybeSerialize(const Dxyz& dxyz)
     //
     // This check keeps us from having to search our serialization queue for
     // cleanup every time a chunk is reclaimed prior to its async serialization.
-    if (it == slice.end()) return;
+    if (it == chunks.end()) return;
 
     ReffedChunk& ref = it->second;
     UniqueSpin chunkLock(ref.spin());
@@ -304,59 +982,114 @@ void ChunkCache::maybeSerialize(const Dxyz& dxyz)
     // At this point, we have both locks, and we know our chunk exists but has
     // no refs, so serialize it.
     //
-    // The actual IO is expensive, so retain only the chunk lock.  Note: As
-    // soon as we let go of the slice lock, another thread could arrive and be
-    // waiting for this chunk lock, so we can't delete the ref from our map
-    // outright after this point without reclaiming the locks.
+    // The actual IO is expensive, so we detach the chunk from its ref and
+    // hold no locks while serializing.  A thread reclaiming the chunk in the
+    // meantime waits for the serialization to finish.  Note: As soon as we
+    // let go of the slice lock, another thread could arrive and be waiting
+    // for this chunk, so we can't delete the ref from our map outright after
+    // this point without reclaiming the locks.
     sliceLock.unlock();
 
-    assert(ref.exists());
+    std::promise<void> done;
+    std::unique_ptr<Chunk> chunk(ref.detach(done.get_future().share()));
+    chunkLock.unlock();
+
+    // A chunk which hasn't changed since it was loaded from, or saved to, our
+    // output already matches it, along with its hierarchy count and stats, so
+    // it is simply dropped.  Reawakened chunks which were only read through
+    // to reach deeper nodes are common while continuing or merging.
+    const bool dirty(chunk->dirty());
 
+    // Anything fetched for this chunk predates what we're about to write.
+    if (m_fetchPool && dirty)
     {
-        SpinGuard lock(infoSpin);
-        ++info.written;
+        SpinGuard lock(m_fetchedSpin);
+        m_fetched.erase(PackedDxyz(dxyz));
+    }
+
+    // Spilled chunks get their stats when they are finally written.
+    bool spill(dirty && m_spill && !m_finishing);
+
+    if (dirty)
+    {
+        add(counters.written);
+        const TimePoint start(now());
+
+        NodeStats stats;
+        uint64_t np(0);
+        if (spill) spill = chunk->spill(m_tmp, np);
+
+        // Without room in tmp, this chunk is written out like any other.
+        if (!spill)
+        {
+            np = chunk->save(out(chunk->chunkKey()), m_tmp, m_tiles, stats);
+        }
+
+        add(counters.serializeMs[
+                serializeBucket(since<std::chrono::milliseconds>(start))]);
+
+        m_hierarchy.set(chunk->chunkKey().get(), np);
+        if (!spill) m_hierarchy.setStats(chunk->chunkKey().get(), stats);
+        assert(np);
+
+        // Our output now matches, should this chunk be reclaimed.
+        if (!spill) chunk->clean();
     }
+    else trace("clean", dxyz);
 
-    const uint64_t np = ref.chunk().save(m_out, m_tmp);
-    m_hierarchy.set(ref.chunk().chunkKey().get(), np);
-    assert(np);
+    chunkLock.lock();
+    const bool reclaimed(ref.count());
 
-    // Cannot erase this chunk here, since we haven't been holding the
-    // sliceLock, someone may be waiting for this chunkLock.  Instead we'll
-    // just reset the pointer.  We'll have to reacquire both locks to attempt
-    // to erase it.
-    ref.reset();
+    if (spill && reclaimed) chunk->discardSpill(m_tmp);
+    else if (spill)
+    {
+        // We're holding the chunk lock, so no one can attempt to reawaken
+        // this chunk before it is recorded as spilled.
+        SpinGuard lock(m_spilledSpin);
+        m_spilled.insert(PackedDxyz(dxyz));
+    }
+
+    // If this chunk was reclaimed while we were serializing it, it goes back
+    // to its ref in memory rather than being read back from what we've just
+    // written.  Otherwise we can't erase it here, since we haven't been
+    // holding the slice lock and someone may be waiting for this chunk lock.
+    // Instead the chunk is released, and we'll have to reacquire both locks
+    // to attempt to erase it.
+    ref.finish(std::move(chunk));
+    trace(reclaimed ? "reclaimed" : "reset", dxyz);
     chunkLock.unlock();
+    done.set_value();
 
-    maybeErase(dxyz);
+    if (!reclaimed) maybeErase(dxyz);
 }
 
 void ChunkCache::maybeErase(const Dxyz& dxyz)
 {
-    UniqueSpin sliceLock(m_spins[dxyz.depth()]);
-    auto& slice(m_slices[dxyz.depth()]);
-    auto it(slice.find(dxyz.position()));
+    Slice& slice(this->slice(dxyz));
+    UniqueSpin sliceLock(slice.spin);
+    auto& chunks(slice.chunks);
+    auto it(chunks.find(dxyz.position()));
 
     // If the chunk has already been erased, no-op.
-    if (it == slice.end()) return;
+    if (it == chunks.end()) return;
 
     ReffedChunk& ref = it->second;
     UniqueSpin chunkLock(ref.spin());
 
     if (ref.count()) return;
     if (ref.exists()) return;
+    if (ref.serializing()) return;
 
     // Because we have both locks, we know that no one is waiting on this chunk.
     //
     // Release the chunkLock so the unique_lock doesn't try to unlock a deleted
     // SpinLock when it destructs.
     chunkLock.release();
-    slice.erase(it);
+    chunks.erase(it);
+    trace("maybeErase", dxyz);
 
-    {
-        SpinGuard lock(infoSpin);
-        --info.alive;
-    }
+    sub(counters.alive);
+    sub(counters.depths[dxyz.depth()].alive);
 }
 
 } // namespace entwine
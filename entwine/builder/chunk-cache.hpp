@@ -11,9 +11,21 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <entwine/builder/chunk.hpp>
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/defs.hpp>
+#include <entwine/util/pool.hpp>
 #include <entwine/util/spin-lock.hpp>
 
 namespace entwine
@@ -21,6 +33,7 @@ namespace entwine
 
 class Clipper;
 class Hierarchy;
+class ShallowBuffer;
 
 class ReffedChunk
 {
@@ -53,54 +66,353 @@ public:
         m_chunk = makeUnique<Chunk>(ck, hierarchy);
     }
 
+    // A chunk is detached from its ref while it is serialized, so its lock
+    // needn't be held for the duration.  Until the serialization finishes,
+    // threads reclaiming this chunk wait on its completion rather than
+    // spinning on the lock.  These must be called while holding the lock.
+    std::unique_ptr<Chunk> detach(std::shared_future<void> serialized)
+    {
+        assert(exists() && !serializing());
+        m_serialized = serialized;
+        return std::move(m_chunk);
+    }
+
+    bool serializing() const { return m_serialized.valid(); }
+    std::shared_future<void> serialized() const { return m_serialized; }
+
+    // Finish a serialization, returning the chunk to this ref if it has been
+    // reclaimed in the meantime.
+    void finish(std::unique_ptr<Chunk> chunk)
+    {
+        assert(!exists() && serializing());
+        m_serialized = std::shared_future<void>();
+        if (m_refs) m_chunk = std::move(chunk);
+    }
+
 private:
     SpinLock m_spin;
     uint64_t m_refs = 0;
     std::unique_ptr<Chunk> m_chunk;
+    std::shared_future<void> m_serialized;
+};
+
+// A point in transit down the tree, along with its key at the depth of the
+// chunk into which it is currently being inserted.
+struct Insertion
+{
+    Insertion(const Voxel& voxel, const Key& key) : voxel(voxel), key(key) { }
+
+    Voxel voxel;
+    Key key;
 };
 
+using Insertions = std::vector<Insertion>;
+
 class ChunkCache
 {
 public:
     ChunkCache(
+            const Metadata& metadata,
             Hierarchy& hierarchy,
             Pool& ioPool,
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
-            uint64_t cacheSize);
+            const arbiter::Endpoint& tiles,
+            uint64_t cacheSize,
+            uint64_t maxMemory = 0,
+            const std::unordered_set<PackedDxyz>* frozen = nullptr,
+            const arbiter::Endpoint* merge = nullptr);
 
     ~ChunkCache();
 
     void insert(Voxel& voxel, Key& key, const ChunkKey& ck, Clipper& clipper);
-    void clip(uint64_t depth, const std::map<Xyz, Chunk*>& stale);
-    void clipped() { maybePurge(m_cacheSize); }
+
+    // Insert a batch of points, all of which belong within the given chunk.
+    // Rather than traversing the tree once per point, points which are not
+    // retained at this depth are partitioned by direction and descend as a
+    // group, so chunk lookups are amortized over each partition.  The batch
+    // is consumed.
+    void insert(Insertions& batch, const ChunkKey& ck, Clipper& clipper);
+
+    // Merge the points of the node at _ck_ from another subset, all of which
+    // belong within it, into our own node there.  Only points landing in
+    // occupied voxels go through selection and may descend.
+    void merge(VectorPointTable& table, const ChunkKey& ck, Clipper& clipper);
+
+    // With a partition depth, each Clipper checks out a private buffer of the
+    // levels above it, which is returned to us when the Clipper is done.
+    std::unique_ptr<ShallowBuffer> acquireShallow();
+    void releaseShallow(std::unique_ptr<ShallowBuffer> buffer);
+
+    // Points dropped as exact duplicates of a voxel's occupant.
+    void addDuplicate() { ++m_duplicates; }
+    void addDuplicates(uint64_t n) { m_duplicates += n; }
+    uint64_t duplicates() const { return m_duplicates; }
+
+    // Points dropped from leaves which have reached their cap.
+    void addThinned() { ++m_thinned; }
+    uint64_t thinned() const { return m_thinned; }
+
+    // Merge every buffered shallow point into the shared chunks, after
+    // waiting for any reawakened chunks to finish loading.  No insertions may
+    // be in flight.
+    void flushShallow();
+
+    // With fetch threads, begin transferring the serialized chunks which
+    // overlap these bounds, and which aren't resident, in the background.  A
+    // reawakening of one of them then decodes the transferred data rather
+    // than blocking its thread on the read.
+    void prefetch(const Bounds& bounds);
+
+    // Release a thread's reference to this chunk.
+    void clip(uint64_t depth, const Xyz& key, Chunk* chunk);
+    void clipped() { if (!m_bulk) maybePurge(m_cacheSize); }
+
+    // The fraction of our budget in use, which may exceed 1 while we are
+    // waiting on evictions.  Measured by memory if we have a memory budget,
+    // otherwise by the number of unused chunks retained - or if greater, by
+    // the most limited of the soft memory limits.
+    double pressure() const;
+
+    // True while serialization is falling behind eviction, in which case
+    // clippers should defer releasing more chunks.
+    bool backlogged() const
+    {
+        return m_evictionCount >= heuristics::evictionBacklog / 2;
+    }
+
+    struct DepthInfo
+    {
+        // Chunks of this depth in memory, how many of those are unused and
+        // retained by the cache along with their bytes, and the number read
+        // back since the previous latch.
+        uint64_t alive = 0;
+        uint64_t cached = 0;
+        uint64_t cachedBytes = 0;
+        uint64_t read = 0;
+    };
 
     struct Info
     {
         uint64_t written = 0;
         uint64_t read = 0;
         uint64_t alive = 0;
+
+        // Indexed by depth, through the deepest with any chunks.
+        std::vector<DepthInfo> depths;
+
+        // Serializations since the previous latch taking under 1, 2, 4, ...
+        // milliseconds, with the last bucket holding any longer.
+        std::vector<uint64_t> serializeMs;
     };
 
     static Info latchInfo();
 
+    // Like latchInfo, but without resetting the written and read counts.
+    static Info peekInfo();
+
 private:
+    // A portion of the chunks at a single depth, along with the lock guarding
+    // its map.  The map itself is a std::map so that references to its
+    // values remain stable while other chunks are inserted and erased.
+    struct Slice
+    {
+        SpinLock spin;
+        std::map<Xyz, ReffedChunk> chunks;
+    };
+
+    static uint64_t shardOf(const Xyz& p)
+    {
+        const uint64_t hash(
+                (p.x * 73856093) ^ (p.y * 19349663) ^ (p.z * 83492791));
+        return hash % heuristics::chunkCacheShards;
+    }
+
+    Slice& slice(uint64_t depth, const Xyz& p)
+    {
+        return m_slices[depth][shardOf(p)];
+    }
+
+    Slice& slice(const Dxyz& dxyz)
+    {
+        return slice(dxyz.depth(), dxyz.position());
+    }
+
+    // A chunk with no remaining references other than our own, which may be
+    // serialized when the cache is over its budget.
+    struct Owned
+    {
+        Owned(uint64_t bytes = 0, uint64_t since = 0)
+            : bytes(bytes)
+            , since(since)
+        { }
+
+        uint64_t bytes;
+        uint64_t since;
+    };
+
+    // Unused chunks are sharded by key like our slices, so threads releasing
+    // and reclaiming different chunks don't contend.  A shard's lock is taken
+    // before any slice or chunk lock.
+    struct OwnedShard
+    {
+        SpinLock spin;
+        std::map<Dxyz, Owned> chunks;
+    };
+
+    OwnedShard& owned(const Dxyz& dxyz)
+    {
+        return m_owned[(dxyz.depth() + shardOf(dxyz.position())) %
+            heuristics::chunkCacheShards];
+    }
+
+    // Nodes which existed before a sparse append are never reawakened -
+    // points pass through them to the next depth.
+    bool frozen(const ChunkKey& ck) const
+    {
+        return m_frozen && m_frozen->count(PackedDxyz(ck.dxyz()));
+    }
+
+    void insertShallow(
+            Insertions& batch,
+            const ChunkKey& ck,
+            Clipper& clipper);
+
     Chunk& addRef(const ChunkKey& ck, Clipper& clipper);
     void maybeSerialize(const Dxyz& dxyz);
     void maybeErase(const Dxyz& dxyz);
     void maybePurge(uint64_t maxCacheSize);
 
+    bool overBudget(uint64_t maxCacheSize) const;
+
+    // Unused chunks with their retention, least worth retaining first.
+    std::vector<std::pair<int64_t, Dxyz>> evictionOrder();
+
+    // A chunk evicted from the cache, awaiting serialization.  Those least
+    // worth retaining are serialized first, and among equals, the oldest.
+    struct Eviction
+    {
+        int64_t retention = 0;
+        uint64_t order = 0;
+        Dxyz dxyz;
+        uint64_t bytes = 0;
+
+        // Ordered for a max-heap: true if we are less urgent than other.
+        bool operator<(const Eviction& other) const
+        {
+            if (retention != other.retention)
+            {
+                return retention > other.retention;
+            }
+            return order > other.order;
+        }
+    };
+
+    void evict(const Eviction& eviction);
+
+    // Serialize queued evictions, most urgent first, until none remain.
+    void serializeEvictions();
+
+    void reawakened(const Dxyz& dxyz);
+
+    bool resident(const ChunkKey& ck);
+
+    // Returns false if no more chunks may be fetched at this time.
+    bool fetch(const ChunkKey& ck);
+
+    // Take the fetched data of this chunk, if any.  Null if it was never
+    // fetched or its transfer failed, in which case it must be read.
+    std::shared_ptr<std::vector<char>> fetched(const Dxyz& dxyz);
+
+    // Reinitialize a chunk being reawakened, from our spill tier if we
+    // spilled it or otherwise from the output.
+    void load(Chunk& chunk, Clipper& clipper, uint64_t np);
+
+    // Load a chunk which the given clipper has just reffed.  With reawaken
+    // threads, the load is queued with a reference of its own, so the caller
+    // may insert into the chunk while its points are reloaded.  Must be
+    // called while holding the chunk's lock.
+    void reawaken(
+            ReffedChunk& ref,
+            const ChunkKey& ck,
+            Clipper& clipper,
+            uint64_t np);
+
+    const Metadata& m_metadata;
     Hierarchy& m_hierarchy;
     Pool& m_pool;
+    // The endpoint holding this node's data, which for shared-depth nodes of
+    // a subset may be the merge endpoint rather than the output.
+    const arbiter::Endpoint& out(const ChunkKey& ck) const
+    {
+        return m_merge && m_metadata.mergesAt(ck.depth()) ? *m_merge : m_out;
+    }
+
     const arbiter::Endpoint& m_out;
     const arbiter::Endpoint& m_tmp;
+    const arbiter::Endpoint& m_tiles;
+    const arbiter::Endpoint* m_merge;
     const uint64_t m_cacheSize = 64;
+    const uint64_t m_maxMemory = 0;
+    const bool m_bulk = false;
+    const uint64_t m_partitionDepth = 0;
+    const uint64_t m_previewDepth = maxDepth;
+    const uint64_t m_pinDepth = 0;
+    const std::unordered_set<PackedDxyz>* const m_frozen = nullptr;
+
+    std::array<
+        std::array<Slice, heuristics::chunkCacheShards>,
+        maxDepth> m_slices;
+
+    std::array<OwnedShard, heuristics::chunkCacheShards> m_owned;
+    std::atomic<uint64_t> m_ownedCount{ 0 };
+
+    // Chunks above the pin depth keep a reference of ours from their first
+    // release until we are destroyed, so they are never owned or evicted.
+    SpinLock m_pinnedSpin;
+    std::map<Dxyz, uint64_t> m_pinned;
+    std::atomic<uint64_t> m_clips{ 0 };
+    std::atomic<uint64_t> m_duplicates{ 0 };
+    std::atomic<uint64_t> m_thinned{ 0 };
+
+    // Held while evicting.  Threads which find us over budget wait for it,
+    // which throttles insertion until evictions catch up.
+    std::mutex m_purgeMutex;
+
+    // Each queued serialization task takes whichever eviction is most urgent
+    // when it runs, so chunks reclaimed in the meantime are simply found to
+    // be in use and skipped.
+    std::mutex m_evictionsMutex;
+    std::condition_variable m_evictionsCv;
+    std::priority_queue<Eviction> m_evictions;
+    std::atomic<uint64_t> m_evictionCount{ 0 };
+    uint64_t m_evictionOrder = 0;
+
+    // Bytes of chunks which have been queued for serialization but not yet
+    // released, so we don't keep evicting while waiting on them.
+    std::atomic<uint64_t> m_evicting{ 0 };
+
+    SpinLock m_shallowSpin;
+    std::vector<std::unique_ptr<ShallowBuffer>> m_shallow;
+
+    mutable SpinLock m_reawakenedSpin;
+    std::unordered_map<PackedDxyz, uint64_t> m_reawakened;
 
-    std::array<SpinLock, maxDepth> m_spins;
-    std::array<std::map<Xyz, ReffedChunk>, maxDepth> m_slices;
+    // Chunks evicted to the spill tier, which still need to be written to
+    // the output.  While finishing, evictions go straight to the output.
+    const bool m_spill = false;
+    std::atomic<bool> m_finishing{ false };
+    SpinLock m_spilledSpin;
+    std::unordered_set<PackedDxyz> m_spilled;
 
-    SpinLock m_ownedSpin;
-    std::set<Dxyz> m_owned;
+    // Data fetched ahead of reawakening, which is discarded when its chunk is
+    // next serialized since it is then out of date.
+    using Fetched = std::shared_future<std::shared_ptr<std::vector<char>>>;
+    SpinLock m_fetchedSpin;
+    std::unordered_map<PackedDxyz, Fetched> m_fetched;
+    std::deque<PackedDxyz> m_fetchOrder;
+    std::unique_ptr<Pool> m_fetchPool;
+    std::unique_ptr<Pool> m_reawakenPool;
 };
 
 } // namespace entwine
@@ -10,44 +10,103 @@
 
 #include <entwine/builder/chunk.hpp>
 
+#include <cstring>
+#include <new>
+#include <numeric>
+
 #include <entwine/builder/chunk-cache.hpp>
 #include <entwine/builder/hierarchy.hpp>
+#include <entwine/formats/cesium/glb.hpp>
+#include <entwine/formats/cesium/pnts.hpp>
 #include <entwine/io/io.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/types/voxel.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/tmp-space.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+    // The chunk whose own points this thread is reinserting, if any.
+    thread_local const Chunk* reloadingChunk(nullptr);
+
+    class Reloading
+    {
+    public:
+        Reloading(const Chunk* chunk) : m_previous(reloadingChunk)
+        {
+            reloadingChunk = chunk;
+        }
+
+        ~Reloading() { reloadingChunk = m_previous; }
+
+    private:
+        const Chunk* const m_previous;
+    };
+}
+
+bool Chunk::reloading() const
+{
+    return reloadingChunk == this;
+}
+
 Chunk::Chunk(const ChunkKey& ck, const Hierarchy& hierarchy)
     : m_metadata(ck.metadata())
     , m_span(m_metadata.span())
     , m_pointSize(m_metadata.schema().pointSize())
+    , m_copy(m_pointSize)
+    , m_selection(m_metadata.selection())
+    , m_duplicate(m_metadata.dedup(), m_metadata.schema())
     , m_chunkKey(ck)
-    , m_childKeys { {
-        ck.getStep(toDir(0)),
-        ck.getStep(toDir(1)),
-        ck.getStep(toDir(2)),
-        ck.getStep(toDir(3)),
-        ck.getStep(toDir(4)),
-        ck.getStep(toDir(5)),
-        ck.getStep(toDir(6)),
-        ck.getStep(toDir(7))
-    } }
+    , m_leaf(ck.depth() >= m_metadata.leafDepth())
     , m_grid(m_span * m_span)
     , m_gridBlock(m_pointSize, 4096)
 {
-    for (uint64_t i(0); i < dirEnd(); ++i)
+    // Children past the depth limit of a preview get no overflow, and
+    // neither do those which already have points.
+    const uint64_t preview(m_metadata.previewDepth());
+    if (!preview || ck.depth() + 1 < preview)
     {
-        const Dir dir(toDir(i));
-
-        // If there are already points here, it gets no overflow.
-        if (!hierarchy.get(childAt(dir).dxyz()))
+        const Dxyz dxyz(ck.dxyz());
+        const std::array<uint64_t, 8> children(hierarchy.children(dxyz));
+        for (uint64_t i(0); i < dirEnd(); ++i)
         {
-            m_overflows[i] = makeUnique<Overflow>(ck.getStep(dir));
+            if (children[i]) continue;
+            m_overflows[i] = makeUnique<Overflow>(
+                    m_metadata,
+                    dxyz.child(toDir(i)));
         }
     }
+
+    Memory::get().add(Memory::Subsystem::Chunks, gridBytes());
+}
+
+static_assert(
+        std::is_trivially_destructible<ChunkKey>::value,
+        "Lazily built child keys are never destroyed");
+
+Chunk::~Chunk()
+{
+    Memory::get().sub(Memory::Subsystem::Chunks, gridBytes());
+}
+
+uint64_t Chunk::bytes()
+{
+    uint64_t bytes(0);
+
+    bytes += m_gridBlock.bytes();
+
+    SpinGuard lock(m_overflowSpin);
+    for (const auto& overflow : m_overflows)
+    {
+        if (overflow) bytes += overflow->block().bytes();
+    }
+
+    return bytes;
 }
 
 bool Chunk::insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key)
@@ -58,22 +117,25 @@ bool Chunk::insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key)
 
     UniqueSpin tubeLock(tube.spin());
     Voxel& dst(tube[pos.z]);
+    modified();
 
     if (dst.data())
     {
-        const Point& mid(key.bounds().mid());
-        if (voxel.point().sqDist3d(mid) < dst.point().sqDist3d(mid))
+        if (m_duplicate(voxel.point(), voxel.data(), dst.point(), dst.data()))
+        {
+            cache.addDuplicate();
+            return true;
+        }
+
+        if (selection::displaces(m_selection, voxel.point(), dst.point(), key))
         {
-            voxel.swapDeep(dst, m_pointSize);
+            voxel.swapDeep(dst, m_copy);
         }
     }
     else
     {
-        {
-            SpinGuard lock(m_spin);
-            dst.setData(m_gridBlock.next());
-        }
-        dst.initDeep(voxel.point(), voxel.data(), m_pointSize);
+        dst.setData(m_gridBlock.next(i));
+        dst.initDeep(voxel.point(), voxel.data(), m_copy);
         return true;
     }
 
@@ -82,47 +144,106 @@ bool Chunk::insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key)
     return insertOverflow(cache, clipper, voxel, key);
 }
 
+void Chunk::merge(VectorPointTable& table, std::vector<Insertion>& conflicts)
+{
+    Voxel voxel;
+    Key key(m_metadata);
+    modified();
+
+    const bool direct(table.directXyz());
+    for (auto it(table.begin()); it != table.end(); ++it)
+    {
+        if (direct) voxel.initShallow(table.xyz(it.data()), it.data());
+        else voxel.initShallow(it.pointRef(), it.data());
+        key.init(voxel.point(), m_chunkKey.depth());
+
+        const Xyz& pos(key.position());
+        const uint64_t i((pos.y % m_span) * m_span + (pos.x % m_span));
+        auto& tube(m_grid[i]);
+
+        {
+            SpinGuard lock(tube.spin());
+            Voxel& dst(tube[pos.z]);
+            if (!dst.data())
+            {
+                dst.setData(m_gridBlock.next(i));
+                dst.initDeep(voxel.point(), voxel.data(), m_copy);
+                continue;
+            }
+        }
+
+        conflicts.emplace_back(voxel, key);
+    }
+}
+
+void Chunk::makeChild(const Dir dir) const
+{
+    const uint32_t bit(1u << toIntegral(dir));
+
+    SpinGuard lock(m_childSpin);
+    if (m_childMask.load(std::memory_order_relaxed) & bit) return;
+
+    new (&m_childKeys[toIntegral(dir)]) ChunkKey(m_chunkKey.getStep(dir));
+    m_childMask.fetch_or(bit, std::memory_order_release);
+}
+
 bool Chunk::insertOverflow(
         ChunkCache& cache,
         Clipper& clipper,
         Voxel& voxel,
         Key& key)
 {
-    if (m_chunkKey.depth() < m_metadata.overflowDepth()) return false;
+    if (!m_leaf && m_chunkKey.depth() < m_metadata.overflowDepth())
+    {
+        return false;
+    }
 
     const Dir dir(getDirection(m_chunkKey.bounds().mid(), voxel.point()));
     const uint64_t i(toIntegral(dir));
 
-    SpinGuard lock(m_overflowSpin);
+    UniqueSpin lock(m_overflowSpin);
 
     if (!m_overflows[i]) return false;
 
+    // A leaf never splits, so its overflow only grows, up to its cap.
+    if (m_leaf)
+    {
+        const uint64_t cap(m_metadata.leafPoints());
+        if (cap && m_overflowCount >= cap) cache.addThinned();
+        else
+        {
+            m_overflows[i]->insert(voxel, key);
+            ++m_overflowCount;
+        }
+        return true;
+    }
+
     m_overflows[i]->insert(voxel, key);
 
     // Overflow inserted, update metric and perform overflow if needed.
-    if (++m_overflowCount >= m_metadata.minNodeSize())
-    {
-        maybeOverflow(cache, clipper);
-    }
+    if (++m_overflowCount < m_metadata.minNodeSize()) return true;
+
+    uint64_t selected(0);
+    std::unique_ptr<Overflow> active(maybeOverflow(selected));
 
+    // Our bookkeeping has been fully updated for the removal of the selected
+    // overflow, so its points may be redistributed without holding our lock.
+    lock.unlock();
+
+    if (active) doOverflow(cache, clipper, selected, *active);
     return true;
 }
 
-void Chunk::maybeOverflow(ChunkCache& cache, Clipper& clipper)
+std::unique_ptr<Overflow> Chunk::maybeOverflow(uint64_t& selectedIndex)
 {
     // See if our resident size is big enough to overflow.
-    uint64_t gridSize(0);
-    {
-        SpinGuard lock(m_spin);
-        gridSize = m_gridBlock.size();
-    }
+    const uint64_t gridSize(m_gridBlock.size());
 
     const uint64_t ourSize(gridSize + m_overflowCount);
-    if (ourSize < m_metadata.maxNodeSize()) return;
+    if (ourSize < m_metadata.maxNodeSize()) return nullptr;
 
     // Find the overflow with the largest point count.
     uint64_t selectedSize = 0;
-    uint64_t selectedIndex = 0;
     for (uint64_t d(0); d < m_overflows.size(); ++d)
     {
         auto& current(m_overflows[d]);
@@ -135,55 +256,286 @@ void Chunk::maybeOverflow(ChunkCache& cache, Clipper& clipper)
 
     // Make sure our largest overflow is large enough to necessitate
     // overflowing into its own node.
-    if (selectedSize < m_metadata.minNodeSize()) return;
+    if (selectedSize < m_metadata.minNodeSize()) return nullptr;
 
-    doOverflow(cache, clipper, selectedIndex);
+    std::unique_ptr<Overflow> active;
+    std::swap(m_overflows[selectedIndex], active);
+    m_overflowCount -= active->size();
+    return active;
 }
 
-void Chunk::doOverflow(ChunkCache& cache, Clipper& clipper, uint64_t dir)
+void Chunk::doOverflow(
+        ChunkCache& cache,
+        Clipper& clipper,
+        const uint64_t dir,
+        Overflow& active)
 {
-    assert(m_overflows[dir]);
+    Metrics::Timer timer(Metrics::Phase::Overflow);
 
-    std::unique_ptr<Overflow> active;
-    std::swap(m_overflows[dir], active);
-    m_overflowCount -= active->size();
+    // Our output holds these points, which now belong to our child.
+    m_dirty = true;
+
+    // Every entry belongs to the same child, so insert them as a single batch
+    // rather than acquiring that child once per point.  The entries' data
+    // remains owned by the overflow's block until the batch is consumed.
+    Insertions batch;
+    batch.reserve(active.size());
+
+    for (uint64_t i(0); i < active.size(); ++i)
+    {
+        const Voxel voxel(active.voxel(i));
+        Key key(active.key(i));
+        key.step(voxel.point());
+        batch.emplace_back(voxel, key);
+    }
+
+    cache.insert(batch, childAt(toDir(dir)), clipper);
+}
+
+namespace
+{
+    // Spill files start with the point counts of our grid and then of each
+    // overflow, followed by the points of each in that order, and then the
+    // tube index and Z position of every point.
+    const std::size_t spillHeaderSize(sizeof(SpillCounts));
+    const std::size_t slotSize(sizeof(uint32_t) * 2);
+
+    uint64_t spillBytes(const uint64_t pointSize, const uint64_t np)
+    {
+        return spillHeaderSize + np * (pointSize + slotSize);
+    }
 
-    // TODO We could unlock our overflowSpin here - bookkeeping has been
-    // fully updated for the removal of this Overflow.
+    void removeSpill(
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            const uint64_t bytes)
+    {
+        arbiter::remove(tmp.prefixedRoot() + filename);
+        TmpSpace::get().uncharge(bytes);
+    }
+
+    std::pair<SpillCounts, uint64_t> readSpillCounts(
+            const std::vector<char>& data,
+            const uint64_t pointSize,
+            const std::string& filename)
+    {
+        std::pair<SpillCounts, uint64_t> result;
+        if (data.size() < spillHeaderSize)
+        {
+            throw std::runtime_error("Invalid spill: " + filename);
+        }
+
+        std::memcpy(result.first.data(), data.data(), spillHeaderSize);
+        result.second = std::accumulate(
+                result.first.begin(),
+                result.first.end(),
+                uint64_t(0));
 
-    const ChunkKey ck(m_childKeys[dir]);
+        if (data.size() != spillBytes(pointSize, result.second))
+        {
+            throw std::runtime_error("Invalid spill: " + filename);
+        }
+
+        return result;
+    }
 
-    for (auto& entry : active->list())
+    std::string spillName(const ChunkKey& ck)
     {
-        entry.key.step(entry.voxel.point());
-        cache.insert(entry.voxel, entry.key, ck, clipper);
+        return ck.toString() + ck.metadata().postfix(ck.depth()) + ".spill";
+    }
+
+    void writeTile(
+            const ChunkKey& ck,
+            const arbiter::Endpoint& tiles,
+            BlockPointTable& table)
+    {
+        const cesium::Settings* settings(ck.metadata().cesium());
+        if (!settings) return;
+
+        const std::string name(ck.get().toString() + settings->extension());
+        if (settings->glb())
+        {
+            cesium::Glb glb(*settings, ck, table.size());
+            ensurePut(tiles, name, glb.build(table));
+        }
+        else
+        {
+            cesium::Pnts pnts(*settings, ck, table.size());
+            ensurePut(tiles, name, pnts.build(table));
+        }
     }
 }
 
+std::string Chunk::dataName(const ChunkKey& ck)
+{
+    const Metadata& metadata(ck.metadata());
+    return metadata.dataName(ck.dxyz()) + metadata.postfix(ck.depth());
+}
+
+NodeStats Chunk::getStats(
+        const Metadata& metadata,
+        BlockPointTable& table)
+{
+    const std::vector<std::string>& names(metadata.nodeStats());
+    NodeStats stats(names.size());
+    if (names.empty()) return stats;
+
+    // XYZ may be held scaled in memory, so apply their scaling to report
+    // the ranges of their actual values.
+    std::vector<DimId> ids;
+    std::vector<std::pair<double, double>> scaling;
+    for (const auto& name : names)
+    {
+        const DimId id(metadata.schema().getId(name));
+        const DimInfo& info(metadata.schema().find(id));
+        ids.push_back(id);
+
+        if (id == DimId::X || id == DimId::Y || id == DimId::Z)
+        {
+            scaling.emplace_back(info.scale(), info.offset());
+        }
+        else scaling.emplace_back(1.0, 0.0);
+    }
+
+    pdal::PointRef pr(table, 0);
+    for (uint64_t i(0); i < table.size(); ++i)
+    {
+        pr.setPointId(i);
+        for (std::size_t d(0); d < ids.size(); ++d)
+        {
+            stats[d].add(
+                    pr.getFieldAs<double>(ids[d]) * scaling[d].first +
+                    scaling[d].second);
+        }
+    }
+
+    return stats;
+}
+
 uint64_t Chunk::save(
         const arbiter::Endpoint& out,
-        const arbiter::Endpoint& tmp) const
+        const arbiter::Endpoint& tmp,
+        const arbiter::Endpoint& tiles,
+        NodeStats& stats) const
 {
+    Metrics::Timer timer(Metrics::Phase::Serialize);
+
     uint64_t np(m_gridBlock.size());
     for (const auto& o : m_overflows) if (o) np += o->size();
 
     BlockPointTable table(m_metadata.schema());
     table.reserve(np);
-    table.insert(m_gridBlock);
+    m_gridBlock.insertInto(table);
     for (auto& o : m_overflows) if (o) table.insert(o->block());
+    pointOrder::sort(m_metadata.pointOrder(), m_chunkKey.bounds(), table);
 
-    const auto filename(
-            m_chunkKey.toString() + m_metadata.postfix(m_chunkKey.depth()));
-    m_metadata.dataIo().write(
+    stats = getStats(m_metadata, table);
+
+    m_metadata.dataIo(m_chunkKey.depth()).write(
             out,
             tmp,
-            filename,
+            dataName(m_chunkKey),
             m_chunkKey.bounds(),
             table);
+    writeTile(m_chunkKey, tiles, table);
 
     return np;
 }
 
+bool Chunk::spill(const arbiter::Endpoint& tmp, uint64_t& np) const
+{
+    Metrics::Timer timer(Metrics::Phase::Serialize);
+
+    SpillCounts counts;
+    counts.fill(0);
+    counts[0] = m_gridBlock.size();
+    for (std::size_t i(0); i < m_overflows.size(); ++i)
+    {
+        if (m_overflows[i]) counts[i + 1] = m_overflows[i]->size();
+    }
+
+    const uint64_t total(
+            std::accumulate(counts.begin(), counts.end(), uint64_t(0)));
+
+    const uint64_t bytes(spillBytes(m_pointSize, total));
+    if (!TmpSpace::get().tryCharge(bytes)) return false;
+
+    std::vector<char> data(bytes);
+    std::memcpy(data.data(), counts.data(), spillHeaderSize);
+
+    char* pos(data.data() + spillHeaderSize);
+    char* slot(pos + total * m_pointSize);
+
+    const auto append([this, &pos, &slot](
+                const char* src,
+                uint32_t tube,
+                uint32_t z)
+    {
+        m_copy.copy(pos, src);
+        std::memcpy(slot, &tube, sizeof(uint32_t));
+        std::memcpy(slot + sizeof(uint32_t), &z, sizeof(uint32_t));
+        pos += m_pointSize;
+        slot += slotSize;
+    });
+
+    for (std::size_t i(0); i < m_grid.size(); ++i)
+    {
+        m_grid[i].forEach([&append, i](uint32_t z, const Voxel& voxel)
+        {
+            append(voxel.data(), i, z);
+        });
+    }
+
+    for (const auto& o : m_overflows)
+    {
+        if (!o) continue;
+        for (uint64_t i(0); i < o->size(); ++i)
+        {
+            append(o->voxel(i).data(), o->tube(i), o->z(i));
+        }
+    }
+
+    assert(pos == data.data() + spillHeaderSize + total * m_pointSize);
+
+    ensurePut(tmp, spillName(m_chunkKey), data);
+    np = total;
+    return true;
+}
+
+void Chunk::saveSpilled(
+        const ChunkKey& ck,
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const arbiter::Endpoint& tiles,
+        NodeStats& stats)
+{
+    Metrics::Timer timer(Metrics::Phase::Serialize);
+
+    const Metadata& metadata(ck.metadata());
+    const uint64_t pointSize(metadata.schema().pointSize());
+    const std::string filename(spillName(ck));
+
+    std::vector<char> data(tmp.getBinary(filename));
+    const uint64_t np(readSpillCounts(data, pointSize, filename).second);
+
+    BlockPointTable table(metadata.schema());
+    table.reserve(np);
+
+    char* pos(data.data() + spillHeaderSize);
+    for (uint64_t i(0); i < np; ++i) table.insert(pos + i * pointSize);
+    pointOrder::sort(metadata.pointOrder(), ck.bounds(), table);
+
+    stats = getStats(metadata, table);
+    metadata.dataIo(ck.depth()).write(
+            out,
+            tmp,
+            dataName(ck),
+            ck.bounds(),
+            table);
+    writeTile(ck, tiles, table);
+    removeSpill(tmp, filename, data.size());
+}
+
 void Chunk::load(
         ChunkCache& cache,
         Clipper& clipper,
@@ -191,23 +543,165 @@ void Chunk::load(
         const arbiter::Endpoint& tmp,
         const uint64_t np)
 {
-    VectorPointTable table(m_metadata.schema(), np);
+    // Other threads may insert into us while we load, which dirties us.
+    clean();
+    Reloading reloading(this);
+
+    VectorPointTable table(m_metadata.schema(), np, VectorPointTable::Reuse());
+    table.setProcess([&]() { reinsert(cache, clipper, table); });
+    m_metadata.dataIo(m_chunkKey.depth()).read(
+            out,
+            tmp,
+            dataName(m_chunkKey),
+            table);
+}
+
+void Chunk::load(
+        ChunkCache& cache,
+        Clipper& clipper,
+        const std::vector<char>& stored,
+        const uint64_t np)
+{
+    clean();
+    Reloading reloading(this);
+
+    VectorPointTable table(m_metadata.schema(), np, VectorPointTable::Reuse());
+    table.setProcess([&]() { reinsert(cache, clipper, table); });
+    m_metadata.dataIo(m_chunkKey.depth()).decode(stored, table);
+}
+
+void Chunk::discardSpill(const arbiter::Endpoint& tmp) const
+{
+    // We haven't changed since spilling, so neither has our size.
+    uint64_t np(m_gridBlock.size());
+    for (const auto& o : m_overflows) if (o) np += o->size();
+    removeSpill(tmp, spillName(m_chunkKey), spillBytes(m_pointSize, np));
+}
+
+void Chunk::unspill(
+        ChunkCache& cache,
+        Clipper& clipper,
+        const arbiter::Endpoint& tmp,
+        const uint64_t np)
+{
+    const std::string filename(spillName(m_chunkKey));
+
+    const std::vector<char> data(tmp.getBinary(filename));
+    const auto counts(readSpillCounts(data, m_pointSize, filename));
+    if (counts.second != np)
+    {
+        throw std::runtime_error("Invalid spill size: " + filename);
+    }
+
+    removeSpill(tmp, filename, data.size());
+
+    const char* points(data.data() + spillHeaderSize);
+    const char* slots(points + np * m_pointSize);
+
+    VectorPointTable table(
+            m_metadata.schema(),
+            std::vector<char>(points, slots));
     table.setProcess([&]()
     {
-        Voxel voxel;
-        Key key(m_metadata);
+        restore(cache, clipper, table, counts.first, slots);
+    });
+    table.clear(np);
+}
+
+void Chunk::reinsert(
+        ChunkCache& cache,
+        Clipper& clipper,
+        VectorPointTable& table)
+{
+    Voxel voxel;
+    Key key(m_metadata);
+
+    const bool direct(table.directXyz());
+    for (auto it(table.begin()); it != table.end(); ++it)
+    {
+        if (direct) voxel.initShallow(table.xyz(it.data()), it.data());
+        else voxel.initShallow(it.pointRef(), it.data());
+        key.init(voxel.point(), m_chunkKey.depth());
+        cache.insert(voxel, key, m_chunkKey, clipper);
+    }
+}
+
+void Chunk::restore(
+        ChunkCache& cache,
+        Clipper& clipper,
+        VectorPointTable& table,
+        const SpillCounts& counts,
+        const char* slots)
+{
+    Voxel voxel;
+    Key key(m_metadata);
+
+    const Xyz& base(m_chunkKey.position());
+    const uint64_t shift(m_metadata.startDepth());
+    const bool direct(table.directXyz());
 
-        for (auto it(table.begin()); it != table.end(); ++it)
+    uint64_t index(0);
+    for (std::size_t section(0); section < counts.size(); ++section)
+    {
+        for (uint64_t i(0); i < counts[section]; ++i, ++index)
         {
-            voxel.initShallow(it.pointRef(), it.data());
-            key.init(voxel.point(), m_chunkKey.depth());
+            uint32_t tube(0);
+            uint32_t z(0);
+            const char* slot(slots + index * slotSize);
+            std::memcpy(&tube, slot, sizeof(uint32_t));
+            std::memcpy(&z, slot + sizeof(uint32_t), sizeof(uint32_t));
+
+            char* pos(table.getPoint(index));
+            if (direct) voxel.initShallow(table.xyz(pos), pos);
+            else voxel.initShallow(table.at(index), pos);
+
+            // The first section is our grid and the rest our overflows.  If
+            // a concurrent insertion has claimed this point's spot in the
+            // meantime, or its overflow no longer exists, fall back to a
+            // regular insertion.
+            if (!section)
+            {
+                if (restoreGridVoxel(voxel, tube, z)) continue;
+            }
+
+            key.set(
+                    Xyz(
+                        (base.x << shift) | (tube % m_span),
+                        (base.y << shift) | (tube / m_span),
+                        (base.z << shift) | (z % m_span)),
+                    m_chunkKey.depth());
+
+            if (section)
+            {
+                SpinGuard lock(m_overflowSpin);
+                if (auto& overflow = m_overflows[section - 1])
+                {
+                    overflow->insert(voxel, key);
+                    ++m_overflowCount;
+                    continue;
+                }
+            }
+
             cache.insert(voxel, key, m_chunkKey, clipper);
         }
-    });
+    }
+}
 
-    const auto filename(
-            m_chunkKey.toString() + m_metadata.postfix(m_chunkKey.depth()));
-    m_metadata.dataIo().read(out, tmp, filename, table);
+bool Chunk::restoreGridVoxel(Voxel& voxel, const uint64_t tube, uint32_t z)
+{
+    if (tube >= m_grid.size())
+    {
+        throw std::runtime_error("Invalid spilled voxel position");
+    }
+
+    auto& t(m_grid[tube]);
+    SpinGuard tubeLock(t.spin());
+    Voxel& dst(t[z]);
+    if (dst.data()) return false;
+
+    dst.setData(m_gridBlock.next(tube));
+    dst.initDeep(voxel.point(), voxel.data(), m_copy);
+    return true;
 }
 
 } // namespace entwine
@@ -10,12 +10,28 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/builder/overflow.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/node-stats.hpp>
+#include <entwine/types/selection.hpp>
 #include <entwine/types/vector-point-table.hpp>
+#include <entwine/types/voxel.hpp>
+#include <entwine/util/huge-pages.hpp>
+#include <entwine/util/memory.hpp>
 #include <entwine/util/spin-lock.hpp>
 
 namespace arbiter { class Endpoint; }
@@ -26,29 +42,219 @@ namespace entwine
 class Hierarchy;
 class ChunkCache;
 class Clipper;
+struct Insertion;
 
+// Point counts of a chunk's grid followed by each of its overflows.
+using SpillCounts = std::array<uint64_t, 9>;
+
+// A single Z-column of voxels within a chunk.  Since a chunk contains
+// span * span of these, they are kept as small as possible: no allocation
+// occurs until the first insertion, after which voxels are stored in a flat
+// open-addressed table indexed by their Z position.  Within a chunk, the Z
+// positions of a tube are contiguous, so the identity hash distributes them
+// without collisions until the table wraps.
+//
+// Building with WITH_ALIGNED_TUBES gives each tube a cache line of its own,
+// so that threads locking neighboring tubes don't contend for one, at the
+// cost of a grid more than twice the size.
+#ifdef ENTWINE_ALIGN_TUBES
+class alignas(64) VoxelTube
+#else
 class VoxelTube
+#endif
 {
+    struct Entry
+    {
+        uint32_t z = empty();
+        Voxel voxel;
+    };
+
 public:
+    ~VoxelTube()
+    {
+        if (!m_capacity) return;
+        Memory::get().sub(
+                Memory::Subsystem::Chunks,
+                m_capacity * sizeof(Entry));
+    }
+
     SpinLock& spin() { return m_spin; }
-    Voxel& operator[](uint32_t i)
+
+    // Returns the voxel at this Z position, inserting an empty voxel if none
+    // exists yet.  References are invalidated by subsequent insertions.
+    Voxel& operator[](uint32_t z)
+    {
+        // Only an insertion may grow the table, never a lookup.
+        if (m_capacity)
+        {
+            Entry& entry(find(z));
+            if (entry.z == z) return entry.voxel;
+            if ((m_size + 1) * 4 <= m_capacity * 3) return insert(entry, z);
+        }
+
+        grow();
+        return insert(find(z), z);
+    }
+
+    uint32_t size() const { return m_size; }
+
+    // Call f(z, voxel) for each voxel in this tube, in no particular order.
+    template<typename F> void forEach(F f) const
     {
-        return m_map[i];
+        for (uint32_t i(0); i < m_capacity; ++i)
+        {
+            const Entry& entry(m_entries[i]);
+            if (entry.z != empty()) f(entry.z, entry.voxel);
+        }
     }
 
 private:
+    static constexpr uint32_t empty()
+    {
+        return std::numeric_limits<uint32_t>::max();
+    }
+
+    // The entry holding this Z position, or else the empty entry at which it
+    // belongs.  The table must not be full.
+    Entry& find(uint32_t z)
+    {
+        const uint32_t mask(m_capacity - 1);
+        uint32_t i(z & mask);
+        while (m_entries[i].z != z && m_entries[i].z != empty())
+        {
+            i = (i + 1) & mask;
+        }
+        return m_entries[i];
+    }
+
+    Voxel& insert(Entry& entry, uint32_t z)
+    {
+        entry.z = z;
+        ++m_size;
+        return entry.voxel;
+    }
+
+    void grow()
+    {
+        const uint32_t capacity(m_capacity ? m_capacity * 2 : 4);
+        std::unique_ptr<Entry[]> entries(new Entry[capacity]);
+        std::swap(entries, m_entries);
+
+        const uint32_t mask(capacity - 1);
+        for (uint32_t i(0); i < m_capacity; ++i)
+        {
+            const Entry& entry(entries[i]);
+            if (entry.z == empty()) continue;
+
+            uint32_t pos(entry.z & mask);
+            while (m_entries[pos].z != empty()) pos = (pos + 1) & mask;
+            m_entries[pos] = entry;
+        }
+
+        Memory::get().add(
+                Memory::Subsystem::Chunks,
+                (capacity - m_capacity) * sizeof(Entry));
+        m_capacity = capacity;
+    }
+
     SpinLock m_spin;
-    std::map<uint32_t, Voxel> m_map;
+    uint32_t m_size = 0;
+    uint32_t m_capacity = 0;
+    std::unique_ptr<Entry[]> m_entries;
+};
+
+// Point storage for a chunk's grid.  Allocation is striped by tube, so
+// threads inserting into different tubes of the same chunk rarely contend for
+// it, and each stripe's lock is held only to bump its position.
+class GridBlock
+{
+    struct Stripe
+    {
+        Stripe(uint64_t pointSize, uint64_t pointsPerBlock)
+            : block(pointSize, pointsPerBlock)
+        { }
+
+        SpinLock spin;
+        MemBlock block;
+
+        // Keep neighboring stripes' locks off of each other's cache lines.
+        char pad[64];
+    };
+
+public:
+    GridBlock(uint64_t pointSize, uint64_t pointsPerBlock)
+    {
+        const uint64_t n(heuristics::gridStripes);
+        const uint64_t per(std::max<uint64_t>(pointsPerBlock / n, 1));
+
+        m_stripes.reserve(n);
+        for (uint64_t i(0); i < n; ++i)
+        {
+            m_stripes.emplace_back(new Stripe(pointSize, per));
+        }
+    }
+
+    char* next(uint64_t tube)
+    {
+        Stripe& stripe(*m_stripes[tube % m_stripes.size()]);
+        SpinGuard lock(stripe.spin);
+        return stripe.block.next();
+    }
+
+    uint64_t size() const
+    {
+        uint64_t n(0);
+        for (const auto& stripe : m_stripes)
+        {
+            SpinGuard lock(stripe->spin);
+            n += stripe->block.size();
+        }
+        return n;
+    }
+
+    uint64_t bytes() const
+    {
+        uint64_t n(0);
+        for (const auto& stripe : m_stripes)
+        {
+            SpinGuard lock(stripe->spin);
+            n += stripe->block.bytes();
+        }
+        return n;
+    }
+
+    // Not synchronized with insertion.
+    void insertInto(BlockPointTable& table) const
+    {
+        for (const auto& stripe : m_stripes) table.insert(stripe->block);
+    }
+
+private:
+    std::vector<std::unique_ptr<Stripe>> m_stripes;
 };
 
 class Chunk
 {
 public:
     Chunk(const ChunkKey& ck, const Hierarchy& hierarchy);
+    ~Chunk();
 
     bool insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key);
-    uint64_t save(const arbiter::Endpoint& out, const arbiter::Endpoint& tmp)
-        const;
+
+    // Merge the points of this same node from another subset.  Subsets split
+    // the X-Y extents along our voxel boundaries, so nearly all of them fall
+    // into empty voxels and are copied straight into our grid.  Those whose
+    // voxels are occupied are appended to _conflicts_, to be inserted as
+    // usual.
+    void merge(VectorPointTable& table, std::vector<Insertion>& conflicts);
+
+    // If the metadata requests 3D Tiles output, the node's tile is written to
+    // the tiles endpoint from the same in-memory points.
+    uint64_t save(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const arbiter::Endpoint& tiles,
+            NodeStats& stats) const;
     void load(
             ChunkCache& cache,
             Clipper& clipper,
@@ -56,37 +262,130 @@ public:
             const arbiter::Endpoint& tmp,
             uint64_t np);
 
+    // Like load, from data already fetched from the output.
+    void load(
+            ChunkCache& cache,
+            Clipper& clipper,
+            const std::vector<char>& stored,
+            uint64_t np);
+
+    // Spilling writes our points in their unpacked in-memory layout to the
+    // local tmp endpoint, along with the grid position of each point and the
+    // overflow it occupies.  Reawakening from a spill then rebuilds our grid
+    // and overflows directly rather than reinserting every point.  A spilled
+    // chunk which is never reawakened must be written to the output with
+    // saveSpilled.  Spills are charged to TmpSpace, and if one doesn't fit,
+    // nothing is written and false is returned.  Otherwise our point count is
+    // written to np.
+    bool spill(const arbiter::Endpoint& tmp, uint64_t& np) const;
+    void unspill(
+            ChunkCache& cache,
+            Clipper& clipper,
+            const arbiter::Endpoint& tmp,
+            uint64_t np);
+    static void saveSpilled(
+            const ChunkKey& ck,
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const arbiter::Endpoint& tiles,
+            NodeStats& stats);
+
+    // Remove our spill, for a chunk which was retained in memory after all.
+    void discardSpill(const arbiter::Endpoint& tmp) const;
+
+    // Bytes of point data held by this chunk and its overflows.
+    uint64_t bytes();
+
+    // False if our points match those of our output, because we were loaded
+    // from it, or saved to it, and have not been modified since.  Points
+    // reinserted by our own load don't count as modifications.
+    bool dirty() const { return m_dirty; }
+    void clean() { m_dirty = false; }
+
+    // The name of a node's data, without the extension of its data type.
+    static std::string dataName(const ChunkKey& ck);
+
+    // The ranges of the configured nodeStats dimensions over the points of
+    // this table, which are exactly those written for a node.
+    static NodeStats getStats(const Metadata& metadata, BlockPointTable& table);
+
     const ChunkKey& chunkKey() const { return m_chunkKey; }
+    // Child keys are built on first use, since most chunks of a deep, sparse
+    // tree never pass points to most of their children.
     const ChunkKey& childAt(Dir dir) const
     {
-        return m_childKeys[toIntegral(dir)];
+        const std::size_t i(toIntegral(dir));
+        if (!(m_childMask.load(std::memory_order_acquire) & (1u << i)))
+        {
+            makeChild(dir);
+        }
+        return *reinterpret_cast<const ChunkKey*>(&m_childKeys[i]);
     }
 
-    SpinLock& spin() { return m_spin; }
-
 private:
+    void makeChild(Dir dir) const;
+
     bool insertOverflow(
             ChunkCache& cache,
             Clipper& clipper,
             Voxel& voxel,
             Key& key);
 
-    void maybeOverflow(ChunkCache& cache, Clipper& clipper);
-    void doOverflow(ChunkCache& cache, Clipper& clipper, uint64_t dir);
+    void modified()
+    {
+        if (!m_dirty.load(std::memory_order_relaxed) && !reloading())
+        {
+            m_dirty.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // The fixed size of our grid, not counting the voxels of its tubes.
+    uint64_t gridBytes() const { return m_grid.size() * sizeof(VoxelTube); }
+
+    // True if this thread is reinserting our own points as we are loaded.
+    bool reloading() const;
+
+    // Detach our largest overflow if it's time to redistribute it into its
+    // child, setting its direction.  Must be called while holding the
+    // overflow lock.
+    std::unique_ptr<Overflow> maybeOverflow(uint64_t& dir);
+    void reinsert(ChunkCache& cache, Clipper& clipper, VectorPointTable& table);
+    void restore(
+            ChunkCache& cache,
+            Clipper& clipper,
+            VectorPointTable& table,
+            const SpillCounts& counts,
+            const char* slots);
+    bool restoreGridVoxel(Voxel& voxel, uint64_t tube, uint32_t z);
+    void doOverflow(
+            ChunkCache& cache,
+            Clipper& clipper,
+            uint64_t dir,
+            Overflow& active);
 
     const Metadata& m_metadata;
     const uint64_t m_span;
     const uint64_t m_pointSize;
+    const PointCopy m_copy;
+    const Selection m_selection;
+    const DuplicateTest m_duplicate;
     const ChunkKey m_chunkKey;
-    const std::array<ChunkKey, 8> m_childKeys;
+    const bool m_leaf;
 
-    SpinLock m_spin;
-    std::vector<VoxelTube> m_grid;
-    MemBlock m_gridBlock;
+    mutable SpinLock m_childSpin;
+    mutable std::atomic<uint32_t> m_childMask{ 0 };
+    mutable std::array<
+            std::aligned_storage<sizeof(ChunkKey), alignof(ChunkKey)>::type,
+            8> m_childKeys;
+
+    std::vector<VoxelTube, hugePages::Allocator<VoxelTube>> m_grid;
+    GridBlock m_gridBlock;
 
     SpinLock m_overflowSpin;
     std::array<std::unique_ptr<Overflow>, 8> m_overflows;
     uint64_t m_overflowCount = 0;
+
+    std::atomic<bool> m_dirty{ true };
 };
 
 } // namespace entwine
@@ -10,6 +10,9 @@
 
 #include <entwine/builder/clipper.hpp>
 
+#include <algorithm>
+#include <cassert>
+
 #include <entwine/builder/chunk.hpp>
 #include <entwine/builder/chunk-cache.hpp>
 
@@ -18,19 +21,23 @@ namespace entwine
 
 Clipper::~Clipper()
 {
-    for (
-            uint64_t depth(0);
-            depth < m_slow.size() && m_slow[depth].size();
-            ++depth)
+    if (m_shallow) m_cache.releaseShallow(std::move(m_shallow));
+
+    // Purging everything, so expire every chunk regardless of its use.
+    m_fast.fill(CachedChunk());
+    for (Entry& entry : m_table)
     {
-        // Purging everything, insert everything into our aged list so we
-        // expire everything.
-        UsedMap& used(m_slow[depth]);
-        UsedMap& aged(m_aged[depth]);
-        aged.insert(used.begin(), used.end());
+        if (entry.chunk) m_cache.clip(entry.depth, entry.xyz, entry.chunk);
     }
 
-    clip();
+    m_cache.clipped();
+    Memory::get().sub(Memory::Subsystem::Clippers, tableBytes());
+}
+
+ShallowBuffer& Clipper::shallow()
+{
+    if (!m_shallow) m_shallow = m_cache.acquireShallow();
+    return *m_shallow;
 }
 
 Chunk* Clipper::get(const ChunkKey& ck)
@@ -38,65 +45,151 @@ Chunk* Clipper::get(const ChunkKey& ck)
     CachedChunk& fast(m_fast[ck.depth()]);
     if (fast.xyz == ck.position()) return fast.chunk;
 
-    auto& slow(m_slow[ck.depth()]);
-    auto it = slow.find(ck.position());
-
-    if (it == slow.end())
-    {
-        auto& aged(m_aged[ck.depth()]);
-        auto agedIt = aged.find(ck.position());
-        if (agedIt == aged.end()) return nullptr;
-
-        it = slow.insert(std::make_pair(agedIt->first, agedIt->second)).first;
-        aged.erase(agedIt);
-    }
+    Entry* entry(find(ck.depth(), ck.position()));
+    if (!entry) return nullptr;
 
+    // Entries are only marked here, on the way into the fast path, which is
+    // reset by each sweep - so anything used since then has been marked.
+    entry->used = true;
     fast.xyz = ck.position();
-    return fast.chunk = it->second;
+    return fast.chunk = entry->chunk;
 }
 
 void Clipper::set(const ChunkKey& ck, Chunk* chunk)
 {
-    CachedChunk& fast(m_fast[ck.depth()]);
+    assert(!find(ck.depth(), ck.position()));
 
+    CachedChunk& fast(m_fast[ck.depth()]);
     fast.xyz = ck.position();
     fast.chunk = chunk;
 
-    auto& slow(m_slow[ck.depth()]);
-    assert(!slow.count(ck.position()));
-    slow[ck.position()] = chunk;
+    // Stay at most half full so probe sequences remain short.
+    if ((m_size + 1) * 2 > m_table.size()) grow();
+
+    Entry entry;
+    entry.chunk = chunk;
+    entry.xyz = ck.position();
+    entry.depth = ck.depth();
+    entry.used = true;
+    place(entry);
+    ++m_size;
 }
 
-void Clipper::clip()
+void Clipper::clip(std::size_t slots)
 {
     m_fast.fill(CachedChunk());
 
-    for (
-            uint64_t depth(0);
-            depth < m_slow.size() && (
-                m_slow[depth].size() || m_aged[depth].size()
-            );
-            ++depth)
+    slots = std::min(slots, m_table.size());
+    std::size_t visited(0);
+
+    while (visited < slots && m_size)
     {
-        if (m_slow[depth].empty() && m_aged[depth].empty()) continue;
+        Entry& entry(m_table[m_hand]);
+
+        if (entry.chunk && !entry.used)
+        {
+            // Releasing shifts a later entry of the same probe sequence into
+            // this slot, so look at it again without advancing.
+            release(m_hand);
+            continue;
+        }
+
+        entry.used = false;
+        m_hand = (m_hand + 1) & m_mask;
+        ++visited;
+    }
 
-        UsedMap& used(m_slow[depth]);
-        UsedMap& aged(m_aged[depth]);
+    m_cache.clipped();
+}
+
+void Clipper::advance(const uint64_t points, const uint64_t period)
+{
+    if (!period) return;
 
-        // Whatever is in our aging list hasn't been touched in two iterations,
-        // so deref those chunks.
-        m_cache.clip(depth, aged);
+    // Under pressure, sweep proportionally faster so stale chunks are
+    // released before the cache needs to evict chunks still in use.
+    const double speed(std::max(1.0, m_cache.pressure()));
+    m_credit += speed * points / period * m_table.size();
 
-        // Get rid of what we just clipped, and lower our recently touched
-        // list into our aging list.
-        aged.clear();
+    if (m_credit < heuristics::clipSweepSlots) return;
 
-        // Now clear our "used" list, moving it into "aged".
-        std::swap(used, aged);
+    // While serialization is behind, releasing chunks would only queue more
+    // evictions, so the sweep waits and then catches up.
+    if (m_cache.backlogged()) return;
+
+    const std::size_t slots(m_credit);
+    m_credit -= slots;
+    clip(slots);
+}
+
+std::size_t Clipper::home(const uint64_t depth, const Xyz& xyz) const
+{
+    uint64_t h(
+            xyz.x * 0x9e3779b97f4a7c15ULL ^
+            xyz.y * 0xc2b2ae3d27d4eb4fULL ^
+            xyz.z * 0x165667b19e3779f9ULL ^
+            depth * 0x27d4eb2f165667c5ULL);
+    h ^= h >> 31;
+    return h & m_mask;
+}
+
+Clipper::Entry* Clipper::find(const uint64_t depth, const Xyz& xyz)
+{
+    for (std::size_t i(home(depth, xyz)); ; i = (i + 1) & m_mask)
+    {
+        Entry& entry(m_table[i]);
+        if (!entry.chunk) return nullptr;
+        if (entry.depth == depth && entry.xyz == xyz) return &entry;
     }
+}
 
-    m_cache.clipped();
+void Clipper::place(const Entry& entry)
+{
+    std::size_t i(home(entry.depth, entry.xyz));
+    while (m_table[i].chunk) i = (i + 1) & m_mask;
+    m_table[i] = entry;
 }
 
-} // namespace entwine
+void Clipper::release(const std::size_t slot)
+{
+    Entry& entry(m_table[slot]);
+    m_cache.clip(entry.depth, entry.xyz, entry.chunk);
+
+    // Backward-shift deletion: pull forward any following entry whose probe
+    // sequence passes through the vacated slot, so lookups never stop short.
+    std::size_t hole(slot);
+    for (std::size_t i((slot + 1) & m_mask); m_table[i].chunk;
+            i = (i + 1) & m_mask)
+    {
+        const std::size_t h(home(m_table[i].depth, m_table[i].xyz));
+        const bool movable(
+                hole <= i ? (h <= hole || h > i) : (h <= hole && h > i));
+
+        if (movable)
+        {
+            m_table[hole] = m_table[i];
+            hole = i;
+        }
+    }
+
+    m_table[hole] = Entry();
+    --m_size;
+}
+
+void Clipper::grow()
+{
+    std::vector<Entry> old(m_table.size() * 2);
+    std::swap(old, m_table);
+    Memory::get().add(
+            Memory::Subsystem::Clippers,
+            old.size() * sizeof(Entry));
+    m_mask = m_table.size() - 1;
+    m_hand = 0;
+
+    for (const Entry& entry : old)
+    {
+        if (entry.chunk) place(entry);
+    }
+}
 
+} // namespace entwine
@@ -11,9 +11,15 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <limits>
+#include <memory>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/shallow-buffer.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/util/memory.hpp>
 
 namespace entwine
 {
@@ -41,31 +47,85 @@ inline bool operator<(const CachedChunk& a, const CachedChunk& b)
     return a.xyz < b.xyz;
 }
 
+// The chunks referenced by a single thread.  Held chunks live in an
+// open-addressed hash table keyed on their depth and position, so lookups are
+// constant time and, once the table has grown to the thread's working set,
+// allocation-free.  Each entry is marked when it's used, and clipping sweeps
+// the table like a clock: marked entries are unmarked, and unmarked entries,
+// which haven't been used since the last sweep passed them, are released.
 class Clipper
 {
 public:
-    Clipper(ChunkCache& cache)
+    Clipper(
+            ChunkCache& cache,
+            std::size_t slots = heuristics::clipperSlots)
         : m_cache(cache)
+        , m_table(capacityFor(slots))
+        , m_mask(m_table.size() - 1)
     {
         m_fast.fill(CachedChunk());
+        Memory::get().add(Memory::Subsystem::Clippers, tableBytes());
     }
 
     ~Clipper();
 
     Chunk* get(const ChunkKey& ck);
     void set(const ChunkKey& ck, Chunk* chunk);
-    void clip();
+
+    // Sweep the entire table.
+    void clip() { clip(m_table.size()); }
+
+    // Advance the sweep by this many slots, so a thread may release its
+    // stale chunks a little at a time.
+    void clip(std::size_t slots);
+
+    // Account for this many inserted points, advancing the sweep in
+    // proportion so that the entire table is swept about once per period
+    // points - or faster, while the cache is over budget.
+    void advance(uint64_t points, uint64_t period);
+
+    // The number of chunks currently held.
+    std::size_t size() const { return m_size; }
+
+    // This thread's private buffer of the levels above the partition depth,
+    // checked out from the cache on first use.
+    ShallowBuffer& shallow();
 
 private:
-    ChunkCache& m_cache;
+    struct Entry
+    {
+        Chunk* chunk = nullptr;
+        Xyz xyz;
+        uint64_t depth = 0;
+        bool used = false;
+    };
+
+    uint64_t tableBytes() const { return m_table.size() * sizeof(Entry); }
 
-    using UsedMap = std::map<Xyz, Chunk*>;
-    using AgedSet = std::set<Xyz>;
+    static std::size_t capacityFor(std::size_t slots)
+    {
+        std::size_t capacity(16);
+        while (capacity < slots) capacity *= 2;
+        return capacity;
+    }
+
+    std::size_t home(uint64_t depth, const Xyz& xyz) const;
+    Entry* find(uint64_t depth, const Xyz& xyz);
+    void place(const Entry& entry);
+    void release(std::size_t slot);
+    void grow();
+
+    ChunkCache& m_cache;
 
     std::array<CachedChunk, maxDepth> m_fast;
-    std::array<std::map<Xyz, Chunk*>, maxDepth> m_slow;
-    std::array<std::map<Xyz, Chunk*>, maxDepth> m_aged;
+
+    std::vector<Entry> m_table;
+    std::size_t m_mask;
+    std::size_t m_size = 0;
+    std::size_t m_hand = 0;
+    double m_credit = 0;
+
+    std::unique_ptr<ShallowBuffer> m_shallow;
 };
 
 } // namespace entwine
-
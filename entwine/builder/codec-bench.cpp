@@ -0,0 +1,266 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/codec-bench.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/time.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    const double gb(1024.0 * 1024.0 * 1024.0);
+    const double mb(1024.0 * 1024.0);
+
+    double seconds(const TimePoint start)
+    {
+        return since<std::chrono::microseconds>(start) / 1000000.0;
+    }
+}
+
+CodecBench::CodecBench(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(m_config.arbiter()))
+    , m_out(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.output())))
+    , m_tmp(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.tmp())))
+    , m_benchEp(makeUnique<arbiter::Endpoint>(
+                m_tmp->getSubEndpoint("entwine-bench")))
+    , m_metadata(makeUnique<Metadata>(*m_out, m_config))
+{
+    if (!m_tmp->isLocal())
+    {
+        throw std::runtime_error("Benchmarking requires a local tmp");
+    }
+
+    const arbiter::Endpoint dataEp(m_out->getSubEndpoint("ept-data"));
+    const arbiter::Endpoint hierEp(m_out->getSubEndpoint("ept-hierarchy"));
+    const arbiter::Endpoint statsEp(m_out->getSubEndpoint("ept-node-stats"));
+    const Hierarchy hierarchy(*m_metadata, hierEp, statsEp, true);
+
+    std::vector<std::pair<Dxyz, uint64_t>> nodes;
+    for (const auto& p : hierarchy.map())
+    {
+        if (!p.second) continue;
+        nodes.push_back(p);
+        m_totalPoints += p.second;
+    }
+
+    if (nodes.empty()) throw std::runtime_error("No nodes to benchmark");
+
+    // Sample evenly across the nodes in key order, which spans every depth.
+    const uint64_t count(
+            std::min<uint64_t>(
+                nodes.size(),
+                std::max<uint64_t>(
+                    m_config.toJson().value("nodes", 32), 1)));
+    const double stride(nodes.size() / static_cast<double>(count));
+
+    const Schema& schema(m_metadata->schema());
+    const uint64_t pointSize(schema.pointSize());
+
+    for (uint64_t i(0); i < count; ++i)
+    {
+        const auto& node(nodes[static_cast<uint64_t>(i * stride)]);
+        const ChunkKey ck(*m_metadata, node.first);
+
+        Points points;
+        points.reserve(node.second * pointSize);
+
+        VectorPointTable table(schema, node.second);
+        table.setProcess([&table, &points, pointSize]()
+        {
+            for (auto it(table.begin()); it != table.end(); ++it)
+            {
+                points.insert(points.end(), it.data(), it.data() + pointSize);
+            }
+        });
+
+        m_metadata->dataIo().read(
+                dataEp,
+                *m_tmp,
+                Chunk::dataName(ck),
+                table);
+
+        m_samples.emplace_back(node.first, std::move(points));
+    }
+}
+
+CodecBench::~CodecBench() { }
+
+json CodecBench::go()
+{
+    std::vector<std::string> types(
+            m_config.toJson().value("types", DataIo::types()));
+
+    json results(json::array());
+    for (const std::string& type : types)
+    {
+        try
+        {
+            results.push_back(measure(type));
+        }
+        catch (std::exception& e)
+        {
+            results.push_back({ { "type", type }, { "error", e.what() } });
+        }
+    }
+
+    // Only our emptied directories remain.
+    for (const std::string& type : types)
+    {
+        arbiter::remove(m_benchEp->getSubEndpoint(type).prefixedRoot());
+    }
+    arbiter::remove(m_benchEp->prefixedRoot());
+
+    return results;
+}
+
+json CodecBench::measure(const std::string& type) const
+{
+    const std::unique_ptr<DataIo> io(DataIo::create(*m_metadata, type));
+    const arbiter::Endpoint ep(m_benchEp->getSubEndpoint(type));
+    arbiter::mkdirp(ep.prefixedRoot());
+
+    const Schema& schema(m_metadata->schema());
+    const uint64_t pointSize(schema.pointSize());
+
+    uint64_t points(0);
+    uint64_t stored(0);
+    double encodeSeconds(0);
+    double decodeSeconds(0);
+
+    for (const Sample& sample : m_samples)
+    {
+        const ChunkKey ck(*m_metadata, sample.dxyz);
+        const std::string filename(Chunk::dataName(ck));
+        const uint64_t np(sample.points.size() / pointSize);
+
+        // Writing may reorder our points, so they are written from a copy.
+        Points copy(sample.points);
+        BlockPointTable block(schema);
+        block.reserve(np);
+        for (uint64_t i(0); i < np; ++i)
+        {
+            block.insert(copy.data() + i * pointSize);
+        }
+
+        TimePoint start(now());
+        io->write(ep, *m_tmp, filename, ck.bounds(), block);
+        encodeSeconds += seconds(start);
+
+        stored += ep.getSize(filename + io->extension());
+
+        uint64_t decoded(0);
+        VectorPointTable table(schema, np + 1);
+        table.setProcess([&table, &decoded]()
+        {
+            decoded += table.numPoints();
+        });
+
+        start = now();
+        io->read(ep, *m_tmp, filename, table);
+        decodeSeconds += seconds(start);
+
+        arbiter::remove(ep.prefixedRoot() + filename + io->extension());
+
+        if (decoded != np)
+        {
+            throw std::runtime_error(
+                    "Decoded " + std::to_string(decoded) + " of " +
+                    std::to_string(np) + " points of " +
+                    sample.dxyz.toString());
+        }
+
+        points += np;
+    }
+
+    const double bytes(points * pointSize);
+    const double bytesPerPoint(stored / static_cast<double>(points));
+    const double totalBytes(bytesPerPoint * m_totalPoints);
+
+    const json& c(m_config.toJson());
+    const double storageCost(c.value("storageCost", 0.023));
+    const double egressCost(c.value("egressCost", 0.09));
+
+    return {
+        { "type", type },
+        { "points", points },
+        { "bytesPerPoint", bytesPerPoint },
+        { "ratio", bytes / std::max<uint64_t>(stored, 1) },
+        { "encodeMBps", bytes / mb / std::max(encodeSeconds, 1e-9) },
+        { "decodeMBps", bytes / mb / std::max(decodeSeconds, 1e-9) },
+        { "estimatedBytes", static_cast<uint64_t>(totalBytes) },
+        { "storageCostPerMonth", totalBytes / gb * storageCost },
+        { "egressCostPerRead", totalBytes / gb * egressCost }
+    };
+}
+
+void CodecBench::print(const json& results)
+{
+    auto cell([](std::string s, std::size_t width)
+    {
+        if (s.size() < width) s.insert(0, width - s.size(), ' ');
+        return s;
+    });
+    auto fixed([](double v, int precision)
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(precision) << v;
+        return ss.str();
+    });
+
+    std::cout <<
+        cell("Type", 10) << cell("B/pt", 8) << cell("Ratio", 7) <<
+        cell("Enc MB/s", 10) << cell("Dec MB/s", 10) <<
+        cell("Est. GB", 10) << cell("$/month", 10) << cell("$/read", 10) <<
+        std::endl;
+
+    for (const json& r : results)
+    {
+        const std::string type(r.at("type").get<std::string>());
+        if (r.count("error"))
+        {
+            std::cout << cell(type, 10) << "  " <<
+                r.at("error").get<std::string>() << std::endl;
+            continue;
+        }
+
+        std::cout <<
+            cell(type, 10) <<
+            cell(fixed(r.at("bytesPerPoint").get<double>(), 2), 8) <<
+            cell(fixed(r.at("ratio").get<double>(), 2), 7) <<
+            cell(fixed(r.at("encodeMBps").get<double>(), 1), 10) <<
+            cell(fixed(r.at("decodeMBps").get<double>(), 1), 10) <<
+            cell(fixed(r.at("estimatedBytes").get<double>() / gb, 2), 10) <<
+            cell(fixed(r.at("storageCostPerMonth").get<double>(), 2), 10) <<
+            cell(fixed(r.at("egressCostPerRead").get<double>(), 2), 10) <<
+            std::endl;
+    }
+}
+
+} // namespace entwine
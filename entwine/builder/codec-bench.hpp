@@ -0,0 +1,82 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+class Metadata;
+
+// Samples nodes of a completed dataset and re-encodes them with each data
+// type, measuring encode and decode throughput and stored size, from which
+// the stored size and cost of the entire dataset in each type is estimated.
+//
+// Configuration, in addition to the output and tmp of the dataset:
+//      nodes: Number of nodes to sample, 32 by default.
+//      types: Data types to measure, all of them by default.
+//      storageCost: Storage cost per GB-month, 0.023 by default.
+//      egressCost: Transfer cost per GB, 0.09 by default.
+class CodecBench
+{
+public:
+    CodecBench(const Config& config);
+    ~CodecBench();
+
+    // Results are an array with an entry per data type.  Types which can't
+    // store this dataset have only an error.
+    json go();
+
+    // Print results in a table.
+    static void print(const json& results);
+
+private:
+    using Points = std::vector<char>;
+
+    struct Sample
+    {
+        Sample(const Dxyz& dxyz, Points points)
+            : dxyz(dxyz)
+            , points(std::move(points))
+        { }
+
+        Dxyz dxyz;
+        Points points;
+    };
+
+    json measure(const std::string& type) const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::unique_ptr<arbiter::Endpoint> m_out;
+    std::unique_ptr<arbiter::Endpoint> m_tmp;
+    std::unique_ptr<arbiter::Endpoint> m_benchEp;
+    std::unique_ptr<Metadata> m_metadata;
+
+    uint64_t m_totalPoints = 0;
+    std::vector<Sample> m_samples;
+};
+
+} // namespace entwine
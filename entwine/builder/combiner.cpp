@@ -0,0 +1,162 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/combiner.hpp>
+
+#include <iostream>
+#include <set>
+#include <stdexcept>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/files.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+Combiner::Combiner(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(m_config.arbiter()))
+    , m_verbose(m_config.verbose())
+{
+    const json input(m_config.toJson().value("input", json()));
+    if (!input.is_array() || input.size() < 2)
+    {
+        throw std::runtime_error("At least two datasets are required");
+    }
+
+    const std::string out(
+            m_arbiter->getEndpoint(m_config.output()).prefixedRoot());
+
+    std::set<std::string> paths;
+
+    for (const json& j : input)
+    {
+        const std::string path(j.get<std::string>());
+        m_in.push_back(makeUnique<arbiter::Endpoint>(
+                    m_arbiter->getEndpoint(path)));
+        const arbiter::Endpoint& ep(*m_in.back());
+
+        if (ep.prefixedRoot() == out)
+        {
+            throw std::runtime_error("The output must differ from each input");
+        }
+
+        m_metadata.push_back(makeUnique<Metadata>(ep));
+        const Metadata& m(*m_metadata.back());
+        const Metadata& first(*m_metadata.front());
+
+        if (m.subset())
+        {
+            throw std::runtime_error("Subsets must be merged before combining");
+        }
+        if (m.packNodes())
+        {
+            throw std::runtime_error("Cannot combine packed nodes");
+        }
+        if (m.cesium())
+        {
+            throw std::runtime_error("Cannot combine cesium output");
+        }
+        if (m.dataIo().type() == "zstandard-dictionary")
+        {
+            // Each dataset's nodes depend on its own dictionary.
+            throw std::runtime_error(
+                    "Cannot combine zstandard-dictionary data");
+        }
+        if (m.boundsCubic() != first.boundsCubic() || m.span() != first.span())
+        {
+            throw std::runtime_error(
+                    "Bounds and span must match the first dataset: " + path);
+        }
+        if (m.outSchema() != first.outSchema())
+        {
+            throw std::runtime_error(
+                    "Schema must match the first dataset: " + path);
+        }
+
+        // The origins of each dataset's points are offset by the number of
+        // files before it, which only holds if none are merged away.
+        for (const FileInfo& f : m.files().list())
+        {
+            if (!paths.insert(f.path()).second)
+            {
+                throw std::runtime_error(
+                        "Datasets may not share the file " + f.path());
+            }
+        }
+
+        // The details of our first dataset's files are carried over with it.
+        if (m_metadata.size() == 1) m_files.emplace_back();
+        else m_files.push_back(Files::extract(ep, true));
+    }
+}
+
+Combiner::~Combiner() { }
+
+Config Combiner::continuation() const
+{
+    const Metadata& first(*m_metadata.front());
+
+    json input(json::array());
+    for (const FileInfoList& list : m_files)
+    {
+        for (const FileInfo& f : list)
+        {
+            // These are assigned anew within our own list.
+            json entry(f);
+            entry.erase("id");
+            entry.erase("url");
+            entry.erase("origin");
+            input.push_back(entry);
+        }
+    }
+
+    json j(m_config.toJson());
+    j["input"] = input;
+    j["bounds"] = first.boundsCubic();
+    j["schema"] = first.outSchema();
+    return Config(j);
+}
+
+void Combiner::go()
+{
+    const std::string from(m_in.front()->prefixedRoot());
+    const std::string to(
+            m_arbiter->getEndpoint(m_config.output()).prefixedRoot());
+
+    if (m_verbose) std::cout << "Copying " << from << "..." << std::endl;
+    m_arbiter->copy(from, to);
+
+    Builder builder(continuation(), m_arbiter);
+    builder.verbose(m_verbose);
+
+    Origin origin(m_metadata.front()->files().size());
+    for (std::size_t i(1); i < m_in.size(); ++i)
+    {
+        if (m_verbose)
+        {
+            std::cout << "Combining " << i + 1 << " / " << m_in.size() <<
+                std::endl;
+        }
+
+        builder.combine(*m_metadata[i], *m_in[i], origin);
+        origin += m_metadata[i]->files().size();
+    }
+
+    if (m_verbose) std::cout << "Combined.  Saving..." << std::endl;
+    builder.save();
+    if (m_verbose) std::cout << "\tFinal save complete." << std::endl;
+}
+
+} // namespace entwine
@@ -0,0 +1,62 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/types/file-info.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+class Metadata;
+
+// Combines independently built datasets, such as adjacent collections, into
+// a new one without reindexing them.  Since they share cubic bounds, a span,
+// and a schema, their trees line up node for node.  The first is copied to
+// the output whole, and then for each of the others, its nodes which are not
+// yet present are copied along with their subtrees, and only those already
+// present are reinserted.
+//
+// Configuration, in addition to the threads and tmp:
+//      input: The paths of at least two datasets, none of which are modified.
+//      output: The path of the combined dataset, which must differ from each.
+class Combiner
+{
+public:
+    Combiner(const Config& config);
+    ~Combiner();
+
+    void go();
+
+private:
+    // The configuration of a continuation of the copy of our first dataset,
+    // whose new input is the files of the others, already inserted.
+    Config continuation() const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::vector<std::unique_ptr<arbiter::Endpoint>> m_in;
+    std::vector<std::unique_ptr<Metadata>> m_metadata;
+    std::vector<FileInfoList> m_files;
+    const bool m_verbose;
+};
+
+} // namespace entwine
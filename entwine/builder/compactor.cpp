@@ -0,0 +1,394 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/compactor.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/uploader.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/types/selection.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    Dxyz parentOf(const Dxyz& dxyz)
+    {
+        const Xyz& p(dxyz.position());
+        return Dxyz(dxyz.depth() - 1, p.x >> 1, p.y >> 1, p.z >> 1);
+    }
+}
+
+Compactor::Compactor(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(m_config.arbiter()))
+    , m_out(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.output())))
+    , m_tmp(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.tmp())))
+    , m_dataEp(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-data")))
+    , m_hierEp(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-hierarchy")))
+    , m_statsEp(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-node-stats")))
+    , m_metadata(makeUnique<Metadata>(*m_out, m_config))
+    , m_hierarchy(makeUnique<Hierarchy>(
+                *m_metadata,
+                *m_hierEp,
+                *m_statsEp,
+                true))
+    , m_pointSize(m_metadata->schema().pointSize())
+    , m_verbose(m_config.verbose())
+    , m_pool(m_config.totalThreads())
+{
+    if (m_metadata->subset())
+    {
+        throw std::runtime_error("Subsets must be merged before compaction");
+    }
+    if (m_metadata->cesium())
+    {
+        throw std::runtime_error("Cannot compact with cesium output");
+    }
+    if (m_metadata->packNodes())
+    {
+        throw std::runtime_error("Cannot compact packed nodes");
+    }
+}
+
+Compactor::~Compactor() { }
+
+void Compactor::go()
+{
+    const uint64_t minNodeSize(m_metadata->minNodeSize());
+    const uint64_t maxNodeSize(m_metadata->maxNodeSize());
+    const uint64_t leafDepth(m_metadata->leafDepth());
+
+    Hierarchy::Map counts(m_hierarchy->map());
+    std::set<Dxyz> parents;
+    uint64_t maxDepth(0);
+    for (const auto& p : counts)
+    {
+        const Dxyz& dxyz(p.first);
+        if (dxyz.depth()) parents.insert(parentOf(dxyz));
+        maxDepth = std::max(maxDepth, dxyz.depth());
+    }
+
+    // Points pushed down from their parents, keyed by their new node.
+    std::map<Dxyz, Points> pending;
+
+    uint64_t split(0);
+    uint64_t merged(0);
+
+    for (uint64_t depth(0); depth <= maxDepth || pending.size(); ++depth)
+    {
+        std::set<Dxyz> nodes;
+        for (const auto& p : counts)
+        {
+            if (p.first.depth() == depth) nodes.insert(p.first);
+        }
+        for (const auto& p : pending) nodes.insert(p.first);
+
+        for (const Dxyz& dxyz : nodes)
+        {
+            const auto it(counts.find(dxyz));
+            const uint64_t np(it != counts.end() ? it->second : 0);
+
+            Points incoming;
+            const auto pit(pending.find(dxyz));
+            if (pit != pending.end()) incoming = std::move(pit->second);
+
+            const uint64_t total(np + incoming.size() / m_pointSize);
+
+            // Fold in the smallest of our undersized leaf children while they
+            // fit, unless we are already too large.
+            std::vector<std::pair<Dxyz, uint64_t>> leaves;
+            if (total <= maxNodeSize)
+            {
+                const ChunkKey ck(*m_metadata, dxyz);
+                for (uint64_t i(0); i < dirEnd(); ++i)
+                {
+                    const Dxyz child(ck.getStep(toDir(i)).dxyz());
+                    const auto cit(counts.find(child));
+                    if (
+                            cit != counts.end() &&
+                            cit->second < minNodeSize &&
+                            !parents.count(child))
+                    {
+                        leaves.emplace_back(child, cit->second);
+                    }
+                }
+
+                std::sort(
+                        leaves.begin(),
+                        leaves.end(),
+                        [](const std::pair<Dxyz, uint64_t>& a,
+                            const std::pair<Dxyz, uint64_t>& b)
+                        {
+                            return a.second < b.second;
+                        });
+
+                uint64_t sum(total);
+                auto end(leaves.begin());
+                while (end != leaves.end() && sum + end->second <= maxNodeSize)
+                {
+                    sum += end->second;
+                    ++end;
+                }
+                leaves.erase(end, leaves.end());
+            }
+
+            if (total <= maxNodeSize && leaves.empty() && incoming.empty())
+            {
+                continue;
+            }
+
+            if (total > maxNodeSize && depth < leafDepth) ++split;
+            merged += leaves.size();
+
+            auto points(std::make_shared<Points>(std::move(incoming)));
+            m_pool.add([this, dxyz, np, points, leaves]()
+            {
+                compact(dxyz, np, std::move(*points), leaves);
+            });
+        }
+
+        m_pool.await();
+        pending.clear();
+
+        if (!m_pool.errors().empty())
+        {
+            throw std::runtime_error(
+                    "Compaction failed: " + m_pool.errors().front());
+        }
+
+        for (Result& result : m_results)
+        {
+            counts[result.dxyz] = result.np;
+            m_hierarchy->set(result.dxyz, result.np);
+            m_hierarchy->setStats(result.dxyz, result.stats);
+
+            for (const Dxyz& leaf : result.merged)
+            {
+                counts.erase(leaf);
+                m_hierarchy->erase(leaf);
+            }
+
+            const ChunkKey ck(*m_metadata, result.dxyz);
+            for (uint64_t i(0); i < dirEnd(); ++i)
+            {
+                Points& points(result.children[i]);
+                if (points.empty()) continue;
+
+                const Dxyz child(ck.getStep(toDir(i)).dxyz());
+                parents.insert(result.dxyz);
+                pending[child] = std::move(points);
+            }
+        }
+        m_results.clear();
+
+        if (m_verbose && nodes.size())
+        {
+            std::cout << "\tDepth " << depth << " complete" << std::endl;
+        }
+    }
+
+    if (m_verbose)
+    {
+        std::cout << "Split " << split << " nodes, merged " << merged <<
+            " nodes" << std::endl;
+    }
+
+    m_hierarchy->analyze(*m_metadata, m_verbose);
+    m_hierarchy->save(*m_metadata, *m_hierEp, *m_statsEp, m_pool);
+    m_pool.await();
+    Uploader::get().await();
+}
+
+void Compactor::compact(
+        const Dxyz& dxyz,
+        const uint64_t np,
+        Points incoming,
+        const std::vector<std::pair<Dxyz, uint64_t>>& leaves)
+{
+    const ChunkKey ck(*m_metadata, dxyz);
+    Result result(dxyz);
+
+    Points points(np ? read(dxyz, np) : Points());
+    points.insert(points.end(), incoming.begin(), incoming.end());
+    Points().swap(incoming);
+
+    for (const auto& leaf : leaves)
+    {
+        const Points child(read(leaf.first, leaf.second));
+        points.insert(points.end(), child.begin(), child.end());
+        result.merged.push_back(leaf.first);
+    }
+
+    // A leaf never splits.
+    if (
+            points.size() / m_pointSize > m_metadata->maxNodeSize() &&
+            dxyz.depth() < m_metadata->leafDepth())
+    {
+        points = split(ck, points, result);
+    }
+
+    result.np = points.size() / m_pointSize;
+    result.stats = write(ck, points);
+
+    // Only remove merged leaves once their points have been written to us.
+    for (const Dxyz& leaf : result.merged) remove(leaf);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results.push_back(std::move(result));
+}
+
+Compactor::Points Compactor::split(
+        const ChunkKey& ck,
+        Points& points,
+        Result& result) const
+{
+    const XyzAccess xyz(m_metadata->schema());
+    if (!xyz.direct()) throw std::runtime_error("Invalid XYZ for compaction");
+
+    const uint64_t span(m_metadata->span());
+    const uint64_t np(points.size() / m_pointSize);
+    const Point& mid(ck.bounds().mid());
+
+    // The index of the selected point of each occupied voxel.
+    const Selection selection(m_metadata->selection());
+    std::unordered_map<uint64_t, uint64_t> best;
+    std::vector<bool> kept(np, false);
+    Key key(*m_metadata);
+
+    for (uint64_t i(0); i < np; ++i)
+    {
+        const Point p(xyz.get(points.data() + i * m_pointSize));
+        key.init(p, ck.depth());
+
+        const Xyz& pos(key.position());
+        const uint64_t cell(
+                ((pos.z % span) * span + (pos.y % span)) * span +
+                (pos.x % span));
+
+        auto it(best.find(cell));
+        if (it == best.end())
+        {
+            best[cell] = i;
+            kept[i] = true;
+            continue;
+        }
+
+        const Point q(xyz.get(points.data() + it->second * m_pointSize));
+        if (selection::displaces(selection, p, q, key))
+        {
+            kept[it->second] = false;
+            kept[i] = true;
+            it->second = i;
+        }
+    }
+
+    Points retained;
+    retained.reserve(best.size() * m_pointSize);
+
+    for (uint64_t i(0); i < np; ++i)
+    {
+        const char* pos(points.data() + i * m_pointSize);
+        if (kept[i])
+        {
+            retained.insert(retained.end(), pos, pos + m_pointSize);
+        }
+        else
+        {
+            const Dir dir(getDirection(mid, xyz.get(pos)));
+            Points& child(result.children[toIntegral(dir)]);
+            child.insert(child.end(), pos, pos + m_pointSize);
+        }
+    }
+
+    return retained;
+}
+
+Compactor::Points Compactor::read(const Dxyz& dxyz, const uint64_t np) const
+{
+    const ChunkKey ck(*m_metadata, dxyz);
+
+    Points points;
+    points.reserve(np * m_pointSize);
+
+    VectorPointTable table(m_metadata->schema(), np);
+    table.setProcess([this, &table, &points]()
+    {
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            points.insert(points.end(), it.data(), it.data() + m_pointSize);
+        }
+    });
+
+    m_metadata->dataIo().read(
+            *m_dataEp,
+            *m_tmp,
+            Chunk::dataName(ck),
+            table);
+
+    return points;
+}
+
+NodeStats Compactor::write(const ChunkKey& ck, Points& points) const
+{
+    const uint64_t np(points.size() / m_pointSize);
+
+    BlockPointTable table(m_metadata->schema());
+    table.reserve(np);
+    for (uint64_t i(0); i < np; ++i)
+    {
+        table.insert(points.data() + i * m_pointSize);
+    }
+
+    pointOrder::sort(m_metadata->pointOrder(), ck.bounds(), table);
+    const NodeStats stats(Chunk::getStats(*m_metadata, table));
+
+    m_metadata->dataIo().write(
+            *m_dataEp,
+            *m_tmp,
+            Chunk::dataName(ck),
+            ck.bounds(),
+            table);
+
+    return stats;
+}
+
+void Compactor::remove(const Dxyz& dxyz) const
+{
+    // Remote data is left in place, since it is no longer referenced by the
+    // hierarchy.
+    if (!m_dataEp->isLocal()) return;
+
+    const ChunkKey ck(*m_metadata, dxyz);
+    arbiter::remove(
+            m_dataEp->prefixedRoot() + Chunk::dataName(ck) +
+            m_metadata->dataIo().extension());
+}
+
+} // namespace entwine
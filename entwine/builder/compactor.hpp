@@ -0,0 +1,96 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/node-stats.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+class Metadata;
+
+// Rebalances the node sizes of a completed dataset.  Working from the root
+// down, a node holding more than maxNodeSize points keeps only the selected
+// point of each of its voxels and pushes the rest into its children, and leaf
+// children smaller than minNodeSize are folded into their parent where the
+// result still fits within maxNodeSize.  Only the nodes
+// which change are read and written.
+class Compactor
+{
+public:
+    Compactor(const Config& config);
+    ~Compactor();
+
+    void go();
+
+private:
+    using Points = std::vector<char>;
+
+    // The outcome of compacting a single node.
+    struct Result
+    {
+        Result(const Dxyz& dxyz) : dxyz(dxyz) { }
+
+        Dxyz dxyz;
+        uint64_t np = 0;
+        NodeStats stats;
+        std::array<Points, 8> children;
+        std::vector<Dxyz> merged;
+    };
+
+    void compact(
+            const Dxyz& dxyz,
+            uint64_t np,
+            Points incoming,
+            const std::vector<std::pair<Dxyz, uint64_t>>& leaves);
+
+    // Keep the selected point of each voxel of this node, and
+    // partition the others by the child to which they belong.
+    Points split(const ChunkKey& ck, Points& points, Result& result) const;
+
+    Points read(const Dxyz& dxyz, uint64_t np) const;
+    NodeStats write(const ChunkKey& ck, Points& points) const;
+    void remove(const Dxyz& dxyz) const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::unique_ptr<arbiter::Endpoint> m_out;
+    std::unique_ptr<arbiter::Endpoint> m_tmp;
+    std::unique_ptr<arbiter::Endpoint> m_dataEp;
+    std::unique_ptr<arbiter::Endpoint> m_hierEp;
+    std::unique_ptr<arbiter::Endpoint> m_statsEp;
+    std::unique_ptr<Metadata> m_metadata;
+    std::unique_ptr<Hierarchy> m_hierarchy;
+    const uint64_t m_pointSize;
+    const bool m_verbose;
+
+    Pool m_pool;
+    std::mutex m_mutex;
+    std::vector<Result> m_results;
+};
+
+} // namespace entwine
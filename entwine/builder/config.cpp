@@ -10,9 +10,15 @@
 
 #include <entwine/builder/config.hpp>
 
+#include <algorithm>
+#include <future>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/planner.hpp>
 #include <entwine/builder/scan.hpp>
 #include <entwine/io/ensure.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/srs-transform.hpp>
 
 namespace entwine
 {
@@ -22,6 +28,92 @@ namespace
 
 const std::string scanFile("scan.json");
 
+FileInfoList expand(
+        const arbiter::Arbiter& a,
+        const json& j,
+        const bool verbose)
+{
+    FileInfoList f;
+
+    if (j.is_object())
+    {
+        if (Executor::get().good(j.at("path").get<std::string>()))
+        {
+            f.emplace_back(j);
+        }
+        return f;
+    }
+
+    if (!j.is_string())
+    {
+        throw std::runtime_error(j.dump() + "not convertible to string");
+    }
+
+    std::string p(j.get<std::string>());
+
+    if (p.empty()) return f;
+
+    if (p.back() != '*')
+    {
+        if (arbiter::isDirectory(p)) p += '*';
+        else if (
+                arbiter::getBasename(p).find_first_of('.') ==
+                std::string::npos)
+        {
+            p += "/*";
+        }
+    }
+
+    Paths current(a.resolve(p, verbose));
+    std::sort(current.begin(), current.end());
+    for (const auto& c : current)
+    {
+        if (Executor::get().good(c)) f.emplace_back(c);
+    }
+
+    return f;
+}
+
+bool contains(const std::vector<std::string>& names, const std::string& name)
+{
+    return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+Schema prune(
+        const Schema& s,
+        const std::vector<std::string>& keep,
+        const std::vector<std::string>& drop)
+{
+    if (keep.empty() && drop.empty()) return s;
+    if (!keep.empty() && !drop.empty())
+    {
+        throw std::runtime_error(
+                "Only one of keepDims and dropDims may be set");
+    }
+
+    for (const std::string& name : keep)
+    {
+        if (!s.contains(name))
+        {
+            throw std::runtime_error("Dimension to keep not found: " + name);
+        }
+    }
+
+    DimList dims;
+    for (const DimInfo& d : s.dims())
+    {
+        const bool xyz(
+                d.id() == DimId::X || d.id() == DimId::Y || d.id() == DimId::Z);
+
+        if (xyz || (keep.empty() ?
+                    !contains(drop, d.name()) : contains(keep, d.name())))
+        {
+            dims.push_back(d);
+        }
+    }
+    return Schema(dims);
+}
+
 bool isScan(std::string s)
 {
     if (s.size() < scanFile.size()) return false;
@@ -51,10 +143,22 @@ Config Config::fromScan(const std::string file) const
     //
     // The primary builder is a) the sole builder if this is not a subset build
     // or b) the subset with ID 1.
+    //
+    // A binary scan has a compact table of its files, and their detailed
+    // metadata isn't loaded at all - it is copied from the scan when the
+    // build is saved.
     const std::string dir(file.substr(0, file.rfind(scanFile)));
     arbiter::Endpoint ep(a.getEndpoint(dir));
+    const arbiter::Endpoint sources(ep.getSubEndpoint("ept-sources"));
+
+    FileInfoList list;
+    if (const auto table = sources.tryGetBinary(Files::tableFile()))
+    {
+        list = Files::readTable(*table);
+        if (primary()) c.m_json["scanSources"] = sources.prefixedRoot();
+    }
+    else list = Files::extract(ep, primary());
 
-    FileInfoList list(Files::extract(ep, primary()));
     c.setInput(list);
 
     return c;
@@ -119,8 +223,9 @@ Config Config::prepareForBuild() const
     if (m_json.count("srs")) result["srs"] = m_json["srs"];
 
     // Prepare the schema, adding OriginId and determining a proper offset, if
-    // necessary.
-    Schema s(result.value("schema", Schema()));
+    // necessary.  Dimensions we don't store are pruned here, so they are never
+    // read into our point tables at all.
+    Schema s(keptSchema(result.value("schema", Schema())));
 
     if (allowOriginId() && !s.contains(DimId::OriginId))
     {
@@ -149,61 +254,95 @@ Config Config::prepareForBuild() const
 
     result["schema"] = s;
 
+    // With our scan results in hand, choose whichever tunable parameters
+    // weren't set explicitly.
+    if (autoTune())
+    {
+        const Planner planner((Config(result)));
+        const json& plan(planner.plan());
+        for (auto it(plan.begin()); it != plan.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+
+        if (verbose() && !planner.rationale().empty())
+        {
+            std::cout << "Auto-tuned:" << std::endl;
+            for (const std::string& line : planner.rationale())
+            {
+                std::cout << "\t" << line << std::endl;
+            }
+        }
+    }
+
     return result;
 }
 
+Schema Config::keptSchema(const Schema& s) const
+{
+    return prune(s, keepDims(), dropDims());
+}
+
 FileInfoList Config::input() const
 {
     FileInfoList f;
-    arbiter::Arbiter a(arbiter());
-
-    auto insert([&](const json& j)
+    input([&f](FileInfoList entry)
     {
-        if (j.is_object())
-        {
-            if (Executor::get().good(j.at("path").get<std::string>()))
-            {
-                f.emplace_back(j);
-            }
-            return;
-        }
+        f.insert(f.end(), entry.begin(), entry.end());
+    });
+    return f;
+}
 
-        if (!j.is_string())
-        {
-            throw std::runtime_error(j.dump() + "not convertible to string");
-        }
+void Config::input(const std::function<void(FileInfoList)>& f) const
+{
+    const json i(m_json.value("input", json()));
 
-        std::string p(j.get<std::string>());
+    std::vector<json> entries;
+    if (i.is_string()) entries.push_back(i);
+    else if (i.is_array()) entries.assign(i.begin(), i.end());
 
-        if (p.empty()) return;
+    const arbiter::Arbiter a(arbiter());
+    const bool v(verbose());
 
-        if (p.back() != '*')
-        {
-            if (arbiter::isDirectory(p)) p += '*';
-            else if (
-                    arbiter::getBasename(p).find_first_of('.') ==
-                    std::string::npos)
-            {
-                p += "/*";
-            }
-        }
+    // Paths and globs are expanded up to listThreads at a time, ahead of the
+    // entry being handed off, while already scanned entries are simply
+    // converted when their turn comes.  Results are delivered in input order.
+    std::vector<std::future<FileInfoList>> pending;
+    std::size_t launched(0);
 
-        Paths current(a.resolve(p, verbose()));
-        std::sort(current.begin(), current.end());
-        for (const auto& c : current)
+    for (std::size_t n(0); n < entries.size(); ++n)
+    {
+        while (
+                launched < entries.size() &&
+                launched < n + heuristics::listThreads)
         {
-            if (Executor::get().good(c)) f.emplace_back(c);
+            const json& entry(entries[launched++]);
+            pending.push_back(
+                    std::async(
+                        entry.is_string() ?
+                            std::launch::async : std::launch::deferred,
+                        [&a, &entry, v]() { return expand(a, entry, v); }));
         }
-    });
 
-    const json i(m_json.value("input", json()));
-    if (i.is_string()) insert(i);
-    else if (i.is_array()) for (const auto& j : i) insert(j);
+        f(pending[n].get());
+    }
+}
 
-    return f;
+bool Config::nativeReprojection() const
+{
+    const auto r(reprojection());
+    if (!r || !r->native() || !SrsTransform::available()) return false;
+
+    const json p(m_json.value("pipeline", json::array({ json::object() })));
+    if (!p.is_array() || p.empty()) return false;
+
+    return std::all_of(p.begin() + 1, p.end(), [](const json& stage)
+    {
+        return stage.value("type", "") == "filters.reprojection";
+    });
 }
 
-json Config::pipeline(std::string filename) const
+json Config::pipeline(std::string filename, const bool native) const
 {
     const auto r(reprojection());
 
@@ -226,13 +365,23 @@ json Config::pipeline(std::string filename) const
             else reader["default_srs"] = r->in();
         }
 
-        // Now set up the output.  If there's already a filters.reprojection in
-        // the pipeline, we'll fill it in.  Otherwise, we'll add one to the end.
-        auto it = std::find_if(p.begin(), p.end(), [](const json& stage)
+        const auto isReprojection([](const json& stage)
         {
             return stage.value("type", "") == "filters.reprojection";
         });
 
+        if (native)
+        {
+            p.erase(
+                    std::remove_if(p.begin() + 1, p.end(), isReprojection),
+                    p.end());
+            return p;
+        }
+
+        // Now set up the output.  If there's already a filters.reprojection in
+        // the pipeline, we'll fill it in.  Otherwise, we'll add one to the end.
+        auto it = std::find_if(p.begin(), p.end(), isReprojection);
+
         json* repPtr(nullptr);
         if (it != p.end()) repPtr = &*it;
         else
@@ -12,12 +12,15 @@
 
 #include <cmath>
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <entwine/builder/thread-pools.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/block-pool.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/defs.hpp>
 #include <entwine/types/file-info.hpp>
@@ -25,6 +28,7 @@
 #include <entwine/types/schema.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/types/version.hpp>
+#include <entwine/util/huge-pages.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/unique.hpp>
 
@@ -41,12 +45,27 @@ public:
     //      - Input data is scanned prior to input.
     //      - If the input is already a scan, that the scan is parsed properly
     //        and has its configuration merged in.
+    //      - If autoTune is set, that parameters not set explicitly are
+    //        chosen by a Planner from the scan.
     Config prepareForBuild() const;
 
-    json pipeline(std::string filename) const;
+    // If _nativeReprojection_ is set, the input SRS is still set on the
+    // reader but the output reprojection is left to the caller.
+    json pipeline(std::string filename, bool nativeReprojection = false)
+        const;
+
+    // True if a reprojection is requested as native, PROJ is available, and
+    // no stages other than reprojections follow the reader - later filters
+    // would otherwise see untransformed coordinates.
+    bool nativeReprojection() const;
 
     FileInfoList input() const;
 
+    // As above, calling _f_ with the files of each input entry in turn.
+    // Several paths and globs are expanded concurrently, so that the caller
+    // may work on the files of one entry while later entries are listed.
+    void input(const std::function<void(FileInfoList)>& f) const;
+
     std::string output() const { return m_json.value("output", ""); }
     std::string tmp() const
     {
@@ -92,6 +111,10 @@ public:
     {
         return m_json.value("hierarchyType", "json");
     }
+    std::string fileOrder() const
+    {
+        return m_json.value("fileOrder", "input");
+    }
 
     std::unique_ptr<Reprojection> reprojection() const
     {
@@ -115,15 +138,48 @@ public:
         return !!a.tryGetSize(path);
     }
 
+    // HTTP settings are passed along with the arbiter settings, overriding
+    // any set there.
     std::string arbiter() const
     {
-        return m_json.value("arbiter", json()).dump();
+        json a(m_json.value("arbiter", json::object()));
+        const json http(m_json.value("http", json::object()));
+        for (auto it(http.begin()); it != http.end(); ++it)
+        {
+            const std::string key(
+                    it.key() == "connections" ? "concurrent" : it.key());
+            a["http"][key] = it.value();
+        }
+        return a.dump();
     }
 
     bool verbose() const { return m_json.value("verbose", false); }
     bool force() const { return m_json.value("force", false); }
     bool trustHeaders() const { return m_json.value("trustHeaders", true); }
+    bool headerScan() const { return m_json.value("headerScan", true); }
+    bool binaryScan() const { return m_json.value("binaryScan", false); }
+
+    // Set when building from a binary scan, whose detailed file metadata is
+    // not loaded but copied from these sources when the build is saved.
+    std::string scanSources() const
+    {
+        return m_json.value("scanSources", "");
+    }
     bool allowOriginId() const { return m_json.value("allowOriginId", true); }
+
+    // At most one of these may be set, naming the dimensions of the input
+    // which are stored, or those which are not.  XYZ are always stored.
+    std::vector<std::string> keepDims() const
+    {
+        return m_json.value("keepDims", std::vector<std::string>());
+    }
+    std::vector<std::string> dropDims() const
+    {
+        return m_json.value("dropDims", std::vector<std::string>());
+    }
+
+    // This schema without the dimensions which keepDims or dropDims exclude.
+    Schema keptSchema(const Schema& s) const;
     uint64_t span() const { return m_json.value("span", 256); }
 
     uint64_t overflowDepth() const { return m_json.value("overflowDepth", 0); }
@@ -139,8 +195,76 @@ public:
     {
         return m_json.value("cacheSize", 64);
     }
+    uint64_t maxMemory() const { return m_json.value("maxMemory", 0); }
+    uint64_t pinDepth() const { return m_json.value("pinDepth", 0); }
+    uint64_t dataPrefixes() const { return m_json.value("dataPrefixes", 0); }
+    bool spill() const { return m_json.value("spill", false); }
+    bool bulk() const { return m_json.value("bulk", false); }
+    bool sparseAppend() const { return m_json.value("sparseAppend", false); }
+    uint64_t previewDepth() const { return m_json.value("previewDepth", 0); }
+    uint64_t partitionDepth() const
+    {
+        return m_json.value("partitionDepth", 0);
+    }
+    uint64_t leafDepth() const { return m_json.value("leafDepth", 0); }
+    uint64_t leafPoints() const { return m_json.value("leafPoints", 0); }
+    uint64_t thinned() const { return m_json.value("thinned", uint64_t(0)); }
+    std::string engine() const { return m_json.value("engine", "insert"); }
+    uint64_t sortRunBytes() const
+    {
+        return m_json.value("sortRunBytes", heuristics::sortRunBytes);
+    }
+    int compressionLevel() const
+    {
+        return m_json.value("compressionLevel", 3); // ZSTD_CLEVEL_DEFAULT.
+    }
+    uint64_t blockPoolSize() const
+    {
+        return m_json.value("blockPoolSize", BlockPool::defaultMaxPooled());
+    }
+    json memoryLimits() const { return m_json.value("memoryLimits", json()); }
+    hugePages::Mode hugePages() const
+    {
+        const json j(m_json.value("hugePages", json(false)));
+        if (j.is_boolean())
+        {
+            return j.get<bool>() ?
+                hugePages::Mode::Transparent : hugePages::Mode::None;
+        }
+        return hugePages::toMode(j.get<std::string>());
+    }
 
     uint64_t hierarchyStep() const { return m_json.value("hierarchyStep", 0); }
+    uint64_t hierarchyPageNodes() const
+    {
+        return m_json.value("hierarchyPageNodes", 0);
+    }
+    std::string mergeData() const { return m_json.value("mergeData", ""); }
+    std::vector<std::string> nodeStats() const
+    {
+        return m_json.value("nodeStats", std::vector<std::string>());
+    }
+    uint64_t subBlockDepth() const { return m_json.value("subBlockDepth", 0); }
+    bool packNodes() const { return m_json.value("packNodes", false); }
+    bool las14() const { return m_json.value("las14", false); }
+    bool statistics() const { return m_json.value("statistics", false); }
+    std::string pointOrder() const { return m_json.value("pointOrder", ""); }
+    std::string selection() const
+    {
+        return m_json.value("selection", "center");
+    }
+    // Either a boolean, where true means "xyz", or a Dedup name.
+    std::string dedup() const
+    {
+        const json j(m_json.value("dedup", json(false)));
+        if (j.is_boolean()) return j.get<bool>() ? "xyz" : "none";
+        return j.get<std::string>();
+    }
+    uint64_t duplicates() const
+    {
+        return m_json.value("duplicates", uint64_t(0));
+    }
+    json cesium() const { return m_json.value("cesium", json()); }
 
     Srs srs() const { return m_json.value("srs", Srs()); }
 
@@ -153,11 +277,61 @@ public:
     }
 
     bool absolute() const { return m_json.value("absolute", false); }
+    bool autoTune() const { return m_json.value("autoTune", false); }
 
+    uint64_t prefetchThreads() const
+    {
+        return m_json.value("prefetchThreads", heuristics::prefetchThreads);
+    }
+    uint64_t prefetchBytes() const
+    {
+        return m_json.value("prefetchBytes", heuristics::prefetchBytes);
+    }
+    uint64_t tmpBytes() const { return m_json.value("tmpBytes", 0); }
+    bool streamInput() const { return m_json.value("streamInput", false); }
+    uint64_t uploadThreads() const
+    {
+        return m_json.value("uploadThreads", heuristics::uploadThreads);
+    }
+    uint64_t uploadBytes() const
+    {
+        return m_json.value("uploadBytes", heuristics::uploadBytes);
+    }
+    uint64_t fetchThreads() const { return m_json.value("fetchThreads", 0); }
+    uint64_t reawakenThreads() const
+    {
+        return m_json.value("reawakenThreads", 0);
+    }
+    uint64_t pointTableBytes() const
+    {
+        return m_json.value("pointTableBytes", heuristics::pointTableBytes);
+    }
+    std::vector<std::string> workers() const
+    {
+        return m_json.value("workers", std::vector<std::string>());
+    }
+    uint64_t retries() const
+    {
+        return m_json.value("retries", heuristics::coordinatorRetries);
+    }
+    bool packed() const { return m_json.value("packed", false); }
+    bool numa() const { return m_json.value("numa", false); }
+    uint64_t checkpoint() const
+    {
+        return m_json.value("checkpoint", 0);
+    }
     uint64_t progressInterval() const
     {
         return m_json.value("progressInterval", 10);
     }
+    std::string metrics() const
+    {
+        return m_json.value("metrics", std::string());
+    }
+    std::string trace() const
+    {
+        return m_json.value("trace", std::string());
+    }
     uint64_t resetFiles() const
     {
         return m_json.value("resetFiles", 0);
@@ -0,0 +1,246 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/coordinator.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/merger.hpp>
+#include <entwine/types/files.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    void replaceAll(
+            std::string& s,
+            const std::string& from,
+            const std::string& to)
+    {
+        std::size_t pos(0);
+        while ((pos = s.find(from, pos)) != std::string::npos)
+        {
+            s.replace(pos, from.size(), to);
+            pos += to.size();
+        }
+    }
+}
+
+Coordinator::Coordinator(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(config.arbiter()))
+    , m_of(config.subset().value("of", 0))
+    , m_retries(config.retries())
+    , m_workers(config.workers())
+    , m_verbose(config.verbose())
+{
+    if (m_of <= 1)
+    {
+        throw std::runtime_error("Coordinated builds require a subset count");
+    }
+
+    if (m_config.subset().count("id"))
+    {
+        throw std::runtime_error("Coordinated builds assign their own IDs");
+    }
+}
+
+void Coordinator::go()
+{
+    // Scan once here rather than once per subset, so every subset is also
+    // guaranteed the same view of the input.
+    if (m_verbose) std::cout << "Preparing input" << std::endl;
+    m_prepared = m_config.prepareForBuild().toJson();
+    m_prepared.erase("workers");
+    m_prepared.erase("retries");
+
+    const std::string output(m_config.output());
+    if (m_arbiter->isLocal(output) && !arbiter::mkdirp(output))
+    {
+        throw std::runtime_error("Couldn't create " + output);
+    }
+
+    for (uint64_t id(1); id <= m_of; ++id) m_tasks.emplace_back(id, 0);
+
+    if (m_workers.empty()) work("");
+    else
+    {
+        Pool pool(m_workers.size(), m_workers.size());
+        for (const std::string& command : m_workers)
+        {
+            pool.add([this, command]() { work(command); });
+        }
+        pool.join();
+    }
+
+    if (m_failed.size())
+    {
+        std::sort(m_failed.begin(), m_failed.end());
+
+        std::string ids;
+        for (const uint64_t id : m_failed)
+        {
+            ids += (ids.empty() ? "" : ", ") + std::to_string(id);
+        }
+
+        throw std::runtime_error("Subsets did not complete: " + ids);
+    }
+
+    if (m_verbose) std::cout << "All subsets complete, merging" << std::endl;
+
+    // Only carry over what the merge needs - in particular, "force" would
+    // discard the completed subsets.
+    json merge {
+        { "output", m_config.output() },
+        { "tmp", m_config.tmp() },
+        { "threads", m_config.totalThreads() },
+        { "verbose", m_verbose }
+    };
+    merge["arbiter"] = json::parse(m_config.arbiter());
+
+    Merger(Config(merge)).go();
+}
+
+void Coordinator::work(const std::string& command)
+{
+    while (true)
+    {
+        Task task(0, 0);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_tasks.empty()) return;
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        const bool success(run(command, task));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (success)
+        {
+            if (m_verbose)
+            {
+                std::cout << "Subset " << task.id << " of " << m_of <<
+                    " complete" << std::endl;
+            }
+        }
+        else if (task.attempt < m_retries)
+        {
+            if (m_verbose)
+            {
+                std::cout << "Subset " << task.id << " failed, retrying" <<
+                    std::endl;
+            }
+            m_tasks.emplace_back(task.id, task.attempt + 1);
+        }
+        else
+        {
+            std::cout << "Subset " << task.id << " failed" << std::endl;
+            m_failed.push_back(task.id);
+        }
+    }
+}
+
+bool Coordinator::run(const std::string& command, const Task& task)
+{
+    try
+    {
+        writeConfig(task);
+
+        if (command.empty())
+        {
+            const json j(json::parse(m_arbiter->get(configPath(task.id))));
+            Builder(Config(j), m_arbiter).go();
+        }
+        else
+        {
+            const std::string expanded(
+                    expand(command, task.id, m_of, configPath(task.id)));
+
+            if (m_verbose)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::cout << "Running: " << expanded << std::endl;
+            }
+
+            if (std::system(expanded.c_str()) != 0) return false;
+        }
+
+        return complete(task.id);
+    }
+    catch (std::exception& e)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::cout << "Subset " << task.id << " error: " << e.what() <<
+            std::endl;
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::cout << "Subset " << task.id << " unknown error" << std::endl;
+    }
+
+    return false;
+}
+
+bool Coordinator::complete(const uint64_t id) const
+{
+    const arbiter::Endpoint out(m_arbiter->getEndpoint(m_config.output()));
+    const std::string postfix("-" + std::to_string(id));
+
+    const FileInfoList files(Files::extract(out, false, postfix));
+    return std::none_of(
+            files.begin(),
+            files.end(),
+            [](const FileInfo& f)
+            {
+                return f.status() == FileInfo::Status::Outstanding;
+            });
+}
+
+std::string Coordinator::configPath(const uint64_t id) const
+{
+    return arbiter::join(
+            m_config.output(),
+            "ept-coordinator-" + std::to_string(id) + ".json");
+}
+
+void Coordinator::writeConfig(const Task& task) const
+{
+    json j(m_prepared);
+    j["subset"]["id"] = task.id;
+    j["subset"]["of"] = m_of;
+
+    // On a retry, continue from whatever the last attempt managed to save.
+    if (task.attempt) j.erase("force");
+
+    m_arbiter->put(configPath(task.id), j.dump(2));
+}
+
+std::string Coordinator::expand(
+        std::string command,
+        const uint64_t id,
+        const uint64_t of,
+        const std::string& configPath)
+{
+    replaceAll(command, "{id}", std::to_string(id));
+    replaceAll(command, "{of}", std::to_string(of));
+    replaceAll(command, "{config}", configPath);
+    return command;
+}
+
+} // namespace entwine
+
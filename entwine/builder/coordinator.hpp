@@ -0,0 +1,85 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+
+namespace arbiter { class Arbiter; }
+
+namespace entwine
+{
+
+// Runs every subset of a build to completion and then merges them.  The input
+// is scanned once up front, and each subset is handed to the next free worker
+// along with a configuration written to the output.  Workers are shell
+// commands, typically launching `entwine build` on another host, which are
+// expanded with the subset ID and configuration path.  With no workers, the
+// subsets are built in-process one at a time.
+//
+// A subset is complete once its worker exits successfully and every file in
+// its saved metadata has left the Outstanding status.  Incomplete subsets are
+// retried, resuming from their partial output when possible.
+class Coordinator
+{
+public:
+    Coordinator(const Config& config);
+
+    void go();
+
+    // Expand the {id}, {of}, and {config} placeholders of a worker command.
+    static std::string expand(
+            std::string command,
+            uint64_t id,
+            uint64_t of,
+            const std::string& configPath);
+
+private:
+    struct Task
+    {
+        Task(uint64_t id, uint64_t attempt) : id(id), attempt(attempt) { }
+
+        uint64_t id;
+        uint64_t attempt;
+    };
+
+    // Take and run tasks until none remain, using the given worker command.
+    void work(const std::string& command);
+
+    bool run(const std::string& command, const Task& task);
+    bool complete(uint64_t id) const;
+
+    std::string configPath(uint64_t id) const;
+    void writeConfig(const Task& task) const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    json m_prepared;
+
+    const uint64_t m_of;
+    const uint64_t m_retries;
+    const std::vector<std::string> m_workers;
+    const bool m_verbose;
+
+    std::mutex m_mutex;
+    std::deque<Task> m_tasks;
+    std::vector<uint64_t> m_failed;
+};
+
+} // namespace entwine
+
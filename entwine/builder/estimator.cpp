@@ -0,0 +1,340 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/estimator.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/registry.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/block-pool.hpp>
+#include <entwine/types/files.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/memory.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    using Peaks = std::array<uint64_t, Memory::numSubsystems>;
+
+    // Record the peak of each memory subsystem until stopped.
+    class PeakWatcher
+    {
+    public:
+        PeakWatcher()
+            : m_peaks()
+            , m_thread([this]()
+            {
+                while (!m_done)
+                {
+                    sample();
+                    std::this_thread::sleep_for(
+                            std::chrono::milliseconds(50));
+                }
+            })
+        { }
+
+        Peaks stop()
+        {
+            m_done = true;
+            m_thread.join();
+            sample();
+            return m_peaks;
+        }
+
+    private:
+        void sample()
+        {
+            // The builder measures blocks only once a second, so we take
+            // our own measurements between them.
+            Memory& memory(Memory::get());
+            memory.set(
+                    Memory::Subsystem::Blocks,
+                    BlockPool::get().stats().resident);
+
+            for (std::size_t i(0); i < Memory::numSubsystems; ++i)
+            {
+                const auto s(static_cast<Memory::Subsystem>(i));
+                m_peaks[i] = std::max(m_peaks[i], memory.bytes(s));
+            }
+        }
+
+        Peaks m_peaks;
+        std::atomic<bool> m_done { false };
+        std::thread m_thread;
+    };
+
+    void removeAll(const std::string& dir)
+    {
+        arbiter::Arbiter a;
+        for (const std::string& path : a.resolve(dir + "**"))
+        {
+            arbiter::remove(path);
+        }
+
+        for (const std::string sub : { "ept-data", "ept-hierarchy",
+                "ept-node-stats", "ept-sources", "" })
+        {
+            arbiter::remove(dir + sub);
+        }
+    }
+}
+
+Estimator::Estimator(const Config& config) : m_config(config) { }
+
+json Estimator::go()
+{
+    const Config prepared(m_config.prepareForBuild());
+
+    FileInfoList files;
+    uint64_t totalPoints(0);
+    for (const FileInfo& f : prepared.input())
+    {
+        if (!f.points()) continue;
+        files.push_back(f);
+        totalPoints += f.points();
+    }
+
+    if (files.empty()) throw std::runtime_error("No points to estimate");
+
+    // Sample evenly across the input, in its order.
+    const uint64_t count(
+            std::min<uint64_t>(
+                files.size(),
+                std::max<uint64_t>(
+                    m_config.toJson().value("sampleFiles", 4), 1)));
+    const double stride(files.size() / static_cast<double>(count));
+
+    FileInfoList sample;
+    uint64_t samplePoints(0);
+    for (uint64_t i(0); i < count; ++i)
+    {
+        // Renumbered within the sample.
+        FileInfo f(files[static_cast<uint64_t>(i * stride)]);
+        f.setOrigin(invalidOrigin);
+        samplePoints += f.points();
+        sample.push_back(f);
+    }
+
+    const std::string dir(
+            arbiter::join(prepared.tmp(), "entwine-estimate") + "/");
+
+    json c(prepared.toJson());
+    c["input"] = sample;
+    c["points"] = samplePoints;
+    c["output"] = dir;
+    c["dataType"] = "null";
+    c["force"] = true;
+    c["verbose"] = false;
+    for (const std::string key : { "cesium", "metrics", "trace", "subset",
+            "checkpoint" })
+    {
+        c.erase(key);
+    }
+
+    Hierarchy::Map nodes;
+    uint64_t inserted(0);
+    uint64_t pointSize(0);
+    double seconds(0);
+    Peaks peaks;
+
+    {
+        Builder builder((Config(c)));
+
+        PeakWatcher watcher;
+        const TimePoint start(now());
+        try
+        {
+            builder.go();
+        }
+        catch (...)
+        {
+            watcher.stop();
+            removeAll(dir);
+            throw;
+        }
+        seconds = since<std::chrono::milliseconds>(start) / 1000.0;
+        peaks = watcher.stop();
+
+        nodes = builder.registry().hierarchy().map();
+        inserted = builder.metadata().files().pointStats().inserts();
+        pointSize = builder.metadata().schema().pointSize();
+    }
+
+    removeAll(dir);
+
+    if (!inserted) throw std::runtime_error("No sampled points were inserted");
+
+    const double share(samplePoints / static_cast<double>(totalPoints));
+
+    // Per depth, the sampled nodes and points.
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> depths;
+    for (const auto& p : nodes)
+    {
+        if (!p.second) continue;
+        auto& d(depths[p.first.depth()]);
+        ++d.first;
+        d.second += p.second;
+    }
+
+    json depthsJson(json::array());
+    uint64_t sampledNodes(0);
+    uint64_t totalNodes(0);
+    for (const auto& p : depths)
+    {
+        const uint64_t depth(p.first);
+        const double capacity(std::pow(8.0, depth));
+        const uint64_t n(
+                static_cast<uint64_t>(
+                    std::min(p.second.first / share, capacity)));
+
+        sampledNodes += p.second.first;
+        totalNodes += n;
+
+        depthsJson.push_back({
+            { "depth", depth },
+            { "nodes", n },
+            { "points", static_cast<uint64_t>(p.second.second / share) }
+        });
+    }
+
+    // The hierarchy grows with the nodes, and the file list is measured
+    // whole.  The others are bounded by the cache, though the cache may fill
+    // further than it did for our sample, to its budget if it has one or
+    // otherwise to its count of unused nodes.
+    json memory(json::object());
+    uint64_t memoryTotal(0);
+    for (std::size_t i(0); i < Memory::numSubsystems; ++i)
+    {
+        const auto s(static_cast<Memory::Subsystem>(i));
+        uint64_t bytes(peaks[i]);
+
+        if (s == Memory::Subsystem::Hierarchy && sampledNodes)
+        {
+            bytes = bytes * (totalNodes / double(sampledNodes));
+        }
+        else if (s == Memory::Subsystem::Files)
+        {
+            FileInfoList all(prepared.input());
+            for (FileInfo& f : all) f.setOrigin(invalidOrigin);
+            bytes = Files(all).bytes();
+        }
+        else if (s == Memory::Subsystem::Blocks)
+        {
+            const uint64_t nodeBytes(
+                    sampledNodes ? inserted * pointSize / sampledNodes : 0);
+            bytes = std::max<uint64_t>(
+                    bytes,
+                    prepared.maxMemory() ?
+                        prepared.maxMemory() :
+                        bytes + prepared.cacheSize() * nodeBytes);
+        }
+
+        memory[Memory::toString(s)] = bytes;
+        memoryTotal += bytes;
+    }
+    memory["total"] = memoryTotal;
+
+    // Raw points are written to tmp when spilling or sorting, and remote
+    // input is downloaded there ahead of insertion.
+    uint64_t tmpBytes(0);
+    if (prepared.spill() || prepared.engine() == "sort")
+    {
+        tmpBytes += totalPoints * pointSize;
+    }
+    const arbiter::Arbiter a(prepared.arbiter());
+    const bool remote(std::any_of(files.begin(), files.end(),
+            [&a](const FileInfo& f) { return !a.isLocal(f.path()); }));
+    if (remote && !prepared.streamInput())
+    {
+        tmpBytes += prepared.prefetchBytes();
+    }
+
+    json sampleMemory(json::object());
+    for (std::size_t i(0); i < Memory::numSubsystems; ++i)
+    {
+        const auto s(static_cast<Memory::Subsystem>(i));
+        sampleMemory[Memory::toString(s)] = peaks[i];
+    }
+
+    return {
+        { "points", totalPoints },
+        { "files", files.size() },
+        { "sample", {
+            { "files", sample.size() },
+            { "points", inserted },
+            { "seconds", seconds },
+            { "nodes", sampledNodes },
+            { "memory", sampleMemory }
+        } },
+        { "nodes", totalNodes },
+        { "depths", depthsJson },
+        { "memory", memory },
+        { "tmpBytes", tmpBytes },
+        { "pointsPerSecond", seconds ? inserted / seconds : 0 },
+        { "minSeconds", static_cast<uint64_t>(seconds / share) }
+    };
+}
+
+void Estimator::print(const json& e)
+{
+    const auto mb([](const json& bytes)
+    {
+        return commify(bytes.get<uint64_t>() / 1024 / 1024) + " MB";
+    });
+
+    const json& sample(e.at("sample"));
+    std::cout <<
+        "Sampled " << sample.at("files").get<uint64_t>() << " of " <<
+        commify(e.at("files").get<uint64_t>()) << " files: " <<
+        commify(sample.at("points").get<uint64_t>()) << " of " <<
+        commify(e.at("points").get<uint64_t>()) << " points in " <<
+        formatTime(sample.at("seconds").get<int>()) << "\n" <<
+        "Estimated:\n" <<
+        "\tNodes: " << commify(e.at("nodes").get<uint64_t>()) << "\n";
+
+    for (const json& d : e.at("depths"))
+    {
+        std::cout << "\t\tDepth " << d.at("depth").get<uint64_t>() << ": " <<
+            commify(d.at("nodes").get<uint64_t>()) << " nodes, " <<
+            commify(d.at("points").get<uint64_t>()) << " points\n";
+    }
+
+    std::cout << "\tPeak memory: " << mb(e.at("memory").at("total")) << "\n";
+    const json& memory(e.at("memory"));
+    for (auto it(memory.begin()); it != memory.end(); ++it)
+    {
+        if (it.key() == "total") continue;
+        std::cout << "\t\t" << it.key() << ": " << mb(it.value()) << "\n";
+    }
+
+    std::cout <<
+        "\tTmp disk: " << mb(e.at("tmpBytes")) << "\n" <<
+        "\tInsertion: " <<
+            commify(e.at("pointsPerSecond").get<uint64_t>()) <<
+            " points/s\n" <<
+        "\tDuration: at least " <<
+            formatTime(e.at("minSeconds").get<int>()) << std::endl;
+}
+
+} // namespace entwine
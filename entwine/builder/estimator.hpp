@@ -0,0 +1,47 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <entwine/builder/config.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// Estimates the resources of a build before it is run.  A few of the input
+// files are inserted through the real insertion path into a throwaway
+// dataset in tmp, with a null data type so nothing is serialized, and the
+// results are extrapolated to the entire input by its share of the points.
+//
+// Node counts at each depth scale with the points, up to the number of nodes
+// the depth can hold.  The memory of the chunk cache and point tables is
+// bounded by the cache rather than the input, so their sampled peaks stand,
+// but the hierarchy grows with the nodes and the file list is measured whole.
+// Serialization is free with a null data type, so the duration is a lower
+// bound.
+//
+// Configuration, as for a build, along with:
+//      sampleFiles: Number of input files to sample, 4 by default.
+class Estimator
+{
+public:
+    Estimator(const Config& config);
+
+    json go();
+
+    // Print an estimate for humans.
+    static void print(const json& estimate);
+
+private:
+    const Config m_config;
+};
+
+} // namespace entwine
@@ -0,0 +1,268 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/external-sort.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    const uint64_t bitsPerDim(21);
+    const uint64_t cellsPerDim(1ULL << bitsPerDim);
+
+    // Spread the low 21 bits of v so that there are two zero bits between
+    // each of them.
+    uint64_t spread(uint64_t v)
+    {
+        v &= cellsPerDim - 1;
+        v = (v | v << 32) & 0x001f00000000ffffULL;
+        v = (v | v << 16) & 0x001f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        return v;
+    }
+
+    uint64_t cell(double v, double min, double size)
+    {
+        if (size <= 0) return 0;
+        const double n((v - min) / size * cellsPerDim);
+        if (n <= 0) return 0;
+        if (n >= cellsPerDim) return cellsPerDim - 1;
+        return static_cast<uint64_t>(n);
+    }
+}
+
+// A k-way merge of the sorted runs, reading each sequentially.
+class ExternalSort::Merge
+{
+public:
+    Merge(const std::vector<std::string>& paths, uint64_t recordSize)
+        : m_recordSize(recordSize)
+    {
+        for (const std::string& path : paths)
+        {
+            m_sources.emplace_back(makeUnique<Source>(path, recordSize));
+        }
+
+        for (std::size_t i(0); i < m_sources.size(); ++i)
+        {
+            if (m_sources[i]->next()) m_heap.emplace(m_sources[i]->code(), i);
+        }
+    }
+
+    // Copy the point of the next record to dst, returning false if there are
+    // no more records.
+    bool next(char* dst)
+    {
+        if (m_heap.empty()) return false;
+
+        const std::size_t i(m_heap.top().second);
+        m_heap.pop();
+
+        Source& source(*m_sources[i]);
+        std::memcpy(
+                dst,
+                source.record() + sizeof(uint64_t),
+                m_recordSize - sizeof(uint64_t));
+
+        if (source.next()) m_heap.emplace(source.code(), i);
+        return true;
+    }
+
+private:
+    class Source
+    {
+    public:
+        Source(const std::string& path, uint64_t recordSize)
+            : m_file(path, std::ios::in | std::ios::binary)
+            , m_record(recordSize)
+        {
+            if (!m_file.good())
+            {
+                throw std::runtime_error("Could not open sort run " + path);
+            }
+        }
+
+        bool next()
+        {
+            return !!m_file.read(m_record.data(), m_record.size());
+        }
+
+        uint64_t code() const
+        {
+            uint64_t c;
+            std::memcpy(&c, m_record.data(), sizeof(uint64_t));
+            return c;
+        }
+
+        const char* record() const { return m_record.data(); }
+
+    private:
+        std::ifstream m_file;
+        std::vector<char> m_record;
+    };
+
+    using Entry = std::pair<uint64_t, std::size_t>;
+
+    const uint64_t m_recordSize;
+    std::vector<std::unique_ptr<Source>> m_sources;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_heap;
+};
+
+ExternalSort::ExternalSort(
+        const Metadata& metadata,
+        const arbiter::Endpoint& tmp,
+        const uint64_t runBytes)
+    : m_bounds(metadata.boundsCubic())
+    , m_tmp(tmp)
+    , m_runBytes(runBytes)
+    , m_pointSize(metadata.schema().pointSize())
+    , m_recordSize(sizeof(uint64_t) + m_pointSize)
+{
+    if (!m_tmp.isLocal())
+    {
+        throw std::runtime_error("Sorting requires a local tmp directory");
+    }
+}
+
+ExternalSort::~ExternalSort()
+{
+    m_merge.reset();
+    for (const std::string& path : m_runs) arbiter::remove(path);
+}
+
+uint64_t ExternalSort::code(const Bounds& b, const Point& p)
+{
+    return
+        spread(cell(p.x, b.min().x, b.width())) |
+        spread(cell(p.y, b.min().y, b.depth())) << 1 |
+        spread(cell(p.z, b.min().z, b.height())) << 2;
+}
+
+void ExternalSort::add(VectorPointTable& table)
+{
+    // Build our records without holding the lock.
+    std::vector<char> records;
+    records.reserve(table.numPoints() * m_recordSize);
+
+    const bool direct(table.directXyz());
+    for (auto it(table.begin()); it != table.end(); ++it)
+    {
+        const Point p(direct ?
+                table.xyz(it.data()) :
+                Point(
+                    it.pointRef().getFieldAs<double>(DimId::X),
+                    it.pointRef().getFieldAs<double>(DimId::Y),
+                    it.pointRef().getFieldAs<double>(DimId::Z)));
+
+        const uint64_t c(code(m_bounds, p));
+        const char* pos(reinterpret_cast<const char*>(&c));
+        records.insert(records.end(), pos, pos + sizeof(uint64_t));
+        records.insert(records.end(), it.data(), it.data() + m_pointSize);
+    }
+
+    m_points += records.size() / m_recordSize;
+
+    std::vector<char> full;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_merge) throw std::runtime_error("Sort is already finished");
+
+        m_current.insert(m_current.end(), records.begin(), records.end());
+        if (m_current.size() < m_runBytes) return;
+        std::swap(full, m_current);
+    }
+
+    // Sort and write this run while others continue to fill the next one.
+    write(full);
+}
+
+void ExternalSort::finish()
+{
+    std::vector<char> rest;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(rest, m_current);
+    }
+    if (rest.size()) write(rest);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_merge = makeUnique<Merge>(m_runs, m_recordSize);
+}
+
+uint64_t ExternalSort::read(VectorPointTable& table)
+{
+    if (!m_merge) throw std::runtime_error("Sort is not finished");
+
+    uint64_t n(0);
+    while (n < table.capacity() && m_merge->next(table.getPoint(n))) ++n;
+    return n;
+}
+
+void ExternalSort::write(std::vector<char>& records)
+{
+    const uint64_t np(records.size() / m_recordSize);
+
+    std::vector<std::pair<uint64_t, uint64_t>> order;
+    order.reserve(np);
+    for (uint64_t i(0); i < np; ++i)
+    {
+        uint64_t c;
+        std::memcpy(&c, records.data() + i * m_recordSize, sizeof(uint64_t));
+        order.emplace_back(c, i);
+    }
+
+    std::sort(order.begin(), order.end());
+
+    const std::string path(
+            m_tmp.prefixedRoot() + "sort-" + std::to_string(m_next++) +
+            ".run");
+
+    {
+        std::ofstream file(path, std::ios::out | std::ios::binary);
+        std::vector<char> sorted(records.size());
+
+        char* pos(sorted.data());
+        for (const auto& entry : order)
+        {
+            std::memcpy(
+                    pos,
+                    records.data() + entry.second * m_recordSize,
+                    m_recordSize);
+            pos += m_recordSize;
+        }
+
+        // Release the unsorted copy before writing.
+        std::vector<char>().swap(records);
+        file.write(sorted.data(), sorted.size());
+
+        if (!file.good())
+        {
+            throw std::runtime_error("Could not write sort run " + path);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_runs.push_back(path);
+}
+
+} // namespace entwine
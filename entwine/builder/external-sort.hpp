@@ -0,0 +1,86 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+class Metadata;
+
+// Sorts any number of points into Morton order within the cubic bounds of the
+// build, in bounded memory.  Points are accumulated into runs of about the
+// given size, each of which is sorted and written to the local tmp endpoint,
+// and afterward the runs are merged into a single sorted stream.
+//
+// Inserting points in this order, each node of the tree is visited during
+// a single contiguous stretch of the stream, so once it is evicted it is
+// never needed again.
+class ExternalSort
+{
+public:
+    ExternalSort(
+            const Metadata& metadata,
+            const arbiter::Endpoint& tmp,
+            uint64_t runBytes);
+    ~ExternalSort();
+
+    // Add the points of this table, which has the schema of the build, other
+    // than those marked as skipped.  May be called concurrently.
+    void add(VectorPointTable& table);
+
+    // Write any remaining points and prepare to merge.  No points may be
+    // added afterward.
+    void finish();
+
+    // Fill the table with the next points in Morton order, returning the
+    // number of points written, or zero once all points have been read.
+    // Not thread-safe.
+    uint64_t read(VectorPointTable& table);
+
+    uint64_t points() const { return m_points; }
+    uint64_t runs() const { return m_runs.size(); }
+
+    // The Morton code, at 21 bits per dimension, of a point within bounds.
+    static uint64_t code(const Bounds& bounds, const Point& p);
+
+private:
+    class Merge;
+
+    void write(std::vector<char>& records);
+
+    const Bounds m_bounds;
+    const arbiter::Endpoint m_tmp;
+    const uint64_t m_runBytes;
+    const uint64_t m_pointSize;
+    const uint64_t m_recordSize;
+
+    std::mutex m_mutex;
+    std::vector<char> m_current;
+    std::vector<std::string> m_runs;
+    std::atomic<uint64_t> m_points { 0 };
+    std::atomic<uint64_t> m_next { 0 };
+
+    std::unique_ptr<Merge> m_merge;
+};
+
+} // namespace entwine
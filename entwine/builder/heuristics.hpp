@@ -10,16 +10,24 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 namespace entwine
 {
 namespace heuristics
 {
 
-// After this many points (per thread), we'll clip - which involves reference-
-// decrementing the chunks that haven't been used in the past two sleepCount
-// windows, which will trigger their serialization.
+// Each thread sweeps its entire table of referenced chunks about once per this
+// many inserted points, a little at a time, reference-decrementing the chunks
+// it hasn't used since the sweep last passed them, which will trigger their
+// serialization.  The sweep speeds up while the chunk cache is over budget.
 const std::size_t sleepCount(65536 * 32);
 
+// Incremental sweeps are batched until they cover at least this many slots,
+// so the chunk cache isn't asked to purge for every point table.
+const std::size_t clipSweepSlots(64);
+
 // A per-thread count of the minimum chunk-cache size to keep during clipping.
 const std::size_t clipCacheSize(64);
 
@@ -29,9 +37,144 @@ const std::size_t clipCacheSize(64);
 // work threads to clip threads.
 const float defaultWorkToClipRatio(0.33f);
 
+// While building, a thread is shifted from insertion to serialization when
+// more than this many serialization tasks per clip thread are queued and the
+// number of live chunks is growing.
+const std::size_t clipBacklogPerThread(4);
+
+// Chunks evicted from the builder's cache wait in a priority queue for a
+// clip thread to serialize them.  Beyond half this many, clippers defer their
+// sweeps, and at this many, evicting threads wait for the queue to drain.
+const std::size_t evictionBacklog(256);
+
+// Remote LAS files are read with ranged requests starting with this many
+// leading bytes, which typically cover the header along with its VLRs.
+const uint64_t lasHeaderBytes(16384);
+
+// While scanning, results so far are saved to the output at this interval so
+// that an interrupted scan may be resumed.
+const std::size_t scanCheckpointSeconds(30);
+
+// Input files are downloaded ahead of insertion by this many threads, while
+// the total size of downloaded files awaiting insertion stays under
+// prefetchBytes.
+const std::size_t prefetchThreads(4);
+const uint64_t prefetchBytes(4ULL * 1024 * 1024 * 1024);
+
+// Writes to remote output are made by this many threads, in addition to the
+// build threads, which hold at most this many bytes awaiting transfer.
+const std::size_t uploadThreads(8);
+const uint64_t uploadBytes(512ULL * 1024 * 1024);
+
+// With fetch threads, at most this many serialized chunks are held in memory
+// ahead of their reawakening.  The oldest are dropped first.
+const std::size_t fetchedChunks(64);
+
+// With reawaken threads, at most this many reawakened chunks wait to be
+// loaded.  Past that, a chunk is loaded by the thread reawakening it.
+const std::size_t queuedReawakenings(64);
+
+// Compressed nodes of at least twice this many points are split into slices
+// of about this many, which are compressed in parallel as separate frames.
+const uint64_t compressSlicePoints(1024 * 1024);
+
+// Input points are read from PDAL in batches of about this many bytes, small
+// enough that a batch stays resident in a typical per-core L2 cache while it
+// is keyed and inserted.
+const uint64_t pointTableBytes(256 * 1024);
+
+// Streamed inputs are fetched in ranged windows of about this many bytes.
+const uint64_t streamWindowBytes(64 * 1024 * 1024);
+
+// Number of independently locked shards per depth in the chunk cache.  Work
+// threads acquiring references to different chunks at the same depth only
+// contend if those chunks hash to the same shard.
+const std::size_t chunkCacheShards(16);
+
+// Point storage for each chunk's grid is allocated from this many
+// independently locked stripes, selected by tube.
+const std::size_t gridStripes(16);
+
+// When choosing which unused chunks to serialize, each past reawakening of a
+// chunk weighs as heavily toward retaining it as this many depth levels.
+const std::size_t reawakenWeight(4);
+
+// Balanced subsets are assigned runs of X-Y cells at the shallowest depth with
+// at least this many cells per subset, but no deeper than the maximum depth.
+const std::size_t balancedSubsetCellsPerSubset(16);
+const std::size_t maxBalancedSubsetDepth(8);
+
+// A coordinated build retries each incomplete subset this many times before
+// giving up on it.
+const std::size_t coordinatorRetries(2);
+
+// Number of independently locked shards of the builder's hierarchy.
+const std::size_t hierarchyShards(32);
+
+// Hierarchy files of the same level are read by up to this many threads.
+const std::size_t hierarchyReadThreads(8);
+
+// While converting to 3D Tiles, tiles are built concurrently until their
+// decoded and encoded data totals about this many bytes.
+const uint64_t cesiumBytesInFlight(1024ULL * 1024 * 1024);
+
+// Levels of each subtree of 3D Tiles implicit tiling.  Each subtree file then
+// holds 4 KiB of child subtree availability at most.
+const uint64_t cesiumSubtreeLevels(5);
+
 // Max number of nodes to store in a single hierarchy file.
 const std::size_t maxHierarchyNodesPerFile(65536);
 
+// Zstandard dictionaries are trained to about this many bytes, from samples of
+// the first chunks written totalling about this many, the first
+// dictionarySampleChunkBytes bytes of each.
+const std::size_t dictionaryBytes(112640);
+const std::size_t dictionarySampleBytes(dictionaryBytes * 100);
+const std::size_t dictionarySampleChunkBytes(128 * 1024);
+
+// Chunks written with sub-blocks are split into at most 8^maxSubBlockDepth of
+// them.  A query reads only the sub-blocks it overlaps if they hold no more
+// than this fraction of the chunk - otherwise the whole chunk is read, and
+// cached for subsequent queries.
+const std::size_t maxSubBlockDepth(4);
+const double partialReadRatio(0.5);
+
+// Laszip data is compressed in independently decodable runs of this many
+// points, LASzip's default, indexed by its chunk table.  Nodes of at least two
+// such runs are decoded by up to lazDecodeThreads threads, each seeking to its
+// own share of the runs.
+const uint64_t lazChunkPoints(50000);
+const std::size_t lazDecodeThreads(8);
+
+// Reading a node packed into a shared blob also reads the nodes which follow
+// it there, up to about this many bytes in total, into the reader's
+// compressed cache if it has one.
+const uint64_t packedReadAhead(4 * 1024 * 1024);
+
+// Initial number of slots in each thread's table of referenced chunks, which
+// doubles whenever it becomes half full.
+const std::size_t clipperSlots(1024);
+
+// With a partition depth, each thread's private copy of the levels above it
+// is merged into the shared chunks once it holds this many points.
+const uint64_t shallowBufferPoints(1 << 16);
+
+// With the sort engine, points are sorted in memory in runs of about this many
+// bytes before being written to tmp storage for merging.
+const uint64_t sortRunBytes(1024ULL * 1024 * 1024);
+
+// When tracing chunk lifecycle events, this many of the most recent events
+// are retained.
+const uint64_t traceEvents(1 << 20);
+
+// Number of input paths or globs which are expanded concurrently.  Listing is
+// mostly spent waiting on remote storage.
+const std::size_t listThreads(8);
+
+// When a build begins, the eligibility of its files is checked by one thread
+// per this many files, up to the number of cores.
+const std::size_t sequenceShardFiles(4096);
+
 } // namespace heuristics
 } // namespace entwine
 
@@ -10,87 +10,368 @@
 
 #include <entwine/builder/hierarchy.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <utility>
+#include <vector>
+
 #include <entwine/io/ensure.hpp>
+#include <entwine/io/hierarchy.hpp>
 #include <entwine/types/metadata.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+Dxyz ancestor(const Dxyz& key, const uint64_t depth)
+{
+    const uint64_t shift(key.d - depth);
+    return Dxyz(depth, key.p.x >> shift, key.p.y >> shift, key.p.z >> shift);
+}
+
+// Call f(file, key, count) for each entry that the node at key contributes to
+// the hierarchy files for this step.  A step of zero writes a single file.
+template <typename F>
+void route(const uint64_t step, const Dxyz& key, const uint64_t n, F f)
+{
+    if (step && key.d && key.d % step == 0)
+    {
+        // The root of a new file is also listed in its parent file, with a
+        // count of -1 pointing to the file beneath it.
+        f(ancestor(key, key.d - step), key, -1);
+        f(key, key, n);
+    }
+    else
+    {
+        const uint64_t depth(step ? key.d / step * step : 0);
+        f(ancestor(key, depth), key, n);
+    }
+}
+
+// As above, for files rooted at the given nodes rather than at every step.
+template <typename F>
+void route(
+        const std::unordered_set<PackedDxyz>& roots,
+        const Dxyz& key,
+        const uint64_t n,
+        F f)
+{
+    const auto rootOf([&roots](const Dxyz& k)
+    {
+        for (uint64_t d(k.d); d > 0; --d)
+        {
+            const Dxyz a(ancestor(k, d));
+            if (roots.count(PackedDxyz(a))) return a;
+        }
+        return Dxyz();
+    });
+
+    if (key.d && roots.count(PackedDxyz(key)))
+    {
+        f(rootOf(ancestor(key, key.d - 1)), key, -1);
+        f(key, key, n);
+    }
+    else f(rootOf(key), key, n);
+}
+
+} // unnamed namespace
+
 Hierarchy::Hierarchy(
         const Metadata& m,
         const arbiter::Endpoint& ep,
+        const arbiter::Endpoint& statsEp,
         const bool exists)
 {
-    if (exists) load(m, ep);
+    if (!exists) return;
+
+    read(m, ep, statsEp, m.postfix(),
+            [this](const Dxyz& k, const uint64_t n, const NodeStats& stats)
+    {
+        assert(!get(k));
+        set(k, n);
+        setStats(k, stats);
+    });
 }
 
-void Hierarchy::load(
+void Hierarchy::read(
         const Metadata& m,
         const arbiter::Endpoint& ep,
+        const arbiter::Endpoint& statsEp,
+        const std::string& postfix,
+        const Visitor& f,
         const Dxyz& root)
 {
-    const json j(json::parse(ep.get(filename(m, root))));
-
-    for (const auto& p : j.items())
+    // Each file names those beneath it, so the files are read a level at a
+    // time.
+    std::vector<Dxyz> roots{ root };
+    while (!roots.empty())
     {
-        const std::string s(p.key());
-        const Dxyz k(s);
+        std::vector<std::vector<Dxyz>> next(roots.size());
+        std::atomic<std::size_t> index(0);
+
+        const auto work([&]()
+        {
+            for (std::size_t i(index++); i < roots.size(); i = index++)
+            {
+                next[i] = readPage(m, ep, statsEp, postfix, f, roots[i]);
+            }
+        });
+
+        const std::size_t threads(
+                std::min(roots.size(), heuristics::hierarchyReadThreads));
+        std::vector<std::future<void>> futures;
+        for (std::size_t i(1); i < threads; ++i)
+        {
+            futures.push_back(std::async(std::launch::async, work));
+        }
+
+        // Every thread must finish before an error may leave this frame.
+        std::exception_ptr error;
+        try { work(); }
+        catch (...) { error = std::current_exception(); }
 
-        assert(!m_map.count(k));
+        for (auto& future : futures)
+        {
+            try { future.get(); }
+            catch (...) { if (!error) error = std::current_exception(); }
+        }
+        if (error) std::rethrow_exception(error);
 
-        int64_t n(p.value().get<int64_t>());
-        if (n < 0) load(m, ep, k);
-        else m_map[k] = static_cast<uint64_t>(n);
+        roots.clear();
+        for (const auto& r : next)
+        {
+            roots.insert(roots.end(), r.begin(), r.end());
+        }
     }
 }
 
-void Hierarchy::save(
+std::vector<Dxyz> Hierarchy::readPage(
         const Metadata& m,
         const arbiter::Endpoint& ep,
-        Pool& pool) const
+        const arbiter::Endpoint& statsEp,
+        const std::string& postfix,
+        const Visitor& f,
+        const Dxyz& root)
 {
-    json j;
-    const ChunkKey k(m);
-    save(m, ep, pool, k, j);
+    const std::string stem(root.toString() + postfix);
+    const HierarchyPage page(hierarchy::read(ep, stem, m.hierarchyType()));
 
-    const std::string f(filename(m, k));
-    pool.add([&ep, f, j]() { ensurePut(ep, f, j.dump(2)); });
+    const std::unordered_map<PackedDxyz, NodeStats> stats(
+            m.nodeStats().size() ?
+                readStats(m, statsEp, stem) :
+                std::unordered_map<PackedDxyz, NodeStats>());
 
-    pool.await();
+    std::vector<Dxyz> roots;
+    for (const auto& p : page)
+    {
+        const Dxyz& k(p.first);
+        const int64_t n(p.second);
+
+        if (n < 0) roots.push_back(k);
+        else
+        {
+            const auto it(stats.find(PackedDxyz(k)));
+            f(k, n, it != stats.end() ? it->second : NodeStats());
+        }
+    }
+    return roots;
 }
 
-void Hierarchy::save(
+std::unordered_map<PackedDxyz, NodeStats> Hierarchy::readStats(
         const Metadata& m,
-        const arbiter::Endpoint& ep,
-        Pool& pool,
-        const ChunkKey& k,
-        json& curr) const
+        const arbiter::Endpoint& statsEp,
+        const std::string& stem)
+{
+    std::unordered_map<PackedDxyz, NodeStats> result;
+
+    // A page may be missing if this dataset was previously built without
+    // stats, in which case its existing nodes simply have none.
+    const auto data(statsEp.tryGet(stem + ".json"));
+    if (!data) return result;
+
+    const std::vector<std::string>& names(m.nodeStats());
+
+    for (const auto& p : json::parse(*data).items())
+    {
+        const json& ranges(p.value());
+
+        NodeStats stats(names.size());
+        for (std::size_t i(0); i < names.size(); ++i)
+        {
+            if (ranges.count(names[i]))
+            {
+                stats[i] = ranges.at(names[i]).get<DimRange>();
+            }
+        }
+
+        result[PackedDxyz(Dxyz(p.key()))] = stats;
+    }
+
+    return result;
+}
+
+std::array<uint64_t, 8> Hierarchy::children(const Dxyz& parent) const
 {
-    const uint64_t n(get(k.dxyz()));
-    if (!n) return;
+    std::array<uint64_t, 8> counts;
+    counts.fill(0);
 
-    if (m_step && k.depth() && (k.depth() % m_step == 0))
+    std::array<PackedDxyz, 8> keys;
+    std::array<std::size_t, 8> shards;
+    for (std::size_t i(0); i < keys.size(); ++i)
     {
-        curr[k.toString()] = -1;
+        keys[i] = PackedDxyz(parent.child(toDir(i)));
+        shards[i] = shardIndex(keys[i]);
+    }
+
+    uint32_t done(0);
+    for (std::size_t i(0); i < keys.size(); ++i)
+    {
+        if (done & (1u << i)) continue;
 
-        json next;
-        next[k.toString()] = n;
+        const Shard& s(m_shards[shards[i]]);
+        SpinGuard lock(s.spin);
 
-        for (uint64_t dir(0); dir < 8; ++dir)
+        for (std::size_t j(i); j < keys.size(); ++j)
         {
-            save(m, ep, pool, k.getStep(toDir(dir)), next);
+            if (shards[j] != shards[i]) continue;
+            done |= 1u << j;
+
+            const auto it(s.map.find(keys[j]));
+            if (it != s.map.end()) counts[j] = it->second;
         }
+    }
+
+    return counts;
+}
 
-        const std::string f(filename(m, k));
-        pool.add([&ep, f, next]() { ensurePut(ep, f, next.dump()); });
+Hierarchy::Map Hierarchy::map() const
+{
+    Map map;
+    for (const Shard& s : m_shards)
+    {
+        SpinGuard lock(s.spin);
+        for (const auto& p : s.map) map[p.first.unpack()] = p.second;
     }
-    else
+    return map;
+}
+
+uint64_t Hierarchy::size() const
+{
+    uint64_t size(0);
+    for (const Shard& s : m_shards)
+    {
+        SpinGuard lock(s.spin);
+        size += s.map.size();
+    }
+    return size;
+}
+
+uint64_t Hierarchy::bytes() const
+{
+    // Each entry of a hash map is a node with a pointer to the next, along
+    // with its share of the buckets.
+    using Count = std::pair<const PackedDxyz, uint64_t>;
+    using Stats = std::pair<const PackedDxyz, NodeStats>;
+    const uint64_t link(sizeof(void*));
+
+    uint64_t bytes(0);
+    for (const Shard& s : m_shards)
+    {
+        SpinGuard lock(s.spin);
+        bytes += s.map.size() * (sizeof(Count) + link);
+        bytes += s.map.bucket_count() * link;
+        bytes += s.stats.size() * (sizeof(Stats) + link);
+        bytes += s.stats.bucket_count() * link;
+
+        // Every node has stats of the same dimensions.
+        if (!s.stats.empty())
+        {
+            bytes += s.stats.size() *
+                s.stats.begin()->second.capacity() * sizeof(DimRange);
+        }
+    }
+    return bytes;
+}
+
+void Hierarchy::save(
+        const Metadata& m,
+        const arbiter::Endpoint& ep,
+        const arbiter::Endpoint& statsEp,
+        Pool& pool) const
+{
+    // Group every node by the file in which it is written in a single pass,
+    // then build and write each file's JSON on the pool.
+    using Page = std::vector<std::pair<Dxyz, int64_t>>;
+    std::unordered_map<PackedDxyz, Page> pages;
+
+    const uint64_t step(m_step);
+    const std::unordered_set<PackedDxyz>& roots(m_roots);
+    forEachNode([step, &roots, &pages](const Dxyz& key, uint64_t n)
+    {
+        const auto add([&pages](
+                const Dxyz& file,
+                const Dxyz& entry,
+                int64_t count)
+        {
+            pages[PackedDxyz(file)].emplace_back(entry, count);
+        });
+
+        if (roots.empty()) route(step, key, n, add);
+        else route(roots, key, n, add);
+    });
+
+    const std::string type(m.hierarchyType());
+
+    for (const auto& p : pages)
     {
-        curr[k.toString()] = n;
+        const Dxyz file(p.first.unpack());
+        const Page& page(p.second);
+        const std::string f(stem(m, file));
+        const bool pretty(!file.d);
 
-        for (uint64_t dir(0); dir < 8; ++dir)
+        pool.add([this, &m, &ep, &statsEp, &page, f, type, pretty]()
         {
-            save(m, ep, pool, k.getStep(toDir(dir)), curr);
+            json j;
+            for (const auto& e : page) j[e.first.toString()] = e.second;
+            hierarchy::write(ep, f, type, j, pretty);
+
+            const std::vector<std::string>& names(m.nodeStats());
+            if (names.empty()) return;
+
+            json s;
+            for (const auto& e : page)
+            {
+                if (e.second < 0) continue;
+
+                const NodeStats stats(this->stats(e.first));
+                if (stats.size() != names.size()) continue;
+
+                json& ranges(s[e.first.toString()]);
+                for (std::size_t i(0); i < names.size(); ++i)
+                {
+                    if (!stats[i].empty()) ranges[names[i]] = stats[i];
+                }
+            }
+            ensurePut(statsEp, f + ".json", s.dump(pretty ? 2 : -1));
+        });
+    }
+
+    pool.await();
+}
+
+void Hierarchy::forEachNode(
+        const std::function<void(const Dxyz&, uint64_t)>& f) const
+{
+    for (const Shard& s : m_shards)
+    {
+        SpinGuard lock(s.spin);
+        for (const auto& p : s.map)
+        {
+            if (p.second) f(p.first.unpack(), p.second);
         }
     }
 }
@@ -98,18 +379,39 @@ void Hierarchy::save(
 void Hierarchy::analyze(const Metadata& m, const bool verbose) const
 {
     if (m_step) return;
-    if (m_map.size() <= heuristics::maxHierarchyNodesPerFile) return;
 
-    AnalysisSet analysis;
-    std::vector<uint64_t> steps{ 5, 6, 8, 10 };
-    for (const uint64_t step : steps)
+    // Pages are chosen afresh on every save, since the tree may have grown.
+    if (const uint64_t target = m.hierarchyPageNodes())
+    {
+        split(target, verbose);
+        return;
+    }
+
+    if (size() <= heuristics::maxHierarchyNodesPerFile) return;
+
+    // Tally the number of nodes per file for every candidate step at once.
+    const std::vector<uint64_t> steps{ 5, 6, 8, 10 };
+    std::vector<Counts> counts(steps.size());
+
+    forEachNode([&steps, &counts](const Dxyz& key, uint64_t n)
     {
-        Map analyzed;
-        const ChunkKey k(m);
-        analyzed[k.dxyz()] = 1;
-        analyze(m, step, k, k.dxyz(), analyzed);
+        for (std::size_t i(0); i < steps.size(); ++i)
+        {
+            Counts& c(counts[i]);
+            route(steps[i], key, n, [&c](
+                    const Dxyz& file,
+                    const Dxyz&,
+                    int64_t)
+            {
+                ++c[PackedDxyz(file)];
+            });
+        }
+    });
 
-        analysis.emplace(m_map, analyzed, step);
+    AnalysisSet analysis;
+    for (std::size_t i(0); i < steps.size(); ++i)
+    {
+        analysis.emplace(counts[i], steps[i]);
     }
 
     const auto& chosen(*analysis.begin());
@@ -123,40 +425,70 @@ void Hierarchy::analyze(const Metadata& m, const bool verbose) const
     m_step = chosen.step;
 }
 
-void Hierarchy::analyze(
-    const Metadata& m,
-    const uint64_t step,
-    const ChunkKey& k,
-    const Dxyz& curr,
-    Hierarchy::Map& map) const
+void Hierarchy::split(const uint64_t target, const bool verbose) const
 {
-    const uint64_t n(get(k.dxyz()));
-    if (!n) return;
+    std::map<uint64_t, std::vector<Dxyz>> levels;
+    forEachNode([&levels](const Dxyz& key, uint64_t)
+    {
+        levels[key.d].push_back(key);
+    });
 
-    ++map[curr];
+    // The entries which each settled subtree adds to the page above it,
+    // grouped by the parent of that subtree.
+    using Subtree = std::pair<uint64_t, Dxyz>;
+    std::unordered_map<PackedDxyz, std::vector<Subtree>> settled;
 
-    if (step && k.depth() && (k.depth() % step == 0))
-    {
-        const Dxyz next(k.dxyz());
-        map[next] = 1;
+    m_roots.clear();
 
-        for (uint64_t dir(0); dir < 8; ++dir)
+    for (auto level(levels.rbegin()); level != levels.rend(); ++level)
+    {
+        for (const Dxyz& key : level->second)
         {
-            analyze(m, step, k.getStep(toDir(dir)), next, map);
+            std::vector<Subtree> children;
+            const auto it(settled.find(PackedDxyz(key)));
+            if (it != settled.end())
+            {
+                children = std::move(it->second);
+                settled.erase(it);
+            }
+
+            uint64_t entries(1);
+            for (const Subtree& c : children) entries += c.first;
+
+            // A subtree split off leaves a single entry linking to its page.
+            std::sort(
+                    children.begin(),
+                    children.end(),
+                    [](const Subtree& a, const Subtree& b)
+                    {
+                        return a.first > b.first;
+                    });
+
+            for (const Subtree& c : children)
+            {
+                if (entries <= target) break;
+                m_roots.insert(PackedDxyz(c.second));
+                entries -= c.first - 1;
+            }
+
+            if (key.d)
+            {
+                settled[PackedDxyz(ancestor(key, key.d - 1))].emplace_back(
+                        entries,
+                        key);
+            }
         }
     }
-    else
+
+    if (verbose)
     {
-        for (uint64_t dir(0); dir < 8; ++dir)
-        {
-            analyze(m, step, k.getStep(toDir(dir)), curr, map);
-        }
+        std::cout << "Split hierarchy into " << m_roots.size() + 1 <<
+            " pages of up to about " << target << " nodes" << std::endl;
     }
 }
 
 Hierarchy::Analysis::Analysis(
-        const Hierarchy::Map& hierarchy,
-        const Hierarchy::Map& analyzed,
+        const Hierarchy::Counts& analyzed,
         uint64_t step)
     : step(step)
     , totalFiles(analyzed.size())
@@ -10,12 +10,18 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <entwine/builder/heuristics.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/types/node-stats.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/pool.hpp>
 #include <entwine/util/spin-lock.hpp>
@@ -35,39 +41,104 @@ public:
     Hierarchy(
             const Metadata& metadata,
             const arbiter::Endpoint& ep,
+            const arbiter::Endpoint& statsEp,
             bool exists);
 
+    using Visitor =
+        std::function<void(const Dxyz& key, uint64_t n, const NodeStats&)>;
+
+    // Reads the hierarchy of this dataset whose files carry this postfix,
+    // calling _f_ with each node rather than retaining them.  The files
+    // beneath each level of files are read concurrently, so _f_ may be called
+    // from several threads at once.
+    static void read(
+            const Metadata& metadata,
+            const arbiter::Endpoint& ep,
+            const arbiter::Endpoint& statsEp,
+            const std::string& postfix,
+            const Visitor& f,
+            const Dxyz& root = Dxyz());
+
     void set(const Dxyz& key, uint64_t val)
     {
-        SpinGuard lock(m_spin);
-        auto it(m_map.find(key));
-        if (it == m_map.end()) m_map[key] = val;
-        else it->second = val;
+        const PackedDxyz packed(key);
+        Shard& s(shard(packed));
+        SpinGuard lock(s.spin);
+        s.map[packed] = val;
     }
 
     uint64_t get(const Dxyz& key) const
     {
-        SpinGuard lock(m_spin);
-        auto it(m_map.find(key));
-        if (it == m_map.end()) return 0;
+        const PackedDxyz packed(key);
+        const Shard& s(shard(packed));
+        SpinGuard lock(s.spin);
+        auto it(s.map.find(packed));
+        if (it == s.map.end()) return 0;
+        else return it->second;
+    }
+
+    // The counts of the eight children of a node, by direction, taking the
+    // lock of each shard they fall in only once.
+    std::array<uint64_t, 8> children(const Dxyz& parent) const;
+
+    // Remove a node, along with its stats.
+    void erase(const Dxyz& key)
+    {
+        const PackedDxyz packed(key);
+        Shard& s(shard(packed));
+        SpinGuard lock(s.spin);
+        s.map.erase(packed);
+        s.stats.erase(packed);
+    }
+
+    // Record the ranges of the configured nodeStats dimensions for a node.
+    void setStats(const Dxyz& key, const NodeStats& stats)
+    {
+        if (stats.empty()) return;
+        const PackedDxyz packed(key);
+        Shard& s(shard(packed));
+        SpinGuard lock(s.spin);
+        s.stats[packed] = stats;
+    }
+
+    NodeStats stats(const Dxyz& key) const
+    {
+        const PackedDxyz packed(key);
+        const Shard& s(shard(packed));
+        SpinGuard lock(s.spin);
+        auto it(s.stats.find(packed));
+        if (it == s.stats.end()) return NodeStats();
         else return it->second;
     }
 
-    const Map& map() const { return m_map; }
+    // An ordered snapshot of the entire hierarchy.
+    Map map() const;
+    uint64_t size() const;
 
+    // An estimate of the memory held by our nodes and their stats.
+    uint64_t bytes() const;
+
+    // Node stats, if any, are written in pages mirroring the hierarchy files
+    // to statsEp.
     void save(
             const Metadata& metadata,
             const arbiter::Endpoint& top,
+            const arbiter::Endpoint& statsEp,
             Pool& pool) const;
 
+    // Choose how the hierarchy is split into files: per subtree if the
+    // metadata sets a page size, or else at a fixed depth step.
     void analyze(const Metadata& m, bool verbose) const;
     void setStep(uint64_t step) const { m_step = step; }
 
 private:
+    // The number of nodes in each hierarchy file, keyed by the file's root.
+    using Counts = std::unordered_map<PackedDxyz, uint64_t>;
+
     struct Analysis
     {
         Analysis() { }
-        Analysis(const Map& hierarchy, const Map& analyzed, uint64_t step);
+        Analysis(const Counts& analyzed, uint64_t step);
 
         uint64_t step = 0;
         uint64_t totalFiles = 0;
@@ -85,38 +156,69 @@ private:
 
     using AnalysisSet = std::set<Analysis>;
 
-    std::string filename(const Metadata& m, const Dxyz& dxyz) const
+    // The path of this hierarchy file, without its extension, which depends
+    // on the hierarchy type.
+    std::string stem(const Metadata& m, const Dxyz& dxyz) const
     {
-        return dxyz.toString() + m.postfix() + ".json";
+        return dxyz.toString() + m.postfix();
     }
 
-    std::string filename(const Metadata& m, const ChunkKey& k) const
+    std::string stem(const Metadata& m, const ChunkKey& k) const
     {
-        return filename(m, k.dxyz());
+        return stem(m, k.dxyz());
     }
 
-    void load(
+    // Read a single hierarchy file, returning the roots of the files beneath.
+    static std::vector<Dxyz> readPage(
             const Metadata& metadata,
-            const arbiter::Endpoint& endpoint,
-            const Dxyz& key = Dxyz());
+            const arbiter::Endpoint& ep,
+            const arbiter::Endpoint& statsEp,
+            const std::string& postfix,
+            const Visitor& f,
+            const Dxyz& root);
 
-    void save(
+    // The node stats of the hierarchy file with this stem.
+    static std::unordered_map<PackedDxyz, NodeStats> readStats(
             const Metadata& metadata,
-            const arbiter::Endpoint& endpoint,
-            Pool& pool,
-            const ChunkKey& key,
-            json& j) const;
-
-    void analyze(
-            const Metadata& m,
-            uint64_t step,
-            const ChunkKey& key,
-            const Dxyz& curr,
-            Map& map) const;
-
-    mutable SpinLock m_spin;
-    Map m_map;
+            const arbiter::Endpoint& statsEp,
+            const std::string& stem);
+
+    // Choose page roots so that each page holds about target entries.
+    // Working up from the deepest nodes, the largest subtrees beneath each
+    // node are split off into their own pages until what remains fits.
+    void split(uint64_t target, bool verbose) const;
+
+    // Visit every non-empty node, without ordering.
+    void forEachNode(
+            const std::function<void(const Dxyz&, uint64_t)>& f) const;
+
+    // Lookups and insertions happen concurrently from every work and clip
+    // thread, so the hierarchy is split into independently locked hash maps.
+    // An ordered view is only needed to save and analyze.
+    struct Shard
+    {
+        mutable SpinLock spin;
+        std::unordered_map<PackedDxyz, uint64_t> map;
+        std::unordered_map<PackedDxyz, NodeStats> stats;
+    };
+
+    static std::size_t shardIndex(const PackedDxyz& key)
+    {
+        return std::hash<PackedDxyz>()(key) % heuristics::hierarchyShards;
+    }
+
+    Shard& shard(const PackedDxyz& key) { return m_shards[shardIndex(key)]; }
+    const Shard& shard(const PackedDxyz& key) const
+    {
+        return m_shards[shardIndex(key)];
+    }
+
+    std::array<Shard, heuristics::hierarchyShards> m_shards;
     mutable uint64_t m_step = 0;
+
+    // The roots of hierarchy files other than the root itself, if split per
+    // subtree, in which case the step is unused.
+    mutable std::unordered_set<PackedDxyz> m_roots;
 };
 
 } // namespace entwine
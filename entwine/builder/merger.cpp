@@ -10,15 +10,9 @@
 
 #include <entwine/builder/merger.hpp>
 
-#include <cassert>
-
 #include <entwine/builder/builder.hpp>
-#include <entwine/builder/clipper.hpp>
-#include <entwine/builder/registry.hpp>
-#include <entwine/builder/thread-pools.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/types/subset.hpp>
-#include <entwine/util/pool.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -28,8 +22,6 @@ Merger::Merger(const Config& config)
     : m_config(config)
     , m_arbiter(std::make_shared<arbiter::Arbiter>(config.arbiter()))
     , m_verbose(m_config.verbose())
-    , m_threads(m_config.totalThreads())
-    , m_pool(m_threads)
 {
     Config first(m_config);
     first.setSubsetId(1);
@@ -59,62 +51,16 @@ Merger::~Merger() { }
 
 void Merger::go()
 {
-    auto clipper(makeUnique<Clipper>(m_builder->registry().cache()));
-
-    m_id = 2;
-    while (m_id <= m_of)
+    // Each subset is read piece by piece as it's merged, so only our own
+    // builder is resident, however many subsets there are.
+    for (m_id = 2; m_id <= m_of; ++m_id)
     {
-        // One-based.
-        const uint64_t n(std::min<uint64_t>(m_threads, m_of - m_id + 1));
-        assert(m_id + n <= m_of + 1);
-
-        std::vector<std::unique_ptr<Builder>> v(n);
-
-        for (uint64_t i(0); i < n; ++i)
-        {
-            assert(m_id + i <= m_of);
-            Config current(m_config);
-            current.setSubsetId(m_id + i);
-            current.setSubsetOf(m_of);
-            current.setThreads(1);
-
-            m_pool.add([this, &v, current, i]()
-            {
-                try
-                {
-                    v[i] = makeUnique<Builder>(current, m_arbiter);
-                }
-                catch (std::exception& e)
-                {
-                    std::cout << "Failed create " << (m_id + i) << ": " <<
-                        e.what() << std::endl;
-                }
-                catch (...)
-                {
-                    std::cout << "Failed create " << (m_id + i) << ": " <<
-                        "unknown error" << std::endl;
-                }
-            });
-        }
-
-        m_pool.cycle();
-
         if (m_verbose)
         {
             std::cout << "Merging " << m_id << " / " << m_of << std::endl;
         }
 
-        for (uint64_t i(0); i < v.size(); ++i)
-        {
-            if (!v.at(i) || !v.at(i)->isContinuation())
-            {
-                throw std::runtime_error("A subset could not be created");
-            }
-
-            m_builder->merge(*v.at(i), *clipper);
-        }
-
-        m_id += n;
+        m_builder->merge(m_id);
     }
 
     if (m_verbose)
@@ -125,7 +71,6 @@ void Merger::go()
     m_builder->makeWhole();
 
     if (m_verbose) std::cout << "Merge complete.  Saving..." << std::endl;
-    clipper.reset();
     m_builder->save();
     m_builder.reset();
     if (m_verbose) std::cout << "\tFinal save complete." << std::endl;
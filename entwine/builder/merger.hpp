@@ -16,7 +16,6 @@
 #include <vector>
 
 #include <entwine/builder/config.hpp>
-#include <entwine/util/pool.hpp>
 
 namespace Json { class Value; }
 
@@ -46,9 +45,6 @@ private:
     uint64_t m_id = 1;
     uint64_t m_of = 0;
     bool m_verbose;
-
-    uint64_t m_threads;
-    Pool m_pool;
 };
 
 } // namespace entwine
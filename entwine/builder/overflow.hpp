@@ -10,45 +10,114 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 #include <entwine/types/key.hpp>
 #include <entwine/types/vector-point-table.hpp>
 #include <entwine/types/voxel.hpp>
+#include <entwine/util/memory.hpp>
 
 namespace entwine
 {
 
+// Points buffered for a child which doesn't yet exist.  Since an overflow may
+// hold many points, its entries are kept compact: each holds only its point
+// and its cell within the parent chunk, from which its key is reconstructed
+// on demand.  An entry's data lives in our block at the same index.
 class Overflow
 {
     struct Entry
     {
-        Entry(const Key& key) : key(key) { }
-        Voxel voxel;
-        Key key;
+        Point point;
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t z = 0;
     };
 
 public:
-    Overflow(const ChunkKey& ck)
-        : m_chunkKey(ck)
-        , m_pointSize(ck.metadata().schema().pointSize())
+    // Takes the key of the child node into which we overflow.
+    Overflow(const Metadata& metadata, const Dxyz& child)
+        : m_metadata(metadata)
+        , m_child(child)
+        , m_pointSize(metadata.schema().pointSize())
+        , m_copy(m_pointSize)
+        , m_span(metadata.span())
         , m_block(m_pointSize, 256)
     { }
 
-    void insert(Voxel& voxel, Key& key)
+    ~Overflow()
+    {
+        Memory::get().sub(
+                Memory::Subsystem::Overflows,
+                m_list.capacity() * sizeof(Entry));
+    }
+
+    // The key must be positioned at the depth of our parent chunk.
+    void insert(const Voxel& voxel, const Key& key)
     {
-        Entry entry(key);
-        entry.voxel.setData(m_block.next());
-        entry.voxel.initDeep(voxel.point(), voxel.data(), m_pointSize);
+        const Xyz& p(key.position());
+
+        Entry entry;
+        entry.point = voxel.point();
+        entry.x = p.x % m_span;
+        entry.y = p.y % m_span;
+        entry.z = p.z % m_span;
+
+        m_copy.copy(m_block.next(), voxel.data());
+
+        const std::size_t capacity(m_list.capacity());
         m_list.push_back(entry);
+        if (m_list.capacity() != capacity)
+        {
+            Memory::get().add(
+                    Memory::Subsystem::Overflows,
+                    (m_list.capacity() - capacity) * sizeof(Entry));
+        }
     }
 
-    const ChunkKey& chunkKey() const { return m_chunkKey; }
     MemBlock& block() { return m_block; }
     uint64_t size() const { return m_block.size(); }
-    std::vector<Entry>& list() { return m_list; }
+
+    Voxel voxel(uint64_t i) const
+    {
+        Voxel voxel;
+        voxel.initShallow(m_list[i].point, m_block.refs()[i]);
+        return voxel;
+    }
+
+    // The index of this entry's tube within the parent's grid, and its Z
+    // position within that tube.
+    uint64_t tube(uint64_t i) const
+    {
+        return m_list[i].y * m_span + m_list[i].x;
+    }
+    uint32_t z(uint64_t i) const { return m_list[i].z; }
+
+    // This entry's key at the depth of our parent chunk.
+    Key key(uint64_t i) const
+    {
+        const Xyz& child(m_child.position());
+        const uint64_t shift(m_metadata.startDepth());
+        const Entry& entry(m_list[i]);
+
+        Key key(m_metadata);
+        key.set(
+                Xyz(
+                    ((child.x >> 1) << shift) | entry.x,
+                    ((child.y >> 1) << shift) | entry.y,
+                    ((child.z >> 1) << shift) | entry.z),
+                m_child.depth() - 1);
+        return key;
+    }
 
 private:
-    const ChunkKey m_chunkKey;
+    const Metadata& m_metadata;
+    const Dxyz m_child;
     const uint64_t m_pointSize = 0;
+    const PointCopy m_copy;
+    const uint64_t m_span = 0;
 
     MemBlock m_block;
     std::vector<Entry> m_list;
@@ -0,0 +1,139 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/packer.hpp>
+
+#include <iostream>
+#include <stdexcept>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/io/ensure.hpp>
+#include <entwine/io/hierarchy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/uploader.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+Packer::Packer(
+        const Metadata& metadata,
+        const arbiter::Endpoint& out,
+        Pool& pool,
+        const bool verbose)
+    : m_metadata(metadata)
+    , m_dataEp(out.getSubEndpoint("ept-data"))
+    , m_hierEp(out.getSubEndpoint("ept-hierarchy"))
+    , m_pool(pool)
+    , m_verbose(verbose)
+{
+    if (m_metadata.subset())
+    {
+        throw std::runtime_error("Subsets must be merged before packing");
+    }
+}
+
+void Packer::go()
+{
+    visit(Dxyz());
+    m_pool.await();
+    Uploader::get().await();
+
+    if (!m_error.empty())
+    {
+        throw std::runtime_error("Packing failed: " + m_error);
+    }
+
+    // Only once every blob has landed are the individual nodes removed.
+    if (m_dataEp.isLocal())
+    {
+        for (const Dxyz& dxyz : m_nodes) remove(dxyz);
+    }
+
+    if (m_verbose)
+    {
+        std::cout << "Packed " << m_nodes.size() << " nodes into " <<
+            m_files << " files" << std::endl;
+    }
+}
+
+void Packer::visit(const Dxyz& root)
+{
+    const HierarchyPage page(
+            hierarchy::read(
+                m_hierEp,
+                root.toString() + m_metadata.postfix(),
+                m_metadata.hierarchyType()));
+
+    std::vector<Dxyz> nodes;
+    for (const auto& p : page)
+    {
+        if (p.second < 0) visit(p.first);
+        else if (p.second > 0) nodes.push_back(p.first);
+    }
+
+    if (nodes.empty()) return;
+
+    m_nodes.insert(m_nodes.end(), nodes.begin(), nodes.end());
+    ++m_files;
+
+    m_pool.add([this, root, nodes]()
+    {
+        try
+        {
+            pack(root, nodes);
+        }
+        catch (std::exception& e)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_error.empty()) m_error = e.what();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_error.empty()) m_error = "Unknown error";
+        }
+    });
+}
+
+void Packer::pack(const Dxyz& root, const std::vector<Dxyz>& nodes) const
+{
+    const DataIo& io(m_metadata.dataIo());
+    const std::string stem(root.toString() + m_metadata.postfix());
+
+    // Nodes are concatenated in key order, so those which are adjacent in
+    // the blob are neighbors in the tree, and may be read together.
+    std::vector<char> blob;
+    json index;
+
+    for (const Dxyz& dxyz : nodes)
+    {
+        const std::string name(Chunk::dataName(ChunkKey(m_metadata, dxyz)));
+        const auto stored(io.fetch(m_dataEp, name));
+        if (!stored) throw std::runtime_error("Could not fetch " + name);
+
+        index[dxyz.toString()] = { blob.size(), stored->size() };
+        blob.insert(blob.end(), stored->begin(), stored->end());
+    }
+
+    ensurePut(m_dataEp, stem + ".pack", std::move(blob));
+    ensurePut(m_hierEp, stem + ".pack.json", index.dump());
+}
+
+void Packer::remove(const Dxyz& dxyz) const
+{
+    const ChunkKey ck(m_metadata, dxyz);
+    arbiter::remove(
+            m_dataEp.prefixedRoot() + Chunk::dataName(ck) +
+            m_metadata.dataIo().extension());
+}
+
+} // namespace entwine
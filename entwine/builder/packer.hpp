@@ -0,0 +1,64 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+class Metadata;
+
+// Concatenates the stored nodes of each hierarchy file of a completed
+// dataset into a single blob, so that they may be read with range requests
+// into a few large objects rather than with a request per node.  The byte
+// range of each node within its blob is written beside its hierarchy file.
+//
+// Local copies of the individual nodes are then removed.  Remote copies are
+// left in place, for readers which don't understand packed nodes.
+class Packer
+{
+public:
+    Packer(
+            const Metadata& metadata,
+            const arbiter::Endpoint& out,
+            Pool& pool,
+            bool verbose);
+
+    void go();
+
+private:
+    // Pack the nodes of the hierarchy file at this root, and recurse into the
+    // files beneath it.
+    void visit(const Dxyz& root);
+    void pack(const Dxyz& root, const std::vector<Dxyz>& nodes) const;
+    void remove(const Dxyz& dxyz) const;
+
+    const Metadata& m_metadata;
+    const arbiter::Endpoint m_dataEp;
+    const arbiter::Endpoint m_hierEp;
+    Pool& m_pool;
+    const bool m_verbose;
+
+    std::vector<Dxyz> m_nodes;
+    uint64_t m_files = 0;
+
+    std::mutex m_mutex;
+    std::string m_error;
+};
+
+} // namespace entwine
@@ -0,0 +1,178 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/planner.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <entwine/builder/config.hpp>
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/file-info.hpp>
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    // Nodes are about half full on average, and we aim for between this many
+    // of them - enough to spread across threads, but few enough to keep the
+    // hierarchy small.
+    const double nodeFill(0.5);
+    const double minNodes(256);
+    const double maxNodes(1 << 20);
+
+    // Overflow is pointless for nodes certain to split, which we take to be
+    // those whose subtrees hold this many times the points of a full node.
+    const double certainSplit(8);
+
+    // Of the memory of this machine, the share used for in-memory nodes.
+    const double memoryShare(0.5);
+
+    std::string mb(uint64_t bytes)
+    {
+        return commify(bytes / 1024 / 1024) + " MB";
+    }
+}
+
+Planner::Planner(const Config& config)
+    : m_plan(json::object())
+{
+    const json& j(config.toJson());
+    const double points(config.points());
+    if (!points || !j.count("bounds")) return;
+
+    const Bounds bounds(j.at("bounds"));
+    const double side(
+            std::max({ bounds.width(), bounds.depth(), bounds.height() }));
+
+    // The share of the cube's footprint which is covered by input files.
+    double coverage(1);
+    if (j.count("input") && side > 0)
+    {
+        const FileInfoList files(j.at("input").get<FileInfoList>());
+        if (const double area = areaUpperBound(files))
+        {
+            coverage = std::min(1.0, area / (side * side));
+        }
+    }
+
+    const uint64_t pointSize(
+            std::max<uint64_t>(config.schema().pointSize(), 1));
+
+    uint64_t span(config.span());
+    if (!j.count("span"))
+    {
+        // A span of 256 unless its nodes would be too few to spread across
+        // threads, or too many for a compact hierarchy.
+        const auto nodes([points](uint64_t s)
+        {
+            return static_cast<uint64_t>(points / (s * s * nodeFill));
+        });
+
+        span = 256;
+        if (nodes(span) < minNodes) span = 128;
+        else if (nodes(span) > maxNodes) span = 512;
+
+        choose("span", span,
+                commify(points) + " points make about " +
+                commify(nodes(span)) + " half-full nodes");
+    }
+
+    const double nodeSize(span * span);
+
+    if (!j.count("overflowDepth"))
+    {
+        uint64_t depth(0);
+        while (
+                depth < 16 &&
+                points / (std::pow(4.0, depth) * coverage) >=
+                    certainSplit * nodeSize)
+        {
+            ++depth;
+        }
+
+        choose("overflowDepth", depth,
+                "nodes above this depth hold at least " +
+                commify(certainSplit * nodeSize) + " points, over " +
+                std::to_string(std::lround(coverage * 100)) +
+                "% coverage");
+    }
+
+    const uint64_t threads(config.totalThreads());
+    const uint64_t physical(physicalMemory());
+    uint64_t memory(config.maxMemory());
+
+    if (!memory && physical)
+    {
+        memory = physical * memoryShare;
+        choose("maxMemory", memory,
+                "half of the " + mb(physical) + " of this machine");
+    }
+
+    if (!memory) return;
+
+    const uint64_t chunkBytes(nodeSize * nodeFill * pointSize);
+
+    if (!j.count("cacheSize"))
+    {
+        // Half of the budget is left for those chunks in use.
+        const uint64_t cacheSize(
+                std::min<uint64_t>(
+                    std::max<uint64_t>(memory / 2 / chunkBytes, 64),
+                    16384));
+
+        choose("cacheSize", cacheSize,
+                "unused nodes of " + mb(chunkBytes) + " filling half of " +
+                mb(memory));
+    }
+
+    if (!j.count("sleepCount"))
+    {
+        // Each thread sweeps its stale chunks at least four times in the
+        // number of points it takes to fill its share of the budget.
+        const uint64_t share(memory / threads);
+        const uint64_t sleepCount(
+                std::min<uint64_t>(
+                    std::max<uint64_t>(share / pointSize / 4, 500000),
+                    heuristics::sleepCount * 8));
+
+        choose("sleepCount", sleepCount,
+                "a quarter of the points filling each of " +
+                std::to_string(threads) + " threads' " + mb(share));
+    }
+}
+
+void Planner::choose(
+        const std::string& key,
+        const json& value,
+        const std::string& why)
+{
+    m_plan[key] = value;
+    m_rationale.push_back(key + ": " + value.dump() + " - " + why);
+}
+
+uint64_t Planner::physicalMemory()
+{
+#ifndef _WIN32
+    const long pages(sysconf(_SC_PHYS_PAGES));
+    const long pageSize(sysconf(_SC_PAGE_SIZE));
+    if (pages > 0 && pageSize > 0) return uint64_t(pages) * pageSize;
+#endif
+    return 0;
+}
+
+} // namespace entwine
@@ -0,0 +1,57 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+class Config;
+
+// Chooses build parameters from the scanned point count and extents of the
+// input, along with the memory and threads available, for whichever of them
+// the configuration doesn't set explicitly.
+//
+// Points are assumed to be spread over the ground rather than through the
+// volume, so the nodes of each depth occupied by the input number about four
+// times those of the depth above, scaled by the share of the cubic bounds
+// covered by the input files.
+class Planner
+{
+public:
+    // The configuration must be prepared for building, with its scan results.
+    explicit Planner(const Config& config);
+
+    // Only the parameters which were chosen, to be merged into the config.
+    const json& plan() const { return m_plan; }
+
+    // A line for each chosen parameter describing why it was chosen.
+    const std::vector<std::string>& rationale() const { return m_rationale; }
+
+    // The memory of this machine, or 0 if it can't be determined.
+    static uint64_t physicalMemory();
+
+private:
+    void choose(
+            const std::string& key,
+            const json& value,
+            const std::string& why);
+
+    json m_plan;
+    std::vector<std::string> m_rationale;
+};
+
+} // namespace entwine
@@ -0,0 +1,485 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/profiler.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/io/hierarchy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    // Counts of values in power-of-two buckets, each keyed by its lower
+    // bound, along with their extremes.
+    json summarize(const std::vector<uint64_t>& values)
+    {
+        if (values.empty()) return json::object();
+
+        std::map<uint64_t, uint64_t> buckets;
+        uint64_t total(0);
+        for (const uint64_t v : values)
+        {
+            uint64_t b(v ? 1 : 0);
+            while (b && b <= v / 2) b *= 2;
+            ++buckets[b];
+            total += v;
+        }
+
+        json histogram(json::array());
+        for (const auto& p : buckets)
+        {
+            histogram.push_back({ { "from", p.first }, { "count", p.second } });
+        }
+
+        return {
+            { "count", values.size() },
+            { "min", *std::min_element(values.begin(), values.end()) },
+            { "max", *std::max_element(values.begin(), values.end()) },
+            { "mean", total / static_cast<double>(values.size()) },
+            { "histogram", histogram }
+        };
+    }
+
+    // Windows of these fractions of the area of the dataset, at every depth.
+    const std::vector<double> windowAreas{ 1, 0.1, 0.01, 0.001 };
+
+    // Smaller windows are placed at each point of a lattice of this many
+    // positions per axis over the dataset, and their costs averaged.
+    const std::size_t windowLattice(3);
+}
+
+Profiler::Profiler(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(m_config.arbiter()))
+    , m_out(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.output())))
+    , m_hierEp(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-hierarchy")))
+    , m_dataEp(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-data")))
+    , m_metadata(makeUnique<Metadata>(*m_out, m_config))
+    , m_threads(m_config.totalThreads())
+{
+    // Each page names those beneath it, so pages are read a level at a time.
+    std::vector<Dxyz> roots{ Dxyz() };
+    while (!roots.empty())
+    {
+        std::vector<std::vector<Dxyz>> next(roots.size());
+        parallel(roots.size(), [&](const std::size_t i)
+        {
+            next[i] = readPage(roots[i]);
+        });
+
+        roots.clear();
+        for (const auto& r : next)
+        {
+            roots.insert(roots.end(), r.begin(), r.end());
+        }
+    }
+
+    if (m_nodes.empty()) throw std::runtime_error("No nodes to profile");
+
+    std::sort(
+            m_nodes.begin(),
+            m_nodes.end(),
+            [](const Node& a, const Node& b) { return a.key < b.key; });
+}
+
+Profiler::~Profiler() { }
+
+template <typename F>
+void Profiler::parallel(const std::size_t n, F f) const
+{
+    std::atomic<std::size_t> index(0);
+    const auto work([&]()
+    {
+        for (std::size_t i(index++); i < n; i = index++) f(i);
+    });
+
+    std::vector<std::future<void>> futures;
+    for (std::size_t i(1); i < std::min(n, m_threads); ++i)
+    {
+        futures.push_back(std::async(std::launch::async, work));
+    }
+
+    // Every thread must finish before an error may leave this frame.
+    std::exception_ptr error;
+    try { work(); }
+    catch (...) { error = std::current_exception(); }
+
+    for (auto& future : futures)
+    {
+        try { future.get(); }
+        catch (...) { if (!error) error = std::current_exception(); }
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+std::vector<Dxyz> Profiler::readPage(const Dxyz& root)
+{
+    const Metadata& m(*m_metadata);
+    const std::string stem(root.toString() + m.postfix());
+    const HierarchyPage page(
+            hierarchy::read(*m_hierEp, stem, m.hierarchyType()));
+
+    Page info;
+    info.root = root;
+    info.nodes = page.size();
+    if (const auto size = m_hierEp->tryGetSize(
+                stem + hierarchy::extension(m.hierarchyType())))
+    {
+        info.bytes = *size;
+    }
+
+    std::vector<Dxyz> roots;
+    std::vector<Node> nodes;
+    for (const auto& p : page)
+    {
+        if (p.second < 0) roots.push_back(p.first);
+        else if (p.second) nodes.emplace_back(p.first, p.second, root);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pages.push_back(info);
+    m_nodes.insert(m_nodes.end(), nodes.begin(), nodes.end());
+    return roots;
+}
+
+json Profiler::go()
+{
+    uint64_t points(0);
+    for (const Node& node : m_nodes) points += node.np;
+
+    json results {
+        { "nodes", m_nodes.size() },
+        { "points", points },
+        { "span", m_metadata->span() },
+        { "depths", depths() },
+        { "largest", largest() },
+        { "pages", pages() },
+        { "objects", objects() }
+    };
+
+    // The cost of each query depends on the object sizes we've sampled.
+    results["queries"] = queries();
+    return results;
+}
+
+json Profiler::depths() const
+{
+    // Nodes holding more than span * span points must stack voxels or hold
+    // overflow.
+    const uint64_t grid(m_metadata->span() * m_metadata->span());
+
+    std::map<uint64_t, std::vector<uint64_t>> sizes;
+    std::map<uint64_t, uint64_t> overGrid;
+    for (const Node& node : m_nodes)
+    {
+        sizes[node.key.d].push_back(node.np);
+        if (node.np > grid) ++overGrid[node.key.d];
+    }
+
+    json j(json::array());
+    for (const auto& p : sizes)
+    {
+        json depth(summarize(p.second));
+        depth["depth"] = p.first;
+        depth["overGrid"] = overGrid[p.first];
+        j.push_back(depth);
+    }
+    return j;
+}
+
+json Profiler::largest() const
+{
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> totals;
+    for (const Node& node : m_nodes)
+    {
+        auto& t(totals[node.key.d]);
+        t.first += node.np;
+        ++t.second;
+    }
+
+    std::vector<const Node*> nodes;
+    for (const Node& node : m_nodes) nodes.push_back(&node);
+
+    const std::size_t top(
+            std::min<std::size_t>(
+                nodes.size(),
+                m_config.toJson().value("top", 10)));
+    std::partial_sort(
+            nodes.begin(),
+            nodes.begin() + top,
+            nodes.end(),
+            [](const Node* a, const Node* b) { return a->np > b->np; });
+
+    json j(json::array());
+    for (std::size_t i(0); i < top; ++i)
+    {
+        const Node& node(*nodes[i]);
+        const auto& t(totals.at(node.key.d));
+        const double mean(t.first / static_cast<double>(t.second));
+
+        j.push_back({
+            { "key", node.key.toString() },
+            { "points", node.np },
+            { "ofDepthMean", node.np / mean }
+        });
+    }
+    return j;
+}
+
+json Profiler::pages() const
+{
+    std::vector<uint64_t> nodes;
+    std::vector<uint64_t> bytes;
+    for (const Page& page : m_pages)
+    {
+        nodes.push_back(page.nodes);
+        bytes.push_back(page.bytes);
+    }
+
+    return { { "nodes", summarize(nodes) }, { "bytes", summarize(bytes) } };
+}
+
+json Profiler::objects()
+{
+    const Metadata& m(*m_metadata);
+
+    // Packed nodes share a blob per hierarchy page, so there are no objects
+    // of their own to measure.
+    if (m.packNodes()) return { { "error", "Nodes are packed" } };
+
+    const uint64_t sample(m_config.toJson().value("nodes", 1024));
+    const uint64_t count(
+            sample ? std::min<uint64_t>(sample, m_nodes.size()) :
+                m_nodes.size());
+    const double stride(m_nodes.size() / static_cast<double>(count));
+    const std::string extension(m.dataIo().extension());
+
+    std::vector<uint64_t> sizes(count, 0);
+    std::vector<char> found(count, 0);
+    parallel(count, [&](const std::size_t i)
+    {
+        const Node& node(m_nodes[static_cast<uint64_t>(i * stride)]);
+        const ChunkKey ck(m, node.key);
+        if (const auto size = m_dataEp->tryGetSize(
+                    Chunk::dataName(ck) + extension))
+        {
+            sizes[i] = *size;
+            found[i] = 1;
+        }
+    });
+
+    std::vector<uint64_t> stored;
+    uint64_t bytes(0);
+    uint64_t points(0);
+    for (std::size_t i(0); i < count; ++i)
+    {
+        if (!found[i]) continue;
+        stored.push_back(sizes[i]);
+        bytes += sizes[i];
+        points += m_nodes[static_cast<uint64_t>(i * stride)].np;
+    }
+
+    if (points) m_bytesPerPoint = bytes / static_cast<double>(points);
+
+    json j(summarize(stored));
+    j["missing"] = count - stored.size();
+    j["bytesPerPoint"] = m_bytesPerPoint;
+    return j;
+}
+
+json Profiler::queries() const
+{
+    const Metadata& m(*m_metadata);
+    const Bounds& b(m.boundsConforming());
+
+    // Without sampled objects, points are costed at their uncompressed size.
+    const double bytesPerPoint(
+            m_bytesPerPoint ?
+                m_bytesPerPoint :
+                static_cast<double>(m.outSchema().pointSize()));
+
+    std::vector<Bounds> bounds;
+    bounds.reserve(m_nodes.size());
+    for (const Node& node : m_nodes)
+    {
+        bounds.push_back(ChunkKey(m, node.key).bounds());
+    }
+
+    json j(json::array());
+    for (const double area : windowAreas)
+    {
+        const double scale(std::sqrt(area));
+        const double w(b.width() * scale);
+        const double h(b.depth() * scale);
+        const std::size_t n(area < 1 ? windowLattice : 1);
+
+        uint64_t nodes(0);
+        uint64_t points(0);
+        uint64_t pages(0);
+
+        for (std::size_t xi(0); xi < n; ++xi)
+        {
+            for (std::size_t yi(0); yi < n; ++yi)
+            {
+                const double x(b.min().x + (b.width() - w) * (xi + 0.5) / n);
+                const double y(b.min().y + (b.depth() - h) * (yi + 0.5) / n);
+                const Bounds window(
+                        Point(x, y, b.min().z),
+                        Point(x + w, y + h, b.max().z));
+
+                std::set<Dxyz> touched;
+                for (std::size_t i(0); i < m_nodes.size(); ++i)
+                {
+                    if (!bounds[i].overlaps(window, true)) continue;
+                    ++nodes;
+                    points += m_nodes[i].np;
+                    touched.insert(m_nodes[i].page);
+                }
+                pages += touched.size();
+            }
+        }
+
+        const double windows(n * n);
+        j.push_back({
+            { "area", area },
+            { "nodes", nodes / windows },
+            { "points", points / windows },
+            { "bytes", points * bytesPerPoint / windows },
+            { "pages", pages / windows },
+            { "requests", (nodes + pages) / windows }
+        });
+    }
+    return j;
+}
+
+void Profiler::print(const json& r)
+{
+    auto cell([](std::string s, std::size_t width)
+    {
+        if (s.size() < width) s.insert(0, width - s.size(), ' ');
+        return s;
+    });
+    auto fixed([](double v, int precision)
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(precision) << v;
+        return ss.str();
+    });
+    auto integer([](const json& v)
+    {
+        return std::to_string(v.get<uint64_t>());
+    });
+    auto histogram([&](const json& s)
+    {
+        if (!s.count("histogram")) return;
+        for (const json& bucket : s.at("histogram"))
+        {
+            std::cout << cell(integer(bucket.at("from")), 14) << "+" <<
+                cell(integer(bucket.at("count")), 12) << std::endl;
+        }
+    });
+
+    std::cout << "Nodes: " << integer(r.at("nodes")) << std::endl;
+    std::cout << "Points: " << integer(r.at("points")) << std::endl;
+    std::cout << "Span: " << integer(r.at("span")) << std::endl;
+
+    std::cout << std::endl << "Node sizes by depth" << std::endl;
+    std::cout <<
+        cell("Depth", 6) << cell("Nodes", 10) << cell("Min", 10) <<
+        cell("Mean", 12) << cell("Max", 10) << cell("Over grid", 11) <<
+        std::endl;
+    for (const json& d : r.at("depths"))
+    {
+        std::cout <<
+            cell(integer(d.at("depth")), 6) <<
+            cell(integer(d.at("count")), 10) <<
+            cell(integer(d.at("min")), 10) <<
+            cell(fixed(d.at("mean").get<double>(), 1), 12) <<
+            cell(integer(d.at("max")), 10) <<
+            cell(integer(d.at("overGrid")), 11) << std::endl;
+    }
+
+    std::cout << std::endl << "Largest nodes" << std::endl;
+    std::cout <<
+        cell("Key", 20) << cell("Points", 12) << cell("x Depth mean", 14) <<
+        std::endl;
+    for (const json& n : r.at("largest"))
+    {
+        std::cout <<
+            cell(n.at("key").get<std::string>(), 20) <<
+            cell(integer(n.at("points")), 12) <<
+            cell(fixed(n.at("ofDepthMean").get<double>(), 2), 14) <<
+            std::endl;
+    }
+
+    const json& pages(r.at("pages"));
+    std::cout << std::endl << "Hierarchy pages: " <<
+        integer(pages.at("nodes").at("count")) << std::endl;
+    std::cout << "Entries per page" << std::endl;
+    histogram(pages.at("nodes"));
+    std::cout << "Bytes per page" << std::endl;
+    histogram(pages.at("bytes"));
+
+    const json& objects(r.at("objects"));
+    std::cout << std::endl << "Data objects";
+    if (objects.count("error"))
+    {
+        std::cout << ": " << objects.at("error").get<std::string>() <<
+            std::endl;
+    }
+    else
+    {
+        std::cout << ", sampled " << integer(objects.at("count")) <<
+            " (" << integer(objects.at("missing")) << " missing), " <<
+            fixed(objects.at("bytesPerPoint").get<double>(), 2) <<
+            " bytes per point" << std::endl;
+        histogram(objects);
+    }
+
+    std::cout << std::endl << "Simulated window queries, by fraction of area" <<
+        std::endl;
+    std::cout <<
+        cell("Area", 8) << cell("Nodes", 10) << cell("Points", 14) <<
+        cell("MB", 10) << cell("Pages", 8) << cell("Requests", 10) <<
+        std::endl;
+    for (const json& q : r.at("queries"))
+    {
+        std::cout <<
+            cell(fixed(q.at("area").get<double>(), 3), 8) <<
+            cell(fixed(q.at("nodes").get<double>(), 1), 10) <<
+            cell(fixed(q.at("points").get<double>(), 0), 14) <<
+            cell(fixed(q.at("bytes").get<double>() / 1024 / 1024, 1), 10) <<
+            cell(fixed(q.at("pages").get<double>(), 1), 8) <<
+            cell(fixed(q.at("requests").get<double>(), 1), 10) << std::endl;
+    }
+}
+
+} // namespace entwine
@@ -0,0 +1,112 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+class Metadata;
+
+// Reads the hierarchy of a completed dataset and reports its layout, to guide
+// the choice of span, node sizes, and hierarchy paging:
+//      - the distribution of node sizes at each depth,
+//      - the largest nodes, which mark the regions heavy with overflow,
+//      - the node count and stored size of each hierarchy page,
+//      - a histogram of the stored sizes of the data objects,
+//      - the simulated cost of reading windows of a few sizes.
+//
+// Hierarchy pages are read a level at a time, with the pages of each level
+// fetched concurrently.
+//
+// Configuration, in addition to the output of the dataset:
+//      threads: Number of concurrent fetches.
+//      nodes: Number of data objects whose size is fetched, sampled evenly
+//          in key order, 1024 by default, or 0 for all of them.
+//      top: Number of the largest nodes listed, 10 by default.
+class Profiler
+{
+public:
+    Profiler(const Config& config);
+    ~Profiler();
+
+    json go();
+
+    // Print results in tables.
+    static void print(const json& results);
+
+private:
+    struct Node
+    {
+        Node(const Dxyz& key, uint64_t np, const Dxyz& page)
+            : key(key)
+            , np(np)
+            , page(page)
+        { }
+
+        Dxyz key;
+        uint64_t np;
+        Dxyz page;
+    };
+
+    struct Page
+    {
+        Dxyz root;
+        uint64_t nodes = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Read a single hierarchy page, returning the roots of the pages beneath.
+    std::vector<Dxyz> readPage(const Dxyz& root);
+
+    // Run f on every index below n across our threads.
+    template <typename F> void parallel(std::size_t n, F f) const;
+
+    json depths() const;
+    json largest() const;
+    json pages() const;
+    json objects();
+    json queries() const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::unique_ptr<arbiter::Endpoint> m_out;
+    std::unique_ptr<arbiter::Endpoint> m_hierEp;
+    std::unique_ptr<arbiter::Endpoint> m_dataEp;
+    std::unique_ptr<Metadata> m_metadata;
+    const std::size_t m_threads;
+
+    std::mutex m_mutex;
+    std::vector<Node> m_nodes;
+    std::vector<Page> m_pages;
+
+    // Stored bytes per point of the sampled data objects, or zero if none
+    // could be sampled.
+    double m_bytesPerPoint = 0;
+};
+
+} // namespace entwine
@@ -10,11 +10,18 @@
 
 #include <entwine/builder/registry.hpp>
 
+#include <functional>
+#include <string>
+#include <utility>
+
 #include <pdal/PointView.hpp>
 
+#include <entwine/builder/clipper.hpp>
 #include <entwine/io/io.hpp>
+#include <entwine/io/uploader.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/types/schema.hpp>
 #include <entwine/types/subset.hpp>
 #include <entwine/util/unique.hpp>
@@ -24,29 +31,117 @@
 namespace entwine
 {
 
+namespace
+{
+    std::unordered_set<PackedDxyz> frozen(const Hierarchy& hierarchy)
+    {
+        std::unordered_set<PackedDxyz> result;
+        for (const auto& p : hierarchy.map())
+        {
+            result.insert(PackedDxyz(p.first));
+        }
+        return result;
+    }
+
+    // Stored nodes may be copied from one dataset to another as they are only
+    // if both would encode them identically.
+    bool sameEncoding(const Metadata& a, const Metadata& b)
+    {
+        return
+            a.dataIo().type() == b.dataIo().type() &&
+            a.subBlockDepth() == b.subBlockDepth() &&
+            a.las14() == b.las14() &&
+            a.pointOrder() == b.pointOrder();
+    }
+
+    void offsetOrigins(VectorPointTable& table, const Origin origin)
+    {
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            auto& pr(it.pointRef());
+            pr.setField(
+                    DimId::OriginId,
+                    pr.getFieldAs<uint64_t>(DimId::OriginId) + origin);
+        }
+    }
+}
+
 Registry::Registry(
         const Metadata& metadata,
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
         ThreadPools& threadPools,
-        const bool exists)
+        const bool exists,
+        const arbiter::Endpoint* merge)
     : m_metadata(metadata)
     , m_dataEp(out.getSubEndpoint("ept-data"))
     , m_hierEp(out.getSubEndpoint("ept-hierarchy"))
+    , m_statsEp(out.getSubEndpoint("ept-node-stats"))
+    , m_tilesEp(out.getSubEndpoint("cesium"))
     , m_tmp(tmp)
     , m_threadPools(threadPools)
-    , m_hierarchy(m_metadata, m_hierEp, exists)
-    , m_chunkCache(
-            makeUnique<ChunkCache>(
-                m_hierarchy,
-                clipPool(),
-                m_dataEp,
-                m_tmp,
-                m_metadata.cacheSize()))
+    , m_mergeEp(merge)
+    , m_hierarchy(m_metadata, m_hierEp, m_statsEp, exists)
+    , m_frozen(exists && m_metadata.sparseAppend() ?
+            frozen(m_hierarchy) :
+            std::unordered_set<PackedDxyz>())
+    , m_chunkCache(makeCache())
 { }
 
+std::unique_ptr<ChunkCache> Registry::makeCache()
+{
+    return makeUnique<ChunkCache>(
+            m_metadata,
+            m_hierarchy,
+            clipPool(),
+            m_dataEp,
+            m_tmp,
+            m_tilesEp,
+            m_metadata.cacheSize(),
+            m_metadata.maxMemory(),
+            m_frozen.empty() ? nullptr : &m_frozen,
+            m_mergeEp);
+}
+
+std::unique_ptr<Clipper> Registry::takeClipper()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_clippersMutex);
+        if (!m_clippers.empty())
+        {
+            std::unique_ptr<Clipper> clipper(std::move(m_clippers.back()));
+            m_clippers.pop_back();
+            return clipper;
+        }
+    }
+
+    return makeUnique<Clipper>(*m_chunkCache);
+}
+
+void Registry::giveClipper(std::unique_ptr<Clipper> clipper)
+{
+    // While the cache is over budget, nothing idle may hold chunks.
+    // Otherwise age the held chunks by a sweep, as if insertion carried on,
+    // so those the last file didn't touch recently are released.
+    if (m_chunkCache->pressure() > 1) return;
+    clipper->clip();
+
+    std::lock_guard<std::mutex> lock(m_clippersMutex);
+    m_clippers.push_back(std::move(clipper));
+}
+
 void Registry::save(const uint64_t hierarchyStep, const bool verbose)
 {
+    // Idle clippers hold chunks and shallow buffers, all of which must be
+    // returned to the cache before it is flushed.
+    {
+        std::lock_guard<std::mutex> lock(m_clippersMutex);
+        m_clippers.clear();
+    }
+
+    m_chunkCache->flushShallow();
+    m_duplicates += m_chunkCache->duplicates();
+    m_thinned += m_chunkCache->thinned();
     m_chunkCache.reset();
 
     if (!m_metadata.subset())
@@ -55,46 +150,286 @@ void Registry::save(const uint64_t hierarchyStep, const bool verbose)
         else m_hierarchy.analyze(m_metadata, verbose);
     }
 
-    m_hierarchy.save(m_metadata, m_hierEp, m_threadPools.workPool());
+    m_hierarchy.save(
+            m_metadata,
+            m_hierEp,
+            m_statsEp,
+            m_threadPools.workPool());
 }
 
-void Registry::merge(const Registry& other, Clipper& clipper)
+void Registry::checkpoint(const uint64_t hierarchyStep)
 {
-    for (const auto& p : other.hierarchy().map())
-    {
-        const Dxyz& dxyz(p.first);
-        const uint64_t np(p.second);
+    // Tearing down the cache joins the clip pool, so restart it afterward
+    // with the share of threads it had.
+    Pool& pool(clipPool());
+    const std::size_t active(pool.active());
+
+    save(hierarchyStep, false);
+
+    pool.go();
+    pool.setActive(active);
+    m_chunkCache = makeCache();
+}
+
+void Registry::merge(const std::string& postfix)
+{
+    // Shared-depth chunks are fetched, decoded, and reinserted concurrently,
+    // each task with its own Clipper.  These run on the work pool, which is
+    // otherwise idle while merging, since insertion may queue serialization
+    // tasks onto the clip pool.
+    Pool& pool(m_threadPools.workPool());
 
+    std::mutex errorMutex;
+    std::string error;
+
+    const auto visit([&](
+                const Dxyz& dxyz,
+                const uint64_t np,
+                const NodeStats& stats)
+    {
         if (dxyz.d < m_metadata.sharedDepth())
         {
-            VectorPointTable table(m_metadata.schema(), np);
-            table.setProcess([this, &table, &clipper, &dxyz]()
+            pool.add([this, &postfix, &errorMutex, &error, dxyz, np]()
             {
-                Voxel voxel;
-                Key pk(m_metadata);
-                ChunkKey ck(m_metadata);
-
-                for (auto it(table.begin()); it != table.end(); ++it)
+                try
                 {
-                    voxel.initShallow(it.pointRef(), it.data());
-                    const Point point(voxel.point());
-                    pk.init(point, dxyz.d);
-                    ck.init(point, dxyz.d);
-
-                    m_chunkCache->insert(voxel, pk, ck, clipper);
+                    mergeChunk(postfix, dxyz, np);
+                }
+                catch (std::exception& e)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error.empty()) error = e.what();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error.empty()) error = "Unknown error";
                 }
             });
-
-            const auto filename(
-                    dxyz.toString() + other.metadata().postfix(dxyz.d));
-            m_metadata.dataIo().read(m_dataEp, m_tmp, filename, table);
         }
         else
         {
             assert(!m_hierarchy.get(dxyz));
             m_hierarchy.set(dxyz, np);
+            m_hierarchy.setStats(dxyz, stats);
+        }
+    });
+
+    // Our tasks refer to this frame, so they must finish before any error in
+    // reading the hierarchy escapes it.
+    try
+    {
+        Hierarchy::read(m_metadata, m_hierEp, m_statsEp, postfix, visit);
+    }
+    catch (...)
+    {
+        pool.await();
+        throw;
+    }
+
+    pool.await();
+
+    if (error.size())
+    {
+        throw std::runtime_error("Failed to merge shared chunk: " + error);
+    }
+}
+
+void Registry::mergeChunk(
+        const std::string& postfix,
+        const Dxyz& dxyz,
+        const uint64_t np)
+{
+    Clipper clipper(*m_chunkCache);
+    const ChunkKey ck(m_metadata, dxyz);
+
+    VectorPointTable table(m_metadata.schema(), np, VectorPointTable::Reuse());
+    table.setProcess([this, &table, &clipper, &ck]()
+    {
+        m_chunkCache->merge(table, ck, clipper);
+    });
+
+    const auto filename(m_metadata.dataName(dxyz) + postfix);
+    const bool local(m_mergeEp && m_metadata.mergesAt(dxyz.d));
+    m_metadata.dataIo(dxyz.d).read(
+            local ? *m_mergeEp : m_dataEp,
+            m_tmp,
+            filename,
+            table);
+}
+
+void Registry::combine(
+        const Metadata& other,
+        const arbiter::Endpoint& ep,
+        const Origin origin)
+{
+    Pool& pool(m_threadPools.workPool());
+    const arbiter::Endpoint in(ep.getSubEndpoint("ept-data"));
+
+    std::mutex mutex;
+    std::string error;
+    std::vector<std::pair<Dxyz, uint64_t>> shared;
+
+    const auto guard([&mutex, &error](const std::function<void()>& f)
+    {
+        try
+        {
+            f();
+        }
+        catch (std::exception& e)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error.empty()) error = e.what();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error.empty()) error = "Unknown error";
+        }
+    });
+
+    // A node we lack has no descendants we hold either, so it may be copied
+    // as soon as it is read.  Its key is distinct from every other node of
+    // the same dataset, so recording it now can't mislead the check of any
+    // other.
+    const auto visit([&](
+                const Dxyz& dxyz,
+                const uint64_t np,
+                const NodeStats& stats)
+    {
+        if (!np) return;
+
+        if (m_hierarchy.get(dxyz))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shared.emplace_back(dxyz, np);
+            return;
         }
+
+        m_hierarchy.set(dxyz, np);
+        m_hierarchy.setStats(dxyz, stats);
+
+        pool.add([this, &guard, &other, &in, dxyz, np, origin]()
+        {
+            guard([&]() { copyChunk(other, in, dxyz, np, origin); });
+        });
+    });
+
+    try
+    {
+        Hierarchy::read(
+                other,
+                ep.getSubEndpoint("ept-hierarchy"),
+                ep.getSubEndpoint("ept-node-stats"),
+                "",
+                visit);
+    }
+    catch (...)
+    {
+        pool.await();
+        throw;
     }
+
+    // Points reinserted below may descend into the copied nodes, which must
+    // be in place to be reawakened.
+    pool.await();
+    Uploader::get().await();
+
+    if (error.empty())
+    {
+        for (const auto& p : shared)
+        {
+            const Dxyz dxyz(p.first);
+            const uint64_t np(p.second);
+            pool.add([this, &guard, &other, &in, dxyz, np, origin]()
+            {
+                guard([&]() { combineChunk(other, in, dxyz, np, origin); });
+            });
+        }
+        pool.await();
+    }
+
+    if (error.size())
+    {
+        throw std::runtime_error("Failed to combine node: " + error);
+    }
+}
+
+void Registry::copyChunk(
+        const Metadata& other,
+        const arbiter::Endpoint& in,
+        const Dxyz& dxyz,
+        const uint64_t np,
+        const Origin origin)
+{
+    const bool offset(origin && m_metadata.schema().contains(DimId::OriginId));
+    const std::string src(other.dataName(dxyz));
+    const std::string dst(m_metadata.dataName(dxyz));
+
+    if (!offset && sameEncoding(other, m_metadata))
+    {
+        const std::string ext(m_metadata.dataIo().extension());
+        ensurePut(m_dataEp, dst + ext, std::move(*ensureGet(in, src + ext)));
+
+        if (m_metadata.subBlockDepth())
+        {
+            if (const auto index = in.tryGetBinary(src + ".idx"))
+            {
+                ensurePut(m_dataEp, dst + ".idx", std::move(*index));
+            }
+        }
+        return;
+    }
+
+    const Schema& schema(m_metadata.schema());
+    const uint64_t pointSize(schema.pointSize());
+
+    std::vector<char> points;
+    points.reserve(np * pointSize);
+
+    VectorPointTable table(schema, np);
+    table.setProcess([&table, &points, offset, origin, pointSize]()
+    {
+        if (offset) offsetOrigins(table, origin);
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            points.insert(points.end(), it.data(), it.data() + pointSize);
+        }
+    });
+
+    other.dataIo().read(in, m_tmp, src, table);
+
+    const ChunkKey ck(m_metadata, dxyz);
+    BlockPointTable block(schema);
+    block.reserve(points.size() / pointSize);
+    for (uint64_t i(0); i < points.size(); i += pointSize)
+    {
+        block.insert(points.data() + i);
+    }
+
+    pointOrder::sort(m_metadata.pointOrder(), ck.bounds(), block);
+    m_metadata.dataIo().write(m_dataEp, m_tmp, dst, ck.bounds(), block);
+}
+
+void Registry::combineChunk(
+        const Metadata& other,
+        const arbiter::Endpoint& in,
+        const Dxyz& dxyz,
+        const uint64_t np,
+        const Origin origin)
+{
+    Clipper clipper(*m_chunkCache);
+    const ChunkKey ck(m_metadata, dxyz);
+    const bool offset(origin && m_metadata.schema().contains(DimId::OriginId));
+
+    VectorPointTable table(m_metadata.schema(), np, VectorPointTable::Reuse());
+    table.setProcess([this, &table, &clipper, &ck, offset, origin]()
+    {
+        if (offset) offsetOrigins(table, origin);
+        m_chunkCache->merge(table, ck, clipper);
+    });
+
+    other.dataIo().read(in, m_tmp, other.dataName(dxyz), table);
 }
 
 } // namespace entwine
@@ -14,12 +14,15 @@
 #include <memory>
 #include <mutex>
 #include <set>
+#include <unordered_set>
 #include <vector>
 
 #include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/clipper.hpp>
 #include <entwine/builder/hierarchy.hpp>
 #include <entwine/builder/thread-pools.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/defs.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/util/pool.hpp>
 #include <entwine/util/unique.hpp>
@@ -35,16 +38,47 @@ public:
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
             ThreadPools& threadPools,
-            bool exists = false);
+            bool exists = false,
+            const arbiter::Endpoint* merge = nullptr);
 
     void save(uint64_t hierarchyStep, bool verbose);
-    void merge(const Registry& other, Clipper& clipper);
+
+    // Serialize every chunk and write the hierarchy as it stands, then
+    // resume with an empty cache.  No insertions may be in flight.
+    void checkpoint(uint64_t hierarchyStep);
+
+    // Merge another subset of this dataset, whose files carry this postfix,
+    // reading its hierarchy and shared-depth nodes as they are needed rather
+    // than loading a registry for it.
+    void merge(const std::string& postfix);
+
+    // Combine an independent dataset at this endpoint, whose bounds, span,
+    // and schema match ours, so that its tree lines up with our own.  Its
+    // nodes which we lack are copied as they are, without selection, along
+    // with their subtrees, which we lack too.  Those we share are reinserted
+    // into ours, and their points which don't fit may descend into either.
+    // Its points' origins are offset by _origin_.
+    void combine(
+            const Metadata& other,
+            const arbiter::Endpoint& ep,
+            Origin origin);
+
+    // A clipper with which to insert a file, which still holds the chunks of
+    // the last file to be given back, since consecutive files are often
+    // adjacent.  Idle clippers are released when we save.
+    std::unique_ptr<Clipper> takeClipper();
+    void giveClipper(std::unique_ptr<Clipper> clipper);
 
     void addPoint(Voxel& voxel, Key& key, ChunkKey& ck, Clipper& clipper)
     {
         m_chunkCache->insert(voxel, key, ck, clipper);
     }
 
+    void addPoints(Insertions& batch, const ChunkKey& ck, Clipper& clipper)
+    {
+        m_chunkCache->insert(batch, ck, clipper);
+    }
+
     Pool& workPool() { return m_threadPools.workPool(); }
     Pool& clipPool() { return m_threadPools.clipPool(); }
 
@@ -52,15 +86,66 @@ public:
     const Hierarchy& hierarchy() const { return m_hierarchy; }
     ChunkCache& cache() const { return *m_chunkCache; }
 
+    // The points dropped as duplicates by every cache we have saved since
+    // the last call.
+    uint64_t takeDuplicates()
+    {
+        const uint64_t n(m_duplicates);
+        m_duplicates = 0;
+        return n;
+    }
+
+    // Likewise for the points thinned from capped leaves.
+    uint64_t takeThinned()
+    {
+        const uint64_t n(m_thinned);
+        m_thinned = 0;
+        return n;
+    }
+
 private:
+    std::unique_ptr<ChunkCache> makeCache();
+
+    // Read one of another subset's shared-depth chunks and insert its points
+    // into our own tree.
+    void mergeChunk(const std::string& postfix, const Dxyz& dxyz, uint64_t np);
+
+    // Write a node of a combined dataset which we lack as our own, copying
+    // its stored bytes if our encodings match and no origins change.
+    void copyChunk(
+            const Metadata& other,
+            const arbiter::Endpoint& in,
+            const Dxyz& dxyz,
+            uint64_t np,
+            Origin origin);
+
+    // Insert the points of a node of a combined dataset which we share.
+    void combineChunk(
+            const Metadata& other,
+            const arbiter::Endpoint& in,
+            const Dxyz& dxyz,
+            uint64_t np,
+            Origin origin);
+
     const Metadata& m_metadata;
     const arbiter::Endpoint m_dataEp;
     const arbiter::Endpoint m_hierEp;
+    const arbiter::Endpoint m_statsEp;
+    const arbiter::Endpoint m_tilesEp;
     const arbiter::Endpoint& m_tmp;
     ThreadPools& m_threadPools;
+    const arbiter::Endpoint* m_mergeEp;
     Hierarchy m_hierarchy;
 
+    // For a sparse append, the nodes which existed before this build.
+    const std::unordered_set<PackedDxyz> m_frozen;
+
     std::unique_ptr<ChunkCache> m_chunkCache;
+
+    std::mutex m_clippersMutex;
+    std::vector<std::unique_ptr<Clipper>> m_clippers;
+    uint64_t m_duplicates = 0;
+    uint64_t m_thinned = 0;
 };
 
 } // namespace entwine
@@ -10,19 +10,20 @@
 
 #include <entwine/builder/scan.hpp>
 
+#include <cstring>
 #include <limits>
 
 #include <pdal/SpatialReference.hpp>
 #include <pdal/StageFactory.hpp>
-#include <pdal/util/IStream.hpp>
-#include <pdal/util/OStream.hpp>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/builder/thread-pools.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/reprojection.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/types/vector-point-table.hpp>
 #include <entwine/util/executor.hpp>
+#include <entwine/util/las-header.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -30,7 +31,15 @@ namespace entwine
 
 namespace
 {
-    arbiter::http::Headers rangeHeaders(int start, int end = 0)
+    const std::string scanCacheFile("scan-cache.json");
+
+    std::string lasKey(const LasHeader& h)
+    {
+        return std::to_string(h.pointFormat()) + '/' +
+            std::to_string(h.pointLength()) + '/' + h.srsRecords();
+    }
+
+    arbiter::http::Headers rangeHeaders(uint64_t start, uint64_t end = 0)
     {
         arbiter::http::Headers h;
         h["Range"] = "bytes=" + std::to_string(start) + "-" +
@@ -44,9 +53,10 @@ Scan::Scan(const Config config)
     , m_arbiter(m_in.arbiter())
     , m_tmp(m_arbiter.getEndpoint(m_in.tmp()))
     , m_re(m_in.reprojection())
-    , m_files(m_in.input())
+    , m_checkpointed(std::chrono::steady_clock::now())
 {
     arbiter::mkdirp(m_tmp.root());
+    loadCache();
 }
 
 void Scan::read()
@@ -57,27 +67,35 @@ void Scan::read()
     }
     m_pool = makeUnique<Pool>(m_in.totalThreads(), 1, m_in.verbose());
 
-    const std::size_t size(m_files.size());
-    for (std::size_t i(0); i < size; ++i)
+    // Each input entry is scanned as soon as it has been expanded, while later
+    // entries are still being listed.  The total isn't known until then.
+    m_in.input([this](const FileInfoList list)
     {
-        m_index = i;
-        FileInfo& f(m_files.get(i));
-        if (m_in.verbose())
+        for (const FileInfo& info : list)
         {
-            std::cout << i + 1 << "/" << size << ": " << f.path() <<
-                std::endl;
+            m_index = m_listed.size();
+            m_listed.push_back(info);
+
+            FileInfo& f(m_listed.back());
+            if (m_in.verbose())
+            {
+                std::cout << m_index + 1 << ": " << f.path() << std::endl;
+            }
+            add(f);
+            checkpoint();
         }
-        add(f);
-    }
+    });
 
     m_pool->cycle();
+    checkpoint(true);
+
+    m_files = makeUnique<Files>(
+            FileInfoList(m_listed.begin(), m_listed.end()));
 }
 
-void Scan::write(const Config& out) const
+arbiter::Endpoint Scan::outEndpoint() const
 {
-    std::string path(m_in.output());
-    if (path.empty()) return;
-
+    const std::string path(m_in.output());
     arbiter::Endpoint ep(m_arbiter.getEndpoint(path));
 
     if (ep.isLocal())
@@ -93,13 +111,24 @@ void Scan::write(const Config& out) const
         }
     }
 
+    return ep;
+}
+
+void Scan::write(const Config& out) const
+{
+    std::string path(m_in.output());
+    if (path.empty()) return;
+
+    arbiter::Endpoint ep(outEndpoint());
+
     if (m_in.verbose())
     {
         std::cout << std::endl;
         std::cout << "Writing details to " << path << "..." << std::flush;
     }
 
-    m_files.save(ep, "", m_in, true);
+    m_files->save(ep, "", m_in, true);
+    if (m_in.binaryScan()) m_files->saveTable(ep);
     json j(out);
     j.erase("input");
     ep.put("scan.json", j.dump(2));
@@ -110,7 +139,6 @@ void Scan::write(const Config& out) const
     }
 }
 
-
 Config Scan::go()
 {
     read();
@@ -119,6 +147,77 @@ Config Scan::go()
     return out;
 }
 
+void Scan::loadCache()
+{
+    if (m_in.output().empty() || m_in.force()) return;
+
+    const arbiter::Endpoint ep(m_arbiter.getEndpoint(m_in.output()));
+    const auto data(ep.tryGet(scanCacheFile));
+    if (!data) return;
+
+    try
+    {
+        const json j(json::parse(*data));
+        for (const auto& p : j.items())
+        {
+            Cached& c(m_cache[p.key()]);
+            c.size = p.value().at("size").get<std::size_t>();
+            c.info = p.value().value("info", json());
+        }
+    }
+    catch (...)
+    {
+        // A partially written cache is simply discarded.
+        m_cache.clear();
+        return;
+    }
+
+    if (m_in.verbose())
+    {
+        std::cout << "Found " << m_cache.size() << " previous scan results" <<
+            std::endl;
+    }
+}
+
+void Scan::record(
+        const FileInfo& f,
+        const std::size_t* size,
+        const ScanInfo* info)
+{
+    if (m_in.output().empty() || !size) return;
+
+    json entry { { "size", *size } };
+    if (info) entry["info"] = info->toJson();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results[f.path()] = entry;
+    m_dirty = true;
+}
+
+void Scan::checkpoint(const bool force)
+{
+    if (m_in.output().empty()) return;
+
+    const auto now(std::chrono::steady_clock::now());
+    if (!force &&
+            now - m_checkpointed <
+                std::chrono::seconds(heuristics::scanCheckpointSeconds))
+    {
+        return;
+    }
+    m_checkpointed = now;
+
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_dirty) return;
+        m_dirty = false;
+        data = m_results.dump();
+    }
+
+    outEndpoint().put(scanCacheFile, data);
+}
+
 void Scan::add(FileInfo& f)
 {
     if (!Executor::get().good(f.path())) return;
@@ -127,19 +226,35 @@ void Scan::add(FileInfo& f)
     {
         try
         {
-            if (m_in.trustHeaders() && m_arbiter.isHttpDerived(f.path()))
+            std::unique_ptr<std::size_t> size;
+            if (!m_in.output().empty()) size = m_arbiter.tryGetSize(f.path());
+
+            std::unique_ptr<ScanInfo> info;
+
+            auto it(m_cache.find(f.path()));
+            if (size && it != m_cache.end() && it->second.size == *size)
+            {
+                const json& cached(it->second.info);
+                if (!cached.is_null()) info = makeUnique<ScanInfo>(cached);
+            }
+            else if (
+                    m_in.trustHeaders() &&
+                    m_arbiter.isHttpDerived(f.path()))
             {
                 const std::string driver =
                     pdal::StageFactory::inferReaderDriver(f.path());
 
-                if (driver == "readers.las") addLas(f);
-                else addRanged(f);
+                if (driver == "readers.las") info = previewLas(f);
+                else info = previewRanged(f);
             }
             else
             {
                 auto localHandle(m_arbiter.getLocalHandle(f.path(), m_tmp));
-                add(f, localHandle->localPath());
+                info = preview(localHandle->localPath());
             }
+
+            record(f, size.get(), info.get());
+            if (info) apply(f, *info);
         }
         catch (std::exception& e)
         {
@@ -152,63 +267,51 @@ void Scan::add(FileInfo& f)
     });
 }
 
-void Scan::addLas(FileInfo& f)
+std::unique_ptr<ScanInfo> Scan::previewLas(const FileInfo& f)
 {
-    const uint64_t maxHeaderSize(375);
-
-    const uint64_t minorVersionPos(25);
-    const uint64_t headerSizePos(94);
-    const uint64_t pointOffsetPos(96);
-    const uint64_t evlrOffsetPos(235);
-
-    uint8_t minorVersion(0);
-    uint16_t headerSize(0);
-    uint32_t pointOffset(0);
-    uint64_t evlrOffset(0);
-
-    std::string header(m_arbiter.get(f.path(), rangeHeaders(0, maxHeaderSize)));
-
-    std::stringstream headerStream(
-            header,
-            std::ios_base::in | std::ios_base::out | std::ios_base::binary);
-
-    pdal::ILeStream is(&headerStream);
-    pdal::OLeStream os(&headerStream);
+    // A single read typically covers both the header and the VLRs.
+    std::vector<char> data(
+            m_arbiter.getBinary(
+                f.path(),
+                rangeHeaders(0, heuristics::lasHeaderBytes)));
 
-    is.seek(minorVersionPos);
-    is >> minorVersion;
+    LasHeader header(data);
 
-    is.seek(headerSizePos);
-    is >> headerSize;
+    const uint64_t pointOffset(header.pointOffset());
+    if (data.size() < pointOffset)
+    {
+        const auto rest(
+                m_arbiter.getBinary(
+                    f.path(),
+                    rangeHeaders(data.size(), pointOffset)));
+        data.insert(data.end(), rest.begin(), rest.end());
+    }
+    data.resize(pointOffset);
 
-    is.seek(pointOffsetPos);
-    is >> pointOffset;
+    header.addVlrs(
+            std::vector<char>(data.begin() + header.headerSize(), data.end()));
 
-    if (minorVersion >= 4)
+    std::vector<char> evlrs;
+    if (header.evlrOffset() && header.evlrCount())
     {
-        is.seek(evlrOffsetPos);
-        is >> evlrOffset;
-
-        // Modify the header such that the EVLRs come directly after the VLRs -
-        // removing the point data itself.
-        os.seek(evlrOffsetPos);
-        os << pointOffset;
+        evlrs = m_arbiter.getBinary(
+                f.path(),
+                rangeHeaders(header.evlrOffset()));
+        header.addEvlrs(evlrs);
     }
 
-    // Extract the modified header, VLRs, and append the EVLRs.
-    header = headerStream.str();
-    std::vector<char> data(header.data(), header.data() + headerSize);
-
-    const auto vlrs = m_arbiter.getBinary(
-            f.path(),
-            rangeHeaders(headerSize, pointOffset));
-    data.insert(data.end(), vlrs.begin(), vlrs.end());
+    if (headerOnly())
+    {
+        if (auto info = previewHeader(header)) return info;
+    }
 
-    if (minorVersion >= 4)
+    // Otherwise hand PDAL a stand-in file made up of the header, the VLRs,
+    // and the EVLRs, which now directly follow the VLRs since the point data
+    // itself is removed.
+    if (evlrs.size())
     {
-        const auto evlrs = m_arbiter.getBinary(
-                f.path(),
-                rangeHeaders(evlrOffset));
+        const uint64_t pos(235);
+        std::memcpy(data.data() + pos, &pointOffset, sizeof(uint64_t));
         data.insert(data.end(), evlrs.begin(), evlrs.end());
     }
 
@@ -219,13 +322,16 @@ void Scan::addLas(FileInfo& f)
             (ext.size() ? "." + ext : ""));
 
     m_tmp.put(basename, data);
-    add(f, m_tmp.fullPath(basename));
+    auto result(preview(m_tmp.fullPath(basename)));
     arbiter::remove(m_tmp.fullPath(basename));
+    return result;
 }
 
-void Scan::addRanged(FileInfo& f)
+std::unique_ptr<ScanInfo> Scan::previewRanged(const FileInfo& f)
 {
-    const auto data = m_arbiter.getBinary(f.path(), rangeHeaders(0, 16384));
+    const auto data = m_arbiter.getBinary(
+            f.path(),
+            rangeHeaders(0, heuristics::lasHeaderBytes));
 
     const std::string ext(arbiter::Arbiter::getExtension(f.path()));
     const std::string basename(
@@ -234,23 +340,91 @@ void Scan::addRanged(FileInfo& f)
             (ext.size() ? "." + ext : ""));
 
     m_tmp.put(basename, data);
-    add(f, m_tmp.fullPath(basename));
+    auto result(preview(m_tmp.fullPath(basename)));
     arbiter::remove(m_tmp.fullPath(basename));
+    return result;
 }
 
-void Scan::add(FileInfo& f, const std::string localPath)
+bool Scan::headerOnly() const
 {
+    if (!m_in.headerScan() || !m_in.trustHeaders() || m_re) return false;
+
+    // Any reader options or filters may change the result, so only a plain
+    // reader qualifies.
+    const json pipeline(m_in.pipeline(""));
+    if (pipeline.size() != 1) return false;
+
+    for (const auto& p : pipeline.at(0).items())
+    {
+        if (p.key() == "type" && p.value() == "readers.las") continue;
+        if (p.key() == "filename") continue;
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<ScanInfo> Scan::previewHeader(const LasHeader& header)
+{
+    LasTraits traits;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_lasTraits.find(lasKey(header)));
+        if (it == m_lasTraits.end()) return std::unique_ptr<ScanInfo>();
+        traits = it->second;
+    }
+
+    auto info(makeUnique<ScanInfo>());
+    info->srs = traits.srs;
+    info->scale = makeUnique<Scale>(header.scale());
+    info->metadata = header.metadata();
+    info->points = header.points();
+    info->dimNames = traits.dimNames;
+    if (info->points) info->bounds = header.bounds();
+    return info;
+}
+
+std::unique_ptr<ScanInfo> Scan::preview(const std::string& localPath)
+{
+    // LAS files resembling one we've already seen through PDAL need only
+    // their headers.
+    std::unique_ptr<LasHeader> header;
+    if (headerOnly() &&
+            pdal::StageFactory::inferReaderDriver(localPath) == "readers.las")
+    {
+        try { header = LasHeader::read(localPath); }
+        catch (...) { }
+
+        if (header)
+        {
+            if (auto info = previewHeader(*header)) return info;
+        }
+    }
+
     const json pipeline(m_in.pipeline(localPath));
+    auto info(Executor::get().preview(pipeline, m_in.trustHeaders()));
 
-    auto preview(Executor::get().preview(pipeline, m_in.trustHeaders()));
-    if (!preview) return;
+    if (info && header)
+    {
+        LasTraits traits;
+        traits.dimNames = info->dimNames;
+        traits.srs = info->srs;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lasTraits[lasKey(*header)] = traits;
+    }
 
-    f.set(*preview);
+    return info;
+}
+
+void Scan::apply(FileInfo& f, const ScanInfo& info)
+{
+    f.set(info);
 
     DimList dims;
-    for (const std::string name : preview->dimNames) dims.emplace_back(name);
+    for (const std::string name : info.dimNames) dims.emplace_back(name);
 
-    const Scale scale(preview->scale ? *preview->scale : 1);
+    const Scale scale(info.scale ? *info.scale : 1);
     if (!scale.x || !scale.y || !scale.z)
     {
         throw std::runtime_error(
@@ -283,7 +457,7 @@ Config Scan::aggregate()
     }
 
     bool srsLogged(false);
-    for (const auto& f : m_files.list())
+    for (const auto& f : m_files->list())
     {
         if (!f.points()) continue;
 
@@ -343,7 +517,7 @@ Config Scan::aggregate()
 
     if (out.schema().empty()) out.setSchema(m_schema);
     out.setPoints(std::max<uint64_t>(np, out.points()));
-    out.setInput(m_files.list());
+    out.setInput(m_files->list());
     if (m_re) out.setReprojection(*m_re);
     out.setSrs(srs);
     out.setPipeline(m_in.pipeline(""));
@@ -10,23 +10,29 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstddef>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <entwine/builder/config.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/files.hpp>
 #include <entwine/types/schema.hpp>
+#include <entwine/util/executor.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/pool.hpp>
 
 namespace entwine
 {
 
+class LasHeader;
 class Reprojection;
 
 class Scan
@@ -42,20 +48,39 @@ public:
     const Config& inConfig() const { return m_in; }
 
     std::size_t index() const { return m_index; }
-    std::size_t total() const { return m_files.size(); }
+    std::size_t total() const { return m_listed.size(); }
 
-    const Files& files() const { return m_files; }
-    Files& files() { return m_files; }
+    // Available once read() completes.
+    const Files& files() const { return *m_files; }
+    Files& files() { return *m_files; }
 
     std::unique_ptr<Reprojection>& reprojection() { return m_re; }
 
 private:
     void add(FileInfo& f);
 
-    void addLas(FileInfo& f);
-    void addRanged(FileInfo& f);
-
-    void add(FileInfo& f, std::string localPath);
+    std::unique_ptr<ScanInfo> previewLas(const FileInfo& f);
+    std::unique_ptr<ScanInfo> previewRanged(const FileInfo& f);
+    std::unique_ptr<ScanInfo> preview(const std::string& localPath);
+
+    // Derive the preview of a LAS file from its header alone, once PDAL has
+    // previewed a file with the same point format and coordinate system
+    // records.  Returns null if PDAL is needed.
+    std::unique_ptr<ScanInfo> previewHeader(const LasHeader& header);
+    bool headerOnly() const;
+
+    void apply(FileInfo& f, const ScanInfo& info);
+
+    // Results are cached in the output alongside the scan, keyed by path and
+    // validated by file size, so an interrupted or repeated scan need only
+    // read new or changed files.
+    void loadCache();
+    void record(
+            const FileInfo& f,
+            const std::size_t* size,
+            const ScanInfo* info);
+    void checkpoint(bool force = false);
+    arbiter::Endpoint outEndpoint() const;
 
     const Config m_in;
 
@@ -67,8 +92,34 @@ private:
     std::unique_ptr<Reprojection> m_re;
     mutable std::mutex m_mutex;
 
+    // What PDAL reported for each combination of LAS point format and
+    // coordinate system records.
+    struct LasTraits
+    {
+        std::vector<std::string> dimNames;
+        std::string srs;
+    };
+
+    std::map<std::string, LasTraits> m_lasTraits;
+
+    struct Cached
+    {
+        std::size_t size = 0;
+        json info;
+    };
+
+    std::map<std::string, Cached> m_cache;
+    json m_results = json::object();
+    bool m_dirty = false;
+    std::chrono::steady_clock::time_point m_checkpointed;
+
+    // Files are appended here as the input is listed.  Unlike a vector, a
+    // deque leaves those already appended in place for the tasks scanning
+    // them.
+    std::deque<FileInfo> m_listed;
+
     // These are the portions we build during go().
-    Files m_files;
+    std::unique_ptr<Files> m_files;
     Schema m_schema;
     Scale m_scale = 1;
 };
@@ -10,105 +10,252 @@
 
 #include <entwine/builder/sequence.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <future>
 #include <iterator>
+#include <limits>
+#include <thread>
+#include <utility>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/bounds.hpp>
+#include <entwine/types/file-index.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/types/subset.hpp>
 #include <entwine/util/executor.hpp>
+#include <entwine/util/hilbert.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
-Sequence::Sequence(Metadata& metadata, std::mutex& mutex)
+namespace
+{
+    uint32_t quantize(double v, double min, double width)
+    {
+        const double cells(1u << 16);
+        const double t(width > 0 ? (v - min) / width * cells : 0);
+        return static_cast<uint32_t>(std::min(std::max(t, 0.0), cells - 1));
+    }
+}
+
+Sequence::Sequence(Metadata& metadata, std::mutex& mutex, std::string order)
     : m_metadata(metadata)
     , m_files(metadata.mutableFiles())
     , m_mutex(mutex)
-    , m_origin(0)
-    , m_end(m_files.size())
+    , m_order()
+    , m_index(0)
+    , m_end(0)
     , m_added(0)
-    , m_overlaps()
 {
     const Bounds activeBounds(
             m_metadata.subset() ?
                 m_metadata.subset()->bounds() :
                 m_metadata.boundsConforming());
 
-    for (Origin i(m_origin); i < m_end; ++i)
+    // Files which may overlap our bounds, found from an index of their
+    // extents.  Those without bounds could overlap anything.
+    m_candidates.assign(m_files.size(), 0);
+    for (const Origin o : FileIndex(m_files.list()).query(activeBounds))
+    {
+        m_candidates[o] = 1;
+    }
+    for (Origin i(0); i < m_files.size(); ++i)
     {
-        const FileInfo& f(m_files.get(i));
-        const Bounds* b(f.boundsEpsilon());
+        if (!m_files.get(i).boundsEpsilon()) m_candidates[i] = 1;
+    }
 
-        if (!b || activeBounds.overlaps(*b, true))
-        {
-            m_overlaps.push_back(i);
-        }
+    // Skip everything prior to the first file which may overlap our bounds.
+    // Files after that point are still all visited, since out-of-bounds
+    // files must be accounted for as such.
+    const auto first(
+            std::find(m_candidates.begin(), m_candidates.end(), 1) -
+            m_candidates.begin());
+
+    for (Origin i(first); i < m_files.size(); ++i) m_order.push_back(i);
+
+    if (order == "spatial") sortSpatially();
+    else if (order == "largest") sortBySize(false);
+    else if (order == "spatial-largest")
+    {
+        sortSpatially();
+        sortBySize(true);
+    }
+    else if (order != "input")
+    {
+        throw std::runtime_error("Invalid file order: " + order);
     }
 
-    m_origin = m_overlaps.empty() ? m_end : m_overlaps.front();
+    filter();
+    m_end = m_order.size();
+    std::vector<char>().swap(m_candidates);
 }
 
-std::unique_ptr<Origin> Sequence::next(std::size_t max)
+void Sequence::filter()
 {
-    auto lock(getLock());
-    while (m_origin < m_end && (!max || m_added < max))
+    // Inferring the reader for each path isn't free, so with very many files
+    // the checks are spread across threads.  Files which can't overlap our
+    // bounds have been scanned, so they need no reader.  Their outcomes are
+    // applied here in order, and only the files to be inserted are retained.
+    std::vector<Outcome> outcomes(m_order.size(), Outcome::Insert);
+
+    const std::size_t shards(
+            std::max<std::size_t>(
+                std::min<std::size_t>(
+                    std::thread::hardware_concurrency(),
+                    m_order.size() / heuristics::sequenceShardFiles),
+                1));
+    const std::size_t per(m_order.size() / shards + 1);
+
+    std::vector<std::future<void>> futures;
+    for (std::size_t shard(0); shard < shards; ++shard)
     {
-        const Origin active(m_origin++);
+        futures.push_back(std::async(std::launch::async, [&, shard]()
+        {
+            const std::size_t begin(shard * per);
+            const std::size_t end(std::min(begin + per, m_order.size()));
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                outcomes[i] = check(m_order[i]);
+            }
+        }));
+    }
+    for (auto& f : futures) f.get();
 
-        if (checkInfo(active))
+    const Subset* subset(m_metadata.subset());
+    const bool primary(!subset || subset->primary());
+
+    std::vector<Origin> order;
+    for (std::size_t i(0); i < m_order.size(); ++i)
+    {
+        const Origin origin(m_order[i]);
+        switch (outcomes[i])
         {
-            ++m_added;
-            return makeUnique<Origin>(active);
+            case Outcome::Insert:
+                order.push_back(origin);
+                break;
+            case Outcome::Skip:
+                break;
+            case Outcome::Omit:
+                m_files.set(origin, FileInfo::Status::Omitted);
+                break;
+            case Outcome::OutOfBounds:
+                m_files.addOutOfBounds(
+                        origin,
+                        m_files.get(origin).points(),
+                        primary);
+                m_files.set(origin, FileInfo::Status::Inserted);
+                break;
+            case Outcome::Elsewhere:
+                m_files.set(origin, FileInfo::Status::Inserted);
+                break;
         }
     }
 
-    return std::unique_ptr<Origin>();
+    m_order = std::move(order);
 }
 
-bool Sequence::checkInfo(Origin origin)
+void Sequence::sortSpatially()
 {
-    FileInfo& info(m_files.get(origin));
+    const Bounds& cube(m_metadata.boundsCubic());
+
+    // Files without bounds keep their relative order, after all others.
+    const uint64_t unknown(std::numeric_limits<uint64_t>::max());
 
-    if (info.status() != FileInfo::Status::Outstanding)
+    std::vector<std::pair<uint64_t, Origin>> keyed;
+    keyed.reserve(m_order.size());
+
+    for (const Origin origin : m_order)
     {
-        return false;
+        uint64_t key(unknown);
+        if (const Bounds* b = m_files.get(origin).boundsEpsilon())
+        {
+            key = hilbert(
+                    quantize(b->mid().x, cube.min().x, cube.width()),
+                    quantize(b->mid().y, cube.min().y, cube.depth()),
+                    16);
+        }
+        keyed.emplace_back(key, origin);
     }
-    else if (!Executor::get().good(info.path()))
+
+    std::stable_sort(
+            keyed.begin(),
+            keyed.end(),
+            [](const std::pair<uint64_t, Origin>& a,
+                const std::pair<uint64_t, Origin>& b)
+            {
+                return a.first < b.first;
+            });
+
+    for (std::size_t i(0); i < keyed.size(); ++i) m_order[i] = keyed[i].second;
+}
+
+void Sequence::sortBySize(const bool classes)
+{
+    // Files of unknown size have no points recorded, so they come last.
+    std::vector<std::pair<uint64_t, Origin>> keyed;
+    keyed.reserve(m_order.size());
+
+    for (const Origin origin : m_order)
     {
-        m_files.set(origin, FileInfo::Status::Omitted);
-        return false;
+        uint64_t key(m_files.get(origin).points());
+        if (classes && key) key = std::log2(key) + 1;
+        keyed.emplace_back(key, origin);
     }
-    else if (const Bounds* infoBounds = info.boundsEpsilon())
+
+    std::stable_sort(
+            keyed.begin(),
+            keyed.end(),
+            [](const std::pair<uint64_t, Origin>& a,
+                const std::pair<uint64_t, Origin>& b)
+            {
+                return a.first > b.first;
+            });
+
+    for (std::size_t i(0); i < keyed.size(); ++i) m_order[i] = keyed[i].second;
+}
+
+std::unique_ptr<Origin> Sequence::next(std::size_t max)
+{
+    auto lock(getLock());
+    if (m_index >= m_end || (max && m_added >= max))
     {
-        if (!checkBounds(origin, *infoBounds, info.points()))
-        {
-            m_files.set(origin, FileInfo::Status::Inserted);
-            return false;
-        }
+        return std::unique_ptr<Origin>();
     }
 
-    return true;
+    ++m_added;
+    return makeUnique<Origin>(m_order[m_index++]);
 }
 
-bool Sequence::checkBounds(
-        const Origin origin,
-        const Bounds& bounds,
-        const std::size_t points)
+Sequence::Outcome Sequence::check(const Origin origin) const
 {
-    if (!m_metadata.boundsCubic().overlaps(bounds, true))
+    const FileInfo& info(m_files.get(origin));
+
+    if (info.status() != FileInfo::Status::Outstanding) return Outcome::Skip;
+    if (m_candidates[origin] && !Executor::get().good(info.path()))
     {
-        const Subset* subset(m_metadata.subset());
-        const bool primary(!subset || subset->primary());
-        m_files.addOutOfBounds(origin, points, primary);
-        return false;
+        return Outcome::Omit;
     }
-    else if (const Subset* subset = m_metadata.subset())
+
+    if (const Bounds* bounds = info.boundsEpsilon())
     {
-        if (!subset->bounds().overlaps(bounds, true)) return false;
+        // Points outside of our conforming bounds are never inserted, so a
+        // file entirely outside of them need not be read at all.
+        if (!m_metadata.boundsConforming().overlaps(*bounds, true))
+        {
+            return Outcome::OutOfBounds;
+        }
+        if (const Subset* subset = m_metadata.subset())
+        {
+            if (!subset->bounds().overlaps(*bounds, true))
+            {
+                return Outcome::Elsewhere;
+            }
+        }
     }
 
-    return true;
+    return Outcome::Insert;
 }
 
 } // namespace entwine
@@ -27,10 +27,23 @@ class Sequence
     friend class Builder;
 
 public:
-    Sequence(Metadata& metadata, std::mutex& mutex);
+    // Files are inserted in the order of the input list unless the order is
+    // "spatial", in which case files with known bounds are visited along a
+    // Hilbert curve of their centers so that consecutive (and thus
+    // concurrently active) files tend to share chunks.
+    //
+    // With "largest", files are visited by descending point count, so that
+    // the largest files don't start last and leave a single thread running
+    // long after the others are idle.  With "spatial-largest", files are
+    // grouped into classes whose point counts are within a factor of two,
+    // largest first, and visited spatially within each class.
+    Sequence(
+            Metadata& metadata,
+            std::mutex& mutex,
+            std::string order = "input");
 
     std::unique_ptr<Origin> next(std::size_t max);
-    bool done() const { auto l(getLock()); return m_origin < m_end; }
+    bool done() const { auto l(getLock()); return m_index < m_end; }
     std::size_t added() const { return m_added; }
 
     // Stop this build as soon as possible.  All partially inserted paths will
@@ -39,7 +52,7 @@ public:
     void stop()
     {
         auto l(getLock());
-        m_end = std::min(m_end, m_origin + 1);
+        m_end = std::min(m_end, m_index + 1);
         std::cout << "Stopping - setting end at " << m_end << std::endl;
     }
 
@@ -49,18 +62,38 @@ private:
         return std::unique_lock<std::mutex>(m_mutex);
     }
 
-    bool checkInfo(Origin origin);
-    bool checkBounds(Origin origin, const Bounds& bounds, std::size_t points);
+    // What becomes of each file, determined for every file up front so that
+    // next() needs only to pop the next one to be inserted.
+    enum class Outcome : char
+    {
+        Insert,         // Outstanding, and may overlap our bounds.
+        Skip,           // Already handled, by a previous build.
+        Omit,           // Not a point cloud file.
+        OutOfBounds,    // Outside of the dataset's conforming bounds.
+        Elsewhere       // Inside the dataset, but outside of our subset.
+    };
+
+    Outcome check(Origin origin) const;
+    void filter();
+    void sortSpatially();
+
+    // Stable, so with _classes_ the existing order is kept among files whose
+    // point counts share a power of two.
+    void sortBySize(bool classes);
 
     const Metadata& m_metadata;
     Files& m_files;
     std::mutex& m_mutex;
 
-    Origin m_origin;
-    Origin m_end;
-    std::size_t m_added;
+    // While constructing, whether each file may overlap our active bounds.
+    std::vector<char> m_candidates;
 
-    std::vector<Origin> m_overlaps;
+    // Origins of the files to be inserted, in the order they will be visited,
+    // and our position within it.
+    std::vector<Origin> m_order;
+    std::size_t m_index;
+    std::size_t m_end;
+    std::size_t m_added;
 };
 
 } // namespace entwine
@@ -0,0 +1,56 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/shallow-buffer.hpp>
+
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/heuristics.hpp>
+
+namespace entwine
+{
+
+ShallowBuffer::ShallowBuffer(const Metadata& metadata)
+    : m_metadata(metadata)
+    , m_copy(metadata.schema().pointSize())
+    , m_selection(metadata.selection())
+    , m_duplicate(metadata.dedup(), metadata.schema())
+    , m_block(metadata.schema().pointSize(), 4096)
+{ }
+
+bool ShallowBuffer::full() const
+{
+    return size() >= heuristics::shallowBufferPoints;
+}
+
+void ShallowBuffer::flush(ChunkCache& cache, Clipper& clipper)
+{
+    Key key(m_metadata);
+    ChunkKey ck(m_metadata);
+
+    for (auto& p : m_voxels)
+    {
+        // Our keys are at tree depths, which begin at the start depth.
+        const Dxyz dxyz(p.first.unpack());
+        const uint64_t depth(dxyz.depth() - m_metadata.startDepth());
+        Voxel& voxel(p.second);
+
+        key.init(voxel.point(), depth);
+        ck.init(voxel.point(), depth);
+        cache.insert(voxel, key, ck, clipper);
+    }
+
+    cache.addDuplicates(m_duplicates);
+    m_duplicates = 0;
+
+    m_voxels.clear();
+    m_block.clear();
+}
+
+} // namespace entwine
@@ -0,0 +1,83 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include <entwine/types/key.hpp>
+#include <entwine/types/point-copy.hpp>
+#include <entwine/types/selection.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/types/voxel.hpp>
+
+namespace entwine
+{
+
+class ChunkCache;
+class Clipper;
+
+// A private copy of the shallowest levels of the tree, above the partition
+// depth, held by one thread at a time.  Points are selected here exactly as
+// they would be in a chunk, but without touching any shared state, and only
+// the winning point of each voxel is later merged into the shared chunks.
+// Losers descend immediately, so below the partition depth each thread works
+// within its own subtrees.
+class ShallowBuffer
+{
+public:
+    ShallowBuffer(const Metadata& metadata);
+
+    // Returns true if this point was retained here, or dropped as a
+    // duplicate.  Otherwise the voxel now holds the point - either this one
+    // or one it displaced - which must descend to the next depth.
+    bool insert(Voxel& voxel, const Key& key)
+    {
+        Voxel& dst(m_voxels[PackedDxyz(Dxyz(key.d, key.position()))]);
+
+        if (!dst.data())
+        {
+            dst.setData(m_block.next());
+            dst.initDeep(voxel.point(), voxel.data(), m_copy);
+            return true;
+        }
+
+        if (m_duplicate(voxel.point(), voxel.data(), dst.point(), dst.data()))
+        {
+            ++m_duplicates;
+            return true;
+        }
+
+        if (selection::displaces(m_selection, voxel.point(), dst.point(), key))
+        {
+            voxel.swapDeep(dst, m_copy);
+        }
+
+        return false;
+    }
+
+    uint64_t size() const { return m_voxels.size(); }
+    bool full() const;
+
+    // Insert our points into the shared chunks, after which we are empty.
+    void flush(ChunkCache& cache, Clipper& clipper);
+
+private:
+    const Metadata& m_metadata;
+    const PointCopy m_copy;
+    const Selection m_selection;
+    const DuplicateTest m_duplicate;
+    uint64_t m_duplicates = 0;
+    MemBlock m_block;
+    std::unordered_map<PackedDxyz, Voxel> m_voxels;
+};
+
+} // namespace entwine
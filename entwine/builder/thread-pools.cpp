@@ -12,6 +12,8 @@
 
 #include <entwine/builder/thread-pools.hpp>
 
+#include <entwine/util/numa.hpp>
+
 namespace entwine
 {
 
@@ -23,12 +25,66 @@ ThreadPools::ThreadPools(
         const std::size_t workThreads,
         const std::size_t clipThreads,
         const bool verbose)
-    : m_workPool(std::max<std::size_t>(1, workThreads), 1, verbose)
+    : m_size(
+            std::max<std::size_t>(1, workThreads) +
+            std::max<std::size_t>(4, clipThreads))
+    , m_workPool(m_size, 1, verbose)
     , m_clipPool(
-            std::max<std::size_t>(4, clipThreads),
-            std::max<std::size_t>(4, clipThreads) * m_workPool.numThreads() * 4,
+            m_size,
+            std::max<std::size_t>(4, clipThreads) *
+                std::max<std::size_t>(1, workThreads) * 4,
             verbose)
-{ }
+{
+    m_workPool.setActive(std::max<std::size_t>(1, workThreads));
+    m_clipPool.setActive(std::max<std::size_t>(4, clipThreads));
+}
+
+void ThreadPools::rebalance(const uint64_t alive)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_joined) return;
+
+    const bool growing(alive > m_lastAlive);
+    m_lastAlive = alive;
+
+    const std::size_t work(m_workPool.active());
+    const std::size_t clip(m_clipPool.active());
+    const std::size_t backlog(m_clipPool.queued());
+
+    if (backlog > clip * heuristics::clipBacklogPerThread && growing)
+    {
+        // Serialization is falling behind.
+        if (work > 1)
+        {
+            m_workPool.setActive(work - 1);
+            m_clipPool.setActive(clip + 1);
+        }
+    }
+    else if (
+            !backlog &&
+            !growing &&
+            clip > 1 &&
+            m_clipPool.idle() > 1 &&
+            !m_workPool.idle())
+    {
+        // Insertion is saturated while serialization threads sit idle.
+        m_clipPool.setActive(clip - 1);
+        m_workPool.setActive(work + 1);
+    }
+}
+
+std::size_t ThreadPools::pinToNodes()
+{
+    const std::size_t nodes(numa::nodes().size());
+    if (nodes < 2) return nodes;
+
+    const auto pin([](std::size_t node) { numa::pin(node); });
+    m_workPool.setGroups(nodes, pin);
+    m_clipPool.setGroups(nodes, pin);
+    cycle();
+
+    return nodes;
+}
 
 std::size_t ThreadPools::getWorkThreads(
         const std::size_t total,
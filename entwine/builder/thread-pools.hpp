@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <mutex>
+
 #include <entwine/builder/heuristics.hpp>
 #include <entwine/util/pool.hpp>
 
@@ -31,21 +33,37 @@ public:
     const Pool& workPool() const { return m_workPool; }
     const Pool& clipPool() const { return m_clipPool; }
 
-    std::size_t size() const
-    {
-        return m_workPool.numThreads() + m_clipPool.numThreads();
-    }
+    // Both pools are created with enough threads to take on the entire
+    // budget, but only this many are active between them.
+    std::size_t size() const { return m_size; }
+
+    // Shift a thread between the work and clip roles if one of them is
+    // falling behind while the other has spare capacity.  The number of
+    // chunks currently alive in the cache indicates whether serialization is
+    // keeping up with insertion.  Intended to be called periodically.
+    void rebalance(uint64_t alive);
+
+    // Spread the threads of both pools across the machine's NUMA nodes,
+    // pinning each to one node, and restart them.  Since active threads are
+    // those of the lowest indices, each role stays balanced across nodes as
+    // threads are shifted between them.  Returns the number of nodes, which
+    // is zero if the topology is unknown, in which case nothing is changed.
+    std::size_t pinToNodes();
 
     void join()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_joined = true;
         m_workPool.join();
         m_clipPool.join();
     }
 
     void go()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
         m_workPool.go();
         m_clipPool.go();
+        m_joined = false;
     }
 
     void cycle()
@@ -63,8 +81,15 @@ public:
             double workToClipRatio = heuristics::defaultWorkToClipRatio);
 
 private:
+    const std::size_t m_size;
     Pool m_workPool;
     Pool m_clipPool;
+
+    // Guards against rebalancing while the pools are being joined or
+    // resized.
+    std::mutex m_mutex;
+    bool m_joined = false;
+    uint64_t m_lastAlive = 0;
 };
 
 } // namespace entwine
@@ -0,0 +1,243 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/transcoder.hpp>
+
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/io/ensure.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/uploader.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
+#include <entwine/types/point-packer.hpp>
+#include <entwine/types/scale-offset.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    std::string getInput(const Config& config)
+    {
+        const json& c(config.toJson());
+        if (!c.count("input") || !c.at("input").is_string())
+        {
+            throw std::runtime_error("Required field 'input' is missing");
+        }
+        return c.at("input").get<std::string>();
+    }
+
+    void putNow(
+            const arbiter::Endpoint& ep,
+            const std::string& path,
+            const json& j)
+    {
+        const std::string s(j.dump(2));
+        ensurePutNow(ep, path, std::vector<char>(s.begin(), s.end()));
+    }
+}
+
+Transcoder::Transcoder(const Config& config)
+    : m_config(config)
+    , m_arbiter(std::make_shared<arbiter::Arbiter>(m_config.arbiter()))
+    , m_in(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(getInput(m_config))))
+    , m_out(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.output())))
+    , m_tmp(makeUnique<arbiter::Endpoint>(
+                m_arbiter->getEndpoint(m_config.tmp())))
+    , m_inData(makeUnique<arbiter::Endpoint>(
+                m_in->getSubEndpoint("ept-data")))
+    , m_outData(makeUnique<arbiter::Endpoint>(
+                m_out->getSubEndpoint("ept-data")))
+    , m_meta(json::parse(m_in->get("ept.json")))
+    , m_build(json::parse(m_in->get("ept-build.json")))
+    , m_from(makeUnique<Metadata>(*m_in))
+    , m_verbose(m_config.verbose())
+    , m_pool(m_config.totalThreads())
+{
+    if (m_in->prefixedRoot() == m_out->prefixedRoot())
+    {
+        throw std::runtime_error("Cannot transcode a dataset in place");
+    }
+    if (m_from->subset())
+    {
+        throw std::runtime_error("Subsets must be merged before transcoding");
+    }
+    if (m_from->packNodes())
+    {
+        throw std::runtime_error("Cannot transcode packed nodes");
+    }
+
+    const json& c(m_config.toJson());
+    if (c.count("dataType")) m_meta["dataType"] = c.at("dataType");
+    if (c.count("compressionLevel"))
+    {
+        m_build["compressionLevel"] = c.at("compressionLevel");
+    }
+
+    const Schema existing(m_meta.at("schema"));
+    const Schema kept(m_config.keptSchema(existing));
+
+    for (const std::string& name : m_from->nodeStats())
+    {
+        if (!kept.contains(name))
+        {
+            throw std::runtime_error(
+                    "Cannot drop node stats dimension " + name);
+        }
+    }
+
+    std::unique_ptr<Scale> scale;
+    if (c.count("scale"))
+    {
+        if (!existing.isScaled())
+        {
+            throw std::runtime_error("Only a scaled dataset may be rescaled");
+        }
+        scale = makeUnique<Scale>(c.at("scale"));
+    }
+
+    // The statistics of the dimensions which remain are still accurate.
+    json dims(json::array());
+    for (json d : m_meta.at("schema"))
+    {
+        const std::string name(d.at("name").get<std::string>());
+        if (!kept.contains(name)) continue;
+
+        if (scale)
+        {
+            if (name == "X") d["scale"] = scale->x;
+            if (name == "Y") d["scale"] = scale->y;
+            if (name == "Z") d["scale"] = scale->z;
+        }
+        dims.push_back(d);
+    }
+    m_meta["schema"] = dims;
+
+    m_to = makeUnique<Metadata>(Config(merge(m_build, m_meta)), true);
+    m_packer = makeUnique<PointPacker>(m_from->schema(), m_to->schema());
+}
+
+Transcoder::~Transcoder() { }
+
+void Transcoder::go()
+{
+    const std::string from(m_in->prefixedRoot());
+    const std::string to(m_out->prefixedRoot());
+
+    if (m_out->isLocal())
+    {
+        for (const std::string& dir : m_to->dataDirs())
+        {
+            arbiter::mkdirp(to + "ept-data/" + dir);
+        }
+        arbiter::mkdirp(to + "ept-data");
+    }
+
+    // Everything but the node data is unchanged.
+    m_arbiter->copy(from + "ept-hierarchy/", to + "ept-hierarchy/");
+    m_arbiter->copy(from + "ept-sources/", to + "ept-sources/");
+    if (m_from->nodeStats().size())
+    {
+        m_arbiter->copy(from + "ept-node-stats/", to + "ept-node-stats/");
+    }
+
+    if (m_verbose)
+    {
+        std::cout << "Transcoding " << m_from->dataIo().type() << " to " <<
+            m_to->dataIo().type() << "..." << std::endl;
+    }
+
+    std::atomic<uint64_t> nodes(0);
+    const arbiter::Endpoint hierEp(m_in->getSubEndpoint("ept-hierarchy"));
+    const arbiter::Endpoint statsEp(m_in->getSubEndpoint("ept-node-stats"));
+
+    Hierarchy::read(
+            *m_from,
+            hierEp,
+            statsEp,
+            m_from->postfix(),
+            [this, &nodes](const Dxyz& key, const uint64_t np, const NodeStats&)
+            {
+                if (!np) return;
+                ++nodes;
+                m_pool.add([this, key, np]() { transcode(key, np); });
+            });
+
+    m_pool.await();
+    Uploader::get().await();
+
+    if (!m_pool.errors().empty())
+    {
+        throw std::runtime_error(
+                "Transcoding failed: " + m_pool.errors().front());
+    }
+
+    m_to->dataIo().save(*m_out);
+    putNow(*m_out, "ept-build.json", m_build);
+    putNow(*m_out, "ept.json", m_meta);
+
+    if (m_verbose)
+    {
+        std::cout << "Transcoded " << nodes << " nodes" << std::endl;
+    }
+}
+
+void Transcoder::transcode(const Dxyz& dxyz, const uint64_t np) const
+{
+    const ChunkKey from(*m_from, dxyz);
+    const ChunkKey to(*m_to, dxyz);
+    const uint64_t pointSize(m_to->schema().pointSize());
+
+    std::vector<char> points;
+    points.reserve(np * pointSize);
+
+    VectorPointTable table(m_from->schema(), np);
+    table.setProcess([this, &table, &points, pointSize]()
+    {
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            points.resize(points.size() + pointSize);
+            char* pos(points.data() + points.size() - pointSize);
+            m_packer->pack(it.data(), pos);
+        }
+    });
+
+    m_from->dataIo().read(*m_inData, *m_tmp, Chunk::dataName(from), table);
+
+    BlockPointTable block(m_to->schema());
+    block.reserve(points.size() / pointSize);
+    for (uint64_t i(0); i < points.size(); i += pointSize)
+    {
+        block.insert(points.data() + i);
+    }
+
+    pointOrder::sort(m_to->pointOrder(), to.bounds(), block);
+    m_to->dataIo().write(
+            *m_outData,
+            *m_tmp,
+            Chunk::dataName(to),
+            to.bounds(),
+            block);
+}
+
+} // namespace entwine
@@ -0,0 +1,77 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+class Metadata;
+class PointPacker;
+
+// Writes a completed dataset to a new output with a different dataType,
+// scale, compressionLevel, or set of dimensions, none of which change the
+// structure of its tree.  Each node is decoded in its existing type and
+// encoded in the new one across a pool, and the hierarchy, node stats, and
+// sources are copied as they are.  The EPT metadata is written last, so an
+// output without it is incomplete.
+//
+// Configuration, in addition to the threads and tmp:
+//      input: The path of the existing dataset, which is only read.
+//      output: The path of the new dataset, which must differ.
+//      dataType, scale, compressionLevel: Each replaces the existing value,
+//          if given.
+//      keepDims, dropDims: As for a build.
+class Transcoder
+{
+public:
+    Transcoder(const Config& config);
+    ~Transcoder();
+
+    void go();
+
+private:
+    void transcode(const Dxyz& dxyz, uint64_t np) const;
+
+    const Config m_config;
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::unique_ptr<arbiter::Endpoint> m_in;
+    std::unique_ptr<arbiter::Endpoint> m_out;
+    std::unique_ptr<arbiter::Endpoint> m_tmp;
+    std::unique_ptr<arbiter::Endpoint> m_inData;
+    std::unique_ptr<arbiter::Endpoint> m_outData;
+
+    // The existing EPT metadata documents, and those we'll write.
+    json m_meta;
+    json m_build;
+
+    std::unique_ptr<Metadata> m_from;
+    std::unique_ptr<Metadata> m_to;
+    std::unique_ptr<PointPacker> m_packer;
+    const bool m_verbose;
+
+    Pool m_pool;
+};
+
+} // namespace entwine
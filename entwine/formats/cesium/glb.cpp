@@ -0,0 +1,449 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/formats/cesium/glb.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <entwine/formats/cesium/meshopt.hpp>
+#include <entwine/io/io.hpp>
+
+namespace entwine
+{
+namespace cesium
+{
+
+namespace
+{
+    const uint64_t headerSize(12);
+    const uint32_t jsonChunk(0x4e4f534a);
+    const uint32_t binChunk(0x004e4942);
+
+    // glTF component types.
+    const int byteType(5120);
+    const int unsignedByteType(5121);
+    const int unsignedShortType(5123);
+    const int floatType(5126);
+
+    const int arrayBufferTarget(34962);
+
+    void put(std::vector<char>& data, const uint32_t v)
+    {
+        const char* pos(reinterpret_cast<const char*>(&v));
+        data.insert(data.end(), pos, pos + sizeof(v));
+    }
+
+    void pad(std::vector<char>& data, const char c = 0)
+    {
+        while (data.size() % 4) data.push_back(c);
+    }
+
+    // XYZ may be read directly only from tables which store them as doubles.
+    bool directXyz(const VectorPointTable& table)
+    {
+        return table.directXyz();
+    }
+
+    bool directXyz(const BlockPointTable&) { return false; }
+
+    Point xyz(VectorPointTable& table, const uint64_t i)
+    {
+        return table.xyz(table.getPoint(i));
+    }
+
+    Point xyz(BlockPointTable&, uint64_t) { return Point(); }
+
+    // Attributes are padded to four bytes per point.
+    uint64_t xyzSize(const Settings& s)
+    {
+        return s.quantize() ? 4 * sizeof(uint16_t) : 3 * sizeof(float);
+    }
+
+    uint64_t normalSize(const Settings& s)
+    {
+        return s.quantize() ? 4 : 3 * sizeof(float);
+    }
+
+    double cubeWidth(const Bounds& b)
+    {
+        return std::max(std::max(b.width(), b.depth()), b.height());
+    }
+}
+
+Glb::Glb(const Settings& settings, const ChunkKey& ck, const uint64_t np)
+    : m_settings(settings)
+    , m_key(ck)
+    , m_np(np)
+    , m_origin(
+            m_settings.quantize() ? m_key.bounds().min() : m_key.bounds().mid())
+    , m_scale(
+            m_settings.quantize() ? cubeWidth(m_key.bounds()) / 65535.0 : 1.0)
+    , m_xyz(np * xyzSize(settings), 0)
+    , m_rgb(settings.hasColor() ? np * 4 : 0, 0)
+    , m_normals(settings.hasNormals() ? np * normalSize(settings) : 0, 0)
+    , m_min(std::numeric_limits<double>::max())
+    , m_max(std::numeric_limits<double>::lowest())
+{
+    if (m_settings.colorType() == ColorType::Tile)
+    {
+        for (uint8_t& c : m_color) c = std::rand() % 256;
+    }
+}
+
+uint64_t Glb::pointSize(const Settings& settings)
+{
+    return xyzSize(settings) +
+        (settings.hasColor() ? 4 : 0) +
+        (settings.hasNormals() ? normalSize(settings) : 0);
+}
+
+std::vector<char> Glb::build(
+        const Metadata& metadata,
+        const arbiter::Endpoint& in,
+        const arbiter::Endpoint& tmp)
+{
+    // Binary data types are unpacked in a single pass, so must be given room
+    // for the entire node, while laszip is streamed in smaller batches.
+    const bool whole(metadata.dataIo().type() != "laszip");
+
+    VectorPointTable table(
+            metadata.schema(),
+            whole ? std::max<uint64_t>(m_np, 1) : 4096);
+    table.setProcess([this, &table]() { encode(table, table.numPoints()); });
+
+    metadata.dataIo().read(
+            in.getSubEndpoint("ept-data"),
+            tmp,
+            metadata.dataName(m_key.get()),
+            table);
+
+    return finish();
+}
+
+std::vector<char> Glb::build(BlockPointTable& table)
+{
+    encode(table, table.size());
+    return finish();
+}
+
+template<typename Table>
+void Glb::encode(Table& table, const uint64_t np)
+{
+    if (m_index + np > m_np)
+    {
+        throw std::runtime_error(
+                "Invalid point count for " + m_key.toString());
+    }
+
+    const uint64_t pointXyzSize(xyzSize(m_settings));
+    char* pos(m_xyz.data() + m_index * pointXyzSize);
+
+    pdal::PointRef pr(table, 0);
+    const bool direct(directXyz(table));
+
+    for (uint64_t i(0); i < np; ++i)
+    {
+        if (direct)
+        {
+            writeXyz(xyz(table, i), pos + i * pointXyzSize);
+        }
+        else
+        {
+            pr.setPointId(i);
+            const Point p(
+                    pr.getFieldAs<double>(DimId::X),
+                    pr.getFieldAs<double>(DimId::Y),
+                    pr.getFieldAs<double>(DimId::Z));
+            writeXyz(p, pos + i * pointXyzSize);
+        }
+    }
+
+    if (m_settings.hasColor())
+    {
+        const ColorType type(m_settings.colorType());
+        assert(type != ColorType::None);
+
+        char* rgb(m_rgb.data() + m_index * 4);
+        uint8_t c[3] = { m_color[0], m_color[1], m_color[2] };
+
+        for (uint64_t i(0); i < np; ++i)
+        {
+            pr.setPointId(i);
+            if (type == ColorType::Rgb)
+            {
+                c[0] = getByte(pr, DimId::Red);
+                c[1] = getByte(pr, DimId::Green);
+                c[2] = getByte(pr, DimId::Blue);
+            }
+            else if (type == ColorType::Intensity)
+            {
+                c[0] = c[1] = c[2] = getByte(pr, DimId::Intensity);
+            }
+
+            std::memcpy(rgb + i * 4, c, 3);
+        }
+    }
+
+    if (m_settings.hasNormals())
+    {
+        const uint64_t pointNormalSize(normalSize(m_settings));
+        char* normals(m_normals.data() + m_index * pointNormalSize);
+
+        for (uint64_t i(0); i < np; ++i)
+        {
+            pr.setPointId(i);
+            const float v[3] = {
+                pr.getFieldAs<float>(DimId::NormalX),
+                pr.getFieldAs<float>(DimId::NormalY),
+                pr.getFieldAs<float>(DimId::NormalZ)
+            };
+            writeNormal(v, normals + i * pointNormalSize);
+        }
+    }
+
+    m_index += np;
+}
+
+void Glb::writeXyz(const Point& p, char* dst)
+{
+    const double v[3] = {
+        (p.x - m_origin.x) / m_scale,
+        (p.y - m_origin.y) / m_scale,
+        (p.z - m_origin.z) / m_scale
+    };
+
+    if (m_settings.quantize())
+    {
+        uint16_t q[4] = { 0, 0, 0, 0 };
+        for (int i(0); i < 3; ++i)
+        {
+            const double c(std::max(0.0, std::min(std::round(v[i]), 65535.0)));
+            q[i] = static_cast<uint16_t>(c);
+        }
+        std::memcpy(dst, q, sizeof(q));
+
+        m_min = Point::min(m_min, Point(q[0], q[1], q[2]));
+        m_max = Point::max(m_max, Point(q[0], q[1], q[2]));
+    }
+    else
+    {
+        const float f[3] = {
+            static_cast<float>(v[0]),
+            static_cast<float>(v[1]),
+            static_cast<float>(v[2])
+        };
+        std::memcpy(dst, f, sizeof(f));
+
+        m_min = Point::min(m_min, Point(f[0], f[1], f[2]));
+        m_max = Point::max(m_max, Point(f[0], f[1], f[2]));
+    }
+}
+
+void Glb::writeNormal(const float* n, char* dst) const
+{
+    if (!m_settings.quantize())
+    {
+        std::memcpy(dst, n, 3 * sizeof(float));
+        return;
+    }
+
+    int8_t v[4] = { 0, 0, 0, 0 };
+    for (int i(0); i < 3; ++i)
+    {
+        const float c(std::max(-1.0f, std::min(n[i], 1.0f)));
+        v[i] = static_cast<int8_t>(std::round(c * 127.0f));
+    }
+    std::memcpy(dst, v, sizeof(v));
+}
+
+uint8_t Glb::getByte(const pdal::PointRef& pr, const DimId id) const
+{
+    if (!m_settings.truncate()) return pr.getFieldAs<uint8_t>(id);
+    else return pr.getFieldAs<uint16_t>(id) >> 8;
+}
+
+std::vector<char> Glb::finish()
+{
+    if (m_index != m_np)
+    {
+        throw std::runtime_error(
+                "Invalid point count for " + m_key.toString());
+    }
+
+    const bool compress(m_settings.meshopt());
+    const bool quantize(m_settings.quantize());
+
+    std::vector<char> bin;
+    uint64_t fallbackBytes(0);
+
+    json bufferViews(json::array());
+    json accessors(json::array());
+    json attributes;
+
+    const auto add([&](
+            const std::string& name,
+            const std::vector<char>& data,
+            const uint64_t stride,
+            json accessor)
+    {
+        json view {
+            { "buffer", 0 },
+            { "byteOffset", bin.size() },
+            { "byteLength", data.size() },
+            { "byteStride", stride },
+            { "target", arrayBufferTarget }
+        };
+
+        if (compress)
+        {
+            // The uncompressed view refers to a fallback buffer which has no
+            // data, since the extension is required.
+            const std::vector<char> compressed(
+                    meshopt::encodeVertices(data.data(), m_np, stride));
+
+            view["buffer"] = 1;
+            view["byteOffset"] = fallbackBytes;
+            view["extensions"]["EXT_meshopt_compression"] = {
+                { "buffer", 0 },
+                { "byteOffset", bin.size() },
+                { "byteLength", compressed.size() },
+                { "byteStride", stride },
+                { "mode", "ATTRIBUTES" },
+                { "count", m_np }
+            };
+
+            bin.insert(bin.end(), compressed.begin(), compressed.end());
+            fallbackBytes += data.size();
+        }
+        else
+        {
+            bin.insert(bin.end(), data.begin(), data.end());
+        }
+        pad(bin);
+
+        accessor["bufferView"] = bufferViews.size();
+        accessor["byteOffset"] = 0;
+        accessor["count"] = m_np;
+        accessor["type"] = "VEC3";
+
+        attributes[name] = accessors.size();
+        bufferViews.push_back(view);
+        accessors.push_back(accessor);
+    });
+
+    add("POSITION", m_xyz, xyzSize(m_settings), {
+        { "componentType", quantize ? unsignedShortType : floatType },
+        { "min", m_np ? m_min : Point(0) },
+        { "max", m_np ? m_max : Point(0) }
+    });
+
+    if (m_settings.hasColor())
+    {
+        add("COLOR_0", m_rgb, 4, {
+            { "componentType", unsignedByteType },
+            { "normalized", true }
+        });
+    }
+
+    if (m_settings.hasNormals())
+    {
+        json accessor { { "componentType", quantize ? byteType : floatType } };
+        if (quantize) accessor["normalized"] = true;
+        add("NORMAL", m_normals, normalSize(m_settings), accessor);
+    }
+
+    json buffers(json::array());
+    buffers.push_back({ { "byteLength", bin.size() } });
+    if (compress)
+    {
+        buffers.push_back({
+            { "byteLength", fallbackBytes },
+            { "extensions", {
+                { "EXT_meshopt_compression", { { "fallback", true } } }
+            } }
+        });
+    }
+
+    json extensions(json::array());
+    if (compress) extensions.push_back("EXT_meshopt_compression");
+    if (quantize) extensions.push_back("KHR_mesh_quantization");
+
+    // Positions are relative to the origin at our scale, and glTF is Y-up
+    // while 3D Tiles are Z-up, so the node transform maps our (x, y, z) to
+    // (x, z, -y), which clients rotate back.  The matrix is column-major.
+    const double s(m_scale);
+    const Point& o(m_origin);
+    const json matrix {
+        s, 0, 0, 0,
+        0, 0, -s, 0,
+        0, s, 0, 0,
+        o.x, o.z, -o.y, 1
+    };
+
+    json primitives(json::array());
+    primitives.push_back({ { "attributes", attributes }, { "mode", 0 } });
+
+    json scenes(json::array());
+    scenes.push_back({ { "nodes", json::array({ 0 }) } });
+
+    json nodes(json::array());
+    nodes.push_back({ { "mesh", 0 }, { "matrix", matrix } });
+
+    json meshes(json::array());
+    meshes.push_back({ { "primitives", primitives } });
+
+    json j {
+        { "asset", { { "version", "2.0" }, { "generator", "Entwine" } } },
+        { "scene", 0 },
+        { "scenes", scenes },
+        { "nodes", nodes },
+        { "meshes", meshes },
+        { "accessors", accessors },
+        { "bufferViews", bufferViews },
+        { "buffers", buffers }
+    };
+
+    if (!extensions.empty())
+    {
+        j["extensionsUsed"] = extensions;
+        j["extensionsRequired"] = extensions;
+    }
+
+    std::vector<char> jsonData;
+    const std::string jsonString(j.dump());
+    jsonData.insert(jsonData.end(), jsonString.begin(), jsonString.end());
+    pad(jsonData, ' ');
+
+    std::vector<char> data;
+    data.reserve(headerSize + 8 + jsonData.size() + 8 + bin.size());
+
+    const std::string magic("glTF");
+    data.insert(data.end(), magic.begin(), magic.end());
+    put(data, 2);                                           // Version.
+    put(data, headerSize + 8 + jsonData.size() + 8 + bin.size());
+
+    put(data, jsonData.size());
+    put(data, jsonChunk);
+    data.insert(data.end(), jsonData.begin(), jsonData.end());
+
+    put(data, bin.size());
+    put(data, binChunk);
+    data.insert(data.end(), bin.begin(), bin.end());
+
+    return data;
+}
+
+} // namespace cesium
+} // namespace entwine
@@ -0,0 +1,83 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <entwine/formats/cesium/settings.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+namespace cesium
+{
+
+// This class represents a single binary glTF tile, holding a mesh of POINTS
+// primitives, for 3D Tiles 1.1 glTF content:
+// https://github.com/CesiumGS/3d-tiles/tree/main/specification/TileFormats/glTF
+//
+// Each attribute is written to its own 4-byte aligned buffer view, which is
+// compressed with EXT_meshopt_compression if enabled.  Quantized attributes
+// use KHR_mesh_quantization, with positions dequantized by the node transform.
+class Glb
+{
+public:
+    Glb(const Settings& settings, const ChunkKey& ck, uint64_t np);
+
+    // Encode the node from a completed build.
+    std::vector<char> build(
+            const Metadata& metadata,
+            const arbiter::Endpoint& in,
+            const arbiter::Endpoint& tmp);
+
+    // Encode the points of a node as it is being written during a build.
+    std::vector<char> build(BlockPointTable& table);
+
+    // The uncompressed size of each point in the binary chunk.
+    static uint64_t pointSize(const Settings& settings);
+
+private:
+    template<typename Table> void encode(Table& table, uint64_t np);
+    void writeXyz(const Point& p, char* dst);
+    void writeNormal(const float* n, char* dst) const;
+    uint8_t getByte(const pdal::PointRef& pr, DimId id) const;
+
+    std::vector<char> finish();
+
+    const Settings& m_settings;
+    const ChunkKey m_key;
+    const uint64_t m_np;
+
+    // Positions are relative to this origin, at this scale.
+    const Point m_origin;
+    const double m_scale;
+
+    std::vector<char> m_xyz;
+    std::vector<char> m_rgb;
+    std::vector<char> m_normals;
+
+    // The extents of the encoded positions.
+    Point m_min;
+    Point m_max;
+
+    // The number of points encoded so far.
+    uint64_t m_index = 0;
+
+    // Used for ColorType::Tile.
+    uint8_t m_color[3] = { 0, 0, 0 };
+};
+
+} // namespace cesium
+} // namespace entwine
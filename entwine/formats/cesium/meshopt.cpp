@@ -0,0 +1,197 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/formats/cesium/meshopt.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace entwine
+{
+namespace cesium
+{
+namespace meshopt
+{
+
+namespace
+{
+    const uint8_t header(0xa0);             // Vertex codec, version 0.
+    const uint64_t groupSize(16);
+    const uint64_t blockBytes(8192);
+    const uint64_t maxBlockSize(256);
+    const uint64_t minTailSize(32);
+
+    // The number of vertices per block, a multiple of the group size.
+    uint64_t blockSize(const uint64_t vertexSize)
+    {
+        const uint64_t n((blockBytes / vertexSize) & ~(groupSize - 1));
+        return std::min(n, maxBlockSize);
+    }
+
+    // The encoded size of a group at this many bits per value.  Values which
+    // do not fit are written in full after the packed bits, so zero bits are
+    // only possible for a group of zeros.
+    uint64_t measure(const uint8_t* group, const int bits)
+    {
+        if (bits == 8) return groupSize;
+
+        if (!bits)
+        {
+            const bool zero(std::all_of(group, group + groupSize,
+                        [](uint8_t v) { return !v; }));
+            return zero ? 0 : std::numeric_limits<uint64_t>::max();
+        }
+
+        const uint8_t sentinel((1 << bits) - 1);
+        uint64_t size(groupSize * bits / 8);
+        for (uint64_t i(0); i < groupSize; ++i)
+        {
+            if (group[i] >= sentinel) ++size;
+        }
+        return size;
+    }
+
+    void encodeGroup(
+            const uint8_t* group,
+            const int bits,
+            std::vector<char>& out)
+    {
+        if (!bits) return;
+
+        if (bits == 8)
+        {
+            out.insert(out.end(), group, group + groupSize);
+            return;
+        }
+
+        const uint64_t perByte(8 / bits);
+        const uint8_t sentinel((1 << bits) - 1);
+
+        for (uint64_t i(0); i < groupSize; i += perByte)
+        {
+            uint8_t byte(0);
+            for (uint64_t k(0); k < perByte; ++k)
+            {
+                byte <<= bits;
+                byte |= std::min(group[i + k], sentinel);
+            }
+            out.push_back(static_cast<char>(byte));
+        }
+
+        for (uint64_t i(0); i < groupSize; ++i)
+        {
+            if (group[i] >= sentinel)
+            {
+                out.push_back(static_cast<char>(group[i]));
+            }
+        }
+    }
+
+    // A header of two bits per group selecting its width, then the groups.
+    void encodeBytes(const std::vector<uint8_t>& buffer, std::vector<char>& out)
+    {
+        const uint64_t groups(buffer.size() / groupSize);
+        const uint64_t headerPos(out.size());
+        out.resize(out.size() + (groups + 3) / 4, 0);
+
+        for (uint64_t g(0); g < groups; ++g)
+        {
+            const uint8_t* group(buffer.data() + g * groupSize);
+
+            int best(8);
+            uint64_t bestSize(measure(group, 8));
+            for (const int bits : { 0, 2, 4 })
+            {
+                const uint64_t size(measure(group, bits));
+                if (size < bestSize)
+                {
+                    best = bits;
+                    bestSize = size;
+                }
+            }
+
+            const int code(best == 8 ? 3 : best / 2);
+            out[headerPos + g / 4] |= static_cast<char>(code << (g % 4 * 2));
+            encodeGroup(group, best, out);
+        }
+    }
+
+    void encodeBlock(
+            const uint8_t* vertices,
+            const uint64_t count,
+            const uint64_t vertexSize,
+            std::vector<uint8_t>& last,
+            std::vector<char>& out)
+    {
+        // Zigzag-encoded deltas of each byte of the vertex in turn, padded
+        // with zeros to a whole number of groups.
+        std::vector<uint8_t> buffer((count + groupSize - 1) & ~(groupSize - 1));
+
+        for (uint64_t k(0); k < vertexSize; ++k)
+        {
+            uint8_t p(last[k]);
+            for (uint64_t i(0); i < count; ++i)
+            {
+                const uint8_t v(vertices[i * vertexSize + k]);
+                const uint8_t d(v - p);
+                buffer[i] = static_cast<uint8_t>((d << 1) ^ (0 - (d >> 7)));
+                p = v;
+            }
+
+            encodeBytes(buffer, out);
+        }
+
+        const uint8_t* back(vertices + (count - 1) * vertexSize);
+        last.assign(back, back + vertexSize);
+    }
+}
+
+std::vector<char> encodeVertices(
+        const char* data,
+        const uint64_t count,
+        const uint64_t vertexSize)
+{
+    if (!vertexSize || vertexSize % 4 || vertexSize > 256)
+    {
+        throw std::runtime_error("Invalid meshopt vertex size");
+    }
+
+    const uint8_t* vertices(reinterpret_cast<const uint8_t*>(data));
+
+    // Deltas begin from the first vertex, which closes the stream.
+    std::vector<uint8_t> first(vertexSize, 0);
+    if (count) std::copy(vertices, vertices + vertexSize, first.begin());
+    std::vector<uint8_t> last(first);
+
+    std::vector<char> out(1, static_cast<char>(header));
+
+    const uint64_t block(blockSize(vertexSize));
+    for (uint64_t i(0); i < count; i += block)
+    {
+        encodeBlock(
+                vertices + i * vertexSize,
+                std::min(block, count - i),
+                vertexSize,
+                last,
+                out);
+    }
+
+    // The tail also gives the decoder room to read whole groups.
+    const uint64_t tail(std::max(vertexSize, minTailSize));
+    out.resize(out.size() + tail - vertexSize, 0);
+    out.insert(out.end(), first.begin(), first.end());
+
+    return out;
+}
+
+} // namespace meshopt
+} // namespace cesium
+} // namespace entwine
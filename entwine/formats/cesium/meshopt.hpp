@@ -0,0 +1,39 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace entwine
+{
+namespace cesium
+{
+namespace meshopt
+{
+
+// Encode interleaved vertex attributes with the version 0 vertex codec of the
+// EXT_meshopt_compression glTF extension, as bufferView data of mode
+// ATTRIBUTES:
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+//
+// Each byte of the vertex is delta-encoded against the previous vertex and
+// bit-packed in groups of 16, so slowly varying attributes such as sorted
+// positions and colors shrink considerably.  The vertex size must be a
+// multiple of 4, no greater than 256.
+std::vector<char> encodeVertices(
+        const char* data,
+        uint64_t count,
+        uint64_t vertexSize);
+
+} // namespace meshopt
+} // namespace cesium
+} // namespace entwine
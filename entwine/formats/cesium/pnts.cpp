@@ -10,6 +10,12 @@
 
 #include <entwine/formats/cesium/pnts.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
 #include <entwine/io/io.hpp>
 #include <entwine/types/binary-point-table.hpp>
 
@@ -18,169 +24,333 @@ namespace entwine
 namespace cesium
 {
 
-Pnts::Pnts(const Tileset& tileset, const ChunkKey& ck)
-    : m_tileset(tileset)
-    , m_key(ck)
-    , m_mid(m_key.bounds().mid())
-{ }
-
-std::vector<char> Pnts::build()
+namespace
 {
-    VectorPointTable table(m_tileset.metadata().schema());
-    table.setProcess([this, &table]()
-    {
-        m_np += table.numPoints();
-        buildXyz(table);
-        buildRgb(table);
-        buildNormals(table);
-    });
-
-    m_tileset.metadata().dataIo().read(
-            m_tileset.in().getSubEndpoint("ept-data"),
-            m_tileset.tmp(),
-            m_key.get().toString(),
-            table);
+    const uint64_t headerSize(28);
+
+    void put(std::vector<char>& data, uint64_t& pos, const uint32_t v)
+    {
+        std::memcpy(data.data() + pos, &v, sizeof(v));
+        pos += sizeof(v);
+    }
+
+    // XYZ may be read directly only from tables which store them as doubles.
+    bool directXyz(const VectorPointTable& table)
+    {
+        return table.directXyz();
+    }
+
+    bool directXyz(const BlockPointTable&) { return false; }
+
+    Point xyz(VectorPointTable& table, const uint64_t i)
+    {
+        return table.xyz(table.getPoint(i));
+    }
+
+    Point xyz(BlockPointTable&, uint64_t) { return Point(); }
+
+    uint16_t quantize(const double v, const double min, const double size)
+    {
+        if (size <= 0) return 0;
+        const double q(std::round((v - min) / size * 65535.0));
+        return static_cast<uint16_t>(std::max(0.0, std::min(q, 65535.0)));
+    }
+
+    uint8_t toSnorm(const float v)
+    {
+        const float c(std::max(-1.0f, std::min(v, 1.0f)));
+        return static_cast<uint8_t>(std::round((c * 0.5f + 0.5f) * 255.0f));
+    }
+
+    float signNotZero(const float v) { return v < 0 ? -1.0f : 1.0f; }
+
+    uint64_t xyzSize(const Settings& s)
+    {
+        return s.quantize() ? 3 * sizeof(uint16_t) : 3 * sizeof(float);
+    }
 
-    return buildFile();
+    uint64_t normalSize(const Settings& s)
+    {
+        return s.quantize() ? 2 : 3 * sizeof(float);
+    }
 }
 
-void Pnts::buildXyz(VectorPointTable& table)
+Pnts::Pnts(const Settings& settings, const ChunkKey& ck, const uint64_t np)
+    : m_settings(settings)
+    , m_key(ck)
+    , m_mid(m_key.bounds().mid())
+    , m_min(m_key.bounds().min())
+    , m_size(
+            m_key.bounds().width(),
+            m_key.bounds().depth(),
+            m_key.bounds().height())
+    , m_np(np)
 {
-    m_xyz.reserve(m_xyz.size() + table.numPoints() * 3);
-
-    for (const auto& pr : table)
+    if (m_settings.colorType() == ColorType::Tile)
     {
-        m_xyz.push_back(pr.getFieldAs<double>(DimId::X) - m_mid.x);
-        m_xyz.push_back(pr.getFieldAs<double>(DimId::Y) - m_mid.y);
-        m_xyz.push_back(pr.getFieldAs<double>(DimId::Z) - m_mid.z);
+        for (uint8_t& c : m_color) c = std::rand() % 256;
     }
+
+    layout();
 }
 
-void Pnts::buildRgb(VectorPointTable& table)
+uint64_t Pnts::pointSize(const Settings& settings)
 {
-    if (!m_tileset.hasColor()) return;
-    m_rgb.reserve(m_rgb.size() + table.numPoints() * 3);
+    return xyzSize(settings) +
+        (settings.hasColor() ? 3 : 0) +
+        (settings.hasNormals() ? normalSize(settings) : 0);
+}
 
-    auto getByte([this](const pdal::PointRef& pr, DimId id) -> uint8_t
-    {
-        if (!m_tileset.truncate()) return pr.getFieldAs<uint8_t>(id);
-        else return pr.getFieldAs<uint16_t>(id) >> 8;
-    });
+void Pnts::layout()
+{
+    json featureTable;
+    featureTable["POINTS_LENGTH"] = m_np;
+
+    uint64_t byteOffset(0);
+    m_xyzOffset = byteOffset;
 
-    uint8_t r(0), g(0), b(0);
+    if (m_settings.quantize())
+    {
+        featureTable["QUANTIZED_VOLUME_OFFSET"] = m_min;
+        featureTable["QUANTIZED_VOLUME_SCALE"] = m_size;
+        featureTable["POSITION_QUANTIZED"]["byteOffset"] = byteOffset;
+    }
+    else
+    {
+        featureTable["RTC_CENTER"] = m_mid;
+        featureTable["POSITION"]["byteOffset"] = byteOffset;
+    }
+    byteOffset += m_np * xyzSize(m_settings);
 
-    if (m_tileset.colorType() == ColorType::Tile)
+    if (m_settings.hasColor())
     {
-        r = std::rand() % 256;
-        g = std::rand() % 256;
-        b = std::rand() % 256;
+        m_rgbOffset = byteOffset;
+        featureTable["RGB"]["byteOffset"] = byteOffset;
+        byteOffset += m_np * 3;
     }
 
-    assert(m_tileset.colorType() != ColorType::None);
-    for (const auto& pr : table)
+    if (m_settings.hasNormals())
     {
-        if (m_tileset.colorType() == ColorType::Rgb)
+        if (m_settings.quantize())
         {
-            r = getByte(pr, DimId::Red);
-            g = getByte(pr, DimId::Green);
-            b = getByte(pr, DimId::Blue);
+            m_normalOffset = byteOffset;
+            featureTable["NORMAL_OCT16P"]["byteOffset"] = byteOffset;
         }
-        else if (m_tileset.colorType() == ColorType::Intensity)
+        else
         {
-            r = g = b = getByte(pr, DimId::Intensity);
+            // Float components must be aligned to their size.
+            while (byteOffset % sizeof(float)) ++byteOffset;
+            m_normalOffset = byteOffset;
+            featureTable["NORMAL"]["byteOffset"] = byteOffset;
         }
+        byteOffset += m_np * normalSize(m_settings);
+    }
+
+    // Pad the feature table so that the binary body is 8-byte aligned.
+    std::string featureString = featureTable.dump();
+    while ((headerSize + featureString.size()) % 8) featureString += ' ';
+
+    const uint64_t binaryBytes(byteOffset);
+    const uint64_t totalBytes(
+            headerSize + featureString.size() + binaryBytes);
+
+    m_data.assign(totalBytes, 0);
+    uint64_t pos(0);
+
+    const std::string magic("pnts");
+    std::copy(magic.begin(), magic.end(), m_data.begin());
+    pos += magic.size();
 
-        m_rgb.push_back(r);
-        m_rgb.push_back(g);
-        m_rgb.push_back(b);
+    put(m_data, pos, 1);                    // Version.
+    put(m_data, pos, totalBytes);           // ByteLength.
+    put(m_data, pos, featureString.size()); // FeatureTableJsonByteLength.
+    put(m_data, pos, binaryBytes);          // FeatureTableBinaryByteLength.
+    put(m_data, pos, 0);                    // BatchTableJsonByteLength.
+    put(m_data, pos, 0);                    // BatchTableBinaryByteLength.
+    assert(pos == headerSize);
+
+    std::copy(featureString.begin(), featureString.end(), m_data.begin() + pos);
+    pos += featureString.size();
+
+    m_xyzOffset += pos;
+    m_rgbOffset += pos;
+    m_normalOffset += pos;
+}
+
+std::vector<char> Pnts::build(
+        const Metadata& metadata,
+        const arbiter::Endpoint& in,
+        const arbiter::Endpoint& tmp)
+{
+    // Binary data types are unpacked in a single pass, so must be given room
+    // for the entire node, while laszip is streamed in smaller batches.
+    const bool whole(metadata.dataIo().type() != "laszip");
+
+    VectorPointTable table(
+            metadata.schema(),
+            whole ? std::max<uint64_t>(m_np, 1) : 4096);
+    table.setProcess([this, &table]() { encode(table, table.numPoints()); });
+
+    metadata.dataIo().read(
+            in.getSubEndpoint("ept-data"),
+            tmp,
+            metadata.dataName(m_key.get()),
+            table);
+
+    if (m_index != m_np)
+    {
+        throw std::runtime_error(
+                "Invalid point count for " + m_key.toString());
     }
+
+    return std::move(m_data);
 }
 
-void Pnts::buildNormals(VectorPointTable& table)
+std::vector<char> Pnts::build(BlockPointTable& table)
 {
-    if (!m_tileset.hasNormals()) return;
-    m_normals.reserve(m_normals.size() + table.numPoints() * 3);
+    encode(table, table.size());
 
-    for (const auto& pr : table)
+    if (m_index != m_np)
     {
-        m_normals.push_back(pr.getFieldAs<float>(DimId::NormalX));
-        m_normals.push_back(pr.getFieldAs<float>(DimId::NormalY));
-        m_normals.push_back(pr.getFieldAs<float>(DimId::NormalZ));
+        throw std::runtime_error(
+                "Invalid point count for " + m_key.toString());
     }
+
+    return std::move(m_data);
 }
 
-std::vector<char> Pnts::buildFile() const
+template<typename Table>
+void Pnts::encode(Table& table, const uint64_t np)
 {
-    json featureTable;
-    featureTable["POINTS_LENGTH"] = m_np;
-    featureTable["RTC_CENTER"] = m_mid;
+    if (m_index + np > m_np)
+    {
+        throw std::runtime_error(
+                "Invalid point count for " + m_key.toString());
+    }
 
-    uint64_t byteOffset(0);
-    featureTable["POSITION"]["byteOffset"] = byteOffset;
-    byteOffset += m_xyz.size() * sizeof(float);
+    const uint64_t pointXyzSize(xyzSize(m_settings));
+    char* pos(m_data.data() + m_xyzOffset + m_index * pointXyzSize);
 
-    if (m_tileset.hasColor())
+    pdal::PointRef pr(table, 0);
+    const bool direct(directXyz(table));
+
+    for (uint64_t i(0); i < np; ++i)
     {
-        featureTable["RGB"]["byteOffset"] = byteOffset;
-        byteOffset += m_rgb.size();
+        if (direct)
+        {
+            writeXyz(xyz(table, i), pos + i * pointXyzSize);
+        }
+        else
+        {
+            pr.setPointId(i);
+            const Point p(
+                    pr.getFieldAs<double>(DimId::X),
+                    pr.getFieldAs<double>(DimId::Y),
+                    pr.getFieldAs<double>(DimId::Z));
+            writeXyz(p, pos + i * pointXyzSize);
+        }
+    }
+
+    if (m_settings.hasColor())
+    {
+        const ColorType type(m_settings.colorType());
+        assert(type != ColorType::None);
+
+        char* rgb(m_data.data() + m_rgbOffset + m_index * 3);
+        uint8_t c[3] = { m_color[0], m_color[1], m_color[2] };
+
+        for (uint64_t i(0); i < np; ++i)
+        {
+            pr.setPointId(i);
+            if (type == ColorType::Rgb)
+            {
+                c[0] = getByte(pr, DimId::Red);
+                c[1] = getByte(pr, DimId::Green);
+                c[2] = getByte(pr, DimId::Blue);
+            }
+            else if (type == ColorType::Intensity)
+            {
+                c[0] = c[1] = c[2] = getByte(pr, DimId::Intensity);
+            }
+
+            std::memcpy(rgb + i * 3, c, 3);
+        }
     }
 
-    if (m_tileset.hasNormals())
+    if (m_settings.hasNormals())
     {
-        featureTable["NORMAL"]["byteOffset"] = byteOffset;
-        byteOffset += m_normals.size() * sizeof(float);
+        const uint64_t pointNormalSize(normalSize(m_settings));
+        char* normals(
+                m_data.data() + m_normalOffset + m_index * pointNormalSize);
+
+        for (uint64_t i(0); i < np; ++i)
+        {
+            pr.setPointId(i);
+            const float v[3] = {
+                pr.getFieldAs<float>(DimId::NormalX),
+                pr.getFieldAs<float>(DimId::NormalY),
+                pr.getFieldAs<float>(DimId::NormalZ)
+            };
+            writeNormal(v, normals + i * pointNormalSize);
+        }
     }
 
-    std::string featureString = featureTable.dump();
-    while (featureString.size() % 8) featureString += ' ';
+    m_index += np;
+}
 
-    const uint64_t headerSize(28);
-    const uint64_t binaryBytes =
-        m_xyz.size() * sizeof(float) +
-        m_rgb.size() +
-        m_normals.size() * sizeof(float);
-    const uint64_t totalBytes = headerSize + featureString.size() + binaryBytes;
+void Pnts::writeXyz(const Point& p, char* dst) const
+{
+    if (m_settings.quantize())
+    {
+        const uint16_t v[3] = {
+            quantize(p.x, m_min.x, m_size.x),
+            quantize(p.y, m_min.y, m_size.y),
+            quantize(p.z, m_min.z, m_size.z)
+        };
+        std::memcpy(dst, v, sizeof(v));
+    }
+    else
+    {
+        // Positions are relative to the tile center so they fit in floats.
+        const float v[3] = {
+            static_cast<float>(p.x - m_mid.x),
+            static_cast<float>(p.y - m_mid.y),
+            static_cast<float>(p.z - m_mid.z)
+        };
+        std::memcpy(dst, v, sizeof(v));
+    }
+}
 
-    std::vector<char> header;
-    header.reserve(headerSize);
+void Pnts::writeNormal(const float* n, char* dst) const
+{
+    if (!m_settings.quantize())
+    {
+        std::memcpy(dst, n, 3 * sizeof(float));
+        return;
+    }
 
-    auto push([&header](uint32_t v)
+    // Project onto the octahedron, folding the lower hemisphere over the
+    // upper one, then map each coordinate to a byte.
+    const float l1(std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]));
+    float x(l1 > 0 ? n[0] / l1 : 0);
+    float y(l1 > 0 ? n[1] / l1 : 0);
+
+    if (n[2] < 0)
     {
-        header.insert(
-                header.end(),
-                reinterpret_cast<char*>(&v),
-                reinterpret_cast<char*>(&v + 1));
-    });
+        const float fx((1.0f - std::abs(y)) * signNotZero(x));
+        const float fy((1.0f - std::abs(x)) * signNotZero(y));
+        x = fx;
+        y = fy;
+    }
 
-    const std::string magic("pnts");
-    header.insert(header.end(), magic.begin(), magic.end());
-    push(1);                    // Version.
-    push(totalBytes);           // ByteLength.
-    push(featureString.size()); // FeatureTableJsonByteLength.
-    push(binaryBytes);          // FeatureTableBinaryByteLength.
-    push(0);                    // BatchTableJsonByteLength.
-    push(0);                    // BatchTableBinaryByteLength.
-    assert(header.size() == headerSize);
-
-    std::vector<char> pnts;
-    pnts.reserve(totalBytes);
-
-    pnts.insert(pnts.end(), header.begin(), header.end());
-    pnts.insert(pnts.end(), featureString.begin(), featureString.end());
-    pnts.insert(
-            pnts.end(),
-            reinterpret_cast<const char*>(m_xyz.data()),
-            reinterpret_cast<const char*>(m_xyz.data() + m_xyz.size()));
-    pnts.insert(
-            pnts.end(),
-            reinterpret_cast<const char*>(m_rgb.data()),
-            reinterpret_cast<const char*>(m_rgb.data() + m_rgb.size()));
-    pnts.insert(
-            pnts.end(),
-            reinterpret_cast<const char*>(m_normals.data()),
-            reinterpret_cast<const char*>(m_normals.data() + m_normals.size()));
-
-    return pnts;
+    const uint8_t v[2] = { toSnorm(x), toSnorm(y) };
+    std::memcpy(dst, v, sizeof(v));
+}
+
+uint8_t Pnts::getByte(const pdal::PointRef& pr, const DimId id) const
+{
+    if (!m_settings.truncate()) return pr.getFieldAs<uint8_t>(id);
+    else return pr.getFieldAs<uint16_t>(id) >> 8;
 }
 
 } // namespace cesium
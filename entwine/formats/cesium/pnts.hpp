@@ -13,8 +13,10 @@
 #include <cstddef>
 #include <vector>
 
-#include <entwine/formats/cesium/tileset.hpp>
+#include <entwine/formats/cesium/settings.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
 #include <entwine/types/vector-point-table.hpp>
 
 namespace entwine
@@ -24,32 +26,51 @@ namespace cesium
 
 // This class represents a single PNTS file:
 // https://git.io/f477J
+//
+// The layout of the file is fixed by the point count, so the output is
+// allocated once up front and each decoded batch of points is encoded
+// directly into place.
 class Pnts
 {
-    using Xyz = std::vector<float>;
-    using Rgb = std::vector<uint8_t>;
-    using Normals = std::vector<float>;
-
 public:
-    Pnts(const Tileset& tileset, const ChunkKey& ck);
-    std::vector<char> build();
+    Pnts(const Settings& settings, const ChunkKey& ck, uint64_t np);
 
-private:
-    void buildXyz(VectorPointTable& table);
-    void buildRgb(VectorPointTable& table);
-    void buildNormals(VectorPointTable& table);
+    // Encode the node from a completed build.
+    std::vector<char> build(
+            const Metadata& metadata,
+            const arbiter::Endpoint& in,
+            const arbiter::Endpoint& tmp);
+
+    // Encode the points of a node as it is being written during a build.
+    std::vector<char> build(BlockPointTable& table);
 
-    std::vector<char> buildFile() const;
+    // The encoded size of each point in the binary body.
+    static uint64_t pointSize(const Settings& settings);
 
-    const Tileset& m_tileset;
+private:
+    void layout();
+    void writeXyz(const Point& p, char* dst) const;
+    void writeNormal(const float* n, char* dst) const;
+    template<typename Table> void encode(Table& table, uint64_t np);
+    uint8_t getByte(const pdal::PointRef& pr, DimId id) const;
+
+    const Settings& m_settings;
     const ChunkKey m_key;
-    Point m_mid;
+    const Point m_mid;
+    const Point m_min;
+    const Point m_size;
+    const uint64_t m_np;
+
+    std::vector<char> m_data;
+    uint64_t m_xyzOffset = 0;
+    uint64_t m_rgbOffset = 0;
+    uint64_t m_normalOffset = 0;
 
-    Xyz m_xyz;
-    Rgb m_rgb;
-    Normals m_normals;
+    // The number of points encoded so far.
+    uint64_t m_index = 0;
 
-    std::size_t m_np = 0;
+    // Used for ColorType::Tile.
+    uint8_t m_color[3] = { 0, 0, 0 };
 };
 
 } // namespace cesium
@@ -0,0 +1,153 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace cesium
+{
+
+enum class ColorType
+{
+    None,
+    Rgb,
+    Intensity,
+    Tile
+};
+
+// The encoding options for 3D Tiles output, shared by conversion of a
+// completed build and by tiles written during a build.
+class Settings
+{
+public:
+    Settings(const json& config, const Schema& schema)
+        : m_colorType(getColorType(config, schema))
+        , m_truncate(config.value("truncate", false))
+        , m_hasNormals(
+                schema.contains(DimId::NormalX) &&
+                schema.contains(DimId::NormalY) &&
+                schema.contains(DimId::NormalZ))
+        , m_geometricErrorDivisor(
+                config.value("geometricErrorDivisor", 32.0))
+        , m_densityError(config.value("densityError", false))
+        , m_quantize(config.value("quantize", false))
+        , m_glb(getGlb(config))
+        , m_meshopt(config.value("meshopt", true))
+        , m_implicit(config.value("implicit", false))
+        , m_subtreeLevels(
+                config.value("subtreeLevels", heuristics::cesiumSubtreeLevels))
+    {
+        if (!m_subtreeLevels || m_subtreeLevels > 8)
+        {
+            throw std::runtime_error("Invalid cesium subtreeLevels");
+        }
+    }
+
+    bool hasColor() const { return m_colorType != ColorType::None; }
+    bool hasNormals() const { return m_hasNormals; }
+    bool truncate() const { return m_truncate; }
+    ColorType colorType() const { return m_colorType; }
+    double geometricErrorDivisor() const { return m_geometricErrorDivisor; }
+
+    // If set, the geometric error of each tile is scaled by the point spacing
+    // of its node, from its point count, rather than only halved per depth.
+    bool densityError() const { return m_densityError; }
+
+    // If set, positions are written as POSITION_QUANTIZED within each tile's
+    // bounds, and normals as NORMAL_OCT16P.
+    bool quantize() const { return m_quantize; }
+
+    // If set, tiles are binary glTF rather than PNTS, with their attributes
+    // compressed by EXT_meshopt_compression unless meshopt is disabled.
+    bool glb() const { return m_glb; }
+    bool meshopt() const { return m_meshopt; }
+    std::string extension() const { return m_glb ? ".glb" : ".pnts"; }
+
+    // glTF content requires 3D Tiles 1.1, as does implicit tiling.
+    std::string version() const
+    {
+        return m_glb || m_implicit ? "1.1" : "1.0";
+    }
+
+    // If set, the tileset uses 3D Tiles 1.1 implicit octree tiling, with
+    // availability written to binary subtree files of this many levels,
+    // rather than an explicit tree of tileset JSON.
+    bool implicit() const { return m_implicit; }
+    uint64_t subtreeLevels() const { return m_subtreeLevels; }
+
+    std::string colorString() const
+    {
+        switch (m_colorType)
+        {
+            case ColorType::None:       return "none";
+            case ColorType::Rgb:        return "rgb";
+            case ColorType::Intensity:  return "intensity";
+            case ColorType::Tile:       return "tile";
+            default:                    return "unknown";
+        }
+    }
+
+private:
+    static bool getGlb(const json& config)
+    {
+        const auto s(config.value("tileFormat", std::string("pnts")));
+        if (s == "pnts") return false;
+        if (s == "glb") return true;
+        throw std::runtime_error("Invalid cesium tileFormat: " + s);
+    }
+
+    static ColorType getColorType(const json& config, const Schema& schema)
+    {
+        if (config.count("colorType"))
+        {
+            const auto s(config.at("colorType").get<std::string>());
+            if (s == "none")        return ColorType::None;
+            if (s == "rgb")         return ColorType::Rgb;
+            if (s == "intensity")   return ColorType::Intensity;
+            if (s == "tile")        return ColorType::Tile;
+            throw std::runtime_error("Invalid cesium colorType: " + s);
+        }
+        else if (
+                schema.contains(DimId::Red) &&
+                schema.contains(DimId::Green) &&
+                schema.contains(DimId::Blue))
+        {
+            return ColorType::Rgb;
+        }
+        else if (schema.contains(DimId::Intensity))
+        {
+            return ColorType::Intensity;
+        }
+
+        return ColorType::None;
+    }
+
+    const ColorType m_colorType;
+    const bool m_truncate;
+    const bool m_hasNormals;
+    const double m_geometricErrorDivisor;
+    const bool m_densityError;
+    const bool m_quantize;
+    const bool m_glb;
+    const bool m_meshopt;
+    const bool m_implicit;
+    const uint64_t m_subtreeLevels;
+};
+
+} // namespace cesium
+} // namespace entwine
@@ -0,0 +1,173 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/formats/cesium/subtree.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace cesium
+{
+
+namespace
+{
+    const uint64_t headerSize(24);
+
+    // The number of tiles in the levels above this one.
+    uint64_t levelOffset(const uint64_t level)
+    {
+        return ((1ULL << (3 * level)) - 1) / 7;
+    }
+
+    // Tiles within a level are ordered by Morton index, with X in the lowest
+    // bit of each triplet, then Y, then Z.
+    uint64_t morton(const Xyz& p, const uint64_t level)
+    {
+        uint64_t m(0);
+        for (uint64_t b(0); b < level; ++b)
+        {
+            m |= ((p.x >> b) & 1) << (3 * b);
+            m |= ((p.y >> b) & 1) << (3 * b + 1);
+            m |= ((p.z >> b) & 1) << (3 * b + 2);
+        }
+        return m;
+    }
+
+    // The position of a key relative to its ancestor this many levels above.
+    Xyz local(const Dxyz& key, const uint64_t levels)
+    {
+        const uint64_t mask((1ULL << levels) - 1);
+        return Xyz(key.p.x & mask, key.p.y & mask, key.p.z & mask);
+    }
+
+    Dxyz ancestor(const Dxyz& key, const uint64_t levels)
+    {
+        return Dxyz(
+                key.d - levels,
+                key.p.x >> levels,
+                key.p.y >> levels,
+                key.p.z >> levels);
+    }
+
+    // Bitstreams are padded to eight bytes, as is each section of the file.
+    std::vector<char> bitstream(
+            const std::vector<uint64_t>& bits,
+            const uint64_t size)
+    {
+        std::vector<char> data(((size + 7) / 8 + 7) / 8 * 8, 0);
+        for (const uint64_t bit : bits)
+        {
+            data[bit / 8] |= static_cast<char>(1 << (bit % 8));
+        }
+        return data;
+    }
+
+    template<typename T>
+    void put(std::vector<char>& data, uint64_t& pos, const T v)
+    {
+        std::memcpy(data.data() + pos, &v, sizeof(v));
+        pos += sizeof(v);
+    }
+}
+
+void Subtree::Set::add(const Dxyz& key)
+{
+    const uint64_t level(key.d % m_levels);
+
+    Subtree& subtree(m_map[ancestor(key, level)]);
+    subtree.m_tiles.push_back(
+            levelOffset(level) + morton(local(key, level), level));
+
+    // The root of a subtree is also available as a child of its parent.
+    if (!level && key.d)
+    {
+        Subtree& parent(m_map[ancestor(key, m_levels)]);
+        parent.m_children.push_back(morton(local(key, m_levels), m_levels));
+    }
+}
+
+std::vector<char> Subtree::build(const uint64_t levels) const
+{
+    const std::vector<char> tiles(bitstream(m_tiles, levelOffset(levels)));
+    const std::vector<char> children(
+            m_children.empty() ?
+                std::vector<char>() :
+                bitstream(m_children, 1ULL << (3 * levels)));
+
+    json bufferViews(json::array());
+    bufferViews.push_back({
+        { "buffer", 0 },
+        { "byteOffset", 0 },
+        { "byteLength", tiles.size() }
+    });
+
+    const json tileAvailability {
+        { "bitstream", 0 },
+        { "availableCount", m_tiles.size() }
+    };
+
+    json j {
+        { "tileAvailability", tileAvailability },
+        { "contentAvailability", json::array({ tileAvailability }) }
+    };
+
+    if (children.empty())
+    {
+        j["childSubtreeAvailability"] = { { "constant", 0 } };
+    }
+    else
+    {
+        bufferViews.push_back({
+            { "buffer", 0 },
+            { "byteOffset", tiles.size() },
+            { "byteLength", children.size() }
+        });
+        j["childSubtreeAvailability"] = {
+            { "bitstream", 1 },
+            { "availableCount", m_children.size() }
+        };
+    }
+
+    const uint64_t binaryBytes(tiles.size() + children.size());
+    json buffers(json::array());
+    buffers.push_back({ { "byteLength", binaryBytes } });
+    j["buffers"] = buffers;
+    j["bufferViews"] = bufferViews;
+
+    std::string jsonString(j.dump());
+    while (jsonString.size() % 8) jsonString += ' ';
+
+    std::vector<char> data(headerSize + jsonString.size() + binaryBytes, 0);
+    uint64_t pos(0);
+
+    const std::string magic("subt");
+    std::copy(magic.begin(), magic.end(), data.begin());
+    pos += magic.size();
+
+    put<uint32_t>(data, pos, 1);                            // Version.
+    put<uint64_t>(data, pos, jsonString.size());            // JSON length.
+    put<uint64_t>(data, pos, binaryBytes);                  // Binary length.
+
+    std::copy(jsonString.begin(), jsonString.end(), data.begin() + pos);
+    pos += jsonString.size();
+    std::copy(tiles.begin(), tiles.end(), data.begin() + pos);
+    pos += tiles.size();
+    std::copy(children.begin(), children.end(), data.begin() + pos);
+
+    return data;
+}
+
+} // namespace cesium
+} // namespace entwine
@@ -0,0 +1,59 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+namespace cesium
+{
+
+// The availability of the tiles within one subtree of a 3D Tiles 1.1 implicit
+// octree, and of the subtrees beneath it:
+// https://github.com/CesiumGS/3d-tiles/tree/main/specification/ImplicitTiling
+//
+// Every EPT node holds points, so tile and content availability are the same.
+class Subtree
+{
+public:
+    // The subtrees of a tree with this many levels each, keyed by the key of
+    // their roots, built from the keys of every available tile.
+    class Set
+    {
+    public:
+        explicit Set(uint64_t levels) : m_levels(levels) { }
+
+        void add(const Dxyz& key);
+
+        uint64_t levels() const { return m_levels; }
+        const std::map<Dxyz, Subtree>& map() const { return m_map; }
+
+    private:
+        const uint64_t m_levels;
+        std::map<Dxyz, Subtree> m_map;
+    };
+
+    // The subtree file, in the binary .subtree format.
+    std::vector<char> build(uint64_t levels) const;
+
+private:
+    // Bit indices within the tile and child subtree bitstreams.
+    std::vector<uint64_t> m_tiles;
+    std::vector<uint64_t> m_children;
+};
+
+} // namespace cesium
+} // namespace entwine
@@ -23,12 +23,21 @@ class Tile
 {
 public:
     Tile(const Tileset& tileset, const ChunkKey& ck, bool external = false)
+        : Tile(tileset, ck, tileset.geometricErrorAt(ck.depth()), external)
+    { }
+
+    Tile(
+            const Tileset& tileset,
+            const ChunkKey& ck,
+            double geometricError,
+            bool external = false)
         : m_tileset(tileset)
         , m_json {
             { "boundingVolume", { { "box", toBox(ck.bounds()) } } },
-            { "geometricError", m_tileset.geometricErrorAt(ck.depth()) },
+            { "geometricError", geometricError },
             { "content", { { "uri", external ?
-                "tileset-" + ck.toString() + ".json" : ck.toString() + ".pnts"
+                "tileset-" + ck.toString() + ".json" :
+                ck.toString() + tileset.settings().extension()
             } } }
         }
     {
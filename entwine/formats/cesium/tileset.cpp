@@ -8,9 +8,19 @@
 *
 ******************************************************************************/
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <thread>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/formats/cesium/glb.hpp>
 #include <entwine/formats/cesium/pnts.hpp>
+#include <entwine/formats/cesium/subtree.hpp>
 #include <entwine/formats/cesium/tile.hpp>
 #include <entwine/formats/cesium/tileset.hpp>
+#include <entwine/io/hierarchy.hpp>
 
 namespace entwine
 {
@@ -24,87 +34,230 @@ Tileset::Tileset(const json& config)
     , m_tmp(m_arbiter.getEndpoint(
                 config.value("tmp", arbiter::getTempPath())))
     , m_metadata(m_in)
-    , m_colorType(getColorType(config))
-    , m_truncate(config.value("truncate", false))
-    , m_hasNormals(
-            m_metadata.schema().contains(DimId::NormalX) &&
-            m_metadata.schema().contains(DimId::NormalY) &&
-            m_metadata.schema().contains(DimId::NormalZ))
+    , m_settings(config, m_metadata.schema())
     , m_rootGeometricError(
             m_metadata.boundsCubic().width() /
-                config.value("geometricErrorDivisor", 32.0))
+                m_settings.geometricErrorDivisor())
+    , m_maxBytesInFlight(
+            config.value("maxBytesInFlight", heuristics::cesiumBytesInFlight))
     , m_threadPool(std::max<uint64_t>(4, config.value("threads", 4)))
 {
     arbiter::mkdirp(m_out.root());
     arbiter::mkdirp(m_tmp.root());
 }
 
-std::string Tileset::colorString() const
+Tileset::HierarchyTree Tileset::getHierarchyTree(const ChunkKey& root) const
+{
+    HierarchyTree h;
+    const HierarchyPage page(
+            hierarchy::read(
+                m_in.getSubEndpoint("ept-hierarchy"),
+                root.get().toString(),
+                m_metadata.hierarchyType()));
+
+    for (const auto& p : page) h[p.first] = p.second;
+
+    return h;
+}
+
+uint64_t Tileset::tileBytes(const uint64_t np) const
 {
-    switch (m_colorType)
+    // The decoded node plus its encoded tile.
+    const uint64_t encoded(
+            m_settings.glb() ?
+                Glb::pointSize(m_settings) : Pnts::pointSize(m_settings));
+    return np * (m_metadata.schema().pointSize() + encoded);
+}
+
+void Tileset::acquire(const uint64_t bytes) const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this, bytes]()
     {
-        case ColorType::None:       return "none";
-        case ColorType::Rgb:        return "rgb";
-        case ColorType::Intensity:  return "intensity";
-        case ColorType::Tile:       return "tile";
-        default:                    return "unknown";
-    }
+        return !m_bytesInFlight ||
+            m_bytesInFlight + bytes <= m_maxBytesInFlight;
+    });
+    m_bytesInFlight += bytes;
 }
 
-ColorType Tileset::getColorType(const json& config) const
+void Tileset::release(const uint64_t bytes) const
 {
-    if (config.count("colorType"))
     {
-        const auto s(config.at("colorType").get<std::string>());
-        if (s == "none")        return ColorType::None;
-        if (s == "rgb")         return ColorType::Rgb;
-        if (s == "intensity")   return ColorType::Intensity;
-        if (s == "tile")        return ColorType::Tile;
-        throw std::runtime_error("Invalid cesium colorType: " + s);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytesInFlight -= bytes;
     }
-    else if (
-            m_metadata.schema().contains(DimId::Red) &&
-            m_metadata.schema().contains(DimId::Green) &&
-            m_metadata.schema().contains(DimId::Blue))
+    m_cv.notify_all();
+}
+
+void Tileset::build() const
+{
+    if (m_settings.implicit()) buildImplicit(true);
+    else buildPages(true);
+    m_threadPool.await();
+}
+
+void Tileset::buildTileset() const
+{
+    if (m_settings.implicit()) buildImplicit(false);
+    else buildPages(false);
+}
+
+void Tileset::buildImplicit(const bool pnts) const
+{
+    const uint64_t levels(m_settings.subtreeLevels());
+    Subtree::Set subtrees(levels);
+    uint64_t depth(0);
+
+    // Pages are read in turn while their tiles are built on the pool.
+    std::vector<Dxyz> pages{ ChunkKey(m_metadata).dxyz() };
+    while (!pages.empty())
     {
-        return ColorType::Rgb;
+        const ChunkKey root(m_metadata, pages.back());
+        pages.pop_back();
+
+        for (const auto& p : getHierarchyTree(root))
+        {
+            if (p.second < 0) pages.push_back(p.first);
+            else if (p.second > 0)
+            {
+                subtrees.add(p.first);
+                depth = std::max<uint64_t>(depth, p.first.d);
+                if (pnts) writeTile(ChunkKey(m_metadata, p.first), p.second);
+            }
+        }
     }
-    else if (m_metadata.schema().contains(DimId::Intensity))
+
+    arbiter::mkdirp(m_out.getSubEndpoint("subtrees").root());
+    for (const auto& p : subtrees.map())
     {
-        return ColorType::Intensity;
+        const Dxyz key(p.first);
+        const Subtree& subtree(p.second);
+        m_threadPool.add([this, levels, key, &subtree]()
+        {
+            m_out.put(
+                    "subtrees/" + key.toString() + ".subtree",
+                    subtree.build(levels));
+        });
     }
+    m_threadPool.await();
 
-    return ColorType::None;
+    json root(Tile(*this, ChunkKey(m_metadata)));
+    root["content"]["uri"] = "{level}-{x}-{y}-{z}" + m_settings.extension();
+    root["implicitTiling"] = {
+        { "subdivisionScheme", "OCTREE" },
+        { "subtreeLevels", levels },
+        { "availableLevels", depth + 1 },
+        { "subtrees", { { "uri", "subtrees/{level}-{x}-{y}-{z}.subtree" } } }
+    };
+
+    const json j {
+        { "asset", { { "version", "1.1" } } },
+        { "geometricError", m_rootGeometricError },
+        { "root", root }
+    };
+
+    m_out.put("tileset.json", j.dump());
 }
 
-Tileset::HierarchyTree Tileset::getHierarchyTree(const ChunkKey& root) const
+void Tileset::writeTile(const ChunkKey& ck, const uint64_t np) const
 {
-    HierarchyTree h;
-    const std::string file("ept-hierarchy/" + root.get().toString() + ".json");
-    const auto fetched(json::parse(m_in.get(file)));
+    // Each tile is fetched, decoded, and encoded on the pool while we continue
+    // traversing, with the number of tiles in flight bounded by their size.
+    const uint64_t bytes(tileBytes(np));
+    acquire(bytes);
 
-    for (const auto& p : fetched.items())
+    m_threadPool.add([this, ck, np, bytes]()
     {
-        h[Dxyz(p.key())] = p.value().get<int64_t>();
-    }
+        try
+        {
+            const std::string name(
+                    ck.get().toString() + m_settings.extension());
+            if (m_settings.glb())
+            {
+                Glb tile(m_settings, ck, np);
+                m_out.put(name, tile.build(m_metadata, m_in, m_tmp));
+            }
+            else
+            {
+                Pnts tile(m_settings, ck, np);
+                m_out.put(name, tile.build(m_metadata, m_in, m_tmp));
+            }
+        }
+        catch (...)
+        {
+            release(bytes);
+            throw;
+        }
 
-    return h;
+        release(bytes);
+    });
 }
 
-void Tileset::build() const
+void Tileset::buildPages(const bool pnts) const
 {
-    build(ChunkKey(m_metadata));
-    m_threadPool.await();
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Dxyz> pages{ ChunkKey(m_metadata).dxyz() };
+    std::size_t active(0);
+    std::string error;
+
+    const auto work([&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            // We're finished once there are no pages left to build and none
+            // in progress which may add more.
+            cv.wait(lock, [&]()
+            {
+                return !pages.empty() || !active || !error.empty();
+            });
+            if (pages.empty() || !error.empty()) break;
+
+            const ChunkKey ck(m_metadata, pages.back());
+            pages.pop_back();
+            ++active;
+            lock.unlock();
+
+            std::vector<Dxyz> children;
+            std::string err;
+            try { buildPage(ck, pnts, children); }
+            catch (std::exception& e) { err = e.what(); }
+            catch (...) { err = "Unknown error"; }
+
+            lock.lock();
+            pages.insert(pages.end(), children.begin(), children.end());
+            if (error.empty()) error = err;
+            --active;
+            cv.notify_all();
+        }
+
+        cv.notify_all();
+    });
+
+    std::vector<std::thread> threads;
+    for (std::size_t i(0); i < m_threadPool.size(); ++i)
+    {
+        threads.emplace_back(work);
+    }
+    for (std::thread& t : threads) t.join();
+
+    if (!error.empty()) throw std::runtime_error(error);
 }
 
-void Tileset::build(const ChunkKey& ck) const
+void Tileset::buildPage(
+        const ChunkKey& ck,
+        const bool pnts,
+        std::vector<Dxyz>& pages) const
 {
     const HierarchyTree hier(getHierarchyTree(ck));
 
     const json j {
-        { "asset", { { "version", "1.0" } } },
+        { "asset", { { "version", m_settings.version() } } },
         { "geometricError", m_rootGeometricError },
-        { "root", build(ck.depth(), ck, hier) }
+        { "root", build(
+                ck, hier, pnts, pages, geometricErrorAt(ck.depth())) }
     };
 
     if (!ck.depth())
@@ -117,33 +270,55 @@ void Tileset::build(const ChunkKey& ck) const
     }
 }
 
+double Tileset::geometricErrorAt(
+        const ChunkKey& ck,
+        const uint64_t np,
+        const double parentError) const
+{
+    double error(geometricErrorAt(ck.depth()));
+
+    if (m_settings.densityError() && np)
+    {
+        const double span(m_metadata.span());
+        error = std::min(error, error * span / std::sqrt(double(np)));
+    }
+
+    return std::min(error, parentError);
+}
+
 json Tileset::build(
-        uint64_t startDepth,
         const ChunkKey& ck,
-        const HierarchyTree& hier) const
+        const HierarchyTree& hier,
+        const bool pnts,
+        std::vector<Dxyz>& pages,
+        const double parentError) const
 {
     if (!hier.count(ck.get())) return json();
 
     if (hier.at(ck.get()) < 0)
     {
-        // We're at a hierarchy leaf - start a new subtree for this node.
-        build(ck);
+        // We're at a hierarchy leaf - its subtree is built as a page of its
+        // own.
+        pages.push_back(ck.dxyz());
 
         // Write the pointer node to that external tileset.
-        return Tile(*this, ck, true);
+        return Tile(
+                *this,
+                ck,
+                std::min(geometricErrorAt(ck.depth()), parentError),
+                true);
     }
 
-    m_threadPool.add([this, ck]()
-    {
-        Pnts pnts(*this, ck);
-        m_out.put(ck.get().toString() + ".pnts", pnts.build());
-    });
+    const uint64_t np(hier.at(ck.get()));
+    if (pnts) writeTile(ck, np);
 
-    json j(Tile(*this, ck));
+    const double error(geometricErrorAt(ck, np, parentError));
+    json j(Tile(*this, ck, error));
 
     for (std::size_t i(0); i < 8; ++i)
     {
-        const json child(build(startDepth, ck.getStep(toDir(i)), hier));
+        const json child(
+                build(ck.getStep(toDir(i)), hier, pnts, pages, error));
         if (!child.is_null()) j["children"].push_back(child);
     }
 
@@ -10,6 +10,12 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <entwine/formats/cesium/settings.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/types/metadata.hpp>
@@ -21,14 +27,6 @@ namespace entwine
 namespace cesium
 {
 
-enum class ColorType
-{
-    None,
-    Rgb,
-    Intensity,
-    Tile
-};
-
 // This class is the entrypoint of a 3D Tiles tileset definition:
 // https://github.com/AnalyticalGraphicsInc/3d-tiles#tilesetjson
 class Tileset
@@ -40,33 +38,75 @@ public:
 
     void build() const;
 
+    // Write only the tileset JSON, for tiles which have already been written
+    // by a build.
+    void buildTileset() const;
+
     const arbiter::Endpoint& in() const { return m_in; }
     const arbiter::Endpoint& out() const { return m_out; }
     const arbiter::Endpoint& tmp() const { return m_tmp; }
 
     const Metadata& metadata() const { return m_metadata; }
-    bool hasColor() const { return m_colorType != ColorType::None; }
-    bool hasNormals() const { return m_hasNormals; }
-    bool truncate() const { return m_truncate; }
-    ColorType colorType() const { return m_colorType; }
-    std::string colorString() const;
+    const Settings& settings() const { return m_settings; }
+    bool hasColor() const { return m_settings.hasColor(); }
+    bool hasNormals() const { return m_settings.hasNormals(); }
+    bool truncate() const { return m_settings.truncate(); }
+    ColorType colorType() const { return m_settings.colorType(); }
+    std::string colorString() const { return m_settings.colorString(); }
     double rootGeometricError() const { return m_rootGeometricError; }
     double geometricErrorAt(uint64_t depth) const
     {
         return m_rootGeometricError / std::pow(2.0, depth);
     }
 
+    // The geometric error of a node holding np points.  With densityError,
+    // the error at its depth is scaled by the ratio of its point spacing to
+    // that of a node whose span by span grid is full, so densely populated
+    // nodes defer the loading of their children.  The result is never more
+    // than the error at its depth, or than that of its parent.
+    double geometricErrorAt(
+            const ChunkKey& ck,
+            uint64_t np,
+            double parentError) const;
+
     Pool& threadPool() const { return m_threadPool; }
 
 private:
-    void build(const ChunkKey& ck) const;
+    // Each hierarchy page becomes its own tileset JSON, so pages are built
+    // concurrently from a shared list, which is worked depth-first so that
+    // only the keys of unbuilt pages accumulate.  At most one page tree per
+    // thread is held in memory.
+    void buildPages(bool pnts) const;
+
+    // Build the tileset JSON of a single page, appending the roots of the
+    // pages beneath it.
+    void buildPage(
+            const ChunkKey& ck,
+            bool pnts,
+            std::vector<Dxyz>& pages) const;
+
+    // Write the tileset for 3D Tiles 1.1 implicit tiling, with the
+    // availability of every node, from each hierarchy page in turn, written
+    // to subtree files.
+    void buildImplicit(bool pnts) const;
+
+    // Queue the tile of this node to be built on our pool.
+    void writeTile(const ChunkKey& ck, uint64_t np) const;
 
     json build(
-            uint64_t startDepth,
             const ChunkKey& ck,
-            const HierarchyTree& hier) const;
+            const HierarchyTree& hier,
+            bool pnts,
+            std::vector<Dxyz>& pages,
+            double parentError) const;
+
+    // Tiles hold roughly this many bytes while being built, limited in total
+    // to m_maxBytesInFlight.  A single tile may exceed the limit if nothing
+    // else is in flight.
+    uint64_t tileBytes(uint64_t np) const;
+    void acquire(uint64_t bytes) const;
+    void release(uint64_t bytes) const;
 
-    ColorType getColorType(const json& config) const;
     HierarchyTree getHierarchyTree(const ChunkKey& root) const;
 
     arbiter::Arbiter m_arbiter;
@@ -75,12 +115,15 @@ private:
     const arbiter::Endpoint m_tmp;
 
     const Metadata m_metadata;
-    const ColorType m_colorType;
-    const bool m_truncate;
-    const bool m_hasNormals;
+    const Settings m_settings;
     const double m_rootGeometricError;
 
+    const uint64_t m_maxBytesInFlight;
     mutable Pool m_threadPool;
+
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cv;
+    mutable uint64_t m_bytesInFlight = 0;
 };
 
 } // namespace cesium
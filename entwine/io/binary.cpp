@@ -11,16 +11,219 @@
 #include <entwine/io/binary.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
-#include <pdal/PointRef.hpp>
-
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/binary-point-table.hpp>
+#include <entwine/types/metadata.hpp>
 #include <entwine/types/scale-offset.hpp>
-#include <entwine/util/executor.hpp>
+#include <entwine/types/schema.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+template<typename T>
+double readAs(const char* pos)
+{
+    T v;
+    std::memcpy(&v, pos, sizeof(T));
+    return static_cast<double>(v);
+}
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value, T>::type fromDouble(
+        double d)
+{
+    return static_cast<T>(std::llround(d));
+}
+
+template<typename T>
+typename std::enable_if<!std::is_integral<T>::value, T>::type fromDouble(
+        double d)
+{
+    return static_cast<T>(d);
+}
+
+template<typename T>
+void writeAs(double d, char* pos)
+{
+    const T v(fromDouble<T>(d));
+    std::memcpy(pos, &v, sizeof(T));
+}
+
+using Reader = double (*)(const char*);
+using Writer = void (*)(double, char*);
+
+Reader getReader(const DimType type)
+{
+    switch (type)
+    {
+        case DimType::Signed8: return readAs<int8_t>;
+        case DimType::Signed16: return readAs<int16_t>;
+        case DimType::Signed32: return readAs<int32_t>;
+        case DimType::Signed64: return readAs<int64_t>;
+        case DimType::Unsigned8: return readAs<uint8_t>;
+        case DimType::Unsigned16: return readAs<uint16_t>;
+        case DimType::Unsigned32: return readAs<uint32_t>;
+        case DimType::Unsigned64: return readAs<uint64_t>;
+        case DimType::Float: return readAs<float>;
+        case DimType::Double: return readAs<double>;
+        default: throw std::runtime_error("Invalid dimension type");
+    }
+}
+
+Writer getWriter(const DimType type)
+{
+    switch (type)
+    {
+        case DimType::Signed8: return writeAs<int8_t>;
+        case DimType::Signed16: return writeAs<int16_t>;
+        case DimType::Signed32: return writeAs<int32_t>;
+        case DimType::Signed64: return writeAs<int64_t>;
+        case DimType::Unsigned8: return writeAs<uint8_t>;
+        case DimType::Unsigned16: return writeAs<uint16_t>;
+        case DimType::Unsigned32: return writeAs<uint32_t>;
+        case DimType::Unsigned64: return writeAs<uint64_t>;
+        case DimType::Float: return writeAs<float>;
+        case DimType::Double: return writeAs<double>;
+        default: throw std::runtime_error("Invalid dimension type");
+    }
+}
+
+// Interleave the bits of each sub-block coordinate, with X lowest.
+uint64_t morton(uint64_t x, uint64_t y, uint64_t z, uint64_t depth)
+{
+    uint64_t code(0);
+    for (uint64_t i(0); i < depth; ++i)
+    {
+        code |= ((x >> i) & 1) << (3 * i);
+        code |= ((y >> i) & 1) << (3 * i + 1);
+        code |= ((z >> i) & 1) << (3 * i + 2);
+    }
+    return code;
+}
+
+// The sub-block of n along one axis of the given bounds containing v, clamped
+// so that points on or beyond the edges land in the outermost sub-blocks.
+uint64_t cell(const Bounds& b, std::size_t axis, double v, uint64_t n)
+{
+    const double size(b.max()[axis] - b.min()[axis]);
+    if (size <= 0) return 0;
+
+    const double c(std::floor((v - b.min()[axis]) / size * n));
+    if (c <= 0) return 0;
+    return std::min<uint64_t>(static_cast<uint64_t>(c), n - 1);
+}
+
+} // unnamed namespace
+
+Binary::Binary(const Metadata& m)
+    : DataIo(m)
+    , m_packPlan(makePlan(true))
+    , m_unpackPlan(makePlan(false))
+{ }
+
+Binary::Plan Binary::makePlan(
+        const bool packing,
+        const pdal::PointLayout* projected) const
+{
+    // When packing, we go from our in-memory schema (XYZ as doubles, unless
+    // packed) to the output schema.  When unpacking, we go the other way.
+    const Schema& outSchema(m_metadata.outSchema());
+    const Schema& absSchema(m_metadata.schema());
+
+    const auto& srcLayout(
+            (packing ? absSchema : outSchema).pdalLayout());
+    const auto& dstLayout(
+            projected ?
+                *projected :
+                (packing ? outSchema : absSchema).pdalLayout());
+
+    Plan plan;
+    plan.srcPointSize = srcLayout.pointSize();
+    plan.dstPointSize = dstLayout.pointSize();
+    plan.identity = plan.srcPointSize == plan.dstPointSize;
+
+    // Packed XYZ are already in their output form.
+    std::unique_ptr<ScaleOffset> so(
+            absSchema.isScaled() ?
+                std::unique_ptr<ScaleOffset>() :
+                outSchema.scaleOffset());
+    std::unique_ptr<SingleScaleOffset> gpsSo(outSchema.gpsScaleOffset());
+
+    for (const pdal::DimType& dim : dstLayout.dimTypes())
+    {
+        const DimId id(dim.m_id);
+        const DimType srcType(srcLayout.dimType(id));
+
+        const uint64_t src(srcLayout.dimOffset(id));
+        const uint64_t dst(dstLayout.dimOffset(id));
+
+        const bool xyz(id == DimId::X || id == DimId::Y || id == DimId::Z);
+        const bool gps(id == DimId::GpsTime && gpsSo);
+
+        if (src != dst || srcType != dim.m_type || (xyz && so) || gps)
+        {
+            plan.identity = false;
+        }
+
+        if (!xyz && !gps && srcType == dim.m_type)
+        {
+            const uint64_t size(pdal::Dimension::size(dim.m_type));
+
+            // Coalesce with the previous run if both sides are adjacent.
+            if (plan.runs.size())
+            {
+                Run& last(plan.runs.back());
+                if (last.src + last.size == src && last.dst + last.size == dst)
+                {
+                    last.size += size;
+                    continue;
+                }
+            }
+
+            Run run;
+            run.src = src;
+            run.dst = dst;
+            run.size = size;
+            plan.runs.push_back(run);
+            continue;
+        }
+
+        Conversion c;
+        c.src = src;
+        c.dst = dst;
+        c.read = getReader(srcType);
+        c.write = getWriter(dim.m_type);
+
+        if (xyz && so)
+        {
+            const uint64_t i(id == DimId::X ? 0 : id == DimId::Y ? 1 : 2);
+            c.scale = so->scale()[i];
+            c.offset = so->offset()[i];
+            c.transform = true;
+            c.round = packing;
+        }
+        else if (gps)
+        {
+            c.scale = gpsSo->scale();
+            c.offset = gpsSo->offset();
+            c.transform = true;
+        }
+
+        plan.conversions.push_back(c);
+    }
+
+    return plan;
+}
+
 void Binary::write(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
@@ -28,8 +231,18 @@ void Binary::write(
         const Bounds& bounds,
         BlockPointTable& src) const
 {
-    const auto packed(pack(src));
-    ensurePut(out, filename + ".bin", packed);
+    if (!m_metadata.subBlockDepth())
+    {
+        ensurePut(out, filename + ".bin", pack(src));
+        return;
+    }
+
+    std::vector<uint64_t> begins;
+    ensurePut(out, filename + ".bin", packSorted(src, bounds, begins));
+
+    std::vector<char> index(begins.size() * sizeof(uint64_t));
+    std::memcpy(index.data(), begins.data(), index.size());
+    ensurePut(out, filename + ".idx", index);
 }
 
 void Binary::read(
@@ -38,133 +251,250 @@ void Binary::read(
         const std::string& filename,
         VectorPointTable& dst) const
 {
-    auto packed(*ensureGet(out, filename + ".bin"));
-    unpack(dst, std::move(packed));
+    decode(*fetch(out, filename), dst);
 }
 
-std::vector<char> Binary::pack(BlockPointTable& src) const
+std::unique_ptr<std::vector<char>> Binary::fetch(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
 {
-    const uint64_t np(src.size());
+    return ensureGet(out, filename + ".bin");
+}
 
-    const Schema& outSchema(m_metadata.outSchema());
-    VectorPointTable dst(outSchema, np);
-
-    // Handle XYZ separately since we might need to scale/offset them.
-    pdal::DimTypeList dimTypes(outSchema.pdalLayout().dimTypes());
-    dimTypes.erase(std::remove_if(
-                dimTypes.begin(),
-                dimTypes.end(),
-                [](const pdal::DimType& d)
-                {
-                    return d.m_id == DimId::X || d.m_id == DimId::Y ||
-                        d.m_id == DimId::Z;
-                }));
+void Binary::decode(
+        const std::vector<char>& stored,
+        VectorPointTable& dst) const
+{
+    unpack(dst, stored);
+}
 
-    pdal::PointRef srcPr(src, 0);
-    pdal::PointRef dstPr(dst, 0);
+std::unique_ptr<MappedFile> Binary::map(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
+{
+    std::unique_ptr<MappedFile> file;
+    if (!m_unpackPlan.identity || !out.isLocal()) return file;
 
-    Point p;
+    file = MappedFile::create(
+            arbiter::expandTilde(out.prefixedRoot() + filename + ".bin"));
 
-    std::unique_ptr<ScaleOffset> so(outSchema.scaleOffset());
+    if (file && file->size() % m_unpackPlan.srcPointSize)
+    {
+        throw std::runtime_error("Invalid binary data size");
+    }
 
-    double gps(0);
-    std::unique_ptr<SingleScaleOffset> gpsSo(outSchema.gpsScaleOffset());
+    return file;
+}
 
-    for (uint64_t i(0); i < np; ++i)
+bool Binary::readWithin(
+        const arbiter::Endpoint& out,
+        const std::string& filename,
+        const Bounds& bounds,
+        const Bounds& query,
+        std::vector<char>& points) const
+{
+    const uint64_t depth(m_metadata.subBlockDepth());
+    if (!depth) return false;
+
+    const uint64_t n(1ULL << depth);
+    const uint64_t cells(n * n * n);
+
+    const auto index(out.tryGetBinary(filename + ".idx"));
+    if (!index || index->size() != (cells + 1) * sizeof(uint64_t))
     {
-        srcPr.setPointId(i);
-        dstPr.setPointId(i);
-        char* pos(dst.getPoint(i));
+        return false;
+    }
 
-        // Handle XYZ, applying transformation if needed.
-        p.x = srcPr.getFieldAs<double>(DimId::X);
-        p.y = srcPr.getFieldAs<double>(DimId::Y);
-        p.z = srcPr.getFieldAs<double>(DimId::Z);
+    std::vector<uint64_t> begins(cells + 1);
+    std::memcpy(begins.data(), index->data(), index->size());
 
-        if (so) p = Point::scale(p, so->scale(), so->offset()).round();
+    points.clear();
+    if (!query.overlaps(bounds)) return true;
 
-        dstPr.setField(DimId::X, p.x);
-        dstPr.setField(DimId::Y, p.y);
-        dstPr.setField(DimId::Z, p.z);
+    // The range of sub-blocks overlapped by the query along each axis.
+    uint64_t lo[3];
+    uint64_t hi[3];
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        lo[i] = cell(bounds, i, query.min()[i], n);
+        hi[i] = cell(bounds, i, query.max()[i], n);
+    }
 
-        // Handle the rest of the dimensions.
-        for (const pdal::DimType& dim : dimTypes)
+    std::vector<uint64_t> codes;
+    for (uint64_t z(lo[2]); z <= hi[2]; ++z)
+    {
+        for (uint64_t y(lo[1]); y <= hi[1]; ++y)
         {
-            srcPr.getField(
-                    pos + outSchema.pdalLayout().dimOffset(dim.m_id),
-                    dim.m_id,
-                    dim.m_type);
+            for (uint64_t x(lo[0]); x <= hi[0]; ++x)
+            {
+                codes.push_back(morton(x, y, z, depth));
+            }
         }
+    }
+    std::sort(codes.begin(), codes.end());
+
+    // Sub-blocks which are contiguous in the file, including those separated
+    // only by empty ones, are fetched as a single range.
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    uint64_t np(0);
+    for (const uint64_t code : codes)
+    {
+        const uint64_t begin(begins[code]);
+        const uint64_t end(begins[code + 1]);
+        if (begin == end) continue;
+
+        if (runs.empty() || runs.back().second != begin)
+        {
+            runs.emplace_back(begin, begin);
+        }
+
+        runs.back().second = end;
+        np += end - begin;
+    }
 
-        if (gpsSo)
+    if (np > begins.back() * heuristics::partialReadRatio) return false;
+    if (!np) return true;
+
+    const uint64_t pointSize(packedPointSize());
+    std::vector<char> packed;
+    packed.reserve(np * pointSize);
+
+    for (const auto& run : runs)
+    {
+        const auto data(
+                getRange(
+                    out,
+                    filename + ".bin",
+                    run.first * pointSize,
+                    run.second * pointSize));
+
+        if (data.size() != (run.second - run.first) * pointSize)
         {
-            gps = srcPr.getFieldAs<double>(DimId::GpsTime);
-            dstPr.setField(
-                    DimId::GpsTime,
-                    Point::scale(gps, gpsSo->scale(), gpsSo->offset()));
+            throw std::runtime_error("Invalid binary data size");
         }
+
+        packed.insert(packed.end(), data.begin(), data.end());
     }
 
-    return dst.data();
+    VectorPointTable table(m_metadata.schema(), np);
+    unpack(table, std::move(packed));
+    points = std::move(table.data());
+    return true;
 }
 
-void Binary::unpack(VectorPointTable& dst, std::vector<char>&& packed) const
+std::vector<char> Binary::pack(BlockPointTable& src) const
 {
-    VectorPointTable src(m_metadata.outSchema(), std::move(packed));
+    const uint64_t np(src.size());
+    std::vector<char> dst(np * packedPointSize(), 0);
+    pack(src, 0, np, dst.data());
+    return dst;
+}
 
-    const uint64_t np(src.capacity());
-    assert(np == dst.capacity());
+void Binary::pack(
+        BlockPointTable& src,
+        const uint64_t begin,
+        const uint64_t end,
+        char* dst) const
+{
+    const uint64_t pointSize(m_packPlan.dstPointSize);
 
-    // For reading, our destination schema will always be normalized (i.e. XYZ
-    // as doubles).  So we can just copy the full dimension list and then
-    // transform XYZ in place, if necessary.
-    const auto& layout(m_metadata.schema().pdalLayout());
-    pdal::DimTypeList dimTypes(layout.dimTypes());
+    for (uint64_t i(begin); i < end; ++i)
+    {
+        packPoint(src.getPoint(i), dst + (i - begin) * pointSize);
+    }
+}
 
-    pdal::PointRef srcPr(src, 0);
-    pdal::PointRef dstPr(dst, 0);
+std::vector<char> Binary::packSorted(
+        BlockPointTable& src,
+        const Bounds& bounds,
+        std::vector<uint64_t>& begins) const
+{
+    const uint64_t depth(m_metadata.subBlockDepth());
+    const uint64_t n(1ULL << depth);
+    const uint64_t np(src.size());
 
-    Point p;
+    // Count the points of each sub-block, then sort them into place.
+    std::vector<uint64_t> codes(np);
+    begins.assign(n * n * n + 1, 0);
 
-    const Schema& outSchema(m_metadata.outSchema());
-    std::unique_ptr<ScaleOffset> so(outSchema.scaleOffset());
+    pdal::PointRef pr(src, 0);
+    for (uint64_t i(0); i < np; ++i)
+    {
+        pr.setPointId(i);
+        codes[i] = morton(
+                cell(bounds, 0, pr.getFieldAs<double>(DimId::X), n),
+                cell(bounds, 1, pr.getFieldAs<double>(DimId::Y), n),
+                cell(bounds, 2, pr.getFieldAs<double>(DimId::Z), n),
+                depth);
+        ++begins[codes[i] + 1];
+    }
 
-    double gps(0);
-    std::unique_ptr<SingleScaleOffset> gpsSo(outSchema.gpsScaleOffset());
+    for (uint64_t c(1); c < begins.size(); ++c) begins[c] += begins[c - 1];
+
+    std::vector<uint64_t> next(begins.begin(), begins.end() - 1);
+    const uint64_t pointSize(packedPointSize());
+    std::vector<char> dst(np * pointSize, 0);
 
     for (uint64_t i(0); i < np; ++i)
     {
-        srcPr.setPointId(i);
-        dstPr.setPointId(i);
-        char* pos(dst.getPoint(i));
+        packPoint(src.getPoint(i), dst.data() + next[codes[i]]++ * pointSize);
+    }
 
-        for (const pdal::DimType& dim : dimTypes)
-        {
-            srcPr.getField(
-                    pos + layout.dimOffset(dim.m_id),
-                    dim.m_id,
-                    dim.m_type);
-        }
+    return dst;
+}
 
-        if (so)
-        {
-            p.x = dstPr.getFieldAs<double>(DimId::X);
-            p.y = dstPr.getFieldAs<double>(DimId::Y);
-            p.z = dstPr.getFieldAs<double>(DimId::Z);
+void Binary::packPoint(const char* const from, char* const to) const
+{
+    const Plan& plan(m_packPlan);
 
-            p = Point::unscale(p, so->scale(), so->offset());
+    for (const Run& r : plan.runs)
+    {
+        std::memcpy(to + r.dst, from + r.src, r.size);
+    }
+
+    for (const Conversion& c : plan.conversions)
+    {
+        double v(c.read(from + c.src));
+        if (c.transform) v = Point::scale(v, c.scale, c.offset);
+        if (c.round) v = std::round(v);
+        c.write(v, to + c.dst);
+    }
+}
+
+void Binary::unpack(
+        VectorPointTable& dst,
+        const std::vector<char>& packed) const
+{
+    // A destination with fewer dimensions than our absolute schema is a
+    // projection of it, for which only the dimensions it holds are unpacked.
+    const bool project(dst.pointSize() != m_unpackPlan.dstPointSize);
+    const Plan projected(project ? makePlan(false, dst.layout()) : Plan());
+    const Plan& plan(project ? projected : m_unpackPlan);
+    if (packed.size() % plan.srcPointSize)
+    {
+        throw std::runtime_error("Invalid binary data size");
+    }
+
+    const uint64_t np(packed.size() / plan.srcPointSize);
+    assert(np == dst.capacity());
 
-            dstPr.setField(DimId::X, p.x);
-            dstPr.setField(DimId::Y, p.y);
-            dstPr.setField(DimId::Z, p.z);
+    const char* const data(packed.data());
+
+    for (uint64_t i(0); i < np; ++i)
+    {
+        const char* const from(data + i * plan.srcPointSize);
+        char* const to(dst.getPoint(i));
+
+        for (const Run& r : plan.runs)
+        {
+            std::memcpy(to + r.dst, from + r.src, r.size);
         }
 
-        if (gpsSo)
+        for (const Conversion& c : plan.conversions)
         {
-            gps = srcPr.getFieldAs<double>(DimId::GpsTime);
-            dstPr.setField(
-                    DimId::GpsTime,
-                    Point::unscale(gps, gpsSo->scale(), gpsSo->offset()));
+            double v(c.read(from + c.src));
+            if (c.transform) v = Point::unscale(v, c.scale, c.offset);
+            c.write(v, to + c.dst);
         }
     }
 
@@ -172,4 +502,3 @@ void Binary::unpack(VectorPointTable& dst, std::vector<char>&& packed) const
 }
 
 } // namespace entwine
-
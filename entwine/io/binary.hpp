@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include <entwine/io/io.hpp>
 
 #include <entwine/types/binary-point-table.hpp>
@@ -20,9 +23,11 @@ namespace entwine
 class Binary : public DataIo
 {
 public:
-    Binary(const Metadata& m) : DataIo(m) { }
+    Binary(const Metadata& m);
 
     virtual std::string type() const override { return "binary"; }
+    virtual std::string extension() const override { return ".bin"; }
+    virtual bool projects() const override { return true; }
 
     virtual void write(
             const arbiter::Endpoint& out,
@@ -37,9 +42,90 @@ public:
             const std::string& filename,
             VectorPointTable& table) const override;
 
+    virtual bool readWithin(
+            const arbiter::Endpoint& out,
+            const std::string& filename,
+            const Bounds& bounds,
+            const Bounds& query,
+            std::vector<char>& points) const override;
+
+    virtual std::unique_ptr<std::vector<char>> fetch(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override;
+
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const override;
+
+    virtual std::unique_ptr<MappedFile> map(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override;
+
 protected:
     std::vector<char> pack(BlockPointTable& src) const;
-    void unpack(VectorPointTable& dst, std::vector<char>&& buffer) const;
+
+    // Pack the points in the range [begin, end) of the source into dst, which
+    // must have room for (end - begin) * packedPointSize() bytes.
+    void pack(BlockPointTable& src, uint64_t begin, uint64_t end, char* dst)
+        const;
+    uint64_t packedPointSize() const { return m_packPlan.dstPointSize; }
+
+    // Pack the source in the Morton order of its sub-blocks within the given
+    // bounds, setting the first point index of each sub-block, plus a final
+    // entry for the total.
+    std::vector<char> packSorted(
+            BlockPointTable& src,
+            const Bounds& bounds,
+            std::vector<uint64_t>& begins) const;
+
+    void unpack(VectorPointTable& dst, const std::vector<char>& buffer) const;
+
+private:
+    // A contiguous byte range copied verbatim from source to destination.
+    struct Run
+    {
+        uint64_t src = 0;
+        uint64_t dst = 0;
+        uint64_t size = 0;
+    };
+
+    // A single dimension which must be converted, and possibly scaled, on
+    // its way from source to destination.
+    struct Conversion
+    {
+        uint64_t src = 0;
+        uint64_t dst = 0;
+        double (*read)(const char*) = nullptr;
+        void (*write)(double, char*) = nullptr;
+        double scale = 1;
+        double offset = 0;
+        bool transform = false;
+        bool round = false;
+    };
+
+    // The per-point work, between two fixed layouts, resolved from the
+    // schema once rather than dispatched per dimension per point.
+    struct Plan
+    {
+        uint64_t srcPointSize = 0;
+        uint64_t dstPointSize = 0;
+        std::vector<Run> runs;
+        std::vector<Conversion> conversions;
+
+        // True if every dimension is at the same offset with the same type on
+        // both sides, so points may be used without any conversion.
+        bool identity = true;
+    };
+
+    // When unpacking, a projected layout, holding only some of the
+    // dimensions of the absolute schema, may be given as the destination.
+    Plan makePlan(
+            bool packing,
+            const pdal::PointLayout* projected = nullptr) const;
+    void packPoint(const char* from, char* to) const;
+
+    const Plan m_packPlan;
+    const Plan m_unpackPlan;
 };
 
 } // namespace entwine
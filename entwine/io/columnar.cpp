@@ -0,0 +1,490 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/columnar.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <pdal/compression/ZstdCompression.hpp>
+
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    // Every column begins with its codec, followed by its encoded values,
+    // all of which is then compressed.
+    enum class Codec : char
+    {
+        Raw,
+        Delta,
+        Rle
+    };
+
+    using Get = uint64_t (*)(const char*);
+    using Set = void (*)(uint64_t, char*);
+
+    // Integral values are widened to 64 bits, and narrowed again on their way
+    // back, so that deltas may be taken with wrapping unsigned arithmetic.
+    template<typename T>
+    uint64_t getAs(const char* pos)
+    {
+        T v;
+        std::memcpy(&v, pos, sizeof(T));
+        return static_cast<uint64_t>(v);
+    }
+
+    template<typename T>
+    void setAs(uint64_t v, char* pos)
+    {
+        const T t(static_cast<T>(v));
+        std::memcpy(pos, &t, sizeof(T));
+    }
+
+    Get getter(const DimType type)
+    {
+        switch (type)
+        {
+            case DimType::Signed8: return getAs<int8_t>;
+            case DimType::Signed16: return getAs<int16_t>;
+            case DimType::Signed32: return getAs<int32_t>;
+            case DimType::Signed64: return getAs<int64_t>;
+            case DimType::Unsigned8: return getAs<uint8_t>;
+            case DimType::Unsigned16: return getAs<uint16_t>;
+            case DimType::Unsigned32: return getAs<uint32_t>;
+            case DimType::Unsigned64: return getAs<uint64_t>;
+            default: throw std::runtime_error("Invalid delta type");
+        }
+    }
+
+    Set setter(const DimType type)
+    {
+        switch (type)
+        {
+            case DimType::Signed8: return setAs<int8_t>;
+            case DimType::Signed16: return setAs<int16_t>;
+            case DimType::Signed32: return setAs<int32_t>;
+            case DimType::Signed64: return setAs<int64_t>;
+            case DimType::Unsigned8: return setAs<uint8_t>;
+            case DimType::Unsigned16: return setAs<uint16_t>;
+            case DimType::Unsigned32: return setAs<uint32_t>;
+            case DimType::Unsigned64: return setAs<uint64_t>;
+            default: throw std::runtime_error("Invalid delta type");
+        }
+    }
+
+    Codec codecFor(const DimId id, const DimType type)
+    {
+        const bool integral(
+                pdal::Dimension::base(type) !=
+                pdal::Dimension::BaseType::Floating);
+
+        if (integral && (
+                    id == DimId::X || id == DimId::Y || id == DimId::Z ||
+                    id == DimId::GpsTime))
+        {
+            return Codec::Delta;
+        }
+
+        if (id == DimId::Classification) return Codec::Rle;
+        return Codec::Raw;
+    }
+
+    uint64_t zigzag(uint64_t v) { return (v << 1) ^ (0 - (v >> 63)); }
+    uint64_t unzigzag(uint64_t v) { return (v >> 1) ^ (0 - (v & 1)); }
+
+    // Pack the low width bits of each value, least significant first.
+    void packBits(
+            const std::vector<uint64_t>& values,
+            const uint64_t width,
+            std::vector<char>& out)
+    {
+        const std::size_t start(out.size());
+        out.resize(start + (values.size() * width + 7) / 8, 0);
+        uint8_t* dst(reinterpret_cast<uint8_t*>(out.data() + start));
+
+        uint64_t bit(0);
+        for (const uint64_t v : values)
+        {
+            for (uint64_t b(0); b < width; )
+            {
+                const uint64_t shift(bit & 7);
+                const uint64_t n(std::min<uint64_t>(8 - shift, width - b));
+                dst[bit >> 3] |= static_cast<uint8_t>(
+                        ((v >> b) & ((1u << n) - 1)) << shift);
+                b += n;
+                bit += n;
+            }
+        }
+    }
+
+    uint64_t unpackBits(const uint8_t* src, uint64_t& bit, uint64_t width)
+    {
+        uint64_t v(0);
+        for (uint64_t b(0); b < width; )
+        {
+            const uint64_t shift(bit & 7);
+            const uint64_t n(std::min<uint64_t>(8 - shift, width - b));
+            v |= static_cast<uint64_t>((src[bit >> 3] >> shift) &
+                    ((1u << n) - 1)) << b;
+            b += n;
+            bit += n;
+        }
+        return v;
+    }
+
+    std::vector<char> encodeColumn(
+            const char* src,
+            const uint64_t np,
+            const uint64_t stride,
+            const DimId id,
+            const DimType type)
+    {
+        const uint64_t size(pdal::Dimension::size(type));
+        const Codec codec(codecFor(id, type));
+
+        std::vector<char> out(1, static_cast<char>(codec));
+
+        if (codec == Codec::Delta)
+        {
+            const Get get(getter(type));
+
+            std::vector<uint64_t> deltas(np);
+            uint64_t last(0);
+            uint64_t max(0);
+            for (uint64_t i(0); i < np; ++i)
+            {
+                const uint64_t v(get(src + i * stride));
+                deltas[i] = zigzag(v - last);
+                max |= deltas[i];
+                last = v;
+            }
+
+            uint64_t width(0);
+            while (width < 64 && (max >> width)) ++width;
+
+            out.push_back(static_cast<char>(width));
+            packBits(deltas, width, out);
+        }
+        else if (codec == Codec::Rle)
+        {
+            // Runs of a single value, each written as the value followed by
+            // its 32-bit length.
+            uint64_t i(0);
+            while (i < np)
+            {
+                const char* v(src + i * stride);
+                uint32_t n(1);
+                while (
+                        i + n < np &&
+                        n < std::numeric_limits<uint32_t>::max() &&
+                        !std::memcmp(v, src + (i + n) * stride, size))
+                {
+                    ++n;
+                }
+
+                out.insert(out.end(), v, v + size);
+                const char* count(reinterpret_cast<const char*>(&n));
+                out.insert(out.end(), count, count + sizeof(n));
+                i += n;
+            }
+        }
+        else
+        {
+            out.resize(1 + np * size);
+            char* dst(out.data() + 1);
+            for (uint64_t i(0); i < np; ++i)
+            {
+                std::memcpy(dst + i * size, src + i * stride, size);
+            }
+        }
+
+        return out;
+    }
+
+    void decodeColumn(
+            const std::vector<char>& in,
+            const uint64_t np,
+            const uint64_t stride,
+            const DimType type,
+            char* dst)
+    {
+        if (in.empty()) throw std::runtime_error("Invalid columnar data");
+
+        const uint64_t size(pdal::Dimension::size(type));
+        const Codec codec(static_cast<Codec>(in.front()));
+        const char* src(in.data() + 1);
+        const uint64_t bytes(in.size() - 1);
+
+        if (codec == Codec::Delta)
+        {
+            if (!bytes) throw std::runtime_error("Invalid columnar data");
+
+            const Set set(setter(type));
+            const uint64_t width(static_cast<uint8_t>(*src));
+            if (width > 64 || bytes - 1 < (np * width + 7) / 8)
+            {
+                throw std::runtime_error("Invalid columnar data");
+            }
+
+            const uint8_t* packed(reinterpret_cast<const uint8_t*>(src + 1));
+            uint64_t bit(0);
+            uint64_t last(0);
+            for (uint64_t i(0); i < np; ++i)
+            {
+                last += unzigzag(unpackBits(packed, bit, width));
+                set(last, dst + i * stride);
+            }
+        }
+        else if (codec == Codec::Rle)
+        {
+            const uint64_t step(size + sizeof(uint32_t));
+            if (bytes % step) throw std::runtime_error("Invalid columnar data");
+
+            uint64_t i(0);
+            for (const char* pos(src); pos < src + bytes; pos += step)
+            {
+                uint32_t n(0);
+                std::memcpy(&n, pos + size, sizeof(n));
+                if (i + n > np) throw std::runtime_error("Invalid columnar data");
+
+                for (uint64_t j(0); j < n; ++j, ++i)
+                {
+                    std::memcpy(dst + i * stride, pos, size);
+                }
+            }
+
+            if (i != np) throw std::runtime_error("Invalid columnar data");
+        }
+        else if (codec == Codec::Raw)
+        {
+            if (bytes != np * size)
+            {
+                throw std::runtime_error("Invalid columnar data");
+            }
+
+            for (uint64_t i(0); i < np; ++i)
+            {
+                std::memcpy(dst + i * stride, src + i * size, size);
+            }
+        }
+        else throw std::runtime_error("Invalid columnar codec");
+    }
+
+    std::vector<char> compress(const std::vector<char>& data, const int level)
+    {
+        std::vector<char> out;
+        pdal::ZstdCompressor compressor([&out](char* pos, std::size_t size)
+        {
+            out.insert(out.end(), pos, pos + size);
+        }, level);
+
+        compressor.compress(data.data(), data.size());
+        compressor.done();
+        return out;
+    }
+
+    std::vector<char> decompress(const char* data, const std::size_t size)
+    {
+        std::vector<char> out;
+        pdal::ZstdDecompressor dec([&out](char* pos, std::size_t size)
+        {
+            out.insert(out.end(), pos, pos + size);
+        });
+
+        dec.decompress(data, size);
+        return out;
+    }
+}
+
+void Columnar::write(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename,
+        const Bounds& bounds,
+        BlockPointTable& src) const
+{
+    const pdal::PointLayout& layout(m_metadata.outSchema().pdalLayout());
+    const pdal::DimTypeList dims(layout.dimTypes());
+
+    const uint64_t np(src.size());
+    const uint64_t pointSize(packedPointSize());
+    const std::vector<char> points(pack(src));
+    const uint64_t start(headerSize());
+
+    std::vector<uint64_t> header;
+    header.push_back(np);
+
+    std::vector<char> columns;
+    for (const pdal::DimType& dim : dims)
+    {
+        const std::vector<char> column(
+                compress(
+                    encodeColumn(
+                        points.data() + layout.dimOffset(dim.m_id),
+                        np,
+                        pointSize,
+                        dim.m_id,
+                        dim.m_type),
+                    m_metadata.compressionLevel()));
+
+        header.push_back(start + columns.size());
+        columns.insert(columns.end(), column.begin(), column.end());
+        header.push_back(start + columns.size());
+    }
+
+    std::vector<char> data(start);
+    std::memcpy(data.data(), header.data(), data.size());
+    data.insert(data.end(), columns.begin(), columns.end());
+
+    ensurePut(out, filename + ".col", data);
+}
+
+void Columnar::read(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename,
+        VectorPointTable& table) const
+{
+    // Without a projection every column is needed, so fetch the file whole.
+    if (table.pointSize() == m_metadata.schema().pointSize())
+    {
+        decode(*fetch(out, filename), table);
+        return;
+    }
+
+    const std::string path(filename + ".col");
+    const std::vector<char> header(getRange(out, path, 0, headerSize()));
+    if (header.size() != headerSize())
+    {
+        throw std::runtime_error("Invalid columnar header");
+    }
+
+    const Ranges ranges(parseHeader(header, table.capacity()));
+    std::vector<char> points(table.capacity() * packedPointSize(), 0);
+
+    // Needed columns which are adjacent in the file are fetched together.
+    std::size_t i(0);
+    while (i < ranges.size())
+    {
+        if (!needs(table, i)) { ++i; continue; }
+
+        std::size_t end(i + 1);
+        while (end < ranges.size() && needs(table, end)) ++end;
+
+        const uint64_t offset(ranges[i].first);
+        const std::vector<char> data(
+                getRange(out, path, offset, ranges[end - 1].second));
+
+        for ( ; i < end; ++i) decodeColumn(ranges, i, data, offset, points);
+    }
+
+    unpack(table, points);
+}
+
+std::unique_ptr<std::vector<char>> Columnar::fetch(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
+{
+    return ensureGet(out, filename + ".col");
+}
+
+void Columnar::decode(
+        const std::vector<char>& stored,
+        VectorPointTable& table) const
+{
+    const Ranges ranges(parseHeader(stored, table.capacity()));
+    std::vector<char> points(table.capacity() * packedPointSize(), 0);
+
+    for (std::size_t i(0); i < ranges.size(); ++i)
+    {
+        if (needs(table, i)) decodeColumn(ranges, i, stored, 0, points);
+    }
+
+    unpack(table, points);
+}
+
+uint64_t Columnar::headerSize() const
+{
+    const pdal::PointLayout& layout(m_metadata.outSchema().pdalLayout());
+    return (1 + 2 * layout.dimTypes().size()) * sizeof(uint64_t);
+}
+
+Columnar::Ranges Columnar::parseHeader(
+        const std::vector<char>& data,
+        const uint64_t np) const
+{
+    if (data.size() < headerSize())
+    {
+        throw std::runtime_error("Invalid columnar header");
+    }
+
+    std::vector<uint64_t> header(headerSize() / sizeof(uint64_t));
+    std::memcpy(header.data(), data.data(), headerSize());
+
+    if (header.front() != np)
+    {
+        throw std::runtime_error("Invalid columnar data size");
+    }
+
+    Ranges ranges;
+    for (std::size_t i(1); i < header.size(); i += 2)
+    {
+        if (header[i] > header[i + 1])
+        {
+            throw std::runtime_error("Invalid columnar header");
+        }
+        ranges.emplace_back(header[i], header[i + 1]);
+    }
+    return ranges;
+}
+
+bool Columnar::needs(
+        const VectorPointTable& table,
+        const std::size_t column) const
+{
+    const pdal::PointLayout& layout(m_metadata.outSchema().pdalLayout());
+    return table.layout()->dimDetail(layout.dimTypes()[column].m_id);
+}
+
+void Columnar::decodeColumn(
+        const Ranges& ranges,
+        const std::size_t column,
+        const std::vector<char>& data,
+        const uint64_t offset,
+        std::vector<char>& points) const
+{
+    const pdal::PointLayout& layout(m_metadata.outSchema().pdalLayout());
+    const pdal::DimType dim(layout.dimTypes()[column]);
+    const auto& range(ranges[column]);
+
+    if (range.first < offset || range.second - offset > data.size())
+    {
+        throw std::runtime_error("Invalid columnar data size");
+    }
+
+    const uint64_t pointSize(packedPointSize());
+    entwine::decodeColumn(
+            decompress(
+                data.data() + range.first - offset,
+                range.second - range.first),
+            points.size() / pointSize,
+            pointSize,
+            dim.m_type,
+            points.data() + layout.dimOffset(dim.m_id));
+}
+
+} // namespace entwine
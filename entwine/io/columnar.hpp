@@ -0,0 +1,96 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <entwine/io/binary.hpp>
+
+namespace entwine
+{
+
+// Points are stored by dimension rather than by point, each dimension of the
+// output schema as its own zstandard-compressed column.  Scaled XYZ and
+// GpsTime are delta-encoded and bit-packed, and Classification is
+// run-length encoded, before compression.
+//
+// A header of the point count followed by the byte range of each column
+// leads the file, so readers needing only some dimensions may fetch only
+// those columns.
+class Columnar : public Binary
+{
+public:
+    Columnar(const Metadata& m) : Binary(m) { }
+
+    virtual std::string type() const override { return "columnar"; }
+    virtual std::string extension() const override { return ".col"; }
+
+    virtual void write(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            const Bounds& bounds,
+            BlockPointTable& table) const override;
+
+    virtual void read(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            VectorPointTable& table) const override;
+
+    virtual bool readWithin(
+            const arbiter::Endpoint& out,
+            const std::string& filename,
+            const Bounds& bounds,
+            const Bounds& query,
+            std::vector<char>& points) const override
+    {
+        return false;
+    }
+
+    virtual std::unique_ptr<std::vector<char>> fetch(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override;
+
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const override;
+
+    virtual std::unique_ptr<MappedFile> map(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override
+    {
+        return std::unique_ptr<MappedFile>();
+    }
+
+private:
+    // The byte range of each column within the file.
+    using Ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    uint64_t headerSize() const;
+    Ranges parseHeader(const std::vector<char>& data, uint64_t np) const;
+
+    // True if the table holds the dimension of the given column.
+    bool needs(const VectorPointTable& table, std::size_t column) const;
+
+    // Decode a column, found within data whose first byte lies at the given
+    // offset of the file, into its place in points of the output schema.
+    void decodeColumn(
+            const Ranges& ranges,
+            std::size_t column,
+            const std::vector<char>& data,
+            uint64_t offset,
+            std::vector<char>& points) const;
+};
+
+} // namespace entwine
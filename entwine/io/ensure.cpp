@@ -10,19 +10,41 @@
 
 #include <entwine/io/ensure.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <mutex>
+#include <random>
 #include <thread>
 
+#include <entwine/io/uploader.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/throttle.hpp>
+#include <entwine/util/unique.hpp>
+
 namespace
 {
     const std::size_t retries(40);
     std::mutex mutex;
 
+    // Retries back off exponentially up to a cap, with full jitter so that
+    // many threads failing at once - for example on throttling - don't all
+    // retry in lockstep.
+    const double backoffBase(0.25);
+    const double backoffMax(30.0);
+
     void sleep(std::size_t tried, std::string method, std::string path)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(tried));
+        const double ceiling(
+                std::min(backoffMax, backoffBase * std::pow(2.0, tried - 1)));
+
+        thread_local std::mt19937 engine((std::random_device()()));
+        const double seconds(
+                std::uniform_real_distribution<double>(0, ceiling)(engine));
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
 
         std::lock_guard<std::mutex> lock(mutex);
         std::cout <<
@@ -50,17 +72,64 @@ void ensurePut(
         const std::string& path,
         const std::vector<char>& data)
 {
+    if (Uploader::get().enabled(endpoint))
+    {
+        ensurePut(endpoint, path, std::vector<char>(data));
+    }
+    else ensurePutNow(endpoint, path, data);
+}
+
+void ensurePut(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        std::vector<char>&& data)
+{
+    Uploader& uploader(Uploader::get());
+    if (uploader.enabled(endpoint))
+    {
+        Metrics::Timer timer(Metrics::Phase::Upload);
+        uploader.put(endpoint, path, std::move(data));
+    }
+    else ensurePutNow(endpoint, path, data);
+}
+
+void ensurePutNow(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        const std::vector<char>& data)
+{
+    Metrics::Timer timer(Metrics::Phase::Upload);
+
+    // Remote writes share a limit on their concurrency, which shrinks when
+    // the remote throttles us.  A slot is held only for each attempt, not
+    // while sleeping between them.
+    const bool throttled(!endpoint.isLocal());
     bool done(false);
     std::size_t tried(0);
 
     while (!done)
     {
-        try
+        std::string error;
+
         {
-            endpoint.put(path, data);
-            done = true;
+            std::unique_ptr<Throttle::Slot> slot(throttled ?
+                    makeUnique<Throttle::Slot>() :
+                    std::unique_ptr<Throttle::Slot>());
+
+            try
+            {
+                endpoint.put(path, data);
+                Metrics::get().addBytesWritten(data.size());
+                if (slot) slot->succeeded();
+                done = true;
+            }
+            catch (const std::exception& e) { error = e.what(); }
+            catch (...) { error = "Unknown error"; }
+
+            if (slot && !done) slot->failed(error);
         }
-        catch (...)
+
+        if (!done)
         {
             if (++tried < retries)
             {
@@ -76,6 +145,7 @@ std::unique_ptr<std::vector<char>> ensureGet(
         const std::string& path)
 {
     std::unique_ptr<std::vector<char>> data;
+    Uploader::get().wait(endpoint, path);
 
     bool done(false);
     std::size_t tried(0);
@@ -112,6 +182,38 @@ std::string ensureGetString(
     return std::string();
 }
 
+std::vector<char> getRange(
+        const arbiter::Endpoint& ep,
+        const std::string& path,
+        const uint64_t begin,
+        const uint64_t end)
+{
+    if (ep.isHttpDerived())
+    {
+        arbiter::http::Headers h;
+        h["Range"] = "bytes=" + std::to_string(begin) + "-" +
+            std::to_string(end - 1);
+        return ep.getBinary(path, h);
+    }
+
+    if (ep.isLocal())
+    {
+        std::ifstream file(
+                arbiter::expandTilde(ep.prefixedRoot() + path),
+                std::ios::in | std::ios::binary);
+
+        std::vector<char> data(end - begin);
+        file.seekg(begin);
+        file.read(data.data(), data.size());
+        data.resize(file.gcount());
+        return data;
+    }
+
+    const std::vector<char> data(ep.getBinary(path));
+    if (end > data.size()) return std::vector<char>();
+    return std::vector<char>(data.begin() + begin, data.begin() + end);
+}
+
 std::string ensureGet(const arbiter::Arbiter& a, const std::string& path)
 {
     std::unique_ptr<std::string> data;
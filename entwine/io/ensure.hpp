@@ -19,11 +19,26 @@
 namespace entwine
 {
 
+// Write data, retrying on failure.  Writes to remote endpoints are handed off
+// to the Uploader if it is enabled, in which case an error may surface only
+// from a later write or from Uploader::await.
 void ensurePut(
         const arbiter::Endpoint& endpoint,
         const std::string& path,
         const std::vector<char>& data);
 
+// As above, but an asynchronous write may take the data without copying it.
+void ensurePut(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        std::vector<char>&& data);
+
+// Write data synchronously, retrying on failure.
+void ensurePutNow(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        const std::vector<char>& data);
+
 inline void ensurePut(
         const arbiter::Endpoint& endpoint,
         const std::string& path,
@@ -42,5 +57,13 @@ std::string ensureGetString(
 
 std::string ensureGet(const arbiter::Arbiter& a, const std::string& path);
 
+// Read the byte range [begin, end) of a file, fetching only that range where
+// the endpoint allows it.
+std::vector<char> getRange(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        uint64_t begin,
+        uint64_t end);
+
 } // namespace entwine
 
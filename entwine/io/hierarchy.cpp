@@ -0,0 +1,190 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/hierarchy.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <pdal/compression/ZstdCompression.hpp>
+
+#include <entwine/io/ensure.hpp>
+
+namespace entwine
+{
+namespace hierarchy
+{
+
+namespace
+{
+
+const std::size_t recordSize(sizeof(uint32_t) * 4 + sizeof(int64_t));
+
+// Records are encoded little-endian regardless of the host.
+void putLe(char*& pos, const uint64_t v, const std::size_t bytes)
+{
+    for (std::size_t i(0); i < bytes; ++i)
+    {
+        *pos++ = static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+uint64_t getLe(const char*& pos, const std::size_t bytes)
+{
+    uint64_t v(0);
+    for (std::size_t i(0); i < bytes; ++i)
+    {
+        v |= uint64_t(static_cast<uint8_t>(*pos++)) << (8 * i);
+    }
+    return v;
+}
+
+void put32(char*& pos, const uint64_t v)
+{
+    if (v > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Key too deep for binary hierarchy");
+    }
+
+    putLe(pos, v, sizeof(uint32_t));
+}
+
+uint32_t get32(const char*& pos)
+{
+    return getLe(pos, sizeof(uint32_t));
+}
+
+HierarchyPage toPage(const json& j)
+{
+    HierarchyPage page;
+    page.reserve(j.size());
+
+    for (const auto& p : j.items())
+    {
+        page.emplace_back(Dxyz(p.key()), p.value().get<int64_t>());
+    }
+
+    std::sort(
+            page.begin(),
+            page.end(),
+            [](const HierarchyPage::value_type& a,
+                const HierarchyPage::value_type& b)
+            {
+                return a.first < b.first;
+            });
+
+    return page;
+}
+
+} // unnamed namespace
+
+void check(const std::string& type)
+{
+    if (type != "json" && type != "binary")
+    {
+        throw std::runtime_error("Invalid hierarchy type: " + type);
+    }
+}
+
+std::string extension(const std::string& type)
+{
+    check(type);
+    return type == "json" ? ".json" : ".zst";
+}
+
+void write(
+        const arbiter::Endpoint& ep,
+        const std::string& stem,
+        const std::string& type,
+        const json& j,
+        const bool pretty)
+{
+    const std::string path(stem + extension(type));
+
+    if (type == "json")
+    {
+        ensurePut(ep, path, pretty ? j.dump(2) : j.dump());
+        return;
+    }
+
+    const HierarchyPage page(toPage(j));
+    std::vector<char> data(page.size() * recordSize);
+    char* pos(data.data());
+
+    for (const auto& entry : page)
+    {
+        const Dxyz& key(entry.first);
+        put32(pos, key.d);
+        put32(pos, key.p.x);
+        put32(pos, key.p.y);
+        put32(pos, key.p.z);
+
+        putLe(pos, static_cast<uint64_t>(entry.second), sizeof(int64_t));
+    }
+
+    // Keys of sorted records share most of their bytes with their
+    // neighbors, so they compress well.
+    std::vector<char> compressed;
+    pdal::ZstdCompressor compressor([&compressed](char* p, std::size_t size)
+    {
+        compressed.insert(compressed.end(), p, p + size);
+    });
+    compressor.compress(data.data(), data.size());
+    compressor.done();
+
+    ensurePut(ep, path, compressed);
+}
+
+HierarchyPage read(
+        const arbiter::Endpoint& ep,
+        const std::string& stem,
+        const std::string& type)
+{
+    const std::string path(stem + extension(type));
+
+    if (type == "json") return toPage(json::parse(ep.get(path)));
+
+    const std::vector<char> compressed(ep.getBinary(path));
+    std::vector<char> data;
+    pdal::ZstdDecompressor dec([&data](char* p, std::size_t size)
+    {
+        data.insert(data.end(), p, p + size);
+    });
+    dec.decompress(compressed.data(), compressed.size());
+
+    if (data.size() % recordSize)
+    {
+        throw std::runtime_error("Invalid binary hierarchy file: " + path);
+    }
+
+    HierarchyPage page;
+    page.reserve(data.size() / recordSize);
+
+    const char* pos(data.data());
+    const char* const end(pos + data.size());
+
+    while (pos < end)
+    {
+        const uint64_t d(get32(pos));
+        const uint64_t x(get32(pos));
+        const uint64_t y(get32(pos));
+        const uint64_t z(get32(pos));
+
+        const int64_t n(static_cast<int64_t>(getLe(pos, sizeof(int64_t))));
+
+        page.emplace_back(Dxyz(d, x, y, z), n);
+    }
+
+    return page;
+}
+
+} // namespace hierarchy
+} // namespace entwine
@@ -0,0 +1,54 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// The contents of a single hierarchy file: point counts by key, where a count
+// of -1 indicates that the subtree at that key is stored in its own file.
+// Entries are sorted by key.
+using HierarchyPage = std::vector<std::pair<Dxyz, int64_t>>;
+
+// Hierarchy files may be stored as JSON, or as a "binary" type made up of
+// fixed-width little-endian records of 32-bit D, X, Y, and Z followed by a
+// 64-bit count, compressed with Zstandard.
+namespace hierarchy
+{
+
+void check(const std::string& type);
+
+std::string extension(const std::string& type);
+
+void write(
+        const arbiter::Endpoint& ep,
+        const std::string& stem,
+        const std::string& type,
+        const json& page,
+        bool pretty = false);
+
+HierarchyPage read(
+        const arbiter::Endpoint& ep,
+        const std::string& stem,
+        const std::string& type);
+
+} // namespace hierarchy
+
+} // namespace entwine
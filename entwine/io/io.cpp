@@ -13,8 +13,11 @@
 #include <stdexcept>
 
 #include <entwine/io/binary.hpp>
+#include <entwine/io/columnar.hpp>
 #include <entwine/io/laszip.hpp>
+#include <entwine/io/null.hpp>
 #include <entwine/io/zstandard.hpp>
+#include <entwine/io/zstandard-dictionary.hpp>
 
 #include <entwine/util/unique.hpp>
 
@@ -26,8 +29,28 @@ std::unique_ptr<DataIo> DataIo::create(const Metadata& m, std::string type)
     if (type == "laszip") return makeUnique<Laz>(m);
     if (type == "binary") return makeUnique<Binary>(m);
     if (type == "zstandard") return makeUnique<Zstandard>(m);
+    if (type == "columnar") return makeUnique<Columnar>(m);
+    if (type == "zstandard-dictionary")
+    {
+#ifdef ENTWINE_HAVE_ZSTD
+        return makeUnique<ZstandardDictionary>(m);
+#else
+        throw std::runtime_error(
+                "The zstandard-dictionary data type requires Zstd");
+#endif
+    }
+    if (type == "null") return makeUnique<Null>(m);
     throw std::runtime_error("Invalid data IO type: " + type);
 }
 
+std::vector<std::string> DataIo::types()
+{
+    std::vector<std::string> t { "laszip", "binary", "zstandard", "columnar" };
+#ifdef ENTWINE_HAVE_ZSTD
+    t.push_back("zstandard-dictionary");
+#endif
+    return t;
+}
+
 } // namespace entwine
 
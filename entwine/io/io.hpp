@@ -13,10 +13,12 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <entwine/io/ensure.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/mapped-file.hpp>
 
 namespace entwine
 {
@@ -29,8 +31,24 @@ public:
 
     static std::unique_ptr<DataIo> create(const Metadata& m, std::string type);
 
+    // Every type which may store a dataset.
+    static std::vector<std::string> types();
+
     virtual std::string type() const = 0;
 
+    // Load or save any state shared by every chunk of a dataset, stored
+    // alongside its metadata at the root of the output.
+    virtual void load(const arbiter::Endpoint& root) { }
+    virtual void save(const arbiter::Endpoint& root) const { }
+
+    // The extension of each stored chunk, including the leading dot.
+    virtual std::string extension() const = 0;
+
+    // True if read and decode may unpack into a table holding only some of
+    // the dimensions of the absolute schema, in which case the others are
+    // skipped entirely.
+    virtual bool projects() const { return false; }
+
     virtual void write(
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
@@ -46,6 +64,47 @@ public:
             VectorPointTable& table) const
     { }
 
+    // Read only those points of a chunk with the given bounds which may lie
+    // within the query bounds, in the absolute schema.  Returns false if this
+    // chunk may only be read whole, or if the query covers too much of it for
+    // a partial read to be worthwhile.
+    virtual bool readWithin(
+            const arbiter::Endpoint& out,
+            const std::string& filename,
+            const Bounds& bounds,
+            const Bounds& query,
+            std::vector<char>& points) const
+    {
+        return false;
+    }
+
+    // Fetch a chunk's stored bytes without decoding them, so that they may be
+    // retained and decoded later, perhaps more than once.  Returns null if
+    // this data type can't be decoded from memory.
+    virtual std::unique_ptr<std::vector<char>> fetch(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const
+    {
+        return std::unique_ptr<std::vector<char>>();
+    }
+
+    // Decode bytes returned by fetch into the table, which must have room
+    // for the entire chunk.
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const
+    { }
+
+    // Map a chunk from local storage whose stored layout is identical to the
+    // absolute schema, so that it may be used in place without unpacking.
+    // Returns null if this chunk must be read.
+    virtual std::unique_ptr<MappedFile> map(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const
+    {
+        return std::unique_ptr<MappedFile>();
+    }
+
 protected:
     const Metadata& m_metadata;
 };
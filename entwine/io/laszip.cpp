@@ -10,16 +10,1023 @@
 
 #include <entwine/io/laszip.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <istream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
 #include <pdal/filters/SortFilter.hpp>
 #include <pdal/io/BufferReader.hpp>
 #include <pdal/io/LasReader.hpp>
 #include <pdal/io/LasWriter.hpp>
 
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/io/uploader.hpp>
 #include <entwine/util/executor.hpp>
+#include <entwine/util/tmp-space.hpp>
+
+#ifdef ENTWINE_HAVE_LASZIP
+#include <laszip_api.h>
+#endif
 
 namespace entwine
 {
 
+namespace
+{
+    // The LAS point format of our output.  Formats 6 and up always hold
+    // GpsTime, and are compressed in layers which may be decompressed
+    // independently.
+    uint8_t pointFormat(const Metadata& metadata)
+    {
+        const Schema& s(metadata.outSchema());
+        if (metadata.las14())
+        {
+            return s.contains(DimId::Infrared) ? 8 : s.hasColor() ? 7 : 6;
+        }
+        return (s.hasTime() ? 1 : 0) | (s.hasColor() ? 2 : 0);
+    }
+}
+
+#ifdef ENTWINE_HAVE_LASZIP
+namespace
+{
+    void checkLaszip(const laszip_POINTER laszip, const laszip_I32 status)
+    {
+        if (!status) return;
+
+        laszip_CHAR* error(nullptr);
+        laszip_get_error(laszip, &error);
+        throw std::runtime_error(
+                std::string("LASzip: ") + (error ? error : "unknown"));
+    }
+
+    // A seekable input stream buffer over bytes already in memory.
+    class MemoryBuffer : public std::streambuf
+    {
+    public:
+        explicit MemoryBuffer(const std::vector<char>& data)
+        {
+            char* begin(const_cast<char*>(data.data()));
+            setg(begin, begin, begin + data.size());
+        }
+
+    protected:
+        virtual pos_type seekoff(
+                off_type off,
+                std::ios_base::seekdir dir,
+                std::ios_base::openmode which) override
+        {
+            const off_type size(egptr() - eback());
+            const off_type base(
+                    dir == std::ios_base::beg ? 0 :
+                    dir == std::ios_base::cur ? gptr() - eback() : size);
+
+            const off_type target(base + off);
+            if (target < 0 || target > size) return pos_type(off_type(-1));
+
+            setg(eback(), eback() + target, egptr());
+            return pos_type(target);
+        }
+
+        virtual pos_type seekpos(
+                pos_type pos,
+                std::ios_base::openmode which) override
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+    };
+
+    class LaszipReader
+    {
+    public:
+        // Layered formats may decompress only the selected layers, whose
+        // fields are otherwise left unset.
+        explicit LaszipReader(
+                const std::vector<char>& data,
+                laszip_U32 selective = LASZIP_DECOMPRESS_SELECTIVE_ALL)
+            : m_buffer(data)
+            , m_stream(&m_buffer)
+        {
+            laszip_POINTER reader(nullptr);
+            if (laszip_create(&reader) || !reader)
+            {
+                throw std::runtime_error("Could not create LASzip reader");
+            }
+            m_reader.reset(reader);
+
+            check(laszip_decompress_selective(reader, selective));
+
+            laszip_BOOL compressed(0);
+            check(laszip_open_reader_stream(reader, m_stream, &compressed));
+            check(laszip_get_header_pointer(reader, &m_header));
+            check(laszip_get_point_pointer(reader, &m_point));
+        }
+
+        const laszip_header& header() const { return *m_header; }
+        const laszip_point& point() const { return *m_point; }
+
+        uint64_t count() const
+        {
+            return m_header->number_of_point_records ?
+                m_header->number_of_point_records :
+                m_header->extended_number_of_point_records;
+        }
+
+        void next() { check(laszip_read_point(m_reader.get())); }
+
+        // Seeking to the first point of a laszip chunk decodes nothing.
+        void seek(uint64_t index)
+        {
+            check(laszip_seek_point(m_reader.get(), index));
+        }
+
+    private:
+        struct Destroy
+        {
+            void operator()(laszip_POINTER reader) const
+            {
+                laszip_close_reader(reader);
+                laszip_destroy(reader);
+            }
+        };
+
+        void check(laszip_I32 status) const
+        {
+            checkLaszip(m_reader.get(), status);
+        }
+
+        MemoryBuffer m_buffer;
+        std::istream m_stream;
+        std::unique_ptr<void, Destroy> m_reader;
+        laszip_header* m_header = nullptr;
+        laszip_point* m_point = nullptr;
+    };
+
+    // A dimension stored in the extra bytes of each point, as described by
+    // the extra bytes VLR.
+    struct ExtraDim
+    {
+        DimId id = DimId::Unknown;
+        DimType type = DimType::None;
+        uint64_t pos = 0;
+        double scale = 1;
+        double offset = 0;
+        bool transform = false;
+    };
+
+    DimType extraType(const uint8_t t)
+    {
+        switch (t)
+        {
+            case 1: return DimType::Unsigned8;
+            case 2: return DimType::Signed8;
+            case 3: return DimType::Unsigned16;
+            case 4: return DimType::Signed16;
+            case 5: return DimType::Unsigned32;
+            case 6: return DimType::Signed32;
+            case 7: return DimType::Unsigned64;
+            case 8: return DimType::Signed64;
+            case 9: return DimType::Float;
+            case 10: return DimType::Double;
+            default: return DimType::None;
+        }
+    }
+
+    // Those extra dimensions held by the layout, at their offsets within the
+    // extra bytes of each point.
+    std::vector<ExtraDim> extraDims(
+            const laszip_header& header,
+            const laszip_point& point,
+            const pdal::PointLayout& layout)
+    {
+        const uint64_t recordSize(192);
+        std::vector<ExtraDim> dims;
+
+        for (laszip_U32 v(0); v < header.number_of_variable_length_records; ++v)
+        {
+            const laszip_vlr& vlr(header.vlrs[v]);
+            if (
+                    vlr.record_id != 4 ||
+                    std::strncmp(vlr.user_id, "LASF_Spec", 16) ||
+                    !vlr.data)
+            {
+                continue;
+            }
+
+            uint64_t pos(0);
+            const uint64_t records(vlr.record_length_after_header / recordSize);
+            for (uint64_t r(0); r < records; ++r)
+            {
+                const laszip_U8* record(vlr.data + r * recordSize);
+                const uint8_t dataType(record[2]);
+                const uint8_t options(record[3]);
+
+                // Array types, deprecated by LAS 1.4, are skipped over.
+                const uint8_t base(dataType ? (dataType - 1) % 10 + 1 : 0);
+                const uint64_t count(dataType ? (dataType - 1) / 10 + 1 : 1);
+                const DimType type(extraType(base));
+                const uint64_t size(
+                        dataType ?
+                            pdal::Dimension::size(type) * count :
+                            options);
+
+                const char* nameBegin(
+                        reinterpret_cast<const char*>(record + 4));
+                const std::string name(
+                        nameBegin,
+                        std::find(nameBegin, nameBegin + 32, '\0'));
+                const DimId id(layout.findDim(name));
+
+                if (
+                        count == 1 &&
+                        type != DimType::None &&
+                        layout.hasDim(id) &&
+                        pos + size <= uint64_t(point.num_extra_bytes))
+                {
+                    ExtraDim dim;
+                    dim.id = id;
+                    dim.type = type;
+                    dim.pos = pos;
+                    if (options & 0x08)
+                    {
+                        std::memcpy(&dim.scale, record + 112, sizeof(double));
+                        dim.transform = true;
+                    }
+                    if (options & 0x10)
+                    {
+                        std::memcpy(&dim.offset, record + 136, sizeof(double));
+                        dim.transform = true;
+                    }
+                    dims.push_back(dim);
+                }
+
+                pos += size;
+            }
+        }
+
+        return dims;
+    }
+
+    double readExtra(const DimType type, const laszip_U8* pos)
+    {
+        switch (type)
+        {
+            case DimType::Unsigned8: return *pos;
+            case DimType::Signed8: return static_cast<int8_t>(*pos);
+            default: break;
+        }
+
+        union
+        {
+            uint16_t u16; int16_t i16; uint32_t u32; int32_t i32;
+            uint64_t u64; int64_t i64; float f; double d;
+        } v;
+        std::memcpy(&v, pos, pdal::Dimension::size(type));
+
+        switch (type)
+        {
+            case DimType::Unsigned16: return v.u16;
+            case DimType::Signed16: return v.i16;
+            case DimType::Unsigned32: return v.u32;
+            case DimType::Signed32: return v.i32;
+            case DimType::Unsigned64: return v.u64;
+            case DimType::Signed64: return v.i64;
+            case DimType::Float: return v.f;
+            default: return v.d;
+        }
+    }
+
+    // The fields of our point format which the table holds, resolved once
+    // per chunk, decoded into points of the table.  Points at different
+    // indices may be decoded concurrently.
+    class Fields
+    {
+    public:
+        Fields(const LaszipReader& reader, VectorPointTable& table)
+            : m_table(table)
+            , m_header(reader.header())
+            , m_direct(table.directXyz())
+            , m_extended(m_header.point_data_format >= 6)
+        {
+            const pdal::PointLayout& layout(*table.layout());
+            const uint8_t format(m_header.point_data_format);
+
+            m_x = layout.hasDim(DimId::X);
+            m_y = layout.hasDim(DimId::Y);
+            m_z = layout.hasDim(DimId::Z);
+            m_intensity = layout.hasDim(DimId::Intensity);
+            m_returnNumber = layout.hasDim(DimId::ReturnNumber);
+            m_numberOfReturns = layout.hasDim(DimId::NumberOfReturns);
+            m_scanDirection = layout.hasDim(DimId::ScanDirectionFlag);
+            m_edge = layout.hasDim(DimId::EdgeOfFlightLine);
+            m_classification = layout.hasDim(DimId::Classification);
+            m_classFlags = m_extended && layout.hasDim(DimId::ClassFlags);
+            m_scanChannel = m_extended && layout.hasDim(DimId::ScanChannel);
+            m_scanAngle = layout.hasDim(DimId::ScanAngleRank);
+            m_userData = layout.hasDim(DimId::UserData);
+            m_pointSourceId = layout.hasDim(DimId::PointSourceId);
+            m_time =
+                (format == 1 || format == 3 || m_extended) &&
+                layout.hasDim(DimId::GpsTime);
+            m_color =
+                (format == 2 || format == 3 || format == 7 || format == 8) &&
+                layout.hasDim(DimId::Red) &&
+                layout.hasDim(DimId::Green) &&
+                layout.hasDim(DimId::Blue);
+            m_nir = format == 8 && layout.hasDim(DimId::Infrared);
+
+            m_extras = extraDims(m_header, reader.point(), layout);
+        }
+
+        // True if our format is compressed in layers, in which case readers
+        // may be opened to decompress only those layers in selective().
+        bool layered() const { return m_extended; }
+
+        laszip_U32 selective() const
+        {
+            laszip_U32 s(LASZIP_DECOMPRESS_SELECTIVE_CHANNEL_RETURNS_XY);
+            if (m_z) s |= LASZIP_DECOMPRESS_SELECTIVE_Z;
+            if (m_classification)
+            {
+                s |= LASZIP_DECOMPRESS_SELECTIVE_CLASSIFICATION;
+            }
+            if (m_scanDirection || m_edge || m_classFlags)
+            {
+                s |= LASZIP_DECOMPRESS_SELECTIVE_FLAGS;
+            }
+            if (m_intensity) s |= LASZIP_DECOMPRESS_SELECTIVE_INTENSITY;
+            if (m_scanAngle) s |= LASZIP_DECOMPRESS_SELECTIVE_SCAN_ANGLE;
+            if (m_userData) s |= LASZIP_DECOMPRESS_SELECTIVE_USER_DATA;
+            if (m_pointSourceId) s |= LASZIP_DECOMPRESS_SELECTIVE_POINT_SOURCE;
+            if (m_time) s |= LASZIP_DECOMPRESS_SELECTIVE_GPS_TIME;
+            if (m_color) s |= LASZIP_DECOMPRESS_SELECTIVE_RGB;
+            if (m_nir) s |= LASZIP_DECOMPRESS_SELECTIVE_NIR;
+
+            // Each of the first 16 extra bytes is its own layer, and the
+            // rest are selected all together.
+            for (const ExtraDim& dim : m_extras)
+            {
+                const uint64_t end(dim.pos + pdal::Dimension::size(dim.type));
+                for (uint64_t b(dim.pos); b < end; ++b)
+                {
+                    s |= b < 16 ?
+                        LASZIP_DECOMPRESS_SELECTIVE_BYTE0 << b :
+                        LASZIP_DECOMPRESS_SELECTIVE_EXTRA_BYTES;
+                }
+            }
+
+            return s;
+        }
+
+        void decode(const laszip_point& point, const uint64_t index) const
+        {
+            pdal::PointRef pr(m_table, index);
+
+            const double x(
+                    point.X * m_header.x_scale_factor + m_header.x_offset);
+            const double y(
+                    point.Y * m_header.y_scale_factor + m_header.y_offset);
+            const double z(
+                    point.Z * m_header.z_scale_factor + m_header.z_offset);
+
+            if (m_direct && m_x && m_y && m_z)
+            {
+                m_table.setXyz(m_table.getPoint(index), Point(x, y, z));
+            }
+            else
+            {
+                if (m_x) pr.setField(DimId::X, x);
+                if (m_y) pr.setField(DimId::Y, y);
+                if (m_z) pr.setField(DimId::Z, z);
+            }
+
+            if (m_intensity) pr.setField(DimId::Intensity, point.intensity);
+            if (m_returnNumber)
+            {
+                pr.setField<uint8_t>(
+                        DimId::ReturnNumber,
+                        m_extended ?
+                            point.extended_return_number :
+                            point.return_number);
+            }
+            if (m_numberOfReturns)
+            {
+                pr.setField<uint8_t>(
+                        DimId::NumberOfReturns,
+                        m_extended ?
+                            point.extended_number_of_returns :
+                            point.number_of_returns);
+            }
+            if (m_scanDirection)
+            {
+                pr.setField<uint8_t>(
+                        DimId::ScanDirectionFlag,
+                        point.scan_direction_flag);
+            }
+            if (m_edge)
+            {
+                pr.setField<uint8_t>(
+                        DimId::EdgeOfFlightLine,
+                        point.edge_of_flight_line);
+            }
+
+            // As PDAL's LasReader does, the classification flags of the
+            // original formats are kept in the upper bits of the
+            // classification, while those of the extended formats are a
+            // dimension of their own.
+            if (m_classification)
+            {
+                pr.setField<uint8_t>(
+                        DimId::Classification,
+                        m_extended ?
+                            point.extended_classification :
+                            point.classification |
+                            (point.synthetic_flag << 5) |
+                            (point.keypoint_flag << 6) |
+                            (point.withheld_flag << 7));
+            }
+            if (m_classFlags)
+            {
+                pr.setField<uint8_t>(
+                        DimId::ClassFlags,
+                        point.extended_classification_flags);
+            }
+            if (m_scanChannel)
+            {
+                pr.setField<uint8_t>(
+                        DimId::ScanChannel,
+                        point.extended_scanner_channel);
+            }
+
+            // Extended scan angles are in increments of 0.006 degrees.
+            if (m_scanAngle)
+            {
+                pr.setField<float>(
+                        DimId::ScanAngleRank,
+                        m_extended ?
+                            point.extended_scan_angle * 0.006f :
+                            point.scan_angle_rank);
+            }
+            if (m_userData) pr.setField(DimId::UserData, point.user_data);
+            if (m_pointSourceId)
+            {
+                pr.setField(DimId::PointSourceId, point.point_source_ID);
+            }
+            if (m_time) pr.setField(DimId::GpsTime, point.gps_time);
+            if (m_color)
+            {
+                pr.setField(DimId::Red, point.rgb[0]);
+                pr.setField(DimId::Green, point.rgb[1]);
+                pr.setField(DimId::Blue, point.rgb[2]);
+            }
+            if (m_nir) pr.setField(DimId::Infrared, point.rgb[3]);
+
+            for (const ExtraDim& dim : m_extras)
+            {
+                double v(readExtra(dim.type, point.extra_bytes + dim.pos));
+                if (dim.transform) v = v * dim.scale + dim.offset;
+                pr.setField(dim.id, v);
+            }
+        }
+
+    private:
+        VectorPointTable& m_table;
+        const laszip_header& m_header;
+        const bool m_direct;
+        const bool m_extended;
+
+        bool m_x = false;
+        bool m_y = false;
+        bool m_z = false;
+        bool m_intensity = false;
+        bool m_returnNumber = false;
+        bool m_numberOfReturns = false;
+        bool m_scanDirection = false;
+        bool m_edge = false;
+        bool m_classification = false;
+        bool m_classFlags = false;
+        bool m_scanChannel = false;
+        bool m_scanAngle = false;
+        bool m_userData = false;
+        bool m_pointSourceId = false;
+        bool m_time = false;
+        bool m_color = false;
+        bool m_nir = false;
+        std::vector<ExtraDim> m_extras;
+    };
+
+    class LaszipWriter
+    {
+    public:
+        LaszipWriter()
+        {
+            laszip_POINTER writer(nullptr);
+            if (laszip_create(&writer) || !writer)
+            {
+                throw std::runtime_error("Could not create LASzip writer");
+            }
+            m_writer.reset(writer);
+
+            check(laszip_get_header_pointer(writer, &m_header));
+            check(laszip_get_point_pointer(writer, &m_point));
+        }
+
+        laszip_POINTER get() const { return m_writer.get(); }
+        laszip_header& header() { return *m_header; }
+        laszip_point& point() { return *m_point; }
+
+        void check(laszip_I32 status) const
+        {
+            checkLaszip(m_writer.get(), status);
+        }
+
+    private:
+        struct Destroy
+        {
+            void operator()(laszip_POINTER writer) const
+            {
+                laszip_close_writer(writer);
+                laszip_destroy(writer);
+            }
+        };
+
+        std::unique_ptr<void, Destroy> m_writer;
+        laszip_header* m_header = nullptr;
+        laszip_point* m_point = nullptr;
+    };
+
+    // The size of the standard fields of each point format, ahead of any
+    // extra bytes.
+    uint16_t baseRecordLength(const uint8_t format)
+    {
+        switch (format)
+        {
+            case 0: return 20;
+            case 1: return 28;
+            case 2: return 26;
+            case 3: return 34;
+            case 6: return 30;
+            case 7: return 36;
+            case 8: return 38;
+            default: throw std::runtime_error("Invalid LAS point format");
+        }
+    }
+
+    // True if a dimension is held by the standard fields of a point format,
+    // as PDAL's LasWriter sees it.  All others are written as extra bytes.
+    bool isStandard(const DimId id, const uint8_t format)
+    {
+        const bool extended(format >= 6);
+        switch (id)
+        {
+            case DimId::X:
+            case DimId::Y:
+            case DimId::Z:
+            case DimId::Intensity:
+            case DimId::ReturnNumber:
+            case DimId::NumberOfReturns:
+            case DimId::ScanDirectionFlag:
+            case DimId::EdgeOfFlightLine:
+            case DimId::Classification:
+            case DimId::ScanAngleRank:
+            case DimId::UserData:
+            case DimId::PointSourceId:
+                return true;
+            case DimId::ClassFlags:
+            case DimId::ScanChannel:
+                return extended;
+            case DimId::GpsTime:
+                return format == 1 || format == 3 || extended;
+            case DimId::Red:
+            case DimId::Green:
+            case DimId::Blue:
+                return format == 2 || format == 3 || format >= 7;
+            case DimId::Infrared:
+                return format == 8;
+            default:
+                return false;
+        }
+    }
+
+    // The LAS data type of an extra bytes record.
+    uint8_t extraDataType(const DimType type)
+    {
+        switch (type)
+        {
+            case DimType::Unsigned8: return 1;
+            case DimType::Signed8: return 2;
+            case DimType::Unsigned16: return 3;
+            case DimType::Signed16: return 4;
+            case DimType::Unsigned32: return 5;
+            case DimType::Signed32: return 6;
+            case DimType::Unsigned64: return 7;
+            case DimType::Signed64: return 8;
+            case DimType::Float: return 9;
+            case DimType::Double: return 10;
+            default: throw std::runtime_error("Invalid extra dimension type");
+        }
+    }
+
+    template<typename T>
+    void putExtra(const pdal::PointRef& pr, const DimId id, laszip_U8* pos)
+    {
+        const T v(pr.getFieldAs<T>(id));
+        std::memcpy(pos, &v, sizeof(T));
+    }
+
+    void writeExtra(
+            const DimType type,
+            const pdal::PointRef& pr,
+            const DimId id,
+            laszip_U8* pos)
+    {
+        switch (type)
+        {
+            case DimType::Unsigned8: putExtra<uint8_t>(pr, id, pos); break;
+            case DimType::Signed8: putExtra<int8_t>(pr, id, pos); break;
+            case DimType::Unsigned16: putExtra<uint16_t>(pr, id, pos); break;
+            case DimType::Signed16: putExtra<int16_t>(pr, id, pos); break;
+            case DimType::Unsigned32: putExtra<uint32_t>(pr, id, pos); break;
+            case DimType::Signed32: putExtra<int32_t>(pr, id, pos); break;
+            case DimType::Unsigned64: putExtra<uint64_t>(pr, id, pos); break;
+            case DimType::Signed64: putExtra<int64_t>(pr, id, pos); break;
+            case DimType::Float: putExtra<float>(pr, id, pos); break;
+            default: putExtra<double>(pr, id, pos); break;
+        }
+    }
+
+    // The inverse of Fields: the dimensions of our output schema encoded into
+    // the fields of a point format, with those outside of the format written
+    // as extra bytes described by an extra bytes VLR.
+    class Encoder
+    {
+    public:
+        Encoder(const Schema& schema, const uint8_t format)
+            : m_extended(format >= 6)
+        {
+            m_intensity = schema.contains(DimId::Intensity);
+            m_returnNumber = schema.contains(DimId::ReturnNumber);
+            m_numberOfReturns = schema.contains(DimId::NumberOfReturns);
+            m_scanDirection = schema.contains(DimId::ScanDirectionFlag);
+            m_edge = schema.contains(DimId::EdgeOfFlightLine);
+            m_classification = schema.contains(DimId::Classification);
+            m_classFlags = m_extended && schema.contains(DimId::ClassFlags);
+            m_scanChannel = m_extended && schema.contains(DimId::ScanChannel);
+            m_scanAngle = schema.contains(DimId::ScanAngleRank);
+            m_userData = schema.contains(DimId::UserData);
+            m_pointSourceId = schema.contains(DimId::PointSourceId);
+            m_time = isStandard(DimId::GpsTime, format) && schema.hasTime();
+            m_red = isStandard(DimId::Red, format) &&
+                schema.contains(DimId::Red);
+            m_green = isStandard(DimId::Green, format) &&
+                schema.contains(DimId::Green);
+            m_blue = isStandard(DimId::Blue, format) &&
+                schema.contains(DimId::Blue);
+            m_nir = isStandard(DimId::Infrared, format) &&
+                schema.contains(DimId::Infrared);
+
+            for (const DimInfo& dim : schema.dims())
+            {
+                if (isStandard(dim.id(), format)) continue;
+
+                Extra extra;
+                extra.id = dim.id();
+                extra.type = dim.type();
+                extra.pos = m_extraBytes;
+                m_extras.push_back(extra);
+
+                std::vector<laszip_U8> record(192, 0);
+                record[2] = extraDataType(dim.type());
+                const std::string name(dim.name().substr(0, 32));
+                std::copy(name.begin(), name.end(), record.begin() + 4);
+                m_extraRecords.insert(
+                        m_extraRecords.end(),
+                        record.begin(),
+                        record.end());
+
+                m_extraBytes += pdal::Dimension::size(dim.type());
+            }
+        }
+
+        uint64_t extraBytes() const { return m_extraBytes; }
+        const std::vector<laszip_U8>& extraRecords() const
+        {
+            return m_extraRecords;
+        }
+
+        // The return number of a point, counted by the header.
+        uint8_t returnNumber(const pdal::PointRef& pr) const
+        {
+            return m_returnNumber ?
+                pr.getFieldAs<uint8_t>(DimId::ReturnNumber) : 0;
+        }
+
+        void encode(const pdal::PointRef& pr, laszip_point& point) const
+        {
+            if (m_intensity)
+            {
+                point.intensity = pr.getFieldAs<uint16_t>(DimId::Intensity);
+            }
+
+            const uint8_t r(returnNumber(pr));
+            const uint8_t n(
+                    m_numberOfReturns ?
+                        pr.getFieldAs<uint8_t>(DimId::NumberOfReturns) : 0);
+            point.return_number = std::min<uint8_t>(r, 7);
+            point.number_of_returns = std::min<uint8_t>(n, 7);
+            point.extended_return_number = std::min<uint8_t>(r, 15);
+            point.extended_number_of_returns = std::min<uint8_t>(n, 15);
+
+            if (m_scanDirection)
+            {
+                point.scan_direction_flag =
+                    pr.getFieldAs<uint8_t>(DimId::ScanDirectionFlag);
+            }
+            if (m_edge)
+            {
+                point.edge_of_flight_line =
+                    pr.getFieldAs<uint8_t>(DimId::EdgeOfFlightLine);
+            }
+
+            // The classification flags of the original formats are kept in
+            // the upper bits of the classification.  Those of the extended
+            // formats are a dimension of their own, which LASzip requires to
+            // match the legacy flags.
+            const uint8_t c(
+                    m_classification ?
+                        pr.getFieldAs<uint8_t>(DimId::Classification) : 0);
+            uint8_t flags(c >> 5);
+            if (m_extended)
+            {
+                flags = m_classFlags ?
+                    pr.getFieldAs<uint8_t>(DimId::ClassFlags) : 0;
+            }
+
+            point.classification = m_extended ? (c < 32 ? c : 0) : c & 0x1f;
+            point.extended_classification = c;
+            point.synthetic_flag = flags & 1;
+            point.keypoint_flag = (flags >> 1) & 1;
+            point.withheld_flag = (flags >> 2) & 1;
+            point.extended_classification_flags = flags & 0x0f;
+
+            if (m_scanChannel)
+            {
+                point.extended_scanner_channel =
+                    pr.getFieldAs<uint8_t>(DimId::ScanChannel);
+            }
+
+            // Extended scan angles are in increments of 0.006 degrees.
+            if (m_scanAngle)
+            {
+                const double a(pr.getFieldAs<double>(DimId::ScanAngleRank));
+                point.scan_angle_rank = static_cast<laszip_I8>(
+                        std::max(-128.0, std::min(127.0, std::round(a))));
+                point.extended_scan_angle = static_cast<laszip_I16>(
+                        std::round(a / 0.006));
+            }
+            if (m_userData)
+            {
+                point.user_data = pr.getFieldAs<uint8_t>(DimId::UserData);
+            }
+            if (m_pointSourceId)
+            {
+                point.point_source_ID =
+                    pr.getFieldAs<uint16_t>(DimId::PointSourceId);
+            }
+            if (m_time) point.gps_time = pr.getFieldAs<double>(DimId::GpsTime);
+            if (m_red) point.rgb[0] = pr.getFieldAs<uint16_t>(DimId::Red);
+            if (m_green) point.rgb[1] = pr.getFieldAs<uint16_t>(DimId::Green);
+            if (m_blue) point.rgb[2] = pr.getFieldAs<uint16_t>(DimId::Blue);
+            if (m_nir) point.rgb[3] = pr.getFieldAs<uint16_t>(DimId::Infrared);
+
+            for (const Extra& extra : m_extras)
+            {
+                writeExtra(
+                        extra.type,
+                        pr,
+                        extra.id,
+                        point.extra_bytes + extra.pos);
+            }
+        }
+
+    private:
+        struct Extra
+        {
+            DimId id = DimId::Unknown;
+            DimType type = DimType::None;
+            uint64_t pos = 0;
+        };
+
+        const bool m_extended;
+
+        bool m_intensity = false;
+        bool m_returnNumber = false;
+        bool m_numberOfReturns = false;
+        bool m_scanDirection = false;
+        bool m_edge = false;
+        bool m_classification = false;
+        bool m_classFlags = false;
+        bool m_scanChannel = false;
+        bool m_scanAngle = false;
+        bool m_userData = false;
+        bool m_pointSourceId = false;
+        bool m_time = false;
+        bool m_red = false;
+        bool m_green = false;
+        bool m_blue = false;
+        bool m_nir = false;
+
+        std::vector<Extra> m_extras;
+        uint64_t m_extraBytes = 0;
+        std::vector<laszip_U8> m_extraRecords;
+    };
+
+    void setString(laszip_CHAR* dst, const std::string& s, std::size_t size)
+    {
+        std::memset(dst, 0, size);
+        std::copy(s.begin(), s.begin() + std::min(s.size(), size), dst);
+    }
+
+    // Encode the points of a table into a LAZ file in memory.  As with the
+    // PDAL writer, points are written in GpsTime order if they hold time and
+    // have not already been sorted into a configured order.
+    std::vector<char> encode(const Metadata& metadata, BlockPointTable& table)
+    {
+        const Schema& s(metadata.outSchema());
+        const uint8_t format(pointFormat(metadata));
+        const bool las14(metadata.las14());
+        const uint64_t np(table.size());
+        const Encoder encoder(s, format);
+
+        std::vector<uint64_t> order(np);
+        std::iota(order.begin(), order.end(), 0);
+
+        if (s.hasTime() && metadata.pointOrder().empty())
+        {
+            std::vector<double> times(np);
+            for (uint64_t i(0); i < np; ++i)
+            {
+                times[i] = pdal::PointRef(table, i).getFieldAs<double>(
+                        DimId::GpsTime);
+            }
+            std::stable_sort(
+                    order.begin(),
+                    order.end(),
+                    [&times](uint64_t a, uint64_t b)
+                    {
+                        return times[a] < times[b];
+                    });
+        }
+
+        // The header holds the bounds and return counts of the points, so
+        // these are gathered ahead of writing any of them.
+        std::vector<Point> xyz(np);
+        std::vector<uint64_t> returns(15, 0);
+        for (uint64_t i(0); i < np; ++i)
+        {
+            const pdal::PointRef pr(table, i);
+            if (table.directXyz()) xyz[i] = table.xyz(table.getPoint(i));
+            else
+            {
+                xyz[i] = Point(
+                        pr.getFieldAs<double>(DimId::X),
+                        pr.getFieldAs<double>(DimId::Y),
+                        pr.getFieldAs<double>(DimId::Z));
+            }
+
+            const uint8_t r(encoder.returnNumber(pr));
+            if (r >= 1 && r <= 15) ++returns[r - 1];
+        }
+
+        LaszipWriter writer;
+        laszip_header& h(writer.header());
+
+        h.version_major = 1;
+        h.version_minor = las14 ? 4 : 2;
+        if (las14)
+        {
+            h.header_size = 375;
+            h.offset_to_point_data = 375;
+        }
+        setString(h.system_identifier, "Entwine", 32);
+        setString(
+                h.generating_software,
+                "Entwine " + currentEntwineVersion().toString(),
+                32);
+
+        h.point_data_format = format;
+        h.point_data_record_length =
+            baseRecordLength(format) + encoder.extraBytes();
+
+        const Scale scale(s.scale());
+        const Offset offset(s.offset());
+        h.x_scale_factor = scale.x;
+        h.y_scale_factor = scale.y;
+        h.z_scale_factor = scale.z;
+        h.x_offset = offset.x;
+        h.y_offset = offset.y;
+        h.z_offset = offset.z;
+
+        if (np)
+        {
+            Point min(xyz[0]);
+            Point max(xyz[0]);
+            for (const Point& p : xyz)
+            {
+                min = Point::min(min, p);
+                max = Point::max(max, p);
+            }
+            h.min_x = min.x; h.min_y = min.y; h.min_z = min.z;
+            h.max_x = max.x; h.max_y = max.y; h.max_z = max.z;
+        }
+
+        // Points of the extended formats are counted only by the extended
+        // fields of the header.
+        if (format < 6)
+        {
+            h.number_of_point_records = np;
+            for (std::size_t r(0); r < 5; ++r)
+            {
+                h.number_of_points_by_return[r] = returns[r];
+            }
+        }
+        if (las14)
+        {
+            h.extended_number_of_point_records = np;
+            for (std::size_t r(0); r < 15; ++r)
+            {
+                h.extended_number_of_points_by_return[r] = returns[r];
+            }
+        }
+
+        const laszip_POINTER w(writer.get());
+        if (encoder.extraBytes())
+        {
+            const std::vector<laszip_U8>& records(encoder.extraRecords());
+            writer.check(
+                    laszip_add_vlr(
+                        w,
+                        "LASF_Spec",
+                        4,
+                        records.size(),
+                        "Extra Bytes",
+                        records.data()));
+        }
+
+        if (metadata.srs().exists())
+        {
+            const std::string wkt(metadata.srs().wkt());
+            if (wkt.size() < 65535)
+            {
+                writer.check(
+                        laszip_add_vlr(
+                            w,
+                            "LASF_Projection",
+                            2112,
+                            wkt.size() + 1,
+                            "OGC WKT",
+                            reinterpret_cast<const laszip_U8*>(wkt.c_str())));
+
+                // The WKT bit of the global encoding is reserved before 1.4.
+                if (las14) h.global_encoding |= 0x10;
+            }
+        }
+
+        writer.check(laszip_preserve_generating_software(w, 1));
+        writer.check(laszip_set_chunk_size(w, heuristics::lazChunkPoints));
+        if (las14) writer.check(laszip_request_native_extension(w, 1));
+
+        std::ostringstream stream(std::ios::out | std::ios::binary);
+        writer.check(laszip_open_writer_stream(w, stream, 1, 0));
+
+        laszip_point& point(writer.point());
+        if (format >= 6) point.extended_point_type = 1;
+
+        for (const uint64_t i : order)
+        {
+            const Point& p(xyz[i]);
+            point.X = std::llround((p.x - offset.x) / scale.x);
+            point.Y = std::llround((p.y - offset.y) / scale.y);
+            point.Z = std::llround((p.z - offset.z) / scale.z);
+
+            encoder.encode(pdal::PointRef(table, i), point);
+            writer.check(laszip_write_point(w));
+        }
+
+        writer.check(laszip_close_writer(w));
+
+        const std::string data(stream.str());
+        return std::vector<char>(data.begin(), data.end());
+    }
+}
+#endif
+
 void Laz::write(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
@@ -27,6 +1034,11 @@ void Laz::write(
         const Bounds& bounds,
         BlockPointTable& table) const
 {
+#ifdef ENTWINE_HAVE_LASZIP
+    // With LASzip, chunks are compressed in memory and written directly,
+    // whether or not our output is local.
+    ensurePut(out, filename + ".laz", encode(m_metadata, table));
+#else
     const bool local(out.isLocal());
     const std::string localDir(
             local ? out.prefixedRoot() : tmp.prefixedRoot());
@@ -35,40 +1047,27 @@ void Laz::write(
             ".laz");
 
     const Schema& outSchema(m_metadata.outSchema());
+    const bool hasSrs(m_metadata.srs().exists());
 
     pdal::BufferReader reader;
     auto view(std::make_shared<pdal::PointView>(table));
     for (std::size_t i(0); i < table.size(); ++i) view->getOrAddPoint(i);
     reader.addView(view);
 
-    // See https://www.pdal.io/stages/writers.las.html
-    const uint64_t timeMask(outSchema.hasTime() ? 1 : 0);
-    const uint64_t colorMask(outSchema.hasColor() ? 2 : 0);
+    // A local copy of remote output is charged against tmp at its size
+    // before compression, but never waits for room there, since the chunk
+    // cache can't drain while its writes are blocked.
+    const TmpSpace::Charge charge(
+            local ? 0 : table.size() * outSchema.pointSize());
 
-    pdal::Options options;
+    pdal::Options options(writerOptions());
     options.add("filename", localDir + localFile);
-    options.add("minor_version", 2);
-    options.add("extra_dims", "all");
-    options.add("software_id", "Entwine " + currentEntwineVersion().toString());
-    options.add("compression", "laszip");
-    options.add("dataformat_id", timeMask | colorMask);
-
-    options.add("scale_x", outSchema.scale().x);
-    options.add("scale_y", outSchema.scale().y);
-    options.add("scale_z", outSchema.scale().z);
-
-    options.add("offset_x", outSchema.offset().x);
-    options.add("offset_y", outSchema.offset().y);
-    options.add("offset_z", outSchema.offset().z);
-
-    if (m_metadata.srs().exists()) options.add("a_srs", m_metadata.srs().wkt());
-
-    auto lock(Executor::getLock());
 
     pdal::Stage* prev(&reader);
 
+    // If points have already been sorted into a configured order, keep it.
     std::unique_ptr<pdal::SortFilter> sort;
-    if (outSchema.hasTime())
+    if (outSchema.hasTime() && m_metadata.pointOrder().empty())
     {
         sort = makeUnique<pdal::SortFilter>();
 
@@ -83,39 +1082,202 @@ void Laz::write(
     pdal::LasWriter writer;
     writer.setOptions(options);
     writer.setInput(*prev);
-    writer.prepare(table);
 
-    lock.unlock();
+    // These stages are constructed directly rather than through a stage
+    // factory, so the only shared state touched by preparation is the
+    // spatial reference.
+    {
+        std::unique_lock<std::mutex> lock;
+        if (hasSrs) lock = Executor::getSrsLock();
+        writer.prepare(table);
+    }
 
     writer.execute(table);
 
     if (!local)
     {
-        ensurePut(out, filename + ".laz", tmp.getBinary(localFile));
+        // Our local copy is removed as soon as it's read back, ahead of the
+        // upload.
+        std::vector<char> data(tmp.getBinary(localFile));
         arbiter::remove(tmp.prefixedRoot() + localFile);
+        ensurePut(out, filename + ".laz", std::move(data));
     }
+#endif
 }
+
+const pdal::Options& Laz::writerOptions() const
+{
+    std::call_once(m_writerOptionsFlag, [this]()
+    {
+        const Schema& outSchema(m_metadata.outSchema());
+
+        pdal::Options& options(m_writerOptions);
+
+        // See https://www.pdal.io/stages/writers.las.html
+        options.add("minor_version", m_metadata.las14() ? 4 : 2);
+        options.add("dataformat_id", uint64_t(pointFormat(m_metadata)));
+
+        options.add("extra_dims", "all");
+        options.add(
+                "software_id",
+                "Entwine " + currentEntwineVersion().toString());
+        options.add("compression", "laszip");
+
+        options.add("scale_x", outSchema.scale().x);
+        options.add("scale_y", outSchema.scale().y);
+        options.add("scale_z", outSchema.scale().z);
+
+        options.add("offset_x", outSchema.offset().x);
+        options.add("offset_y", outSchema.offset().y);
+        options.add("offset_z", outSchema.offset().z);
+
+        if (m_metadata.srs().exists())
+        {
+            options.add("a_srs", m_metadata.srs().wkt());
+        }
+    });
+
+    return m_writerOptions;
+}
+
 void Laz::read(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
         const std::string& filename,
         VectorPointTable& table) const
 {
+#ifdef ENTWINE_HAVE_LASZIP
+    decode(*fetch(out, filename), table);
+#else
+    Uploader::get().wait(out, filename + ".laz");
     auto handle(out.getLocalHandle(filename + ".laz"));
 
     pdal::Options o;
     o.add("filename", handle->localPath());
     o.add("use_eb_vlr", true);
 
+    // We already know the SRS of our own output, so skip parsing it, which
+    // lets chunk reads prepare without any global lock.
+    o.add("nosrs", true);
+
     pdal::LasReader reader;
     reader.setOptions(o);
+    reader.prepare(table);
 
+    reader.execute(table);
+#endif
+}
+
+bool Laz::projects() const
+{
+#ifdef ENTWINE_HAVE_LASZIP
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<std::vector<char>> Laz::fetch(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
+{
+#ifdef ENTWINE_HAVE_LASZIP
+    Uploader::get().wait(out, filename + ".laz");
+    return ensureGet(out, filename + ".laz");
+#else
+    return std::unique_ptr<std::vector<char>>();
+#endif
+}
+
+void Laz::decode(
+        const std::vector<char>& stored,
+        VectorPointTable& table) const
+{
+#ifdef ENTWINE_HAVE_LASZIP
+    // The header tells us which layers we need, which must be chosen before
+    // the reader is opened, so layered data is opened again to select them.
+    LaszipReader probe(stored);
+    const Fields fields(probe, table);
+    const laszip_U32 selective(fields.selective());
+
+    std::unique_ptr<LaszipReader> layered;
+    if (fields.layered())
     {
-        auto lock(Executor::getLock());
-        reader.prepare(table);
+        layered = makeUnique<LaszipReader>(stored, selective);
     }
+    LaszipReader& reader(layered ? *layered : probe);
+    const uint64_t np(reader.count());
 
-    reader.execute(table);
+    // Large nodes, decoded into a table holding all of their points, are
+    // split at chunk boundaries into runs decoded concurrently, each by its
+    // own reader into its own region of the table.
+    const uint64_t chunks(
+            (np + heuristics::lazChunkPoints - 1) / heuristics::lazChunkPoints);
+    const uint64_t threads(
+            std::min<uint64_t>(
+                std::min<uint64_t>(
+                    chunks,
+                    std::max(std::thread::hardware_concurrency(), 1u)),
+                heuristics::lazDecodeThreads));
+
+    if (threads > 1 && table.capacity() >= np)
+    {
+        const uint64_t chunksPerThread((chunks + threads - 1) / threads);
+        const uint64_t pointsPerThread(
+                chunksPerThread * heuristics::lazChunkPoints);
+
+        std::vector<std::future<void>> runs;
+        for (uint64_t begin(pointsPerThread); begin < np;
+                begin += pointsPerThread)
+        {
+            const uint64_t end(std::min(np, begin + pointsPerThread));
+            runs.push_back(std::async(std::launch::async,
+                        [&stored, &fields, selective, begin, end]()
+            {
+                LaszipReader run(stored, selective);
+                run.seek(begin);
+                for (uint64_t i(begin); i < end; ++i)
+                {
+                    run.next();
+                    fields.decode(run.point(), i);
+                }
+            }));
+        }
+
+        // Our own reader takes the first run.
+        for (uint64_t i(0); i < std::min(np, pointsPerThread); ++i)
+        {
+            reader.next();
+            fields.decode(reader.point(), i);
+        }
+
+        for (auto& run : runs) run.get();
+
+        table.clear(np);
+        return;
+    }
+
+    // Otherwise points are decoded a table at a time, so the table needn't
+    // hold the entire chunk.
+    const uint64_t capacity(table.capacity());
+    uint64_t n(0);
+
+    for (uint64_t i(0); i < np; ++i)
+    {
+        reader.next();
+        fields.decode(reader.point(), n);
+
+        if (++n == capacity)
+        {
+            table.clear(n);
+            n = 0;
+        }
+    }
+
+    if (n) table.clear(n);
+#else
+    throw std::runtime_error("Laszip data may only be decoded with LASzip");
+#endif
 }
 
 } // namespace entwine
@@ -10,6 +10,13 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pdal/Options.hpp>
+
 #include <entwine/io/io.hpp>
 
 namespace entwine
@@ -28,7 +35,15 @@ public:
     }
 
     virtual std::string type() const override { return "laszip"; }
+    virtual std::string extension() const override { return ".laz"; }
+
+    // With LASzip, only those dimensions held by the table are decoded, and
+    // for LAS 1.4 data only their layers are decompressed.
+    virtual bool projects() const override;
 
+    // With LASzip available, chunks are compressed in memory and written
+    // directly.  Otherwise they are written by PDAL's LasWriter by way of a
+    // local file.
     virtual void write(
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
@@ -41,6 +56,26 @@ public:
             const arbiter::Endpoint& tmp,
             const std::string& filename,
             VectorPointTable& table) const override;
+
+    // With LASzip available, chunks are decompressed from memory straight
+    // into the table.  Otherwise fetch returns null, and reads go through
+    // PDAL's LasReader by way of a local file.
+    virtual std::unique_ptr<std::vector<char>> fetch(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override;
+
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const override;
+
+private:
+    // PDAL writer options common to every chunk.  These are resolved on first
+    // write rather than at construction, since the SRS is not yet available
+    // when our Metadata constructs us.
+    const pdal::Options& writerOptions() const;
+
+    mutable std::once_flag m_writerOptionsFlag;
+    mutable pdal::Options m_writerOptions;
 };
 
 } // namespace entwine
@@ -0,0 +1,31 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <entwine/io/io.hpp>
+
+namespace entwine
+{
+
+// Discards whatever is written, and reads back nothing, so that chunk
+// serialization costs only the work of the builder itself.  Reawakened chunks
+// therefore begin empty.  For benchmarking the builder in isolation - not
+// listed among the types which may store a dataset.
+class Null : public DataIo
+{
+public:
+    Null(const Metadata& m) : DataIo(m) { }
+
+    virtual std::string type() const override { return "null"; }
+    virtual std::string extension() const override { return ".null"; }
+};
+
+} // namespace entwine
@@ -0,0 +1,115 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/uploader.hpp>
+
+#include <limits>
+
+#include <entwine/io/ensure.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+Uploader::Uploader() { }
+
+Uploader::~Uploader()
+{
+    // Nothing should be in flight by now, but don't throw during static
+    // destruction if it is.
+    try { configure(0, 0); }
+    catch (...) { }
+}
+
+void Uploader::configure(const uint64_t threads, const uint64_t maxBytes)
+{
+    if (m_pool) m_pool->join();
+    m_pool.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxBytes = maxBytes;
+        m_error.clear();
+    }
+
+    // Our own byte limit bounds the queue, so the pool's never blocks.
+    if (threads)
+    {
+        m_pool.reset(
+                new Pool(
+                    threads,
+                    std::numeric_limits<std::size_t>::max(),
+                    false));
+    }
+}
+
+void Uploader::put(
+        const arbiter::Endpoint& ep,
+        const std::string& path,
+        std::vector<char>&& data)
+{
+    const std::string full(ep.prefixedRoot() + path);
+    const uint64_t bytes(data.size());
+
+    {
+        // Writes to the same path are serialized, so they can't complete out
+        // of order.  At least one write is always allowed in flight.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]()
+        {
+            return !m_error.empty() || (!m_pending.count(full) &&
+                (!m_bytes || m_bytes + bytes <= m_maxBytes));
+        });
+
+        if (!m_error.empty()) throw std::runtime_error(m_error);
+
+        m_pending.insert(full);
+        m_bytes += bytes;
+    }
+
+    auto shared(std::make_shared<std::vector<char>>(std::move(data)));
+    m_pool->add([this, ep, path, full, bytes, shared]()
+    {
+        std::string error;
+        try { ensurePutNow(ep, path, *shared); }
+        catch (const std::exception& e) { error = e.what(); }
+        catch (...) { error = "Unknown error during PUT of " + full; }
+
+        shared->clear();
+        shared->shrink_to_fit();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!error.empty() && m_error.empty()) m_error = error;
+            m_pending.erase(full);
+            m_bytes -= bytes;
+        }
+        m_cv.notify_all();
+    });
+}
+
+void Uploader::wait(const arbiter::Endpoint& ep, const std::string& path)
+{
+    if (!enabled(ep)) return;
+
+    const std::string full(ep.prefixedRoot() + path);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return !m_pending.count(full); });
+}
+
+void Uploader::await()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_pending.empty(); });
+
+    if (!m_error.empty()) throw std::runtime_error(m_error);
+}
+
+} // namespace entwine
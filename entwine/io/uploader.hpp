@@ -0,0 +1,85 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+class Pool;
+
+// A process-wide stage for writes to remote endpoints, so that a thread
+// serializing a chunk hands off its data and returns to work rather than
+// waiting out the transfer and any retries.  Transfers reuse connections from
+// the arbiter's pool of HTTP handles.
+//
+// Data is held until its transfer completes, and hand-offs block while the
+// held data exceeds the configured size.  Writes to local endpoints are
+// always synchronous.
+class Uploader
+{
+public:
+    static Uploader& get()
+    {
+        static Uploader uploader;
+        return uploader;
+    }
+
+    ~Uploader();
+
+    // Use this many threads for remote writes, holding at most this many
+    // bytes in flight, or disable asynchronous writes if threads is zero.
+    // Any writes already in flight are completed first.
+    void configure(uint64_t threads, uint64_t maxBytes);
+
+    bool enabled(const arbiter::Endpoint& ep) const
+    {
+        return m_pool && ep.isRemote();
+    }
+
+    // Queue a write, blocking while we're over our byte limit.  Throws if a
+    // previous write has failed.
+    void put(
+            const arbiter::Endpoint& ep,
+            const std::string& path,
+            std::vector<char>&& data);
+
+    // Block until any write in flight to this path has completed, so it may
+    // be read back.
+    void wait(const arbiter::Endpoint& ep, const std::string& path);
+
+    // Block until all writes in flight have completed, throwing if any of
+    // them failed.
+    void await();
+
+private:
+    Uploader();
+
+    std::unique_ptr<Pool> m_pool;
+    uint64_t m_maxBytes = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    uint64_t m_bytes = 0;
+    std::set<std::string> m_pending;
+    std::string m_error;
+};
+
+} // namespace entwine
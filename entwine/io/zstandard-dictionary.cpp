@@ -0,0 +1,253 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/zstandard-dictionary.hpp>
+
+#ifdef ENTWINE_HAVE_ZSTD
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include <zdict.h>
+#include <zstd.h>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/io/ensure.hpp>
+#include <entwine/types/metadata.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    struct FreeCDict
+    {
+        void operator()(ZSTD_CDict* p) const { ZSTD_freeCDict(p); }
+    };
+
+    struct FreeDDict
+    {
+        void operator()(ZSTD_DDict* p) const { ZSTD_freeDDict(p); }
+    };
+
+    struct FreeCCtx
+    {
+        void operator()(ZSTD_CCtx* p) const { ZSTD_freeCCtx(p); }
+    };
+
+    struct FreeDCtx
+    {
+        void operator()(ZSTD_DCtx* p) const { ZSTD_freeDCtx(p); }
+    };
+
+    void check(const std::size_t result)
+    {
+        if (ZSTD_isError(result))
+        {
+            throw std::runtime_error(
+                    std::string("Zstandard: ") + ZSTD_getErrorName(result));
+        }
+    }
+}
+
+// A trained dictionary, digested once for compression at our level and once
+// for decompression.
+class ZstandardDictionary::Dictionary
+{
+public:
+    Dictionary(std::vector<char> data, const int level)
+        : m_data(std::move(data))
+        , m_id(ZDICT_getDictID(m_data.data(), m_data.size()))
+        , m_c(ZSTD_createCDict(m_data.data(), m_data.size(), level))
+        , m_d(ZSTD_createDDict(m_data.data(), m_data.size()))
+    {
+        if (!m_id || !m_c || !m_d)
+        {
+            throw std::runtime_error("Invalid Zstandard dictionary");
+        }
+    }
+
+    const std::vector<char>& data() const { return m_data; }
+    unsigned id() const { return m_id; }
+    const ZSTD_CDict* compression() const { return m_c.get(); }
+    const ZSTD_DDict* decompression() const { return m_d.get(); }
+
+private:
+    const std::vector<char> m_data;
+    const unsigned m_id;
+    std::unique_ptr<ZSTD_CDict, FreeCDict> m_c;
+    std::unique_ptr<ZSTD_DDict, FreeDDict> m_d;
+};
+
+ZstandardDictionary::ZstandardDictionary(const Metadata& m) : Zstandard(m) { }
+ZstandardDictionary::~ZstandardDictionary() { }
+
+void ZstandardDictionary::load(const arbiter::Endpoint& root)
+{
+    std::unique_ptr<std::vector<char>> data(root.tryGetBinary(filename()));
+    if (!data) return;
+
+    auto dictionary(
+            std::make_shared<const Dictionary>(
+                std::move(*data),
+                m_metadata.compressionLevel()));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dictionary = dictionary;
+    m_sampling = false;
+}
+
+void ZstandardDictionary::save(const arbiter::Endpoint& root) const
+{
+    if (const auto d = dictionary()) ensurePut(root, filename(), d->data());
+}
+
+std::shared_ptr<const ZstandardDictionary::Dictionary>
+ZstandardDictionary::dictionary() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dictionary;
+}
+
+void ZstandardDictionary::write(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename,
+        const Bounds& bounds,
+        BlockPointTable& table) const
+{
+    // The nodes which benefit from a dictionary are small, so unlike our
+    // base class we compress each one whole, as a single frame.
+    const std::shared_ptr<const Dictionary> dict(dictionary());
+    const std::vector<char> packed(pack(table));
+    if (!dict) sample(packed);
+
+    std::vector<char> compressed(ZSTD_compressBound(packed.size()));
+    std::unique_ptr<ZSTD_CCtx, FreeCCtx> ctx(ZSTD_createCCtx());
+    if (!ctx) throw std::runtime_error("Could not create Zstandard context");
+
+    const std::size_t size(
+            dict ?
+                ZSTD_compress_usingCDict(
+                    ctx.get(),
+                    compressed.data(),
+                    compressed.size(),
+                    packed.data(),
+                    packed.size(),
+                    dict->compression()) :
+                ZSTD_compressCCtx(
+                    ctx.get(),
+                    compressed.data(),
+                    compressed.size(),
+                    packed.data(),
+                    packed.size(),
+                    m_metadata.compressionLevel()));
+    check(size);
+
+    compressed.resize(size);
+    ensurePut(out, filename + ".zst", std::move(compressed));
+}
+
+void ZstandardDictionary::decode(
+        const std::vector<char>& stored,
+        VectorPointTable& table) const
+{
+    // Frames written before our dictionary was trained carry no dictionary
+    // ID, and are plain Zstandard.
+    const unsigned id(ZSTD_getDictID_fromFrame(stored.data(), stored.size()));
+    if (!id)
+    {
+        Zstandard::decode(stored, table);
+        return;
+    }
+
+    const std::shared_ptr<const Dictionary> dict(dictionary());
+    if (!dict || dict->id() != id)
+    {
+        throw std::runtime_error("Missing Zstandard dictionary");
+    }
+
+    std::vector<char> uncompressed(
+            table.capacity() * m_metadata.outSchema().pointSize());
+    std::unique_ptr<ZSTD_DCtx, FreeDCtx> ctx(ZSTD_createDCtx());
+    if (!ctx) throw std::runtime_error("Could not create Zstandard context");
+
+    const std::size_t size(
+            ZSTD_decompress_usingDDict(
+                ctx.get(),
+                uncompressed.data(),
+                uncompressed.size(),
+                stored.data(),
+                stored.size(),
+                dict->decompression()));
+    check(size);
+
+    if (size != uncompressed.size())
+    {
+        throw std::runtime_error("Invalid zstandard data size");
+    }
+
+    unpack(table, uncompressed);
+}
+
+void ZstandardDictionary::sample(const std::vector<char>& packed) const
+{
+    std::vector<char> samples;
+    std::vector<std::size_t> sizes;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_sampling) return;
+
+        const std::size_t size(
+                std::min(
+                    packed.size(),
+                    heuristics::dictionarySampleChunkBytes));
+        m_samples.insert(
+                m_samples.end(),
+                packed.begin(),
+                packed.begin() + size);
+        m_sampleSizes.push_back(size);
+
+        if (m_samples.size() < heuristics::dictionarySampleBytes) return;
+
+        // Training takes a while, so it happens outside of our lock, while
+        // other writes carry on without a dictionary.
+        m_sampling = false;
+        samples.swap(m_samples);
+        sizes.swap(m_sampleSizes);
+    }
+
+    std::vector<char> data(heuristics::dictionaryBytes);
+    const std::size_t result(
+            ZDICT_trainFromBuffer(
+                data.data(),
+                data.size(),
+                samples.data(),
+                sizes.data(),
+                sizes.size()));
+
+    // Samples too uniform to train on are left to plain compression.
+    if (ZDICT_isError(result)) return;
+    data.resize(result);
+
+    auto dictionary(
+            std::make_shared<const Dictionary>(
+                std::move(data),
+                m_metadata.compressionLevel()));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dictionary = dictionary;
+}
+
+} // namespace entwine
+
+#endif
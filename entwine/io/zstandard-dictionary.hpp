@@ -0,0 +1,71 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/io/zstandard.hpp>
+
+namespace entwine
+{
+
+// Zstandard chunks compressed with a dictionary trained on samples of the
+// first chunks written, which suits datasets of many small nodes.  Until the
+// dictionary is trained, chunks are written as plain Zstandard frames, which
+// remain readable alongside those using the dictionary.  The dictionary is
+// stored beside ept.json, and is required to read the data.
+class ZstandardDictionary : public Zstandard
+{
+public:
+    ZstandardDictionary(const Metadata& m);
+    ~ZstandardDictionary();
+
+    virtual std::string type() const override
+    {
+        return "zstandard-dictionary";
+    }
+
+    virtual void load(const arbiter::Endpoint& root) override;
+    virtual void save(const arbiter::Endpoint& root) const override;
+
+    virtual void write(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            const Bounds& bounds,
+            BlockPointTable& table) const override;
+
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const override;
+
+    static std::string filename() { return "ept-dictionary.zdict"; }
+
+private:
+    class Dictionary;
+
+    std::shared_ptr<const Dictionary> dictionary() const;
+
+    // Add the packed points of a chunk to our samples, training the
+    // dictionary once there are enough of them.
+    void sample(const std::vector<char>& packed) const;
+
+    mutable std::mutex m_mutex;
+    mutable std::shared_ptr<const Dictionary> m_dictionary;
+    mutable std::vector<char> m_samples;
+    mutable std::vector<std::size_t> m_sampleSizes;
+    mutable bool m_sampling = true;
+};
+
+} // namespace entwine
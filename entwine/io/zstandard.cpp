@@ -10,12 +10,25 @@
 
 #include <entwine/io/zstandard.hpp>
 
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
 #include <pdal/compression/ZstdCompression.hpp>
-#include <pdal/filters/SortFilter.hpp>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/metadata.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+    // Number of points packed at a time while streaming into the compressor.
+    const uint64_t packBlockSize(4096);
+}
+
 void Zstandard::write(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
@@ -23,42 +36,68 @@ void Zstandard::write(
         const Bounds& bounds,
         BlockPointTable& src) const
 {
-    const std::vector<char> uncompressed(pack(src));
+    const uint64_t np(src.size());
+
+    // A large node is compressed in slices, each of them a complete frame.
+    // Concatenated frames form a single valid stream, so readers see no
+    // difference.
+    const uint64_t threads(std::max(1u, std::thread::hardware_concurrency()));
+    const uint64_t slices(
+            std::max<uint64_t>(
+                1,
+                std::min(threads, np / heuristics::compressSlicePoints)));
 
-    /*
-    const Schema& outSchema(m_metadata.outSchema());
-    VectorPointTable table(outSchema, pack(src));
+    std::vector<std::future<std::vector<char>>> futures;
+    for (uint64_t i(1); i < slices; ++i)
+    {
+        futures.push_back(std::async(std::launch::async, [&, i]()
+        {
+            return compress(src, np * i / slices, np * (i + 1) / slices);
+        }));
+    }
 
-    pdal::PointView view(table);
-    for (std::size_t i(0); i < table.size(); ++i) view.getOrAddPoint(i);
-    if (outSchema.hasTime())
+    std::vector<char> compressed(compress(src, 0, np / slices));
+    for (auto& f : futures)
     {
-        std::sort(
-                view.begin(),
-                view.end(),
-                [](const pdal::PointIdxRef& a, const pdal::PointIdxRef& b)
-                {
-                    return a.compare(DimId::GpsTime, b);
-                });
+        const std::vector<char> frame(f.get());
+        compressed.insert(compressed.end(), frame.begin(), frame.end());
     }
-    */
 
+    ensurePut(out, filename + ".zst", compressed);
+}
+
+std::vector<char> Zstandard::compress(
+        BlockPointTable& src,
+        const uint64_t begin,
+        const uint64_t end) const
+{
+    const uint64_t pointSize(packedPointSize());
+
+    // Typical point data compresses several-fold, so start from a fraction of
+    // the uncompressed size rather than reserving the full compression bound,
+    // which would be as large as the uncompressed buffer we're avoiding.
     std::vector<char> compressed;
+    compressed.reserve((end - begin) * pointSize / 4);
+
     pdal::ZstdCompressor compressor([&compressed](char* pos, std::size_t size)
     {
         compressed.insert(compressed.end(), pos, pos + size);
-    }, 3); // ZSTD_CLEVEL_DEFAULT = 3.
+    }, m_metadata.compressionLevel());
 
-    /*
-    for (std::size_t i(0); i < view.size(); ++i)
+    // Pack and compress a block at a time, so we never hold the entire
+    // uncompressed range in memory.
+    std::vector<char> block(
+            std::min(end - begin, packBlockSize) * pointSize);
+
+    for (uint64_t pos(begin); pos < end; pos += packBlockSize)
     {
-        compressor.compress(view.getPoint(i), outSchema.pointSize());
+        const uint64_t stop(std::min(end, pos + packBlockSize));
+        pack(src, pos, stop, block.data());
+        compressor.compress(block.data(), (stop - pos) * pointSize);
     }
-    */
-    compressor.compress(uncompressed.data(), uncompressed.size());
-    compressor.done();
 
-    ensurePut(out, filename + ".zst", compressed);
+    compressor.done();
+    return compressed;
 }
 
 void Zstandard::read(
@@ -67,18 +106,46 @@ void Zstandard::read(
         const std::string& filename,
         VectorPointTable& dst) const
 {
-    auto compressed(*ensureGet(out, filename + ".zst"));
+    decode(*fetch(out, filename), dst);
+}
+
+std::unique_ptr<std::vector<char>> Zstandard::fetch(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
+{
+    return ensureGet(out, filename + ".zst");
+}
 
-    std::vector<char> uncompressed;
-    pdal::ZstdDecompressor dec([&uncompressed](char* pos, std::size_t size)
+void Zstandard::decode(
+        const std::vector<char>& compressed,
+        VectorPointTable& dst) const
+{
+    // We know the exact uncompressed size up front, so decompress in place.
+    std::vector<char> uncompressed(
+            dst.capacity() * m_metadata.outSchema().pointSize());
+    std::size_t offset(0);
+
+    pdal::ZstdDecompressor dec([&uncompressed, &offset](
+                char* pos,
+                std::size_t size)
     {
-        uncompressed.insert(uncompressed.end(), pos, pos + size);
+        if (offset + size > uncompressed.size())
+        {
+            throw std::runtime_error("Invalid zstandard data size");
+        }
+
+        std::copy(pos, pos + size, uncompressed.data() + offset);
+        offset += size;
     });
 
     dec.decompress(compressed.data(), compressed.size());
 
-    unpack(dst, std::move(uncompressed));
+    if (offset != uncompressed.size())
+    {
+        throw std::runtime_error("Invalid zstandard data size");
+    }
+
+    unpack(dst, uncompressed);
 }
 
 } // namespace entwine
-
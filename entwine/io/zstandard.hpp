@@ -19,6 +19,7 @@ public:
     Zstandard(const Metadata& m) : Binary(m) { }
 
     virtual std::string type() const override { return "zstandard"; }
+    virtual std::string extension() const override { return ".zst"; }
 
     virtual void write(
             const arbiter::Endpoint& out,
@@ -32,6 +33,22 @@ public:
             const arbiter::Endpoint& tmp,
             const std::string& filename,
             VectorPointTable& table) const override;
+
+    virtual std::unique_ptr<std::vector<char>> fetch(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const override;
+
+    virtual void decode(
+            const std::vector<char>& stored,
+            VectorPointTable& table) const override;
+
+private:
+    // Pack and compress the points in the range [begin, end) of the source
+    // as a single frame.
+    std::vector<char> compress(
+            BlockPointTable& src,
+            uint64_t begin,
+            uint64_t end) const;
 };
 
 } // namespace entwine
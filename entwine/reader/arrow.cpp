@@ -0,0 +1,163 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/arrow.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+namespace arrow
+{
+
+namespace
+{
+    // Owned by each exported schema, and freed by its release callback.
+    struct SchemaData
+    {
+        std::string format;
+        std::string name;
+        std::vector<ArrowSchema*> children;
+    };
+
+    // Owned by each exported array.  Each child owns its column.
+    struct ArrayData
+    {
+        std::vector<char> column;
+        std::vector<const void*> buffers;
+        std::vector<ArrowArray*> children;
+    };
+
+    std::string format(const DimType type)
+    {
+        switch (type)
+        {
+            case DimType::Double:       return "g";
+            case DimType::Float:        return "f";
+            case DimType::Unsigned8:    return "C";
+            case DimType::Signed8:      return "c";
+            case DimType::Unsigned16:   return "S";
+            case DimType::Signed16:     return "s";
+            case DimType::Unsigned32:   return "I";
+            case DimType::Signed32:     return "i";
+            case DimType::Unsigned64:   return "L";
+            case DimType::Signed64:     return "l";
+            default: throw std::runtime_error("Invalid Arrow dimension type");
+        }
+    }
+
+    void releaseSchema(ArrowSchema* s)
+    {
+        SchemaData* data(static_cast<SchemaData*>(s->private_data));
+        for (ArrowSchema* child : data->children)
+        {
+            if (child->release) child->release(child);
+            delete child;
+        }
+        delete data;
+        s->release = nullptr;
+    }
+
+    void releaseArray(ArrowArray* a)
+    {
+        ArrayData* data(static_cast<ArrayData*>(a->private_data));
+        for (ArrowArray* child : data->children)
+        {
+            if (child->release) child->release(child);
+            delete child;
+        }
+        delete data;
+        a->release = nullptr;
+    }
+
+    void exportSchema(
+            ArrowSchema* s,
+            SchemaData* data,
+            const int64_t flags)
+    {
+        s->format = data->format.c_str();
+        s->name = data->name.c_str();
+        s->metadata = nullptr;
+        s->flags = flags;
+        s->n_children = data->children.size();
+        s->children = data->children.empty() ? nullptr : data->children.data();
+        s->dictionary = nullptr;
+        s->release = releaseSchema;
+        s->private_data = data;
+    }
+
+    void exportArray(ArrowArray* a, ArrayData* data, const uint64_t points)
+    {
+        a->length = points;
+        a->null_count = 0;
+        a->offset = 0;
+        a->n_buffers = data->buffers.size();
+        a->n_children = data->children.size();
+        a->buffers = data->buffers.data();
+        a->children = data->children.empty() ? nullptr : data->children.data();
+        a->dictionary = nullptr;
+        a->release = releaseArray;
+        a->private_data = data;
+    }
+}
+
+void exportColumns(
+        const Schema& schema,
+        std::vector<std::vector<char>> columns,
+        const uint64_t points,
+        ArrowArray* array,
+        ArrowSchema* arrowSchema)
+{
+    const DimList& dims(schema.dims());
+    if (columns.size() != dims.size())
+    {
+        throw std::runtime_error("Invalid column count for Arrow export");
+    }
+
+    // Check every type before allocating anything.
+    std::vector<std::string> formats;
+    for (const DimInfo& dim : dims) formats.push_back(format(dim.type()));
+
+    SchemaData* schemaData(new SchemaData());
+    schemaData->format = "+s";
+
+    ArrayData* arrayData(new ArrayData());
+    arrayData->buffers.push_back(nullptr);  // No validity bitmap.
+
+    for (std::size_t i(0); i < dims.size(); ++i)
+    {
+        SchemaData* childSchemaData(new SchemaData());
+        childSchemaData->format = formats[i];
+        childSchemaData->name = dims[i].name();
+
+        ArrowSchema* childSchema(new ArrowSchema());
+        exportSchema(childSchema, childSchemaData, 0);
+        schemaData->children.push_back(childSchema);
+
+        ArrayData* childArrayData(new ArrayData());
+        childArrayData->column = std::move(columns[i]);
+        childArrayData->column.resize(points * dims[i].size());
+        childArrayData->buffers.push_back(nullptr);
+        childArrayData->buffers.push_back(childArrayData->column.data());
+
+        ArrowArray* childArray(new ArrowArray());
+        exportArray(childArray, childArrayData, points);
+        arrayData->children.push_back(childArray);
+    }
+
+    exportSchema(arrowSchema, schemaData, 0);
+    exportArray(array, arrayData, points);
+}
+
+} // namespace arrow
+} // namespace entwine
@@ -0,0 +1,80 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// The structures of the Apache Arrow C data interface, which are part of its
+// stable ABI and so are declared here rather than depending on Arrow:
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C"
+{
+
+struct ArrowSchema
+{
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray
+{
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+} // extern "C"
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace entwine
+{
+
+class Schema;
+
+namespace arrow
+{
+
+// Export columns of the given schema, each holding the values of one
+// dimension for every point, as an Arrow struct array with a non-nullable
+// child array per dimension.  The columns are moved into the exported array
+// rather than copied, and are freed when the consumer releases it.
+void exportColumns(
+        const Schema& schema,
+        std::vector<std::vector<char>> columns,
+        uint64_t points,
+        ArrowArray* array,
+        ArrowSchema* arrowSchema);
+
+} // namespace arrow
+} // namespace entwine
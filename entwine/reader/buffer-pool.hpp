@@ -0,0 +1,92 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace entwine
+{
+
+// Idle result buffers of finished queries, kept for the queries after them so
+// that each doesn't grow its own from nothing.  Buffers are handed out by
+// best fit of their capacity, and at most maxBytes of idle capacity is kept,
+// favoring the largest buffers.
+class BufferPool
+{
+public:
+    explicit BufferPool(std::size_t maxBytes = 64 * 1024 * 1024)
+        : m_maxBytes(maxBytes)
+    { }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // An empty buffer with room for at least this many bytes.  If no idle
+    // buffer is large enough, the largest is grown.
+    std::vector<char> take(std::size_t bytes)
+    {
+        std::vector<char> data;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it(m_free.lower_bound(bytes));
+            if (it == m_free.end() && !m_free.empty())
+            {
+                it = std::prev(m_free.end());
+            }
+
+            if (it != m_free.end())
+            {
+                data.swap(it->second);
+                m_bytes -= it->first;
+                m_free.erase(it);
+            }
+        }
+
+        data.reserve(bytes);
+        return data;
+    }
+
+    // The given buffer is left empty.
+    void give(std::vector<char>&& data)
+    {
+        std::vector<char> idle(std::move(data));
+        const std::size_t capacity(idle.capacity());
+        if (!capacity || capacity > m_maxBytes) return;
+
+        idle.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.emplace(capacity, std::move(idle));
+        m_bytes += capacity;
+
+        while (m_bytes > m_maxBytes)
+        {
+            const auto it(m_free.begin());
+            m_bytes -= it->first;
+            m_free.erase(it);
+        }
+    }
+
+private:
+    const std::size_t m_maxBytes;
+
+    std::mutex m_mutex;
+    std::size_t m_bytes = 0;
+    std::multimap<std::size_t, std::vector<char>> m_free;
+};
+
+} // namespace entwine
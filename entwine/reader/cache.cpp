@@ -10,80 +10,325 @@
 
 #include <entwine/reader/cache.hpp>
 
+#include <algorithm>
+#include <utility>
+
 #include <entwine/reader/reader.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+    std::string projectionOf(const Reader& reader, const Schema& schema)
+    {
+        std::string name;
+        if (&schema == &reader.metadata().schema()) return name;
+
+        for (const DimInfo& dim : schema.dims())
+        {
+            name += (name.empty() ? "" : ",") + dim.name();
+        }
+        return name;
+    }
+}
+
 bool operator<(const GlobalId& a, const GlobalId& b)
 {
-    return a.path < b.path || (a.path == b.path && a.key < b.key);
+    if (a.path != b.path) return a.path < b.path;
+    if (a.key != b.key) return a.key < b.key;
+    return a.projection < b.projection;
 }
 
-std::deque<SharedChunkReader> Cache::acquire(
-        const Reader& reader,
-        const std::vector<Dxyz>& keys)
+CompressedCache::Stored CompressedCache::get(const GlobalId& id)
 {
-    std::deque<SharedChunkReader> block;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it(m_entries.find(id));
+    if (it == m_entries.end()) return Stored();
+
+    ++m_hits;
+
+    Entry& entry(it->second);
+    m_order.erase(entry.it);
+    m_order.push_front(it);
+    entry.it = m_order.begin();
+
+    return entry.stored;
+}
+
+void CompressedCache::put(const GlobalId& id, Stored stored)
+{
+    if (!stored || stored->size() > m_maxBytes) return;
 
     std::lock_guard<std::mutex> lock(m_mutex);
-    for (const Dxyz& key : keys) block.push_back(get(reader, key));
 
-    purge();
+    // Another thread may have fetched this chunk concurrently.
+    if (m_entries.count(id)) return;
 
-    return block;
+    auto it(m_entries.insert(std::make_pair(id, Entry())).first);
+    it->second.stored = stored;
+    m_order.push_front(it);
+    it->second.it = m_order.begin();
+    m_size += stored->size();
+
+    while (m_size > m_maxBytes && m_order.size())
+    {
+        const auto last(m_order.back());
+        m_size -= last->second.stored->size();
+        m_order.pop_back();
+        m_entries.erase(last);
+    }
 }
 
-SharedChunkReader Cache::get(const Reader& reader, const Dxyz& key)
+uint64_t CompressedCache::hits() const
 {
-    const GlobalId id(reader.path(), key);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
 
-    auto it(m_chunks.find(id));
+uint64_t CompressedCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
 
-    if (it == m_chunks.end())
+Cache::Stats Cache::stats() const
+{
+    Stats stats;
+    for (const Shard& shard : m_shards)
     {
-        // std::cout << "\tAdd " << id.key << std::endl;
-        it = m_chunks.insert(std::make_pair(id, ChunkReaderInfo())).first;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const Stats& s(shard.stats);
+        stats.hits += s.hits;
+        stats.misses += s.misses;
+        stats.diskHits += s.diskHits;
+        stats.evictions += s.evictions;
+        stats.prefetches += s.prefetches;
+        stats.prefetchHits += s.prefetchHits;
+        stats.prefetchWasted += s.prefetchWasted;
+        stats.bytes += shard.size;
+    }
 
-        ChunkReaderInfo& info(it->second);
-        info.chunk = std::make_shared<ChunkReader>(reader, key);
-        m_size += info.chunk->bytes();
+    if (m_disk) stats.diskStoredHits = m_disk->storedHits();
+
+    if (m_compressed)
+    {
+        stats.compressedHits = m_compressed->hits();
+        stats.compressedBytes = m_compressed->bytes();
     }
-    else
+
+    return stats;
+}
+
+std::deque<SharedChunkReader> Cache::acquire(
+        const Reader& reader,
+        const std::vector<Dxyz>& keys,
+        const Schema& schema)
+{
+    std::vector<std::shared_future<SharedChunkReader>> futures;
+    for (const Dxyz& key : keys) futures.push_back(get(reader, key, schema));
+
+    std::deque<SharedChunkReader> block;
+    for (auto& f : futures) block.push_back(f.get());
+    return block;
+}
+
+void Cache::release(const Reader& reader)
+{
+    std::unique_lock<std::mutex> lock(m_prefetchMutex);
+    m_released.wait(lock, [this, &reader]()
+    {
+        return !m_prefetching.count(&reader);
+    });
+    lock.unlock();
+
+    if (m_hedger) m_hedger->release(&reader);
+}
+
+std::shared_future<SharedChunkReader> Cache::get(
+        const Reader& reader,
+        const Dxyz& key,
+        const Schema& schema,
+        const bool speculative)
+{
+    const GlobalId id(reader.path(), key, projectionOf(reader, schema));
+    Shard& shard(shardOf(key));
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it(shard.chunks.find(id));
+
+    if (it != shard.chunks.end())
     {
         ChunkReaderInfo& info(it->second);
-        m_order.erase(info.it);
+        if (speculative) return info.chunk;
+
+        ++shard.stats.hits;
+
+        if (info.speculative)
+        {
+            info.speculative = false;
+            ++shard.stats.prefetchHits;
+            if (info.loaded) m_speculativeBytes -= info.bytes;
+        }
+
+        if (info.loaded)
+        {
+            shard.order.erase(info.it);
+            shard.order.push_front(it);
+            info.it = shard.order.begin();
+        }
+
+        const std::shared_future<SharedChunkReader> result(info.chunk);
+        lock.unlock();
+
+        prefetch(reader, key, schema);
+        return result;
     }
 
-    m_order.push_front(it);
+    // This chunk isn't resident or being loaded, so we will load it.  Anyone
+    // else requesting it in the meantime will wait on our future.
+    if (speculative) ++shard.stats.prefetches;
+    else ++shard.stats.misses;
+
+    std::promise<SharedChunkReader> promise;
+    it = shard.chunks.insert(std::make_pair(id, ChunkReaderInfo())).first;
+    it->second.chunk = promise.get_future().share();
+    it->second.speculative = speculative;
+    const std::shared_future<SharedChunkReader> result(it->second.chunk);
+
+    lock.unlock();
+
+    // The children are prefetched while we load this chunk.
+    if (!speculative) prefetch(reader, key, schema);
+
+    SharedChunkReader chunk;
+
+    try
+    {
+        if (m_disk)
+        {
+            chunk = m_disk->get(id, schema, reader.hierarchy().count(key));
+        }
+
+        if (chunk)
+        {
+            std::lock_guard<std::mutex> statsLock(shard.mutex);
+            ++shard.stats.diskHits;
+        }
+        else
+        {
+            chunk = std::make_shared<ChunkReader>(
+                    reader,
+                    key,
+                    schema,
+                    m_compressed.get(),
+                    m_disk.get(),
+                    m_hedger.get());
+            if (m_disk) m_disk->put(id, *chunk);
+        }
+    }
+    catch (...)
+    {
+        // Don't cache failures - let a subsequent request try again.
+        promise.set_exception(std::current_exception());
+        lock.lock();
+        shard.chunks.erase(it);
+        return result;
+    }
+
+    promise.set_value(chunk);
+
+    lock.lock();
 
     ChunkReaderInfo& info(it->second);
-    info.it = m_order.begin();
+    info.loaded = true;
+    info.bytes = chunk->bytes();
+    shard.order.push_front(it);
+    info.it = shard.order.begin();
+    shard.size += info.bytes;
+    if (info.speculative) m_speculativeBytes += info.bytes;
 
-    return info.chunk;
+    purge(shard);
+
+    return result;
 }
 
-void Cache::purge()
+void Cache::purge(Shard& shard)
 {
-    const std::size_t start(m_size);
-    while (m_size > m_maxBytes)
-    {
-        const auto& it(m_order.back());
-        const GlobalId& id(it->first);
-        const ChunkReaderInfo& info(it->second);
+    const std::size_t maxBytes(m_maxBytes / shardCount);
 
-        std::cout << "\tDel " << id.key << std::endl;
-        m_size -= info.chunk->bytes();
-        m_order.pop_back();
-        m_chunks.erase(it);
+    while (shard.size > maxBytes && shard.order.size())
+    {
+        const auto it(shard.order.back());
+        shard.size -= it->second.bytes;
+        if (it->second.speculative)
+        {
+            m_speculativeBytes -= it->second.bytes;
+            ++shard.stats.prefetchWasted;
+        }
+        shard.order.pop_back();
+        shard.chunks.erase(it);
+        ++shard.stats.evictions;
     }
+}
+
+void Cache::prefetch(
+        const Reader& reader,
+        const Dxyz& key,
+        const Schema& schema)
+{
+    if (!m_prefetcher) return;
+
+    if (m_speculativeBytes >= m_prefetch.maxBytes) return;
 
-    if (start > m_size)
     {
-        std::cout << "\t\tPurged " << (start - m_size) << std::endl;
-        std::cout << "\t\tLeft " << m_size << std::endl;
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        ++m_prefetching[&reader];
     }
+
+    const auto done([this, &reader]()
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        if (!--m_prefetching[&reader]) m_prefetching.erase(&reader);
+        m_released.notify_all();
+    });
+
+    // Hierarchy lookups for the children may themselves need a fetch, so
+    // they happen on the prefetching thread too.
+    const bool added(m_prefetcher->tryAdd([this, &reader, key, &schema, done]()
+    {
+        try
+        {
+            std::vector<std::pair<uint64_t, Dxyz>> children;
+            for (uint64_t i(0); i < dirEnd(); ++i)
+            {
+                const Dxyz child(
+                        key.d + 1,
+                        (key.p.x << 1) | (i & EwBit ? 1 : 0),
+                        (key.p.y << 1) | (i & NsBit ? 1 : 0),
+                        (key.p.z << 1) | (i & UdBit ? 1 : 0));
+
+                const uint64_t np(reader.hierarchy().count(child));
+                if (np) children.emplace_back(np, child);
+            }
+
+            std::sort(children.rbegin(), children.rend());
+            if (children.size() > m_prefetch.children)
+            {
+                children.resize(m_prefetch.children);
+            }
+
+            for (const auto& c : children)
+            {
+                get(reader, c.second, schema, true);
+            }
+        }
+        catch (...) { }
+
+        done();
+    }));
+
+    if (!added) done();
 }
 
 } // namespace entwine
-
@@ -10,67 +10,244 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
 #include <deque>
+#include <future>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include <entwine/reader/chunk-reader.hpp>
+#include <entwine/reader/disk-cache.hpp>
+#include <entwine/reader/hedger.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
 class Reader;
 
+// Decoded chunks are further keyed by the names of the dimensions they hold,
+// if they were decoded in a projection of the absolute schema.
 struct GlobalId
 {
-    GlobalId(const std::string path, const Dxyz& key)
+    GlobalId(
+            const std::string path,
+            const Dxyz& key,
+            const std::string projection = "")
         : path(path)
         , key(key)
+        , projection(projection)
     { }
 
     const std::string path;
     const Dxyz key;
+    const std::string projection;
 };
 
 bool operator<(const GlobalId& a, const GlobalId& b);
 
+// The stored bytes of recently read chunks, which are typically several times
+// smaller than their decoded points, so that chunks evicted from the decoded
+// Cache may be decoded again without being refetched.
+class CompressedCache
+{
+public:
+    using Stored = std::shared_ptr<const std::vector<char>>;
+
+    CompressedCache(std::size_t maxBytes) : m_maxBytes(maxBytes) { }
+
+    // Returns null if this chunk isn't resident.
+    Stored get(const GlobalId& id);
+    void put(const GlobalId& id, Stored stored);
+
+    uint64_t hits() const;
+    uint64_t bytes() const;
+
+private:
+    struct Entry;
+    using Map = std::map<GlobalId, Entry>;
+    using Order = std::list<Map::iterator>;
+
+    struct Entry
+    {
+        Stored stored;
+        Order::iterator it;
+    };
+
+    const std::size_t m_maxBytes;
+
+    mutable std::mutex m_mutex;
+    std::size_t m_size = 0;
+    uint64_t m_hits = 0;
+
+    Map m_entries;
+    Order m_order;
+};
+
 struct ChunkReaderInfo
 {
     using Map = std::map<GlobalId, ChunkReaderInfo>;
     using Order = std::list<Map::iterator>;
 
-    SharedChunkReader chunk;
+    // Shared by every request for this chunk, including those which arrive
+    // while it is still being loaded.
+    std::shared_future<SharedChunkReader> chunk;
+
+    // Only chunks which have finished loading are eligible for eviction, and
+    // only those have a position in the LRU order.
+    bool loaded = false;
+    std::size_t bytes = 0;
     Order::iterator it;
+
+    // True if this chunk was prefetched and hasn't yet been requested.
+    bool speculative = false;
+};
+
+// Viewers typically request the children of a node soon after the node
+// itself, so after each request the most populous children of the requested
+// node may be loaded speculatively, in the same schema.
+struct PrefetchPolicy
+{
+    // The number of children to prefetch for each request, 0 to disable.
+    std::size_t children = 0;
+
+    // The number of speculative loads which may run at once.  Requests
+    // arriving while all of these are busy prefetch nothing.
+    std::size_t threads = 4;
+
+    // Bytes of prefetched chunks not yet requested, beyond which nothing more
+    // is prefetched.
+    std::size_t maxBytes = 64 * 1024 * 1024;
 };
 
 class Cache
 {
 public:
-    Cache(std::size_t maxBytes = 1024 * 1024 * 256) // 250 MB.
+    // Chunks missing from this cache are looked up in the optional disk
+    // cache before being read, and are added to it once read, as are their
+    // stored bytes.  If compressedBytes is nonzero, the stored bytes of
+    // chunks are also retained in memory, up to that size, so they may be
+    // decoded again without being refetched.  Remote fetches are hedged by
+    // the given policy, if it is enabled.
+    Cache(
+            std::size_t maxBytes = 1024 * 1024 * 256, // 250 MB.
+            std::shared_ptr<DiskCache> disk = std::shared_ptr<DiskCache>(),
+            std::size_t compressedBytes = 0,
+            PrefetchPolicy prefetch = PrefetchPolicy(),
+            HedgePolicy hedge = HedgePolicy())
         : m_maxBytes(maxBytes)
+        , m_disk(disk)
+        , m_compressed(compressedBytes ?
+                makeUnique<CompressedCache>(compressedBytes) :
+                std::unique_ptr<CompressedCache>())
+        , m_prefetch(prefetch)
+        , m_hedger(hedge.percentile ?
+                makeUnique<Hedger>(hedge) :
+                std::unique_ptr<Hedger>())
+        , m_prefetcher(prefetch.children ?
+                makeUnique<Pool>(prefetch.threads, 1, false) :
+                std::unique_ptr<Pool>())
     { }
 
     std::size_t maxBytes() const { return m_maxBytes; }
 
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t diskHits = 0;
+        uint64_t diskStoredHits = 0;
+        uint64_t compressedHits = 0;
+        uint64_t evictions = 0;
+        uint64_t bytes = 0;
+        uint64_t compressedBytes = 0;
+
+        // Chunks loaded speculatively, those of them later requested, and
+        // those evicted without having been requested.
+        uint64_t prefetches = 0;
+        uint64_t prefetchHits = 0;
+        uint64_t prefetchWasted = 0;
+    };
+
+    Stats stats() const;
+
+    // Null if hedging is disabled.
+    const Hedger* hedger() const { return m_hedger.get(); }
+
+    // Safe for any number of concurrent queries.  Chunk loads happen outside
+    // of any lock, so a slow fetch only blocks the queries waiting for that
+    // same chunk.
+    //
+    // Chunks are decoded in the given schema, which must be either the
+    // absolute schema of this reader or one of its projections.
     std::deque<SharedChunkReader> acquire(
             const Reader& reader,
-            const std::vector<Dxyz>& keys);
+            const std::vector<Dxyz>& keys,
+            const Schema& schema);
+
+    // Wait for any prefetches or hedged fetches on behalf of this reader,
+    // which is about to be destroyed.
+    void release(const Reader& reader);
 
 private:
-    SharedChunkReader get(const Reader& reader, const Dxyz& id);
-    void purge();
+    // Chunks are spread over independently locked shards by key, so that
+    // concurrent queries rarely contend, each holding an even share of our
+    // bytes in its own LRU order.
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::size_t size = 0;
+        Stats stats;
+
+        ChunkReaderInfo::Map chunks;
+        ChunkReaderInfo::Order order;
+    };
+
+    static constexpr std::size_t shardCount = 16;
+
+    Shard& shardOf(const Dxyz& key)
+    {
+        return m_shards[std::hash<Dxyz>()(key) % shardCount];
+    }
+
+    std::shared_future<SharedChunkReader> get(
+            const Reader& reader,
+            const Dxyz& id,
+            const Schema& schema,
+            bool speculative = false);
+
+    // Must be called with the shard's lock held.
+    void purge(Shard& shard);
+
+    // Queue the prefetch of the children of this node, if we have room.
+    void prefetch(const Reader& reader, const Dxyz& key, const Schema& schema);
 
     const std::size_t m_maxBytes;
+    const std::shared_ptr<DiskCache> m_disk;
+    const std::unique_ptr<CompressedCache> m_compressed;
 
-    mutable std::mutex m_mutex;
-    std::size_t m_size = 0;
+    std::array<Shard, shardCount> m_shards;
 
-    ChunkReaderInfo::Map m_chunks;
-    ChunkReaderInfo::Order m_order;
+    const PrefetchPolicy m_prefetch;
+    std::atomic<std::size_t> m_speculativeBytes{ 0 };
+
+    std::mutex m_prefetchMutex;
+    std::map<const Reader*, std::size_t> m_prefetching;
+    std::condition_variable m_released;
+
+    const std::unique_ptr<Hedger> m_hedger;
+
+    // Last, so that pending prefetches finish before anything else is torn
+    // down.
+    const std::unique_ptr<Pool> m_prefetcher;
 };
 
 } // namespace entwine
-
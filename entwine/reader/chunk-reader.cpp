@@ -10,33 +10,229 @@
 
 #include <entwine/reader/chunk-reader.hpp>
 
+#include <algorithm>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/io/io.hpp>
+#include <entwine/reader/cache.hpp>
+#include <entwine/reader/hedger.hpp>
 #include <entwine/reader/reader.hpp>
 
 namespace entwine
 {
 
-ChunkReader::ChunkReader(const Reader& r, const Dxyz& id)
+namespace
 {
-    std::vector<char> data;
+    // A view directly over a mapped chunk, whose stored layout is the
+    // absolute schema.
+    class MappedPointTable : public VectorPointTable
+    {
+    public:
+        MappedPointTable(
+                const Schema& schema,
+                std::unique_ptr<MappedFile> file)
+            : VectorPointTable(
+                    schema,
+                    file->size() / schema.pointSize(),
+                    Unowned())
+            , m_file(std::move(file))
+        { }
 
-    VectorPointTable tmp(r.metadata().schema());
-    tmp.setProcess([&data, &tmp]()
+        virtual char* getPoint(pdal::PointId index) override
+        {
+            return m_file->data() + index * pointSize();
+        }
+
+    private:
+        std::unique_ptr<MappedFile> m_file;
+    };
+
+    // Fetch a packed node along with the nodes following it in its blob,
+    // within our read-ahead, in a single range request.  The others are added
+    // to the compressed and disk caches.  Returns null if this node isn't
+    // packed.
+    CompressedCache::Stored fetchPacked(
+            const Reader& r,
+            const Dxyz& id,
+            CompressedCache* compressed,
+            DiskCache* disk)
     {
-        data.insert(
-                data.end(),
-                tmp.data().data(),
-                tmp.data().data() + tmp.numPoints() * tmp.pointSize());
-    });
+        const HierarchyReader::Extents extents(
+                r.hierarchy().extents(
+                    id,
+                    compressed || disk ? heuristics::packedReadAhead : 0));
+
+        CompressedCache::Stored result;
+        if (extents.empty()) return result;
+
+        const HierarchyReader::Extent& first(extents.front().second);
+        const HierarchyReader::Extent& last(extents.back().second);
+        const uint64_t end(last.offset + last.size);
+
+        const std::vector<char> data(
+                getRange(
+                    r.ep().getSubEndpoint("ept-data"),
+                    first.root.toString() + ".pack",
+                    first.offset,
+                    end));
+
+        if (data.size() != end - first.offset)
+        {
+            throw std::runtime_error("Invalid packed node data");
+        }
+
+        for (const auto& p : extents)
+        {
+            const HierarchyReader::Extent& e(p.second);
+            const char* pos(data.data() + e.offset - first.offset);
+            auto stored(
+                    std::make_shared<const std::vector<char>>(
+                        pos,
+                        pos + e.size));
+
+            if (p.first == id)
+            {
+                result = stored;
+                continue;
+            }
 
+            const GlobalId gid(r.path(), p.first);
+            if (compressed) compressed->put(gid, stored);
+            if (disk) disk->putStored(gid, stored);
+        }
+
+        return result;
+    }
+}
+
+ChunkReader::ChunkReader(
+        const Reader& r,
+        const Dxyz& id,
+        const Schema& schema,
+        CompressedCache* compressed,
+        DiskCache* disk,
+        Hedger* hedger)
+{
     const auto dataEp(r.ep().getSubEndpoint("ept-data"));
-    r.metadata().dataIo().read(dataEp, r.tmp(), id.toString(), tmp);
+    const std::string name(r.metadata().dataName(id));
+
+    // Mapping costs nothing up front, so mapped chunks always hold every
+    // dimension, even if only a projection was requested.
+    if (auto file = r.metadata().dataIo().map(dataEp, name))
+    {
+        m_table = makeUnique<MappedPointTable>(
+                r.metadata().schema(),
+                std::move(file));
+        m_table->clear(m_table->capacity());
+        m_mapped = true;
+        return;
+    }
+
+    // Points are decoded straight into a table sized from our hierarchy to
+    // hold the entire chunk, whose storage we then take without copying.
+    // Binary data types are unpacked in a single pass of exactly this size,
+    // while laszip is streamed, so is given room for one extra point: a batch
+    // short of full is then known to be the last.  Only if the count falls
+    // short must batches be copied out as they arrive.
+    const bool streamed(r.metadata().dataIo().type() == "laszip");
+    const uint64_t count(r.hierarchy().count(id));
+    VectorPointTable tmp(
+            schema,
+            std::max<uint64_t>(count + (streamed ? 1 : 0), 1));
+
+    std::vector<char> data;
+    tmp.setProcess([&data, &tmp, streamed]()
+    {
+        const uint64_t np(tmp.numPoints());
+        if (!np) return;
+
+        const uint64_t bytes(np * tmp.pointSize());
+        if (data.empty() && (!streamed || np < tmp.capacity()))
+        {
+            data = tmp.acquire();
+            data.resize(bytes);
+        }
+        else
+        {
+            data.insert(
+                    data.end(),
+                    tmp.data().data(),
+                    tmp.data().data() + bytes);
+        }
+    });
+
+    const DataIo& io(r.metadata().dataIo());
+    const GlobalId gid(r.path(), id);
+    CompressedCache::Stored stored;
+
+    if (compressed) stored = compressed->get(gid);
+
+    if (!stored)
+    {
+        if (disk) stored = disk->getStored(gid);
+
+        if (!stored)
+        {
+            if (r.metadata().packNodes())
+            {
+                stored = fetchPacked(r, id, compressed, disk);
+            }
+            // Hedging local reads would gain nothing.
+            if (!stored && hedger && !dataEp.isLocal())
+            {
+                stored = hedger->fetch(&r, io, dataEp, name);
+            }
+            else if (!stored && (compressed || disk))
+            {
+                stored = io.fetch(dataEp, name);
+            }
+            if (disk) disk->putStored(gid, stored);
+        }
 
-    m_table = makeUnique<VectorPointTable>(
-            r.metadata().schema(),
-            std::move(data));
+        if (compressed) compressed->put(gid, stored);
+    }
+
+    if (stored) io.decode(*stored, tmp);
+    else io.read(dataEp, r.tmp(), name, tmp);
+
+    m_table = makeUnique<VectorPointTable>(schema, std::move(data));
+    m_table->clear(m_table->capacity());
+}
+
+ChunkReader::ChunkReader(const Schema& schema, std::vector<char>&& points)
+    : m_table(makeUnique<VectorPointTable>(schema, std::move(points)))
+{
     m_table->clear(m_table->capacity());
 }
 
+ChunkReader::ChunkReader(
+        const Schema& schema,
+        std::unique_ptr<MappedFile> file)
+    : m_table(makeUnique<MappedPointTable>(schema, std::move(file)))
+    , m_mapped(true)
+{
+    m_table->clear(m_table->capacity());
+}
+
+SharedChunkReader ChunkReader::within(
+        const Reader& r,
+        const Dxyz& id,
+        const Bounds& bounds)
+{
+    const Metadata& m(r.metadata());
+    const ChunkKey ck(m, id);
+
+    std::vector<char> points;
+    const auto dataEp(r.ep().getSubEndpoint("ept-data"));
+    if (!m.dataIo().readWithin(dataEp, m.dataName(id), ck.bounds(), bounds,
+                points))
+    {
+        return SharedChunkReader();
+    }
+
+    return std::make_shared<ChunkReader>(m.schema(), std::move(points));
+}
+
 } // namespace entwine
 
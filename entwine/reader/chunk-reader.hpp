@@ -14,19 +14,50 @@
 
 #include <entwine/types/key.hpp>
 #include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/mapped-file.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
+class ChunkReader;
+class CompressedCache;
+class DiskCache;
+class Hedger;
 class Reader;
 
+using SharedChunkReader = std::shared_ptr<ChunkReader>;
+
 class ChunkReader
 {
 public:
-    ChunkReader(const Reader& reader, const Dxyz& id);
+    // Points are decoded in the given schema, which may be a projection of
+    // the absolute schema if our data type supports it.  If a compressed
+    // cache is given, this chunk's stored bytes are taken from it if they are
+    // resident, or otherwise are added to it, and likewise for the stored
+    // bytes of a disk cache.  If a hedger is given, remote stored bytes are
+    // fetched through it.
+    ChunkReader(
+            const Reader& reader,
+            const Dxyz& id,
+            const Schema& schema,
+            CompressedCache* compressed = nullptr,
+            DiskCache* disk = nullptr,
+            Hedger* hedger = nullptr);
+    ChunkReader(const Schema& schema, std::vector<char>&& points);
+
+    // A view directly over a mapped file of points in the given schema.
+    ChunkReader(const Schema& schema, std::unique_ptr<MappedFile> file);
+
+    // Read only the points of this chunk which may lie within the given
+    // bounds, bypassing the cache, or return null if it must be read whole.
+    static SharedChunkReader within(
+            const Reader& reader,
+            const Dxyz& id,
+            const Bounds& bounds);
 
     VectorPointTable& table() { return *m_table; }
+    bool mapped() const { return m_mapped; }
     std::size_t bytes() const
     {
         return m_table->capacity() * m_table->pointSize();
@@ -34,9 +65,8 @@ public:
 
 private:
     std::unique_ptr<VectorPointTable> m_table;
+    bool m_mapped = false;
 };
 
-using SharedChunkReader = std::shared_ptr<ChunkReader>;
-
 } // namespace entwine
 
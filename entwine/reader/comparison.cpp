@@ -10,9 +10,12 @@
 
 #include <entwine/reader/comparison.hpp>
 
+#include <algorithm>
+
 #include <pdal/Dimension.hpp>
 #include <pdal/util/Utils.hpp>
 
+#include <entwine/reader/filter-program.hpp>
 #include <entwine/types/files.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/types/schema.hpp>
@@ -152,6 +155,40 @@ std::unique_ptr<Comparison> Comparison::create(
     return makeUnique<Comparison>(id, dimName, std::move(op));
 }
 
+bool ComparisonOperator::operator()(const DimRange& r) const
+{
+    if (r.empty()) return true;
+
+    const std::vector<double> vals(values());
+    const double v(vals.empty() ? 0 : vals.front());
+
+    // Only a node made up entirely of one value can fail inequality.
+    const auto constant([&r](double d) { return r.min == d && r.max == d; });
+
+    switch (m_type)
+    {
+        case ComparisonType::eq:    return r.min <= v && v <= r.max;
+        case ComparisonType::gt:    return r.max > v;
+        case ComparisonType::gte:   return r.max >= v;
+        case ComparisonType::lt:    return r.min < v;
+        case ComparisonType::lte:   return r.min <= v;
+        case ComparisonType::ne:    return !constant(v);
+        case ComparisonType::in:
+            return std::any_of(vals.begin(), vals.end(), [&r](double d)
+            {
+                return r.min <= d && d <= r.max;
+            });
+        case ComparisonType::nin:
+            return std::none_of(vals.begin(), vals.end(), constant);
+        default: return true;
+    }
+}
+
+void Comparison::compile(FilterProgram& program) const
+{
+    program.compare(m_dim, m_op->type(), m_op->values());
+}
+
 std::unique_ptr<ComparisonOperator> ComparisonOperator::create(
         const Metadata& metadata,
         const std::string& dimName,
@@ -15,6 +15,8 @@
 #include <entwine/reader/filterable.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/defs.hpp>
+#include <entwine/types/file-index.hpp>
+#include <entwine/types/node-stats.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/unique.hpp>
 
@@ -109,6 +111,9 @@ public:
 
     virtual bool operator()(double in) const = 0;
     virtual bool operator()(const Bounds& bounds) const { return true; }
+
+    // True if some value within this range could pass.
+    bool operator()(const DimRange& range) const;
     virtual void log(const std::string& pre) const = 0;
 
     virtual std::vector<Origin> origins() const
@@ -116,6 +121,9 @@ public:
         return std::vector<Origin>();
     }
 
+    // The value or values compared against.
+    virtual std::vector<double> values() const = 0;
+
     ComparisonType type() const { return m_type; }
 
 protected:
@@ -157,6 +165,11 @@ public:
         return o;
     }
 
+    virtual std::vector<double> values() const override
+    {
+        return std::vector<double>(1, m_val);
+    }
+
 protected:
     Op m_op;
     double m_val;
@@ -187,6 +200,8 @@ public:
         }
     }
 
+    virtual std::vector<double> values() const override { return m_vals; }
+
 protected:
     std::vector<double> m_vals;
     std::vector<Bounds> m_boundsList;
@@ -199,6 +214,7 @@ public:
             const std::vector<double>& vals,
             const std::vector<Bounds>& boundsList)
         : ComparisonMulti(ComparisonType::in, vals, boundsList)
+        , m_index(indexOf(boundsList))
     { }
 
     virtual bool operator()(double in) const override
@@ -212,16 +228,23 @@ public:
     virtual bool operator()(const Bounds& bounds) const override
     {
         if (m_boundsList.empty()) return true;
-        else
-        {
-            for (const auto& b : m_boundsList)
-            {
-                if (b.overlaps(bounds.growBy(.005), true)) return true;
-            }
+        else return m_index.overlaps(bounds.growBy(.005));
+    }
 
-            return false;
+private:
+    // Filters may list very many files, each of which would otherwise be
+    // tested against every node.
+    static FileIndex indexOf(const std::vector<Bounds>& boundsList)
+    {
+        std::vector<FileIndex::Entry> entries;
+        for (std::size_t i(0); i < boundsList.size(); ++i)
+        {
+            entries.emplace_back(boundsList[i], i);
         }
+        return FileIndex(entries);
     }
+
+    FileIndex m_index;
 };
 
 class ComparisonNone : public ComparisonMulti
@@ -279,12 +302,20 @@ public:
         return (*m_op)(bounds);
     }
 
+    bool check(const DimRanges& ranges) const override
+    {
+        const auto it(ranges.find(m_name));
+        return it == ranges.end() || (*m_op)(it->second);
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << m_name << " ";
         m_op->log("");
     }
 
+    virtual void compile(FilterProgram& program) const override;
+
 protected:
     pdal::Dimension::Id m_dim;
     std::string m_name;
@@ -0,0 +1,262 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/disk-cache.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <utime.h>
+#endif
+
+#include <entwine/reader/cache.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/mapped-file.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    std::string makeToken()
+    {
+        std::random_device rd;
+        std::ostringstream ss;
+        ss << std::hex << rd() << rd();
+        return ss.str();
+    }
+
+    // FNV-1a, which unlike std::hash is stable across processes.
+    uint64_t hash(const char* pos, const char* end)
+    {
+        uint64_t h(0xcbf29ce484222325ULL);
+        for ( ; pos < end; ++pos)
+        {
+            h ^= static_cast<unsigned char>(*pos);
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    uint64_t hash(const std::string& s)
+    {
+        return hash(s.data(), s.data() + s.size());
+    }
+
+    // Stored bytes are followed by their size and checksum.
+    const std::size_t trailerSize(2 * sizeof(uint64_t));
+
+    // Number of stored writes which may wait for our writer thread.
+    const std::size_t maxPendingWrites(64);
+}
+
+DiskCache::DiskCache(std::string dir, const uint64_t maxBytes)
+    : m_dir(arbiter::expandTilde(dir) +
+            (dir.size() && dir.back() != '/' ? "/" : ""))
+    , m_maxBytes(maxBytes)
+    , m_token(makeToken())
+    , m_pool(1, maxPendingWrites, false)
+{
+    arbiter::mkdirp(m_dir);
+}
+
+std::string DiskCache::filename(const GlobalId& id) const
+{
+    std::ostringstream ss;
+    ss << std::hex << hash(id.path);
+    if (id.projection.size()) ss << "-" << hash(id.projection);
+    return m_dir + ss.str() + "-" + id.key.toString() + ".bin";
+}
+
+std::string DiskCache::storedFilename(const GlobalId& id) const
+{
+    std::ostringstream ss;
+    ss << std::hex << hash(id.path);
+    return m_dir + ss.str() + "-" + id.key.toString() + ".stored";
+}
+
+SharedChunkReader DiskCache::get(
+        const GlobalId& id,
+        const Schema& schema,
+        const uint64_t np) const
+{
+    const std::string path(filename(id));
+
+    // A file of any other size is from some other dataset, or is corrupt.
+    std::unique_ptr<MappedFile> file(MappedFile::create(path));
+    if (!file || file->size() != np * schema.pointSize())
+    {
+        return SharedChunkReader();
+    }
+
+#ifndef _WIN32
+    // Mark this file as recently used, for every process sharing it.
+    ::utime(path.c_str(), nullptr);
+#endif
+
+    return std::make_shared<ChunkReader>(schema, std::move(file));
+}
+
+void DiskCache::put(const GlobalId& id, ChunkReader& chunk)
+{
+    // Chunks mapped from their source gain nothing from being cached here.
+    if (chunk.mapped() || !chunk.bytes() || chunk.bytes() > m_maxBytes) return;
+
+    if (write(filename(id), chunk.table().data())) purge();
+}
+
+DiskCache::Stored DiskCache::getStored(const GlobalId& id) const
+{
+    const std::string path(storedFilename(id));
+
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    if (!stream.good()) return Stored();
+
+    std::vector<char> data(
+            (std::istreambuf_iterator<char>(stream)),
+            std::istreambuf_iterator<char>());
+
+    // A file failing its checks was damaged, or truncated by a full disk, so
+    // it is removed to be fetched and written again.
+    uint64_t size(0);
+    uint64_t checksum(0);
+    if (data.size() >= trailerSize)
+    {
+        const char* trailer(data.data() + data.size() - trailerSize);
+        std::memcpy(&size, trailer, sizeof(uint64_t));
+        std::memcpy(&checksum, trailer + sizeof(uint64_t), sizeof(uint64_t));
+    }
+
+    if (
+            data.size() < trailerSize ||
+            size != data.size() - trailerSize ||
+            checksum != hash(data.data(), data.data() + size))
+    {
+        arbiter::remove(path);
+        return Stored();
+    }
+
+#ifndef _WIN32
+    ::utime(path.c_str(), nullptr);
+#endif
+
+    data.resize(size);
+    ++m_storedHits;
+    return std::make_shared<const std::vector<char>>(std::move(data));
+}
+
+void DiskCache::putStored(const GlobalId& id, Stored stored)
+{
+    if (!stored || stored->size() + trailerSize > m_maxBytes) return;
+
+    const std::string path(storedFilename(id));
+    m_pool.tryAdd([this, path, stored]()
+    {
+        const uint64_t size(stored->size());
+        const uint64_t checksum(hash(stored->data(), stored->data() + size));
+
+        std::vector<char> data(size + trailerSize);
+        std::copy(stored->begin(), stored->end(), data.begin());
+        std::memcpy(data.data() + size, &size, sizeof(uint64_t));
+        std::memcpy(
+                data.data() + size + sizeof(uint64_t),
+                &checksum,
+                sizeof(uint64_t));
+
+        if (write(path, data)) purge();
+    });
+}
+
+bool DiskCache::write(const std::string& path, const std::vector<char>& data)
+{
+    const std::string partial(
+            path + "." + m_token + "-" + std::to_string(m_written++));
+
+    {
+        std::ofstream stream(partial, std::ios::out | std::ios::binary);
+        stream.write(data.data(), data.size());
+        if (!stream.good())
+        {
+            arbiter::remove(partial);
+            return false;
+        }
+    }
+
+    // Renaming is atomic, so no process may see a partially written file.
+    if (std::rename(partial.c_str(), path.c_str()) != 0)
+    {
+        arbiter::remove(partial);
+        return false;
+    }
+
+    return true;
+}
+
+void DiskCache::purge()
+{
+    struct Entry
+    {
+        std::string path;
+        uint64_t bytes = 0;
+        std::time_t used = 0;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total(0);
+
+    std::vector<std::string> paths(arbiter::glob(m_dir + "*.bin"));
+    for (const std::string& path : arbiter::glob(m_dir + "*.stored"))
+    {
+        paths.push_back(path);
+    }
+
+    for (const std::string& path : paths)
+    {
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0) continue;
+
+        Entry entry;
+        entry.path = path;
+        entry.bytes = info.st_size;
+        entry.used = info.st_mtime;
+        entries.push_back(entry);
+
+        total += entry.bytes;
+    }
+
+    if (total <= m_maxBytes) return;
+
+    std::sort(
+            entries.begin(),
+            entries.end(),
+            [](const Entry& a, const Entry& b) { return a.used < b.used; });
+
+    // Other processes may be removing these concurrently, or may still have
+    // them mapped, neither of which is a problem.
+    for (const Entry& entry : entries)
+    {
+        if (total <= m_maxBytes) break;
+        arbiter::remove(entry.path);
+        total -= entry.bytes;
+    }
+}
+
+} // namespace entwine
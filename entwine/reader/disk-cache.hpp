@@ -0,0 +1,86 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/reader/chunk-reader.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+struct GlobalId;
+
+// A second tier of decoded chunks behind the in-process Cache, stored as
+// files in a local directory which may be shared by every reader process on a
+// host.  Files are mapped when they are loaded, so processes share their
+// contents through the page cache.  Whenever a chunk is added, the least
+// recently used files are removed until the directory fits within its limit.
+//
+// The stored bytes of chunks, as fetched from their endpoint, may be cached
+// here too, sharing the same limit.  These are smaller than decoded chunks
+// and serve every projection.  They are written in the background, and carry
+// a checksum so a damaged file is discarded rather than decoded.
+//
+// Entries are keyed only by dataset path, chunk key, and projection, so the
+// directory should be cleared if a dataset is rebuilt in place.
+class DiskCache
+{
+public:
+    using Stored = std::shared_ptr<const std::vector<char>>;
+
+    DiskCache(std::string dir, uint64_t maxBytes);
+
+    // Returns null if this chunk, with the given point count, isn't cached.
+    SharedChunkReader get(
+            const GlobalId& id,
+            const Schema& schema,
+            uint64_t np) const;
+
+    void put(const GlobalId& id, ChunkReader& chunk);
+
+    // Returns null if these stored bytes aren't cached or are damaged.
+    Stored getStored(const GlobalId& id) const;
+
+    // Queued to be written in the background, or dropped if too many writes
+    // are already pending.
+    void putStored(const GlobalId& id, Stored stored);
+
+    uint64_t maxBytes() const { return m_maxBytes; }
+    uint64_t storedHits() const { return m_storedHits; }
+
+private:
+    std::string filename(const GlobalId& id) const;
+    std::string storedFilename(const GlobalId& id) const;
+
+    // Write to a uniquely named file which is then renamed into place, so no
+    // process may see a partially written file.
+    bool write(const std::string& path, const std::vector<char>& data);
+    void purge();
+
+    const std::string m_dir;
+    const uint64_t m_maxBytes;
+
+    // Distinguishes our partially written files from those of other
+    // processes sharing this directory.
+    const std::string m_token;
+    std::atomic<uint64_t> m_written{ 0 };
+    mutable std::atomic<uint64_t> m_storedHits{ 0 };
+
+    Pool m_pool;
+};
+
+} // namespace entwine
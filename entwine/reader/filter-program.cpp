@@ -0,0 +1,238 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/filter-program.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    using Mask = FilterProgram::Mask;
+    using Column = FilterProgram::Column;
+
+    template <typename T>
+    void extractAs(
+            const char* pos,
+            const std::size_t pointSize,
+            Column& column)
+    {
+        T v;
+        for (double& d : column)
+        {
+            std::memcpy(&v, pos, sizeof(T));
+            d = v;
+            pos += pointSize;
+        }
+    }
+
+    template <typename Op>
+    void compareAs(const Column& column, const double val, Mask& mask, Op op)
+    {
+        const std::size_t n(column.size());
+        const double* in(column.data());
+        uint8_t* out(mask.data());
+        for (std::size_t i(0); i < n; ++i) out[i] = op(in[i], val);
+    }
+
+    void any(const Column& column, const std::vector<double>& vals, Mask& mask)
+    {
+        const std::size_t n(column.size());
+        const double* in(column.data());
+        uint8_t* out(mask.data());
+
+        std::fill(mask.begin(), mask.end(), 0);
+        for (const double val : vals)
+        {
+            for (std::size_t i(0); i < n; ++i) out[i] |= in[i] == val;
+        }
+    }
+
+    void invert(Mask& mask)
+    {
+        for (uint8_t& v : mask) v = !v;
+    }
+}
+
+std::size_t FilterProgram::column(const pdal::Dimension::Id dim)
+{
+    const auto it(std::find(m_dims.begin(), m_dims.end(), dim));
+    if (it != m_dims.end()) return it - m_dims.begin();
+
+    m_dims.push_back(dim);
+    return m_dims.size() - 1;
+}
+
+void FilterProgram::compare(
+        const pdal::Dimension::Id dim,
+        const ComparisonType type,
+        const std::vector<double>& values)
+{
+    if (isSingle(type) && values.size() != 1)
+    {
+        throw std::runtime_error("Invalid single comparison value");
+    }
+
+    Instruction i;
+    i.code = Code::Compare;
+    i.comparison = type;
+    i.columns.push_back(column(dim));
+    i.values = values;
+    m_program.push_back(i);
+}
+
+void FilterProgram::gate(const LogicalOperator type, const std::size_t count)
+{
+    Instruction i;
+    i.code = Code::Gate;
+    i.logic = type;
+    i.count = count;
+    m_program.push_back(i);
+}
+
+void FilterProgram::within(const Bounds& bounds)
+{
+    Instruction i;
+    i.code = Code::Within;
+    i.columns.push_back(column(pdal::Dimension::Id::X));
+    i.columns.push_back(column(pdal::Dimension::Id::Y));
+    i.columns.push_back(column(pdal::Dimension::Id::Z));
+    i.bounds = bounds;
+    m_program.push_back(i);
+}
+
+void FilterProgram::extract(
+        VectorPointTable& table,
+        const pdal::Dimension::Id dim,
+        Column& column)
+{
+    using Type = pdal::Dimension::Type;
+
+    const pdal::Dimension::Detail* detail(table.layout()->dimDetail(dim));
+    if (!detail)
+    {
+        // Matches PDAL, which reads absent dimensions as zero.
+        std::fill(column.begin(), column.end(), 0);
+        return;
+    }
+
+    const char* pos(table.data().data() + detail->offset());
+    const std::size_t n(table.pointSize());
+
+    switch (detail->type())
+    {
+        case Type::Double:      extractAs<double>(pos, n, column); break;
+        case Type::Float:       extractAs<float>(pos, n, column); break;
+        case Type::Unsigned8:   extractAs<uint8_t>(pos, n, column); break;
+        case Type::Signed8:     extractAs<int8_t>(pos, n, column); break;
+        case Type::Unsigned16:  extractAs<uint16_t>(pos, n, column); break;
+        case Type::Signed16:    extractAs<int16_t>(pos, n, column); break;
+        case Type::Unsigned32:  extractAs<uint32_t>(pos, n, column); break;
+        case Type::Signed32:    extractAs<int32_t>(pos, n, column); break;
+        case Type::Unsigned64:  extractAs<uint64_t>(pos, n, column); break;
+        case Type::Signed64:    extractAs<int64_t>(pos, n, column); break;
+        default: throw std::runtime_error("Invalid filter dimension type");
+    }
+}
+
+void FilterProgram::select(VectorPointTable& table, Mask& selected) const
+{
+    const std::size_t n(table.numPoints());
+
+    std::vector<Column> columns(m_dims.size(), Column(n));
+    for (std::size_t i(0); i < m_dims.size(); ++i)
+    {
+        extract(table, m_dims[i], columns[i]);
+    }
+
+    std::vector<Mask> stack;
+
+    for (const Instruction& ins : m_program)
+    {
+        if (ins.code == Code::Compare)
+        {
+            const Column& c(columns[ins.columns.front()]);
+            stack.emplace_back(n);
+            Mask& m(stack.back());
+
+            const double v(ins.values.empty() ? 0 : ins.values.front());
+
+            switch (ins.comparison)
+            {
+                case ComparisonType::eq:
+                    compareAs(c, v, m, std::equal_to<double>()); break;
+                case ComparisonType::gt:
+                    compareAs(c, v, m, std::greater<double>()); break;
+                case ComparisonType::gte:
+                    compareAs(c, v, m, std::greater_equal<double>()); break;
+                case ComparisonType::lt:
+                    compareAs(c, v, m, std::less<double>()); break;
+                case ComparisonType::lte:
+                    compareAs(c, v, m, std::less_equal<double>()); break;
+                case ComparisonType::ne:
+                    compareAs(c, v, m, std::not_equal_to<double>()); break;
+                case ComparisonType::in:
+                    any(c, ins.values, m); break;
+                case ComparisonType::nin:
+                    any(c, ins.values, m); invert(m); break;
+            }
+        }
+        else if (ins.code == Code::Gate)
+        {
+            if (ins.count > stack.size())
+            {
+                throw std::runtime_error("Invalid filter program");
+            }
+
+            const bool isAnd(ins.logic == LogicalOperator::lAnd);
+            Mask result(n, isAnd ? 1 : 0);
+            uint8_t* out(result.data());
+
+            for (auto it(stack.end() - ins.count); it != stack.end(); ++it)
+            {
+                const uint8_t* in(it->data());
+                if (isAnd) for (std::size_t i(0); i < n; ++i) out[i] &= in[i];
+                else for (std::size_t i(0); i < n; ++i) out[i] |= in[i];
+            }
+
+            if (ins.logic == LogicalOperator::lNor) invert(result);
+
+            stack.resize(stack.size() - ins.count);
+            stack.push_back(std::move(result));
+        }
+        else
+        {
+            const double* x(columns[ins.columns[0]].data());
+            const double* y(columns[ins.columns[1]].data());
+            const double* z(columns[ins.columns[2]].data());
+
+            stack.emplace_back(n);
+            ins.bounds.contains(x, y, z, n, stack.back().data());
+        }
+    }
+
+    if (stack.size() != 1) throw std::runtime_error("Invalid filter program");
+
+    selected = std::move(stack.back());
+    for (std::size_t i(0); i < n; ++i)
+    {
+        if (selected[i] && table.skip(i)) selected[i] = 0;
+    }
+}
+
+} // namespace entwine
+
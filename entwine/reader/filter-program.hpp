@@ -0,0 +1,93 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <pdal/Dimension.hpp>
+
+#include <entwine/reader/comparison.hpp>
+#include <entwine/reader/logic-gate.hpp>
+#include <entwine/types/bounds.hpp>
+
+namespace entwine
+{
+
+class VectorPointTable;
+
+// A filter tree flattened into a postfix program, evaluated over a whole
+// table at a time rather than per point.  Each referenced dimension is first
+// unpacked into a column of doubles, after which every instruction is a tight
+// loop over contiguous columns and byte masks which the compiler may
+// vectorize, with no virtual dispatch or field lookups per point.
+class FilterProgram
+{
+public:
+    using Mask = std::vector<uint8_t>;
+    using Column = std::vector<double>;
+
+    // Push the mask of points satisfying this comparison against the given
+    // value, or any of the given values for $in and $nin.
+    void compare(
+            pdal::Dimension::Id dim,
+            ComparisonType type,
+            const std::vector<double>& values);
+
+    // Replace the topmost count masks with their combination.
+    void gate(LogicalOperator type, std::size_t count);
+
+    // Push the mask of points within these bounds.
+    void within(const Bounds& bounds);
+
+    // Evaluate the program over the points of this table, resulting in a
+    // nonzero entry for each selected point.  Skipped points are never
+    // selected.
+    void select(VectorPointTable& table, Mask& selected) const;
+
+    // Unpack a dimension of every point in this table into a column, which
+    // must already be sized to the table.  Absent dimensions read as zero.
+    static void extract(
+            VectorPointTable& table,
+            pdal::Dimension::Id dim,
+            Column& column);
+
+    // The dimensions referenced by this program.
+    const std::vector<pdal::Dimension::Id>& dims() const { return m_dims; }
+
+private:
+    enum class Code
+    {
+        Compare,
+        Gate,
+        Within
+    };
+
+    struct Instruction
+    {
+        Code code = Code::Compare;
+        ComparisonType comparison = ComparisonType::eq;
+        LogicalOperator logic = LogicalOperator::lAnd;
+        std::vector<std::size_t> columns;
+        std::vector<double> values;
+        std::size_t count = 0;
+        Bounds bounds;
+    };
+
+    std::size_t column(pdal::Dimension::Id dim);
+
+    std::vector<pdal::Dimension::Id> m_dims;
+    std::vector<Instruction> m_program;
+};
+
+} // namespace entwine
+
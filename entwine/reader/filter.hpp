@@ -13,6 +13,7 @@
 #include <string>
 
 #include <entwine/reader/comparison.hpp>
+#include <entwine/reader/filter-program.hpp>
 #include <entwine/reader/logic-gate.hpp>
 #include <entwine/reader/query-params.hpp>
 #include <entwine/types/metadata.hpp>
@@ -38,6 +39,11 @@ public:
     {
         if (j.is_object()) build(m_root, j);
         else if (!j.is_null()) throw std::runtime_error("Invalid filter type");
+        m_bare = !j.is_object() || j.empty();
+
+        m_root.compile(m_program);
+        m_program.within(m_queryBounds);
+        m_program.gate(LogicalOperator::lAnd, 2);
     }
 
     bool check(const pdal::PointRef& pointRef) const
@@ -50,6 +56,39 @@ public:
         return m_queryBounds.overlaps(bounds) && m_root.check(bounds);
     }
 
+    bool check(const DimRanges& ranges) const
+    {
+        return m_root.check(ranges);
+    }
+
+    // True if every point within these bounds is selected, which requires
+    // that there is no attribute filter.
+    bool selectsAll(const Bounds& b) const
+    {
+        if (!m_bare) return false;
+
+        const Bounds& q(m_queryBounds);
+        const bool xy(
+                q.min().x <= b.min().x && b.max().x <= q.max().x &&
+                q.min().y <= b.min().y && b.max().y <= q.max().y);
+
+        if (!q.is3d()) return xy;
+        return xy && q.min().z <= b.min().z && b.max().z <= q.max().z;
+    }
+
+    // Select the points of this table which are within the query bounds and
+    // pass the filter, as a mask with a nonzero entry for each selected point.
+    void select(VectorPointTable& table, FilterProgram::Mask& selected) const
+    {
+        m_program.select(table, selected);
+    }
+
+    // The dimensions needed to select points, including XYZ.
+    const std::vector<pdal::Dimension::Id>& dims() const
+    {
+        return m_program.dims();
+    }
+
     void log() const
     {
         m_root.log("");
@@ -122,6 +161,8 @@ private:
     const Metadata& m_metadata;
     const Bounds m_queryBounds;
     LogicalAnd m_root;
+    FilterProgram m_program;
+    bool m_bare = true;
 };
 
 } // namespace entwine
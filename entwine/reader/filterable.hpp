@@ -16,16 +16,27 @@
 #include <pdal/PointRef.hpp>
 
 #include <entwine/types/bounds.hpp>
+#include <entwine/types/node-stats.hpp>
 
 namespace entwine
 {
 
+class FilterProgram;
+
 class Filterable
 {
 public:
     virtual bool check(const pdal::PointRef& pointRef) const = 0;
     virtual bool check(const Bounds& bounds) const { return true; }
+
+    // Returns false only if no point of a node with these value ranges can
+    // pass.  Dimensions without a recorded range are assumed to match.
+    virtual bool check(const DimRanges& ranges) const { return true; }
     virtual void log(const std::string& pre) const = 0;
+
+    // Append the instructions evaluating this node, which leave its result
+    // as a single mask atop the program's stack.
+    virtual void compile(FilterProgram& program) const = 0;
 };
 
 } // namespace entwine
@@ -0,0 +1,219 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/hedger.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include <entwine/io/io.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    // Latencies are kept for this many recent attempts, and no fetch is
+    // hedged until there are this many.
+    const std::size_t sampleCount(1024);
+    const std::size_t minSamples(64);
+
+    // The threshold is recomputed after this many new samples.
+    const std::size_t recomputeInterval(64);
+}
+
+// The attempts at a single fetch, of which the first to succeed wins.
+struct Hedger::Race
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    Stored result;
+    bool done = false;
+    bool hedgeWon = false;
+    std::size_t attempts = 0;
+    std::size_t failed = 0;
+    std::string error;
+};
+
+Hedger::Hedger(const HedgePolicy policy)
+    : m_policy(policy)
+    , m_pool(policy.threads, policy.threads, false)
+{
+    m_samples.reserve(sampleCount);
+}
+
+Hedger::Stored Hedger::fetch(
+        const void* owner,
+        const DataIo& io,
+        const arbiter::Endpoint& ep,
+        const std::string& name)
+{
+    double threshold(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.fetches;
+        threshold = m_threshold;
+    }
+
+    auto race(std::make_shared<Race>());
+
+    // Without room for even a first attempt, fetch directly.
+    if (!attempt(race, owner, io, ep, name, false))
+    {
+        const TimePoint start(now());
+        Stored stored(io.fetch(ep, name));
+        record(since<std::chrono::microseconds>(start) / 1000.0);
+        return stored;
+    }
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    const auto finished([&race]()
+    {
+        return race->done || race->failed == race->attempts;
+    });
+
+    if (threshold && !race->cv.wait_for(
+                lock,
+                std::chrono::duration<double, std::milli>(threshold),
+                finished))
+    {
+        bool allowed(false);
+        {
+            std::lock_guard<std::mutex> statsLock(m_mutex);
+            if (m_stats.hedges < m_policy.budget * m_stats.fetches)
+            {
+                ++m_stats.hedges;
+                allowed = true;
+            }
+        }
+
+        if (allowed)
+        {
+            lock.unlock();
+            attempt(race, owner, io, ep, name, true);
+            lock.lock();
+        }
+    }
+
+    race->cv.wait(lock, finished);
+
+    if (!race->done) throw std::runtime_error(race->error);
+    if (race->hedgeWon)
+    {
+        std::lock_guard<std::mutex> statsLock(m_mutex);
+        ++m_stats.hedgeWins;
+    }
+    return race->result;
+}
+
+bool Hedger::attempt(
+        std::shared_ptr<Race> race,
+        const void* owner,
+        const DataIo& io,
+        const arbiter::Endpoint& ep,
+        const std::string& name,
+        const bool hedge)
+{
+    {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        ++race->attempts;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_inflight[owner];
+    }
+
+    const bool added(m_pool.tryAdd([this, race, owner, &io, ep, name, hedge]()
+    {
+        const TimePoint start(now());
+        Stored stored;
+        std::string error;
+
+        try { stored = io.fetch(ep, name); }
+        catch (const std::exception& e) { error = e.what(); }
+        catch (...) { error = "Unknown error fetching " + name; }
+
+        if (error.empty())
+        {
+            record(since<std::chrono::microseconds>(start) / 1000.0);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            if (!error.empty())
+            {
+                ++race->failed;
+                race->error = error;
+            }
+            else if (!race->done)
+            {
+                race->result = stored;
+                race->done = true;
+                race->hedgeWon = hedge;
+            }
+        }
+        race->cv.notify_all();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!--m_inflight[owner]) m_inflight.erase(owner);
+        }
+        m_released.notify_all();
+    }));
+
+    if (added) return true;
+
+    {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        --race->attempts;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!--m_inflight[owner]) m_inflight.erase(owner);
+    }
+    m_released.notify_all();
+    return false;
+}
+
+void Hedger::release(const void* owner)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [this, owner]() { return !m_inflight.count(owner); });
+}
+
+void Hedger::record(const double ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_samples.size() < sampleCount) m_samples.push_back(ms);
+    else m_samples[m_next] = ms;
+    m_next = (m_next + 1) % sampleCount;
+
+    if (m_samples.size() < minSamples || m_next % recomputeInterval) return;
+
+    std::vector<double> sorted(m_samples);
+    const std::size_t rank(std::min<std::size_t>(
+                sorted.size() - 1,
+                sorted.size() * m_policy.percentile / 100));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    m_threshold = sorted[rank];
+    m_stats.thresholdMs = m_threshold;
+}
+
+Hedger::Stats Hedger::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+} // namespace entwine
@@ -0,0 +1,111 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+class DataIo;
+
+// A fetch of stored chunk data which hasn't completed within this percentile
+// of recent fetch latencies is issued again, and whichever attempt returns
+// first is taken, so that the slow tail of remote storage doesn't set the
+// latency of every query touching many chunks.  Duplicate attempts are
+// limited to a fraction of all fetches.
+struct HedgePolicy
+{
+    // Between 0 and 100, where 0 disables hedging.
+    double percentile = 0;
+
+    // The most duplicate attempts, as a fraction of fetches.
+    double budget = 0.05;
+
+    // The number of attempts which may be in flight at once.  Fetches
+    // beyond this are made directly, without hedging.
+    std::size_t threads = 16;
+};
+
+class Hedger
+{
+public:
+    using Stored = std::shared_ptr<const std::vector<char>>;
+
+    explicit Hedger(HedgePolicy policy);
+
+    Hedger(const Hedger&) = delete;
+    Hedger& operator=(const Hedger&) = delete;
+
+    // Fetch stored data on behalf of an owner, which must not be destroyed
+    // until release has been called for it, since an attempt which loses may
+    // still be running when the winner returns.
+    Stored fetch(
+            const void* owner,
+            const DataIo& io,
+            const arbiter::Endpoint& ep,
+            const std::string& name);
+
+    // Wait for every attempt on behalf of this owner.
+    void release(const void* owner);
+
+    struct Stats
+    {
+        uint64_t fetches = 0;
+        uint64_t hedges = 0;
+        uint64_t hedgeWins = 0;
+        double thresholdMs = 0;
+    };
+
+    Stats stats() const;
+
+private:
+    struct Race;
+
+    // Returns false if there was no room for this attempt.
+    bool attempt(
+            std::shared_ptr<Race> race,
+            const void* owner,
+            const DataIo& io,
+            const arbiter::Endpoint& ep,
+            const std::string& name,
+            bool hedge);
+
+    void record(double ms);
+
+    const HedgePolicy m_policy;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    std::map<const void*, std::size_t> m_inflight;
+
+    // Recent latencies of successful attempts, in a ring.
+    std::vector<double> m_samples;
+    std::size_t m_next = 0;
+    double m_threshold = 0;     // Zero until we have enough samples.
+    Stats m_stats;
+
+    // Last, so that running attempts finish before anything else is torn
+    // down.
+    Pool m_pool;
+};
+
+} // namespace entwine
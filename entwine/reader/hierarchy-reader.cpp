@@ -0,0 +1,270 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/hierarchy-reader.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <entwine/io/hierarchy.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+HierarchyReader::HierarchyReader(
+        const arbiter::Endpoint& out,
+        const std::string& type,
+        const std::size_t maxPages,
+        const bool stats,
+        const bool packed)
+    : m_ep(out.getSubEndpoint("ept-hierarchy"))
+    , m_statsEp(out.getSubEndpoint("ept-node-stats"))
+    , m_type(type)
+    , m_stats(stats)
+    , m_packed(packed)
+    , m_maxPages(std::max<std::size_t>(maxPages, 1))
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_roots.insert(Dxyz());
+    page(Dxyz());
+}
+
+uint64_t HierarchyReader::count(const Dxyz& p) const
+{
+    const SharedPage current(owner(p));
+    const std::vector<Count>& counts(current->counts);
+
+    const PackedDxyz packed(p);
+    const auto it(std::lower_bound(
+                counts.begin(),
+                counts.end(),
+                packed,
+                [](const Count& a, const PackedDxyz& b)
+                {
+                    return a.first < b;
+                }));
+
+    return it != counts.end() && it->first == packed ? it->second : 0;
+}
+
+DimRanges HierarchyReader::ranges(const Dxyz& p) const
+{
+    if (!m_stats) return DimRanges();
+
+    const SharedPage current(owner(p));
+    const auto it(current->ranges.find(p));
+    return it != current->ranges.end() ? it->second : DimRanges();
+}
+
+HierarchyReader::Extents HierarchyReader::extents(
+        const Dxyz& p,
+        const uint64_t span) const
+{
+    Extents result;
+    if (!m_packed) return result;
+
+    const SharedPage current(owner(p));
+    const std::map<Dxyz, Extent>& extents(current->extents);
+    auto it(extents.find(p));
+    if (it == extents.end()) return result;
+
+    const uint64_t begin(it->second.offset);
+    result.push_back(*it);
+
+    while (
+            ++it != extents.end() &&
+            it->second.offset + it->second.size - begin <= span)
+    {
+        result.push_back(*it);
+    }
+
+    return result;
+}
+
+void HierarchyReader::preload(const std::size_t threads) const
+{
+    std::vector<Dxyz> level;
+    std::size_t loaded(0);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Dxyz& root : m_roots)
+        {
+            if (!m_pages.count(root)) level.push_back(root);
+        }
+        loaded = m_pages.size();
+    }
+
+    Pool pool(threads, 1, false);
+
+    while (level.size() && loaded < m_maxPages)
+    {
+        if (level.size() > m_maxPages - loaded)
+        {
+            level.resize(m_maxPages - loaded);
+        }
+
+        std::vector<Dxyz> next;
+        for (const Dxyz& root : level)
+        {
+            pool.add([this, root, &next]()
+            {
+                Fetched fetched(fetch(root));
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                next.insert(
+                        next.end(),
+                        fetched.roots.begin(),
+                        fetched.roots.end());
+                insert(root, std::move(fetched));
+            });
+        }
+
+        pool.await();
+
+        if (!pool.errors().empty())
+        {
+            throw std::runtime_error(
+                    "Hierarchy preload failed: " + pool.errors().front());
+        }
+
+        loaded += level.size();
+        level = std::move(next);
+    }
+}
+
+HierarchyReader::SharedPage HierarchyReader::owner(const Dxyz& p) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Loading a page may reveal a deeper page root for this key, so repeat
+    // until the page we've loaded is the one that owns it.
+    Dxyz root(pageRoot(p));
+    while (true)
+    {
+        SharedPage current(page(root));
+
+        const Dxyz next(pageRoot(p));
+        if (next == root) return current;
+
+        root = next;
+    }
+}
+
+Dxyz HierarchyReader::pageRoot(const Dxyz& p) const
+{
+    for (uint64_t d(p.d + 1); d-- > 0; )
+    {
+        const uint64_t shift(p.d - d);
+        const Dxyz candidate(
+                d,
+                p.p.x >> shift,
+                p.p.y >> shift,
+                p.p.z >> shift);
+
+        if (m_roots.count(candidate)) return candidate;
+    }
+
+    return Dxyz();
+}
+
+HierarchyReader::SharedPage HierarchyReader::page(const Dxyz& root) const
+{
+    auto it(m_pages.find(root));
+
+    if (it != m_pages.end())
+    {
+        Resident& resident(it->second);
+        m_order.splice(m_order.begin(), m_order, resident.it);
+        return resident.page;
+    }
+
+    return insert(root, fetch(root));
+}
+
+HierarchyReader::Fetched HierarchyReader::fetch(const Dxyz& root) const
+{
+    Fetched fetched;
+    fetched.page = std::make_shared<Page>();
+    Page& page(*fetched.page);
+
+    for (const auto& entry : hierarchy::read(m_ep, root.toString(), m_type))
+    {
+        const Dxyz& key(entry.first);
+        const int64_t n(entry.second);
+
+        if (n < 0) fetched.roots.push_back(key);
+        else page.counts.emplace_back(PackedDxyz(key), n);
+    }
+
+    std::sort(
+            page.counts.begin(),
+            page.counts.end(),
+            [](const Count& a, const Count& b) { return a.first < b.first; });
+    page.counts.shrink_to_fit();
+
+    if (m_stats)
+    {
+        if (const auto data = m_statsEp.tryGet(root.toString() + ".json"))
+        {
+            for (const auto& p : json::parse(*data).items())
+            {
+                page.ranges[Dxyz(p.key())] = p.value().get<DimRanges>();
+            }
+        }
+    }
+
+    // A page may be missing if the build was interrupted before its nodes
+    // were packed, in which case they are read individually.
+    if (m_packed)
+    {
+        if (const auto data = m_ep.tryGet(root.toString() + ".pack.json"))
+        {
+            for (const auto& p : json::parse(*data).items())
+            {
+                Extent& e(page.extents[Dxyz(p.key())]);
+                e.root = root;
+                e.offset = p.value().at(0).get<uint64_t>();
+                e.size = p.value().at(1).get<uint64_t>();
+            }
+        }
+    }
+
+    return fetched;
+}
+
+HierarchyReader::SharedPage HierarchyReader::insert(
+        const Dxyz& root,
+        Fetched fetched) const
+{
+    m_roots.insert(fetched.roots.begin(), fetched.roots.end());
+
+    // A query may have loaded this page while it was being fetched.
+    auto it(m_pages.find(root));
+    if (it != m_pages.end()) return it->second.page;
+
+    while (m_pages.size() >= m_maxPages)
+    {
+        m_pages.erase(m_order.back());
+        m_order.pop_back();
+    }
+
+    m_order.push_front(root);
+
+    Resident resident;
+    resident.page = std::move(fetched.page);
+    resident.it = m_order.begin();
+
+    return m_pages.insert(std::make_pair(root, std::move(resident)))
+        .first->second.page;
+}
+
+} // namespace entwine
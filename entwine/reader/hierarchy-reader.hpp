@@ -12,9 +12,18 @@
 
 #include <cassert>
 #include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/types/node-stats.hpp>
 #include <entwine/util/json.hpp>
 
 namespace entwine
@@ -25,44 +34,112 @@ class Node
 public:
 };
 
+// Hierarchy pages are fetched on demand, as traversal reaches them, and a
+// bounded number of parsed pages are kept in LRU order.  The root page is
+// loaded on construction.
+//
+// Parsed pages are immutable and shared, so lookups within them happen
+// without our lock, and a page evicted during a lookup stays alive until that
+// lookup is done.  Node counts are held in a sorted flat array of packed
+// keys rather than a tree, which is about a quarter of the size and searched
+// without chasing pointers.
 class HierarchyReader
 {
 public:
     using Keys = std::map<Dxyz, uint64_t>;
 
-    HierarchyReader(const arbiter::Endpoint& out)
-        : m_ep(out.getSubEndpoint("ept-hierarchy"))
+    // The byte range of a node packed into the blob of its hierarchy file.
+    struct Extent
     {
-        load();
-    }
+        Dxyz root;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
 
-    uint64_t count(const Dxyz& p) const
-    {
-        const auto it(m_keys.find(p));
-        if (it != m_keys.end()) return it->second;
-        else return 0;
-    }
+    using Extents = std::vector<std::pair<Dxyz, Extent>>;
+
+    // If stats is set, node stats pages are fetched along with each
+    // hierarchy page, and likewise the packed node extents if packed is set.
+    HierarchyReader(
+            const arbiter::Endpoint& out,
+            const std::string& type = "json",
+            std::size_t maxPages = 256,
+            bool stats = false,
+            bool packed = false);
+
+    uint64_t count(const Dxyz& p) const;
+
+    // The recorded value ranges of this node's points, which are empty if
+    // none were recorded.
+    DimRanges ranges(const Dxyz& p) const;
+
+    // The extent of this node, followed by those of the nodes after it in the
+    // same blob while their total span is within the given number of bytes.
+    // Empty if this node isn't packed.
+    Extents extents(const Dxyz& p, uint64_t span = 0) const;
+
+    // Load pages breadth-first, fetching those of each depth concurrently
+    // with the given number of threads, until all of them are resident or our
+    // page limit is reached.  Queries may run while this is in progress.
+    void preload(std::size_t threads) const;
 
 private:
-    // For now, we'll just load everything on init.  This needs to be hooked up
-    // to a caching mechanism.
-    void load(const Dxyz& root = Dxyz())
+    using Count = std::pair<PackedDxyz, uint64_t>;
+
+    struct Page
+    {
+        // Sorted by key.
+        std::vector<Count> counts;
+        std::map<Dxyz, DimRanges> ranges;
+        std::map<Dxyz, Extent> extents;
+    };
+
+    using SharedPage = std::shared_ptr<const Page>;
+
+    struct Resident
     {
-        const json j(json::parse(m_ep.get(root.toString() + ".json")));
-
-        for (const auto& p : j.items())
-        {
-            const std::string str(p.key());
-            const Dxyz key(str);
-            const int64_t n(p.value().get<int64_t>());
-            if (n < 0) load(key);
-            else m_keys[key] = static_cast<uint64_t>(n);
-        }
-    }
+        SharedPage page;
+        std::list<Dxyz>::iterator it;
+    };
+
+    // A page read from storage along with the roots of the pages beneath it,
+    // which has not yet been recorded.
+    struct Fetched
+    {
+        std::shared_ptr<Page> page;
+        std::vector<Dxyz> roots;
+    };
+
+    // The page containing this key, loading it if needed.  Lookups within
+    // the result need no lock.
+    SharedPage owner(const Dxyz& p) const;
+
+    // The root of the page containing this key, given the page roots we know
+    // of so far.
+    Dxyz pageRoot(const Dxyz& p) const;
+
+    // These must be called with our lock held.
+    SharedPage page(const Dxyz& root) const;
+    SharedPage insert(const Dxyz& root, Fetched fetched) const;
+
+    // Read a page, which does not require our lock.
+    Fetched fetch(const Dxyz& root) const;
 
     const arbiter::Endpoint m_ep;
-    Keys m_keys;
+    const arbiter::Endpoint m_statsEp;
+    const std::string m_type;
+    const bool m_stats;
+    const bool m_packed;
+    const std::size_t m_maxPages;
+
+    mutable std::mutex m_mutex;
+
+    // Every page root we have encountered.  This is retained even when those
+    // pages are evicted, so we know where to find them again.
+    mutable std::set<Dxyz> m_roots;
+
+    mutable std::map<Dxyz, Resident> m_pages;
+    mutable std::list<Dxyz> m_order;
 };
 
 } // namespace entwine
-
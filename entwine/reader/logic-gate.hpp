@@ -52,6 +52,9 @@ public:
         m_filters.push_back(std::move(f));
     }
 
+    virtual LogicalOperator type() const = 0;
+    virtual void compile(FilterProgram& program) const override;
+
 protected:
     std::vector<std::unique_ptr<Filterable>> m_filters;
 };
@@ -59,6 +62,11 @@ protected:
 class LogicalAnd : public LogicGate
 {
 public:
+    virtual LogicalOperator type() const override
+    {
+        return LogicalOperator::lAnd;
+    }
+
     virtual bool check(const pdal::PointRef& pointRef) const override
     {
         for (const auto& f : m_filters)
@@ -79,6 +87,16 @@ public:
         return true;
     }
 
+    virtual bool check(const DimRanges& ranges) const override
+    {
+        for (const auto& f : m_filters)
+        {
+            if (!f->check(ranges)) return false;
+        }
+
+        return true;
+    }
+
     virtual void log(const std::string& pre) const override
     {
         if (m_filters.size()) std::cout << pre << "AND" << std::endl;
@@ -89,6 +107,11 @@ public:
 class LogicalOr : public LogicGate
 {
 public:
+    virtual LogicalOperator type() const override
+    {
+        return LogicalOperator::lOr;
+    }
+
     virtual bool check(const pdal::PointRef& pointRef) const override
     {
         for (const auto& f : m_filters)
@@ -109,6 +132,16 @@ public:
         return false;
     }
 
+    virtual bool check(const DimRanges& ranges) const override
+    {
+        for (const auto& f : m_filters)
+        {
+            if (f->check(ranges)) return true;
+        }
+
+        return false;
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << "OR" << std::endl;
@@ -119,6 +152,11 @@ public:
 class LogicalNor : public LogicalOr
 {
 public:
+    virtual LogicalOperator type() const override
+    {
+        return LogicalOperator::lNor;
+    }
+
     using LogicalOr::check;
     virtual bool check(const pdal::PointRef& pointRef) const override
     {
@@ -130,6 +168,13 @@ public:
         return !LogicalOr::check(bounds);
     }
 
+    // A range only tells us whether some point might match, not whether every
+    // point does, so a negation can't rule anything out.
+    virtual bool check(const DimRanges& ranges) const override
+    {
+        return true;
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << "NOR" << std::endl;
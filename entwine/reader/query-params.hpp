@@ -16,6 +16,7 @@
 
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/unique.hpp>
 
@@ -66,6 +67,15 @@ public:
                 q.at("depth").get<uint64_t>() + 1 : q.value("depthEnd", 0),
             q.value("filter", json()))
     {
+        m_budget = q.value("budget", 0);
+        m_resolution = q.value("resolution", 0.0);
+        m_timeout = q.value("timeout", 0.0);
+        m_limit = q.value("limit", 0);
+        if (q.count("origin"))
+        {
+            m_origin = std::make_shared<Point>(q.at("origin").get<Point>());
+        }
+
         if (q.count("depth"))
         {
             if (q.count("depthBegin") || q.count("depthEnd"))
@@ -81,11 +91,31 @@ public:
     std::size_t de() const { return m_depthEnd; }
     const json& filter() const { return m_filter; }
 
+    // Level-of-detail selection.  The budget caps the number of points in
+    // the selected nodes, and the resolution is the coarsest point spacing
+    // beyond which nodes are not refined - each is zero if unset.  If an
+    // origin is given, nodes nearer to it are refined first.
+    uint64_t budget() const { return m_budget; }
+    double resolution() const { return m_resolution; }
+    const Point* origin() const { return m_origin.get(); }
+    bool lod() const { return m_budget || m_resolution > 0; }
+
+    // A query stops early, with partial results, once it has run for timeout
+    // seconds or selected at least limit points - each is zero if unset.
+    double timeout() const { return m_timeout; }
+    uint64_t limit() const { return m_limit; }
+
 private:
     const Bounds m_bounds;
     const std::size_t m_depthBegin = 0;
     const std::size_t m_depthEnd = 0;
     const json m_filter;
+
+    uint64_t m_budget = 0;
+    double m_resolution = 0;
+    double m_timeout = 0;
+    uint64_t m_limit = 0;
+    std::shared_ptr<Point> m_origin;
 };
 
 } // namespace entwine
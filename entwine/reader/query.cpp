@@ -10,11 +10,249 @@
 
 #include <entwine/reader/query.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <future>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+
+#include <pdal/util/Utils.hpp>
+
 #include <entwine/reader/reader.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+    // Upper limit on the result buffer reserved before any points are read,
+    // since the points of the overlapped nodes may far exceed those selected.
+    const uint64_t maxReserveBytes(256 * 1024 * 1024);
+
+    // Upper limit on the number of cells of a grid query.
+    const uint64_t maxGridCells(1 << 28);
+
+    DimId dimOf(const Metadata& m, const json& name)
+    {
+        const DimId id(m.schema().getId(name.get<std::string>()));
+        if (id == DimId::Unknown)
+        {
+            throw std::runtime_error("Unknown dimension: " + name.dump());
+        }
+        return id;
+    }
+
+    // Unless told otherwise, nodes of a grid of means aren't refined beyond
+    // the resolution of its cells.
+    json sampled(json j)
+    {
+        if (j.count("dimension") && !j.count("resolution") &&
+                !j.count("budget"))
+        {
+            j["resolution"] = j.at("cellSize");
+        }
+        return j;
+    }
+
+    // The XY extents of the query bounds, clipped to those of the dataset.
+    Bounds clip(const Bounds& q, const Bounds& d)
+    {
+        return Bounds(
+                std::max(q.min().x, d.min().x),
+                std::max(q.min().y, d.min().y),
+                std::min(q.max().x, d.max().x),
+                std::min(q.max().y, d.max().y));
+    }
+
+    double positive(const double d, const std::string& name)
+    {
+        if (!(d > 0)) throw std::runtime_error("Invalid " + name);
+        return d;
+    }
+
+    // The shared parameters of a batch query, whose bounds are per box.
+    json unbounded(json j)
+    {
+        j.erase("bounds");
+        return j;
+    }
+
+    using Kernel = ReadQuery::Copy::Kernel;
+
+    template<std::size_t N>
+    std::size_t copyAs(
+            const char* src,
+            const std::size_t srcStride,
+            const std::size_t* ids,
+            const std::size_t n,
+            char* dst,
+            const std::size_t dstStride)
+    {
+        for (std::size_t i(0); i < n; ++i, dst += dstStride)
+        {
+            std::memcpy(dst, src + ids[i] * srcStride, N);
+        }
+        return n;
+    }
+
+    // Conversions match PDAL's, which rounds to integers and fails on values
+    // out of range.
+    template<typename From, typename To>
+    std::size_t convertAs(
+            const char* src,
+            const std::size_t srcStride,
+            const std::size_t* ids,
+            const std::size_t n,
+            char* dst,
+            const std::size_t dstStride)
+    {
+        From from;
+        To to;
+        for (std::size_t i(0); i < n; ++i, dst += dstStride)
+        {
+            std::memcpy(&from, src + ids[i] * srcStride, sizeof(From));
+            if (!pdal::Utils::numericCast(from, to)) return i;
+            std::memcpy(dst, &to, sizeof(To));
+        }
+        return n;
+    }
+
+    template<typename From>
+    Kernel converter(const DimType to)
+    {
+        switch (to)
+        {
+            case DimType::Signed8: return convertAs<From, int8_t>;
+            case DimType::Signed16: return convertAs<From, int16_t>;
+            case DimType::Signed32: return convertAs<From, int32_t>;
+            case DimType::Signed64: return convertAs<From, int64_t>;
+            case DimType::Unsigned8: return convertAs<From, uint8_t>;
+            case DimType::Unsigned16: return convertAs<From, uint16_t>;
+            case DimType::Unsigned32: return convertAs<From, uint32_t>;
+            case DimType::Unsigned64: return convertAs<From, uint64_t>;
+            case DimType::Float: return convertAs<From, float>;
+            case DimType::Double: return convertAs<From, double>;
+            default: return nullptr;
+        }
+    }
+
+    Kernel kernel(const DimType from, const DimType to)
+    {
+        if (from == to)
+        {
+            switch (pdal::Dimension::size(to))
+            {
+                case 1: return copyAs<1>;
+                case 2: return copyAs<2>;
+                case 4: return copyAs<4>;
+                case 8: return copyAs<8>;
+                default: return nullptr;
+            }
+        }
+
+        switch (from)
+        {
+            case DimType::Signed8: return converter<int8_t>(to);
+            case DimType::Signed16: return converter<int16_t>(to);
+            case DimType::Signed32: return converter<int32_t>(to);
+            case DimType::Signed64: return converter<int64_t>(to);
+            case DimType::Unsigned8: return converter<uint8_t>(to);
+            case DimType::Unsigned16: return converter<uint16_t>(to);
+            case DimType::Unsigned32: return converter<uint32_t>(to);
+            case DimType::Unsigned64: return converter<uint64_t>(to);
+            case DimType::Float: return converter<float>(to);
+            case DimType::Double: return converter<double>(to);
+            default: return nullptr;
+        }
+    }
+
+    // Copy a dimension of the points at these indices to successive
+    // destinations.  Whatever the kernel can't do is done by PDAL, so that
+    // its errors are unchanged.
+    void apply(
+            const ReadQuery::Copy& copy,
+            const char* src,
+            const std::size_t srcStride,
+            const std::vector<std::size_t>& ids,
+            char* dst,
+            const std::size_t dstStride,
+            pdal::PointRef& pr)
+    {
+        std::size_t i(0);
+        while (i < ids.size())
+        {
+            if (copy.kernel)
+            {
+                i += copy.kernel(
+                        src + copy.srcOffset,
+                        srcStride,
+                        ids.data() + i,
+                        ids.size() - i,
+                        dst + i * dstStride,
+                        dstStride);
+                if (i == ids.size()) break;
+            }
+
+            pr.setPointId(ids[i]);
+            pr.getField(dst + i * dstStride, copy.id, copy.type);
+            ++i;
+        }
+    }
+
+    // Pack a single point by its copy plan.  The point reference must be set
+    // to this point, for any conversions.
+    void pack(
+            const std::vector<ReadQuery::Copy>& copies,
+            const char* point,
+            const pdal::PointRef& pr,
+            char* dst)
+    {
+        const std::size_t zero(0);
+        for (const ReadQuery::Copy& copy : copies)
+        {
+            char* pos(dst + copy.dstOffset);
+            if (!copy.kernel ||
+                    !copy.kernel(point + copy.srcOffset, 0, &zero, 1, pos, 0))
+            {
+                pr.getField(pos, copy.id, copy.type);
+            }
+        }
+    }
+
+    // The union of the output schemas of these readers, by dimension name.
+    Schema unified(const std::vector<const Reader*>& readers)
+    {
+        DimList dims;
+        for (const Reader* r : readers)
+        {
+            for (const DimInfo& d : r->metadata().outSchema().dims())
+            {
+                const auto it(
+                        std::find_if(
+                            dims.begin(),
+                            dims.end(),
+                            [&d](const DimInfo& e)
+                            {
+                                return e.name() == d.name();
+                            }));
+                if (it == dims.end()) dims.push_back(d);
+            }
+        }
+        return Schema(dims);
+    }
+
+    uint64_t cells(const double span, const double size)
+    {
+        if (span < 0) return 0;
+        return std::max<uint64_t>(std::ceil(span / size), 1);
+    }
+}
+
 Query::Query(const Reader& r, const json& j)
     : m_reader(r)
     , m_metadata(r.metadata())
@@ -22,62 +260,485 @@ Query::Query(const Reader& r, const json& j)
     , m_params(j)
     , m_filter(m_metadata, m_params)
     , m_overlaps(overlaps())
+    , m_prefetch(std::max<uint64_t>(j.value("prefetch", 8), 1))
 { }
 
-HierarchyReader::Keys Query::overlaps() const
+Query::Nodes Query::overlaps() const
 {
-    HierarchyReader::Keys keys;
+    Nodes nodes;
+
+    // If the dataset was built with statistics, a filter which no point could
+    // pass selects nothing, without visiting the hierarchy.
+    if (!m_filter.check(m_metadata.dimRanges())) return nodes;
+
     ChunkKey c(m_metadata);
-    overlaps(keys, c);
-    return keys;
+    if (m_params.lod()) refine(nodes, c);
+    else overlaps(nodes, c);
+    return nodes;
 }
 
-void Query::overlaps(HierarchyReader::Keys& keys, const ChunkKey& c) const
+double Query::error(const ChunkKey& c) const
 {
-    if (!m_filter.check(c.bounds())) return;
+    const Bounds& b(c.bounds());
+    const double spacing(b.width() / m_metadata.span());
 
-    const auto k(c.get());
-    const auto count(m_hierarchy.count(k));
-    if (!count) return;
+    const Point* origin(m_params.origin());
+    if (!origin) return spacing;
 
-    if (c.depth() >= m_params.db()) keys[k] = count;
+    // The spacing as seen from the origin, so nearby nodes are refined before
+    // equally coarse ones farther away.
+    const double radius(std::sqrt(b.min().sqDist3d(b.max())) / 2.0);
+    const double distance(std::sqrt(origin->sqDist3d(b.mid())) - radius);
+    return spacing / std::max(distance, spacing);
+}
 
-    if (c.depth() + 1 >= m_params.de()) return;
+void Query::refine(Nodes& nodes, const ChunkKey& root) const
+{
+    // Nodes are visited in order of decreasing error using only hierarchy
+    // counts, so no data is fetched to plan the query.  Insertion order breaks
+    // ties, making the selection deterministic.
+    struct Candidate
+    {
+        double error;
+        uint64_t order;
+        std::shared_ptr<ChunkKey> key;
 
-    for (std::size_t i(0); i < dirEnd(); ++i)
+        bool operator<(const Candidate& other) const
+        {
+            if (error != other.error) return error < other.error;
+            return order > other.order;
+        }
+    };
+
+    std::priority_queue<Candidate> queue;
+    uint64_t order(0);
+    queue.push(Candidate { error(root), order++,
+            std::make_shared<ChunkKey>(root) });
+
+    const uint64_t budget(m_params.budget());
+    const double resolution(m_params.resolution());
+    uint64_t total(0);
+
+    while (!queue.empty())
     {
-        overlaps(keys, c.getStep(toDir(i)));
+        const ChunkKey c(*queue.top().key);
+        queue.pop();
+
+        if (!m_filter.check(c.bounds())) continue;
+
+        const auto k(c.get());
+        const auto count(m_hierarchy.count(k));
+        if (!count) continue;
+
+        if (c.depth() >= m_params.db() && m_filter.check(m_hierarchy.ranges(k)))
+        {
+            // Once a node doesn't fit, stop entirely rather than skipping it -
+            // anything after it would be less important.
+            if (budget && total + count > budget) break;
+
+            nodes.emplace_back(k, count);
+            total += count;
+        }
+
+        // Nodes already at the requested resolution are not refined.
+        const double spacing(c.bounds().width() / m_metadata.span());
+        if (c.depth() + 1 >= m_params.de()) continue;
+        if (resolution > 0 && spacing <= resolution) continue;
+
+        for (std::size_t i(0); i < dirEnd(); ++i)
+        {
+            const ChunkKey next(c.getStep(toDir(i)));
+            queue.push(Candidate { error(next), order++,
+                    std::make_shared<ChunkKey>(next) });
+        }
     }
+
+    // Selected nodes are read in key order, like those of other queries.
+    std::sort(
+            nodes.begin(),
+            nodes.end(),
+            [](const Nodes::value_type& a, const Nodes::value_type& b)
+            {
+                return a.first < b.first;
+            });
 }
 
-void Query::run()
+void Query::overlaps(Nodes& nodes, const ChunkKey& root) const
 {
-    for (const auto& k : m_overlaps)
+    // The existing, overlapping nodes of the current depth, and the children
+    // of those which may have some of their own.  Children are pruned by
+    // their bounds before they are stored.
+    std::vector<ChunkKey> level;
+    std::vector<ChunkKey> next;
+
+    if (m_filter.check(root.bounds())) level.push_back(root);
+
+    while (!level.empty())
     {
-        // For now we're doing one at a time.
-        std::vector<Dxyz> keys;
-        keys.push_back(k.first);
-        auto block(m_reader.cache().acquire(m_reader, keys));
+        for (const ChunkKey& c : level)
+        {
+            const auto k(c.get());
+            const auto count(m_hierarchy.count(k));
+            if (!count) continue;
+
+            // A node's stats cover only its own points, so even if they can't
+            // match, its descendants must still be visited.
+            if (
+                    c.depth() >= m_params.db() &&
+                    m_filter.check(m_hierarchy.ranges(k)))
+            {
+                nodes.emplace_back(k, count);
+            }
+
+            if (c.depth() + 1 >= m_params.de()) continue;
+
+            for (std::size_t i(0); i < dirEnd(); ++i)
+            {
+                const Dir dir(toDir(i));
+                if (!m_filter.check(c.bounds().get(dir))) continue;
+
+                next.push_back(c);
+                next.back().step(dir);
+            }
+        }
+
+        level.swap(next);
+        next.clear();
+    }
+}
+
+bool Query::partial(const Dxyz& key) const
+{
+    if (!m_metadata.subBlockDepth()) return false;
+    return !m_params.bounds().contains(ChunkKey(m_metadata, key).bounds());
+}
+
+void Query::run()
+{
+    // Keep up to m_prefetch chunks being fetched and decoded in the
+    // background while we process the oldest one, in overlap order, on the
+    // calling thread.
+    //
+    // Chunks lying entirely within the query bounds, with no attribute
+    // filter, have every point selected without being checked.
+    //
+    // Chunks are decoded with only the dimensions we need.
+    //
+    // Concurrent queries instead consume each chunk as soon as it is loaded,
+    // on the thread which loaded it.
+    //
+    // Between chunks we check whether to stop early, after which no more
+    // chunks are started and those in flight are not processed.
+    std::vector<DimId> ids(dims());
+    ids.insert(ids.end(), m_filter.dims().begin(), m_filter.dims().end());
+    const Schema& schema(m_reader.projection(ids));
+    const TimePoint start(now());
+
+    // Declared first, so that they outlive any tasks still pending if we
+    // throw.
+    std::atomic<uint64_t> consumed(0);
+    std::atomic<bool> halted(false);
+
+    std::deque<std::pair<bool, std::future<SharedChunkReader>>> pending;
+    auto next(m_overlaps.begin());
 
-        for (auto& chunk : block)
+    const auto fill([&]()
+    {
+        while (
+                pending.size() < m_prefetch &&
+                next != m_overlaps.end() &&
+                !stopped(start, consumed))
         {
-            for (const auto& pr : chunk->table())
+            const Dxyz key(next->first);
+            const uint64_t count(next->second);
+            ++next;
+
+            const ChunkKey ck(m_metadata, key);
+            const bool whole(m_filter.selectsAll(ck.bounds()));
+
+            if (whole && tally(ck, count))
             {
-                maybeProcess(pr);
+                m_points += count;
+                continue;
             }
+
+            const auto task([this, key, whole, &schema, &consumed, &halted]()
+            {
+                if (halted) return SharedChunkReader();
+
+                SharedChunkReader chunk(load(key, schema));
+                if (!concurrent()) return chunk;
+                if (halted) return SharedChunkReader();
+
+                FilterProgram::Mask selected;
+                consumed += consume(*chunk, whole, selected);
+                return SharedChunkReader();
+            });
+
+            pending.emplace_back(whole, std::async(std::launch::async, task));
         }
+    });
+
+    fill();
+
+    FilterProgram::Mask selected;
+
+    while (pending.size() && !stopped(start, consumed))
+    {
+        const bool whole(pending.front().first);
+        SharedChunkReader chunk(pending.front().second.get());
+        pending.pop_front();
+        fill();
+
+        if (chunk) m_points += consume(*chunk, whole, selected);
+    }
+
+    // Wait for any chunks still in flight.
+    halted = true;
+    pending.clear();
+
+    m_points += consumed;
+    finish();
+}
+
+bool Query::stopped(const TimePoint& start, const uint64_t consumed)
+{
+    const double timeout(m_params.timeout());
+    const uint64_t limit(m_params.limit());
+
+    if (
+            m_cancelled ||
+            (timeout > 0 &&
+                since<std::chrono::milliseconds>(start) >= timeout * 1000) ||
+            (limit && m_points + consumed >= limit))
+    {
+        m_complete = false;
+    }
+
+    return !m_complete;
+}
+
+SharedChunkReader Query::load(const Dxyz& key, const Schema& schema) const
+{
+    // A query covering only part of a chunk may be able to read only that
+    // part of it.
+    if (partial(key))
+    {
+        const Bounds& bounds(m_params.bounds());
+        auto chunk(ChunkReader::within(m_reader, key, bounds));
+        if (chunk) return chunk;
     }
+
+    const std::vector<Dxyz> keys { key };
+    return m_reader.cache().acquire(m_reader, keys, schema).front();
 }
 
-void Query::maybeProcess(const pdal::PointRef& pr)
+uint64_t Query::consume(
+        ChunkReader& chunk,
+        const bool whole,
+        FilterProgram::Mask& selected)
 {
-    const Point point(
-            pr.getFieldAs<double>(DimId::X),
-            pr.getFieldAs<double>(DimId::Y),
-            pr.getFieldAs<double>(DimId::Z));
-    if (!m_params.bounds().contains(point) || !m_filter.check(pr)) return;
-    process(pr);
-    ++m_points;
+    // Select the whole chunk at once, then process its selected points.
+    VectorPointTable& table(chunk.table());
+    if (!table.capacity()) return 0;
+
+    if (whole) selected.assign(table.numPoints(), 1);
+    else m_filter.select(table, selected);
+    process(table, selected);
+
+    return std::count_if(
+            selected.begin(),
+            selected.end(),
+            [](uint8_t v) { return v != 0; });
+}
+
+void Query::process(
+        VectorPointTable& table,
+        const FilterProgram::Mask& selected)
+{
+    pdal::PointRef pr(table, 0);
+    for (std::size_t i(0); i < selected.size(); ++i)
+    {
+        if (!selected[i]) continue;
+
+        pr.setPointId(i);
+        process(pr);
+    }
+}
+
+uint64_t Query::maxPoints() const
+{
+    uint64_t np(0);
+    for (const auto& p : m_overlaps) np += p.second;
+    return np;
+}
+
+std::vector<ReadQuery::Copy> ReadQuery::plan(
+        const Schema& schema,
+        VectorPointTable& table)
+{
+    const pdal::PointLayout& layout(*table.layout());
+
+    std::vector<Copy> copies;
+    std::size_t dstOffset(0);
+
+    for (const auto& dimInfo : schema.dims())
+    {
+        Copy c;
+        c.id = dimInfo.id();
+        c.type = dimInfo.type();
+        c.size = dimInfo.size();
+        c.dstOffset = dstOffset;
+        c.srcOffset = 0;
+        c.kernel = nullptr;
+
+        if (const pdal::Dimension::Detail* d = layout.dimDetail(c.id))
+        {
+            c.srcOffset = d->offset();
+            c.kernel = kernel(d->type(), c.type);
+        }
+
+        copies.push_back(c);
+        dstOffset += c.size;
+    }
+
+    return copies;
+}
+
+void ReadQuery::process(
+        VectorPointTable& table,
+        const FilterProgram::Mask& selected)
+{
+    const uint64_t np(
+            std::count_if(
+                selected.begin(),
+                selected.end(),
+                [](uint8_t v) { return v != 0; }));
+    if (!np) return;
+
+    const std::vector<Copy> copies(plan(m_schema, table));
+    const std::size_t srcSize(table.pointSize());
+    const std::size_t dstSize(m_schema.pointSize());
+
+    // Reserve for every point we might select up front, within reason, so
+    // the output is rarely reallocated.  When streaming, only a single chunk
+    // is held at a time.
+    const uint64_t reserve(
+            m_callback ?
+                np :
+                std::min<uint64_t>(maxPoints(), maxReserveBytes / dstSize));
+
+    if (m_columnar && m_columns.empty())
+    {
+        m_columns.resize(copies.size());
+        for (std::size_t c(0); c < copies.size(); ++c)
+        {
+            grow(m_columns[c], reserve * copies[c].size);
+        }
+    }
+    else if (!m_columnar && m_data.empty())
+    {
+        grow(m_data, reserve * dstSize);
+    }
+
+    std::vector<char*> dst(copies.size());
+    if (m_columnar)
+    {
+        for (std::size_t c(0); c < copies.size(); ++c)
+        {
+            std::vector<char>& column(m_columns[c]);
+            column.resize(column.size() + np * copies[c].size);
+            dst[c] = column.data() + column.size() - np * copies[c].size;
+        }
+    }
+    else
+    {
+        m_data.resize(m_data.size() + np * dstSize);
+        char* pos(m_data.data() + m_data.size() - np * dstSize);
+        for (std::size_t c(0); c < copies.size(); ++c)
+        {
+            dst[c] = pos + copies[c].dstOffset;
+        }
+    }
+
+    // Each dimension is copied over every selected point in turn, so its
+    // kernel is dispatched once per chunk rather than once per point.
+    std::vector<std::size_t> ids;
+    ids.reserve(np);
+    for (std::size_t i(0); i < selected.size(); ++i)
+    {
+        if (selected[i]) ids.push_back(i);
+    }
+
+    const char* src(table.data().data());
+    pdal::PointRef pr(table, 0);
+
+    for (std::size_t c(0); c < copies.size(); ++c)
+    {
+        const Copy& copy(copies[c]);
+        apply(
+                copy,
+                src,
+                srcSize,
+                ids,
+                dst[c],
+                m_columnar ? copy.size : dstSize,
+                pr);
+    }
+
+    if (m_callback)
+    {
+        if (m_columnar) flatten();
+        m_callback(m_data, np);
+        m_data.clear();
+    }
+}
+
+ReadQuery::~ReadQuery()
+{
+    m_reader.buffers().give(std::move(m_data));
+    for (auto& column : m_columns) m_reader.buffers().give(std::move(column));
+}
+
+void ReadQuery::grow(std::vector<char>& data, const uint64_t bytes)
+{
+    if (!data.capacity()) data = m_reader.buffers().take(bytes);
+    else data.reserve(bytes);
+}
+
+void ReadQuery::finish()
+{
+    if (m_columnar && !m_callback && !m_arrow) flatten();
+}
+
+void ReadQuery::exportArrow(ArrowArray* array, ArrowSchema* schema)
+{
+    if (!m_arrow) throw std::runtime_error("Query is not set for Arrow");
+
+    // Nothing may have been selected, in which case no columns were made.
+    const DimList& dims(m_schema.dims());
+    m_columns.resize(dims.size());
+    const uint64_t np(
+            dims.empty() ? 0 : m_columns.front().size() / dims.front().size());
+
+    arrow::exportColumns(m_schema, std::move(m_columns), np, array, schema);
+    m_columns.clear();
+}
+
+void ReadQuery::flatten()
+{
+    uint64_t bytes(0);
+    for (const auto& column : m_columns) bytes += column.size();
+
+    grow(m_data, bytes);
+    for (auto& column : m_columns)
+    {
+        m_data.insert(m_data.end(), column.begin(), column.end());
+
+        // Streamed columns are reused for the next chunk.
+        if (m_callback) column.clear();
+        else m_reader.buffers().give(std::move(column));
+    }
 }
 
 void ReadQuery::process(const pdal::PointRef& pr)
@@ -92,5 +753,728 @@ void ReadQuery::process(const pdal::PointRef& pr)
     }
 }
 
-} // namespace entwine
+GridQuery::GridQuery(const Reader& r, const json& j)
+    : Query(r, sampled(j))
+    , m_bounds(clip(m_params.bounds(), m_metadata.boundsConforming()))
+    , m_cellSize(positive(j.at("cellSize").get<double>(), "cellSize"))
+    , m_width(cells(m_bounds.max().x - m_bounds.min().x, m_cellSize))
+    , m_height(cells(m_bounds.max().y - m_bounds.min().y, m_cellSize))
+    , m_dim(j.count("dimension") ?
+            dimOf(m_metadata, j.at("dimension")) : DimId::Unknown)
+{
+    if (m_width && m_height > maxGridCells / m_width)
+    {
+        throw std::runtime_error("Grid too large, increase the cellSize");
+    }
+
+    m_counts.assign(m_width * m_height, 0);
+    if (m_dim != DimId::Unknown) m_sums.assign(m_counts.size(), 0);
+}
 
+int64_t GridQuery::cellOf(const double x, const double y) const
+{
+    const Point& min(m_bounds.min());
+    const Point& max(m_bounds.max());
+    if (x < min.x || y < min.y || x > max.x || y > max.y) return -1;
+
+    // The maximum edges of the grid belong to its last cells.
+    const uint64_t col(
+            std::min<uint64_t>((x - min.x) / m_cellSize, m_width - 1));
+    const uint64_t row(
+            std::min<uint64_t>((y - min.y) / m_cellSize, m_height - 1));
+    return row * m_width + col;
+}
+
+bool GridQuery::tally(const ChunkKey& key, const uint64_t count)
+{
+    if (m_dim != DimId::Unknown) return false;
+
+    const Bounds& b(key.bounds());
+    const int64_t cell(cellOf(b.min().x, b.min().y));
+    if (cell < 0 || cell != cellOf(b.max().x, b.max().y)) return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_counts[cell] += count;
+    return true;
+}
+
+std::vector<DimId> GridQuery::dims() const
+{
+    std::vector<DimId> ids { DimId::X, DimId::Y };
+    if (m_dim != DimId::Unknown) ids.push_back(m_dim);
+    return ids;
+}
+
+void GridQuery::process(
+        VectorPointTable& table,
+        const FilterProgram::Mask& selected)
+{
+    const std::size_t n(table.numPoints());
+    const bool mean(m_dim != DimId::Unknown);
+
+    FilterProgram::Column x(n), y(n), v(mean ? n : 0);
+    FilterProgram::extract(table, DimId::X, x);
+    FilterProgram::extract(table, DimId::Y, y);
+    if (mean) FilterProgram::extract(table, m_dim, v);
+
+    // Aggregate this chunk on its own, then merge it in.
+    std::unordered_map<uint64_t, std::pair<uint64_t, double>> local;
+    for (std::size_t i(0); i < n; ++i)
+    {
+        if (!selected[i]) continue;
+
+        const int64_t cell(cellOf(x[i], y[i]));
+        if (cell < 0) continue;
+
+        auto& c(local[cell]);
+        ++c.first;
+        if (mean) c.second += v[i];
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& p : local)
+    {
+        m_counts[p.first] += p.second.first;
+        if (mean) m_sums[p.first] += p.second.second;
+    }
+}
+
+std::vector<double> GridQuery::means() const
+{
+    std::vector<double> result(m_counts.size(), 0);
+    if (m_sums.empty()) return result;
+
+    for (std::size_t i(0); i < m_counts.size(); ++i)
+    {
+        if (m_counts[i]) result[i] = m_sums[i] / m_counts[i];
+    }
+    return result;
+}
+
+json GridQuery::toJson() const
+{
+    json j {
+        { "bounds", {
+            m_bounds.min().x, m_bounds.min().y,
+            m_bounds.max().x, m_bounds.max().y } },
+        { "cellSize", m_cellSize },
+        { "width", m_width },
+        { "height", m_height },
+        { "counts", m_counts }
+    };
+    if (m_dim != DimId::Unknown) j["means"] = means();
+    return j;
+}
+
+StatsQuery::StatsQuery(const Reader& r, const json& j)
+    : Query(r, j)
+    , m_dim(dimOf(m_metadata, j.at("dimension")))
+    , m_bins(j.count("histogram") ?
+            j.at("histogram").at("bins").get<uint64_t>() : 0)
+    , m_binMin(m_bins ? j.at("histogram").at("min").get<double>() : 0)
+    , m_binMax(m_bins ? j.at("histogram").at("max").get<double>() : 0)
+    , m_histogram(m_bins, 0)
+{
+    if (m_bins) positive(m_binMax - m_binMin, "histogram range");
+}
+
+void StatsQuery::process(
+        VectorPointTable& table,
+        const FilterProgram::Mask& selected)
+{
+    const std::size_t n(table.numPoints());
+    FilterProgram::Column v(n);
+    FilterProgram::extract(table, m_dim, v);
+
+    // Aggregate this chunk on its own, then merge it in.
+    uint64_t count(0);
+    double min(0), max(0), sum(0);
+    std::vector<uint64_t> histogram(m_bins, 0);
+    const double width(m_bins ? (m_binMax - m_binMin) / m_bins : 0);
+
+    for (std::size_t i(0); i < n; ++i)
+    {
+        if (!selected[i]) continue;
+
+        const double d(v[i]);
+        min = count ? std::min(min, d) : d;
+        max = count ? std::max(max, d) : d;
+        sum += d;
+        ++count;
+
+        if (m_bins && d >= m_binMin && d < m_binMax)
+        {
+            const uint64_t bin((d - m_binMin) / width);
+            ++histogram[std::min<uint64_t>(bin, m_bins - 1)];
+        }
+    }
+
+    if (!count) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_min = m_count ? std::min(m_min, min) : min;
+    m_max = m_count ? std::max(m_max, max) : max;
+    m_sum += sum;
+    m_count += count;
+    for (std::size_t i(0); i < m_bins; ++i) m_histogram[i] += histogram[i];
+}
+
+json StatsQuery::toJson() const
+{
+    json j { { "count", m_count } };
+    if (m_count)
+    {
+        j["minimum"] = m_min;
+        j["maximum"] = m_max;
+        j["mean"] = m_sum / m_count;
+    }
+    if (m_bins)
+    {
+        j["histogram"] = {
+            { "min", m_binMin },
+            { "max", m_binMax },
+            { "counts", m_histogram }
+        };
+    }
+    return j;
+}
+
+BatchQuery::BatchQuery(const Reader& r, const json& j)
+    : m_reader(r)
+    , m_metadata(r.metadata())
+    , m_hierarchy(r.hierarchy())
+    , m_params(unbounded(j))
+    , m_schema(j.count("schema") ?
+            Schema(j.at("schema")) : m_metadata.outSchema())
+    , m_prefetch(std::max<uint64_t>(j.value("prefetch", 8), 1))
+{
+    if (m_params.lod() || j.value("columnar", false))
+    {
+        throw std::runtime_error(
+                "Batch queries may not use a budget, resolution, or columnar");
+    }
+
+    const json& bounds(j.at("bounds"));
+    if (!bounds.is_array()) throw std::runtime_error("Invalid batch bounds");
+
+    std::vector<std::size_t> boxes;
+    for (const json& b : bounds)
+    {
+        boxes.push_back(m_boxes.size());
+        m_boxes.push_back(
+                makeUnique<Box>(m_metadata, Bounds(b), m_params.filter()));
+    }
+
+    if (boxes.size()) traverse(ChunkKey(m_metadata), boxes);
+}
+
+void BatchQuery::traverse(
+        const ChunkKey& c,
+        const std::vector<std::size_t>& boxes)
+{
+    std::vector<std::size_t> overlapping;
+    for (const std::size_t b : boxes)
+    {
+        if (m_boxes[b]->filter.check(c.bounds())) overlapping.push_back(b);
+    }
+    if (overlapping.empty()) return;
+
+    const auto k(c.get());
+    if (!m_hierarchy.count(k)) return;
+
+    if (c.depth() >= m_params.db())
+    {
+        const DimRanges& ranges(m_hierarchy.ranges(k));
+
+        std::vector<std::size_t> assigned;
+        for (const std::size_t b : overlapping)
+        {
+            if (m_boxes[b]->filter.check(ranges)) assigned.push_back(b);
+        }
+        if (assigned.size()) m_nodes[k] = assigned;
+    }
+
+    if (c.depth() + 1 >= m_params.de()) return;
+
+    for (std::size_t i(0); i < dirEnd(); ++i)
+    {
+        traverse(c.getStep(toDir(i)), overlapping);
+    }
+}
+
+void BatchQuery::run()
+{
+    // As for a single query, chunks are loaded in the background ahead of
+    // the one being scattered, and decoded with only the dimensions we need.
+    // Every box shares the same filter, so the same filter dimensions.
+    std::vector<DimId> ids;
+    for (const DimInfo& d : m_schema.dims()) ids.push_back(d.id());
+    if (m_boxes.size())
+    {
+        const auto& dims(m_boxes.front()->filter.dims());
+        ids.insert(ids.end(), dims.begin(), dims.end());
+    }
+    const Schema& schema(m_reader.projection(ids));
+
+    std::deque<std::future<SharedChunkReader>> pending;
+    auto next(m_nodes.begin());
+    auto current(m_nodes.begin());
+
+    const auto fill([&]()
+    {
+        while (pending.size() < m_prefetch && next != m_nodes.end())
+        {
+            const std::vector<Dxyz> keys { next->first };
+            ++next;
+
+            const auto task([this, keys, &schema]()
+            {
+                return m_reader.cache().acquire(m_reader, keys, schema).front();
+            });
+
+            pending.push_back(std::async(std::launch::async, task));
+        }
+    });
+
+    fill();
+
+    FilterProgram::Mask selected;
+
+    while (pending.size())
+    {
+        SharedChunkReader chunk(pending.front().get());
+        pending.pop_front();
+        fill();
+
+        const ChunkKey ck(m_metadata, current->first);
+        const std::vector<std::size_t>& boxes(current->second);
+        ++current;
+
+        VectorPointTable& table(chunk->table());
+        if (!table.capacity()) continue;
+
+        const std::vector<ReadQuery::Copy> copies(
+                ReadQuery::plan(m_schema, table));
+
+        for (const std::size_t b : boxes)
+        {
+            Box& box(*m_boxes[b]);
+
+            if (box.filter.selectsAll(ck.bounds()))
+            {
+                selected.assign(table.numPoints(), 1);
+            }
+            else box.filter.select(table, selected);
+
+            scatter(table, copies, selected, box);
+        }
+    }
+}
+
+void BatchQuery::scatter(
+        VectorPointTable& table,
+        const std::vector<ReadQuery::Copy>& copies,
+        const FilterProgram::Mask& selected,
+        Box& box) const
+{
+    const uint64_t np(
+            std::count_if(
+                selected.begin(),
+                selected.end(),
+                [](uint8_t v) { return v != 0; }));
+    if (!np) return;
+
+    const std::size_t srcSize(table.pointSize());
+    const std::size_t dstSize(m_schema.pointSize());
+
+    box.data.resize(box.data.size() + np * dstSize);
+    char* dst(box.data.data() + box.data.size() - np * dstSize);
+    box.points += np;
+
+    const char* src(table.data().data());
+    pdal::PointRef pr(table, 0);
+
+    for (std::size_t i(0); i < selected.size(); ++i)
+    {
+        if (!selected[i]) continue;
+
+        pr.setPointId(i);
+        pack(copies, src + i * srcSize, pr, dst);
+        dst += dstSize;
+    }
+}
+
+MultiQuery::Source::Source(const Reader& r, const QueryParams& params)
+    : reader(r)
+    , filter(r.metadata(), params)
+{ }
+
+MultiQuery::MultiQuery(
+        const std::vector<const Reader*>& readers,
+        const json& j)
+    : m_params(j)
+    , m_schema(j.count("schema") ? Schema(j.at("schema")) : unified(readers))
+    , m_prefetch(std::max<uint64_t>(j.value("prefetch", 8), 1))
+{
+    if (m_params.lod() || j.value("columnar", false))
+    {
+        throw std::runtime_error(
+                "Multi-dataset queries may not use a budget, resolution, or "
+                "columnar");
+    }
+
+    for (const Reader* r : readers)
+    {
+        m_sources.push_back(makeUnique<Source>(*r, m_params));
+        Source& source(*m_sources.back());
+
+        if (source.filter.check(r->metadata().dimRanges()))
+        {
+            traverse(source, ChunkKey(r->metadata()));
+        }
+    }
+}
+
+void MultiQuery::traverse(Source& source, const ChunkKey& c)
+{
+    if (!source.filter.check(c.bounds())) return;
+
+    const auto k(c.get());
+    const HierarchyReader& hierarchy(source.reader.hierarchy());
+    if (!hierarchy.count(k)) return;
+
+    if (c.depth() >= m_params.db() && source.filter.check(hierarchy.ranges(k)))
+    {
+        source.nodes.emplace_back(k, source.filter.selectsAll(c.bounds()));
+    }
+
+    if (c.depth() + 1 >= m_params.de()) return;
+
+    for (std::size_t i(0); i < dirEnd(); ++i)
+    {
+        traverse(source, c.getStep(toDir(i)));
+    }
+}
+
+std::vector<DimId> MultiQuery::dims(const Source& source) const
+{
+    const Schema& full(source.reader.metadata().schema());
+
+    std::vector<DimId> ids(source.filter.dims());
+    for (const DimInfo& d : m_schema.dims())
+    {
+        const DimId id(full.getId(d.name()));
+        if (id != DimId::Unknown) ids.push_back(id);
+    }
+    return ids;
+}
+
+std::vector<ReadQuery::Copy> MultiQuery::plan(VectorPointTable& table) const
+{
+    const pdal::PointLayout& layout(*table.layout());
+
+    std::vector<ReadQuery::Copy> copies;
+    std::size_t dstOffset(0);
+
+    for (const DimInfo& d : m_schema.dims())
+    {
+        const DimId id(layout.findDim(d.name()));
+        if (const pdal::Dimension::Detail* detail = layout.dimDetail(id))
+        {
+            ReadQuery::Copy c;
+            c.id = id;
+            c.type = d.type();
+            c.size = d.size();
+            c.dstOffset = dstOffset;
+            c.srcOffset = detail->offset();
+            c.kernel = kernel(detail->type(), c.type);
+            copies.push_back(c);
+        }
+
+        dstOffset += d.size();
+    }
+
+    return copies;
+}
+
+void MultiQuery::run()
+{
+    // Each source decodes only the dimensions it needs, as for a single
+    // query, so each has its own projection.
+    std::vector<const Schema*> projections;
+    for (const auto& source : m_sources)
+    {
+        projections.push_back(&source->reader.projection(dims(*source)));
+    }
+
+    // Every node of every source, in turn, through one pipeline.
+    struct Node
+    {
+        std::size_t source;
+        Dxyz key;
+        bool whole;
+    };
+
+    std::vector<Node> nodes;
+    for (std::size_t s(0); s < m_sources.size(); ++s)
+    {
+        for (const auto& n : m_sources[s]->nodes)
+        {
+            nodes.push_back(Node { s, n.first, n.second });
+        }
+    }
+
+    std::deque<std::future<SharedChunkReader>> pending;
+    auto next(nodes.begin());
+    auto current(nodes.begin());
+
+    const auto fill([&]()
+    {
+        while (pending.size() < m_prefetch && next != nodes.end())
+        {
+            const Reader& reader(m_sources[next->source]->reader);
+            const Schema& schema(*projections[next->source]);
+            const Dxyz key(next->key);
+            const bool partial(
+                    !next->whole &&
+                    reader.metadata().subBlockDepth() &&
+                    !m_params.bounds().contains(
+                        ChunkKey(reader.metadata(), key).bounds()));
+            ++next;
+
+            const auto task([this, &reader, &schema, key, partial]()
+            {
+                if (partial)
+                {
+                    const Bounds& bounds(m_params.bounds());
+                    SharedChunkReader chunk(
+                            ChunkReader::within(reader, key, bounds));
+                    if (chunk) return chunk;
+                }
+
+                const std::vector<Dxyz> keys { key };
+                return reader.cache().acquire(reader, keys, schema).front();
+            });
+
+            pending.push_back(std::async(std::launch::async, task));
+        }
+    });
+
+    fill();
+
+    FilterProgram::Mask selected;
+    const std::size_t dstSize(m_schema.pointSize());
+
+    while (pending.size())
+    {
+        SharedChunkReader chunk(pending.front().get());
+        pending.pop_front();
+        fill();
+
+        const Node& node(*current);
+        ++current;
+
+        VectorPointTable& table(chunk->table());
+        if (!table.capacity()) continue;
+
+        const Filter& filter(m_sources[node.source]->filter);
+        if (node.whole) selected.assign(table.numPoints(), 1);
+        else filter.select(table, selected);
+
+        const uint64_t np(
+                std::count_if(
+                    selected.begin(),
+                    selected.end(),
+                    [](uint8_t v) { return v != 0; }));
+        if (!np) continue;
+
+        // Newly appended points are zeroed, for any dimensions this chunk
+        // lacks.
+        const std::vector<ReadQuery::Copy> copies(plan(table));
+        m_data.resize(m_data.size() + np * dstSize);
+        char* dst(m_data.data() + m_data.size() - np * dstSize);
+        m_points += np;
+
+        const std::size_t srcSize(table.pointSize());
+        const char* src(table.data().data());
+        pdal::PointRef pr(table, 0);
+
+        for (std::size_t i(0); i < selected.size(); ++i)
+        {
+            if (!selected[i]) continue;
+
+            pr.setPointId(i);
+            pack(copies, src + i * srcSize, pr, dst);
+            dst += dstSize;
+        }
+    }
+}
+
+KnnQuery::KnnQuery(const Reader& r, const json& j)
+    : m_reader(r)
+    , m_metadata(r.metadata())
+    , m_hierarchy(r.hierarchy())
+    , m_params(j)
+    , m_filter(m_metadata, m_params)
+    , m_schema(j.count("schema") ?
+            Schema(j.at("schema")) : m_metadata.outSchema())
+    , m_point(j.at("point").get<Point>())
+    , m_k(j.at("k").get<uint64_t>())
+    , m_maxSqDist(j.count("maxDistance") ?
+            std::pow(j.at("maxDistance").get<double>(), 2) :
+            std::numeric_limits<double>::max())
+    , m_2d(j.value("2d", false))
+{
+    if (m_params.lod() || j.value("columnar", false))
+    {
+        throw std::runtime_error(
+                "Nearest neighbor queries may not use a budget, resolution, "
+                "or columnar");
+    }
+}
+
+double KnnQuery::sqDist(const Bounds& b) const
+{
+    const auto gap([](double v, double min, double max)
+    {
+        return v < min ? min - v : v > max ? v - max : 0;
+    });
+
+    const double x(gap(m_point.x, b.min().x, b.max().x));
+    const double y(gap(m_point.y, b.min().y, b.max().y));
+    const double z(m_2d ? 0 : gap(m_point.z, b.min().z, b.max().z));
+    return x * x + y * y + z * z;
+}
+
+void KnnQuery::run()
+{
+    std::vector<DimId> ids { DimId::X, DimId::Y, DimId::Z };
+    for (const DimInfo& d : m_schema.dims()) ids.push_back(d.id());
+    ids.insert(ids.end(), m_filter.dims().begin(), m_filter.dims().end());
+    const Schema& schema(m_reader.projection(ids));
+
+    // Nearest first, with insertion order breaking ties so the traversal is
+    // deterministic.
+    struct Candidate
+    {
+        double sqDist;
+        uint64_t order;
+        std::shared_ptr<ChunkKey> key;
+
+        bool operator<(const Candidate& other) const
+        {
+            if (sqDist != other.sqDist) return sqDist > other.sqDist;
+            return order > other.order;
+        }
+    };
+
+    std::priority_queue<Candidate> queue;
+    uint64_t order(0);
+    const ChunkKey root(m_metadata);
+    queue.push(Candidate { sqDist(root.bounds()), order++,
+            std::make_shared<ChunkKey>(root) });
+
+    Heap heap;
+    FilterProgram::Mask selected;
+
+    while (!queue.empty() && m_k)
+    {
+        const double d(queue.top().sqDist);
+        const ChunkKey c(*queue.top().key);
+        queue.pop();
+
+        // Nothing in this node, or any after it, can be nearer.
+        if (d > m_maxSqDist) break;
+        if (heap.size() == m_k && d >= heap.top().sqDist) break;
+
+        if (!m_filter.check(c.bounds())) continue;
+
+        const auto k(c.get());
+        if (!m_hierarchy.count(k)) continue;
+
+        if (c.depth() >= m_params.db() && m_filter.check(m_hierarchy.ranges(k)))
+        {
+            const std::vector<Dxyz> keys { k };
+            SharedChunkReader chunk(
+                    m_reader.cache().acquire(m_reader, keys, schema).front());
+
+            VectorPointTable& table(chunk->table());
+            if (table.capacity())
+            {
+                if (m_filter.selectsAll(c.bounds()))
+                {
+                    selected.assign(table.numPoints(), 1);
+                }
+                else m_filter.select(table, selected);
+
+                consume(table, selected, heap);
+            }
+        }
+
+        if (c.depth() + 1 >= m_params.de()) continue;
+
+        for (std::size_t i(0); i < dirEnd(); ++i)
+        {
+            const ChunkKey next(c.getStep(toDir(i)));
+            queue.push(Candidate { sqDist(next.bounds()), order++,
+                    std::make_shared<ChunkKey>(next) });
+        }
+    }
+
+    // Unwind the heap, farthest first, into nearest-first results.
+    const std::size_t pointSize(m_schema.pointSize());
+    m_data.assign(heap.size() * pointSize, 0);
+    m_distances.assign(heap.size(), 0);
+
+    for (std::size_t i(heap.size()); i > 0; --i)
+    {
+        const Neighbor& n(heap.top());
+        m_distances[i - 1] = std::sqrt(n.sqDist);
+        std::copy(
+                n.point.begin(),
+                n.point.end(),
+                m_data.begin() + (i - 1) * pointSize);
+        heap.pop();
+    }
+}
+
+void KnnQuery::consume(
+        VectorPointTable& table,
+        const FilterProgram::Mask& selected,
+        Heap& heap) const
+{
+    const std::size_t n(table.numPoints());
+    FilterProgram::Column x(n), y(n), z(m_2d ? 0 : n);
+    FilterProgram::extract(table, DimId::X, x);
+    FilterProgram::extract(table, DimId::Y, y);
+    if (!m_2d) FilterProgram::extract(table, DimId::Z, z);
+
+    std::vector<ReadQuery::Copy> copies;
+    const char* src(table.data().data());
+    pdal::PointRef pr(table, 0);
+
+    for (std::size_t i(0); i < n; ++i)
+    {
+        if (!selected[i]) continue;
+
+        const double dx(x[i] - m_point.x);
+        const double dy(y[i] - m_point.y);
+        const double dz(m_2d ? 0 : z[i] - m_point.z);
+        const double d(dx * dx + dy * dy + dz * dz);
+
+        if (d > m_maxSqDist) continue;
+        if (heap.size() == m_k && d >= heap.top().sqDist) continue;
+
+        // Planned only once a point makes the cut.
+        if (copies.empty()) copies = ReadQuery::plan(m_schema, table);
+
+        Neighbor neighbor { d, std::vector<char>(m_schema.pointSize()) };
+        pr.setPointId(i);
+        pack(copies, src + i * table.pointSize(), pr, neighbor.point.data());
+
+        heap.push(std::move(neighbor));
+        if (heap.size() > m_k) heap.pop();
+    }
+}
+
+} // namespace entwine
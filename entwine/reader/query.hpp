@@ -10,14 +10,25 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
 #include <entwine/reader/query-params.hpp>
 
+#include <entwine/reader/arrow.hpp>
 #include <entwine/reader/filter.hpp>
 #include <entwine/reader/hierarchy-reader.hpp>
 #include <entwine/reader/chunk-reader.hpp>
 #include <entwine/types/binary-point-table.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/types/schema.hpp>
+#include <entwine/util/time.hpp>
 
 namespace entwine
 {
@@ -34,9 +45,51 @@ public:
 
     uint64_t points() const { return m_points; }
 
+    // Stop this query from any thread.  It is checked between chunks, and
+    // chunks already being loaded are left to finish loading, since other
+    // queries may be waiting on them in the cache, but are not processed.
+    void cancel() { m_cancelled = true; }
+
+    // False if this query stopped early - cancelled, past its timeout, or at
+    // its point limit - in which case its results are partial.
+    bool complete() const { return m_complete; }
+
 protected:
     virtual void process(const pdal::PointRef& pr) { }
 
+    // Process the selected points of a chunk, which by default calls
+    // process() for each one.
+    virtual void process(VectorPointTable& table, const FilterProgram::Mask& s);
+
+    // Called once all chunks have been processed.
+    virtual void finish() { }
+
+    // Called for each node whose points are all selected, before it is read.
+    // Returns true if the node has been accounted for from its hierarchy
+    // count alone, in which case it is not read.
+    virtual bool tally(const ChunkKey& key, uint64_t count) { return false; }
+
+    // If true, the selection and process() of each chunk run on the thread
+    // which fetched it, concurrently with other chunks and in no particular
+    // order, rather than in overlap order on the calling thread.
+    virtual bool concurrent() const { return false; }
+
+    // The dimensions needed by process(), beyond those needed by the filter.
+    // Chunks are decoded with only these, where our data type allows it.
+    virtual std::vector<DimId> dims() const
+    {
+        std::vector<DimId> ids;
+        for (const DimInfo& d : m_metadata.schema().dims())
+        {
+            ids.push_back(d.id());
+        }
+        return ids;
+    }
+
+    // The number of points in the nodes this query will visit, which bounds
+    // the number of points selected.
+    uint64_t maxPoints() const;
+
     const Reader& m_reader;
     const Metadata& m_metadata;
     const HierarchyReader& m_hierarchy;
@@ -44,14 +97,44 @@ protected:
     const Filter m_filter;
 
 private:
-    HierarchyReader::Keys overlaps() const;
-    void overlaps(HierarchyReader::Keys& keys, const ChunkKey& c) const;
+    // Nodes to be read, with their point counts.
+    using Nodes = std::vector<std::pair<Dxyz, uint64_t>>;
+
+    Nodes overlaps() const;
+
+    // Select overlapping nodes breadth-first, so that the nodes of each depth
+    // are fetched together, and siblings are adjacent.
+    void overlaps(Nodes& nodes, const ChunkKey& root) const;
+
+    // Select nodes for a level-of-detail query, coarsest error first, within
+    // the point budget and resolution.
+    void refine(Nodes& nodes, const ChunkKey& root) const;
+    double error(const ChunkKey& c) const;
+
+    // True if this chunk has sub-blocks and the query covers only part of it.
+    bool partial(const Dxyz& key) const;
+
+    SharedChunkReader load(const Dxyz& key, const Schema& schema) const;
 
-    void maybeProcess(const pdal::PointRef& pr);
+    // Select and process the points of a chunk, returning the number
+    // selected.
+    uint64_t consume(
+            ChunkReader& chunk,
+            bool whole,
+            FilterProgram::Mask& selected);
 
-    HierarchyReader::Keys m_overlaps;
+    // True, and marks us incomplete, if we should stop before the next chunk.
+    bool stopped(const TimePoint& start, uint64_t consumed);
+
+    Nodes m_overlaps;
     uint64_t m_points = 0;
-    std::deque<SharedChunkReader> m_chunks;
+
+    std::atomic<bool> m_cancelled { false };
+    bool m_complete = true;
+
+    // Number of chunks to fetch and decode concurrently, ahead of the one
+    // currently being processed.
+    const uint64_t m_prefetch;
 };
 
 class CountQuery : public Query
@@ -60,62 +143,380 @@ public:
     CountQuery(const Reader& reader, const json& j)
         : Query(reader, j)
     { }
+
+protected:
+    // Only the number of selected points is needed.
+    virtual void process(VectorPointTable&, const FilterProgram::Mask&)
+        override
+    { }
+
+    virtual bool tally(const ChunkKey&, uint64_t) override { return true; }
+    virtual std::vector<DimId> dims() const override { return { }; }
 };
 
+// Results are packed in the requested schema, either row by row or, if
+// "columnar" is set, as a contiguous array of every point's value for each
+// dimension in turn.
+//
+// If a callback is given, results are instead streamed to it as each chunk is
+// processed - the data passed holds only that chunk's selected points, laid
+// out as above, and is not retained afterward.  So memory stays bounded by
+// the chunks in flight regardless of the size of the result.
+//
+// If "arrow" is set, the columns are instead kept apart, to be exported
+// without a copy as an Arrow array by exportArrow once the query has run.
 class ReadQuery : public Query
 {
 public:
-    ReadQuery(const Reader& reader, const json& j)
+    using Callback =
+        std::function<void(const std::vector<char>& data, uint64_t points)>;
+
+    ReadQuery(const Reader& reader, const json& j, Callback cb = Callback())
         : Query(reader, j)
         , m_schema(j.count("schema") ?
                 Schema(j.at("schema")) : m_metadata.outSchema())
-    { }
+        , m_arrow(j.value("arrow", false))
+        , m_columnar(m_arrow || j.value("columnar", false))
+        , m_callback(cb)
+    {
+        if (m_arrow && m_callback)
+        {
+            throw std::runtime_error("Arrow results may not be streamed");
+        }
+    }
 
+    // Our buffers are returned to the reader for later queries.
+    ~ReadQuery();
+
+    // The entire result, which is empty if streaming to a callback or if
+    // exporting to Arrow.
     const std::vector<char>& data() const { return m_data; }
 
+    // Move the result into a struct array of one child per dimension of the
+    // output schema, through the Arrow C data interface.  The consumer owns
+    // both structures, and must release them.  May be called only once.
+    void exportArrow(ArrowArray* array, ArrowSchema* schema);
+
+    // How each dimension of an output schema is copied out of a chunk's
+    // points.  Each is planned once per chunk with a kernel for its pair of
+    // types, which copies or converts the dimension over a batch of points.
+    // The kernel returns the number of points done before a value it can't
+    // convert, which is then left to PDAL, as is any dimension with no
+    // kernel.
+    struct Copy
+    {
+        using Kernel = std::size_t (*)(
+                const char* src,
+                std::size_t srcStride,
+                const std::size_t* ids,
+                std::size_t n,
+                char* dst,
+                std::size_t dstStride);
+
+        pdal::Dimension::Id id;
+        pdal::Dimension::Type type;
+        std::size_t size;
+        std::size_t dstOffset;
+        std::size_t srcOffset;
+        Kernel kernel;
+    };
+
+    static std::vector<Copy> plan(
+            const Schema& schema,
+            VectorPointTable& table);
+
 protected:
     virtual void process(const pdal::PointRef& pr) override;
+    virtual void process(
+            VectorPointTable& table,
+            const FilterProgram::Mask& selected) override;
+    virtual void finish() override;
+    virtual std::vector<DimId> dims() const override
+    {
+        std::vector<DimId> ids;
+        for (const DimInfo& d : m_schema.dims()) ids.push_back(d.id());
+        return ids;
+    }
+
+private:
+    // Concatenate the columns into the result.
+    void flatten();
+
+    // Reserve room in a result buffer, which is taken from the reader's pool
+    // if we have none yet.
+    void grow(std::vector<char>& data, uint64_t bytes);
+
+    const Schema m_schema;
+    const bool m_arrow;
+    const bool m_columnar;
+    const Callback m_callback;
+
+    std::vector<char> m_data;
+    std::vector<std::vector<char>> m_columns;
+};
+
+// A raster over the XY extents of the query bounds, or of the dataset if the
+// query is unbounded, with square cells of width "cellSize" starting from the
+// minimum corner.  Each cell holds the number of selected points within it
+// or, if a "dimension" is given, their mean value of that dimension.
+//
+// Counts are exact.  Nodes whose points are all selected and which lie
+// within a single cell are counted from the hierarchy without being read, so
+// the deep nodes below the resolution of the grid are mostly skipped.  Means
+// are of a sample - unless a budget or resolution is given, nodes are not
+// refined beyond a point spacing of the cell size.
+//
+// Chunks are aggregated concurrently and merged.
+class GridQuery : public Query
+{
+public:
+    GridQuery(const Reader& reader, const json& j);
+
+    const Bounds& bounds() const { return m_bounds; }
+    double cellSize() const { return m_cellSize; }
+    uint64_t width() const { return m_width; }
+    uint64_t height() const { return m_height; }
+
+    // Row-major from the minimum corner.
+    const std::vector<uint64_t>& counts() const { return m_counts; }
+
+    // The mean of each cell, or zero for cells without points.
+    std::vector<double> means() const;
+
+    json toJson() const;
+
+protected:
+    virtual bool tally(const ChunkKey& key, uint64_t count) override;
+    virtual bool concurrent() const override { return true; }
+    virtual std::vector<DimId> dims() const override;
+    virtual void process(
+            VectorPointTable& table,
+            const FilterProgram::Mask& selected) override;
 
 private:
-    void setAs(char* dst, double d, pdal::Dimension::Type t)
+    // The cell containing this point, or -1 if it lies outside the grid.
+    int64_t cellOf(double x, double y) const;
+
+    const Bounds m_bounds;
+    const double m_cellSize;
+    const uint64_t m_width;
+    const uint64_t m_height;
+    const DimId m_dim;
+
+    std::mutex m_mutex;
+    std::vector<uint64_t> m_counts;
+    std::vector<double> m_sums;
+};
+
+// The count, minimum, maximum, and mean of a "dimension" over the selected
+// points.  If a "histogram" of { "bins", "min", "max" } is given, the values
+// are also binned into that many bins of equal width over [min, max), and
+// values outside that range are not binned.  For example, per-class counts:
+//
+//      {
+//          "dimension": "Classification",
+//          "histogram": { "bins": 256, "min": 0, "max": 256 }
+//      }
+//
+// Chunks are aggregated concurrently and merged.
+class StatsQuery : public Query
+{
+public:
+    StatsQuery(const Reader& reader, const json& j);
+
+    json toJson() const;
+
+protected:
+    virtual bool concurrent() const override { return true; }
+    virtual std::vector<DimId> dims() const override { return { m_dim }; }
+    virtual void process(
+            VectorPointTable& table,
+            const FilterProgram::Mask& selected) override;
+
+private:
+    const DimId m_dim;
+    const uint64_t m_bins;
+    const double m_binMin;
+    const double m_binMax;
+
+    std::mutex m_mutex;
+    uint64_t m_count = 0;
+    double m_min = 0;
+    double m_max = 0;
+    double m_sum = 0;
+    std::vector<uint64_t> m_histogram;
+};
+
+// Many reads of one dataset at once, one for each entry of "bounds", sharing
+// the other parameters of a ReadQuery aside from level-of-detail selection
+// and "columnar".  Rather than traversing the hierarchy and acquiring chunks
+// once per box, a single traversal assigns each node to the boxes it
+// overlaps, each node is loaded and decoded once, and its selected points are
+// scattered into the result of each of its boxes.
+class BatchQuery
+{
+public:
+    BatchQuery(const Reader& reader, const json& j);
+
+    void run();
+
+    std::size_t size() const { return m_boxes.size(); }
+
+    // The points selected within a box, packed row by row in the requested
+    // schema.
+    const std::vector<char>& data(std::size_t box) const
     {
-        switch (t)
-        {
-            case pdal::Dimension::Type::Double:     setAs<double>(dst, d);
-                break;
-            case pdal::Dimension::Type::Float:      setAs<float>(dst, d);
-                break;
-            case pdal::Dimension::Type::Unsigned8:  setAs<uint8_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Signed8:    setAs<int8_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Unsigned16: setAs<uint16_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Signed16:   setAs<int16_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Unsigned32: setAs<uint32_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Signed32:   setAs<int32_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Unsigned64: setAs<uint64_t>(dst, d);
-                break;
-            case pdal::Dimension::Type::Signed64:   setAs<int64_t>(dst, d);
-                break;
-            default:
-                break;
-        }
+        return m_boxes.at(box)->data;
     }
 
-    template<typename T> void setAs(char* dst, double d)
+    uint64_t points(std::size_t box) const
     {
-        const T v(static_cast<T>(d));
-        auto src(reinterpret_cast<const char*>(&v));
-        std::copy(src, src + sizeof(T), dst);
+        return m_boxes.at(box)->points;
     }
 
+private:
+    struct Box
+    {
+        Box(const Metadata& m, const Bounds& b, const json& j)
+            : filter(m, b, j)
+        { }
+
+        const Filter filter;
+        std::vector<char> data;
+        uint64_t points = 0;
+    };
+
+    // Assign this node and its descendants to those of the given boxes which
+    // they overlap.
+    void traverse(const ChunkKey& c, const std::vector<std::size_t>& boxes);
+
+    void scatter(
+            VectorPointTable& table,
+            const std::vector<ReadQuery::Copy>& copies,
+            const FilterProgram::Mask& selected,
+            Box& box) const;
+
+    const Reader& m_reader;
+    const Metadata& m_metadata;
+    const HierarchyReader& m_hierarchy;
+    const QueryParams m_params;
+    const Schema m_schema;
+    const uint64_t m_prefetch;
+
+    std::vector<std::unique_ptr<Box>> m_boxes;
+
+    // The nodes to read, with the boxes assigned to each.
+    std::map<Dxyz, std::vector<std::size_t>> m_nodes;
+};
+
+// One read across several datasets at once, such as adjacent datasets of
+// different collections, with the parameters of a ReadQuery aside from
+// level-of-detail selection and "columnar".  The overlapping nodes of each
+// dataset are found in its own hierarchy, and then every node is loaded
+// through one pipeline, so nodes of all of the datasets are fetched and
+// decoded concurrently.  Readers constructed with the same Cache share it.
+//
+// Results are packed row by row in the requested "schema", or otherwise in
+// the union of the output schemas of the datasets, with each dimension taking
+// its type from the first dataset which has it.  Dimensions are matched by
+// name, and those which a dataset lacks are zero for its points.
+class MultiQuery
+{
+public:
+    MultiQuery(const std::vector<const Reader*>& readers, const json& j);
+
+    void run();
+
+    uint64_t points() const { return m_points; }
+    const std::vector<char>& data() const { return m_data; }
+    const Schema& schema() const { return m_schema; }
+
+private:
+    struct Source
+    {
+        Source(const Reader& reader, const QueryParams& params);
+
+        const Reader& reader;
+        const Filter filter;
+
+        // Overlapping nodes, with whether all of their points are selected.
+        std::vector<std::pair<Dxyz, bool>> nodes;
+    };
+
+    void traverse(Source& source, const ChunkKey& c);
+
+    // The decoded dimensions needed from this source.
+    std::vector<DimId> dims(const Source& source) const;
+
+    // Copies from a chunk of this source into our schema, by dimension name,
+    // omitting those which the chunk lacks.
+    std::vector<ReadQuery::Copy> plan(VectorPointTable& table) const;
+
+    const QueryParams m_params;
+    const Schema m_schema;
+    const uint64_t m_prefetch;
+
+    std::vector<std::unique_ptr<Source>> m_sources;
+
+    std::vector<char> m_data;
+    uint64_t m_points = 0;
+};
+
+// The "k" points nearest to a "point", optionally within a "maxDistance", of
+// those passing the other parameters of a ReadQuery aside from level-of-detail
+// selection and "columnar".  If "2d" is set, distances are measured in XY.
+//
+// Nodes are visited best-first, in order of the least distance from the point
+// to their bounds, and only while that distance is less than that of the
+// k-th nearest point found so far.  So only the nodes which may still hold
+// nearer points are read.
+class KnnQuery
+{
+public:
+    KnnQuery(const Reader& reader, const json& j);
+
+    void run();
+
+    uint64_t points() const { return m_distances.size(); }
+
+    // The neighbors packed row by row in the requested schema, nearest first.
+    const std::vector<char>& data() const { return m_data; }
+    const std::vector<double>& distances() const { return m_distances; }
+
+private:
+    struct Neighbor
+    {
+        double sqDist;
+        std::vector<char> point;
+
+        bool operator<(const Neighbor& other) const
+        {
+            return sqDist < other.sqDist;
+        }
+    };
+
+    // Farthest first, so the k-th nearest is on top.
+    using Heap = std::priority_queue<Neighbor>;
+
+    double sqDist(const Bounds& b) const;
+    void consume(
+            VectorPointTable& table,
+            const FilterProgram::Mask& selected,
+            Heap& heap) const;
+
+    const Reader& m_reader;
+    const Metadata& m_metadata;
+    const HierarchyReader& m_hierarchy;
+    const QueryParams m_params;
+    const Filter m_filter;
     const Schema m_schema;
+    const Point m_point;
+    const uint64_t m_k;
+    const double m_maxSqDist;
+    const bool m_2d;
 
     std::vector<char> m_data;
+    std::vector<double> m_distances;
 };
 
 } // namespace entwine
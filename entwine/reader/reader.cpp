@@ -10,6 +10,9 @@
 
 #include <entwine/reader/reader.hpp>
 
+#include <algorithm>
+
+#include <entwine/io/io.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -25,10 +28,20 @@ Reader::Reader(
     , m_tmp(m_arbiter->getEndpoint(
                 tmp.size() ? tmp : arbiter::getTempPath()))
     , m_metadata(m_ep)
-    , m_hierarchy(m_ep)
-    , m_cache(makeUnique<Cache>())
+    , m_hierarchy(
+            m_ep,
+            m_metadata.hierarchyType(),
+            256,
+            !m_metadata.nodeStats().empty(),
+            m_metadata.packNodes())
+    , m_cache(cache ? cache : std::make_shared<Cache>())
 { }
 
+Reader::~Reader()
+{
+    m_cache->release(*this);
+}
+
 std::unique_ptr<CountQuery> Reader::count(const json& j) const
 {
     return makeUnique<CountQuery>(*this, j);
@@ -39,5 +52,80 @@ std::unique_ptr<ReadQuery> Reader::read(const json& j) const
     return makeUnique<ReadQuery>(*this, j);
 }
 
+std::unique_ptr<GridQuery> Reader::grid(const json& j) const
+{
+    return makeUnique<GridQuery>(*this, j);
+}
+
+std::unique_ptr<StatsQuery> Reader::stats(const json& j) const
+{
+    return makeUnique<StatsQuery>(*this, j);
+}
+
+json Reader::summary(const json& j) const
+{
+    for (auto it(j.begin()); it != j.end(); ++it)
+    {
+        if (it.key() != "dimension" && it.key() != "timeout") return json();
+    }
+
+    if (!j.count("dimension") || !j.at("dimension").is_string()) return json();
+    const std::string name(j.at("dimension").get<std::string>());
+
+    const DimStatsList stats(m_metadata.dimStats());
+    const DimList& dims(m_metadata.schema().dims());
+    for (std::size_t i(0); i < stats.size(); ++i)
+    {
+        if (dims[i].name() == name)
+        {
+            json s(stats[i].toJson());
+            s["count"] = stats[i].count();
+            return s;
+        }
+    }
+
+    return json();
+}
+
+std::unique_ptr<BatchQuery> Reader::batch(const json& j) const
+{
+    return makeUnique<BatchQuery>(*this, j);
+}
+
+std::unique_ptr<KnnQuery> Reader::knn(const json& j) const
+{
+    return makeUnique<KnnQuery>(*this, j);
+}
+
+std::unique_ptr<ReadQuery> Reader::read(
+        const json& j,
+        ReadQuery::Callback cb) const
+{
+    return makeUnique<ReadQuery>(*this, j, cb);
+}
+
+const Schema& Reader::projection(const std::vector<DimId>& ids) const
+{
+    const Schema& full(m_metadata.schema());
+    if (!m_metadata.dataIo().projects()) return full;
+
+    DimList dims;
+    std::string name;
+    for (const DimInfo& dim : full.dims())
+    {
+        if (!std::count(ids.begin(), ids.end(), dim.id())) continue;
+
+        dims.push_back(dim);
+        name += (name.empty() ? "" : ",") + dim.name();
+    }
+
+    if (dims.size() == full.dims().size()) return full;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_ptr<Schema>& schema(m_projections[name]);
+    if (!schema) schema = makeUnique<Schema>(dims);
+    return *schema;
+}
+
 } // namespace entwine
 
@@ -10,9 +10,13 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include <entwine/reader/buffer-pool.hpp>
 #include <entwine/reader/cache.hpp>
 #include <entwine/reader/hierarchy-reader.hpp>
 #include <entwine/reader/query.hpp>
@@ -24,6 +28,9 @@
 namespace entwine
 {
 
+// A reader is safe for any number of concurrent queries.  Its metadata is
+// immutable once loaded, and its hierarchy, cache, and pool of result buffers
+// each synchronize their own state.
 class Reader
 {
 public:
@@ -33,18 +40,40 @@ public:
             std::shared_ptr<Cache> cache = std::shared_ptr<Cache>(),
             std::shared_ptr<arbiter::Arbiter> a =
                 std::shared_ptr<arbiter::Arbiter>());
+    ~Reader();
 
     std::unique_ptr<CountQuery> count(const json& j) const;
     std::unique_ptr<ReadQuery> read(const json& j) const;
+    std::unique_ptr<GridQuery> grid(const json& j) const;
+    std::unique_ptr<StatsQuery> stats(const json& j) const;
+    std::unique_ptr<BatchQuery> batch(const json& j) const;
+    std::unique_ptr<KnnQuery> knn(const json& j) const;
+
+    // A query which streams its results to the callback, chunk by chunk, as
+    // it runs.
+    std::unique_ptr<ReadQuery> read(
+            const json& j,
+            ReadQuery::Callback cb) const;
+
+    // The result of a stats query over the whole dataset, without bounds,
+    // filter, depth limits, or histogram, from the statistics recorded while
+    // building.  Null if the query is any narrower or nothing was recorded.
+    json summary(const json& j) const;
 
     const Metadata& metadata() const { return m_metadata; }
     const HierarchyReader& hierarchy() const { return m_hierarchy; }
     const arbiter::Endpoint& ep() const { return m_ep; }
     const arbiter::Endpoint& tmp() const { return m_tmp; }
     Cache& cache() const { return *m_cache; }
+    BufferPool& buffers() const { return m_buffers; }
 
     std::string path() const { return ep().prefixedRoot(); }
 
+    // The absolute schema reduced to the given dimensions, if our data type
+    // can decode only those, or otherwise the absolute schema itself.  The
+    // result remains valid for the lifetime of this reader.
+    const Schema& projection(const std::vector<DimId>& ids) const;
+
 private:
     std::shared_ptr<arbiter::Arbiter> m_arbiter;
     arbiter::Endpoint m_ep;
@@ -53,7 +82,11 @@ private:
     const Metadata m_metadata;
     const HierarchyReader m_hierarchy;
 
-    std::unique_ptr<Cache> m_cache;
+    std::shared_ptr<Cache> m_cache;
+    mutable BufferPool m_buffers;
+
+    mutable std::mutex m_mutex;
+    mutable std::map<std::string, std::unique_ptr<Schema>> m_projections;
 };
 
 } // namespace entwine
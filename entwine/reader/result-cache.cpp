@@ -0,0 +1,77 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/result-cache.hpp>
+
+#include <utility>
+
+namespace entwine
+{
+
+std::string ResultCache::key(const std::string& dataset, json query)
+{
+    query.erase("timeout");
+    return dataset + '\n' + query.dump();
+}
+
+ResultCache::Result ResultCache::get(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto it(m_entries.find(key));
+    if (it == m_entries.end())
+    {
+        ++m_misses;
+        return Result();
+    }
+
+    ++m_hits;
+    m_list.splice(m_list.begin(), m_list, it->second);
+    return it->second->data;
+}
+
+void ResultCache::put(const std::string& key, std::string&& data)
+{
+    const std::size_t bytes(key.size() + data.size());
+    if (bytes > m_maxBytes) return;
+
+    Result result(std::make_shared<const std::string>(std::move(data)));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Identical queries may have raced to fill the same entry.
+    if (m_entries.count(key)) return;
+
+    m_list.push_front(Entry { key, result });
+    m_entries[key] = m_list.begin();
+    m_bytes += bytes;
+
+    while (m_bytes > m_maxBytes)
+    {
+        const Entry& last(m_list.back());
+        m_bytes -= last.key.size() + last.data->size();
+        m_entries.erase(last.key);
+        m_list.pop_back();
+    }
+}
+
+ResultCache::Stats ResultCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Stats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.entries = m_list.size();
+    stats.bytes = m_bytes;
+    return stats;
+}
+
+} // namespace entwine
@@ -0,0 +1,82 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// The encoded results of complete read queries, so that repeated identical
+// requests - like the hot tiles of map clients - are served without being
+// run.  Results are keyed by the dataset and a canonical form of the query,
+// and the least recently used are evicted past maxBytes.
+class ResultCache
+{
+public:
+    using Result = std::shared_ptr<const std::string>;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit ResultCache(std::size_t maxBytes) : m_maxBytes(maxBytes) { }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Object keys are dumped in sorted order, so queries differing only in
+    // the order of their keys, or in their timeout, share a key.  A dataset
+    // is immutable while it is served, so its name stands for its version.
+    static std::string key(const std::string& dataset, json query);
+
+    std::size_t maxBytes() const { return m_maxBytes; }
+
+    // Null if there is no result for this key.
+    Result get(const std::string& key);
+
+    // Results larger than our entire budget are not kept.
+    void put(const std::string& key, std::string&& data);
+
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        Result data;
+    };
+
+    using List = std::list<Entry>;
+
+    const std::size_t m_maxBytes;
+
+    mutable std::mutex m_mutex;
+    List m_list;    // Most recently used first.
+    std::unordered_map<std::string, List::iterator> m_entries;
+    std::size_t m_bytes = 0;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+} // namespace entwine
@@ -0,0 +1,757 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/server.hpp>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    const std::size_t maxHeaderSize(64 * 1024);
+    const std::size_t maxBodySize(16 * 1024 * 1024);
+
+    // A failure to be reported to the client with the given status.
+    class HttpError : public std::runtime_error
+    {
+    public:
+        HttpError(int code, std::string message)
+            : std::runtime_error(message)
+            , code(code)
+        { }
+
+        const int code;
+    };
+
+    // A failure after which nothing more may be sent, because the client is
+    // gone or our response has already begun.
+    class Abort : public std::runtime_error
+    {
+    public:
+        Abort(std::string message) : std::runtime_error(message) { }
+    };
+
+    std::string reason(const int code)
+    {
+        switch (code)
+        {
+            case 200: return "OK";
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 408: return "Request Timeout";
+            case 413: return "Payload Too Large";
+            default: return "Internal Server Error";
+        }
+    }
+
+    void sendAll(const int fd, const char* data, std::size_t size)
+    {
+        while (size)
+        {
+            const ssize_t n(::send(fd, data, size, 0));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw Abort("Client disconnected");
+
+            data += n;
+            size -= n;
+        }
+    }
+
+    void sendAll(const int fd, const std::string& s)
+    {
+        sendAll(fd, s.data(), s.size());
+    }
+
+    // Bound each blocking receive and send on a connection, so that idle or
+    // stalled clients can't hold our threads indefinitely.
+    void setTimeouts(const int fd, const double seconds)
+    {
+        timeval t;
+        t.tv_sec = static_cast<time_t>(seconds);
+        t.tv_usec = static_cast<suseconds_t>(
+                (seconds - std::floor(seconds)) * 1000000);
+
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t));
+    }
+
+    std::string header(
+            const int code,
+            const std::string& type,
+            const std::string& length)
+    {
+        return
+            "HTTP/1.1 " + std::to_string(code) + " " + reason(code) + "\r\n" +
+            "Content-Type: " + type + "\r\n" +
+            length + "\r\n" +
+            "Connection: close\r\n\r\n";
+    }
+
+    void sendBody(
+            const int fd,
+            const int code,
+            const std::string& type,
+            const std::string& body)
+    {
+        sendAll(
+                fd,
+                header(
+                    code,
+                    type,
+                    "Content-Length: " + std::to_string(body.size())) +
+                body);
+    }
+
+    // Splits a path like "/name/op?x=y" into its segments, without the
+    // query string.
+    std::vector<std::string> segments(std::string path)
+    {
+        path = path.substr(0, path.find('?'));
+
+        std::vector<std::string> result;
+        std::istringstream stream(path);
+        std::string s;
+        while (std::getline(stream, s, '/')) if (s.size()) result.push_back(s);
+        return result;
+    }
+
+    uint64_t contentLength(const std::string& headers)
+    {
+        std::istringstream stream(headers);
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            const auto colon(line.find(':'));
+            if (colon == std::string::npos) continue;
+
+            std::string name(line.substr(0, colon));
+            for (char& c : name) c = std::tolower(c);
+            if (name != "content-length") continue;
+
+            try
+            {
+                return std::stoull(line.substr(colon + 1));
+            }
+            catch (...)
+            {
+                throw HttpError(400, "Invalid Content-Length");
+            }
+        }
+        return 0;
+    }
+
+    std::shared_ptr<DiskCache> makeDiskCache(const json& config)
+    {
+        const std::string dir(config.value("diskCache", std::string()));
+        if (dir.empty()) return std::shared_ptr<DiskCache>();
+
+        return std::make_shared<DiskCache>(
+                dir,
+                config.value("diskCacheSize", 16 * 1024 * 1024 * 1024ull));
+    }
+
+    PrefetchPolicy makePrefetchPolicy(const json& config)
+    {
+        PrefetchPolicy policy;
+        policy.children = config.value("prefetchChildren", policy.children);
+        policy.threads = config.value("prefetchThreads", policy.threads);
+        policy.maxBytes = config.value("prefetchSize", policy.maxBytes);
+        return policy;
+    }
+
+    HedgePolicy makeHedgePolicy(const json& config)
+    {
+        HedgePolicy policy;
+        policy.percentile = config.value("hedgePercentile", policy.percentile);
+        policy.budget = config.value("hedgeBudget", policy.budget);
+        if (policy.percentile < 0 || policy.percentile >= 100)
+        {
+            throw std::runtime_error("Invalid hedgePercentile");
+        }
+        return policy;
+    }
+}
+
+Server::Server(const json& config)
+    : m_arbiter(std::make_shared<arbiter::Arbiter>(
+                config.value("arbiter", json()).dump()))
+    , m_cache(std::make_shared<Cache>(
+                config.value("cacheSize", 1024 * 1024 * 1024ull),
+                makeDiskCache(config),
+                config.value("compressedCacheSize", 0ull),
+                makePrefetchPolicy(config),
+                makeHedgePolicy(config)))
+    , m_port(config.value("port", 8080))
+    , m_timeout(config.value("timeout", 0.0))
+    , m_ioTimeout(config.value("ioTimeout", 30.0))
+    , m_pool(config.value("threads", 8), 1, false)
+{
+    const json datasets(config.value("datasets", json::object()));
+    if (!datasets.is_object() || datasets.empty())
+    {
+        throw std::runtime_error("No datasets to serve");
+    }
+
+    // Datasets are independent, so they are opened concurrently.
+    const std::string tmp(config.value("tmp", std::string()));
+    std::map<std::string, std::future<std::unique_ptr<Reader>>> opening;
+    for (auto it(datasets.begin()); it != datasets.end(); ++it)
+    {
+        const std::string path(it.value().get<std::string>());
+        opening[it.key()] = std::async(std::launch::async, [this, path, tmp]()
+        {
+            return makeUnique<Reader>(path, tmp, m_cache, m_arbiter);
+        });
+    }
+    for (auto& p : opening) m_readers[p.first] = p.second.get();
+
+    if (const uint64_t bytes = config.value("resultCacheSize", 0ull))
+    {
+        m_results = makeUnique<ResultCache>(bytes);
+    }
+
+    // Hierarchies are warmed in the background so we may begin serving
+    // immediately.
+    if (config.value("preload", false))
+    {
+        const std::size_t threads(config.value("threads", 8));
+        m_preload = std::thread([this, threads]()
+        {
+            for (const auto& p : m_readers)
+            {
+                try
+                {
+                    p.second->hierarchy().preload(threads);
+                }
+                catch (std::exception& e)
+                {
+                    std::cout << "Preload of " << p.first << " failed: " <<
+                        e.what() << std::endl;
+                }
+            }
+        });
+    }
+}
+
+Server::~Server()
+{
+    if (m_preload.joinable()) m_preload.join();
+}
+
+void Server::serve()
+{
+    // Clients which disconnect mid-response are handled as send errors.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listener(::socket(AF_INET, SOCK_STREAM, 0));
+    if (listener < 0) throw std::runtime_error("Could not create socket");
+
+    const int on(1);
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(m_port);
+
+    if (
+            ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+            || ::listen(listener, 128))
+    {
+        ::close(listener);
+        throw std::runtime_error(
+                "Could not listen on port " + std::to_string(m_port) + ": " +
+                std::strerror(errno));
+    }
+
+    while (true)
+    {
+        const int fd(::accept(listener, nullptr, nullptr));
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::cout << "Accept failed: " << std::strerror(errno) <<
+                std::endl;
+            continue;
+        }
+
+        if (m_ioTimeout > 0) setTimeouts(fd, m_ioTimeout);
+
+        // Blocks while every thread is busy and one connection is queued,
+        // which our timeouts bound.
+        m_pool.add([this, fd]() { handle(fd); });
+    }
+}
+
+void Server::handle(const int fd)
+{
+    ++m_active;
+    ++m_requests;
+
+    // Each receive is bounded by our socket timeouts, and the whole request,
+    // however slowly it trickles in, by this deadline.
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline(
+            Clock::now() + std::chrono::milliseconds(
+                static_cast<int64_t>(m_ioTimeout * 1000)));
+
+    char buffer[4096];
+    const auto receive([&]()
+    {
+        while (true)
+        {
+            const ssize_t n(::recv(fd, buffer, sizeof(buffer), 0));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                throw HttpError(408, "Request timed out");
+            }
+            if (n <= 0) throw Abort("Client disconnected");
+            if (m_ioTimeout > 0 && Clock::now() > deadline)
+            {
+                throw HttpError(408, "Request timed out");
+            }
+            return static_cast<std::size_t>(n);
+        }
+    });
+
+    const auto fail([this, fd](const int code, const std::string& message)
+    {
+        ++m_errors;
+        try
+        {
+            const json body { { "error", message } };
+            sendBody(fd, code, "application/json", body.dump());
+        }
+        catch (...) { }
+    });
+
+    try
+    {
+        std::string data;
+        std::size_t end(std::string::npos);
+
+        while ((end = data.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (data.size() > maxHeaderSize)
+            {
+                throw HttpError(413, "Request header too large");
+            }
+
+            data.append(buffer, receive());
+        }
+
+        Request req;
+        const std::string headers(data.substr(0, end));
+        std::istringstream(headers) >> req.method >> req.path;
+
+        const uint64_t length(contentLength(headers));
+        if (length > maxBodySize) throw HttpError(413, "Request too large");
+
+        req.body = data.substr(end + 4);
+        while (req.body.size() < length) req.body.append(buffer, receive());
+        req.body.resize(length);
+
+        respond(fd, req);
+    }
+    catch (HttpError& e)
+    {
+        fail(e.code, e.what());
+    }
+    catch (Abort&)
+    {
+        // The client is gone, or our response was cut short.
+        ++m_errors;
+    }
+    catch (std::exception& e)
+    {
+        fail(500, e.what());
+    }
+    catch (...)
+    {
+        fail(500, "Unknown error");
+    }
+
+    ::close(fd);
+    --m_active;
+}
+
+void Server::respond(const int fd, const Request& req)
+{
+    const std::vector<std::string> path(segments(req.path));
+
+    if (path.size() == 1 && path[0] == "metrics")
+    {
+        if (req.method != "GET") throw HttpError(405, "Expected GET");
+        sendBody(fd, 200, "text/plain", toPrometheus(metrics()));
+        return;
+    }
+
+    if (path.size() == 1 && path[0] == "datasets")
+    {
+        if (req.method != "GET") throw HttpError(405, "Expected GET");
+        json names(json::array());
+        for (const auto& p : m_readers) names.push_back(p.first);
+        sendBody(fd, 200, "application/json", names.dump());
+        return;
+    }
+
+    const bool multi(path.size() == 1 && path[0] == "multi");
+    if (!multi && path.size() != 2)
+    {
+        throw HttpError(404, "Not found: " + req.path);
+    }
+    if (req.method != "POST") throw HttpError(405, "Expected POST");
+
+    json query;
+    try
+    {
+        query = req.body.size() ? json::parse(req.body) : json::object();
+    }
+    catch (std::exception& e)
+    {
+        throw HttpError(400, std::string("Invalid query: ") + e.what());
+    }
+
+    if (!query.is_object()) throw HttpError(400, "Invalid query");
+    if (m_timeout > 0 && !query.count("timeout")) query["timeout"] = m_timeout;
+
+    if (multi)
+    {
+        std::unique_ptr<MultiQuery> q;
+        try
+        {
+            const json names(query.value("datasets", json::array()));
+            if (!names.is_array() || names.empty())
+            {
+                throw std::runtime_error("Expected an array of datasets");
+            }
+
+            std::vector<const Reader*> readers;
+            for (const json& name : names)
+            {
+                readers.push_back(&reader(name.get<std::string>()));
+            }
+
+            query.erase("datasets");
+            q = makeUnique<MultiQuery>(readers, query);
+            q->run();
+        }
+        catch (HttpError&)
+        {
+            throw;
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        // The point count, then the points.
+        const uint64_t np(q->points());
+        const std::vector<char>& data(q->data());
+
+        std::string body;
+        body.append(reinterpret_cast<const char*>(&np), sizeof(np));
+        body.append(data.data(), data.size());
+
+        sendBody(fd, 200, "application/octet-stream", body);
+        return;
+    }
+
+    const Reader& r(reader(path[0]));
+    const std::string& op(path[1]);
+
+    if (op == "count")
+    {
+        std::unique_ptr<CountQuery> q;
+        try
+        {
+            q = r.count(query);
+            q->run();
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        const json body {
+            { "points", q->points() },
+            { "complete", q->complete() }
+        };
+        sendBody(fd, 200, "application/json", body.dump());
+    }
+    else if (op == "grid")
+    {
+        std::unique_ptr<GridQuery> q;
+        try
+        {
+            q = r.grid(query);
+            q->run();
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        json body(q->toJson());
+        body["complete"] = q->complete();
+        sendBody(fd, 200, "application/json", body.dump());
+    }
+    else if (op == "stats")
+    {
+        json summary(r.summary(query));
+        if (!summary.is_null())
+        {
+            summary["complete"] = true;
+            sendBody(fd, 200, "application/json", summary.dump());
+            return;
+        }
+
+        std::unique_ptr<StatsQuery> q;
+        try
+        {
+            q = r.stats(query);
+            q->run();
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        json body(q->toJson());
+        body["complete"] = q->complete();
+        sendBody(fd, 200, "application/json", body.dump());
+    }
+    else if (op == "batch")
+    {
+        std::unique_ptr<BatchQuery> q;
+        try
+        {
+            q = r.batch(query);
+            q->run();
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        // Each box in turn, as its point count followed by its points.
+        std::string body;
+        for (std::size_t i(0); i < q->size(); ++i)
+        {
+            const uint64_t np(q->points(i));
+            const std::vector<char>& data(q->data(i));
+            body.append(reinterpret_cast<const char*>(&np), sizeof(np));
+            body.append(data.data(), data.size());
+        }
+
+        sendBody(fd, 200, "application/octet-stream", body);
+    }
+    else if (op == "knn")
+    {
+        std::unique_ptr<KnnQuery> q;
+        try
+        {
+            q = r.knn(query);
+            q->run();
+        }
+        catch (std::exception& e)
+        {
+            throw HttpError(400, e.what());
+        }
+
+        // The point count, then the distance of each point, then the points.
+        const uint64_t np(q->points());
+        const std::vector<double>& distances(q->distances());
+        const std::vector<char>& data(q->data());
+
+        std::string body;
+        body.append(reinterpret_cast<const char*>(&np), sizeof(np));
+        body.append(
+                reinterpret_cast<const char*>(distances.data()),
+                distances.size() * sizeof(double));
+        body.append(data.data(), data.size());
+
+        sendBody(fd, 200, "application/octet-stream", body);
+    }
+    else if (op == "read") read(fd, r, query);
+    else throw HttpError(404, "Not found: " + req.path);
+}
+
+void Server::read(const int fd, const Reader& r, const json& query)
+{
+    const std::string key(m_results ? ResultCache::key(r.path(), query) : "");
+    if (m_results)
+    {
+        if (ResultCache::Result result = m_results->get(key))
+        {
+            sendAll(
+                    fd,
+                    header(
+                        200,
+                        "application/octet-stream",
+                        "Content-Length: " + std::to_string(result->size()) +
+                        "\r\nX-Entwine-Complete: true") +
+                    *result);
+            m_bytesSent += result->size();
+            return;
+        }
+    }
+
+    // While it fits, the result is also kept to be cached if it completes.
+    bool started(false);
+    bool keep(!!m_results);
+    std::string kept;
+
+    auto stream([&](const std::vector<char>& data, uint64_t)
+    {
+        if (data.empty()) return;
+
+        if (keep && kept.size() + data.size() <= m_results->maxBytes())
+        {
+            kept.append(data.data(), data.size());
+        }
+        else
+        {
+            keep = false;
+            std::string().swap(kept);
+        }
+
+        if (!started)
+        {
+            sendAll(
+                    fd,
+                    header(
+                        200,
+                        "application/octet-stream",
+                        "Transfer-Encoding: chunked\r\n"
+                        "Trailer: X-Entwine-Complete"));
+            started = true;
+        }
+
+        std::ostringstream size;
+        size << std::hex << data.size() << "\r\n";
+        sendAll(fd, size.str());
+        sendAll(fd, data.data(), data.size());
+        sendAll(fd, "\r\n");
+        m_bytesSent += data.size();
+    });
+
+    std::unique_ptr<ReadQuery> q;
+    try
+    {
+        q = r.read(query, stream);
+        q->run();
+    }
+    catch (std::exception& e)
+    {
+        // Once the response has begun, all we can do is cut it short.
+        if (started) throw Abort(e.what());
+        throw HttpError(400, e.what());
+    }
+
+    const std::string complete(
+            std::string("X-Entwine-Complete: ") +
+            (q->complete() ? "true" : "false"));
+
+    if (!started)
+    {
+        sendAll(
+                fd,
+                header(
+                    200,
+                    "application/octet-stream",
+                    "Content-Length: 0\r\n" + complete));
+    }
+    else sendAll(fd, "0\r\n" + complete + "\r\n\r\n");
+
+    if (keep && q->complete()) m_results->put(key, std::move(kept));
+}
+
+const Reader& Server::reader(const std::string& name) const
+{
+    const auto it(m_readers.find(name));
+    if (it == m_readers.end()) throw HttpError(404, "No dataset: " + name);
+    return *it->second;
+}
+
+json Server::metrics() const
+{
+    const Cache::Stats cache(m_cache->stats());
+
+    json j(Metrics::get().toJson());
+    j["cache"] = {
+        { "hits", cache.hits },
+        { "misses", cache.misses },
+        { "diskHits", cache.diskHits },
+        { "diskStoredHits", cache.diskStoredHits },
+        { "compressedHits", cache.compressedHits },
+        { "evictions", cache.evictions },
+        { "bytes", cache.bytes },
+        { "compressedBytes", cache.compressedBytes },
+        { "prefetches", cache.prefetches },
+        { "prefetchHits", cache.prefetchHits },
+        { "prefetchWasted", cache.prefetchWasted }
+    };
+    if (const Hedger* hedger = m_cache->hedger())
+    {
+        const Hedger::Stats hedge(hedger->stats());
+        j["hedge"] = {
+            { "fetches", hedge.fetches },
+            { "hedges", hedge.hedges },
+            { "hedgeWins", hedge.hedgeWins },
+            { "thresholdMs", hedge.thresholdMs }
+        };
+    }
+    if (m_results)
+    {
+        const ResultCache::Stats results(m_results->stats());
+        j["results"] = {
+            { "hits", results.hits },
+            { "misses", results.misses },
+            { "entries", results.entries },
+            { "bytes", results.bytes }
+        };
+    }
+    j["server"] = {
+        { "datasets", m_readers.size() },
+        { "requests", m_requests.load() },
+        { "errors", m_errors.load() },
+        { "active", m_active.load() },
+        { "bytesSent", m_bytesSent.load() }
+    };
+    return j;
+}
+
+} // namespace entwine
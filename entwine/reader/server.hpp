@@ -0,0 +1,122 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <entwine/reader/cache.hpp>
+#include <entwine/reader/reader.hpp>
+#include <entwine/reader/result-cache.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+}
+
+namespace entwine
+{
+
+// A long-lived HTTP/1.1 query server over a set of named datasets.  Each
+// dataset's Reader, with its hierarchy, is loaded once at startup and kept
+// resident, and all of them share a single chunk Cache.  Connections are
+// handled on a thread pool, one request per connection:
+//
+//      GET  /datasets          A JSON array of dataset names.
+//      GET  /metrics           Process, cache, and request metrics in the
+//                              Prometheus text format.
+//      POST /<name>/count      The JSON query body is run as a CountQuery,
+//                              responding with { "points": <count> }.
+//      POST /<name>/read       The JSON query body is run as a ReadQuery,
+//                              whose binary results are streamed with chunked
+//                              transfer encoding as each node is processed.
+//      POST /<name>/grid       A GridQuery, responding with its JSON result.
+//      POST /<name>/stats      A StatsQuery, responding with its JSON result.
+//      POST /<name>/batch      A BatchQuery, responding with each box in turn
+//                              as its uint64 point count and then its points.
+//      POST /<name>/knn        A KnnQuery, responding with its uint64 point
+//                              count, the double distance of each point, and
+//                              then the points, nearest first.
+//      POST /multi             A MultiQuery over the dataset names listed in
+//                              its "datasets", responding with its uint64
+//                              point count and then its points.
+//
+// Errors respond with { "error": <message> }, with a status of 500 for those
+// which are unexpected.  A read failing after its response has begun is closed
+// without the final chunk, so clients can tell it from a complete result.
+// Queries stopped early by their timeout or limit report "complete": false, or
+// for reads an X-Entwine-Complete header or trailer of false.  A request which
+// doesn't arrive within the ioTimeout is answered with a 408.
+class Server
+{
+public:
+    // Configuration:
+    //      datasets: An object of dataset names to their EPT paths.
+    //      port: TCP port on which to listen, 8080 by default.
+    //      threads: Number of concurrent connections, 8 by default.
+    //      cacheSize: Bytes of decoded chunks shared by all datasets.
+    //      compressedCacheSize: Bytes of stored chunk data, 0 by default.
+    //      diskCache: Local directory for a DiskCache, none by default.
+    //      diskCacheSize: Bytes of the DiskCache, 16 GiB by default.
+    //      prefetchChildren, prefetchThreads, prefetchSize: PrefetchPolicy.
+    //      timeout: Default query timeout in seconds, 0 for none.
+    //      ioTimeout: Seconds within which a request must arrive, and bound
+    //          on each receive and send, 30 by default, or 0 for none.
+    //      resultCacheSize: Bytes of complete read results kept to serve
+    //          repeated identical reads, 0 (none) by default.
+    //      preload: If true, load each hierarchy in the background.
+    //      tmp, arbiter: As for a build.
+    Server(const json& config);
+    ~Server();
+
+    // Listen on our port and serve requests until the process exits.
+    void serve();
+
+    json metrics() const;
+
+private:
+    struct Request
+    {
+        std::string method;
+        std::string path;
+        std::string body;
+    };
+
+    void handle(int fd);
+    void respond(int fd, const Request& req);
+    void read(int fd, const Reader& reader, const json& query);
+
+    const Reader& reader(const std::string& name) const;
+
+    std::shared_ptr<arbiter::Arbiter> m_arbiter;
+    std::shared_ptr<Cache> m_cache;
+    std::map<std::string, std::unique_ptr<Reader>> m_readers;
+    std::unique_ptr<ResultCache> m_results;
+
+    const uint16_t m_port;
+    const double m_timeout;
+    const double m_ioTimeout;
+    Pool m_pool;
+    std::thread m_preload;
+
+    std::atomic<uint64_t> m_requests { 0 };
+    std::atomic<uint64_t> m_errors { 0 };
+    std::atomic<uint64_t> m_active { 0 };
+    std::atomic<uint64_t> m_bytesSent { 0 };
+};
+
+} // namespace entwine
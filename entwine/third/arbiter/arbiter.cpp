@@ -99,6 +99,18 @@ namespace
 
         return merge(in, config);
     }
+
+#ifdef ARBITER_CURL
+    std::size_t getConcurrency(const json& c)
+    {
+        const json h(c.value("http", json::object()));
+        if (h.is_object() && h.count("concurrent"))
+        {
+            return std::max<std::size_t>(h["concurrent"].get<std::size_t>(), 1);
+        }
+        return concurrentHttpReqs;
+    }
+#endif
 }
 
 Arbiter::Arbiter() : Arbiter(json().dump()) { }
@@ -108,7 +120,7 @@ Arbiter::Arbiter(const std::string s)
 #ifdef ARBITER_CURL
     , m_pool(
             new http::Pool(
-                concurrentHttpReqs,
+                getConcurrency(getConfig(s)),
                 httpRetryCount,
                 getConfig(s).dump()))
 #endif
@@ -3233,6 +3245,7 @@ std::vector<std::string> Dropbox::glob(std::string path, bool verbose) const
 // //////////////////////////////////////////////////////////////////////
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <ios>
 #include <iostream>
@@ -3269,7 +3282,18 @@ namespace http
 
 namespace
 {
+    std::atomic<uint64_t> statOpened(0);
+    std::atomic<uint64_t> statReused(0);
+    std::atomic<uint64_t> statFailed(0);
+    std::atomic<uint64_t> statConnectNanos(0);
+    std::atomic<uint64_t> statTlsNanos(0);
+
 #ifdef ARBITER_CURL
+    uint64_t toNanos(double seconds)
+    {
+        return seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0;
+    }
+
     struct PutData
     {
         PutData(const std::vector<char>& data)
@@ -3347,6 +3371,17 @@ namespace
 #endif // ARBITER_CURL
 } // unnamed namespace
 
+Stats stats()
+{
+    Stats s;
+    s.opened = statOpened;
+    s.reused = statReused;
+    s.failed = statFailed;
+    s.connectSeconds = statConnectNanos / 1e9;
+    s.tlsSeconds = statTlsNanos / 1e9;
+    return s;
+}
+
 Curl::Curl(const std::string s)
 {
 #ifdef ARBITER_CURL
@@ -3360,6 +3395,8 @@ Curl::Curl(const std::string s)
     //      - caBundle          (CURLOPT_CAPATH)
     //      - caInfo            (CURLOPT_CAINFO)
     //      - verifyPeer        (CURLOPT_SSL_VERIFYPEER)
+    //      - connectTimeout    (CURLOPT_CONNECTTIMEOUT_MS, in seconds)
+    //      - http2             (CURLOPT_HTTP_VERSION)
 
     using Keys = std::vector<std::string>;
     auto find([](const Keys& keys)->std::unique_ptr<std::string>
@@ -3408,6 +3445,16 @@ Curl::Curl(const std::string s)
             {
                 m_verifyPeer = h["verifyPeer"].get<bool>();
             }
+
+            if (h.count("connectTimeout"))
+            {
+                m_connectTimeout = h["connectTimeout"].get<double>();
+            }
+
+            if (h.count("http2"))
+            {
+                m_http2 = h["http2"].get<bool>();
+            }
         }
     }
 
@@ -3440,6 +3487,8 @@ Curl::Curl(const std::string s)
         logged = true;
         std::cout << "Curl config:" << std::boolalpha <<
             "\n\ttimeout: " << m_timeout << "s" <<
+            "\n\tconnectTimeout: " << m_connectTimeout << "s" <<
+            "\n\thttp2: " << m_http2 <<
             "\n\tfollowRedirect: " << m_followRedirect <<
             "\n\tverifyPeer: " << m_verifyPeer <<
             "\n\tcaBundle: " << (m_caPath ? *m_caPath : "(default)") <<
@@ -3483,8 +3532,21 @@ void Curl::init(
     curl_easy_setopt(m_curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
     curl_easy_setopt(m_curl, CURLOPT_LOW_SPEED_TIME, m_timeout);
 
-    curl_easy_setopt(m_curl, CURLOPT_CONNECTTIMEOUT_MS, 2000L);
-    curl_easy_setopt(m_curl, CURLOPT_ACCEPTTIMEOUT_MS, 2000L);
+    const long connectMs(static_cast<long>(m_connectTimeout * 1000));
+    curl_easy_setopt(m_curl, CURLOPT_CONNECTTIMEOUT_MS, connectMs);
+    curl_easy_setopt(m_curl, CURLOPT_ACCEPTTIMEOUT_MS, connectMs);
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // Negotiate HTTP/2 over TLS where the server supports it, so requests
+    // to the same host may share a single connection.
+    if (m_http2)
+    {
+        curl_easy_setopt(
+                m_curl,
+                CURLOPT_HTTP_VERSION,
+                static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    }
+#endif
 
     auto toLong([](bool b) { return b ? 1L : 0L; });
 
@@ -3514,6 +3576,28 @@ int Curl::perform()
 
     const auto code(curl_easy_perform(m_curl));
     curl_easy_getinfo(m_curl, CURLINFO_RESPONSE_CODE, &httpCode);
+
+    // A request which made no new connection reused one held open by this
+    // handle from a previous request.
+    long connects(0);
+    double connectTime(0);
+    double tlsTime(0);
+    curl_easy_getinfo(m_curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(m_curl, CURLINFO_CONNECT_TIME, &connectTime);
+    curl_easy_getinfo(m_curl, CURLINFO_APPCONNECT_TIME, &tlsTime);
+
+    if (code != CURLE_OK) ++statFailed;
+    if (connects)
+    {
+        statOpened += connects;
+        statConnectNanos += toNanos(connectTime);
+        if (tlsTime > connectTime)
+        {
+            statTlsNanos += toNanos(tlsTime - connectTime);
+        }
+    }
+    else if (code == CURLE_OK) ++statReused;
+
     curl_easy_reset(m_curl);
 
     if (code != CURLE_OK) httpCode = 500;
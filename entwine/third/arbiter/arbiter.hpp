@@ -24246,6 +24246,7 @@ inline json merge(const json& a, const json& b)
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -24277,11 +24278,33 @@ namespace http
 
 class Pool;
 
+/** @endcond */
+
+/** Process-wide counts of HTTP connections, for diagnosing transfer stalls.
+ * A request either opens new connections or reuses one kept alive from a
+ * previous request, and failed requests are those which could not complete
+ * a transfer at all.  Connect and TLS handshake times are summed over the
+ * connections opened.
+ */
+struct Stats
+{
+    uint64_t opened = 0;
+    uint64_t reused = 0;
+    uint64_t failed = 0;
+    double connectSeconds = 0;
+    double tlsSeconds = 0;
+};
+
+ARBITER_DLL Stats stats();
+
+/** @cond arbiter_internal */
+
 class ARBITER_DLL Curl
 {
     friend class Pool;
 
     static constexpr std::size_t defaultHttpTimeout = 5;
+    static constexpr double defaultConnectTimeout = 2;
 
 public:
     ~Curl();
@@ -24322,6 +24345,8 @@ private:
 
     bool m_verbose = false;
     long m_timeout = defaultHttpTimeout;
+    double m_connectTimeout = defaultConnectTimeout;
+    bool m_http2 = false;
     bool m_followRedirect = true;
     bool m_verifyPeer = true;
     std::unique_ptr<std::string> m_caPath;
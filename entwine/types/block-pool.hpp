@@ -0,0 +1,203 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <entwine/util/huge-pages.hpp>
+
+namespace entwine
+{
+
+// A process-wide cache of fixed-size point blocks.  Chunks are continually
+// serialized and reawakened during a build, so rather than handing their
+// blocks back to the heap each time, released blocks are kept here for the
+// next chunk with the same block size to borrow.  At most maxPooled() bytes of
+// idle blocks are retained - beyond that, released blocks are freed.
+//
+// If huge pages are enabled, blocks are instead carved from slabs of huge
+// pages, one slab at a time for each block size, so that the blocks of a
+// chunk share few TLB entries.  Slabs are never returned to the system, so
+// their blocks are always retained for reuse, regardless of maxPooled().
+class BlockPool
+{
+public:
+    // Blocks carved from a slab are owned by it rather than by their holder.
+    struct Deleter
+    {
+        bool owned = true;
+        void operator()(char* p) const { if (owned) delete[] p; }
+    };
+
+    using Block = std::unique_ptr<char[], Deleter>;
+
+    struct Stats
+    {
+        // Bytes currently borrowed by live chunks and overflows.
+        uint64_t resident = 0;
+
+        // Bytes of idle blocks held for reuse.
+        uint64_t pooled = 0;
+    };
+
+    static constexpr uint64_t defaultMaxPooled() { return 256 * 1024 * 1024; }
+
+    static BlockPool& get()
+    {
+        static BlockPool pool;
+        return pool;
+    }
+
+    Block acquire(uint64_t bytes)
+    {
+        m_resident += bytes;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it(m_free.find(bytes));
+            if (it != m_free.end() && !it->second.empty())
+            {
+                Block block(std::move(it->second.back()));
+                it->second.pop_back();
+                m_pooled -= bytes;
+                return block;
+            }
+        }
+
+        if (hugePages::mode() != hugePages::Mode::None) return carve(bytes);
+        return Block(new char[bytes]);
+    }
+
+    void release(uint64_t bytes, Block block)
+    {
+        if (!block) return;
+        m_resident -= bytes;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (block.get_deleter().owned && m_pooled + bytes > m_maxPooled)
+        {
+            return;
+        }
+
+        m_free[bytes].push_back(std::move(block));
+        m_pooled += bytes;
+    }
+
+    // Set the maximum number of idle bytes to retain, freeing any excess.
+    void setMaxPooled(uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxPooled = bytes;
+
+        for (auto& p : m_free)
+        {
+            auto& blocks(p.second);
+            auto it(blocks.begin());
+            while (m_pooled > m_maxPooled && it != blocks.end())
+            {
+                if (it->get_deleter().owned)
+                {
+                    it = blocks.erase(it);
+                    m_pooled -= p.first;
+                }
+                else ++it;
+            }
+        }
+    }
+
+    uint64_t maxPooled() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_maxPooled;
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.resident = m_resident;
+        s.pooled = m_pooled;
+        return s;
+    }
+
+private:
+    BlockPool() = default;
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    ~BlockPool()
+    {
+        for (const Slab& slab : m_slabs)
+        {
+            hugePages::release(slab.data, slab.bytes, slab.mode);
+        }
+    }
+
+    struct Slab
+    {
+        char* data;
+        std::size_t bytes;
+        hugePages::Mode mode;
+    };
+
+    // The unused remainder of the newest slab for each block size.
+    struct Remainder
+    {
+        char* pos = nullptr;
+        char* end = nullptr;
+    };
+
+    Block carve(const uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Remainder& rest(m_rest[bytes]);
+
+        if (static_cast<uint64_t>(rest.end - rest.pos) < bytes)
+        {
+            const std::size_t page(hugePages::pageSize());
+            Slab slab;
+            slab.bytes = (std::max<std::size_t>(bytes, page) + page - 1) /
+                page * page;
+            slab.mode = hugePages::mode();
+            slab.data = static_cast<char*>(
+                    hugePages::allocate(slab.bytes, slab.mode));
+            m_slabs.push_back(slab);
+
+            rest.pos = slab.data;
+            rest.end = slab.data + slab.bytes;
+        }
+
+        Deleter deleter;
+        deleter.owned = false;
+        Block block(rest.pos, deleter);
+        rest.pos += bytes;
+        return block;
+    }
+
+    mutable std::mutex m_mutex;
+    std::map<uint64_t, std::vector<Block>> m_free;
+    uint64_t m_maxPooled = defaultMaxPooled();
+
+    std::vector<Slab> m_slabs;
+    std::map<uint64_t, Remainder> m_rest;
+
+    std::atomic<uint64_t> m_resident{ 0 };
+    std::atomic<uint64_t> m_pooled{ 0 };
+};
+
+} // namespace entwine
+
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -92,6 +94,31 @@ public:
             p.y >= m_min.y && p.y < m_max.y;
     }
 
+    // Like contains(const Point&) for n points stored as columns, setting
+    // each mask entry to 1 if its point is contained, and 0 otherwise.
+    // Branch-free, so the compiler may vectorize it.
+    void contains(
+            const double* x,
+            const double* y,
+            const double* z,
+            std::size_t n,
+            uint8_t* mask) const
+    {
+        for (std::size_t i(0); i < n; ++i)
+        {
+            mask[i] =
+                (x[i] >= m_min.x) & (x[i] < m_max.x) &
+                (y[i] >= m_min.y) & (y[i] < m_max.y);
+        }
+
+        if (!is3d()) return;
+
+        for (std::size_t i(0); i < n; ++i)
+        {
+            mask[i] &= (z[i] >= m_min.z) & (z[i] < m_max.z);
+        }
+    }
+
     double width()  const { return m_max.x - m_min.x; } // Length in X.
     double depth()  const { return m_max.y - m_min.y; } // Length in Y.
     double height() const { return m_max.z - m_min.z; } // Length in Z.
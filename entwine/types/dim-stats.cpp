@@ -0,0 +1,177 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/dim-stats.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+void DimStats::add(const DimStats& other)
+{
+    if (!other.m_count) return;
+
+    if (!m_count)
+    {
+        *this = other;
+        return;
+    }
+
+    const double na(m_count);
+    const double nb(other.m_count);
+    const double n(na + nb);
+    const double delta(other.m_mean - m_mean);
+
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_mean += delta * nb / n;
+    m_m2 += other.m_m2 + delta * delta * na * nb / n;
+
+    if (m_counts.empty()) m_counts = other.m_counts;
+    else if (other.m_counts.size() == m_counts.size())
+    {
+        for (std::size_t i(0); i < m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+    }
+}
+
+json DimStats::toJson() const
+{
+    if (!m_count) return json::object();
+
+    json j {
+        { "count", m_count },
+        { "minimum", m_min },
+        { "maximum", m_max },
+        { "mean", m_mean },
+        { "stddev", std::sqrt(variance()) },
+        { "variance", variance() }
+    };
+
+    if (!m_counts.empty())
+    {
+        json counts(json::array());
+        for (std::size_t i(0); i < m_counts.size(); ++i)
+        {
+            if (m_counts[i])
+            {
+                counts.push_back({ { "value", i }, { "count", m_counts[i] } });
+            }
+        }
+        j["counts"] = counts;
+    }
+
+    return j;
+}
+
+DimStats DimStats::fromJson(const json& j, const bool counted)
+{
+    DimStats s(counted);
+    if (!j.count("count")) return s;
+
+    s.m_count = j.at("count").get<uint64_t>();
+    if (!s.m_count) return s;
+
+    s.m_min = j.at("minimum").get<double>();
+    s.m_max = j.at("maximum").get<double>();
+    s.m_mean = j.at("mean").get<double>();
+    s.m_m2 = j.at("variance").get<double>() * s.m_count;
+
+    if (counted && j.count("counts"))
+    {
+        for (const json& c : j.at("counts"))
+        {
+            const uint64_t value(c.at("value").get<uint64_t>());
+            if (value < s.m_counts.size())
+            {
+                s.m_counts[value] = c.at("count").get<uint64_t>();
+            }
+        }
+    }
+
+    return s;
+}
+
+SharedDimStats::SharedDimStats(const Schema& schema, const json& existing)
+{
+    for (const DimInfo& dim : schema.dims())
+    {
+        m_names.push_back(dim.name());
+        m_empty.emplace_back(dim.type() == DimType::Unsigned8);
+    }
+
+    m_base = parse(existing);
+    for (Shard& shard : m_shards) shard.stats = m_empty;
+}
+
+DimStatsList SharedDimStats::parse(const json& schema) const
+{
+    DimStatsList result(m_empty);
+    if (!schema.is_array()) return result;
+
+    for (const json& entry : schema)
+    {
+        const std::string name(entry.value("name", ""));
+        const auto it(std::find(m_names.begin(), m_names.end(), name));
+        if (it == m_names.end()) continue;
+
+        const std::size_t i(it - m_names.begin());
+        result[i] = DimStats::fromJson(entry, !m_empty[i].counts().empty());
+    }
+    return result;
+}
+
+void SharedDimStats::add(const DimStatsList& stats)
+{
+    Shard& shard(mine());
+    SpinGuard lock(shard.spin);
+    for (std::size_t i(0); i < stats.size(); ++i)
+    {
+        shard.stats[i].add(stats[i]);
+    }
+}
+
+DimStatsList SharedDimStats::get() const
+{
+    DimStatsList result(m_base);
+    for (Shard& shard : m_shards)
+    {
+        SpinGuard lock(shard.spin);
+        for (std::size_t i(0); i < result.size(); ++i)
+        {
+            result[i].add(shard.stats[i]);
+        }
+    }
+    return result;
+}
+
+json SharedDimStats::annotate(json schema) const
+{
+    const DimStatsList stats(get());
+    for (json& entry : schema)
+    {
+        const std::string name(entry.value("name", ""));
+        const auto it(std::find(m_names.begin(), m_names.end(), name));
+        if (it == m_names.end()) continue;
+
+        const json s(stats[it - m_names.begin()].toJson());
+        for (auto p(s.begin()); p != s.end(); ++p) entry[p.key()] = p.value();
+    }
+    return schema;
+}
+
+} // namespace entwine
@@ -0,0 +1,144 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <entwine/types/node-stats.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/spin-lock.hpp>
+
+namespace entwine
+{
+
+class Schema;
+
+// Summary statistics of the values of a single dimension over a dataset.  The
+// mean and variance are accumulated by Welford's method, which unlike sums of
+// squares stays accurate for large coordinates.  Dimensions of eight bits or
+// fewer also count the occurrences of each value.
+class DimStats
+{
+public:
+    DimStats() = default;
+    explicit DimStats(bool counted) : m_counts(counted ? 256 : 0, 0) { }
+
+    void add(double v)
+    {
+        ++m_count;
+        if (v < m_min) m_min = v;
+        if (v > m_max) m_max = v;
+
+        const double delta(v - m_mean);
+        m_mean += delta / m_count;
+        m_m2 += delta * (v - m_mean);
+
+        if (!m_counts.empty()) ++m_counts[static_cast<uint8_t>(v)];
+    }
+
+    void add(const DimStats& other);
+
+    uint64_t count() const { return m_count; }
+    double minimum() const { return m_min; }
+    double maximum() const { return m_max; }
+    double mean() const { return m_mean; }
+    double variance() const { return m_count ? m_m2 / m_count : 0; }
+
+    DimRange range() const
+    {
+        DimRange r;
+        if (m_count)
+        {
+            r.min = m_min;
+            r.max = m_max;
+        }
+        return r;
+    }
+
+    // Occurrences of each value from 0 to 255, if counted.
+    const std::vector<uint64_t>& counts() const { return m_counts; }
+
+    // Written as the statistics of an EPT schema entry, which are ignored in
+    // its absence.
+    json toJson() const;
+    static DimStats fromJson(const json& j, bool counted);
+
+private:
+    uint64_t m_count = 0;
+    double m_min = std::numeric_limits<double>::max();
+    double m_max = std::numeric_limits<double>::lowest();
+    double m_mean = 0;
+    double m_m2 = 0;
+    std::vector<uint64_t> m_counts;
+};
+
+// The statistics of each dimension of a schema, in order.
+using DimStatsList = std::vector<DimStats>;
+
+// Statistics which many threads add to at once.  Each thread accumulates a
+// batch privately and adds it to its own shard once per batch, so the shard
+// locks are practically uncontended, and reads merge every shard.
+class SharedDimStats
+{
+public:
+    // If the schema carries statistics from an existing build, ours begin
+    // from them.
+    SharedDimStats(const Schema& schema, const json& existing = json());
+    SharedDimStats(const SharedDimStats&) = delete;
+    SharedDimStats& operator=(const SharedDimStats&) = delete;
+
+    // An empty list in which a thread may accumulate its batch.
+    DimStatsList make() const { return m_empty; }
+
+    void add(const DimStatsList& stats);
+    DimStatsList get() const;
+
+    // Discards the statistics of the existing build.
+    void reset() { m_base = m_empty; }
+
+    // Adds the statistics carried by the schema of another subset.
+    void merge(const json& schema) { add(parse(schema)); }
+
+    // The schema entries of these dimensions, with our statistics added.
+    json annotate(json schema) const;
+
+private:
+    DimStatsList parse(const json& schema) const;
+
+    struct Shard
+    {
+        SpinLock spin;
+        DimStatsList stats;
+    };
+
+    Shard& mine()
+    {
+        static std::atomic<std::size_t> next(0);
+        thread_local const std::size_t index(next++ % shardCount);
+        return m_shards[index];
+    }
+
+    static constexpr std::size_t shardCount = 16;
+
+    std::vector<std::string> m_names;
+    DimStatsList m_empty;
+    DimStatsList m_base;
+
+    mutable std::array<Shard, shardCount> m_shards;
+};
+
+} // namespace entwine
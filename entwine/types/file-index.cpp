@@ -0,0 +1,161 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/file-index.hpp>
+
+#include <cmath>
+
+namespace entwine
+{
+
+namespace
+{
+    // Children per node.
+    const std::size_t nodeSize(16);
+}
+
+FileIndex::FileIndex(const std::vector<Entry>& entries)
+{
+    m_items.reserve(entries.size());
+    for (const Entry& entry : entries)
+    {
+        Item item;
+        item.box = Box(entry.first);
+        item.origin = entry.second;
+        m_items.push_back(item);
+    }
+
+    build();
+}
+
+FileIndex::FileIndex(const FileInfoList& files)
+{
+    for (Origin i(0); i < files.size(); ++i)
+    {
+        if (const Bounds* b = files[i].boundsEpsilon())
+        {
+            Item item;
+            item.box = Box(*b);
+            item.origin = i;
+            m_items.push_back(item);
+        }
+    }
+
+    build();
+}
+
+template<typename T>
+std::vector<FileIndex::Node> FileIndex::pack(std::vector<T>& v)
+{
+    // Sort by X into vertical slices of about sqrt(n / nodeSize) nodes each,
+    // then each slice by Y, so that consecutive runs form compact tiles.
+    const std::size_t nodes((v.size() + nodeSize - 1) / nodeSize);
+    const std::size_t slices(std::ceil(std::sqrt(nodes)));
+    const std::size_t perSlice(slices * nodeSize);
+
+    std::sort(v.begin(), v.end(), [](const T& a, const T& b)
+    {
+        return a.box.midx() < b.box.midx();
+    });
+
+    for (std::size_t i(0); i < v.size(); i += perSlice)
+    {
+        const auto end(v.begin() + std::min(i + perSlice, v.size()));
+        std::sort(v.begin() + i, end, [](const T& a, const T& b)
+        {
+            return a.box.midy() < b.box.midy();
+        });
+    }
+
+    std::vector<Node> out;
+    out.reserve(nodes);
+
+    for (std::size_t i(0); i < v.size(); i += nodeSize)
+    {
+        Node node;
+        node.begin = i;
+        node.end = std::min(i + nodeSize, v.size());
+        node.box = v[i].box;
+        for (std::size_t j(i + 1); j < node.end; ++j) node.box.grow(v[j].box);
+        out.push_back(node);
+    }
+
+    return out;
+}
+
+void FileIndex::build()
+{
+    if (m_items.empty()) return;
+
+    m_levels.push_back(pack(m_items));
+    while (m_levels.back().size() > 1)
+    {
+        // Reordering a level leaves the ranges of its nodes intact, since
+        // those refer to the level beneath it.
+        std::vector<Node> level(m_levels.back());
+        std::vector<Node> above(pack(level));
+        m_levels.back() = std::move(level);
+        m_levels.push_back(std::move(above));
+    }
+}
+
+template<typename F>
+void FileIndex::visit(const Box& box, F f) const
+{
+    if (m_levels.empty()) return;
+
+    // Pairs of a level and a node within it.
+    std::vector<std::pair<std::size_t, std::size_t>> stack;
+    stack.emplace_back(m_levels.size() - 1, 0);
+
+    while (!stack.empty())
+    {
+        const std::size_t depth(stack.back().first);
+        const Node& node(m_levels[depth][stack.back().second]);
+        stack.pop_back();
+
+        if (!node.box.overlaps(box)) continue;
+
+        for (uint64_t i(node.begin); i < node.end; ++i)
+        {
+            if (depth) stack.emplace_back(depth - 1, i);
+            else if (m_items[i].box.overlaps(box))
+            {
+                if (!f(m_items[i].origin)) return;
+            }
+        }
+    }
+}
+
+OriginList FileIndex::query(const Bounds& bounds) const
+{
+    OriginList result;
+    visit(Box(bounds), [&result](Origin o)
+    {
+        result.push_back(o);
+        return true;
+    });
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool FileIndex::overlaps(const Bounds& bounds) const
+{
+    bool found(false);
+    visit(Box(bounds), [&found](Origin)
+    {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+} // namespace entwine
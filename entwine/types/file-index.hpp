@@ -0,0 +1,113 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/file-info.hpp>
+
+namespace entwine
+{
+
+// A static R-tree over the X-Y extents of a set of files, packed by
+// Sort-Tile-Recursive so that each node is full and siblings are spatially
+// compact.  Overlap is tested as for Bounds::overlaps in two dimensions, so
+// bounds which merely touch do not overlap.
+class FileIndex
+{
+public:
+    using Entry = std::pair<Bounds, Origin>;
+
+    FileIndex() = default;
+    explicit FileIndex(const std::vector<Entry>& entries);
+
+    // Indexes each file which has bounds by its epsilon bounds, with its
+    // position in the list as its origin.
+    explicit FileIndex(const FileInfoList& files);
+
+    // The origins of each entry overlapping these bounds, in ascending order.
+    OriginList query(const Bounds& bounds) const;
+
+    // True if any entry overlaps these bounds.
+    bool overlaps(const Bounds& bounds) const;
+
+    std::size_t size() const { return m_items.size(); }
+    bool empty() const { return m_items.empty(); }
+
+private:
+    struct Box
+    {
+        Box() = default;
+        explicit Box(const Bounds& b)
+            : minx(b.min().x), miny(b.min().y)
+            , maxx(b.max().x), maxy(b.max().y)
+        { }
+
+        bool overlaps(const Box& o) const
+        {
+            return maxx > o.minx && minx < o.maxx &&
+                maxy > o.miny && miny < o.maxy;
+        }
+
+        void grow(const Box& o)
+        {
+            minx = std::min(minx, o.minx);
+            miny = std::min(miny, o.miny);
+            maxx = std::max(maxx, o.maxx);
+            maxy = std::max(maxy, o.maxy);
+        }
+
+        double midx() const { return minx + (maxx - minx) / 2.0; }
+        double midy() const { return miny + (maxy - miny) / 2.0; }
+
+        double minx = 0;
+        double miny = 0;
+        double maxx = 0;
+        double maxy = 0;
+    };
+
+    struct Item
+    {
+        Box box;
+        Origin origin = invalidOrigin;
+    };
+
+    // The children of a node are [begin, end) of the level beneath it, or of
+    // our items for the lowest level.
+    struct Node
+    {
+        Box box;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+    };
+
+    void build();
+
+    // Sorts these elements into tiles of nodeSize and returns a node over
+    // each consecutive run of them.
+    template<typename T> static std::vector<Node> pack(std::vector<T>& v);
+
+    // Visits each item overlapping this box until _f_ returns false.
+    template<typename F> void visit(const Box& box, F f) const;
+
+    std::vector<Item> m_items;
+
+    // Levels of nodes, from those over our items up to the single root.
+    std::vector<std::vector<Node>> m_levels;
+};
+
+} // namespace entwine
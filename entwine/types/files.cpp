@@ -11,9 +11,14 @@
 #include <entwine/types/files.hpp>
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 
 #include <entwine/io/ensure.hpp>
 #include <entwine/types/bounds.hpp>
@@ -33,6 +38,83 @@ std::string idFrom(std::string path)
     return arbiter::getBasename(path);
 }
 
+// An estimate of the memory held by a JSON value, counting each object member
+// with roughly the overhead of a map node.
+uint64_t jsonBytes(const json& j)
+{
+    uint64_t bytes(sizeof(json));
+
+    if (j.is_string())
+    {
+        bytes += j.get_ref<const std::string&>().capacity();
+    }
+    else if (j.is_object())
+    {
+        for (auto it(j.begin()); it != j.end(); ++it)
+        {
+            bytes += 4 * sizeof(void*) + it.key().capacity();
+            bytes += jsonBytes(it.value());
+        }
+    }
+    else if (j.is_array())
+    {
+        for (const json& v : j) bytes += jsonBytes(v);
+    }
+
+    return bytes;
+}
+
+const std::string tableMagic("EPTFILES");
+const uint32_t tableVersion(1);
+
+template<typename T>
+void put(std::vector<char>& data, const T v)
+{
+    const char* p(reinterpret_cast<const char*>(&v));
+    data.insert(data.end(), p, p + sizeof(T));
+}
+
+void put(std::vector<char>& data, const std::string& s)
+{
+    put(data, static_cast<uint32_t>(s.size()));
+    data.insert(data.end(), s.begin(), s.end());
+}
+
+class TableReader
+{
+public:
+    explicit TableReader(const std::vector<char>& data) : m_data(data) { }
+
+    template<typename T> T get()
+    {
+        T v;
+        const char* p(take(sizeof(T)));
+        std::copy(p, p + sizeof(T), reinterpret_cast<char*>(&v));
+        return v;
+    }
+
+    std::string getString()
+    {
+        const uint32_t size(get<uint32_t>());
+        const char* begin(take(size));
+        return std::string(begin, begin + size);
+    }
+
+private:
+    const char* take(const std::size_t n)
+    {
+        if (n > m_data.size() - m_pos)
+        {
+            throw std::runtime_error("Invalid file table");
+        }
+        m_pos += n;
+        return m_data.data() + m_pos - n;
+    }
+
+    const std::vector<char>& m_data;
+    std::size_t m_pos = 0;
+};
+
 } // unnamed namespace
 
 Files::Files(const FileInfoList& files)
@@ -41,7 +123,7 @@ Files::Files(const FileInfoList& files)
     // Aggregate statuses.
     for (const auto& f : m_files)
     {
-        m_pointStats += f.pointStats();
+        m_pointStats.add(f.pointStats());
     }
 
     // Initialize origin info for detailed metadata storage purposes.
@@ -54,6 +136,7 @@ Files::Files(const FileInfoList& files)
                     std::to_string(i) + ": " + f.toMetaJson().dump(2));
         }
         f.setOrigin(i);
+        m_index.emplace(f.path(), i);
     }
 
     // If the basenames of all files are unique amongst one-another, then use
@@ -92,7 +175,17 @@ FileInfoList Files::extract(
 {
     const auto ep(top.getSubEndpoint("ept-sources"));
     const std::string filename("list" + postfix + ".json");
-    auto list(json::parse(ensureGetString(ep, filename)).get<FileInfoList>());
+    return extract(top, primary, postfix, ensureGetString(ep, filename));
+}
+
+FileInfoList Files::extract(
+        const arbiter::Endpoint& top,
+        const bool primary,
+        const std::string& postfix,
+        const std::string& data)
+{
+    const auto ep(top.getSubEndpoint("ept-sources"));
+    auto list(json::parse(data).get<FileInfoList>());
 
     if (!primary) return list;
 
@@ -106,9 +199,30 @@ FileInfoList Files::extract(
         idMap[f.id()] = i;
     }
 
+    std::map<std::string, std::string> fetched;
+    std::mutex mutex;
+
+    Pool pool(std::min<std::size_t>(urls.size(), 8));
     for (const auto url : urls)
     {
-        const auto meta(json::parse(ensureGetString(ep, url)));
+        pool.add([&ep, &fetched, &mutex, url]()
+        {
+            const std::string data(ensureGetString(ep, url));
+            std::lock_guard<std::mutex> lock(mutex);
+            fetched[url] = data;
+        });
+    }
+    pool.join();
+
+    if (!pool.errors().empty())
+    {
+        throw std::runtime_error(
+                "Failed to fetch file metadata: " + pool.errors().front());
+    }
+
+    for (const auto& entry : fetched)
+    {
+        const auto meta(json::parse(entry.second));
         for (const auto& p : meta.items())
         {
             const std::string id(p.key());
@@ -127,49 +241,169 @@ void Files::save(
         const arbiter::Endpoint& top,
         const std::string& postfix,
         const Config& config,
-        const bool detailed) const
+        const bool detailed,
+        Pool* pool) const
 {
     const auto ep(top.getSubEndpoint("ept-sources"));
     writeList(ep, postfix);
-    if (detailed) writeMeta(ep, config);
+    if (detailed) writeMeta(ep, config, pool);
+}
+
+void Files::saveTable(const arbiter::Endpoint& top) const
+{
+    std::vector<char> data(tableMagic.begin(), tableMagic.end());
+    put(data, tableVersion);
+    put(data, static_cast<uint64_t>(size()));
+
+    for (const FileInfo& f : m_files)
+    {
+        put(data, f.path());
+        put(data, f.id());
+        put(data, f.url());
+        put(data, f.message());
+        put(data, static_cast<char>(f.status()));
+        put(data, static_cast<uint64_t>(f.points()));
+        put(data, static_cast<uint64_t>(f.pointStats().inserts()));
+        put(data, static_cast<uint64_t>(f.pointStats().outOfBounds()));
+
+        const Bounds* b(f.bounds());
+        put(data, static_cast<char>(b ? 1 : 0));
+        if (b) for (std::size_t i(0); i < 6; ++i) put(data, (*b)[i]);
+    }
+
+    ensurePut(top.getSubEndpoint("ept-sources"), tableFile(), std::move(data));
+}
+
+FileInfoList Files::readTable(const std::vector<char>& data)
+{
+    TableReader reader(data);
+    for (const char c : tableMagic)
+    {
+        if (reader.get<char>() != c)
+        {
+            throw std::runtime_error("Invalid file table");
+        }
+    }
+
+    const uint32_t version(reader.get<uint32_t>());
+    if (version != tableVersion)
+    {
+        throw std::runtime_error(
+                "Unsupported file table version: " + std::to_string(version));
+    }
+
+    FileInfoList list(reader.get<uint64_t>());
+    for (FileInfo& f : list)
+    {
+        f.m_path = reader.getString();
+        f.m_id = reader.getString();
+        f.m_url = reader.getString();
+        f.m_message = reader.getString();
+        f.m_status = static_cast<FileInfo::Status>(reader.get<char>());
+        f.m_points = reader.get<uint64_t>();
+
+        const uint64_t inserts(reader.get<uint64_t>());
+        const uint64_t outOfBounds(reader.get<uint64_t>());
+        f.m_pointStats = PointStats(inserts, outOfBounds);
+
+        if (reader.get<char>())
+        {
+            double b[6];
+            for (double& v : b) v = reader.get<double>();
+            f.setBounds(Bounds(b[0], b[1], b[2], b[3], b[4], b[5]));
+        }
+    }
+
+    return list;
 }
 
 void Files::writeList(
         const arbiter::Endpoint& ep,
         const std::string& postfix) const
 {
-    json j;
-    for (const FileInfo& f : list()) j.push_back(f.toListJson());
+    // Serialize each entry directly rather than building a single document
+    // of every file, with one entry per line.
+    std::string list("[");
+    for (std::size_t i(0); i < size(); ++i)
+    {
+        list += (i ? ",\n" : "\n") + m_files[i].toListJson().dump();
+    }
+    list += "\n]";
 
-    const bool styled(size() <= 1000);
-    ensurePut(ep, "list" + postfix + ".json", styled ? j.dump(2) : j.dump());
+    ensurePut(ep, "list" + postfix + ".json", list);
 }
 
 void Files::writeMeta(
         const arbiter::Endpoint& ep,
-        const Config& config) const
+        const Config& config,
+        Pool* pool) const
 {
-    Pool pool(config.totalThreads());
-
-    std::map<std::string, json> meta;
-    for (const auto& f : m_files)
+    std::unique_ptr<Pool> owned;
+    if (!pool)
     {
-        meta[f.url()][f.id()] = f.toMetaJson();
+        owned = makeUnique<Pool>(config.totalThreads());
+        pool = owned.get();
     }
 
-    const bool styled(size() <= 1000);
+    // Group files by their metadata file, each of which is then serialized
+    // and written by a single task.
+    std::map<std::string, std::vector<const FileInfo*>> groups;
+    for (const auto& f : m_files) groups[f.url()].push_back(&f);
+
+    // When building from a binary scan, the SRS and metadata of each file
+    // still live in the scan's metadata file of the same name, and if our
+    // details were deferred, in the file we are about to replace.
+    std::unique_ptr<arbiter::Arbiter> a;
+    std::unique_ptr<arbiter::Endpoint> scan;
+    if (!config.scanSources().empty())
+    {
+        a = makeUnique<arbiter::Arbiter>(config.arbiter());
+        scan = makeUnique<arbiter::Endpoint>(
+                a->getEndpoint(config.scanSources()));
+    }
+    const arbiter::Endpoint* source(scan ? scan.get() : nullptr);
+    if (!source && m_deferred) source = &ep;
 
-    for (const auto& p : meta)
+    for (const auto& p : groups)
     {
-        pool.add([this, &ep, &p, styled]()
+        pool->add([&ep, source, &p]()
         {
             const std::string& filename(p.first);
-            const json& j(p.second);
-            ensurePut(ep, filename, j.dump(2));
+            const std::vector<const FileInfo*>& files(p.second);
+
+            json scanned;
+            if (source)
+            {
+                if (const auto s = source->tryGet(filename))
+                {
+                    scanned = json::parse(*s);
+                }
+            }
+
+            std::string meta("{");
+            for (std::size_t i(0); i < files.size(); ++i)
+            {
+                const FileInfo& f(*files[i]);
+                json j(f.toMetaJson());
+                if (scanned.count(f.id()))
+                {
+                    const json& s(scanned.at(f.id()));
+                    for (const std::string key : { "srs", "metadata" })
+                    {
+                        if (!j.count(key) && s.count(key)) j[key] = s.at(key);
+                    }
+                }
+
+                meta += (i ? ",\n" : "\n") + json(f.id()).dump() + ": " +
+                    j.dump();
+            }
+            meta += "\n}";
+
+            ensurePut(ep, filename, meta);
         });
     }
 
-    pool.await();
+    pool->await();
 }
 
 void Files::append(const FileInfoList& fileInfo)
@@ -177,7 +411,12 @@ void Files::append(const FileInfoList& fileInfo)
     FileInfoList adding(diff(fileInfo));
     for (auto& f : adding)
     {
-        f.setOrigin(m_files.size());
+        const Origin origin(m_files.size());
+
+        // The incoming list may itself contain duplicates.
+        if (!m_index.emplace(f.path(), origin).second) continue;
+
+        f.setOrigin(origin);
         m_files.emplace_back(f);
     }
 }
@@ -187,18 +426,28 @@ FileInfoList Files::diff(const FileInfoList& in) const
     FileInfoList out;
     for (const auto& f : in)
     {
-        auto matches([&f](const FileInfo& x) { return f.path() == x.path(); });
+        if (!m_index.count(f.path())) out.emplace_back(f);
+    }
 
-        if (std::none_of(m_files.begin(), m_files.end(), matches))
-        {
-            out.emplace_back(f);
-        }
+    return out;
+}
+
+FileInfoList Files::restart(const FileInfoList& in)
+{
+    FileInfoList out(in);
+    for (FileInfo& f : out)
+    {
+        if (f.status() == FileInfo::Status::Omitted) continue;
+
+        f.status(FileInfo::Status::Outstanding);
+        f.m_message.clear();
+        f.pointStats() = PointStats();
     }
 
     return out;
 }
 
-void Files::merge(const Files& other)
+void Files::merge(const FileInfoList& other)
 {
     if (size() != other.size())
     {
@@ -207,8 +456,28 @@ void Files::merge(const Files& other)
 
     for (std::size_t i(0); i < size(); ++i)
     {
-        m_files[i].add(other.list()[i]);
+        m_files[i].add(other[i]);
+    }
+}
+
+uint64_t Files::bytes() const
+{
+    uint64_t bytes(m_files.capacity() * sizeof(FileInfo));
+    for (const FileInfo& f : m_files)
+    {
+        bytes += f.path().capacity() + f.id().capacity() + f.url().capacity();
+        bytes += f.message().capacity();
+        bytes += jsonBytes(f.metadata()) - sizeof(json);
+    }
+
+    // Each indexed path is copied into a hash node.
+    for (const auto& p : m_index)
+    {
+        bytes += sizeof(p) + 2 * sizeof(void*) + p.first.capacity();
     }
+    bytes += m_index.bucket_count() * sizeof(void*);
+
+    return bytes;
 }
 
 } // namespace entwine
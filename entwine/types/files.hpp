@@ -13,8 +13,8 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
-#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <entwine/builder/config.hpp>
@@ -40,16 +40,44 @@ public:
             bool primary,
             std::string postfix = "");
 
+    // As above, given the already fetched contents of the file list.  The
+    // detailed metadata files, if needed, are fetched in parallel.
+    static FileInfoList extract(
+            const arbiter::Endpoint& top,
+            bool primary,
+            const std::string& postfix,
+            const std::string& list);
+
+    // Detailed metadata is written in parallel, on the given pool if one is
+    // supplied and otherwise on a pool of our own.
     void save(
             const arbiter::Endpoint& ep,
             const std::string& postfix,
             const Config& config,
-            bool primary) const;
+            bool primary,
+            Pool* pool = nullptr) const;
+
+    // A compact binary table of the files, with everything in the file list
+    // but none of their detailed metadata, which is much faster to load than
+    // the JSON list for very many files.  It is written alongside the list.
+    static std::string tableFile() { return "list.bin"; }
+    void saveTable(const arbiter::Endpoint& top) const;
+    static FileInfoList readTable(const std::vector<char>& data);
+
+    // Mark the detailed metadata of these files as not loaded, in which case
+    // it is copied from the existing metadata files at the destination when
+    // they are rewritten.
+    void deferDetails() { m_deferred = true; }
 
     std::size_t size() const { return m_files.size(); }
 
+    // Matches a full path exactly if possible, or else the first path which
+    // contains the given string.
     Origin find(const std::string& p) const
     {
+        const auto it(m_index.find(p));
+        if (it != m_index.end()) return it->second;
+
         for (std::size_t i(0); i < size(); ++i)
         {
             if (m_files[i].path().find(p) != std::string::npos) return i;
@@ -69,8 +97,6 @@ public:
     void add(Origin origin, const PointStats& stats)
     {
         get(origin).add(stats);
-
-        std::lock_guard<std::mutex> lock(m_mutex);
         m_pointStats.add(stats);
     }
 
@@ -82,11 +108,16 @@ public:
 
     const FileInfoList& list() const { return m_files; }
     FileInfoList& list() { return m_files; }
-    const PointStats& pointStats() const { return m_pointStats; }
+    // Safe to call while insertion is running.
+    PointStats pointStats() const { return m_pointStats.get(); }
 
     FileInfoList diff(const FileInfoList& fileInfo) const;
     void append(const FileInfoList& fileInfo);
 
+    // A copy of the given list with every point cloud file outstanding once
+    // more, and with no points counted for any of them.
+    static FileInfoList restart(const FileInfoList& fileInfo);
+
     std::size_t totalPoints() const
     {
         std::size_t n(0);
@@ -108,18 +139,33 @@ public:
         return n;
     }
 
-    void merge(const Files& other);
+    // Adds the statistics of each file of another subset, in the same order.
+    void merge(const Files& other) { merge(other.list()); }
+    void merge(const FileInfoList& other);
+
+    // An estimate of the memory held by our list, including the metadata of
+    // each file.  Not safe to call while insertion is running.
+    uint64_t bytes() const;
 
 private:
     void writeList(const arbiter::Endpoint& ep, const std::string& postfix)
         const;
 
-    void writeMeta(const arbiter::Endpoint& ep, const Config& config) const;
+    void writeMeta(
+            const arbiter::Endpoint& ep,
+            const Config& config,
+            Pool* pool) const;
 
     FileInfoList m_files;
 
-    mutable std::mutex m_mutex;
-    PointStats m_pointStats;
+    // The origin of each path, so that incoming lists may be diffed against
+    // ours without a scan per path.
+    std::unordered_map<std::string, Origin> m_index;
+
+    // Totals across every file, added to by each insertion thread.
+    SharedPointStats m_pointStats;
+
+    bool m_deferred = false;
 };
 
 inline void to_json(json& j, const Files& f)
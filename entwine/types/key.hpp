@@ -10,9 +10,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <ostream>
 #include <string>
 
@@ -61,14 +65,11 @@ inline bool operator!=(const Xyz& a, const Xyz& b)
 
 struct Dxyz
 {
-    Dxyz() : x(p.x), y(p.y), z(p.z) { }
+    Dxyz() { }
 
     Dxyz(uint64_t d, uint64_t x, uint64_t y, uint64_t z)
         : p(x, y, z)
         , d(d)
-        , x(p.x)
-        , y(p.y)
-        , z(p.z)
     { }
 
     Dxyz(uint64_t d, const Xyz& p)
@@ -98,23 +99,21 @@ struct Dxyz
         assert(toString() == v);
     }
 
-    Dxyz& operator=(const Dxyz& other)
-    {
-        d = other.d;
-        p = other.p;
-        return *this;
-    }
-
     std::string toString() const { return p.toString(d); }
     uint64_t depth() const { return d; }
     const Xyz& position() const { return p; }
 
-    Xyz p;
+    Dxyz child(Dir dir) const
+    {
+        return Dxyz(
+                d + 1,
+                (p.x << 1) | (isEast(dir)  ? 1u : 0u),
+                (p.y << 1) | (isNorth(dir) ? 1u : 0u),
+                (p.z << 1) | (isUp(dir)    ? 1u : 0u));
+    }
 
+    Xyz p;
     uint64_t d = 0;
-    uint64_t& x;
-    uint64_t& y;
-    uint64_t& z;
 };
 
 inline bool operator<(const Xyz& a, const Xyz& b)
@@ -152,19 +151,86 @@ struct Key
     {
         b = m.boundsCubic();
         p.reset();
+        d = 0;
+        fresh = true;
     }
 
     void init(const Point& g) { init(g, 0); }
 
+    // Rather than bisecting the bounds once per depth, quantize the point
+    // directly into its cell at the target depth and leave the bounds to be
+    // derived only if they are needed.  Points within rounding distance of an
+    // interior cell boundary take the bisection path so the result always
+    // matches stepping.
     void init(const Point& g, uint64_t depth)
     {
         reset();
-        for (std::size_t d(0); d < m.startDepth() + depth; ++d) step(g);
+
+        const uint64_t target(m.startDepth() + depth);
+        if (!target) return;
+
+        assert(target < 64);
+        const Bounds& r(m.boundsCubic());
+        const double cells(std::ldexp(1.0, target));
+
+        if (
+                quantize(g.x, r.min().x, r.max().x, cells, p.x) &&
+                quantize(g.y, r.min().y, r.max().y, cells, p.y) &&
+                quantize(g.z, r.min().z, r.max().z, cells, p.z))
+        {
+            d = target;
+            fresh = false;
+            return;
+        }
+
+        reset();
+        while (d < target) step(g);
+    }
+
+    // Quantize n coordinates along one axis to their cells at the given
+    // depth, as init does, clearing the entry of exact for any value too near
+    // an interior cell boundary to be trusted - those must be passed to init.
+    // Branch-free, so the compiler may vectorize it over a batch of points.
+    static void quantize(
+            const double* v,
+            std::size_t n,
+            double lo,
+            double hi,
+            uint64_t depth,
+            uint64_t* out,
+            uint8_t* exact)
+    {
+        const double cells(std::ldexp(1.0, depth));
+        const double tolerance(edgeTolerance(lo, hi, cells));
+
+        for (std::size_t i(0); i < n; ++i)
+        {
+            const double t((v[i] - lo) / (hi - lo) * cells);
+            const double f(std::floor(std::min(std::max(t, 0.0), cells - 1)));
+            const double frac(t - f);
+            out[i] = static_cast<uint64_t>(f);
+
+            const bool interior((t > 0) & (t < cells));
+            const bool edge(
+                    ((frac < tolerance) & (f > 0)) |
+                    ((frac > 1.0 - tolerance) & (f + 1 < cells)));
+            exact[i] &= !(interior & edge);
+        }
+    }
+
+    // Position this key directly at a known cell of the given depth, with
+    // bounds derived only if they are needed.
+    void set(const Xyz& position, uint64_t depth)
+    {
+        reset();
+        p = position;
+        d = m.startDepth() + depth;
+        fresh = !d;
     }
 
     Dir step(const Point& g)
     {
-        return step(getDirection(b.mid(), g));
+        return step(getDirection(bounds().mid(), g));
     }
 
     Dir step(Dir dir)
@@ -172,19 +238,77 @@ struct Key
         p.x = (p.x << 1) | (isEast(dir)  ? 1u : 0u);
         p.y = (p.y << 1) | (isNorth(dir) ? 1u : 0u);
         p.z = (p.z << 1) | (isUp(dir)    ? 1u : 0u);
+        ++d;
 
-        b.go(dir);
+        if (fresh) b.go(dir);
         return dir;
     }
 
     const Metadata& metadata() const { return m; }
-    const Bounds& bounds() const { return b; }
     const Xyz& position() const { return p; }
 
+    const Bounds& bounds() const
+    {
+        if (!fresh)
+        {
+            const Bounds& r(m.boundsCubic());
+            const double scale(std::ldexp(1.0, -static_cast<int>(d)));
+            const Point w((r.max() - r.min()) * scale);
+            const Point lo(
+                    r.min().x + w.x * p.x,
+                    r.min().y + w.y * p.y,
+                    r.min().z + w.z * p.z);
+
+            b = Bounds(lo, lo + w);
+            fresh = true;
+        }
+        return b;
+    }
+
     const Metadata& m;
 
-    Bounds b;
+    mutable Bounds b;
     Xyz p;
+    uint64_t d = 0;
+    mutable bool fresh = true;
+
+private:
+    // The distance from a cell boundary, in cells, within which bisection may
+    // place a value on either side of it.  Each bisected bound carries
+    // rounding error of up to an ulp of its magnitude per depth, which far
+    // from the origin may be a sizable fraction of a deep cell.
+    static double edgeTolerance(double lo, double hi, double cells)
+    {
+        const double magnitude(std::max(std::abs(lo), std::abs(hi)));
+        return 1e-6 +
+            64 * std::numeric_limits<double>::epsilon() *
+            magnitude / (hi - lo) * cells;
+    }
+
+    static bool quantize(
+            double v,
+            double lo,
+            double hi,
+            double cells,
+            uint64_t& out)
+    {
+        const double t((v - lo) / (hi - lo) * cells);
+
+        if (t <= 0) out = 0;
+        else if (t >= cells) out = static_cast<uint64_t>(cells) - 1;
+        else
+        {
+            const double f(std::floor(t));
+            const double frac(t - f);
+            out = static_cast<uint64_t>(f);
+
+            const double tolerance(edgeTolerance(lo, hi, cells));
+            if (frac < tolerance && out > 0) return false;
+            if (frac > 1.0 - tolerance && out + 1 < cells) return false;
+        }
+
+        return true;
+    }
 };
 
 inline bool operator<(const Key& a, const Key& b)
@@ -201,6 +325,19 @@ struct ChunkKey
 {
     ChunkKey(const Metadata& m) : k(m) { reset(); }
 
+    ChunkKey(const Metadata& m, const Dxyz& dxyz)
+        : ChunkKey(m)
+    {
+        while (d < dxyz.d)
+        {
+            const uint64_t shift(dxyz.d - d - 1);
+            step(toDir(
+                    (((dxyz.p.x >> shift) & 1) ? EwBit : 0) |
+                    (((dxyz.p.y >> shift) & 1) ? NsBit : 0) |
+                    (((dxyz.p.z >> shift) & 1) ? UdBit : 0)));
+        }
+    }
+
     void reset()
     {
         d = 0;
@@ -253,6 +390,58 @@ inline std::ostream& operator<<(std::ostream& os, const Xyz& xyz)
     return os;
 }
 
+// A Dxyz packed into 128 bits, for compact storage in large containers.  The
+// depth occupies the top 8 bits, followed by 40 bits each of X, Y, and Z, so
+// these order the same as their unpacked equivalents.  Positions must fit in
+// 40 bits, which is always true for depths of at most 40, so no node is ever
+// deeper than this - see Metadata::leafDepth.
+class PackedDxyz
+{
+public:
+    PackedDxyz() = default;
+
+    static constexpr uint64_t deepest() { return 40; }
+
+    explicit PackedDxyz(const Dxyz& k)
+    {
+        if (k.d > 0xff || (k.p.x | k.p.y | k.p.z) > mask())
+        {
+            throw std::runtime_error("Key too large to pack: " + k.toString());
+        }
+
+        m_hi = (k.d << 56) | (k.p.x << 16) | (k.p.y >> 24);
+        m_lo = (k.p.y << 40) | k.p.z;
+    }
+
+    Dxyz unpack() const
+    {
+        return Dxyz(
+                m_hi >> 56,
+                (m_hi >> 16) & mask(),
+                ((m_hi & 0xffff) << 24) | (m_lo >> 40),
+                m_lo & mask());
+    }
+
+    uint64_t hi() const { return m_hi; }
+    uint64_t lo() const { return m_lo; }
+
+private:
+    static constexpr uint64_t mask() { return (1ULL << 40) - 1; }
+
+    uint64_t m_hi = 0;
+    uint64_t m_lo = 0;
+};
+
+inline bool operator<(const PackedDxyz& a, const PackedDxyz& b)
+{
+    return a.hi() < b.hi() || (a.hi() == b.hi() && a.lo() < b.lo());
+}
+
+inline bool operator==(const PackedDxyz& a, const PackedDxyz& b)
+{
+    return a.hi() == b.hi() && a.lo() == b.lo();
+}
+
 inline std::ostream& operator<<(std::ostream& os, const Dxyz& dxyz)
 {
     os << dxyz.toString();
@@ -273,5 +462,29 @@ namespace std
                 std::hash<uint64_t>()(k.p.z);
         }
     };
+
+    template<> struct hash<entwine::Dxyz>
+    {
+        std::size_t operator()(const entwine::Dxyz& k) const
+        {
+            // Combine with a multiplicative mix so that neighboring keys, which
+            // differ only in their low bits, spread across buckets.
+            uint64_t h(k.d);
+            h = (h ^ k.p.x) * 0x9e3779b97f4a7c15ULL;
+            h = (h ^ k.p.y) * 0x9e3779b97f4a7c15ULL;
+            h = (h ^ k.p.z) * 0x9e3779b97f4a7c15ULL;
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+    };
+
+    template<> struct hash<entwine::PackedDxyz>
+    {
+        std::size_t operator()(const entwine::PackedDxyz& k) const
+        {
+            uint64_t h((k.hi() ^ (k.lo() >> 29)) * 0x9e3779b97f4a7c15ULL);
+            h = (h ^ k.lo()) * 0x9e3779b97f4a7c15ULL;
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+    };
 }
 
@@ -9,12 +9,21 @@
 ******************************************************************************/
 
 #include <cassert>
+#include <future>
+#include <string>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/formats/cesium/settings.hpp>
+#include <entwine/io/hierarchy.hpp>
 #include <entwine/io/io.hpp>
 #include <entwine/types/files.hpp>
+#include <entwine/types/key.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/types/reprojection.hpp>
 #include <entwine/types/schema.hpp>
+#include <entwine/types/selection.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/types/subset.hpp>
 #include <entwine/util/json.hpp>
@@ -23,9 +32,56 @@
 namespace entwine
 {
 
+namespace
+{
+    // The documents describing an existing dataset, which are independent of
+    // each other and so are fetched concurrently: its build metadata, its EPT
+    // metadata, and its list of files.
+    std::vector<std::string> fetchDocuments(
+            const arbiter::Endpoint& ep,
+            const std::string& postfix)
+    {
+        auto build(std::async(std::launch::async, [&ep, postfix]()
+        {
+            return ep.get("ept-build" + postfix + ".json");
+        }));
+        auto meta(std::async(std::launch::async, [&ep, postfix]()
+        {
+            return ep.get("ept" + postfix + ".json");
+        }));
+        auto list(std::async(std::launch::async, [&ep, postfix]()
+        {
+            return ensureGetString(
+                    ep.getSubEndpoint("ept-sources"),
+                    "list" + postfix + ".json");
+        }));
+
+        return { build.get(), meta.get(), list.get() };
+    }
+
+    // The existing settings override our own, except for an explicit depth
+    // limit for a preview, which may differ from that of the existing data.
+    json mergeExisting(const Config& c, const std::vector<std::string>& docs)
+    {
+        const json existing(
+                entwine::merge(json::parse(docs[0]), json::parse(docs[1])));
+        json j(entwine::merge(json(c), existing));
+        if (json(c).count("previewDepth"))
+        {
+            j["previewDepth"] = c.previewDepth();
+        }
+        return j;
+    }
+}
+
 Metadata::Metadata(const Config& config, const bool exists)
     : m_outSchema(makeUnique<Schema>(config.schema()))
-    , m_schema(makeUnique<Schema>(Schema::makeAbsolute(*m_outSchema)))
+    , m_absoluteSchema(
+            makeUnique<Schema>(Schema::makeAbsolute(*m_outSchema)))
+    , m_schema(makeUnique<Schema>(
+                config.packed() ?
+                    Schema::makePacked(*m_outSchema) :
+                    *m_absoluteSchema))
     , m_boundsConforming(makeUnique<Bounds>(
                 exists ?
                     config.boundsConforming() :
@@ -36,12 +92,14 @@ Metadata::Metadata(const Config& config, const bool exists)
                     makeCube(*m_boundsConforming)))
     , m_files(makeUnique<Files>(config.input()))
     , m_dataIo(DataIo::create(*this, config.dataType()))
+    , m_hierarchyType(config.hierType())
     , m_reprojection(config.reprojection())
     , m_eptVersion(exists ?
             makeUnique<Version>(config.version()) :
             makeUnique<Version>(currentEptVersion()))
     , m_srs(makeUnique<Srs>(config.srs()))
-    , m_subset(Subset::create(boundsCubic(), config.subset()))
+    , m_subset(
+            Subset::create(boundsCubic(), config.subset(), m_files->list()))
     , m_trustHeaders(config.trustHeaders())
     , m_span(config.span())
     , m_startDepth(std::log2(m_span))
@@ -50,12 +108,59 @@ Metadata::Metadata(const Config& config, const bool exists)
     , m_minNodeSize(config.minNodeSize())
     , m_maxNodeSize(config.maxNodeSize())
     , m_cacheSize(config.cacheSize())
+    , m_maxMemory(config.maxMemory())
+    , m_pinDepth(config.pinDepth())
+    , m_dataPrefixes(config.dataPrefixes())
+    , m_hierarchyPageNodes(config.hierarchyPageNodes())
+    , m_mergeData(config.mergeData())
+    , m_spill(config.spill())
+    , m_bulk(config.bulk())
+    , m_sparseAppend(config.sparseAppend())
+    , m_previewDepth(config.previewDepth())
+    , m_partitionDepth(config.partitionDepth())
+    , m_configuredLeafDepth(config.leafDepth())
+    , m_leafDepth(m_configuredLeafDepth ?
+            m_configuredLeafDepth :
+            PackedDxyz::deepest())
+    , m_leafPoints(config.leafPoints())
+    , m_thinned(config.thinned())
+    , m_fetchThreads(config.fetchThreads())
+    , m_reawakenThreads(config.reawakenThreads())
+    , m_compressionLevel(config.compressionLevel())
+    , m_nodeStats(config.nodeStats())
+    , m_statistics(config.statistics())
+    , m_subBlockDepth(config.subBlockDepth())
+    , m_packNodes(config.packNodes())
+    , m_las14(config.las14())
+    , m_pointOrder(config.pointOrder())
+    , m_selection(toSelection(config.selection()))
+    , m_dedup(toDedup(config.dedup()))
+    , m_duplicates(config.duplicates())
+    , m_cesiumConfig(config.cesium())
+    , m_cesium(m_cesiumConfig.is_object() ?
+            makeUnique<cesium::Settings>(m_cesiumConfig, *m_schema) :
+            std::unique_ptr<cesium::Settings>())
 {
     if (1ULL << m_startDepth != m_span)
     {
         throw std::runtime_error("Invalid voxel span");
     }
 
+    if (packed())
+    {
+        // These hand our points to PDAL or read them through PointRefs,
+        // which know nothing of our scaling.
+        if (m_dataIo->type() == "laszip")
+        {
+            throw std::runtime_error("Packed points require binary data");
+        }
+        if (m_cesium)
+        {
+            throw std::runtime_error("Packed points may not be used with "
+                    "cesium output");
+        }
+    }
+
     if (m_outSchema->isScaled())
     {
         const Scale scale(m_outSchema->scale());
@@ -93,42 +198,183 @@ Metadata::Metadata(const Config& config, const bool exists)
         }
     }
 
+    hierarchy::check(m_hierarchyType);
+
+    for (const std::string& name : m_nodeStats)
+    {
+        if (!m_schema->contains(name))
+        {
+            throw std::runtime_error("Invalid nodeStats dimension: " + name);
+        }
+    }
+
+    pointOrder::check(m_pointOrder, *m_schema);
+
+    if (m_statistics)
+    {
+        // An existing schema carries the statistics of the existing data.
+        m_dimStats = makeUnique<SharedDimStats>(
+                *m_schema,
+                exists ? config.toJson().value("schema", json()) : json());
+    }
+
+    if (m_subBlockDepth)
+    {
+        if (m_dataIo->type() != "binary")
+        {
+            throw std::runtime_error("Sub-blocks require the binary data type");
+        }
+        if (m_subBlockDepth > heuristics::maxSubBlockDepth)
+        {
+            throw std::runtime_error("Invalid subBlockDepth");
+        }
+    }
+
+    if (m_packNodes)
+    {
+        if (m_dataIo->type() == "laszip")
+        {
+            throw std::runtime_error("Packed nodes require non-laszip data");
+        }
+        if (m_subBlockDepth)
+        {
+            throw std::runtime_error("Packed nodes may not use sub-blocks");
+        }
+    }
+
+    if (m_dedup == Dedup::XyzTime && !m_schema->hasTime())
+    {
+        throw std::runtime_error("Dedup by time requires GpsTime");
+    }
+
+    if (m_bulk && m_spill)
+    {
+        throw std::runtime_error("Bulk builds never evict, so can't spill");
+    }
+
+    if (m_partitionDepth >= maxDepth)
+    {
+        throw std::runtime_error("Invalid partitionDepth");
+    }
+
+    if (m_pinDepth >= maxDepth) throw std::runtime_error("Invalid pinDepth");
+
+    if (m_mergeData.size()) m_mergeIo = DataIo::create(*this, "binary");
+
+    if (m_hierarchyPageNodes && m_hierarchyPageNodes < 16)
+    {
+        throw std::runtime_error("Invalid hierarchyPageNodes");
+    }
+
+    if (m_dataPrefixes == 1 || m_dataPrefixes > 65536)
+    {
+        throw std::runtime_error("Invalid dataPrefixes");
+    }
+
+    if (m_previewDepth && (
+                m_previewDepth >= maxDepth ||
+                m_previewDepth <= m_sharedDepth))
+    {
+        throw std::runtime_error("Invalid previewDepth");
+    }
+
+    if (m_configuredLeafDepth && (
+                m_configuredLeafDepth > PackedDxyz::deepest() ||
+                m_configuredLeafDepth <= m_sharedDepth ||
+                m_configuredLeafDepth < m_partitionDepth))
+    {
+        throw std::runtime_error("Invalid leafDepth");
+    }
+
+    if (m_cesium && m_subset)
+    {
+        throw std::runtime_error("Cesium output is not supported for subsets");
+    }
+
     if (m_outSchema->gpsScaleOffset() && m_dataIo->type() == "laszip")
     {
         throw std::runtime_error("Cannot scale GpsTime with laszip data type");
     }
+
+    if (m_las14 && m_dataIo->type() != "laszip")
+    {
+        throw std::runtime_error("LAS 1.4 output requires laszip data");
+    }
+
+    // Each subset would train a dictionary of its own.
+    if (m_subset && m_dataIo->type() == "zstandard-dictionary")
+    {
+        throw std::runtime_error("Subsets may not use zstandard-dictionary");
+    }
 }
 
 Metadata::Metadata(const arbiter::Endpoint& ep, const Config& c)
-    : Metadata(
-            entwine::merge(
-                json(c),
-                entwine::merge(
-                    json::parse(ep.get("ept-build" + c.postfix() + ".json")),
-                    json::parse(ep.get("ept" + c.postfix() + ".json")))),
-            true)
-{
-    Files files(Files::extract(ep, primary(), c.postfix()));
+    : Metadata(ep, c, fetchDocuments(ep, c.postfix()))
+{ }
+
+Metadata::Metadata(
+        const arbiter::Endpoint& ep,
+        const Config& c,
+        const std::vector<std::string>& docs)
+    : Metadata(mergeExisting(c, docs), true)
+{
+    // The detailed metadata of existing files is only needed to rewrite it,
+    // so it isn't loaded - it is copied over when saved.
+    FileInfoList list(Files::extract(ep, false, c.postfix(), docs[2]));
+
+    // The top of a preview depends on every point of its files, none of which
+    // were kept past its depth limit, so to continue it at any other depth
+    // each of them must be indexed again.
+    const uint64_t previewed(
+            json::parse(docs[0]).value("previewDepth", 0));
+    if (previewed && previewed != m_previewDepth)
+    {
+        m_rebuildingPreview = true;
+        list = Files::restart(list);
+        if (m_dimStats) m_dimStats->reset();
+    }
+    else if (!previewed && m_previewDepth)
+    {
+        throw std::runtime_error("A complete index may not become a preview");
+    }
+
+    m_dataIo->load(ep);
+
+    Files files(list);
     files.append(m_files->list());
     m_files = makeUnique<Files>(files.list());
+    m_files->deferDetails();
 }
 
 Metadata::~Metadata() { }
 
-void Metadata::save(const arbiter::Endpoint& ep, const Config& config) const
+void Metadata::save(
+        const arbiter::Endpoint& ep,
+        const Config& config,
+        Pool* pool,
+        const bool partial) const
 {
+    m_dataIo->save(ep);
+
     {
-        const json meta {
+        json meta {
             { "version", eptVersion().toString() },
             { "bounds", boundsCubic() },
             { "boundsConforming", boundsConforming() },
-            { "schema", *m_outSchema },
+            { "schema", m_dimStats ?
+                m_dimStats->annotate(*m_outSchema) :
+                json(*m_outSchema) },
             { "span", m_span },
-            { "points", m_files->totalInserts() },
+            {
+                "points",
+                m_files->totalInserts() - m_duplicates - m_thinned
+            },
             { "dataType", m_dataIo->type() },
-            { "hierarchyType", "json" }, // TODO
+            { "hierarchyType", m_hierarchyType },
             { "srs", *m_srs }
         };
+        if (partial) meta["partial"] = true;
+        if (m_dataPrefixes) meta["dataPrefixes"] = m_dataPrefixes;
 
         const std::string f("ept" + postfix() + ".json");
         ensurePut(ep, f, meta.dump(2));
@@ -142,8 +388,42 @@ void Metadata::save(const arbiter::Endpoint& ep, const Config& config) const
             { "overflowDepth", m_overflowDepth },
             { "minNodeSize", m_minNodeSize },
             { "maxNodeSize", m_maxNodeSize },
-            { "cacheSize", m_cacheSize }
+            { "cacheSize", m_cacheSize },
+            { "maxMemory", m_maxMemory },
+            { "spill", m_spill },
+            { "bulk", m_bulk },
+            { "selection", toString(m_selection) },
+            { "compressionLevel", m_compressionLevel }
         };
+        if (m_nodeStats.size()) buildMeta["nodeStats"] = m_nodeStats;
+        if (m_subBlockDepth) buildMeta["subBlockDepth"] = m_subBlockDepth;
+        if (m_packNodes) buildMeta["packNodes"] = true;
+        if (m_las14) buildMeta["las14"] = true;
+        if (m_statistics) buildMeta["statistics"] = true;
+        if (m_previewDepth) buildMeta["previewDepth"] = m_previewDepth;
+        if (m_partitionDepth) buildMeta["partitionDepth"] = m_partitionDepth;
+        if (m_pinDepth) buildMeta["pinDepth"] = m_pinDepth;
+        if (m_hierarchyPageNodes)
+        {
+            buildMeta["hierarchyPageNodes"] = m_hierarchyPageNodes;
+        }
+        if (m_subset && m_mergeData.size())
+        {
+            buildMeta["mergeData"] = m_mergeData;
+        }
+        if (m_pointOrder.size()) buildMeta["pointOrder"] = m_pointOrder;
+        if (m_configuredLeafDepth) buildMeta["leafDepth"] = m_leafDepth;
+        if (m_leafPoints)
+        {
+            buildMeta["leafPoints"] = m_leafPoints;
+            buildMeta["thinned"] = m_thinned;
+        }
+        if (m_dedup != Dedup::None)
+        {
+            buildMeta["dedup"] = toString(m_dedup);
+            buildMeta["duplicates"] = m_duplicates;
+        }
+        if (m_cesium) buildMeta["cesium"] = m_cesiumConfig;
         if (m_subset) buildMeta["subset"] = *m_subset;
         if (m_reprojection) buildMeta["reprojection"] = *m_reprojection;
 
@@ -152,12 +432,82 @@ void Metadata::save(const arbiter::Endpoint& ep, const Config& config) const
     }
 
     const bool detailed(!m_merged && primary());
-    m_files->save(ep, postfix(), config, detailed);
+    m_files->save(ep, postfix(), config, detailed, pool);
+}
+
+void Metadata::merge(const arbiter::Endpoint& ep, const std::string& postfix)
+{
+    // Only the list itself is needed, not the detailed metadata of its files.
+    m_files->merge(Files::extract(ep, false, postfix));
+
+    if (m_dedup != Dedup::None || m_leafPoints)
+    {
+        const json build(json::parse(ep.get("ept-build" + postfix + ".json")));
+        m_duplicates += build.value("duplicates", uint64_t(0));
+        m_thinned += build.value("thinned", uint64_t(0));
+    }
+
+    if (m_dimStats)
+    {
+        const json meta(json::parse(ep.get("ept" + postfix + ".json")));
+        m_dimStats->merge(meta.value("schema", json()));
+    }
+}
+
+void Metadata::combine(const Metadata& other, const Origin origin)
+{
+    m_boundsConforming->grow(other.boundsConforming());
+    m_duplicates += other.m_duplicates;
+    m_thinned += other.m_thinned;
+
+    if (!m_dimStats) return;
+
+    // Without statistics of its own, the other dataset leaves ours partial.
+    if (!other.m_dimStats)
+    {
+        m_dimStats.reset();
+        return;
+    }
+
+    json schema(other.m_dimStats->annotate(*other.m_outSchema));
+    for (json& d : schema)
+    {
+        if (d.at("name").get<std::string>() != "OriginId") continue;
+        if (!d.count("count")) continue;
+
+        for (const std::string key : { "minimum", "maximum", "mean" })
+        {
+            d[key] = d.at(key).get<double>() + origin;
+        }
+        if (d.count("counts"))
+        {
+            for (json& c : d.at("counts"))
+            {
+                c["value"] = c.at("value").get<uint64_t>() + origin;
+            }
+        }
+    }
+    m_dimStats->merge(schema);
 }
 
-void Metadata::merge(const Metadata& other)
+DimStatsList Metadata::dimStats() const
 {
-    m_files->merge(other.files());
+    if (m_dimStats) return m_dimStats->get();
+    return DimStatsList();
+}
+
+DimRanges Metadata::dimRanges() const
+{
+    DimRanges ranges;
+    const DimStatsList stats(dimStats());
+    for (std::size_t i(0); i < stats.size(); ++i)
+    {
+        if (stats[i].count())
+        {
+            ranges[m_schema->dims().at(i).name()] = stats[i].range();
+        }
+    }
+    return ranges;
 }
 
 void Metadata::makeWhole()
@@ -185,6 +535,53 @@ std::string Metadata::postfix(const uint64_t depth) const
     return "";
 }
 
+namespace
+{
+    // Hexadecimal, zero-padded to the width of the largest prefix.
+    std::string prefixName(const uint64_t prefix, const uint64_t prefixes)
+    {
+        std::size_t width(1);
+        while ((prefixes - 1) >> (4 * width)) ++width;
+
+        static const char digits[] = "0123456789abcdef";
+        std::string s(width, '0');
+        for (std::size_t i(0); i < width; ++i)
+        {
+            s[width - i - 1] = digits[(prefix >> (4 * i)) & 0xf];
+        }
+        return s;
+    }
+}
+
+std::string Metadata::dataName(const Dxyz& key) const
+{
+    if (!m_dataPrefixes) return key.toString();
+
+    // FNV-1a over the key, which unlike std::hash is the same everywhere.
+    uint64_t h(0xcbf29ce484222325ULL);
+    for (const uint64_t v : { key.d, key.p.x, key.p.y, key.p.z })
+    {
+        for (std::size_t i(0); i < 8; ++i)
+        {
+            h ^= (v >> (8 * i)) & 0xff;
+            h *= 0x100000001b3ULL;
+        }
+    }
+
+    return prefixName(h % m_dataPrefixes, m_dataPrefixes) + "/" +
+        key.toString();
+}
+
+std::vector<std::string> Metadata::dataDirs() const
+{
+    std::vector<std::string> dirs;
+    for (uint64_t i(0); i < m_dataPrefixes; ++i)
+    {
+        dirs.push_back(prefixName(i, m_dataPrefixes));
+    }
+    return dirs;
+}
+
 Bounds Metadata::makeConformingBounds(Bounds b) const
 {
     Point pmin(b.min());
@@ -19,6 +19,7 @@
 #include <entwine/builder/config.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/defs.hpp>
+#include <entwine/types/dim-stats.hpp>
 #include <entwine/types/subset.hpp>
 
 namespace Json { class Value; }
@@ -28,11 +29,17 @@ namespace arbiter { class Endpoint; }
 namespace entwine
 {
 
+namespace cesium { class Settings; }
+
 class DataIo;
 class Files;
 class Point;
+class Pool;
 class Reprojection;
 class Schema;
+struct Dxyz;
+enum class Dedup;
+enum class Selection;
 class Srs;
 class Version;
 
@@ -49,8 +56,21 @@ public:
 
     ~Metadata();
 
-    void merge(const Metadata& other);
-    void save(const arbiter::Endpoint& endpoint, const Config& config) const;
+    // Adds the file statistics and dimension statistics of another subset of
+    // this dataset, whose metadata carries this postfix.
+    void merge(const arbiter::Endpoint& endpoint, const std::string& postfix);
+
+    // Adds the conforming bounds and dimension statistics of an independent
+    // dataset being combined with ours, whose files follow our own from this
+    // origin.  Its files themselves are appended as a continuation would.
+    void combine(const Metadata& other, Origin origin);
+    // Per-file metadata is written on the given pool, if any.  A partial
+    // save marks ept.json as the snapshot of a build still in progress.
+    void save(
+            const arbiter::Endpoint& endpoint,
+            const Config& config,
+            Pool* pool = nullptr,
+            bool partial = false) const;
 
     const Bounds& boundsConforming() const { return *m_boundsConforming; }
     const Bounds& boundsCubic() const { return *m_boundsCubic; }
@@ -60,12 +80,32 @@ public:
         else return nullptr;
     }
 
+    // The layout of points in memory during the build, which is either the
+    // absolute schema or, if packing, the same with scaled XYZ.
     const Schema& schema() const { return *m_schema; }
     const Schema& outSchema() const { return *m_outSchema; }
+
+    // The layout in which input is read, with XYZ as doubles.
+    const Schema& absoluteSchema() const { return *m_absoluteSchema; }
+    bool packed() const { return m_schema->isScaled(); }
     const Files& files() const { return *m_files; }
 
     const DataIo& dataIo() const { return *m_dataIo; }
 
+    // With mergeData, the shared-depth nodes of a subset are written there
+    // as uncompressed binary, rather than to the output, until the subsets
+    // are merged.  This is the data type of the nodes at this depth.
+    const DataIo& dataIo(uint64_t depth) const
+    {
+        return mergesAt(depth) ? *m_mergeIo : *m_dataIo;
+    }
+    bool mergesAt(uint64_t depth) const
+    {
+        return m_mergeIo && m_subset && depth < m_sharedDepth;
+    }
+    const std::string& mergeData() const { return m_mergeData; }
+    const std::string& hierarchyType() const { return m_hierarchyType; }
+
     const Reprojection* reprojection() const { return m_reprojection.get(); }
     const Subset* subset() const { return m_subset.get(); }
 
@@ -82,22 +122,135 @@ public:
     uint64_t minNodeSize() const { return m_minNodeSize; }
     uint64_t maxNodeSize() const { return m_maxNodeSize; }
     uint64_t cacheSize() const { return m_cacheSize; }
+    uint64_t maxMemory() const { return m_maxMemory; }
+
+    // Nodes above this depth stay resident until the end of the build, and
+    // don't count toward the cache.  Zero if disabled.
+    uint64_t pinDepth() const { return m_pinDepth; }
+
+    // If set, hierarchy pages are split per subtree to hold about this many
+    // nodes each, rather than at a fixed depth step.
+    uint64_t hierarchyPageNodes() const { return m_hierarchyPageNodes; }
+    bool spill() const { return m_spill; }
+
+    // If set, every node stays resident until the end of the build, when they
+    // are all serialized at once.
+    bool bulk() const { return m_bulk; }
+
+    // If set, a continued build leaves the nodes which already exist in place,
+    // so new points descend past them into new nodes.
+    bool sparseAppend() const { return m_sparseAppend; }
+
+    // Points which would descend to this depth or beyond are discarded, so
+    // only the top of the tree is built.  Zero if disabled.
+    uint64_t previewDepth() const { return m_previewDepth; }
+
+    // True if an existing preview is being rebuilt at a different depth limit,
+    // or with none, in which case all of its files are indexed again from
+    // scratch.
+    bool rebuildingPreview() const { return m_rebuildingPreview; }
+
+    // Above this depth, each thread selects points privately and merges its
+    // selections into the shared chunks periodically.  Zero if disabled.
+    uint64_t partitionDepth() const { return m_partitionDepth; }
+
+    // Nodes at this depth are leaves, which never split.  Points which don't
+    // win a voxel of a leaf are kept in its overflow, up to leafPoints of
+    // them if that is nonzero, past which they are thinned away.  Without a
+    // configured depth, the deepest depth the tree may reach is a leaf.
+    uint64_t leafDepth() const { return m_leafDepth; }
+    uint64_t leafPoints() const { return m_leafPoints; }
+    uint64_t thinned() const { return m_thinned; }
+    void addThinned(uint64_t n) { m_thinned += n; }
+
+    // Number of threads fetching serialized chunks ahead of their
+    // reawakening.  Zero if disabled.
+    uint64_t fetchThreads() const { return m_fetchThreads; }
+
+    // Number of threads reloading reawakened chunks, while the threads which
+    // reawakened them carry on inserting.  Zero if disabled.
+    uint64_t reawakenThreads() const { return m_reawakenThreads; }
+    int compressionLevel() const { return m_compressionLevel; }
+
+    // Dimensions whose per-node ranges are recorded alongside the hierarchy.
+    const std::vector<std::string>& nodeStats() const { return m_nodeStats; }
+
+    // If set, the statistics of every dimension are accumulated as points are
+    // inserted, and written into the schema of the EPT metadata.
+    bool statistics() const { return m_statistics; }
+
+    // The statistics of each dimension of our schema, in order, or of the
+    // existing data if read.  Empty if not accumulated.
+    DimStatsList dimStats() const;
+
+    // The extents of every point of the dataset, by dimension name, from our
+    // statistics.  Empty if not accumulated.
+    DimRanges dimRanges() const;
+
+    // Each chunk is sorted into 8^depth spatial sub-blocks, in Morton order,
+    // so that small queries may read only part of it.  Zero if disabled.
+    uint64_t subBlockDepth() const { return m_subBlockDepth; }
+
+    // Once the build completes, the nodes of each hierarchy file are packed
+    // into a single blob, from which they are read with range requests.
+    bool packNodes() const { return m_packNodes; }
+
+    // Laszip nodes are written as LAS 1.4 with point formats 6 through 8,
+    // whose layered compression allows reading only some dimensions.
+    bool las14() const { return m_las14; }
+
+    // The order into which each node's points are sorted before they are
+    // encoded.  Empty if points are left in insertion order.
+    const std::string& pointOrder() const { return m_pointOrder; }
+
+    // How points contend for occupied voxels.
+    Selection selection() const { return m_selection; }
+
+    // Which exact duplicates are dropped, and how many have been dropped
+    // across every run of this build.  They are counted among the inserts of
+    // our files, so they are subtracted from the total point count, as are
+    // thinned points.
+    Dedup dedup() const { return m_dedup; }
+    uint64_t duplicates() const { return m_duplicates; }
+    void addDuplicates(uint64_t n) { m_duplicates += n; }
+
+    // If set, each node is also written as a 3D Tiles tile as it is saved.
+    const cesium::Settings* cesium() const { return m_cesium.get(); }
+    const json& cesiumConfig() const { return m_cesiumConfig; }
 
     void makeWhole();
 
     std::string postfix() const;
     std::string postfix(uint64_t depth) const;
 
+    // The path of a node's data within ept-data, without its extension or
+    // any postfix.  With dataPrefixes, nodes are spread by a hash of their
+    // key over that many subdirectories, since object stores limit the
+    // request rate of each prefix.
+    uint64_t dataPrefixes() const { return m_dataPrefixes; }
+    std::string dataName(const Dxyz& key) const;
+
+    // Each of those subdirectories, if any.
+    std::vector<std::string> dataDirs() const;
+
 private:
     Metadata& operator=(const Metadata& other);
 
+    // Given the build metadata, EPT metadata, and file list documents.
+    Metadata(
+            const arbiter::Endpoint& endpoint,
+            const Config& config,
+            const std::vector<std::string>& docs);
+
     Bounds makeConformingBounds(Bounds b) const;
     Bounds makeCube(const Bounds& b) const;
 
     // These are aggregated as the Builder runs.
     Files& mutableFiles() { return *m_files; }
+    SharedDimStats* mutableDimStats() { return m_dimStats.get(); }
 
     std::unique_ptr<Schema> m_outSchema;
+    std::unique_ptr<Schema> m_absoluteSchema;
     std::unique_ptr<Schema> m_schema;
 
     std::unique_ptr<Bounds> m_boundsConforming;
@@ -105,6 +258,7 @@ private:
 
     std::unique_ptr<Files> m_files;
     std::unique_ptr<DataIo> m_dataIo;
+    const std::string m_hierarchyType;
     std::unique_ptr<Reprojection> m_reprojection;
     std::unique_ptr<Version> m_eptVersion;
     std::unique_ptr<Srs> m_srs;
@@ -120,8 +274,39 @@ private:
     const uint64_t m_minNodeSize;
     const uint64_t m_maxNodeSize;
     const uint64_t m_cacheSize;
+    const uint64_t m_maxMemory;
+    const uint64_t m_pinDepth;
+    const uint64_t m_dataPrefixes;
+    const uint64_t m_hierarchyPageNodes;
+    const std::string m_mergeData;
+    std::unique_ptr<DataIo> m_mergeIo;
+    const bool m_spill;
+    const bool m_bulk;
+    const bool m_sparseAppend;
+    const uint64_t m_previewDepth;
+    const uint64_t m_partitionDepth;
+    const uint64_t m_configuredLeafDepth;
+    const uint64_t m_leafDepth;
+    const uint64_t m_leafPoints;
+    uint64_t m_thinned;
+    const uint64_t m_fetchThreads;
+    const uint64_t m_reawakenThreads;
+    const int m_compressionLevel;
+    const std::vector<std::string> m_nodeStats;
+    const bool m_statistics;
+    std::unique_ptr<SharedDimStats> m_dimStats;
+    const uint64_t m_subBlockDepth;
+    const bool m_packNodes;
+    const bool m_las14;
+    const std::string m_pointOrder;
+    const Selection m_selection;
+    const Dedup m_dedup;
+    uint64_t m_duplicates;
+    const json m_cesiumConfig;
+    std::unique_ptr<cesium::Settings> m_cesium;
 
     bool m_merged = false;
+    bool m_rebuildingPreview = false;
 };
 
 } // namespace entwine
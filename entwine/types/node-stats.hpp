@@ -0,0 +1,58 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// The extents of a single dimension's values over the points of one node.
+struct DimRange
+{
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+
+    void add(double v)
+    {
+        min = std::min(min, v);
+        max = std::max(max, v);
+    }
+
+    bool empty() const { return min > max; }
+};
+
+inline void to_json(json& j, const DimRange& r)
+{
+    j = json::array({ r.min, r.max });
+}
+
+inline void from_json(const json& j, DimRange& r)
+{
+    r.min = j.at(0).get<double>();
+    r.max = j.at(1).get<double>();
+}
+
+// While building, the ranges of a node's points for each dimension listed in
+// the nodeStats configuration, in that order.
+using NodeStats = std::vector<DimRange>;
+
+// While reading, the ranges of a node's points by dimension name.
+using DimRanges = std::map<std::string, DimRange>;
+
+} // namespace entwine
+
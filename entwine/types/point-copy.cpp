@@ -0,0 +1,116 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/point-copy.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace entwine
+{
+
+namespace
+{
+
+void copyAny(char* dst, const char* src, std::size_t size)
+{
+    std::memcpy(dst, src, size);
+}
+
+// Swap through a buffer of the largest fixed size at a time, rather than a
+// byte at a time.
+void swapAny(char* a, char* b, std::size_t size)
+{
+    const std::size_t step(PointCopy::maxFixedSize);
+    char tmp[PointCopy::maxFixedSize];
+    while (size)
+    {
+        const std::size_t n(std::min(size, step));
+        std::memcpy(tmp, a, n);
+        std::memcpy(a, b, n);
+        std::memcpy(b, tmp, n);
+        a += n;
+        b += n;
+        size -= n;
+    }
+}
+
+template <std::size_t N>
+void copyFixed(char* dst, const char* src, std::size_t)
+{
+    std::memcpy(dst, src, N);
+}
+
+template <std::size_t N>
+void swapFixed(char* a, char* b, std::size_t)
+{
+    char tmp[N];
+    std::memcpy(tmp, a, N);
+    std::memcpy(a, b, N);
+    std::memcpy(b, tmp, N);
+}
+
+struct Kernels
+{
+    PointCopy::Copy copy = copyAny;
+    PointCopy::Swap swap = swapAny;
+};
+
+using Table = std::array<Kernels, PointCopy::maxFixedSize + 1>;
+
+template <std::size_t N>
+struct Fill
+{
+    static void fill(Table& table)
+    {
+        table[N].copy = copyFixed<N>;
+        table[N].swap = swapFixed<N>;
+        Fill<N - 1>::fill(table);
+    }
+};
+
+template <>
+struct Fill<0>
+{
+    static void fill(Table&) { }
+};
+
+Table makeTable()
+{
+    Table t;
+    Fill<PointCopy::maxFixedSize>::fill(t);
+    return t;
+}
+
+const Table& table()
+{
+    static const Table t(makeTable());
+    return t;
+}
+
+} // unnamed namespace
+
+PointCopy::PointCopy(const std::size_t size)
+    : m_size(size)
+    , m_fixed(size && size <= maxFixedSize)
+    , m_copy(copyAny)
+    , m_swap(swapAny)
+{
+    if (m_fixed)
+    {
+        const Kernels& k(table()[size]);
+        m_copy = k.copy;
+        m_swap = k.swap;
+    }
+}
+
+} // namespace entwine
+
@@ -0,0 +1,46 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+
+namespace entwine
+{
+
+// Copies and swaps of whole points.  For any point size up to
+// maxFixedSize, these are compiled for that exact size so the compiler can
+// unroll them rather than looping over a size known only at runtime.  Larger
+// points fall back to the generic versions.
+class PointCopy
+{
+public:
+    using Copy = void (*)(char* dst, const char* src, std::size_t size);
+    using Swap = void (*)(char* a, char* b, std::size_t size);
+
+    static const std::size_t maxFixedSize = 128;
+
+    explicit PointCopy(std::size_t size);
+
+    void copy(char* dst, const char* src) const { m_copy(dst, src, m_size); }
+    void swap(char* a, char* b) const { m_swap(a, b, m_size); }
+
+    std::size_t size() const { return m_size; }
+    bool fixed() const { return m_fixed; }
+
+private:
+    std::size_t m_size;
+    bool m_fixed;
+    Copy m_copy;
+    Swap m_swap;
+};
+
+} // namespace entwine
+
@@ -0,0 +1,153 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/point-order.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/schema.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/hilbert.hpp>
+
+namespace entwine
+{
+namespace pointOrder
+{
+
+namespace
+{
+
+const uint64_t bits(21);
+const uint64_t cells(1ULL << bits);
+
+// The cell of v along one axis of the given bounds, clamped so that points on
+// or beyond the edges land in the outermost cells.
+uint64_t cell(const Bounds& b, std::size_t axis, double v)
+{
+    const double size(b.max()[axis] - b.min()[axis]);
+    if (size <= 0) return 0;
+
+    const double c(std::floor((v - b.min()[axis]) / size * cells));
+    if (c <= 0) return 0;
+    return std::min<uint64_t>(static_cast<uint64_t>(c), cells - 1);
+}
+
+// Spread the low 21 bits of v so that each is followed by two zero bits.
+uint64_t spread(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Reverse the order of the 3-bit octant digits of a Morton code, so that the
+// octant of the coarsest level becomes the least significant.
+uint64_t reverseOctants(const uint64_t code)
+{
+    uint64_t result(0);
+    for (uint64_t level(0); level < bits; ++level)
+    {
+        result |= ((code >> (3 * level)) & 7) << (3 * (bits - level - 1));
+    }
+    return result;
+}
+
+// Map a double onto an unsigned integer of the same ordering.
+uint64_t orderable(double d)
+{
+    uint64_t u(0);
+    std::memcpy(&u, &d, sizeof(u));
+    return (u >> 63) ? ~u : u | (1ULL << 63);
+}
+
+} // unnamed namespace
+
+void check(const std::string& order, const Schema& schema)
+{
+    if (order.empty() || order == "morton" || order == "hilbert") return;
+    if (order == "progressive") return;
+
+    if (order == "gpsTime")
+    {
+        if (!schema.hasTime())
+        {
+            throw std::runtime_error("Point order gpsTime requires GpsTime");
+        }
+        return;
+    }
+
+    throw std::runtime_error("Invalid point order: " + order);
+}
+
+void sort(
+        const std::string& order,
+        const Bounds& bounds,
+        BlockPointTable& table)
+{
+    if (order.empty()) return;
+
+    // Compute a single integral code per point, and then sort the codes along
+    // with their point references rather than comparing points directly.
+    const uint64_t np(table.size());
+    std::vector<std::pair<uint64_t, char*>> coded(np);
+
+    const bool direct(table.directXyz());
+    pdal::PointRef pr(table, 0);
+    for (uint64_t i(0); i < np; ++i)
+    {
+        pr.setPointId(i);
+
+        uint64_t code(0);
+        if (order == "gpsTime")
+        {
+            code = orderable(pr.getFieldAs<double>(DimId::GpsTime));
+        }
+        else
+        {
+            const Point p(
+                    direct ?
+                        table.xyz(table.getPoint(i)) :
+                        Point(
+                            pr.getFieldAs<double>(DimId::X),
+                            pr.getFieldAs<double>(DimId::Y),
+                            pr.getFieldAs<double>(DimId::Z)));
+
+            const uint64_t x(cell(bounds, 0, p.x));
+            const uint64_t y(cell(bounds, 1, p.y));
+            const uint64_t z(cell(bounds, 2, p.z));
+
+            if (order == "hilbert") code = hilbert(x, y, bits) << bits | z;
+            else code = spread(x) | spread(y) << 1 | spread(z) << 2;
+
+            if (order == "progressive") code = reverseOctants(code);
+        }
+
+        coded[i] = std::make_pair(code, table.getPoint(i));
+    }
+
+    std::sort(coded.begin(), coded.end());
+
+    std::vector<char*>& refs(table.refs());
+    for (uint64_t i(0); i < np; ++i) refs[i] = coded[i].second;
+}
+
+} // namespace pointOrder
+} // namespace entwine
@@ -0,0 +1,39 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+namespace entwine
+{
+
+class BlockPointTable;
+class Bounds;
+class Schema;
+
+namespace pointOrder
+{
+
+// Valid orders are "morton" and "hilbert", which order points spatially within
+// the bounds of their node, and "gpsTime".  The "progressive" order is Morton
+// order with the octants of each level reversed, so the coarsest octant varies
+// fastest and any prefix of a node is spread evenly over its bounds.  An empty
+// order leaves points in the order in which they were inserted.
+void check(const std::string& order, const Schema& schema);
+
+// Reorder the points of this table in place, before they are encoded.
+void sort(
+        const std::string& order,
+        const Bounds& bounds,
+        BlockPointTable& table);
+
+} // namespace pointOrder
+} // namespace entwine
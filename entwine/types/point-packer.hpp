@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <entwine/types/schema.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+// Converts points from a layout which differs from another only in the
+// representation of its XYZ, for example from the absolute schema in which
+// input is read to the packed schema in which points are held while building.
+// Every other dimension is copied verbatim.
+class PointPacker
+{
+    struct Run
+    {
+        std::size_t src = 0;
+        std::size_t dst = 0;
+        std::size_t size = 0;
+    };
+
+public:
+    PointPacker(const Schema& from, const Schema& to)
+        : m_from(from)
+        , m_to(to)
+    {
+        if (!m_from.direct() || !m_to.direct())
+        {
+            throw std::runtime_error("Cannot pack points without direct XYZ");
+        }
+
+        const pdal::PointLayout& src(from.pdalLayout());
+        const pdal::PointLayout& dst(to.pdalLayout());
+
+        for (const pdal::DimType& dim : dst.dimTypes())
+        {
+            const DimId id(dim.m_id);
+            if (id == DimId::X || id == DimId::Y || id == DimId::Z) continue;
+
+            if (src.dimType(id) != dim.m_type)
+            {
+                throw std::runtime_error("Mismatched dimension while packing");
+            }
+
+            Run run;
+            run.src = src.dimOffset(id);
+            run.dst = dst.dimOffset(id);
+            run.size = pdal::Dimension::size(dim.m_type);
+
+            if (m_runs.size())
+            {
+                Run& last(m_runs.back());
+                if (
+                        last.src + last.size == run.src &&
+                        last.dst + last.size == run.dst)
+                {
+                    last.size += run.size;
+                    continue;
+                }
+            }
+
+            m_runs.push_back(run);
+        }
+    }
+
+    void pack(const char* src, char* dst) const
+    {
+        for (const Run& run : m_runs)
+        {
+            std::memcpy(dst + run.dst, src + run.src, run.size);
+        }
+        m_to.set(dst, m_from.get(src));
+    }
+
+private:
+    const XyzAccess m_from;
+    const XyzAccess m_to;
+    std::vector<Run> m_runs;
+};
+
+} // namespace entwine
+
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 
 #include <entwine/types/defs.hpp>
@@ -63,5 +65,59 @@ private:
 
 typedef std::map<Origin, PointStats> PointStatsMap;
 
+// Running totals which many threads add to at once.  Each thread adds to its
+// own shard without locking, and reads sum every shard, so a read never sees
+// a torn value and is exact once its writers have finished.
+class SharedPointStats
+{
+public:
+    SharedPointStats() = default;
+    SharedPointStats(const SharedPointStats&) = delete;
+    SharedPointStats& operator=(const SharedPointStats&) = delete;
+
+    void add(const PointStats& stats)
+    {
+        Shard& shard(mine());
+        shard.inserts.fetch_add(stats.inserts(), std::memory_order_relaxed);
+        shard.oob.fetch_add(stats.outOfBounds(), std::memory_order_relaxed);
+    }
+
+    void addOutOfBounds(uint64_t n)
+    {
+        mine().oob.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    PointStats get() const
+    {
+        uint64_t inserts(0);
+        uint64_t oob(0);
+        for (const Shard& shard : m_shards)
+        {
+            inserts += shard.inserts.load(std::memory_order_relaxed);
+            oob += shard.oob.load(std::memory_order_relaxed);
+        }
+        return PointStats(inserts, oob);
+    }
+
+private:
+    // Padded so that neighboring shards don't share a cache line.
+    struct Shard
+    {
+        std::atomic<uint64_t> inserts { 0 };
+        std::atomic<uint64_t> oob { 0 };
+        char pad[64 - 2 * sizeof(std::atomic<uint64_t>)];
+    };
+
+    Shard& mine()
+    {
+        static std::atomic<std::size_t> next(0);
+        thread_local const std::size_t index(next++ % shardCount);
+        return m_shards[index];
+    }
+
+    static constexpr std::size_t shardCount = 16;
+    std::array<Shard, shardCount> m_shards;
+};
+
 } // namespace entwine
 
@@ -22,10 +22,15 @@ namespace entwine
 class Reprojection
 {
 public:
-    Reprojection(std::string in, std::string out, bool hammer = false)
+    Reprojection(
+            std::string in,
+            std::string out,
+            bool hammer = false,
+            bool native = false)
         : m_in(in)
         , m_out(out)
         , m_hammer(hammer)
+        , m_native(native)
     {
         if (m_out.empty())
         {
@@ -42,7 +47,8 @@ public:
         : Reprojection(
                 j.value("in", ""),
                 j.value("out", ""),
-                j.value("hammer", false))
+                j.value("hammer", false),
+                j.value("native", false))
     { }
 
     static std::unique_ptr<Reprojection> create(const json& j)
@@ -55,11 +61,16 @@ public:
     std::string out() const { return m_out; }
     bool hammer() const { return m_hammer; }
 
+    // If true, entwine transforms the coordinates itself rather than adding
+    // a PDAL reprojection filter to each pipeline.
+    bool native() const { return m_native; }
+
 private:
     std::string m_in;
     std::string m_out;
 
     bool m_hammer = false;
+    bool m_native = false;
 };
 
 inline void to_json(json& j, const Reprojection& r)
@@ -67,6 +78,7 @@ inline void to_json(json& j, const Reprojection& r)
     j["out"] = r.out();
     if (r.in().size()) j["in"] = r.in();
     if (r.hammer()) j["hammer"] = true;
+    if (r.native()) j["native"] = true;
 }
 
 inline std::ostream& operator<<(std::ostream& os, const Reprojection& r)
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <cmath>
+#include <cstddef>
+
 #include <entwine/types/point.hpp>
 
 namespace entwine
@@ -34,6 +37,18 @@ public:
             offset());
     }
 
+    // Clip n coordinates of one axis in place, as clip does per point.
+    // Branch-free, so the compiler may vectorize it over a column of points.
+    void clip(double* v, std::size_t n, std::size_t axis) const
+    {
+        const double s(m_scale[axis]);
+        const double o(m_offset[axis]);
+        for (std::size_t i(0); i < n; ++i)
+        {
+            v[i] = Point::unscale(std::round(Point::scale(v[i], s, o)), s, o);
+        }
+    }
+
 private:
     const Scale m_scale = 1;
     const Offset m_offset = 0;
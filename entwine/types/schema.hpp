@@ -236,22 +236,39 @@ public:
 
     static Schema makeAbsolute(const Schema& s)
     {
-        const Schema xyz(DimList {
-            { DimId::X, DimType::Double },
-            { DimId::Y, DimType::Double },
-            { DimId::Z, DimType::Double }
-        });
-
-        Schema rest = s.filter(DimId::X).filter(DimId::Y).filter(DimId::Z);
+        return withXyz(
+                Schema(DimList {
+                    { DimId::X, DimType::Double },
+                    { DimId::Y, DimType::Double },
+                    { DimId::Z, DimType::Double }
+                }),
+                s);
+    };
 
-        if (s.hasTime())
+    // Like makeAbsolute, but XYZ are kept in their scaled form if they are
+    // scaled 32-bit integers, so points held in memory stay compact.  Their
+    // values are then only meaningful along with this schema's scale and
+    // offset.
+    static Schema makePacked(const Schema& s)
+    {
+        const DimId ids[] = { DimId::X, DimId::Y, DimId::Z };
+        for (const DimId id : ids)
         {
-            DimInfo& gps = rest.find(DimId::GpsTime);
-            gps = DimInfo(DimId::GpsTime);
+            if (!s.contains(id) || s.find(id).type() != DimType::Signed32)
+            {
+                return makeAbsolute(s);
+            }
         }
-
-        return xyz.merge(rest);
-    };
+        if (!s.isScaled()) return makeAbsolute(s);
+
+        return withXyz(
+                Schema(DimList {
+                    s.find(DimId::X),
+                    s.find(DimId::Y),
+                    s.find(DimId::Z)
+                }),
+                s);
+    }
 
     std::vector<DimId> ids() const
     {
@@ -285,6 +302,21 @@ public:
     }
 
 private:
+    // The given XYZ followed by the rest of the dimensions of s, with
+    // GpsTime unscaled.
+    static Schema withXyz(const Schema& xyz, const Schema& s)
+    {
+        Schema rest = s.filter(DimId::X).filter(DimId::Y).filter(DimId::Z);
+
+        if (s.hasTime())
+        {
+            DimInfo& gps = rest.find(DimId::GpsTime);
+            gps = DimInfo(DimId::GpsTime);
+        }
+
+        return xyz.merge(rest);
+    }
+
     std::unique_ptr<pdal::PointLayout> makePointLayout(DimList& dims)
     {
         std::unique_ptr<pdal::PointLayout> layout(new FixedPointLayout());
@@ -0,0 +1,66 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/selection.hpp>
+
+#include <stdexcept>
+
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+Selection toSelection(const std::string& s)
+{
+    if (s == "center") return Selection::Center;
+    if (s == "first") return Selection::First;
+    if (s == "random") return Selection::Random;
+    throw std::runtime_error("Invalid selection: " + s);
+}
+
+std::string toString(const Selection selection)
+{
+    switch (selection)
+    {
+        case Selection::First: return "first";
+        case Selection::Random: return "random";
+        default: return "center";
+    }
+}
+
+Dedup toDedup(const std::string& s)
+{
+    if (s == "none") return Dedup::None;
+    if (s == "xyz") return Dedup::Xyz;
+    if (s == "xyzt") return Dedup::XyzTime;
+    throw std::runtime_error("Invalid dedup: " + s);
+}
+
+std::string toString(const Dedup dedup)
+{
+    switch (dedup)
+    {
+        case Dedup::Xyz: return "xyz";
+        case Dedup::XyzTime: return "xyzt";
+        default: return "none";
+    }
+}
+
+DuplicateTest::DuplicateTest(const Dedup dedup, const Schema& schema)
+    : m_dedup(dedup)
+{
+    if (m_dedup != Dedup::XyzTime) return;
+
+    const pdal::PointLayout& layout(schema.pdalLayout());
+    m_timeOffset = layout.dimOffset(DimId::GpsTime);
+    m_timeSize = pdal::Dimension::size(layout.dimType(DimId::GpsTime));
+}
+
+} // namespace entwine
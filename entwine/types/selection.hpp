@@ -0,0 +1,123 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <entwine/types/key.hpp>
+#include <entwine/types/point.hpp>
+
+namespace entwine
+{
+
+// How points contend for an occupied voxel.  With Center, the point nearest
+// the center of the voxel is retained.  With First, the first point to arrive
+// is retained, so occupants are never displaced.  With Random, the point with
+// the lowest hash of its coordinates is retained, which picks uniformly among
+// the contenders regardless of the order in which they arrive.
+enum class Selection
+{
+    Center,
+    First,
+    Random
+};
+
+// Valid names are "center", "first", and "random".
+Selection toSelection(const std::string& s);
+std::string toString(Selection selection);
+
+// Which points contending for an occupied voxel are exact duplicates of its
+// occupant, to be dropped rather than cascading deeper.  With Xyz, those at
+// the same position, and with XyzTime, those also with the same GpsTime.
+enum class Dedup
+{
+    None,
+    Xyz,
+    XyzTime
+};
+
+// Valid names are "none", "xyz", and "xyzt".
+Dedup toDedup(const std::string& s);
+std::string toString(Dedup dedup);
+
+class Schema;
+
+// Whether a point is an exact duplicate of a voxel's occupant, by comparing
+// positions and, with XyzTime, the raw GpsTime bytes of their point data.
+class DuplicateTest
+{
+public:
+    DuplicateTest(Dedup dedup, const Schema& schema);
+
+    bool operator()(
+            const Point& a,
+            const char* aData,
+            const Point& b,
+            const char* bData) const
+    {
+        if (m_dedup == Dedup::None || !(a == b)) return false;
+        return !m_timeSize || !std::memcmp(
+                aData + m_timeOffset,
+                bData + m_timeOffset,
+                m_timeSize);
+    }
+
+private:
+    const Dedup m_dedup;
+    std::size_t m_timeOffset = 0;
+    std::size_t m_timeSize = 0;
+};
+
+namespace selection
+{
+
+inline uint64_t rank(const Point& p)
+{
+    const double v[] = { p.x, p.y, p.z };
+
+    uint64_t h(0);
+    for (const double d : v)
+    {
+        uint64_t bits(0);
+        std::memcpy(&bits, &d, sizeof(double));
+        h = (h ^ bits) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+// True if the candidate should displace the current occupant of the voxel
+// at this key.
+inline bool displaces(
+        Selection selection,
+        const Point& candidate,
+        const Point& current,
+        const Key& key)
+{
+    switch (selection)
+    {
+        case Selection::First:
+            return false;
+        case Selection::Random:
+            return rank(candidate) < rank(current);
+        default:
+        {
+            const Point& mid(key.bounds().mid());
+            return candidate.sqDist3d(mid) < current.sqDist3d(mid);
+        }
+    }
+}
+
+} // namespace selection
+} // namespace entwine
@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/srs-transform.hpp>
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#ifdef ENTWINE_HAVE_PROJ
+#include <proj.h>
+#endif
+
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+#ifdef ENTWINE_HAVE_PROJ
+
+namespace
+{
+    PJ_CONTEXT* ctx(void* p) { return static_cast<PJ_CONTEXT*>(p); }
+    PJ* pj(void* p) { return static_cast<PJ*>(p); }
+
+    std::string describe(int err)
+    {
+        const char* s(proj_errno_string(err));
+        return s ? s : "unknown error";
+    }
+}
+
+bool SrsTransform::available() { return true; }
+
+SrsTransform::SrsTransform(const std::string& in, const std::string& out)
+    : m_ctx(proj_context_create())
+{
+    PJ* raw(proj_create_crs_to_crs(
+                ctx(m_ctx), in.c_str(), out.c_str(), nullptr));
+
+    // Use easting/northing, or longitude/latitude, order regardless of the
+    // axis order of the definitions, as PDAL does.
+    if (raw)
+    {
+        m_pj = proj_normalize_for_visualization(ctx(m_ctx), raw);
+        proj_destroy(raw);
+    }
+
+    if (!m_pj)
+    {
+        const int err(proj_context_errno(ctx(m_ctx)));
+        proj_context_destroy(ctx(m_ctx));
+        throw std::runtime_error(
+                "Could not create transformation to " + out + ": " +
+                describe(err));
+    }
+}
+
+SrsTransform::~SrsTransform()
+{
+    proj_destroy(pj(m_pj));
+    proj_context_destroy(ctx(m_ctx));
+}
+
+void SrsTransform::apply(VectorPointTable& table)
+{
+    const std::size_t np(table.numPoints());
+    if (!np) return;
+
+    m_xyz.resize(np * 3);
+
+    for (std::size_t i(0); i < np; ++i)
+    {
+        const Point p(table.xyz(table.getPoint(i)));
+        m_xyz[i * 3 + 0] = p.x;
+        m_xyz[i * 3 + 1] = p.y;
+        m_xyz[i * 3 + 2] = p.z;
+    }
+
+    const std::size_t stride(3 * sizeof(double));
+    double* pos(m_xyz.data());
+
+    proj_errno_reset(pj(m_pj));
+    proj_trans_generic(
+            pj(m_pj), PJ_FWD,
+            pos + 0, stride, np,
+            pos + 1, stride, np,
+            pos + 2, stride, np,
+            nullptr, 0, 0);
+
+    if (const int err = proj_errno(pj(m_pj)))
+    {
+        throw std::runtime_error("Reprojection failed: " + describe(err));
+    }
+
+    for (std::size_t i(0); i < np; ++i)
+    {
+        table.setXyz(
+                table.getPoint(i),
+                Point(m_xyz[i * 3 + 0], m_xyz[i * 3 + 1], m_xyz[i * 3 + 2]));
+    }
+}
+
+#else
+
+bool SrsTransform::available() { return false; }
+
+SrsTransform::SrsTransform(const std::string&, const std::string&)
+{
+    throw std::runtime_error("Native reprojection requires PROJ");
+}
+
+SrsTransform::~SrsTransform() { }
+
+void SrsTransform::apply(VectorPointTable&) { }
+
+#endif
+
+SrsTransform& SrsTransform::get(const std::string& in, const std::string& out)
+{
+    using Transforms =
+        std::map<std::pair<std::string, std::string>,
+            std::unique_ptr<SrsTransform>>;
+    thread_local Transforms transforms;
+
+    std::unique_ptr<SrsTransform>& t(transforms[std::make_pair(in, out)]);
+    if (!t) t.reset(new SrsTransform(in, out));
+    return *t;
+}
+
+} // namespace entwine
+
@@ -0,0 +1,53 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace entwine
+{
+
+class VectorPointTable;
+
+// A coordinate transformation applied to whole tables of points at once.
+// PROJ objects may not be shared between threads, so each thread holds its
+// own transformations, created on first use and reused for later tables.
+class SrsTransform
+{
+public:
+    ~SrsTransform();
+
+    // False if entwine was built without PROJ.
+    static bool available();
+
+    // This thread's transformation from the input to the output SRS.
+    static SrsTransform& get(const std::string& in, const std::string& out);
+
+    // Transform the XYZ of every point in the table in place.  The table
+    // must store XYZ as doubles.
+    void apply(VectorPointTable& table);
+
+private:
+    SrsTransform(const std::string& in, const std::string& out);
+
+    SrsTransform(const SrsTransform&) = delete;
+    SrsTransform& operator=(const SrsTransform&) = delete;
+
+    void* m_ctx = nullptr;
+    void* m_pj = nullptr;
+
+    // Coordinates are gathered here so that PROJ sees aligned doubles.
+    std::vector<double> m_xyz;
+};
+
+} // namespace entwine
+
@@ -10,6 +10,9 @@
 
 #include <entwine/types/srs.hpp>
 
+#include <mutex>
+#include <unordered_map>
+
 namespace entwine
 {
 
@@ -21,12 +24,37 @@ const auto isint = [](const std::string s)
     return s.find_first_not_of("0123456789") == std::string::npos;
 };
 
+// The files of a large dataset tend to share a handful of SRS definitions, so
+// each distinct one is parsed and identified only once.
+const std::size_t maxCached(1024);
+std::mutex cacheMutex;
+std::unordered_map<std::string, Srs> cache;
+
 } // unnamed namespace
 
 Srs::Srs(const std::string full)
-    : m_spatialReference(full)
-    , m_wkt(m_spatialReference.getWKT())
 {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        const auto it(cache.find(full));
+        if (it != cache.end())
+        {
+            *this = it->second;
+            return;
+        }
+    }
+
+    parse(full);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cache.size() < maxCached) cache.emplace(full, *this);
+}
+
+void Srs::parse(const std::string& full)
+{
+    m_spatialReference = pdal::SpatialReference(full);
+    m_wkt = m_spatialReference.getWKT();
+
     auto pos = full.find(':');
     if (pos != std::string::npos)
     {
@@ -29,7 +29,8 @@ public:
     //
     // If the string is a code, we'll pull authority/horizontal/vertical values
     // directly from the string.  Otherwise, we'll try to identify these values
-    // with the pdal::SpatialReference::identifyEPSG functions.
+    // with the pdal::SpatialReference::identifyEPSG functions.  The results
+    // for each distinct string are cached for the life of the process.
     Srs(std::string s);
     Srs(const char* c) : Srs(std::string(c)) { }
 
@@ -53,6 +54,8 @@ public:
     const std::string& wkt() const { return m_wkt; }
 
 private:
+    void parse(const std::string& full);
+
     pdal::SpatialReference m_spatialReference;
 
     std::string m_authority;
@@ -10,22 +10,94 @@
 
 #include <entwine/types/subset.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/key.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/util/hilbert.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
-Subset::Subset(const Bounds cube, const json& j)
+namespace
+{
+    uint64_t toCell(double v, double min, double size, uint64_t n)
+    {
+        const double t(std::floor((v - min) / size));
+        if (t <= 0) return 0;
+        return std::min<uint64_t>(static_cast<uint64_t>(t), n - 1);
+    }
+
+    // The portion of the range [lo, hi] falling within [cmin, cmax].
+    double overlap(double lo, double hi, double cmin, double cmax)
+    {
+        if (hi <= lo) return 1;
+        return std::max(0.0, std::min(hi, cmax) - std::max(lo, cmin)) /
+            (hi - lo);
+    }
+}
+
+Subset::Subset(const Bounds cube, const json& j, const FileInfoList& files)
     : m_id(j.at("id").get<uint64_t>())
     , m_of(j.at("of").get<uint64_t>())
-    , m_splits(std::log2(m_of) / std::log2(4))
+    , m_balanced(j.value("balanced", false))
     , m_bounds(cube)
 {
     if (!m_id) throw std::runtime_error("Subset IDs should be 1-based.");
     if (m_of <= 1) throw std::runtime_error("Invalid subset range");
     if (m_id > m_of) throw std::runtime_error("Invalid subset ID - too large.");
 
+    if (m_balanced)
+    {
+        // Once partitioned, our range is persisted with the build so that
+        // continuations and merges need not reconstruct it.
+        if (j.count("depth"))
+        {
+            m_splits = j.at("depth").get<uint64_t>();
+            m_begin = j.at("begin").get<uint64_t>();
+            m_end = j.at("end").get<uint64_t>();
+        }
+        else partition(files);
+
+        const uint64_t n(1ULL << m_splits);
+        uint64_t xmin(n), ymin(n), xmax(0), ymax(0);
+
+        for (uint64_t x(0); x < n; ++x)
+        {
+            for (uint64_t y(0); y < n; ++y)
+            {
+                if (!owns(x, y)) continue;
+                xmin = std::min(xmin, x);
+                ymin = std::min(ymin, y);
+                xmax = std::max(xmax, x);
+                ymax = std::max(ymax, y);
+            }
+        }
+
+        if (xmin == n) throw std::runtime_error("Empty balanced subset");
+
+        const double w(cube.width() / n);
+        const double d(cube.depth() / n);
+
+        m_bounds = Bounds(
+                Point(
+                    cube.min().x + w * xmin,
+                    cube.min().y + d * ymin,
+                    cube.min().z),
+                Point(
+                    cube.min().x + w * (xmax + 1),
+                    cube.min().y + d * (ymax + 1),
+                    cube.max().z));
+
+        return;
+    }
+
+    m_splits = std::log2(m_of) / std::log2(4);
+
     if (std::pow(2, static_cast<uint64_t>(std::log2(m_of))) != m_of)
     {
         throw std::runtime_error("Subset range must be a power of 2");
@@ -45,10 +117,117 @@ Subset::Subset(const Bounds cube, const json& j)
     }
 }
 
-std::unique_ptr<Subset> Subset::create(const Bounds cube, const json& j)
+std::unique_ptr<Subset> Subset::create(
+        const Bounds cube,
+        const json& j,
+        const FileInfoList& files)
 {
     if (j.is_null()) return std::unique_ptr<Subset>();
-    else return makeUnique<Subset>(cube, j);
+    else return makeUnique<Subset>(cube, j, files);
+}
+
+void Subset::partition(const FileInfoList& files)
+{
+    m_splits = 1;
+    while (
+            (1ULL << (m_splits * 2)) <
+                m_of * heuristics::balancedSubsetCellsPerSubset &&
+            m_splits < heuristics::maxBalancedSubsetDepth)
+    {
+        ++m_splits;
+    }
+
+    const uint64_t n(1ULL << m_splits);
+    const uint64_t cells(n * n);
+
+    if (cells < m_of) throw std::runtime_error("Too many balanced subsets");
+
+    // Estimate the number of points in each X-Y cell, assuming points are
+    // spread evenly over the bounds of each file, and index the estimates by
+    // Hilbert curve position.
+    const Bounds& cube(m_bounds);
+    const double w(cube.width() / n);
+    const double d(cube.depth() / n);
+
+    std::vector<double> weights(cells, 0);
+    double total(0);
+
+    for (const FileInfo& f : files)
+    {
+        const Bounds* b(f.bounds());
+        if (!b || !f.points()) continue;
+
+        const uint64_t x0(toCell(b->min().x, cube.min().x, w, n));
+        const uint64_t x1(toCell(b->max().x, cube.min().x, w, n));
+        const uint64_t y0(toCell(b->min().y, cube.min().y, d, n));
+        const uint64_t y1(toCell(b->max().y, cube.min().y, d, n));
+
+        for (uint64_t x(x0); x <= x1; ++x)
+        {
+            const double cx(cube.min().x + w * x);
+            const double fx(overlap(b->min().x, b->max().x, cx, cx + w));
+
+            for (uint64_t y(y0); y <= y1; ++y)
+            {
+                const double cy(cube.min().y + d * y);
+                const double fy(overlap(b->min().y, b->max().y, cy, cy + d));
+
+                const double v(f.points() * fx * fy);
+                weights[hilbert(x, y, m_splits)] += v;
+                total += v;
+            }
+        }
+    }
+
+    if (!total)
+    {
+        throw std::runtime_error(
+                "Balanced subsets require file bounds and point counts - "
+                "use a scan as input");
+    }
+
+    // Split the curve into contiguous runs of similar weight, ensuring that
+    // every subset receives at least one cell.
+    std::vector<uint64_t> breaks(m_of + 1, 0);
+    breaks[m_of] = cells;
+
+    uint64_t h(0);
+    double sum(0);
+
+    for (uint64_t k(1); k < m_of; ++k)
+    {
+        const double target(total * k / m_of);
+        while (h < cells && sum < target) sum += weights[h++];
+
+        const uint64_t lo(breaks[k - 1] + 1);
+        const uint64_t hi(cells - (m_of - k));
+        const uint64_t b(std::min(std::max(h, lo), hi));
+
+        while (h < b) sum += weights[h++];
+        while (h > b) sum -= weights[--h];
+
+        breaks[k] = b;
+    }
+
+    m_begin = breaks[m_id - 1];
+    m_end = breaks[m_id];
+}
+
+bool Subset::owns(const uint64_t x, const uint64_t y) const
+{
+    const uint64_t h(hilbert(x, y, m_splits));
+    return h >= m_begin && h < m_end;
+}
+
+bool Subset::contains(const Point& point, Key& key) const
+{
+    if (!m_balanced) return m_bounds.contains(point);
+
+    // Use the same traversal as the tree itself so that each node at the
+    // shared depth lands entirely within a single subset.
+    key.init(point, m_splits);
+    const uint64_t shift(key.d - m_splits);
+    return owns(key.p.x >> shift, key.p.y >> shift);
 }
 
 } // namespace entwine
@@ -16,38 +16,83 @@
 
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/dir.hpp>
+#include <entwine/types/file-info.hpp>
 #include <entwine/util/json.hpp>
 
 namespace entwine
 {
 
+struct Key;
 class Metadata;
 
+// A subset covers either a quadrant of the X-Y extents, recursively split
+// once per power of 4 in the subset count, or, for balanced subsets, a
+// contiguous run along a Hilbert curve of X-Y cells chosen so that each of any
+// number of subsets receives a similar share of the input points.  In both
+// cases Z is kept at its full extents, so every node at the shared depth and
+// below belongs to exactly one subset.
 class Subset
 {
 public:
-    Subset(Bounds cube, const json& j);
-    static std::unique_ptr<Subset> create(Bounds cube, const json& j);
+    Subset(Bounds cube, const json& j, const FileInfoList& files);
+    static std::unique_ptr<Subset> create(
+            Bounds cube,
+            const json& j,
+            const FileInfoList& files);
 
     uint64_t id() const { return m_id; }
     uint64_t of() const { return m_of; }
     uint64_t splits() const { return m_splits; }
 
     bool primary() const { return m_id == 1; }
+    bool balanced() const { return m_balanced; }
 
+    // For balanced subsets, this is the bounding box of our cells, which may
+    // overlap other subsets.
     const Bounds& bounds() const { return m_bounds; }
 
+    // Whether this point belongs to this subset.  The key is used as scratch
+    // space for balanced subsets.
+    bool contains(const Point& point, Key& key) const;
+
+    // Whether every point within these bounds belongs to this subset.  Always
+    // false for balanced subsets, whose cells are not tested here.
+    bool contains(const Bounds& bounds) const
+    {
+        return !m_balanced &&
+            m_bounds.contains(bounds) &&
+            m_bounds.contains(bounds.max());
+    }
+
+    // The range of Hilbert curve positions owned by a balanced subset.
+    uint64_t begin() const { return m_begin; }
+    uint64_t end() const { return m_end; }
+
 private:
+    void partition(const FileInfoList& files);
+    bool owns(uint64_t x, uint64_t y) const;
+
     const uint64_t m_id;
     const uint64_t m_of;
+    const bool m_balanced;
 
-    const uint64_t m_splits;
+    uint64_t m_splits = 0;
+    uint64_t m_begin = 0;
+    uint64_t m_end = 0;
     Bounds m_bounds;
 };
 
 inline void to_json(json& j, const Subset& s)
 {
     j = { { "id", s.id() }, { "of", s.of() } };
+
+    if (s.balanced())
+    {
+        j["balanced"] = true;
+        j["depth"] = s.splits();
+        j["begin"] = s.begin();
+        j["end"] = s.end();
+    }
 }
 
 } // namespace entwine
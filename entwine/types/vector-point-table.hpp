@@ -10,22 +10,32 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <vector>
 
 #include <pdal/PointRef.hpp>
 #include <pdal/PointTable.hpp>
 
+#include <entwine/types/block-pool.hpp>
+#include <entwine/types/point.hpp>
 #include <entwine/types/schema.hpp>
 
 namespace entwine
 {
 
+// Blocks are borrowed from the process-wide BlockPool and returned to it on
+// destruction or clear, so chunks cycling in and out of memory reuse them.
 class MemBlock
 {
 public:
-    using Block = std::vector<char>;
+    using Block = BlockPool::Block;
 
     MemBlock(uint64_t pointSize, uint64_t pointsPerBlock)
         : m_pointSize(pointSize)
@@ -36,12 +46,14 @@ public:
         m_refs.reserve(m_pointsPerBlock);
     }
 
+    ~MemBlock() { clear(); }
+
     char* next()
     {
         if (m_pos == m_end)
         {
-            m_blocks.emplace_back(Block(m_bytesPerBlock));
-            m_pos = m_blocks.back().data();
+            m_blocks.push_back(BlockPool::get().acquire(m_bytesPerBlock));
+            m_pos = m_blocks.back().get();
             m_end = m_pos + m_bytesPerBlock;
         }
 
@@ -52,9 +64,15 @@ public:
     }
 
     uint64_t size() const { return m_refs.size(); }
+    uint64_t bytes() const { return m_blocks.size() * m_bytesPerBlock; }
     const std::vector<char*>& refs() const { return m_refs; }
     void clear()
     {
+        BlockPool& pool(BlockPool::get());
+        for (Block& block : m_blocks)
+        {
+            pool.release(m_bytesPerBlock, std::move(block));
+        }
         m_blocks.clear();
         m_pos = nullptr;
         m_end = nullptr;
@@ -62,6 +80,9 @@ public:
     }
 
 private:
+    MemBlock(const MemBlock&) = delete;
+    MemBlock& operator=(const MemBlock&) = delete;
+
     const uint64_t m_pointSize;
     const uint64_t m_pointsPerBlock;
     const uint64_t m_bytesPerBlock;
@@ -73,12 +94,113 @@ private:
     std::vector<char*> m_refs;
 };
 
+// Reads and writes XYZ within a point's data at fixed offsets, bypassing
+// PDAL's per-field dispatch, if they are stored as doubles or as scaled 32-bit
+// integers.  Otherwise direct() is false and PointRefs must be used.
+class XyzAccess
+{
+public:
+    explicit XyzAccess(const Schema& schema)
+    {
+        const pdal::PointLayout& layout(schema.pdalLayout());
+        const DimId ids[] = { DimId::X, DimId::Y, DimId::Z };
+
+        std::size_t doubles(0);
+        std::size_t ints(0);
+        for (std::size_t i(0); i < 3; ++i)
+        {
+            const pdal::Dimension::Detail* d(layout.dimDetail(ids[i]));
+            if (!d) return;
+
+            if (d->type() == DimType::Double) ++doubles;
+            else if (d->type() == DimType::Signed32) ++ints;
+
+            m_offsets[i] = d->offset();
+
+            const DimInfo& info(schema.find(ids[i]));
+            m_scale[i] = info.scale();
+            m_offset[i] = info.offset();
+        }
+
+        m_direct = doubles == 3 || ints == 3;
+        m_scaled = ints == 3;
+    }
+
+    bool direct() const { return m_direct; }
+    bool scaled() const { return m_scaled; }
+
+    Point get(const char* pos) const
+    {
+        assert(m_direct);
+        Point p;
+        if (m_scaled)
+        {
+            p.x = read(pos, 0);
+            p.y = read(pos, 1);
+            p.z = read(pos, 2);
+        }
+        else
+        {
+            std::memcpy(&p.x, pos + m_offsets[0], sizeof(double));
+            std::memcpy(&p.y, pos + m_offsets[1], sizeof(double));
+            std::memcpy(&p.z, pos + m_offsets[2], sizeof(double));
+        }
+        return p;
+    }
+
+    // Scaled values are rounded, and clamped to the integer range.
+    void set(char* pos, const Point& p) const
+    {
+        assert(m_direct);
+        if (m_scaled)
+        {
+            write(pos, 0, p.x);
+            write(pos, 1, p.y);
+            write(pos, 2, p.z);
+        }
+        else
+        {
+            std::memcpy(pos + m_offsets[0], &p.x, sizeof(double));
+            std::memcpy(pos + m_offsets[1], &p.y, sizeof(double));
+            std::memcpy(pos + m_offsets[2], &p.z, sizeof(double));
+        }
+    }
+
+private:
+    double read(const char* pos, std::size_t i) const
+    {
+        int32_t v(0);
+        std::memcpy(&v, pos + m_offsets[i], sizeof(int32_t));
+        return v * m_scale[i] + m_offset[i];
+    }
+
+    void write(char* pos, std::size_t i, double d) const
+    {
+        const double r(std::round((d - m_offset[i]) / m_scale[i]));
+        const int32_t v(
+                static_cast<int32_t>(
+                    std::max<double>(
+                        std::min<double>(
+                            r,
+                            std::numeric_limits<int32_t>::max()),
+                        std::numeric_limits<int32_t>::lowest())));
+        std::memcpy(pos + m_offsets[i], &v, sizeof(int32_t));
+    }
+
+    bool m_direct = false;
+    bool m_scaled = false;
+    std::size_t m_offsets[3] = { 0, 0, 0 };
+    double m_scale[3] = { 1, 1, 1 };
+    double m_offset[3] = { 0, 0, 0 };
+};
+
 // For writing.
 class BlockPointTable : public pdal::SimplePointTable
 {
 public:
     BlockPointTable(const Schema& schema)
         : SimplePointTable(schema.pdalLayout())
+        , m_xyz(schema)
     { }
 
     void reserve(uint64_t size) { m_refs.reserve(size); }
@@ -86,6 +208,7 @@ public:
     {
         m_refs.insert(m_refs.end(), m.refs().begin(), m.refs().end());
     }
+    void insert(char* pos) { m_refs.push_back(pos); }
 
     virtual char* getPoint(pdal::PointId index) override
     {
@@ -96,9 +219,16 @@ public:
     virtual bool supportsView() const override { return true; }
     uint64_t size() const { return m_refs.size(); }
 
+    // May be reordered, but not resized.
+    std::vector<char*>& refs() { return m_refs; }
+
+    bool directXyz() const { return m_xyz.direct(); }
+    Point xyz(const char* pos) const { return m_xyz.get(pos); }
+
 private:
     std::vector<char*> m_refs;
     uint64_t m_index = 0;
+    XyzAccess m_xyz;
 };
 
 // For reading.
@@ -111,14 +241,31 @@ public:
         : pdal::StreamPointTable(schema.pdalLayout(), np)
         , m_pointSize(schema.pointSize())
         , m_data(np * m_pointSize, 0)
+        , m_xyz(schema)
     { }
 
+    // A table whose buffer is reused from the last such table destroyed on
+    // this thread, rather than being freshly allocated and zero-filled.  Its
+    // contents are unspecified, so this is only for tables whose points are
+    // entirely written before they are read, as when decoding a chunk.
+    struct Reuse { };
+    VectorPointTable(const Schema& schema, std::size_t np, Reuse)
+        : pdal::StreamPointTable(schema.pdalLayout(), np)
+        , m_pointSize(schema.pointSize())
+        , m_data(takeSpare(np * m_pointSize))
+        , m_xyz(schema)
+        , m_reuse(true)
+    { }
+
+    ~VectorPointTable() { if (m_reuse) giveSpare(std::move(m_data)); }
+
     VectorPointTable(const Schema& schema, std::vector<char>&& data)
         : pdal::StreamPointTable(
                 schema.pdalLayout(),
                 data.size() / schema.pointSize())
         , m_pointSize(schema.pointSize())
         , m_data(std::move(data))
+        , m_xyz(schema)
     {
         if (m_data.size() % m_pointSize != 0)
         {
@@ -126,6 +273,13 @@ public:
         }
     }
 
+    // The number of points of this size which fit in the given number of
+    // bytes, for sizing a table to stay resident in cache.
+    static std::size_t capacityFor(const Schema& schema, uint64_t bytes)
+    {
+        return std::max<std::size_t>(bytes / schema.pointSize(), 1);
+    }
+
     pdal::PointRef at(pdal::PointId index)
     {
         if (index >= capacity())
@@ -200,6 +354,14 @@ public:
 
     std::size_t pointSize() const { return m_pointSize; }
 
+    // True if XYZ may be read directly by xyz() rather than through the
+    // PointRef field lookups - see XyzAccess.
+    bool directXyz() const { return m_xyz.direct(); }
+    bool scaledXyz() const { return m_xyz.scaled(); }
+
+    Point xyz(const char* pos) const { return m_xyz.get(pos); }
+    void setXyz(char* pos, const Point& p) const { m_xyz.set(pos, p); }
+
     // Used when wrapping this table in a pdal::PointView, which calls this
     // function to populate its indices.
     virtual pdal::PointId addPoint() override
@@ -208,14 +370,56 @@ public:
         return m_added++;
     }
 
+protected:
+    struct Unowned { };
+
+    // For derived tables whose points are stored elsewhere, which must
+    // override getPoint.  Our own data is left empty.
+    VectorPointTable(const Schema& schema, std::size_t np, Unowned)
+        : pdal::StreamPointTable(schema.pdalLayout(), np)
+        , m_pointSize(schema.pointSize())
+        , m_xyz(schema)
+    { }
+
 private:
     VectorPointTable(const VectorPointTable&);
     VectorPointTable& operator=(const VectorPointTable&);
 
+    static std::vector<char>& spare()
+    {
+        static thread_local std::vector<char> data;
+        return data;
+    }
+
+    // Only growth beyond the size of the spare buffer is zero-filled.
+    static std::vector<char> takeSpare(std::size_t bytes)
+    {
+        std::vector<char> data;
+        data.swap(spare());
+        data.resize(bytes);
+        return data;
+    }
+
+    // Keep the largest buffer, within reason, for the next table.
+    static void giveSpare(std::vector<char>&& data)
+    {
+        const std::size_t maxSpareBytes(64 * 1024 * 1024);
+        std::vector<char>& current(spare());
+        if (
+                data.capacity() <= maxSpareBytes &&
+                data.capacity() > current.capacity())
+        {
+            current.swap(data);
+        }
+    }
+
     const std::size_t m_pointSize;
     std::vector<char> m_data;
     std::size_t m_added = 0;
 
+    XyzAccess m_xyz;
+    const bool m_reuse = false;
+
     Process m_f = []() { };
 };
 
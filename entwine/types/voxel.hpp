@@ -15,6 +15,7 @@
 #include <cstddef>
 
 #include <entwine/types/point.hpp>
+#include <entwine/types/point-copy.hpp>
 #include <entwine/types/scale-offset.hpp>
 
 namespace entwine
@@ -27,10 +28,13 @@ public:
     const char* const data() const { return m_data; }
     void setData(char* pos) { m_data = pos; }
 
-    void initDeep(const Point& point, const char* const pos, std::size_t size)
+    void initDeep(
+            const Point& point,
+            const char* const pos,
+            const PointCopy& c)
     {
         m_point = point;
-        std::copy(pos, pos + size, m_data);
+        c.copy(m_data, pos);
     }
 
     void initShallow(const pdal::PointRef& pr, char* pos)
@@ -41,17 +45,23 @@ public:
         m_data = pos;
     }
 
+    void initShallow(const Point& p, char* pos)
+    {
+        m_point = p;
+        m_data = pos;
+    }
+
     void clip(const ScaleOffset& so)
     {
         m_point = so.clip(m_point);
     }
 
-    void swapDeep(Voxel& other, uint64_t pointSize)
+    void swapDeep(Voxel& other, const PointCopy& c)
     {
         assert(m_data);
         assert(other.m_data);
         std::swap(m_point, other.m_point);
-        std::swap_ranges(m_data, m_data + pointSize, other.m_data);
+        c.swap(m_data, other.m_data);
     }
 
 private:
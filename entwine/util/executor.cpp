@@ -10,7 +10,10 @@
 
 #include <entwine/util/executor.hpp>
 
+#include <algorithm>
+#include <future>
 #include <sstream>
+#include <thread>
 
 #include <pdal/Dimension.hpp>
 #include <pdal/QuickInfo.hpp>
@@ -42,8 +45,42 @@ json ensureArray(json in)
     return json::array({ in });
 }
 
+// Files whose headers claim at least twice this many points are deep-scanned
+// in ranges of at least this many points, concurrently.
+const uint64_t scanSplitPoints(1 << 24);
+
+// Stands in for the filename while a PipelineTemplate is serialized.
+const std::string filenameToken("__entwine_filename__");
+
 } // unnamed namespace
 
+PipelineTemplate::PipelineTemplate(json pipeline)
+{
+    pipeline = ensureArray(pipeline);
+    if (pipeline.empty() || !pipeline.at(0).is_object())
+    {
+        throw std::runtime_error("Invalid pipeline: " + pipeline.dump(2));
+    }
+
+    pipeline.at(0)["filename"] = filenameToken;
+
+    const std::string s(objectify(pipeline).dump());
+    const std::string token(json(filenameToken).dump());
+    const std::size_t pos(s.find(token));
+    if (pos == std::string::npos || s.rfind(token) != pos)
+    {
+        throw std::runtime_error("Invalid pipeline: " + pipeline.dump(2));
+    }
+
+    m_head = s.substr(0, pos);
+    m_tail = s.substr(pos + token.size());
+}
+
+std::string PipelineTemplate::instantiate(const std::string& filename) const
+{
+    return m_head + json(filename).dump() + m_tail;
+}
+
 
 Executor::Executor()
     : m_stageFactory(makeUnique<pdal::StageFactory>())
@@ -85,6 +122,30 @@ ScanInfo::ScanInfo(pdal::Stage& reader, const pdal::QuickInfo& qi)
     })();
 }
 
+ScanInfo::ScanInfo(const json& j)
+    : srs(j.value("srs", ""))
+    , metadata(j.value("metadata", json()))
+    , points(j.value("points", 0))
+    , dimNames(j.value("dimNames", std::vector<std::string>()))
+{
+    if (j.count("scale")) scale = makeUnique<Scale>(j.at("scale"));
+    if (j.count("bounds")) bounds = Bounds(j.at("bounds"));
+}
+
+json ScanInfo::toJson() const
+{
+    json j {
+        { "srs", srs },
+        { "points", points },
+        { "dimNames", dimNames }
+    };
+
+    if (scale) j["scale"] = *scale;
+    if (bounds.exists()) j["bounds"] = bounds;
+    if (!metadata.is_null()) j["metadata"] = metadata;
+    return j;
+}
+
 std::unique_ptr<ScanInfo> ScanInfo::create(pdal::Stage& reader)
 {
     const pdal::QuickInfo qi(reader.preview());
@@ -234,42 +295,135 @@ std::unique_ptr<ScanInfo> Executor::deepScan(const json pipeline) const
     const Schema schema(dims);
 
     // Reset the values we're going to aggregate from the deep scan.
+    const uint64_t headerPoints(result->points);
     result->bounds = Bounds::expander();
     result->points = 0;
     result->dimNames.clear();
 
+    // If the header was wrong enough that a range can't be read, fall back
+    // to reading the file as a whole.
+    const uint64_t ranges(scanRanges(pipeline, headerPoints));
+    bool ran(ranges > 1 &&
+            scanSplit(pipeline, schema, headerPoints, ranges, *result));
+    if (!ran) ran = scanAll(pipeline, schema, *result);
+
+    if (ran)
+    {
+        for (const auto& d : schema.fixedLayout().added())
+        {
+            result->dimNames.push_back(d);
+        }
+        return result;
+    }
+    else return std::unique_ptr<ScanInfo>();
+}
+
+uint64_t Executor::scanRanges(const json& pipeline, const uint64_t points)
+    const
+{
+    // Only LAS readers may start from an arbitrary point, and only filters
+    // which treat each point independently may run over part of a file.
+    const json& reader(pipeline.at(0));
+    if (!reader.is_object()) return 1;
+
+    const std::string filename(reader.value("filename", ""));
+    const std::string type(reader.value("type",
+                m_stageFactory->inferReaderDriver(filename)));
+    if (type != "readers.las") return 1;
+
+    const bool pointwise(std::all_of(
+            pipeline.begin() + 1,
+            pipeline.end(),
+            [](const json& stage)
+            {
+                return stage.value("type", "") == "filters.reprojection";
+            }));
+    if (!pointwise) return 1;
+
+    const uint64_t threads(std::max(1u, std::thread::hardware_concurrency()));
+    return std::min(threads, points / scanSplitPoints);
+}
+
+bool Executor::scanAll(
+        const json& pipeline,
+        const Schema& schema,
+        ScanInfo& info) const
+{
     VectorPointTable table(schema);
-    table.setProcess([&result, &table]()
+    table.setProcess([&info, &table]()
     {
         Point point;
 
         for (auto it(table.begin()); it != table.end(); ++it)
         {
             // Don't use table.numPoints since that includes skipped points.
-            ++result->points;
+            ++info.points;
 
             auto& pr(it.pointRef());
             point.x = pr.getFieldAs<double>(DimId::X);
             point.y = pr.getFieldAs<double>(DimId::Y);
             point.z = pr.getFieldAs<double>(DimId::Z);
-            result->bounds.grow(point);
+            info.bounds.grow(point);
         }
     });
 
-    if (Executor::get().run(table, pipeline))
+    return Executor::get().run(table, pipeline);
+}
+
+bool Executor::scanSplit(
+        const json& pipeline,
+        const Schema& schema,
+        const uint64_t points,
+        const uint64_t ranges,
+        ScanInfo& info) const
+{
+    // The last range reads to the end, in case the header undercounts.
+    const uint64_t step(points / ranges);
+    std::vector<ScanInfo> parts(ranges);
+    std::vector<std::future<bool>> futures;
+
+    for (uint64_t i(0); i < ranges; ++i)
     {
-        for (const auto& d : schema.fixedLayout().added())
-        {
-            result->dimNames.push_back(d);
-        }
-        return result;
+        json p(pipeline);
+        p.at(0)["start"] = i * step;
+        if (i + 1 < ranges) p.at(0)["count"] = step;
+
+        ScanInfo& part(parts[i]);
+        part.bounds = Bounds::expander();
+        futures.push_back(std::async(
+                    std::launch::async,
+                    [this, p, &schema, &part]()
+                    {
+                        return scanAll(p, schema, part);
+                    }));
     }
-    else return std::unique_ptr<ScanInfo>();
+
+    bool ran(true);
+    for (auto& f : futures)
+    {
+        try { ran = f.get() && ran; }
+        catch (...) { ran = false; }
+    }
+    if (!ran) return false;
+
+    for (const ScanInfo& part : parts)
+    {
+        info.points += part.points;
+        if (part.points) info.bounds.grow(part.bounds);
+    }
+    return true;
 }
 
 bool Executor::run(pdal::StreamPointTable& table, const json pipeline)
 {
-    std::istringstream iss(objectify(pipeline).dump());
+    return run(table, objectify(pipeline).dump());
+}
+
+bool Executor::run(
+        pdal::StreamPointTable& table,
+        const std::string& pipeline)
+{
+    std::istringstream iss(pipeline);
 
     auto lock(getLock());
     pdal::PipelineManager pm;
@@ -326,6 +480,11 @@ std::unique_lock<std::mutex> Executor::getLock()
     return std::unique_lock<std::mutex>(mutex());
 }
 
+std::unique_lock<std::mutex> Executor::getSrsLock()
+{
+    return std::unique_lock<std::mutex>(get().m_srsMutex);
+}
+
 ScopedStage::ScopedStage(
         pdal::Stage* stage,
         pdal::StageFactory& stageFactory,
@@ -57,8 +57,11 @@ class ScanInfo
 public:
     ScanInfo() = default;
     ScanInfo(pdal::Stage& reader, const pdal::QuickInfo& qi);
+    explicit ScanInfo(const json& j);
     static std::unique_ptr<ScanInfo> create(pdal::Stage& reader);
 
+    json toJson() const;
+
     std::string srs;
     std::unique_ptr<Scale> scale;
     json metadata;
@@ -68,6 +71,22 @@ public:
     std::vector<std::string> dimNames;
 };
 
+// A pipeline prepared once for many files, which differ only in the filename
+// of their reader.  The pipeline is validated and serialized up front, so
+// instantiating it for a file only splices in the filename.
+class PipelineTemplate
+{
+public:
+    explicit PipelineTemplate(json pipeline);
+
+    // The serialized pipeline for this file, for Executor::run.
+    std::string instantiate(const std::string& filename) const;
+
+private:
+    std::string m_head;
+    std::string m_tail;
+};
+
 class Executor
 {
 public:
@@ -87,13 +106,38 @@ public:
 
     bool run(pdal::StreamPointTable& table, json pipeline);
 
+    // Run a pipeline which is already serialized, as from a PipelineTemplate.
+    bool run(pdal::StreamPointTable& table, const std::string& pipeline);
+
     std::unique_ptr<ScanInfo> preview(json pipeline, bool shallow = true) const;
 
+    // Guards stage factory and pipeline construction, which are not
+    // thread-safe in PDAL.
     static std::unique_lock<std::mutex> getLock();
 
+    // Guards only spatial reference handling during stage preparation.
+    // Stages which are constructed directly, rather than through a factory,
+    // and which have no SRS to process, need no lock at all.
+    static std::unique_lock<std::mutex> getSrsLock();
+
 private:
     std::unique_ptr<ScanInfo> deepScan(json pipeline) const;
 
+    // The number of point ranges into which a deep scan of this pipeline may
+    // be split, given the point count from its header.
+    uint64_t scanRanges(const json& pipeline, uint64_t points) const;
+
+    // Accumulate the points and bounds of the whole pipeline, or of each of
+    // these ranges concurrently, into the given info.
+    bool scanAll(const json& pipeline, const Schema& schema, ScanInfo& info)
+        const;
+    bool scanSplit(
+            const json& pipeline,
+            const Schema& schema,
+            uint64_t points,
+            uint64_t ranges,
+            ScanInfo& info) const;
+
     Executor();
     ~Executor();
 
@@ -101,6 +145,7 @@ private:
     Executor& operator=(const Executor&) = delete;
 
     mutable std::mutex m_mutex;
+    std::mutex m_srsMutex;
     std::unique_ptr<pdal::StageFactory> m_stageFactory;
 };
 
@@ -0,0 +1,47 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+namespace entwine
+{
+
+// Position of the cell (x, y) along a Hilbert curve covering a 2^bits by
+// 2^bits grid.
+inline uint64_t hilbert(uint32_t x, uint32_t y, const uint32_t bits)
+{
+    const uint32_t n(1u << bits);
+    uint64_t d(0);
+
+    for (uint32_t s(n / 2); s > 0; s /= 2)
+    {
+        const uint32_t rx((x & s) ? 1 : 0);
+        const uint32_t ry((y & s) ? 1 : 0);
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        if (!ry)
+        {
+            if (rx)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return d;
+}
+
+} // namespace entwine
+
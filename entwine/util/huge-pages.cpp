@@ -0,0 +1,156 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/huge-pages.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace entwine
+{
+namespace hugePages
+{
+
+namespace
+{
+    std::atomic<int> current(static_cast<int>(Mode::None));
+
+    std::size_t roundUp(const std::size_t bytes, const std::size_t align)
+    {
+        return (bytes + align - 1) / align * align;
+    }
+
+    void* alignedAlloc(const std::size_t bytes, const std::size_t align)
+    {
+#ifdef _WIN32
+        void* p(_aligned_malloc(bytes, align));
+        if (!p) throw std::bad_alloc();
+        return p;
+#else
+        void* p(nullptr);
+        if (posix_memalign(&p, align, bytes)) throw std::bad_alloc();
+        return p;
+#endif
+    }
+
+    void alignedFree(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    void advise(void* p, const std::size_t bytes)
+    {
+#ifdef MADV_HUGEPAGE
+        // Only a hint - if transparent huge pages are disabled, we simply
+        // get normal pages.
+        madvise(p, bytes, MADV_HUGEPAGE);
+#else
+        (void)p;
+        (void)bytes;
+#endif
+    }
+}
+
+Mode toMode(const std::string& s)
+{
+    if (s == "none") return Mode::None;
+    if (s == "transparent") return Mode::Transparent;
+    if (s == "explicit") return Mode::Explicit;
+    throw std::runtime_error("Invalid huge page mode: " + s);
+}
+
+std::string toString(const Mode mode)
+{
+    switch (mode)
+    {
+        case Mode::Transparent: return "transparent";
+        case Mode::Explicit: return "explicit";
+        default: return "none";
+    }
+}
+
+void setMode(const Mode mode) { current = static_cast<int>(mode); }
+Mode mode() { return static_cast<Mode>(current.load()); }
+
+void* allocate(std::size_t bytes, Mode& mode)
+{
+    bytes = roundUp(bytes, pageSize());
+
+#if defined(MAP_HUGETLB) && !defined(_WIN32)
+    if (mode == Mode::Explicit)
+    {
+        void* p(mmap(
+                    nullptr,
+                    bytes,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                    -1,
+                    0));
+        if (p != MAP_FAILED) return p;
+    }
+#endif
+
+    if (mode == Mode::Explicit) mode = Mode::Transparent;
+
+    void* p(alignedAlloc(bytes, pageSize()));
+    if (mode == Mode::Transparent) advise(p, bytes);
+    return p;
+}
+
+void release(void* p, const std::size_t bytes, const Mode mode)
+{
+    if (!p) return;
+
+#if defined(MAP_HUGETLB) && !defined(_WIN32)
+    if (mode == Mode::Explicit)
+    {
+        munmap(p, roundUp(bytes, pageSize()));
+        return;
+    }
+#else
+    (void)bytes;
+    (void)mode;
+#endif
+
+    alignedFree(p);
+}
+
+void* allocateAligned(const std::size_t bytes)
+{
+    if (mode() == Mode::None || bytes < pageSize() / 2)
+    {
+        return alignedAlloc(std::max(bytes, cacheLine()), cacheLine());
+    }
+
+    const std::size_t size(roundUp(bytes, pageSize()));
+    void* p(alignedAlloc(size, pageSize()));
+    advise(p, size);
+    return p;
+}
+
+void releaseAligned(void* p, std::size_t)
+{
+    alignedFree(p);
+}
+
+} // namespace hugePages
+} // namespace entwine
@@ -0,0 +1,94 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <string>
+
+namespace entwine
+{
+namespace hugePages
+{
+
+// Large regions of point memory may be backed by 2 MiB pages, so that
+// insertion into them takes fewer TLB misses.  Transparent huge pages are
+// requested with madvise, and explicit pages are reserved from the kernel's
+// hugetlb pool, falling back to transparent pages if none are available.
+// Both are Linux-only - elsewhere, regions are only aligned.
+enum class Mode
+{
+    None,
+    Transparent,
+    Explicit
+};
+
+// Throws if there is no mode of this name.
+Mode toMode(const std::string& s);
+std::string toString(Mode mode);
+
+// The process-wide mode, which should be set before any point memory is
+// allocated.
+void setMode(Mode mode);
+Mode mode();
+
+constexpr std::size_t pageSize() { return 2 * 1024 * 1024; }
+constexpr std::size_t cacheLine() { return 64; }
+
+// Allocate a region, aligned to the page size and backed by huge pages with
+// the given mode, whose size is rounded up to a whole number of pages.  The
+// mode is updated to the one actually used, should explicit pages be
+// unavailable, and the region must be freed with release, with the same size
+// and that mode.  Throws std::bad_alloc on failure.
+void* allocate(std::size_t bytes, Mode& mode);
+void release(void* p, std::size_t bytes, Mode mode);
+
+// Allocate a cache-aligned region, which is backed by transparent huge pages
+// in any mode but None if it spans at least half a page.  It must be freed
+// with releaseAligned, with the same size.
+void* allocateAligned(std::size_t bytes);
+void releaseAligned(void* p, std::size_t bytes);
+
+// A stateless allocator for containers, like a chunk's grid, which are large
+// and accessed randomly.
+template<typename T>
+class Allocator
+{
+public:
+    using value_type = T;
+
+    Allocator() = default;
+    template<typename U> Allocator(const Allocator<U>&) { }
+
+    T* allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(allocateAligned(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) { releaseAligned(p, n * sizeof(T)); }
+
+    template<typename U> bool operator==(const Allocator<U>&) const
+    {
+        return true;
+    }
+    template<typename U> bool operator!=(const Allocator<U>&) const
+    {
+        return false;
+    }
+};
+
+} // namespace hugePages
+} // namespace entwine
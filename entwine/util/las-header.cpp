@@ -0,0 +1,207 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/las-header.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    const uint64_t vlrHeaderSize(54);
+    const uint64_t evlrHeaderSize(60);
+
+    template <typename T>
+    T get(const std::vector<char>& data, const uint64_t pos)
+    {
+        if (pos + sizeof(T) > data.size())
+        {
+            throw std::runtime_error("Truncated LAS header");
+        }
+
+        T v;
+        std::memcpy(&v, data.data() + pos, sizeof(T));
+        return v;
+    }
+
+    std::string getString(
+            const std::vector<char>& data,
+            const uint64_t pos,
+            const uint64_t size)
+    {
+        if (pos + size > data.size())
+        {
+            throw std::runtime_error("Truncated LAS record");
+        }
+
+        std::string s(data.data() + pos, size);
+        return s.substr(0, s.find('\0'));
+    }
+
+    std::vector<char> readRange(
+            std::ifstream& file,
+            const uint64_t begin,
+            const uint64_t end)
+    {
+        std::vector<char> data(end > begin ? end - begin : 0);
+        file.seekg(begin);
+        file.read(data.data(), data.size());
+        data.resize(file.gcount());
+        return data;
+    }
+}
+
+LasHeader::LasHeader(const std::vector<char>& data)
+{
+    if (getString(data, 0, 4) != "LASF")
+    {
+        throw std::runtime_error("Invalid LAS signature");
+    }
+
+    m_majorVersion = get<uint8_t>(data, 24);
+    m_minorVersion = get<uint8_t>(data, 25);
+    m_headerSize = get<uint16_t>(data, 94);
+    m_pointOffset = get<uint32_t>(data, 96);
+    m_vlrCount = get<uint32_t>(data, 100);
+
+    // The upper bits of the format flag compression.
+    const uint8_t format(get<uint8_t>(data, 104));
+    m_compressed = format & 0xc0;
+    m_pointFormat = format & 0x3f;
+    m_pointLength = get<uint16_t>(data, 105);
+    m_points = get<uint32_t>(data, 107);
+
+    m_scale = Scale(
+            get<double>(data, 131),
+            get<double>(data, 139),
+            get<double>(data, 147));
+    m_offset = Offset(
+            get<double>(data, 155),
+            get<double>(data, 163),
+            get<double>(data, 171));
+
+    // Stored as max-X, min-X, max-Y, min-Y, max-Z, min-Z.
+    m_bounds = Bounds(
+            get<double>(data, 187),
+            get<double>(data, 203),
+            get<double>(data, 219),
+            get<double>(data, 179),
+            get<double>(data, 195),
+            get<double>(data, 211));
+
+    if (m_minorVersion >= 4)
+    {
+        m_evlrOffset = get<uint64_t>(data, 235);
+        m_evlrCount = get<uint32_t>(data, 243);
+
+        const uint64_t points(get<uint64_t>(data, 247));
+        if (points) m_points = points;
+    }
+}
+
+std::unique_ptr<LasHeader> LasHeader::read(const std::string& path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.good()) throw std::runtime_error("Could not open " + path);
+
+    auto header(makeUnique<LasHeader>(readRange(file, 0, maxHeaderSize())));
+
+    file.clear();
+    header->addVlrs(
+            readRange(file, header->headerSize(), header->pointOffset()));
+
+    if (header->m_evlrOffset && header->m_evlrCount)
+    {
+        file.clear();
+        file.seekg(0, std::ios::end);
+        const uint64_t size(file.tellg());
+        header->addEvlrs(readRange(file, header->m_evlrOffset, size));
+    }
+
+    return header;
+}
+
+void LasHeader::addVlrs(const std::vector<char>& data)
+{
+    addRecords(data, false);
+}
+
+void LasHeader::addEvlrs(const std::vector<char>& data)
+{
+    addRecords(data, true);
+}
+
+void LasHeader::addRecords(const std::vector<char>& data, const bool extended)
+{
+    const uint64_t headerSize(extended ? evlrHeaderSize : vlrHeaderSize);
+
+    uint64_t pos(0);
+    while (pos + headerSize <= data.size())
+    {
+        const std::string user(getString(data, pos + 2, 16));
+        const uint16_t record(get<uint16_t>(data, pos + 18));
+        const uint64_t length(extended ?
+                get<uint64_t>(data, pos + 20) :
+                get<uint16_t>(data, pos + 20));
+
+        pos += headerSize;
+
+        // WKT, or the GeoTIFF key directory and its double and ASCII params.
+        if (user == "LASF_Projection" && (
+                    record == 2112 ||
+                    record == 34735 ||
+                    record == 34736 ||
+                    record == 34737))
+        {
+            if (pos + length > data.size())
+            {
+                throw std::runtime_error("Truncated LAS record");
+            }
+
+            m_srsRecords += std::to_string(record) + ':';
+            m_srsRecords.append(data.data() + pos, length);
+        }
+
+        pos += length;
+    }
+}
+
+json LasHeader::metadata() const
+{
+    return json {
+        { "major_version", m_majorVersion },
+        { "minor_version", m_minorVersion },
+        { "dataformat_id", m_pointFormat },
+        { "point_length", m_pointLength },
+        { "count", m_points },
+        { "compressed", m_compressed },
+        { "scale_x", m_scale.x },
+        { "scale_y", m_scale.y },
+        { "scale_z", m_scale.z },
+        { "offset_x", m_offset.x },
+        { "offset_y", m_offset.y },
+        { "offset_z", m_offset.z },
+        { "minx", m_bounds.min().x },
+        { "miny", m_bounds.min().y },
+        { "minz", m_bounds.min().z },
+        { "maxx", m_bounds.max().x },
+        { "maxy", m_bounds.max().y },
+        { "maxz", m_bounds.max().z }
+    };
+}
+
+} // namespace entwine
+
@@ -0,0 +1,95 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/point.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// A minimal parser of the LAS/LAZ public header block and its variable length
+// records, for scanning files without constructing a PDAL reader.  Only what
+// a scan needs is extracted, and only little-endian hosts are supported.
+class LasHeader
+{
+public:
+    // Enough to hold the public header block of any LAS version.
+    static constexpr uint64_t maxHeaderSize() { return 375; }
+
+    // Parse the public header block from the start of a file.  Throws if
+    // this is not a LAS header.
+    explicit LasHeader(const std::vector<char>& data);
+
+    // Read the header and all VLRs and EVLRs from a local file.
+    static std::unique_ptr<LasHeader> read(const std::string& path);
+
+    // Parse the VLRs, which are the bytes from headerSize() to pointOffset().
+    void addVlrs(const std::vector<char>& data);
+
+    // Parse the EVLRs, which are the bytes from evlrOffset() to the end of the
+    // file.
+    void addEvlrs(const std::vector<char>& data);
+
+    uint64_t minorVersion() const { return m_minorVersion; }
+    uint64_t headerSize() const { return m_headerSize; }
+    uint64_t pointOffset() const { return m_pointOffset; }
+    uint64_t evlrOffset() const { return m_evlrOffset; }
+    uint64_t evlrCount() const { return m_evlrCount; }
+
+    uint64_t pointFormat() const { return m_pointFormat; }
+    uint64_t pointLength() const { return m_pointLength; }
+    uint64_t points() const { return m_points; }
+    bool compressed() const { return m_compressed; }
+
+    const Scale& scale() const { return m_scale; }
+    const Offset& offset() const { return m_offset; }
+    const Bounds& bounds() const { return m_bounds; }
+
+    // The raw contents of every coordinate system record, in file order.
+    // Files with equal contents here have the same coordinate system.
+    const std::string& srsRecords() const { return m_srsRecords; }
+
+    // A summary of the header in the same terms as PDAL's LAS metadata.
+    json metadata() const;
+
+private:
+    void addRecords(const std::vector<char>& data, bool extended);
+
+    uint64_t m_majorVersion = 0;
+    uint64_t m_minorVersion = 0;
+    uint64_t m_headerSize = 0;
+    uint64_t m_pointOffset = 0;
+    uint64_t m_vlrCount = 0;
+    uint64_t m_evlrOffset = 0;
+    uint64_t m_evlrCount = 0;
+
+    uint64_t m_pointFormat = 0;
+    uint64_t m_pointLength = 0;
+    uint64_t m_points = 0;
+    bool m_compressed = false;
+
+    Scale m_scale;
+    Offset m_offset;
+    Bounds m_bounds;
+
+    std::string m_srsRecords;
+};
+
+} // namespace entwine
+
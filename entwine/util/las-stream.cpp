@@ -0,0 +1,192 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/las-stream.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    arbiter::http::Headers rangeHeaders(uint64_t start, uint64_t end = 0)
+    {
+        arbiter::http::Headers h;
+        h["Range"] = "bytes=" + std::to_string(start) + "-" +
+            (end ? std::to_string(end - 1) : "");
+        return h;
+    }
+
+    template <typename T>
+    void set(std::vector<char>& data, const uint64_t pos, const T v)
+    {
+        std::memcpy(data.data() + pos, &v, sizeof(T));
+    }
+}
+
+std::unique_ptr<LasStream> LasStream::create(
+        const arbiter::Arbiter& a,
+        const std::string path,
+        const arbiter::Endpoint& tmp,
+        const uint64_t windowBytes)
+{
+    if (!a.isHttpDerived(path)) return std::unique_ptr<LasStream>();
+
+    const std::string ext(arbiter::Arbiter::getExtension(path));
+    if (ext != "las" && ext != "LAS") return std::unique_ptr<LasStream>();
+
+    std::vector<char> data(
+            a.getBinary(path, rangeHeaders(0, heuristics::lasHeaderBytes)));
+    const LasHeader header(data);
+
+    // Compressed points may not be split at arbitrary offsets.
+    if (header.compressed() || !header.pointLength())
+    {
+        return std::unique_ptr<LasStream>();
+    }
+
+    if (data.size() < header.pointOffset())
+    {
+        const auto rest(
+                a.getBinary(
+                    path,
+                    rangeHeaders(data.size(), header.pointOffset())));
+        data.insert(data.end(), rest.begin(), rest.end());
+    }
+
+    return makeUnique<LasStream>(a, path, tmp, windowBytes, data);
+}
+
+LasStream::LasStream(
+        const arbiter::Arbiter& a,
+        const std::string path,
+        const arbiter::Endpoint& tmp,
+        const uint64_t windowBytes,
+        std::vector<char> header)
+    : m_arbiter(a)
+    , m_path(path)
+    , m_tmp(tmp)
+    , m_basename(
+            arbiter::crypto::encodeAsHex(arbiter::crypto::sha256(path)) +
+            ".las")
+    , m_header(header)
+    , m_lasHeader(m_header)
+    , m_windowPoints(
+            std::max<uint64_t>(windowBytes / m_lasHeader.pointLength(), 1))
+{
+    m_header.resize(m_lasHeader.pointOffset());
+    m_lasHeader.addVlrs(
+            std::vector<char>(
+                m_header.begin() + m_lasHeader.headerSize(),
+                m_header.end()));
+
+    if (m_lasHeader.evlrOffset() && m_lasHeader.evlrCount())
+    {
+        m_evlrs = m_arbiter.getBinary(
+                m_path,
+                rangeHeaders(m_lasHeader.evlrOffset()));
+    }
+
+    m_next = fetch(0);
+}
+
+LasStream::~LasStream()
+{
+    if (m_next.valid()) m_next.wait();
+    remove();
+}
+
+std::future<std::vector<char>> LasStream::fetch(const uint64_t window)
+{
+    const uint64_t total(m_lasHeader.points());
+    const uint64_t begin(std::min(window * m_windowPoints, total));
+    const uint64_t end(std::min(begin + m_windowPoints, total));
+
+    if (begin == end)
+    {
+        std::promise<std::vector<char>> done;
+        done.set_value(std::vector<char>());
+        return done.get_future();
+    }
+
+    const uint64_t length(m_lasHeader.pointLength());
+    const uint64_t offset(m_lasHeader.pointOffset());
+
+    return std::async(std::launch::async, [this, begin, end, length, offset]()
+    {
+        return m_arbiter.getBinary(
+                m_path,
+                rangeHeaders(offset + begin * length, offset + end * length));
+    });
+}
+
+bool LasStream::next()
+{
+    std::vector<char> points(m_next.get());
+    remove();
+
+    if (points.empty()) return false;
+    m_next = fetch(++m_window);
+
+    const uint64_t length(m_lasHeader.pointLength());
+    if (points.size() % length)
+    {
+        throw std::runtime_error("Truncated LAS points: " + m_path);
+    }
+
+    const uint64_t count(points.size() / length);
+
+    std::vector<char> data(m_header);
+
+    // Only the counts are patched - the by-return counts and bounds still
+    // describe the whole file, which PDAL does not verify.
+    if (m_lasHeader.minorVersion() >= 4)
+    {
+        set<uint64_t>(data, 247, count);
+
+        if (m_evlrs.size())
+        {
+            set<uint64_t>(data, 235, data.size() + points.size());
+        }
+    }
+
+    // The legacy count is zero for formats that cannot represent it.
+    uint32_t legacy(0);
+    std::memcpy(&legacy, data.data() + 107, sizeof(uint32_t));
+    if (legacy) set<uint32_t>(data, 107, count);
+
+    data.insert(data.end(), points.begin(), points.end());
+    data.insert(data.end(), m_evlrs.begin(), m_evlrs.end());
+
+    m_tmp.put(m_basename, data);
+    m_written = true;
+    return true;
+}
+
+std::string LasStream::localPath() const
+{
+    return m_tmp.fullPath(m_basename);
+}
+
+void LasStream::remove()
+{
+    if (!m_written) return;
+    arbiter::remove(localPath());
+    m_written = false;
+}
+
+} // namespace entwine
+
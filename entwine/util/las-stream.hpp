@@ -0,0 +1,89 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/util/las-header.hpp>
+
+namespace arbiter
+{
+    class Arbiter;
+    class Endpoint;
+}
+
+namespace entwine
+{
+
+// Reads a remote, uncompressed LAS file as a series of ranged windows of
+// points rather than downloading it whole.  Each window is written to the
+// temporary endpoint as a standalone LAS file - the original header and
+// records with its point count patched - so the usual PDAL pipeline may run
+// over it.  The next window is fetched while the current one is processed, so
+// at most one window is on disk and one is in memory at any time.
+class LasStream
+{
+public:
+    // Returns null if the file at this path cannot be streamed, in which case
+    // it should be localized as usual.
+    static std::unique_ptr<LasStream> create(
+            const arbiter::Arbiter& a,
+            std::string path,
+            const arbiter::Endpoint& tmp,
+            uint64_t windowBytes);
+
+    LasStream(
+            const arbiter::Arbiter& a,
+            std::string path,
+            const arbiter::Endpoint& tmp,
+            uint64_t windowBytes,
+            std::vector<char> header);
+    ~LasStream();
+
+    // Write the next window to the temporary endpoint, replacing the previous
+    // one.  Returns false when all points have been read.
+    bool next();
+
+    // The local path of the current window.
+    std::string localPath() const;
+
+    // The in-memory footprint of a stream, for budgeting purposes.
+    uint64_t bytes() const
+    {
+        return 2 * m_windowPoints * m_lasHeader.pointLength();
+    }
+
+private:
+    std::future<std::vector<char>> fetch(uint64_t window);
+    void remove();
+
+    const arbiter::Arbiter& m_arbiter;
+    const std::string m_path;
+    const arbiter::Endpoint& m_tmp;
+    const std::string m_basename;
+
+    std::vector<char> m_header;
+    std::vector<char> m_evlrs;
+    LasHeader m_lasHeader;
+
+    uint64_t m_windowPoints = 0;
+    uint64_t m_window = 0;
+    bool m_written = false;
+
+    std::future<std::vector<char>> m_next;
+};
+
+} // namespace entwine
+
@@ -0,0 +1,64 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/mapped-file.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace entwine
+{
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string& path)
+{
+    std::unique_ptr<MappedFile> result;
+
+#ifndef _WIN32
+    const int fd(::open(path.c_str(), O_RDONLY));
+    if (fd == -1) return result;
+
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        const uint64_t size(info.st_size);
+        void* data(
+                ::mmap(
+                    nullptr,
+                    size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE,
+                    fd,
+                    0));
+
+        if (data != MAP_FAILED)
+        {
+            result.reset(new MappedFile(static_cast<char*>(data), size));
+        }
+    }
+
+    // The mapping remains valid after its descriptor is closed.
+    ::close(fd);
+#endif
+
+    return result;
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    ::munmap(m_data, m_size);
+#endif
+}
+
+} // namespace entwine
@@ -0,0 +1,46 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace entwine
+{
+
+// A local file mapped into memory, so that its contents are read lazily from
+// the page cache, which is shared between processes mapping the same file.
+// The mapping is private: its contents may be modified, but modifications are
+// never written back to the file.
+class MappedFile
+{
+public:
+    // Returns null if the file doesn't exist, is empty, or if mapping is
+    // unsupported on this platform.
+    static std::unique_ptr<MappedFile> create(const std::string& path);
+
+    ~MappedFile();
+
+    char* data() { return m_data; }
+    uint64_t size() const { return m_size; }
+
+private:
+    MappedFile(char* data, uint64_t size) : m_data(data), m_size(size) { }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    char* const m_data;
+    const uint64_t m_size;
+};
+
+} // namespace entwine
@@ -0,0 +1,92 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/memory.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace entwine
+{
+
+std::string Memory::toString(const Subsystem subsystem)
+{
+    switch (subsystem)
+    {
+        case Subsystem::Chunks:     return "chunks";
+        case Subsystem::Blocks:     return "blocks";
+        case Subsystem::Overflows:  return "overflows";
+        case Subsystem::Clippers:   return "clippers";
+        case Subsystem::Hierarchy:  return "hierarchy";
+        case Subsystem::Files:      return "files";
+        case Subsystem::Tables:     return "tables";
+        default:                    return "unknown";
+    }
+}
+
+Memory::Subsystem Memory::toSubsystem(const std::string& name)
+{
+    for (std::size_t i(0); i < numSubsystems; ++i)
+    {
+        const Subsystem s(static_cast<Subsystem>(i));
+        if (toString(s) == name) return s;
+    }
+
+    throw std::runtime_error("Invalid memory subsystem: " + name);
+}
+
+uint64_t Memory::total() const
+{
+    uint64_t n(0);
+    for (const Counter& counter : m_counters) n += counter.bytes;
+    return n;
+}
+
+void Memory::setLimits(const json& limits)
+{
+    if (limits.is_null()) return;
+    if (!limits.is_object())
+    {
+        throw std::runtime_error("Memory limits must be an object");
+    }
+
+    for (auto it(limits.begin()); it != limits.end(); ++it)
+    {
+        setLimit(toSubsystem(it.key()), it.value().get<uint64_t>());
+    }
+}
+
+double Memory::pressure() const
+{
+    double pressure(0);
+    for (const Counter& counter : m_counters)
+    {
+        if (const uint64_t limit = counter.limit)
+        {
+            pressure = std::max(pressure, double(counter.bytes) / limit);
+        }
+    }
+    return pressure;
+}
+
+json Memory::toJson() const
+{
+    json j(json::object());
+    for (std::size_t i(0); i < numSubsystems; ++i)
+    {
+        const Subsystem s(static_cast<Subsystem>(i));
+        json& entry(j[toString(s)] = { { "bytes", bytes(s) } });
+        if (const uint64_t l = limit(s)) entry["limit"] = l;
+    }
+    j["total"] = total();
+    return j;
+}
+
+} // namespace entwine
@@ -0,0 +1,122 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// Process-wide accounting of the bytes held by each part of a build, so that
+// high memory use may be traced to its source.  Most subsystems are charged as
+// they allocate and release, while those which are cheaper to measure than to
+// track are set periodically by the builder.
+//
+// Each subsystem may have a soft limit.  Nothing is refused beyond it, but
+// while any subsystem is over its limit the chunk cache reports itself under
+// pressure, so threads clip their stale chunks sooner.
+class Memory
+{
+public:
+    enum class Subsystem
+    {
+        Chunks,     // Voxel grids of in-memory chunks.
+        Blocks,     // Point data of chunks and overflows.  Measured.
+        Overflows,  // Overflow entries, beyond their point data.
+        Clippers,   // The per-thread tables of held chunks.
+        Hierarchy,  // Node counts and stats.  Measured.
+        Files,      // The file list and per-file metadata.  Measured.
+        Tables      // Points read from inputs and awaiting insertion.
+    };
+
+    static const std::size_t numSubsystems = 7;
+    static std::string toString(Subsystem subsystem);
+
+    // Throws if there is no subsystem of this name.
+    static Subsystem toSubsystem(const std::string& name);
+
+    static Memory& get()
+    {
+        static Memory memory;
+        return memory;
+    }
+
+    void add(Subsystem s, uint64_t bytes) { at(s).bytes += bytes; }
+    void sub(Subsystem s, uint64_t bytes) { at(s).bytes -= bytes; }
+
+    // For measured subsystems, replace the previous measurement.
+    void set(Subsystem s, uint64_t bytes) { at(s).bytes = bytes; }
+
+    uint64_t bytes(Subsystem s) const { return at(s).bytes; }
+    uint64_t total() const;
+
+    // A soft limit of 0 means no limit.
+    void setLimit(Subsystem s, uint64_t bytes) { at(s).limit = bytes; }
+    uint64_t limit(Subsystem s) const { return at(s).limit; }
+
+    // Set the soft limits given as an object of subsystem names to bytes.
+    void setLimits(const json& limits);
+
+    // The greatest fraction of its soft limit in use by any limited
+    // subsystem, or 0 if none are limited.
+    double pressure() const;
+
+    // Charges bytes to a subsystem for the lifetime of this object.
+    class Charge
+    {
+    public:
+        Charge(Subsystem subsystem, uint64_t bytes)
+            : m_subsystem(subsystem)
+            , m_bytes(bytes)
+        {
+            Memory::get().add(m_subsystem, m_bytes);
+        }
+
+        ~Charge() { Memory::get().sub(m_subsystem, m_bytes); }
+
+    private:
+        const Subsystem m_subsystem;
+        const uint64_t m_bytes;
+
+        Charge(const Charge&) = delete;
+        Charge& operator=(const Charge&) = delete;
+    };
+
+    // An object keyed by subsystem name with the bytes of each, and its
+    // limit if it has one, along with the total.
+    json toJson() const;
+
+private:
+    Memory() = default;
+
+    // Each subsystem is charged from many threads, so they're kept on
+    // separate cache lines.
+    struct alignas(64) Counter
+    {
+        std::atomic<uint64_t> bytes { 0 };
+        std::atomic<uint64_t> limit { 0 };
+    };
+
+    Counter& at(Subsystem s) { return m_counters[static_cast<int>(s)]; }
+    const Counter& at(Subsystem s) const
+    {
+        return m_counters[static_cast<int>(s)];
+    }
+
+    std::array<Counter, numSubsystems> m_counters;
+};
+
+} // namespace entwine
@@ -0,0 +1,129 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/metrics.hpp>
+
+#include <chrono>
+#include <sstream>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/spin-lock.hpp>
+#include <entwine/util/throttle.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    thread_local Metrics::Timer* current(nullptr);
+
+    void flatten(
+            const json& j,
+            const std::string& name,
+            std::ostringstream& out)
+    {
+        if (j.is_object())
+        {
+            for (auto it(j.begin()); it != j.end(); ++it)
+            {
+                flatten(it.value(), name + "_" + it.key(), out);
+            }
+        }
+        else if (j.is_boolean())
+        {
+            out << name << " " << (j.get<bool>() ? 1 : 0) << "\n";
+        }
+        else if (j.is_number()) out << name << " " << j.dump() << "\n";
+    }
+}
+
+std::string Metrics::toString(const Phase phase)
+{
+    switch (phase)
+    {
+        case Phase::Download:   return "download";
+        case Phase::Read:       return "read";
+        case Phase::Key:        return "key";
+        case Phase::Insert:     return "insert";
+        case Phase::Overflow:   return "overflow";
+        case Phase::Serialize:  return "serialize";
+        case Phase::Upload:     return "upload";
+        default:                return "unknown";
+    }
+}
+
+Metrics::Timer::Timer(const Phase phase)
+    : m_phase(phase)
+    , m_start(now())
+    , m_parent(current)
+{
+    current = this;
+}
+
+Metrics::Timer::~Timer()
+{
+    const uint64_t nanos(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now() - m_start).count());
+
+    Counter& counter(Metrics::get().m_phases[static_cast<int>(m_phase)]);
+    counter.nanos += nanos > m_nested ? nanos - m_nested : 0;
+    ++counter.count;
+
+    if (m_parent) m_parent->m_nested += nanos;
+    current = m_parent;
+}
+
+json Metrics::toJson() const
+{
+    json phases(json::object());
+    for (std::size_t i(0); i < numPhases; ++i)
+    {
+        const Counter& counter(m_phases[i]);
+        phases[toString(static_cast<Phase>(i))] = {
+            { "seconds", counter.nanos / 1000000000.0 },
+            { "count", counter.count.load() }
+        };
+    }
+
+    json j {
+        { "phases", phases },
+        { "bytesWritten", m_bytesWritten.load() }
+    };
+
+    const arbiter::http::Stats http(arbiter::http::stats());
+    j["http"] = {
+        { "opened", http.opened },
+        { "reused", http.reused },
+        { "failed", http.failed },
+        { "connectSeconds", http.connectSeconds },
+        { "tlsSeconds", http.tlsSeconds }
+    };
+    j["throttle"] = Throttle::get().toJson();
+
+#ifndef SPINLOCK_AS_MUTEX
+    j["locks"] = {
+        { "contended", SpinLock::contended() },
+        { "parked", SpinLock::parked() },
+        { "waitSeconds", SpinLock::waitNanos() / 1000000000.0 }
+    };
+#endif
+
+    return j;
+}
+
+std::string toPrometheus(const json& j, const std::string& prefix)
+{
+    std::ostringstream out;
+    flatten(j, prefix, out);
+    return out.str();
+}
+
+} // namespace entwine
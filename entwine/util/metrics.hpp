@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <entwine/util/json.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+
+// Process-wide counters of where build time goes.  Each phase accumulates the
+// time spent in it summed over all threads, so with N threads busy a phase
+// may accrue up to N seconds per second of wall time.
+//
+// Phases nest - for example an upload happens during serialization, and an
+// overflow during insertion - and each phase is charged only for its own time,
+// excluding that of any phase nested within it on the same thread.
+class Metrics
+{
+public:
+    enum class Phase
+    {
+        Download,
+        Read,
+        Key,
+        Insert,
+        Overflow,
+        Serialize,
+        Upload
+    };
+
+    static const std::size_t numPhases = 7;
+    static std::string toString(Phase phase);
+
+    static Metrics& get()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    // Charges the time from its construction to its destruction, less that of
+    // any timers created on this thread within its lifetime, to a phase.
+    class Timer
+    {
+    public:
+        explicit Timer(Phase phase);
+        ~Timer();
+
+    private:
+        const Phase m_phase;
+        const TimePoint m_start;
+        Timer* const m_parent;
+        uint64_t m_nested = 0;
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+
+    void addBytesWritten(uint64_t bytes) { m_bytesWritten += bytes; }
+
+    // Totals since the start of this process, as an object keyed by phase
+    // name with the seconds and number of occurrences of each, along with
+    // bytes written and lock contention.
+    json toJson() const;
+
+private:
+    Metrics() = default;
+
+    struct Counter
+    {
+        std::atomic<uint64_t> nanos { 0 };
+        std::atomic<uint64_t> count { 0 };
+    };
+
+    std::array<Counter, numPhases> m_phases;
+    std::atomic<uint64_t> m_bytesWritten { 0 };
+};
+
+// Flatten the numeric values of a JSON object into the Prometheus text
+// exposition format, with metric names joined by underscores from the path to
+// each value.  Booleans are written as 0 or 1 and other values are skipped.
+std::string toPrometheus(const json& j, const std::string& prefix = "entwine");
+
+} // namespace entwine
@@ -0,0 +1,112 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/numa.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace entwine
+{
+namespace numa
+{
+
+namespace
+{
+
+// Parse a kernel CPU list like "0-7,16-23".
+std::vector<int> parseList(const std::string& s)
+{
+    std::vector<int> cpus;
+    std::istringstream ss(s);
+    std::string range;
+
+    while (std::getline(ss, range, ','))
+    {
+        if (range.empty()) continue;
+
+        const std::size_t dash(range.find('-'));
+        const int begin(std::stoi(range.substr(0, dash)));
+        const int end(
+                dash == std::string::npos ?
+                    begin : std::stoi(range.substr(dash + 1)));
+
+        for (int cpu(begin); cpu <= end; ++cpu) cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+std::vector<std::vector<int>> discover()
+{
+    std::vector<std::vector<int>> result;
+
+#ifdef __linux__
+    for (std::size_t node(0); ; ++node)
+    {
+        std::ifstream file(
+                "/sys/devices/system/node/node" + std::to_string(node) +
+                "/cpulist");
+        if (!file.good()) break;
+
+        std::string line;
+        std::getline(file, line);
+
+        try
+        {
+            std::vector<int> cpus(parseList(line));
+            if (cpus.empty()) continue;
+            result.push_back(cpus);
+        }
+        catch (...)
+        {
+            return std::vector<std::vector<int>>();
+        }
+    }
+#endif
+
+    return result;
+}
+
+} // unnamed namespace
+
+const std::vector<std::vector<int>>& nodes()
+{
+    static const std::vector<std::vector<int>> n(discover());
+    return n;
+}
+
+bool pin(const std::size_t node)
+{
+#ifdef __linux__
+    if (node >= nodes().size()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : nodes()[node])
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+
+    return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return false;
+#endif
+}
+
+} // namespace numa
+} // namespace entwine
+
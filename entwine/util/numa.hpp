@@ -0,0 +1,31 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace entwine
+{
+namespace numa
+{
+
+// The CPUs of each NUMA node of this machine, as reported by the kernel.
+// Empty if the topology is unknown, which is always the case off of Linux.
+const std::vector<std::vector<int>>& nodes();
+
+// Restrict the calling thread to the CPUs of the given node, so memory it
+// touches first is allocated there.  Returns false if this isn't possible.
+bool pin(std::size_t node);
+
+} // namespace numa
+} // namespace entwine
+
@@ -10,22 +10,46 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <entwine/util/task.hpp>
+
 namespace entwine
 {
 
+// A thread pool with a lane of queued tasks per worker thread.  Tasks added
+// from outside the pool are distributed round-robin across the lanes, and
+// tasks added from within one of the pool's own tasks go to the lane of the
+// calling worker.  Idle workers steal from the other lanes, so no single lock
+// is taken by every producer and consumer.  High-priority tasks bypass the
+// per-worker lanes and are always run before any normal-priority task.
 class Pool
 {
+    struct Lane
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
 public:
+    enum class Priority
+    {
+        Normal,
+        High
+    };
+
     // After numThreads tasks are actively running, and queueSize tasks have
     // been enqueued to wait for an available worker thread, subsequent calls
     // to Pool::add will block until an enqueued task has been popped from the
@@ -38,11 +62,26 @@ public:
         , m_numThreads(std::max<std::size_t>(numThreads, 1))
         , m_queueSize(std::max<std::size_t>(queueSize, 1))
     {
+        m_active = m_numThreads;
         go();
     }
 
     ~Pool() { join(); }
 
+    // Partition the workers into this many groups by their index, modulo the
+    // group count.  Idle workers steal from their own group before any other,
+    // and each worker calls onStart with its group as it starts, for example
+    // to pin itself to a NUMA node.  Takes effect the next time the pool is
+    // started.
+    void setGroups(
+            std::size_t groups,
+            std::function<void(std::size_t)> onStart = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_groups = std::max<std::size_t>(groups, 1);
+        m_onStart = onStart;
+    }
+
     // Start worker threads.
     void go()
     {
@@ -50,9 +89,15 @@ public:
         if (m_running) return;
         m_running = true;
 
+        m_lanes.clear();
+        for (std::size_t i(0); i < m_numThreads; ++i)
+        {
+            m_lanes.emplace_back(new Lane());
+        }
+
         for (std::size_t i(0); i < m_numThreads; ++i)
         {
-            m_threads.emplace_back([this]() { work(); });
+            m_threads.emplace_back([this, i]() { work(i); });
         }
     }
 
@@ -66,6 +111,7 @@ public:
         lock.unlock();
 
         m_consumeCv.notify_all();
+        m_parkCv.notify_all();
         for (auto& t : m_threads) t.join();
         m_threads.clear();
     }
@@ -74,11 +120,13 @@ public:
     // continue to be added while a thread is await()-ing the queue to empty.
     void await()
     {
+        ++m_waiting;
         std::unique_lock<std::mutex> lock(m_mutex);
         m_produceCv.wait(lock, [this]()
         {
-            return !m_outstanding && m_tasks.empty();
+            return !m_outstanding && !m_queued;
         });
+        --m_waiting;
     }
 
     // Join and restart.
@@ -88,73 +136,267 @@ public:
     void resize(const std::size_t numThreads)
     {
         join();
-        m_numThreads = numThreads;
+        m_numThreads = std::max<std::size_t>(numThreads, 1);
+        m_active = m_numThreads;
         go();
     }
 
+    // Limit the number of threads taking tasks without joining, for example
+    // to lend capacity to another pool.  Threads beyond this count park after
+    // their current task until they are reactivated, and their queued tasks
+    // are taken by the active threads.
+    void setActive(std::size_t active)
+    {
+        active = std::min(std::max<std::size_t>(active, 1), m_numThreads);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active = active;
+        m_parkCv.notify_all();
+    }
+
+    std::size_t active() const { return m_active; }
+
+    // Snapshots for monitoring - these may be stale by the time they return.
+    std::size_t queued() const { return m_queued; }
+    std::size_t idle() const { return m_idle; }
+
     // Not thread-safe, pool should be joined before calling.
     const std::vector<std::string>& errors() const { return m_errors; }
 
     // Add a threaded task, blocking until a thread is available.  If join() is
     // called, add() may not be called again until go() is called and completes.
-    void add(std::function<void()> task)
+    void add(Task task, Priority priority = Priority::Normal)
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
         if (!m_running)
         {
             throw std::runtime_error(
                     "Attempted to add a task to a stopped Pool");
         }
 
-        m_produceCv.wait(lock, [this]()
+        if (!reserve(1))
         {
-            return m_tasks.size() < m_queueSize;
-        });
+            ++m_waiting;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_produceCv.wait(lock, [this]() { return reserve(1); });
+            --m_waiting;
+        }
 
-        m_tasks.emplace(task);
+        push(&task, 1, priority);
+    }
 
-        // Notify worker that a task is available.
-        lock.unlock();
-        m_consumeCv.notify_all();
+    // Add a batch of tasks, blocking as needed for space in the queue.  As
+    // many as there is room for are pushed at a time, taking each lock once
+    // rather than once per task.
+    void addBatch(std::vector<Task> tasks, Priority priority = Priority::Normal)
+    {
+        if (!m_running)
+        {
+            throw std::runtime_error(
+                    "Attempted to add a task to a stopped Pool");
+        }
+
+        std::size_t pos(0);
+        while (pos < tasks.size())
+        {
+            const std::size_t remaining(tasks.size() - pos);
+            std::size_t n(reserve(remaining));
+            if (!n)
+            {
+                ++m_waiting;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_produceCv.wait(lock, [this, remaining, &n]()
+                {
+                    return (n = reserve(remaining)) != 0;
+                });
+                --m_waiting;
+            }
+
+            push(tasks.data() + pos, n, priority);
+            pos += n;
+        }
     }
 
+    // Add a task only if there is space in the queue, without blocking.
+    // Returns false if the task was not added.
+    bool tryAdd(Task task, Priority priority = Priority::Normal)
+    {
+        if (!m_running)
+        {
+            throw std::runtime_error(
+                    "Attempted to add a task to a stopped Pool");
+        }
+
+        if (!reserve(1)) return false;
+        push(&task, 1, priority);
+        return true;
+    }
 
     std::size_t size() const { return m_numThreads; }
     std::size_t numThreads() const { return m_numThreads; }
 
 private:
+    // Claim up to n spots in the queue, returning the number claimed.
+    std::size_t reserve(const std::size_t n)
+    {
+        std::size_t queued(m_queued);
+        while (queued < m_queueSize)
+        {
+            const std::size_t count(std::min(n, m_queueSize - queued));
+            if (m_queued.compare_exchange_weak(queued, queued + count))
+            {
+                return count;
+            }
+        }
+        return 0;
+    }
+
+    // Move n reserved tasks into the lanes.  From outside the pool, they are
+    // split evenly across consecutive lanes.
+    void push(Task* tasks, const std::size_t n, Priority priority)
+    {
+        if (priority == Priority::High) pushTo(m_priority, tasks, n);
+        else if (current().pool == this)
+        {
+            pushTo(*m_lanes[current().index], tasks, n);
+        }
+        else
+        {
+            const std::size_t lanes(std::min(n, m_lanes.size()));
+            const std::size_t first(m_next.fetch_add(lanes));
+            for (std::size_t i(0); i < lanes; ++i)
+            {
+                const std::size_t begin(n * i / lanes);
+                const std::size_t end(n * (i + 1) / lanes);
+                Lane& lane(*m_lanes[(first + i) % m_lanes.size()]);
+                pushTo(lane, tasks + begin, end - begin);
+            }
+        }
+
+        // Notify workers that tasks are available.  Idle workers register
+        // themselves before sleeping, so we only need the pool lock if there
+        // is someone to wake.
+        if (m_idle)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (n == 1) m_consumeCv.notify_one();
+            else m_consumeCv.notify_all();
+        }
+    }
+
+    void pushTo(Lane& lane, Task* tasks, const std::size_t n)
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        for (std::size_t i(0); i < n; ++i)
+        {
+            lane.tasks.emplace_back(std::move(tasks[i]));
+        }
+    }
+
+    // Wake any threads in add() or await(), if there are any.
+    void notifyWaiting()
+    {
+        if (m_waiting)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_produceCv.notify_all();
+        }
+    }
+
+    bool pop(Lane& lane, Task& task, bool back)
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        if (lane.tasks.empty()) return false;
+
+        if (back)
+        {
+            task = std::move(lane.tasks.back());
+            lane.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(lane.tasks.front());
+            lane.tasks.pop_front();
+        }
+
+        // Mark this task as outstanding before it leaves the queued count so
+        // await() never observes an empty pool while a task is in transit.
+        ++m_outstanding;
+        --m_queued;
+        return true;
+    }
+
+    // Take from the priority lane, then the back of our own lane, and then
+    // steal from the front of the other workers' lanes, starting with those
+    // in our own group.
+    bool take(const std::size_t index, Task& task)
+    {
+        if (pop(m_priority, task, false)) return true;
+        if (pop(*m_lanes[index], task, true)) return true;
+
+        const std::size_t n(m_lanes.size());
+        const std::size_t group(index % m_groups);
+
+        for (std::size_t i(1); i < n; ++i)
+        {
+            const std::size_t j((index + i) % n);
+            if (j % m_groups == group && pop(*m_lanes[j], task, false))
+            {
+                return true;
+            }
+        }
+
+        if (m_groups == 1) return false;
+
+        for (std::size_t i(1); i < n; ++i)
+        {
+            const std::size_t j((index + i) % n);
+            if (j % m_groups != group && pop(*m_lanes[j], task, false))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     // Worker thread function.  Wait for a task and run it - or if stop() is
     // called, complete any outstanding task and return.
-    void work()
+    void work(const std::size_t index)
     {
+        current().pool = this;
+        current().index = index;
+
+        if (m_onStart) m_onStart(index % m_groups);
+
+        Task task;
+
         while (true)
         {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_consumeCv.wait(lock, [this]()
+            if (index >= m_active && m_running)
             {
-                return m_tasks.size() || !m_running;
-            });
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_parkCv.wait(lock, [this, index]()
+                {
+                    return index < m_active || !m_running;
+                });
+                continue;
+            }
 
-            if (m_tasks.size())
+            if (take(index, task))
             {
-                ++m_outstanding;
-                auto task(std::move(m_tasks.front()));
-                m_tasks.pop();
-
-                lock.unlock();
-
                 // Notify add(), which may be waiting for a spot in the queue.
-                m_produceCv.notify_all();
+                notifyWaiting();
 
                 std::string err;
                 try { task(); }
                 catch (std::exception& e) { err = e.what(); }
                 catch (...) { err = "Unknown error"; }
 
-                lock.lock();
-                --m_outstanding;
+                task = nullptr;
+
                 if (err.size())
                 {
+                    std::lock_guard<std::mutex> lock(m_errorMutex);
                     if (m_verbose)
                     {
                         std::cout << "Exception in pool task: " << err <<
@@ -162,33 +404,72 @@ private:
                     }
                     m_errors.push_back(err);
                 }
-                lock.unlock();
+
+                --m_outstanding;
 
                 // Notify await(), which may be waiting for a running task.
-                m_produceCv.notify_all();
+                notifyWaiting();
+            }
+            else if (m_queued)
+            {
+                // A task has been reserved but not yet pushed to its lane.
+                std::this_thread::yield();
             }
-            else if (!m_running)
+            else
             {
-                return;
+                ++m_idle;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_consumeCv.wait(lock, [this]()
+                {
+                    return m_queued || !m_running;
+                });
+                --m_idle;
+
+                if (!m_queued && !m_running) break;
             }
         }
+
+        current().pool = nullptr;
+    }
+
+    struct Worker
+    {
+        const Pool* pool = nullptr;
+        std::size_t index = 0;
+    };
+
+    static Worker& current()
+    {
+        static thread_local Worker worker;
+        return worker;
     }
 
     bool m_verbose;
     std::size_t m_numThreads;
     std::size_t m_queueSize;
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+
+    std::vector<std::unique_ptr<Lane>> m_lanes;
+    Lane m_priority;
+    std::atomic<std::size_t> m_next { 0 };
+
+    std::size_t m_groups = 1;
+    std::function<void(std::size_t)> m_onStart;
 
     std::vector<std::string> m_errors;
     std::mutex m_errorMutex;
 
-    std::size_t m_outstanding = 0;
-    bool m_running = false;
+    std::atomic<std::size_t> m_queued { 0 };
+    std::atomic<std::size_t> m_outstanding { 0 };
+    std::atomic<std::size_t> m_idle { 0 };
+    std::atomic<std::size_t> m_waiting { 0 };
+    std::atomic<bool> m_running { false };
+    std::atomic<std::size_t> m_active { 0 };
 
     mutable std::mutex m_mutex;
     std::condition_variable m_produceCv;
     std::condition_variable m_consumeCv;
+    std::condition_variable m_parkCv;
 
     // Disable copy/assignment.
     Pool(const Pool& other);
@@ -196,4 +477,3 @@ private:
 };
 
 } // namespace entwine
-
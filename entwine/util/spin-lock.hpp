@@ -14,6 +14,14 @@
 #include <mutex>
 #else
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 #endif
 
 namespace entwine
@@ -25,15 +33,86 @@ using SpinLock = std::mutex;
 
 #else
 
+// An adaptive lock, small enough to be embedded per-voxel-tube.  Uncontended
+// acquisition is a single test-and-set.  Under contention we spin briefly
+// with a CPU pause hint, then yield, and finally sleep, so threads blocked
+// behind long critical sections (like chunk serialization) don't burn whole
+// cores.
 class SpinLock
 {
 public:
     SpinLock() = default;
 
-    void lock() { while (m_flag.test_and_set()) ; }
-    void unlock() { m_flag.clear(); }
+    void lock()
+    {
+        if (!m_flag.test_and_set(std::memory_order_acquire)) return;
+        contend();
+    }
+
+    bool try_lock() { return !m_flag.test_and_set(std::memory_order_acquire); }
+    void unlock() { m_flag.clear(std::memory_order_release); }
+
+    // Process-wide count of lock acquisitions which did not succeed on the
+    // first attempt, and of those, how many had to park the thread.
+    static uint64_t contended() { return counters().contended; }
+    static uint64_t parked() { return counters().parked; }
+
+    // Total time spent waiting in contended acquisitions, over all threads.
+    static uint64_t waitNanos() { return counters().waitNanos; }
 
 private:
+    struct Counters
+    {
+        std::atomic<uint64_t> contended { 0 };
+        std::atomic<uint64_t> parked { 0 };
+        std::atomic<uint64_t> waitNanos { 0 };
+    };
+
+    static Counters& counters()
+    {
+        static Counters c;
+        return c;
+    }
+
+    static void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    void contend()
+    {
+        ++counters().contended;
+        const auto start(std::chrono::steady_clock::now());
+
+        const uint64_t spinCount(64);
+        const uint64_t yieldCount(spinCount + 16);
+        bool parked(false);
+
+        for (uint64_t i(0); m_flag.test_and_set(std::memory_order_acquire); ++i)
+        {
+            if (i < spinCount) pause();
+            else if (i < yieldCount) std::this_thread::yield();
+            else
+            {
+                if (!parked)
+                {
+                    parked = true;
+                    ++counters().parked;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+
+        counters().waitNanos +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
     std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
 
     SpinLock(const SpinLock& other) = delete;
@@ -45,4 +124,3 @@ using SpinGuard = std::lock_guard<SpinLock>;
 using UniqueSpin = std::unique_lock<SpinLock>;
 
 } // namespace entwine
-
@@ -0,0 +1,162 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace entwine
+{
+
+// A move-only callable taking no arguments, for work submitted to a Pool.
+// Unlike std::function, callables of up to inlineBytes are stored in place,
+// so submitting a typical lambda doesn't allocate, and captures may be
+// move-only.  Larger callables are kept on the heap.
+class Task
+{
+public:
+    static constexpr std::size_t inlineBytes = 64;
+
+    Task() = default;
+    Task(std::nullptr_t) { }
+
+    template<
+        typename Fn,
+        typename D = typename std::decay<Fn>::type,
+        typename = typename std::enable_if<
+            !std::is_same<D, Task>::value>::type>
+    Task(Fn&& f)
+    {
+        construct<D>(
+                std::forward<Fn>(f),
+                std::integral_constant<bool, fits<D>()>());
+    }
+
+    Task(Task&& other) noexcept { take(other); }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return m_ops; }
+    void operator()() { m_ops->invoke(m_storage); }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);   // Leaves src destroyed.
+        void (*destroy)(void*);
+    };
+
+    template<typename Fn>
+    static constexpr bool fits()
+    {
+        return sizeof(Fn) <= inlineBytes &&
+            alignof(Fn) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<typename Fn>
+    struct Inline
+    {
+        static void invoke(void* p) { (*static_cast<Fn*>(p))(); }
+        static void move(void* dst, void* src)
+        {
+            Fn* f(static_cast<Fn*>(src));
+            new (dst) Fn(std::move(*f));
+            f->~Fn();
+        }
+        static void destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+
+        static const Ops ops;
+    };
+
+    template<typename Fn>
+    struct Heap
+    {
+        static void invoke(void* p) { (**static_cast<Fn**>(p))(); }
+        static void move(void* dst, void* src)
+        {
+            *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+        }
+        static void destroy(void* p) { delete *static_cast<Fn**>(p); }
+
+        static const Ops ops;
+    };
+
+    template<typename D, typename Fn>
+    void construct(Fn&& f, std::true_type)
+    {
+        new (m_storage) D(std::forward<Fn>(f));
+        m_ops = &Inline<D>::ops;
+    }
+
+    template<typename D, typename Fn>
+    void construct(Fn&& f, std::false_type)
+    {
+        *reinterpret_cast<D**>(m_storage) = new D(std::forward<Fn>(f));
+        m_ops = &Heap<D>::ops;
+    }
+
+    void take(Task& other)
+    {
+        if (!other.m_ops) return;
+        other.m_ops->move(m_storage, other.m_storage);
+        m_ops = other.m_ops;
+        other.m_ops = nullptr;
+    }
+
+    void reset()
+    {
+        if (!m_ops) return;
+        m_ops->destroy(m_storage);
+        m_ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[inlineBytes];
+    const Ops* m_ops = nullptr;
+};
+
+template<typename Fn>
+const Task::Ops Task::Inline<Fn>::ops = {
+    &Task::Inline<Fn>::invoke,
+    &Task::Inline<Fn>::move,
+    &Task::Inline<Fn>::destroy
+};
+
+template<typename Fn>
+const Task::Ops Task::Heap<Fn>::ops = {
+    &Task::Heap<Fn>::invoke,
+    &Task::Heap<Fn>::move,
+    &Task::Heap<Fn>::destroy
+};
+
+} // namespace entwine
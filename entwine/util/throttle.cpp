@@ -0,0 +1,93 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/throttle.hpp>
+
+#include <algorithm>
+
+namespace entwine
+{
+
+Throttle::Slot::Slot()
+{
+    Throttle& t(Throttle::get());
+    std::unique_lock<std::mutex> lock(t.m_mutex);
+    t.m_cv.wait(lock, [&t]() { return t.available(); });
+
+    m_epoch = t.m_epoch;
+    ++t.m_active;
+    t.m_peak = std::max(t.m_peak, t.m_active);
+}
+
+Throttle::Slot::~Slot()
+{
+    Throttle& t(Throttle::get());
+    {
+        std::lock_guard<std::mutex> lock(t.m_mutex);
+        --t.m_active;
+    }
+    t.m_cv.notify_all();
+}
+
+void Throttle::Slot::succeeded()
+{
+    Throttle& t(Throttle::get());
+    {
+        std::lock_guard<std::mutex> lock(t.m_mutex);
+        ++t.m_writes;
+
+        if (!t.m_limit) return;
+        t.m_limit += 1.0 / t.m_limit;
+        if (t.m_limit > t.m_peak) t.m_limit = 0;
+    }
+    t.m_cv.notify_all();
+}
+
+void Throttle::Slot::failed(const std::string& error)
+{
+    if (!throttling(error)) return;
+
+    Throttle& t(Throttle::get());
+    std::lock_guard<std::mutex> lock(t.m_mutex);
+    ++t.m_throttled;
+
+    if (m_epoch != t.m_epoch) return;
+
+    const double current(t.m_limit ? t.m_limit : t.m_active);
+    t.m_limit = std::max(1.0, current / 2);
+    ++t.m_epoch;
+    ++t.m_decreases;
+}
+
+bool Throttle::throttling(const std::string& error)
+{
+    for (const std::string s : {
+            "SlowDown", "Throttl", "TooManyRequests", "RequestLimitExceeded",
+            "rateLimitExceeded", "ServerBusy" })
+    {
+        if (error.find(s) != std::string::npos) return true;
+    }
+    return false;
+}
+
+json Throttle::toJson() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return {
+        { "limit", static_cast<uint64_t>(m_limit) },
+        { "active", m_active },
+        { "peak", m_peak },
+        { "writes", m_writes },
+        { "throttled", m_throttled },
+        { "decreases", m_decreases }
+    };
+}
+
+} // namespace entwine
@@ -0,0 +1,87 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// Process-wide control of the number of concurrent writes to remote output,
+// by additive increase and multiplicative decrease.  Writes are unlimited
+// until one is throttled by the remote, at which point the limit is set to
+// half of those in flight.  Each success then raises the limit by the
+// reciprocal of the limit, so about one per round of writes, and once it
+// exceeds the most writes ever in flight the limit is lifted.
+//
+// Only writes begun since the last decrease may cause another, so a burst of
+// throttled writes from the same round halves the limit once.
+class Throttle
+{
+public:
+    static Throttle& get()
+    {
+        static Throttle throttle;
+        return throttle;
+    }
+
+    // Holds a write slot for the lifetime of this object, blocking in its
+    // construction until one is available.  The outcome of the write should
+    // be reported before its destruction.
+    class Slot
+    {
+    public:
+        Slot();
+        ~Slot();
+
+        void succeeded();
+        void failed(const std::string& error);
+
+    private:
+        uint64_t m_epoch = 0;
+
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+    };
+
+    // True if this error from a remote write indicates throttling.
+    static bool throttling(const std::string& error);
+
+    // The current state, for metrics.
+    json toJson() const;
+
+private:
+    Throttle() = default;
+
+    bool available() const
+    {
+        return !m_limit || m_active < static_cast<uint64_t>(m_limit);
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    double m_limit = 0;     // Zero if unlimited.
+    uint64_t m_epoch = 0;   // Incremented on each decrease.
+    uint64_t m_active = 0;
+    uint64_t m_peak = 0;
+
+    uint64_t m_writes = 0;
+    uint64_t m_throttled = 0;
+    uint64_t m_decreases = 0;
+};
+
+} // namespace entwine
@@ -0,0 +1,85 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/tmp-space.hpp>
+
+namespace entwine
+{
+
+void TmpSpace::configure(const uint64_t maxBytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxBytes = maxBytes;
+    }
+    m_cv.notify_all();
+}
+
+TmpSpace::Lease::Lease(const uint64_t bytes)
+    : m_bytes(bytes)
+{
+    TmpSpace& space(TmpSpace::get());
+    std::unique_lock<std::mutex> lock(space.m_mutex);
+    space.m_cv.wait(lock, [this, &space]()
+    {
+        return !space.m_leases || space.fits(m_bytes);
+    });
+
+    ++space.m_leases;
+    space.m_bytes += m_bytes;
+}
+
+TmpSpace::Lease::~Lease()
+{
+    TmpSpace& space(TmpSpace::get());
+    {
+        std::lock_guard<std::mutex> lock(space.m_mutex);
+        --space.m_leases;
+        space.m_bytes -= m_bytes;
+    }
+    space.m_cv.notify_all();
+}
+
+bool TmpSpace::tryCharge(const uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!fits(bytes)) return false;
+    m_bytes += bytes;
+    return true;
+}
+
+void TmpSpace::charge(const uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bytes += bytes;
+}
+
+void TmpSpace::uncharge(const uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytes -= bytes;
+    }
+    m_cv.notify_all();
+}
+
+uint64_t TmpSpace::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+uint64_t TmpSpace::maxBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_maxBytes;
+}
+
+} // namespace entwine
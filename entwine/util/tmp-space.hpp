@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace entwine
+{
+
+// Process-wide accounting of the bytes written to our local tmp directory,
+// against an optional budget.  Localized input files are leased, which blocks
+// while tmp is over budget.  Spills are charged only if they fit, and are
+// otherwise written to the output instead, and transient files are charged
+// unconditionally for their short lifetime.
+//
+// A lease is always granted if no other lease is held, so that however much
+// of tmp is taken by spills, which only shrink as insertion proceeds, one
+// input may still be inserted.
+class TmpSpace
+{
+public:
+    static TmpSpace& get()
+    {
+        static TmpSpace space;
+        return space;
+    }
+
+    // A budget of 0 means no limit.
+    void configure(uint64_t maxBytes);
+
+    // Holds bytes of tmp for the lifetime of this object, blocking in its
+    // construction until they fit.
+    class Lease
+    {
+    public:
+        explicit Lease(uint64_t bytes);
+        ~Lease();
+
+    private:
+        const uint64_t m_bytes;
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+    };
+
+    // Returns false, charging nothing, if these bytes don't fit.
+    bool tryCharge(uint64_t bytes);
+    void charge(uint64_t bytes);
+    void uncharge(uint64_t bytes);
+
+    // Charges bytes for the lifetime of this object, without waiting.
+    class Charge
+    {
+    public:
+        explicit Charge(uint64_t bytes) : m_bytes(bytes)
+        {
+            TmpSpace::get().charge(m_bytes);
+        }
+
+        ~Charge() { TmpSpace::get().uncharge(m_bytes); }
+
+    private:
+        const uint64_t m_bytes;
+
+        Charge(const Charge&) = delete;
+        Charge& operator=(const Charge&) = delete;
+    };
+
+    uint64_t bytes() const;
+    uint64_t maxBytes() const;
+
+private:
+    TmpSpace() = default;
+
+    bool fits(uint64_t bytes) const
+    {
+        return !m_maxBytes || m_bytes + bytes <= m_maxBytes;
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    uint64_t m_maxBytes = 0;
+    uint64_t m_bytes = 0;
+    uint64_t m_leases = 0;
+};
+
+} // namespace entwine
@@ -0,0 +1,102 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/trace.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace entwine
+{
+
+namespace
+{
+    // Small sequential thread IDs read better in trace viewers than hashes
+    // of std::thread::id.
+    std::atomic<uint64_t> nextThread(0);
+
+    uint64_t threadId()
+    {
+        thread_local const uint64_t id(++nextThread);
+        return id;
+    }
+}
+
+void Trace::enable(const uint64_t capacity)
+{
+    if (!capacity) throw std::runtime_error("Invalid trace capacity");
+
+    m_events.reset(new Event[capacity]);
+    m_capacity = capacity;
+    m_next = 0;
+    m_epoch = Clock::now();
+    m_enabled = true;
+}
+
+void Trace::record(
+        const char* name,
+        const bool complete,
+        const uint64_t start,
+        const uint64_t duration,
+        const uint64_t d,
+        const uint64_t x,
+        const uint64_t y,
+        const uint64_t z)
+{
+    Event& e(m_events[m_next.fetch_add(1, std::memory_order_relaxed) %
+            m_capacity]);
+
+    e.name = name;
+    e.start = start;
+    e.duration = duration;
+    e.complete = complete;
+    e.thread = threadId();
+    e.d = d;
+    e.x = x;
+    e.y = y;
+    e.z = z;
+}
+
+uint64_t Trace::dump(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file.good()) throw std::runtime_error("Could not open " + path);
+
+    const uint64_t next(m_next);
+    const uint64_t count(std::min(next, m_capacity));
+    const uint64_t begin(next - count);
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (uint64_t i(begin); i < next; ++i)
+    {
+        const Event& e(m_events[i % m_capacity]);
+        if (i != begin) file << ",";
+
+        file << "\n{\"name\":\"" << e.name << "\",\"cat\":\"chunk\"," <<
+            "\"ph\":\"" << (e.complete ? "X" : "i") << "\"," <<
+            "\"ts\":" << e.start << ",";
+
+        if (e.complete) file << "\"dur\":" << e.duration << ",";
+        else file << "\"s\":\"t\",";
+
+        file << "\"pid\":1,\"tid\":" << e.thread << "," <<
+            "\"args\":{\"key\":\"" <<
+            e.d << "-" << e.x << "-" << e.y << "-" << e.z << "\"}}";
+    }
+
+    file << "\n]}" << std::endl;
+
+    if (!file.good()) throw std::runtime_error("Could not write " + path);
+    return count;
+}
+
+} // namespace entwine
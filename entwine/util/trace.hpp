@@ -0,0 +1,126 @@
+/******************************************************************************
+* Copyright (c) 2019, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace entwine
+{
+
+// An optional process-wide record of chunk lifecycle events, written to a
+// fixed-size ring buffer so the most recent events are retained without any
+// allocation or locking while tracing.  When disabled, recording an event
+// costs a single atomic load.
+//
+// Events are dumped in the Chrome trace event format, which may be viewed
+// with chrome://tracing or Perfetto.
+class Trace
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        // Event names must be string literals, or otherwise outlive the trace.
+        const char* name = nullptr;
+        uint64_t start = 0;     // Microseconds since tracing was enabled.
+        uint64_t duration = 0;
+        bool complete = false;  // False for instantaneous events.
+        uint64_t thread = 0;
+        uint64_t d = 0;
+        uint64_t x = 0;
+        uint64_t y = 0;
+        uint64_t z = 0;
+    };
+
+    static Trace& get()
+    {
+        static Trace trace;
+        return trace;
+    }
+
+    // Begin recording, retaining at most the given number of recent events.
+    // This must not be called while events are being recorded.
+    void enable(uint64_t capacity);
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Record an instantaneous event for the node at depth d and position xyz.
+    void instant(const char* name, uint64_t d, uint64_t x, uint64_t y,
+            uint64_t z)
+    {
+        if (enabled()) record(name, false, now(), 0, d, x, y, z);
+    }
+
+    // Records a single event spanning its construction to its destruction.
+    class Span
+    {
+    public:
+        Span(const char* name, uint64_t d, uint64_t x, uint64_t y, uint64_t z)
+            : m_name(name)
+            , m_start(Trace::get().enabled() ? Trace::get().now() : 0)
+            , m_d(d), m_x(x), m_y(y), m_z(z)
+            , m_active(Trace::get().enabled())
+        { }
+
+        ~Span()
+        {
+            if (!m_active) return;
+            Trace& t(Trace::get());
+            t.record(m_name, true, m_start, t.now() - m_start,
+                    m_d, m_x, m_y, m_z);
+        }
+
+    private:
+        const char* const m_name;
+        const uint64_t m_start;
+        const uint64_t m_d, m_x, m_y, m_z;
+        const bool m_active;
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    };
+
+    // Write the retained events, oldest first, as a Chrome trace JSON file.
+    // This should be called once the traced work has completed.  Returns
+    // the number of events written.
+    uint64_t dump(const std::string& path) const;
+
+private:
+    Trace() = default;
+
+    uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - m_epoch).count();
+    }
+
+    void record(
+            const char* name,
+            bool complete,
+            uint64_t start,
+            uint64_t duration,
+            uint64_t d,
+            uint64_t x,
+            uint64_t y,
+            uint64_t z);
+
+    std::atomic<bool> m_enabled { false };
+    Clock::time_point m_epoch;
+    uint64_t m_capacity = 0;
+    std::unique_ptr<Event[]> m_events;
+    std::atomic<uint64_t> m_next { 0 };
+};
+
+} // namespace entwine
@@ -2,9 +2,25 @@
 #include "config.hpp"
 #include "verify.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <pdal/PointTable.hpp>
+#include <pdal/PointView.hpp>
+#include <pdal/io/BufferReader.hpp>
+#include <pdal/io/LasWriter.hpp>
+
 #include <entwine/builder/builder.hpp>
+#include <entwine/builder/hierarchy.hpp>
 #include <entwine/builder/merger.hpp>
 #include <entwine/builder/scan.hpp>
+#include <entwine/reader/reader.hpp>
+#include <entwine/util/tmp-space.hpp>
+#include <entwine/util/unique.hpp>
 
 using namespace entwine;
 
@@ -40,6 +56,109 @@ namespace
             ASSERT_TRUE(meta.at("metadata").is_object());
         }
     }
+
+    // The XYZ of every point of a build, each packed into a string and
+    // sorted, so that builds holding the same points compare equal.
+    std::vector<std::string> readXyz(const std::string& out)
+    {
+        const Schema s(DimList { DimId::X, DimId::Y, DimId::Z });
+
+        Reader r(out);
+        auto q(r.read(json { { "schema", s } }));
+        q->run();
+
+        const std::vector<char>& data(q->data());
+        std::vector<std::string> points;
+        for (std::size_t i(0); i < data.size(); i += s.pointSize())
+        {
+            points.emplace_back(data.data() + i, s.pointSize());
+        }
+
+        std::sort(points.begin(), points.end());
+        return points;
+    }
+
+    // Writes n copies of a single point to a LAS file.
+    void writeCluster(const std::string& path, const uint64_t n)
+    {
+        pdal::PointTable table;
+        table.layout()->registerDims({ DimId::X, DimId::Y, DimId::Z });
+
+        pdal::PointViewPtr view(new pdal::PointView(table));
+        for (pdal::PointId i(0); i < n; ++i)
+        {
+            view->setField(DimId::X, i, 1.0);
+            view->setField(DimId::Y, i, 1.0);
+            view->setField(DimId::Z, i, 1.0);
+        }
+
+        pdal::BufferReader reader;
+        reader.addView(view);
+
+        pdal::Options options;
+        options.add("filename", path);
+
+        pdal::LasWriter writer;
+        writer.setOptions(options);
+        writer.setInput(reader);
+        writer.prepare(table);
+        writer.execute(table);
+    }
+
+    // The point count of each node of a build.
+    Hierarchy::Map readNodes(const std::string& out)
+    {
+        const Reader r(out);
+        const arbiter::Endpoint ep(a.getEndpoint(out));
+
+        std::mutex mutex;
+        Hierarchy::Map nodes;
+        Hierarchy::read(
+                r.metadata(),
+                ep.getSubEndpoint("ept-hierarchy"),
+                ep.getSubEndpoint("ept-node-stats"),
+                r.metadata().postfix(),
+                [&](const Dxyz& key, const uint64_t np, const NodeStats&)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    nodes[key] = np;
+                });
+        return nodes;
+    }
+
+    uint64_t deepest(const Hierarchy::Map& nodes)
+    {
+        uint64_t depth(0);
+        for (const auto& p : nodes) depth = std::max(depth, p.first.depth());
+        return depth;
+    }
+
+    uint64_t total(const Hierarchy::Map& nodes)
+    {
+        uint64_t np(0);
+        for (const auto& p : nodes) np += p.second;
+        return np;
+    }
+
+    // A build of a cluster of identical points, so dense that each point
+    // past the first few nodes descends a level further than the last.
+    json clusterConfig(const std::string& outPath, const uint64_t n)
+    {
+        const std::string input(outPath + "cluster.las");
+        if (!arbiter::mkdirp(outPath))
+        {
+            throw std::runtime_error("Could not create " + outPath);
+        }
+        writeCluster(input, n);
+
+        return json {
+            { "input", input },
+            { "output", outPath + "ept/" },
+            { "force", true },
+            { "bounds", json::array({ 0, 0, 0, 8, 8, 8 }) },
+            { "span", 8 }
+        };
+    }
 }
 
 TEST(build, basic)
@@ -326,6 +445,52 @@ TEST(build, subset)
     checkSources(outPath);
 }
 
+TEST(build, balancedSubset)
+{
+    const std::string outPath(test::dataPath() + "out/balanced-subset/");
+
+    for (uint64_t i(0); i < 3u; ++i)
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid-multi/" },
+            { "output", outPath },
+            { "force", true },
+            { "span", v.span() },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "subset", {
+                { "id", i + 1 },
+                { "of", 3 },
+                { "balanced", true }
+            } }
+        });
+
+        Builder(c).go();
+
+        const auto build(json::parse(
+                    a.get(outPath + "ept-build-" + std::to_string(i + 1) +
+                        ".json")));
+        const json subset(build.at("subset"));
+        EXPECT_TRUE(subset.at("balanced").get<bool>());
+        EXPECT_LT(
+                subset.at("begin").get<uint64_t>(),
+                subset.at("end").get<uint64_t>());
+    }
+
+    {
+        Config c(json { { "output", outPath } });
+        Merger(c).go();
+    }
+
+    const auto info(json::parse(a.get(outPath + "ept.json")));
+
+    const auto points(info.at("points").get<uint64_t>());
+    EXPECT_EQ(points, v.points());
+
+    EXPECT_EQ(info.at("span").get<uint64_t>(), v.span());
+
+    checkSources(outPath);
+}
+
 TEST(build, invalidSubset)
 {
     const std::string outPath(test::dataPath() + "out/subset/");
@@ -494,3 +659,159 @@ TEST(build, reprojected)
     checkSources(outPath);
 }
 
+
+TEST(build, cesium)
+{
+    const std::string outPath(test::dataPath() + "out/ellipsoid-cesium/");
+
+    Config c(json {
+        { "input", test::dataPath() + "ellipsoid.laz" },
+        { "output", outPath },
+        { "force", true },
+        { "span", v.span() },
+        { "cesium", json::object() }
+    });
+
+    Builder(c).go();
+
+    // The tiles are written during the build, and the tileset afterward.
+    const json tileset(json::parse(a.get(outPath + "cesium/tileset.json")));
+    const auto uri(
+            tileset.at("root").at("content").at("uri").get<std::string>());
+    EXPECT_EQ(uri, "0-0-0-0.pnts");
+
+    const std::vector<char> pnts(a.getBinary(outPath + "cesium/" + uri));
+    ASSERT_GT(pnts.size(), 28u);
+    EXPECT_EQ(std::string(pnts.data(), 4), "pnts");
+
+    uint32_t length(0);
+    std::memcpy(&length, pnts.data() + 8, sizeof(length));
+    EXPECT_EQ(length, pnts.size());
+}
+
+TEST(build, tmpSpace)
+{
+    TmpSpace& space(TmpSpace::get());
+    space.configure(100);
+
+    {
+        // With no other lease held, one is granted even beyond the budget.
+        TmpSpace::Lease big(1000);
+        EXPECT_EQ(space.bytes(), 1000u);
+        EXPECT_FALSE(space.tryCharge(1));
+    }
+    EXPECT_EQ(space.bytes(), 0u);
+
+    auto held(makeUnique<TmpSpace::Lease>(80));
+
+    // Charges only succeed if they fit alongside what's held.
+    EXPECT_FALSE(space.tryCharge(30));
+    EXPECT_EQ(space.bytes(), 80u);
+    EXPECT_TRUE(space.tryCharge(20));
+    EXPECT_EQ(space.bytes(), 100u);
+    space.uncharge(20);
+    EXPECT_EQ(space.bytes(), 80u);
+
+    // A second lease which doesn't fit waits for the first to be released.
+    std::atomic<bool> granted(false);
+    std::thread waiter([&granted]()
+    {
+        TmpSpace::Lease lease(80);
+        granted = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(granted);
+
+    held.reset();
+    waiter.join();
+    EXPECT_TRUE(granted);
+    EXPECT_EQ(space.bytes(), 0u);
+
+    space.configure(0);
+}
+
+TEST(build, spillBudget)
+{
+    const std::string outPath(test::dataPath() + "out/spill-budget/");
+
+    const json base {
+        { "input", test::dataPath() + "ellipsoid-multi/" },
+        { "force", true },
+        { "bounds", v.bounds() },
+        { "span", v.span() },
+        { "dataType", "binary" }
+    };
+
+    json plain(base);
+    plain["output"] = outPath + "plain/";
+    const Config plainConfig(plain);
+    Builder(plainConfig).go();
+
+    // Evicting after every insertion spills constantly, and the budget fits
+    // only some of those spills, so the rest are written to the output.
+    json spilled(base);
+    spilled["output"] = outPath + "spilled/";
+    spilled["tmp"] = outPath + "tmp/";
+    spilled["spill"] = true;
+    spilled["cacheSize"] = 1;
+    spilled["tmpBytes"] = 65536;
+    const Config spilledConfig(spilled);
+    Builder(spilledConfig).go();
+
+    EXPECT_EQ(TmpSpace::get().bytes(), 0u);
+
+    const auto expected(readXyz(outPath + "plain/"));
+    ASSERT_EQ(expected.size(), v.points());
+    EXPECT_EQ(readXyz(outPath + "spilled/"), expected);
+
+    TmpSpace::get().configure(0);
+}
+
+TEST(build, leafDepthLimit)
+{
+    const std::string outPath(test::dataPath() + "out/leaf-depth-limit/");
+    json j(clusterConfig(outPath, 1000));
+
+    // No node may be deeper than PackedDxyz can hold.
+    j["leafDepth"] = PackedDxyz::deepest() + 1;
+    const Config invalid(j);
+    EXPECT_ANY_THROW(Builder(invalid).go());
+
+    // So by default, the cluster stops there rather than failing to pack.
+    j.erase("leafDepth");
+    const Config c(j);
+    Builder(c).go();
+
+    const Hierarchy::Map nodes(readNodes(outPath + "ept/"));
+    EXPECT_EQ(deepest(nodes), PackedDxyz::deepest());
+    EXPECT_EQ(total(nodes), 1000u);
+}
+
+TEST(build, leafPoints)
+{
+    const std::string outPath(test::dataPath() + "out/leaf-points/");
+    json j(clusterConfig(outPath, 1000));
+    j["leafDepth"] = 4;
+    j["leafPoints"] = 16;
+
+    const Config c(j);
+    Builder(c).go();
+
+    // The leaf keeps the one point of its grid, and then its cap.
+    const Hierarchy::Map nodes(readNodes(outPath + "ept/"));
+    ASSERT_EQ(deepest(nodes), 4u);
+    for (const auto& p : nodes)
+    {
+        if (p.first.depth() == 4) EXPECT_EQ(p.second, 17u);
+    }
+
+    const json info(json::parse(a.get(outPath + "ept/ept.json")));
+    const json build(json::parse(a.get(outPath + "ept/ept-build.json")));
+    const uint64_t points(info.at("points").get<uint64_t>());
+    const uint64_t thinned(build.at("thinned").get<uint64_t>());
+
+    EXPECT_EQ(points, total(nodes));
+    EXPECT_GT(thinned, 0u);
+    EXPECT_EQ(points + thinned, 1000u);
+}
@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <entwine/builder/config.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/unique.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    const uint64_t maxDepth(24);
+
+    std::unique_ptr<Metadata> makeMetadata(const Bounds& bounds)
+    {
+        return makeUnique<Metadata>(Config(json {
+            { "bounds", bounds },
+            { "schema", Schema(DimList { DimId::X, DimId::Y, DimId::Z }) },
+            { "dataType", "binary" },
+            { "span", 256 }
+        }));
+    }
+
+    // The points to place: random points within the cube, every corner and
+    // the center, points exactly on and within rounding distance of interior
+    // cell boundaries at several depths, and points beyond the cube.
+    std::vector<Point> makePoints(const Bounds& cube)
+    {
+        std::vector<Point> points;
+
+        std::mt19937 gen(42);
+        std::uniform_real_distribution<double> x(cube.min().x, cube.max().x);
+        std::uniform_real_distribution<double> y(cube.min().y, cube.max().y);
+        std::uniform_real_distribution<double> z(cube.min().z, cube.max().z);
+        for (std::size_t i(0); i < 1000; ++i)
+        {
+            points.emplace_back(x(gen), y(gen), z(gen));
+        }
+
+        for (std::size_t i(0); i < 8; ++i)
+        {
+            points.push_back(cube.get(toDir(i)).min());
+            points.push_back(cube.get(toDir(i)).max());
+        }
+        points.push_back(cube.mid());
+
+        const Point w(cube.max() - cube.min());
+        for (const uint64_t depth : { 1, 3, 9, 17 })
+        {
+            const double cells(std::ldexp(1.0, depth));
+            for (const double k : { 1.0, cells / 2 + 1, cells - 1 })
+            {
+                const Point edge(cube.min() + w * (k / cells));
+                const double nudge(std::ldexp(w.x, -40));
+                points.push_back(edge);
+                points.emplace_back(edge.x - nudge, edge.y, edge.z + nudge);
+                points.emplace_back(edge.x + nudge, edge.y - nudge, edge.z);
+            }
+        }
+
+        points.push_back(cube.min() - w);
+        points.push_back(cube.max() + w);
+
+        return points;
+    }
+
+    // Key::init as it was, bisecting the bounds once per depth.
+    Key bisect(const Metadata& m, const Point& g, const uint64_t depth)
+    {
+        Key key(m);
+        for (uint64_t d(0); d < m.startDepth() + depth; ++d) key.step(g);
+        return key;
+    }
+
+    void check(const Bounds& bounds)
+    {
+        const auto metadata(makeMetadata(bounds));
+        const Metadata& m(*metadata);
+        const Bounds& cube(m.boundsCubic());
+        const std::vector<Point> points(makePoints(cube));
+
+        const double magnitude(
+                std::max(
+                    std::max(std::abs(cube.min().x), std::abs(cube.max().x)),
+                    std::max(
+                        std::max(
+                            std::abs(cube.min().y),
+                            std::abs(cube.max().y)),
+                        std::max(
+                            std::abs(cube.min().z),
+                            std::abs(cube.max().z)))));
+        const double tolerance(magnitude * 1e-13);
+
+        Key key(m);
+        for (uint64_t depth(0); depth <= maxDepth; ++depth)
+        {
+            for (const Point& g : points)
+            {
+                key.init(g, depth);
+                const Key expected(bisect(m, g, depth));
+
+                ASSERT_EQ(key.d, expected.d);
+                ASSERT_EQ(key.position(), expected.position()) <<
+                    "Point " << g << " at depth " << depth;
+
+                const Bounds& a(key.bounds());
+                const Bounds& b(expected.bounds());
+                for (std::size_t i(0); i < 6; ++i)
+                {
+                    ASSERT_NEAR(a[i], b[i], tolerance) <<
+                        "Point " << g << " at depth " << depth;
+                }
+            }
+        }
+    }
+}
+
+TEST(key, initMatchesBisection)
+{
+    check(Bounds(0, 0, 0, 100, 100, 100));
+}
+
+TEST(key, initMatchesBisectionAwayFromOrigin)
+{
+    check(Bounds(-8242746, 4966506, -50, -8242446, 4966706, 50));
+    check(Bounds(580621, 4504618, -50, 580850, 4504771, 50));
+    check(Bounds(1e7, 1e7, 1e3, 1e7 + 1, 1e7 + 1, 1e3 + 1));
+}
+
+TEST(key, quantizeMatchesInit)
+{
+    const auto metadata(
+            makeMetadata(Bounds(580621, 4504618, -50, 580850, 4504771, 50)));
+    const Metadata& m(*metadata);
+    const Bounds& cube(m.boundsCubic());
+    const std::vector<Point> points(makePoints(cube));
+    const std::size_t n(points.size());
+
+    std::vector<double> xs(n);
+    for (std::size_t i(0); i < n; ++i) xs[i] = points[i].x;
+
+    Key key(m);
+    for (uint64_t depth(0); depth <= maxDepth; ++depth)
+    {
+        std::vector<uint64_t> cells(n);
+        std::vector<uint8_t> exact(n, 1);
+        Key::quantize(
+                xs.data(),
+                n,
+                cube.min().x,
+                cube.max().x,
+                m.startDepth() + depth,
+                cells.data(),
+                exact.data());
+
+        // Values trusted by the batch quantization land where init puts them.
+        for (std::size_t i(0); i < n; ++i)
+        {
+            if (!exact[i]) continue;
+            key.init(points[i], depth);
+            ASSERT_EQ(cells[i], key.position().x) <<
+                "Point " << points[i] << " at depth " << depth;
+        }
+    }
+}
@@ -3,12 +3,47 @@
 #include "config.hpp"
 #include "verify.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
 #include <entwine/builder/builder.hpp>
 #include <entwine/reader/reader.hpp>
 
 namespace
 {
     const Verify v;
+
+    // The points of data packed as XYZ doubles.
+    std::vector<Point> toXyz(const std::vector<char>& data)
+    {
+        const std::size_t size(sizeof(double));
+        std::vector<Point> points;
+        for (std::size_t i(0); i < data.size(); i += size * 3)
+        {
+            Point p;
+            std::memcpy(&p.x, data.data() + i, size);
+            std::memcpy(&p.y, data.data() + i + size, size);
+            std::memcpy(&p.z, data.data() + i + size * 2, size);
+            points.push_back(p);
+        }
+        return points;
+    }
+
+    double sqDistance(const Point& a, const Point& b, bool xy)
+    {
+        const double dx(a.x - b.x);
+        const double dy(a.y - b.y);
+        const double dz(xy ? 0 : a.z - b.z);
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    double distance(const Point& a, const Point& b, bool xy)
+    {
+        return std::sqrt(sqDistance(a, b, xy));
+    }
 }
 
 TEST(read, count)
@@ -124,3 +159,327 @@ TEST(read, filter)
 {
 }
 
+
+TEST(read, nodeStats)
+{
+    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+    const json filter { { "Z", { { "$gt", 0 } } } };
+
+    const auto build([&out](const json& stats)
+    {
+        json j {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "span", v.span() }
+        };
+        if (!stats.is_null()) j["nodeStats"] = stats;
+
+        Builder b{Config(j)};
+        b.go();
+    });
+
+    const auto count([&out, &filter]()
+    {
+        Reader r(out);
+        auto q(r.count(json { { "filter", filter } }));
+        q->run();
+        return q->points();
+    });
+
+    build(json());
+    const uint64_t expected(count());
+
+    // Pruning by node stats must not change the result.
+    build(json::array({ "Z" }));
+    {
+        Reader r(out);
+        EXPECT_EQ(r.metadata().nodeStats().size(), 1u);
+        EXPECT_TRUE(r.ep().tryGet("ept-node-stats/0-0-0-0.json"));
+    }
+    EXPECT_EQ(count(), expected);
+}
+
+TEST(read, columnar)
+{
+    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "span", v.span() }
+        });
+
+        Builder b(c);
+        b.go();
+    }
+
+    Reader r(out);
+
+    const Schema schema(DimList { DimId::X, DimId::Y, DimId::Z });
+    const std::size_t pointSize(schema.pointSize());
+    const std::size_t dimSize(sizeof(double));
+
+    auto rowQuery(r.read(json { { "schema", schema } }));
+    rowQuery->run();
+    const std::vector<char>& rows(rowQuery->data());
+
+    auto columnQuery(
+            r.read(json { { "schema", schema }, { "columnar", true } }));
+    columnQuery->run();
+    const std::vector<char>& columns(columnQuery->data());
+
+    ASSERT_EQ(rows.size(), v.points() * pointSize);
+    ASSERT_EQ(columns.size(), rows.size());
+
+    // Points arrive in the same order either way, so the columnar result is
+    // exactly the transposition of the row-wise one.
+    const uint64_t np(v.points());
+    for (uint64_t i(0); i < np; ++i)
+    {
+        for (std::size_t d(0); d < 3; ++d)
+        {
+            const char* row(rows.data() + i * pointSize + d * dimSize);
+            const char* col(columns.data() + (d * np + i) * dimSize);
+            ASSERT_TRUE(std::equal(row, row + dimSize, col));
+        }
+    }
+}
+
+TEST(read, streamed)
+{
+    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "span", v.span() }
+        });
+
+        Builder b(c);
+        b.go();
+    }
+
+    Reader r(out);
+
+    const Schema schema(DimList { DimId::X, DimId::Y, DimId::Z });
+    const json j { { "schema", schema } };
+
+    auto whole(r.read(j));
+    whole->run();
+
+    std::vector<char> streamed;
+    uint64_t points(0);
+    uint64_t calls(0);
+
+    auto q(r.read(j, [&](const std::vector<char>& data, uint64_t np)
+    {
+        EXPECT_EQ(data.size(), np * schema.pointSize());
+        streamed.insert(streamed.end(), data.begin(), data.end());
+        points += np;
+        ++calls;
+    }));
+    q->run();
+
+    EXPECT_TRUE(q->data().empty());
+    EXPECT_GT(calls, 1u);
+    EXPECT_EQ(points, v.points());
+    EXPECT_EQ(streamed, whole->data());
+}
+
+TEST(read, budget)
+{
+    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "span", v.span() }
+        });
+
+        Builder b(c);
+        b.go();
+    }
+
+    Reader r(out);
+
+    // Without a binding budget, every point is selected.
+    {
+        auto q(r.count(json { { "budget", v.points() } }));
+        q->run();
+        EXPECT_EQ(q->points(), v.points());
+    }
+
+    // Otherwise the selection stays within the budget, and a larger budget
+    // selects at least as much.
+    const uint64_t budget(v.points() / 4);
+    auto small(r.count(json { { "budget", budget } }));
+    small->run();
+    EXPECT_GT(small->points(), 0u);
+    EXPECT_LE(small->points(), budget);
+
+    auto large(r.count(json { { "budget", budget * 2 } }));
+    large->run();
+    EXPECT_GE(large->points(), small->points());
+    EXPECT_LE(large->points(), budget * 2);
+}
+
+TEST(read, subBlocks)
+{
+    const std::string whole(test::dataPath() + "out/ellipsoid/binary");
+    const std::string split(test::dataPath() + "out/ellipsoid/sub-blocks");
+
+    for (const std::string& out : { whole, split })
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "dataType", "binary" },
+            { "subBlockDepth", out == split ? 2 : 0 },
+            { "span", v.span() }
+        });
+
+        Builder b(c);
+        b.go();
+    }
+
+    Reader a(whole);
+    Reader b(split);
+    EXPECT_TRUE(arbiter::Arbiter().exists(split + "/ept-data/0-0-0-0.idx"));
+
+    // Partial reads of small regions select exactly the points that whole
+    // reads would.
+    const Bounds& cube(a.metadata().boundsCubic());
+    const Bounds small(cube.get(toDir(0)).get(toDir(7)).get(toDir(3)));
+
+    const json q { { "bounds", small } };
+    auto x(a.read(q));
+    auto y(b.read(q));
+    x->run();
+    y->run();
+
+    EXPECT_GT(x->points(), 0u);
+    EXPECT_EQ(x->points(), y->points());
+    EXPECT_EQ(x->data().size(), y->data().size());
+
+    auto all(b.count(json::object()));
+    all->run();
+    EXPECT_EQ(all->points(), v.points());
+}
+
+TEST(read, knn)
+{
+    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+
+    {
+        Config c(json {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out },
+            { "force", true },
+            { "hierarchyStep", v.hierarchyStep() },
+            { "span", v.span() }
+        });
+
+        Builder b(c);
+        b.go();
+    }
+
+    Reader r(out);
+    const Schema schema(DimList { DimId::X, DimId::Y, DimId::Z });
+
+    auto whole(r.read(json { { "schema", schema } }));
+    whole->run();
+    const std::vector<Point> all(toXyz(whole->data()));
+    ASSERT_EQ(all.size(), v.points());
+
+    // The distances of the k nearest points by brute force, nearest first.
+    // Distances are limited as squares, as the query does.
+    const auto nearest([&all](
+                const Point& p,
+                uint64_t k,
+                double maxDistance,
+                bool xy)
+    {
+        const double maxSqDist(std::pow(maxDistance, 2));
+        std::vector<double> d;
+        for (const Point& q : all)
+        {
+            const double sq(sqDistance(q, p, xy));
+            if (sq <= maxSqDist) d.push_back(std::sqrt(sq));
+        }
+        std::sort(d.begin(), d.end());
+        if (d.size() > k) d.resize(k);
+        return d;
+    });
+
+    // Ties may be broken either way, so only the distances must match, along
+    // with those of the points actually returned.
+    const double unlimited(std::numeric_limits<double>::max());
+    const auto check([&](const Point& p, uint64_t k, json j)
+    {
+        const bool xy(j.value("2d", false));
+        const double maxDistance(j.value("maxDistance", unlimited));
+
+        j["point"] = p;
+        j["k"] = k;
+        j["schema"] = schema;
+
+        auto q(r.knn(j));
+        q->run();
+
+        const std::vector<double> expected(nearest(p, k, maxDistance, xy));
+        const std::vector<double>& distances(q->distances());
+        const std::vector<Point> found(toXyz(q->data()));
+
+        EXPECT_EQ(q->points(), expected.size()) << j.dump();
+        EXPECT_EQ(found.size(), expected.size()) << j.dump();
+        const std::size_t n(std::min(found.size(), expected.size()));
+        for (std::size_t i(0); i < n; ++i)
+        {
+            EXPECT_NEAR(distances[i], expected[i], 1e-9) << j.dump();
+            EXPECT_NEAR(distance(found[i], p, xy), distances[i], 1e-9);
+        }
+        return distances;
+    });
+
+    const Bounds& cube(r.metadata().boundsCubic());
+    const std::vector<Point> targets {
+        cube.mid(),
+        all[all.size() / 3],
+        Point(cube.max().x + 10, cube.mid().y, cube.mid().z)
+    };
+
+    for (const Point& p : targets)
+    {
+        // Best-first traversal stops once no node can hold anything nearer,
+        // at any k, including k larger than a single node.
+        for (const uint64_t k : { 1u, 10u, 2000u })
+        {
+            check(p, k, json::object());
+            check(p, k, json { { "2d", true } });
+        }
+
+        // A maximum distance may leave fewer than k.
+        const double within(nearest(p, 50, unlimited, false).back());
+        const auto limited(check(p, 500, json { { "maxDistance", within } }));
+        EXPECT_GT(limited.size(), 0u);
+        EXPECT_LT(limited.size(), 500u);
+
+        const double withinXy(nearest(p, 50, unlimited, true).back());
+        check(p, 500, json { { "maxDistance", withinXy }, { "2d", true } });
+    }
+
+    // An empty result is fine.
+    EXPECT_TRUE(check(cube.mid(), 0, json::object()).empty());
+}
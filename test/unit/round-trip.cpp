@@ -0,0 +1,663 @@
+#include "gtest/gtest.h"
+
+#include "config.hpp"
+#include "verify.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include <pdal/io/LasReader.hpp>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/combiner.hpp>
+#include <entwine/builder/compactor.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/transcoder.hpp>
+#include <entwine/io/hierarchy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/zstandard-dictionary.hpp>
+#include <entwine/reader/reader.hpp>
+#include <entwine/types/binary-point-table.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    const arbiter::Arbiter a;
+    const Verify v;
+
+    const std::string outPath(test::dataPath() + "out/round-trip/");
+
+    // The dimensions compared after each round trip, read back as doubles.
+    const Schema schema(DimList {
+        DimId::X,
+        DimId::Y,
+        DimId::Z,
+        DimId::Intensity,
+        DimId::ReturnNumber,
+        DimId::NumberOfReturns,
+        DimId::Classification,
+        DimId::GpsTime,
+        DimId::Red,
+        DimId::Green,
+        DimId::Blue
+    });
+
+    using Points = std::vector<std::vector<double>>;
+
+    // Builds the multi-file ellipsoid to the given output, with the given
+    // settings applied over our defaults.  The bounds are explicit so that
+    // every such build, however its input is split, has the same tree.
+    void build(const std::string& out, const json& settings = json::object())
+    {
+        json j {
+            { "input", test::dataPath() + "ellipsoid-multi/" },
+            { "output", out },
+            { "force", true },
+            { "bounds", v.bounds() },
+            { "span", v.span() },
+            { "hierarchyStep", v.hierarchyStep() }
+        };
+        j.update(settings);
+
+        const Config c(j);
+        Builder(c).go();
+    }
+
+    // Our dimensions of each point in some packed data, sorted so that
+    // datasets holding the same points compare equal however they store them.
+    Points toPoints(const Schema& s, std::vector<char> data)
+    {
+        Points points;
+        BinaryPointTable table(s);
+        for (std::size_t i(0); i < data.size(); i += s.pointSize())
+        {
+            table.setPoint(data.data() + i);
+
+            std::vector<double> point;
+            for (const DimInfo& d : s.dims())
+            {
+                point.push_back(table.ref().getFieldAs<double>(d.id()));
+            }
+            points.push_back(point);
+        }
+
+        std::sort(points.begin(), points.end());
+        return points;
+    }
+
+    Points readAll(const std::string& out, const Schema& s = schema)
+    {
+        Reader r(out);
+        auto q(r.read(json { { "schema", s } }));
+        q->run();
+        return toPoints(s, q->data());
+    }
+
+    // Every point of the ellipsoid, stored as uncompressed binary.
+    const Points& reference()
+    {
+        static const Points points([]()
+        {
+            const std::string out(outPath + "reference/");
+            build(out, json { { "dataType", "binary" } });
+            return readAll(out);
+        }());
+        return points;
+    }
+
+    // Every point of the ellipsoid, stored as laszip.
+    const std::string& laszip()
+    {
+        static const std::string out([]()
+        {
+            const std::string out(outPath + "laszip/");
+            build(out, json { { "dataType", "laszip" } });
+            return out;
+        }());
+        return out;
+    }
+
+    // Our dimensions of each point of a LAZ file, as read by PDAL.
+    Points pdalPoints(const std::string& path)
+    {
+        pdal::Options options;
+        options.add("filename", path);
+
+        pdal::LasReader reader;
+        reader.setOptions(options);
+
+        pdal::PointTable table;
+        reader.prepare(table);
+        const pdal::PointViewSet views(reader.execute(table));
+
+        Points points;
+        for (const pdal::PointViewPtr& view : views)
+        {
+            for (pdal::PointId i(0); i < view->size(); ++i)
+            {
+                std::vector<double> point;
+                for (const DimInfo& d : schema.dims())
+                {
+                    point.push_back(view->getFieldAs<double>(d.id(), i));
+                }
+                points.push_back(point);
+            }
+        }
+
+        std::sort(points.begin(), points.end());
+        return points;
+    }
+
+    // The point count of each node of a dataset.
+    Hierarchy::Map readHierarchy(const Reader& r, const std::string& out)
+    {
+        const arbiter::Endpoint ep(a.getEndpoint(out));
+
+        std::mutex mutex;
+        Hierarchy::Map nodes;
+        Hierarchy::read(
+                r.metadata(),
+                ep.getSubEndpoint("ept-hierarchy"),
+                ep.getSubEndpoint("ept-node-stats"),
+                r.metadata().postfix(),
+                [&](const Dxyz& key, const uint64_t np, const NodeStats&)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    nodes[key] = np;
+                });
+        return nodes;
+    }
+
+    uint32_t getU32(const std::vector<char>& data, std::size_t offset)
+    {
+        uint32_t v(0);
+        std::memcpy(&v, data.data() + offset, sizeof(v));
+        return v;
+    }
+
+    // The JSON chunk of a glb tile, or the feature table JSON of a pnts tile.
+    // Either way its length is the fourth word, and the JSON follows the
+    // remainder of the header.
+    json tileJson(const std::vector<char>& tile, bool glb)
+    {
+        const std::size_t offset(glb ? 20 : 28);
+        const std::size_t size(getU32(tile, 12));
+        return json::parse(tile.data() + offset, tile.data() + offset + size);
+    }
+
+#ifdef ENTWINE_HAVE_LASZIP
+    // Our dimensions of each point of a LAZ file, decoded from memory by our
+    // own laszip reader into a table of the given capacity.
+    Points lazPoints(
+            const Metadata& m,
+            const std::string& path,
+            std::size_t capacity)
+    {
+        const std::vector<char> stored(a.getBinary(path));
+        const auto io(DataIo::create(m, "laszip"));
+
+        std::vector<char> data;
+        VectorPointTable table(schema, capacity);
+        table.setProcess([&]()
+        {
+            const auto begin(table.data().begin());
+            data.insert(
+                    data.end(),
+                    begin,
+                    begin + table.numPoints() * schema.pointSize());
+        });
+        io->decode(stored, table);
+
+        return toPoints(schema, data);
+    }
+#endif
+
+#ifdef ENTWINE_HAVE_ZSTD
+    // Whether a Zstandard frame names the dictionary it was compressed with,
+    // by the dictionary ID flag of the descriptor following its magic number.
+    bool usesDictionary(const std::vector<char>& frame)
+    {
+        return frame.size() > 4 && (frame[4] & 0x03);
+    }
+#endif
+}
+
+TEST(roundTrip, binaryHierarchy)
+{
+    const std::string jsonOut(outPath + "json-hierarchy/");
+    const std::string binaryOut(outPath + "binary-hierarchy/");
+
+    build(jsonOut, json { { "dataType", "binary" } });
+    build(binaryOut, json {
+        { "dataType", "binary" },
+        { "hierarchyType", "binary" }
+    });
+
+    ASSERT_TRUE(a.tryGetSize(binaryOut + "ept-hierarchy/0-0-0-0.zst"));
+
+    const HierarchyPage page(
+            hierarchy::read(
+                a.getEndpoint(binaryOut + "ept-hierarchy/"),
+                "0-0-0-0",
+                "binary"));
+    ASSERT_FALSE(page.empty());
+    EXPECT_EQ(
+            page,
+            hierarchy::read(
+                a.getEndpoint(jsonOut + "ept-hierarchy/"),
+                "0-0-0-0",
+                "json"));
+
+    const Points points(readAll(binaryOut));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
+
+TEST(roundTrip, packed)
+{
+    const std::string out(outPath + "packed/");
+    build(out, json { { "dataType", "binary" }, { "packed", true } });
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
+
+TEST(roundTrip, sorted)
+{
+    // Small runs spill several sorted runs to tmp, which are then merged.
+    const std::string out(outPath + "sorted/");
+    build(out, json {
+        { "dataType", "binary" },
+        { "engine", "sort" },
+        { "sortRunBytes", 262144 }
+    });
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+    const json meta(json::parse(a.get(out + "ept.json")));
+    EXPECT_EQ(meta.at("points").get<uint64_t>(), v.points());
+}
+
+TEST(roundTrip, spill)
+{
+    // With room for a single chunk, every chunk the overlapping inputs
+    // share is spilled and reawakened over and over, and the rest are
+    // written from their spills at the end.
+    const std::string out(outPath + "spill/");
+    const std::string tmp(outPath + "spill-tmp/");
+    build(out, json {
+        { "dataType", "binary" },
+        { "spill", true },
+        { "cacheSize", 1 },
+        { "tmp", tmp }
+    });
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+    EXPECT_TRUE(a.resolve(tmp + "*.spill").empty());
+}
+
+TEST(roundTrip, columnar)
+{
+    const std::string out(outPath + "columnar/");
+    build(out, json { { "dataType", "columnar" } });
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+    // A projection fetches and decodes only its own columns.
+    const Schema projection(DimList {
+        DimId::Z,
+        DimId::Classification,
+        DimId::GpsTime
+    });
+    reference();
+    EXPECT_EQ(
+            readAll(out, projection),
+            readAll(outPath + "reference/", projection));
+}
+
+#ifdef ENTWINE_HAVE_ZSTD
+TEST(roundTrip, zstandardDictionary)
+{
+    // Padding each point with empty dimensions gives us enough samples to
+    // train a dictionary partway through the build, so our output holds
+    // frames written both before and after training.
+    Schema padded(schema);
+    for (int i(0); i < 32; ++i)
+    {
+        padded = padded.append(DimInfo("Pad" + std::to_string(i), "double"));
+    }
+
+    const std::string out(outPath + "zstandard-dictionary/");
+    build(out, json {
+        { "dataType", "zstandard-dictionary" },
+        { "schema", padded },
+        { "span", 16 }
+    });
+
+    ASSERT_TRUE(a.tryGetSize(out + ZstandardDictionary::filename()));
+
+    uint64_t plain(0);
+    uint64_t trained(0);
+    for (const std::string& node : a.resolve(out + "ept-data/*.zst"))
+    {
+        if (usesDictionary(a.getBinary(node))) ++trained;
+        else ++plain;
+    }
+    EXPECT_GT(plain, 0u);
+    EXPECT_GT(trained, 0u);
+
+    // Our reader's fresh metadata loads the dictionary to decode them.
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
+#endif
+
+TEST(roundTrip, packNodes)
+{
+    const std::string out(outPath + "pack-nodes/");
+    build(out, json { { "dataType", "binary" }, { "packNodes", true } });
+
+    // Local node files are replaced by their hierarchy file's blob.
+    EXPECT_TRUE(a.tryGetSize(out + "ept-data/0-0-0-0.pack"));
+    EXPECT_TRUE(a.tryGetSize(out + "ept-hierarchy/0-0-0-0.pack.json"));
+    EXPECT_FALSE(a.tryGetSize(out + "ept-data/0-0-0-0.bin"));
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
+
+TEST(roundTrip, laszip)
+{
+    const std::string out(laszip());
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+#ifdef ENTWINE_HAVE_LASZIP
+    // Each node decoded by LASzip directly matches PDAL's reading of it.
+    const Reader r(out);
+    const auto nodes(a.resolve(out + "ept-data/*.laz"));
+    ASSERT_FALSE(nodes.empty());
+
+    for (const std::string& node : nodes)
+    {
+        const Points expected(pdalPoints(node));
+        ASSERT_FALSE(expected.empty());
+        EXPECT_EQ(lazPoints(r.metadata(), node, 4096), expected) << node;
+    }
+#endif
+}
+
+#ifdef ENTWINE_HAVE_LASZIP
+TEST(roundTrip, laszipLargeNode)
+{
+    // Into a table holding all of its points, a file spanning several LASzip
+    // chunks is decoded concurrently by chunk.  Otherwise it is decoded in
+    // sequence, a table at a time.
+    const std::string path(test::dataPath() + "ellipsoid.laz");
+    const Reader r(laszip());
+
+    const Points expected(pdalPoints(path));
+    ASSERT_EQ(expected.size(), v.points());
+
+    EXPECT_EQ(lazPoints(r.metadata(), path, v.points()), expected);
+    EXPECT_EQ(lazPoints(r.metadata(), path, 4096), expected);
+}
+#endif
+
+TEST(roundTrip, las14)
+{
+    const std::string out(outPath + "las14/");
+    build(out, json { { "dataType", "laszip" }, { "las14", true } });
+
+    // The version follows the signature and project fields of the header.
+    const std::vector<char> root(a.getBinary(out + "ept-data/0-0-0-0.laz"));
+    ASSERT_GT(root.size(), 26u);
+    EXPECT_EQ(root[24], 1);
+    EXPECT_EQ(root[25], 4);
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+    // A projection decompresses only the layers it needs.
+    const Schema projection(DimList {
+        DimId::Z,
+        DimId::Classification,
+        DimId::GpsTime
+    });
+    reference();
+    EXPECT_EQ(
+            readAll(out, projection),
+            readAll(outPath + "reference/", projection));
+
+#ifdef ENTWINE_HAVE_LASZIP
+    const Reader r(out);
+    for (const std::string& node : a.resolve(out + "ept-data/*.laz"))
+    {
+        EXPECT_EQ(lazPoints(r.metadata(), node, 4096), pdalPoints(node))
+            << node;
+    }
+#endif
+}
+
+TEST(roundTrip, cesiumImplicit)
+{
+    const std::string out(outPath + "cesium-implicit/");
+    build(out, json {
+        { "dataType", "binary" },
+        { "cesium", { { "implicit", true } } }
+    });
+
+    const json tileset(json::parse(a.get(out + "cesium/tileset.json")));
+    const json root(tileset.at("root"));
+    ASSERT_TRUE(root.count("implicitTiling"));
+    EXPECT_EQ(
+            root.at("content").at("uri").get<std::string>(),
+            "{level}-{x}-{y}-{z}.pnts");
+    EXPECT_TRUE(a.tryGetSize(out + "cesium/subtrees/0-0-0-0.subtree"));
+
+    // Every point lands in exactly one tile.
+    uint64_t np(0);
+    for (const std::string& path : a.resolve(out + "cesium/*.pnts"))
+    {
+        const std::vector<char> tile(a.getBinary(path));
+        ASSERT_GT(tile.size(), 28u);
+        ASSERT_EQ(std::string(tile.data(), 4), "pnts");
+        np += tileJson(tile, false).at("POINTS_LENGTH").get<uint64_t>();
+    }
+    EXPECT_EQ(np, v.points());
+}
+
+TEST(roundTrip, cesiumGlb)
+{
+    for (const bool meshopt : { true, false })
+    {
+        const std::string out(
+                outPath + "cesium-glb-" + (meshopt ? "meshopt" : "raw") + "/");
+        build(out, json {
+            { "dataType", "binary" },
+            { "cesium", {
+                { "tileFormat", "glb" },
+                { "implicit", true },
+                { "meshopt", meshopt }
+            } }
+        });
+
+        // Every point lands in exactly one tile.
+        uint64_t np(0);
+        for (const std::string& path : a.resolve(out + "cesium/*.glb"))
+        {
+            const std::vector<char> tile(a.getBinary(path));
+            ASSERT_GT(tile.size(), 20u);
+            ASSERT_EQ(std::string(tile.data(), 4), "glTF");
+            EXPECT_EQ(getU32(tile, 8), tile.size());
+
+            const json j(tileJson(tile, true));
+            EXPECT_EQ(j.count("extensionsUsed"), meshopt ? 1u : 0u);
+
+            const json& accessors(j.at("accessors"));
+            for (const json& mesh : j.at("meshes"))
+            {
+                for (const json& primitive : mesh.at("primitives"))
+                {
+                    const uint64_t position(
+                            primitive.at("attributes").at("POSITION"));
+                    np += accessors.at(position).at("count").get<uint64_t>();
+                }
+            }
+        }
+        EXPECT_EQ(np, v.points());
+    }
+}
+
+TEST(roundTrip, dedup)
+{
+    // Two identical copies of the ellipsoid deduplicate to a single one.
+    const std::string in(outPath + "dedup-input/");
+    ASSERT_TRUE(arbiter::mkdirp(in));
+    a.copy(test::dataPath() + "ellipsoid.laz", in + "a.laz");
+    a.copy(test::dataPath() + "ellipsoid.laz", in + "b.laz");
+
+    const std::string single(outPath + "dedup-single/");
+    build(single, json {
+        { "input", test::dataPath() + "ellipsoid.laz" },
+        { "dataType", "binary" },
+        { "dedup", "xyz" }
+    });
+
+    const std::string doubled(outPath + "dedup-doubled/");
+    build(doubled, json {
+        { "input", json::array({ in + "a.laz", in + "b.laz" }) },
+        { "dataType", "binary" },
+        { "dedup", "xyz" }
+    });
+
+    const Points expected(readAll(single));
+    ASSERT_GT(expected.size(), 0u);
+
+    const Points points(readAll(doubled));
+    EXPECT_EQ(points, expected);
+
+    const json meta(json::parse(a.get(doubled + "ept.json")));
+    EXPECT_EQ(meta.at("points").get<uint64_t>(), points.size());
+}
+
+TEST(roundTrip, dataPrefixes)
+{
+    const std::string out(outPath + "data-prefixes/");
+    build(out, json { { "dataType", "binary" }, { "dataPrefixes", 16 } });
+
+    const Reader r(out);
+    const std::string name(r.metadata().dataName(Dxyz(0, 0, 0, 0)));
+    EXPECT_NE(name, "0-0-0-0");
+    EXPECT_TRUE(a.tryGetSize(out + "ept-data/" + name + ".bin"));
+    EXPECT_FALSE(a.tryGetSize(out + "ept-data/0-0-0-0.bin"));
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
+
+TEST(roundTrip, transcode)
+{
+    std::vector<std::string> types { "binary", "zstandard", "columnar" };
+#ifdef ENTWINE_HAVE_ZSTD
+    types.push_back("zstandard-dictionary");
+#endif
+
+    for (const std::string& type : types)
+    {
+        const std::string out(outPath + "transcode-" + type + "/");
+        const Config c(json {
+            { "input", laszip() },
+            { "output", out },
+            { "dataType", type }
+        });
+        Transcoder(c).go();
+
+        const Points points(readAll(out));
+        ASSERT_EQ(points.size(), v.points()) << type;
+        EXPECT_EQ(points, reference()) << type;
+    }
+}
+
+TEST(roundTrip, compact)
+{
+    // Nodes may hold up to a point per voxel of their grid, well past this
+    // maxNodeSize, so compaction both splits nodes and folds leaves.
+    const std::string out(outPath + "compact/");
+    build(out, json {
+        { "dataType", "binary" },
+        { "minNodeSize", 128 },
+        { "maxNodeSize", 512 }
+    });
+
+    const Config c(json { { "output", out } });
+    Compactor(c).go();
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+
+    // Each node's count matches its data, and folded nodes are removed.
+    const Reader r(out);
+    const Hierarchy::Map nodes(readHierarchy(r, out));
+    const uint64_t pointSize(r.metadata().outSchema().pointSize());
+
+    uint64_t total(0);
+    uint64_t count(0);
+    for (const auto& p : nodes)
+    {
+        if (!p.second) continue;
+        ++count;
+
+        const std::string name(r.metadata().dataName(p.first) + ".bin");
+        const auto size(a.tryGetSize(out + "ept-data/" + name));
+        ASSERT_TRUE(size) << name;
+        EXPECT_EQ(*size, p.second * pointSize) << name;
+        total += p.second;
+    }
+    EXPECT_EQ(total, v.points());
+    EXPECT_EQ(a.resolve(out + "ept-data/*.bin").size(), count);
+}
+
+TEST(roundTrip, combine)
+{
+    // The northern and southern halves of the ellipsoid, built separately.
+    const std::string dir(test::dataPath() + "ellipsoid-multi/");
+    json halves(json::array());
+    for (const std::string half : { "n", "s" })
+    {
+        json input(json::array());
+        for (const std::string rest : { "ed", "eu", "wd", "wu" })
+        {
+            input.push_back(dir + half + rest + ".laz");
+        }
+
+        const std::string out(outPath + "combine-" + half + "/");
+        build(out, json { { "input", input }, { "dataType", "binary" } });
+        halves.push_back(out);
+    }
+
+    const std::string out(outPath + "combined/");
+    const Config c(json { { "input", halves }, { "output", out } });
+    Combiner(c).go();
+
+    const Points points(readAll(out));
+    ASSERT_EQ(points.size(), v.points());
+    EXPECT_EQ(points, reference());
+}
@@ -307,3 +307,26 @@ TEST(scan, outputFile)
     EXPECT_EQ(out.srs().wkt(), expFile->srs);
 }
 
+
+TEST(scan, cached)
+{
+    const std::string outPath(test::dataPath() + "out/scan-cache/");
+    json in {
+        { "input", test::dataPath() + "ellipsoid-multi" },
+        { "output", outPath },
+        { "force", true }
+    };
+
+    const Config first(Scan(in).go());
+    EXPECT_TRUE(arbiter::Arbiter().tryGetSize(outPath + "scan-cache.json"));
+
+    // Without force, every result is reused from the previous scan.
+    in.erase("force");
+    const Config second(Scan(in).go());
+
+    EXPECT_EQ(second.bounds(), first.bounds());
+    EXPECT_EQ(second.points(), first.points());
+    EXPECT_EQ(second.schema(), first.schema());
+    EXPECT_EQ(second.srs().wkt(), first.srs().wkt());
+    EXPECT_EQ(second.input().size(), first.input().size());
+}